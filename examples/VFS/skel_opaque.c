@@ -178,6 +178,37 @@ static void skel_rewind_dir(vfs_handle_struct *handle, DIR *dirp)
 	;
 }
 
+struct skel_nsop_state {
+	uint8_t dummy;
+};
+
+static struct tevent_req *skel_nsop_send(TALLOC_CTX *mem_ctx,
+					 struct tevent_context *ev)
+{
+	struct tevent_req *req = NULL;
+	struct skel_nsop_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state, struct skel_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	tevent_req_error(req, ENOSYS);
+	return tevent_req_post(req, ev);
+}
+
+static int skel_nsop_recv(struct tevent_req *req,
+			  struct vfs_aio_state *aio_state)
+{
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	tevent_req_received(req);
+	return 0;
+}
+
 static int skel_mkdirat(vfs_handle_struct *handle,
 		struct files_struct *dirfsp,
 		const struct smb_filename *smb_fname,
@@ -187,6 +218,16 @@ static int skel_mkdirat(vfs_handle_struct *handle,
 	return -1;
 }
 
+static struct tevent_req *skel_mkdirat_send(TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct vfs_handle_struct *handle,
+					    struct files_struct *dirfsp,
+					    const struct smb_filename *smb_fname,
+					    mode_t mode)
+{
+	return skel_nsop_send(mem_ctx, ev);
+}
+
 static int skel_closedir(vfs_handle_struct *handle, DIR *dir)
 {
 	errno = ENOSYS;
@@ -236,6 +277,14 @@ static int skel_close_fn(vfs_handle_struct *handle, files_struct *fsp)
 	return -1;
 }
 
+static struct tevent_req *skel_close_send(struct vfs_handle_struct *handle,
+					  TALLOC_CTX *mem_ctx,
+					  struct tevent_context *ev,
+					  struct files_struct *fsp)
+{
+	return skel_nsop_send(mem_ctx, ev);
+}
+
 static ssize_t skel_pread(vfs_handle_struct *handle, files_struct *fsp,
 			  void *data, size_t n, off_t offset)
 {
@@ -298,6 +347,15 @@ static ssize_t skel_sendfile(vfs_handle_struct *handle, int tofd,
 	return -1;
 }
 
+static int skel_splice_read_fd(vfs_handle_struct *handle,
+			       files_struct *fsp,
+			       off_t offset,
+			       size_t n)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
 static ssize_t skel_recvfile(vfs_handle_struct *handle, int fromfd,
 			     files_struct *tofsp, off_t offset, size_t n)
 {
@@ -316,6 +374,18 @@ static int skel_renameat(vfs_handle_struct *handle,
 	return -1;
 }
 
+static struct tevent_req *skel_renameat_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct vfs_handle_struct *handle,
+					     files_struct *srcfsp,
+					     const struct smb_filename *smb_fname_src,
+					     files_struct *dstfsp,
+					     const struct smb_filename *smb_fname_dst,
+					     const struct vfs_rename_how *how)
+{
+	return skel_nsop_send(mem_ctx, ev);
+}
+
 static int skel_rename_stream(struct vfs_handle_struct *handle,
 			      struct files_struct *src_fsp,
 			      const char *dst_name,
@@ -340,6 +410,12 @@ static int skel_fsync_recv(struct tevent_req *req,
 	return -1;
 }
 
+static NTSTATUS skel_flush_cached_writes(vfs_handle_struct *handle,
+					 files_struct *fsp)
+{
+	return NT_STATUS_NOT_IMPLEMENTED;
+}
+
 static int skel_stat(vfs_handle_struct *handle, struct smb_filename *smb_fname)
 {
 	errno = ENOSYS;
@@ -388,6 +464,16 @@ static int skel_unlinkat(vfs_handle_struct *handle,
 	return -1;
 }
 
+static struct tevent_req *skel_unlinkat_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct vfs_handle_struct *handle,
+					     struct files_struct *dirfsp,
+					     const struct smb_filename *smb_fname,
+					     int flags)
+{
+	return skel_nsop_send(mem_ctx, ev);
+}
+
 static int skel_fchmod(vfs_handle_struct *handle, files_struct *fsp,
 		       mode_t mode)
 {
@@ -508,6 +594,18 @@ static int skel_linkat(vfs_handle_struct *handle,
 	return -1;
 }
 
+static struct tevent_req *skel_linkat_send(TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct vfs_handle_struct *handle,
+					   files_struct *srcfsp,
+					   const struct smb_filename *old_smb_fname,
+					   files_struct *dstfsp,
+					   const struct smb_filename *new_smb_fname,
+					   int flags)
+{
+	return skel_nsop_send(mem_ctx, ev);
+}
+
 static int skel_mknodat(vfs_handle_struct *handle,
 			files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
@@ -982,6 +1080,8 @@ static struct vfs_fn_pointers skel_opaque_fns = {
 	.readdir_fn = skel_readdir,
 	.rewind_dir_fn = skel_rewind_dir,
 	.mkdirat_fn = skel_mkdirat,
+	.mkdirat_send_fn = skel_mkdirat_send,
+	.mkdirat_recv_fn = skel_nsop_recv,
 	.closedir_fn = skel_closedir,
 
 	/* File operations */
@@ -989,6 +1089,8 @@ static struct vfs_fn_pointers skel_opaque_fns = {
 	.openat_fn = skel_openat,
 	.create_file_fn = skel_create_file,
 	.close_fn = skel_close_fn,
+	.close_send_fn = skel_close_send,
+	.close_recv_fn = skel_nsop_recv,
 	.pread_fn = skel_pread,
 	.pread_send_fn = skel_pread_send,
 	.pread_recv_fn = skel_pread_recv,
@@ -997,17 +1099,23 @@ static struct vfs_fn_pointers skel_opaque_fns = {
 	.pwrite_recv_fn = skel_pwrite_recv,
 	.lseek_fn = skel_lseek,
 	.sendfile_fn = skel_sendfile,
+	.splice_read_fd_fn = skel_splice_read_fd,
 	.recvfile_fn = skel_recvfile,
 	.renameat_fn = skel_renameat,
+	.renameat_send_fn = skel_renameat_send,
+	.renameat_recv_fn = skel_nsop_recv,
 	.rename_stream_fn = skel_rename_stream,
 	.fsync_send_fn = skel_fsync_send,
 	.fsync_recv_fn = skel_fsync_recv,
+	.flush_cached_writes_fn = skel_flush_cached_writes,
 	.stat_fn = skel_stat,
 	.fstat_fn = skel_fstat,
 	.lstat_fn = skel_lstat,
 	.fstatat_fn = skel_fstatat,
 	.get_alloc_size_fn = skel_get_alloc_size,
 	.unlinkat_fn = skel_unlinkat,
+	.unlinkat_send_fn = skel_unlinkat_send,
+	.unlinkat_recv_fn = skel_nsop_recv,
 	.fchmod_fn = skel_fchmod,
 	.fchown_fn = skel_fchown,
 	.lchown_fn = skel_lchown,
@@ -1023,6 +1131,8 @@ static struct vfs_fn_pointers skel_opaque_fns = {
 	.symlinkat_fn = skel_symlinkat,
 	.readlinkat_fn = skel_vfs_readlinkat,
 	.linkat_fn = skel_linkat,
+	.linkat_send_fn = skel_linkat_send,
+	.linkat_recv_fn = skel_nsop_recv,
 	.mknodat_fn = skel_mknodat,
 	.realpath_fn = skel_realpath,
 	.fchflags_fn = skel_fchflags,
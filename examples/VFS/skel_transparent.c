@@ -195,6 +195,32 @@ static int skel_mkdirat(vfs_handle_struct *handle,
 			mode);
 }
 
+/*
+ * The directory entry operations below can hand out the next
+ * module's request as their own, there's nothing to do on completion.
+ */
+
+static struct tevent_req *skel_mkdirat_send(TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct vfs_handle_struct *handle,
+					    struct files_struct *dirfsp,
+					    const struct smb_filename *smb_fname,
+					    mode_t mode)
+{
+	return SMB_VFS_NEXT_MKDIRAT_SEND(mem_ctx,
+					 ev,
+					 handle,
+					 dirfsp,
+					 smb_fname,
+					 mode);
+}
+
+static int skel_mkdirat_recv(struct tevent_req *req,
+			     struct vfs_aio_state *aio_state)
+{
+	return SMB_VFS_NEXT_MKDIRAT_RECV(req, aio_state);
+}
+
 static int skel_closedir(vfs_handle_struct *handle, DIR *dir)
 {
 	return SMB_VFS_NEXT_CLOSEDIR(handle, dir);
@@ -250,6 +276,20 @@ static int skel_close_fn(vfs_handle_struct *handle, files_struct *fsp)
 	return SMB_VFS_NEXT_CLOSE(handle, fsp);
 }
 
+static struct tevent_req *skel_close_send(struct vfs_handle_struct *handle,
+					  TALLOC_CTX *mem_ctx,
+					  struct tevent_context *ev,
+					  struct files_struct *fsp)
+{
+	return SMB_VFS_NEXT_CLOSE_SEND(mem_ctx, ev, handle, fsp);
+}
+
+static int skel_close_recv(struct tevent_req *req,
+			   struct vfs_aio_state *aio_state)
+{
+	return SMB_VFS_NEXT_CLOSE_RECV(req, aio_state);
+}
+
 static ssize_t skel_pread(vfs_handle_struct *handle, files_struct *fsp,
 			  void *data, size_t n, off_t offset)
 {
@@ -384,6 +424,14 @@ static ssize_t skel_sendfile(vfs_handle_struct *handle, int tofd,
 	return SMB_VFS_NEXT_SENDFILE(handle, tofd, fromfsp, hdr, offset, n);
 }
 
+static int skel_splice_read_fd(vfs_handle_struct *handle,
+			       files_struct *fsp,
+			       off_t offset,
+			       size_t n)
+{
+	return SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+}
+
 static ssize_t skel_recvfile(vfs_handle_struct *handle, int fromfd,
 			     files_struct *tofsp, off_t offset, size_t n)
 {
@@ -405,6 +453,31 @@ static int skel_renameat(vfs_handle_struct *handle,
 			how);
 }
 
+static struct tevent_req *skel_renameat_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct vfs_handle_struct *handle,
+					     files_struct *srcfsp,
+					     const struct smb_filename *smb_fname_src,
+					     files_struct *dstfsp,
+					     const struct smb_filename *smb_fname_dst,
+					     const struct vfs_rename_how *how)
+{
+	return SMB_VFS_NEXT_RENAMEAT_SEND(mem_ctx,
+					  ev,
+					  handle,
+					  srcfsp,
+					  smb_fname_src,
+					  dstfsp,
+					  smb_fname_dst,
+					  how);
+}
+
+static int skel_renameat_recv(struct tevent_req *req,
+			      struct vfs_aio_state *aio_state)
+{
+	return SMB_VFS_NEXT_RENAMEAT_RECV(req, aio_state);
+}
+
 static int skel_rename_stream(struct vfs_handle_struct *handle,
 			      struct files_struct *src_fsp,
 			      const char *dst_name,
@@ -468,6 +541,12 @@ static int skel_fsync_recv(struct tevent_req *req,
 	return state->ret;
 }
 
+static NTSTATUS skel_flush_cached_writes(vfs_handle_struct *handle,
+					 files_struct *fsp)
+{
+	return SMB_VFS_NEXT_FLUSH_CACHED_WRITES(handle, fsp);
+}
+
 static int skel_stat(vfs_handle_struct *handle, struct smb_filename *smb_fname)
 {
 	return SMB_VFS_NEXT_STAT(handle, smb_fname);
@@ -513,6 +592,27 @@ static int skel_unlinkat(vfs_handle_struct *handle,
 			flags);
 }
 
+static struct tevent_req *skel_unlinkat_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct vfs_handle_struct *handle,
+					     struct files_struct *dirfsp,
+					     const struct smb_filename *smb_fname,
+					     int flags)
+{
+	return SMB_VFS_NEXT_UNLINKAT_SEND(mem_ctx,
+					  ev,
+					  handle,
+					  dirfsp,
+					  smb_fname,
+					  flags);
+}
+
+static int skel_unlinkat_recv(struct tevent_req *req,
+			      struct vfs_aio_state *aio_state)
+{
+	return SMB_VFS_NEXT_UNLINKAT_RECV(req, aio_state);
+}
+
 static int skel_fchmod(vfs_handle_struct *handle, files_struct *fsp,
 		       mode_t mode)
 {
@@ -642,6 +742,31 @@ static int skel_linkat(vfs_handle_struct *handle,
 			flags);
 }
 
+static struct tevent_req *skel_linkat_send(TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct vfs_handle_struct *handle,
+					   files_struct *srcfsp,
+					   const struct smb_filename *old_smb_fname,
+					   files_struct *dstfsp,
+					   const struct smb_filename *new_smb_fname,
+					   int flags)
+{
+	return SMB_VFS_NEXT_LINKAT_SEND(mem_ctx,
+					ev,
+					handle,
+					srcfsp,
+					old_smb_fname,
+					dstfsp,
+					new_smb_fname,
+					flags);
+}
+
+static int skel_linkat_recv(struct tevent_req *req,
+			    struct vfs_aio_state *aio_state)
+{
+	return SMB_VFS_NEXT_LINKAT_RECV(req, aio_state);
+}
+
 static int skel_mknodat(vfs_handle_struct *handle,
 			files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
@@ -1293,6 +1418,8 @@ static struct vfs_fn_pointers skel_transparent_fns = {
 	.readdir_fn = skel_readdir,
 	.rewind_dir_fn = skel_rewind_dir,
 	.mkdirat_fn = skel_mkdirat,
+	.mkdirat_send_fn = skel_mkdirat_send,
+	.mkdirat_recv_fn = skel_mkdirat_recv,
 	.closedir_fn = skel_closedir,
 
 	/* File operations */
@@ -1300,6 +1427,8 @@ static struct vfs_fn_pointers skel_transparent_fns = {
 	.openat_fn = skel_openat,
 	.create_file_fn = skel_create_file,
 	.close_fn = skel_close_fn,
+	.close_send_fn = skel_close_send,
+	.close_recv_fn = skel_close_recv,
 	.pread_fn = skel_pread,
 	.pread_send_fn = skel_pread_send,
 	.pread_recv_fn = skel_pread_recv,
@@ -1308,17 +1437,23 @@ static struct vfs_fn_pointers skel_transparent_fns = {
 	.pwrite_recv_fn = skel_pwrite_recv,
 	.lseek_fn = skel_lseek,
 	.sendfile_fn = skel_sendfile,
+	.splice_read_fd_fn = skel_splice_read_fd,
 	.recvfile_fn = skel_recvfile,
 	.renameat_fn = skel_renameat,
+	.renameat_send_fn = skel_renameat_send,
+	.renameat_recv_fn = skel_renameat_recv,
 	.rename_stream_fn = skel_rename_stream,
 	.fsync_send_fn = skel_fsync_send,
 	.fsync_recv_fn = skel_fsync_recv,
+	.flush_cached_writes_fn = skel_flush_cached_writes,
 	.stat_fn = skel_stat,
 	.fstat_fn = skel_fstat,
 	.lstat_fn = skel_lstat,
 	.fstatat_fn = skel_fstatat,
 	.get_alloc_size_fn = skel_get_alloc_size,
 	.unlinkat_fn = skel_unlinkat,
+	.unlinkat_send_fn = skel_unlinkat_send,
+	.unlinkat_recv_fn = skel_unlinkat_recv,
 	.fchmod_fn = skel_fchmod,
 	.fchown_fn = skel_fchown,
 	.lchown_fn = skel_lchown,
@@ -1334,6 +1469,8 @@ static struct vfs_fn_pointers skel_transparent_fns = {
 	.symlinkat_fn = skel_symlinkat,
 	.readlinkat_fn = skel_vfs_readlinkat,
 	.linkat_fn = skel_linkat,
+	.linkat_send_fn = skel_linkat_send,
+	.linkat_recv_fn = skel_linkat_recv,
 	.mknodat_fn = skel_mknodat,
 	.realpath_fn = skel_realpath,
 	.fchflags_fn = skel_fchflags,
@@ -1137,42 +1137,17 @@ static ssize_t write_compressed_bytes(uint16_t symbol_values[512],
 }
 
 
-static ssize_t lzx_huffman_compress_block(struct lzxhuff_compressor_context *cmp_ctx,
-					  struct lzxhuff_compressor_mem *cmp_mem,
-					  size_t block_no)
+/*
+ * lzx_huffman_write_block() writes out the Huffman table and the encoded
+ * symbols for a block, after the LZ77 stage has filled in the intermediate
+ * buffer and the symbol codes.
+ */
+static ssize_t lzx_huffman_write_block(struct lzxhuff_compressor_context *cmp_ctx,
+				       struct lzxhuff_compressor_mem *cmp_mem,
+				       ssize_t intermediate_size)
 {
-	ssize_t intermediate_size;
-	uint16_t *hash_table = NULL;
-	uint16_t *back_window_hash_table = NULL;
 	ssize_t bytes_written;
 
-	if (cmp_ctx->available_size - cmp_ctx->output_pos < 260) {
-		/* huffman block + 4 bytes */
-		return LZXPRESS_ERROR;
-	}
-
-	/*
-	 * For LZ77 compression, we keep a hash table for the previous block,
-	 * via alternation after the first block.
-	 *
-	 * LZ77 writes into the intermediate buffer in the cmp_mem context.
-	 */
-	if (block_no == 0) {
-		hash_table = cmp_mem->hash_table1;
-		back_window_hash_table = NULL;
-	} else if (block_no & 1) {
-		hash_table = cmp_mem->hash_table2;
-		back_window_hash_table = cmp_mem->hash_table1;
-	} else {
-		hash_table = cmp_mem->hash_table1;
-		back_window_hash_table = cmp_mem->hash_table2;
-	}
-
-	intermediate_size = lz77_encode_block(cmp_ctx,
-					      cmp_mem,
-					      hash_table,
-					      back_window_hash_table);
-
 	if (intermediate_size < 0) {
 		return intermediate_size;
 	}
@@ -1210,6 +1185,46 @@ static ssize_t lzx_huffman_compress_block(struct lzxhuff_compressor_context *cmp
 	return bytes_written;
 }
 
+
+static ssize_t lzx_huffman_compress_block(struct lzxhuff_compressor_context *cmp_ctx,
+					  struct lzxhuff_compressor_mem *cmp_mem,
+					  size_t block_no)
+{
+	ssize_t intermediate_size;
+	uint16_t *hash_table = NULL;
+	uint16_t *back_window_hash_table = NULL;
+
+	if (cmp_ctx->available_size - cmp_ctx->output_pos < 260) {
+		/* huffman block + 4 bytes */
+		return LZXPRESS_ERROR;
+	}
+
+	/*
+	 * For LZ77 compression, we keep a hash table for the previous block,
+	 * via alternation after the first block.
+	 *
+	 * LZ77 writes into the intermediate buffer in the cmp_mem context.
+	 */
+	if (block_no == 0) {
+		hash_table = cmp_mem->hash_table1;
+		back_window_hash_table = NULL;
+	} else if (block_no & 1) {
+		hash_table = cmp_mem->hash_table2;
+		back_window_hash_table = cmp_mem->hash_table1;
+	} else {
+		hash_table = cmp_mem->hash_table1;
+		back_window_hash_table = cmp_mem->hash_table2;
+	}
+
+	intermediate_size = lz77_encode_block(cmp_ctx,
+					      cmp_mem,
+					      hash_table,
+					      back_window_hash_table);
+
+	return lzx_huffman_write_block(cmp_ctx, cmp_mem, intermediate_size);
+}
+
+
 /*
  * lzxpress_huffman_max_compressed_size()
  *
@@ -2043,3 +2058,969 @@ uint8_t *lzxpress_huffman_decompress_talloc(TALLOC_CTX *mem_ctx,
 	}
 	return output;
 }
+
+
+/*
+ * The fast engine.
+ *
+ * Everything above is the reference implementation, which works a bit at a
+ * time when decoding, and with small circular hash tables when encoding. The
+ * code below produces and accepts the same format (using the same Huffman
+ * tree building and bit writing code), but
+ *
+ * - finds LZ77 matches via hash chains, with the search depth set by an
+ *   effort level,
+ *
+ * - measures match lengths 16 (SSE2) or 8 bytes at a time,
+ *
+ * - decodes symbols through a 15 bit lookup table, in which an entry can
+ *   resolve two literals at once.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FAST_HASH_MASK(bits) ((1U << (bits)) - 1)
+#define FAST_WINDOW_MASK (LZX_HUFF_FAST_WINDOW_SIZE - 1)
+
+/*
+ * The reference compressor never uses a distance of 65535, and nor do we.
+ */
+#define FAST_MAX_DISTANCE 65534
+
+struct lzxhuff_effort {
+	/* how many earlier positions to try */
+	uint16_t max_chain;
+	/* a match this long is good enough to stop looking */
+	uint32_t nice_length;
+	/* matches up to this length get all their positions hashed */
+	uint32_t max_insert;
+	/* try the next position before accepting a match */
+	bool lazy;
+};
+
+static const struct lzxhuff_effort lzxhuff_efforts[LZX_HUFF_EFFORT_MAX + 1] = {
+	[1] = { .max_chain = 1,   .nice_length = 16,    .max_insert = 4, },
+	[2] = { .max_chain = 2,   .nice_length = 32,    .max_insert = 8, },
+	[3] = { .max_chain = 4,   .nice_length = 64,    .max_insert = 16, },
+	[4] = { .max_chain = 8,   .nice_length = 128,   .max_insert = 64,
+		.lazy = true, },
+	[5] = { .max_chain = 16,  .nice_length = 256,   .max_insert = 256,
+		.lazy = true, },
+	[6] = { .max_chain = 32,  .nice_length = 512,   .max_insert = UINT32_MAX,
+		.lazy = true, },
+	[7] = { .max_chain = 64,  .nice_length = 1024,  .max_insert = UINT32_MAX,
+		.lazy = true, },
+	[8] = { .max_chain = 256, .nice_length = 4096,  .max_insert = UINT32_MAX,
+		.lazy = true, },
+	[9] = { .max_chain = 1024, .nice_length = 65538, .max_insert = UINT32_MAX,
+		.lazy = true, },
+};
+
+
+struct lzxhuff_fast_search {
+	const struct lzxhuff_effort *effort;
+	uint32_t *head;
+	uint32_t *chain;
+	unsigned hash_bits;
+};
+
+
+static inline uint32_t fast_three_byte_hash(const uint8_t *bytes,
+					    unsigned hash_bits)
+{
+	uint32_t v = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+	return (v * 2654435761U) >> (32 - hash_bits);
+}
+
+
+/*
+ * match_length() counts the bytes in common at a and b, up to max_len.
+ */
+static inline size_t match_length(const uint8_t *a,
+				  const uint8_t *b,
+				  size_t max_len)
+{
+	size_t len = 0;
+#ifdef __SSE2__
+	while (len + 16 <= max_len) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(const void *)(a + len));
+		__m128i y = _mm_loadu_si128((const __m128i *)(const void *)(b + len));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (mask != 0xffff) {
+			return len + __builtin_ctz(~mask);
+		}
+		len += 16;
+	}
+#endif
+#if __has_builtin(__builtin_ctzll)
+	while (len + 8 <= max_len) {
+		/* little-endian, so the first difference is the lowest bit */
+		uint64_t d = PULL_LE_U64(a, len) ^ PULL_LE_U64(b, len);
+		if (d != 0) {
+			return len + (__builtin_ctzll(d) >> 3);
+		}
+		len += 8;
+	}
+#endif
+	while (len < max_len && a[len] == b[len]) {
+		len++;
+	}
+	return len;
+}
+
+
+static inline void fast_insert(struct lzxhuff_fast_search *search,
+			       const uint8_t *input,
+			       size_t pos)
+{
+	uint32_t h = fast_three_byte_hash(input + pos, search->hash_bits);
+	/* positions are stored + 1, so that 0 means empty */
+	search->chain[pos & FAST_WINDOW_MASK] = search->head[h];
+	search->head[h] = pos + 1;
+}
+
+
+/*
+ * Look for the longest match for pos, *before* pos is inserted into the
+ * chains. The chains are walked from the nearest position backwards, so the
+ * first one of any length is the closest, which is never worse to encode.
+ */
+static inline struct match fast_find_match(struct lzxhuff_fast_search *search,
+					   const uint8_t *input,
+					   size_t pos,
+					   size_t max_len)
+{
+	const struct lzxhuff_effort *effort = search->effort;
+	const uint8_t *here = input + pos;
+	uint32_t h = fast_three_byte_hash(here, search->hash_bits);
+	uint32_t candidate = search->head[h];
+	unsigned tries = effort->max_chain;
+	struct match best = {0};
+
+	while (candidate != 0 && tries > 0) {
+		size_t there_pos = candidate - 1;
+		const uint8_t *there = input + there_pos;
+		size_t len;
+
+		if (pos - there_pos > FAST_MAX_DISTANCE) {
+			/*
+			 * The chains go backwards, so everything
+			 * else is further away still.
+			 */
+			break;
+		}
+		tries--;
+
+		/*
+		 * A candidate that differs at the byte just past the best
+		 * match so far can't be better.
+		 */
+		if (best.length == 0 ||
+		    there[best.length] == here[best.length]) {
+			len = match_length(here, there, max_len);
+			if (len > best.length) {
+				best.length = len;
+				best.there = there;
+				if (len >= effort->nice_length ||
+				    len == max_len) {
+					break;
+				}
+			}
+		}
+		candidate = search->chain[there_pos & FAST_WINDOW_MASK];
+	}
+
+	if (best.length < 3) {
+		best = (struct match) {0};
+	}
+	return best;
+}
+
+
+static inline size_t fast_add_match(uint16_t *intermediate,
+				    size_t j,
+				    struct huffman_node *leaf_nodes,
+				    size_t length,
+				    size_t distance)
+{
+	uint16_t code;
+
+	if (length <= 65538) {
+		intermediate[j] = 0xffff;
+		intermediate[j + 1] = length - 3;
+		intermediate[j + 2] = distance;
+		j += 3;
+	} else {
+		size_t m = length - 3;
+		intermediate[j] = 0xfffe;
+		intermediate[j + 1] = m & 0xffff;
+		intermediate[j + 2] = m >> 16;
+		intermediate[j + 3] = distance;
+		j += 4;
+	}
+	code = encode_match(length, distance);
+	leaf_nodes[code].count++;
+	return j;
+}
+
+
+/*
+ * This is the counterpart of lz77_encode_block(), with the same output in
+ * the intermediate buffer and symbol counts.
+ *
+ * Unlike the reference, positions here are absolute in the input, and the
+ * hash chains are kept across blocks, so a match can look back into the
+ * previous block without a separate table.
+ */
+static ssize_t lz77_encode_block_fast(struct lzxhuff_compressor_context *cmp_ctx,
+				      struct lzxhuff_compressor_mem *cmp_mem,
+				      struct lzxhuff_fast_search *search)
+{
+	uint16_t *intermediate = cmp_mem->intermediate;
+	struct huffman_node *leaf_nodes = cmp_mem->leaf_nodes;
+	const uint8_t *input = cmp_ctx->input_bytes;
+	const struct lzxhuff_effort *effort = search->effort;
+	size_t input_size = cmp_ctx->input_size;
+	size_t pos = cmp_ctx->input_pos;
+	size_t remaining_size = input_size - pos;
+	size_t block_end = pos + MIN(65536, remaining_size);
+	size_t i, j, intermediate_len;
+	int n_symbols;
+
+	if (cmp_ctx->input_size < cmp_ctx->input_pos) {
+		return LZXPRESS_ERROR;
+	}
+
+	for (i = 0; i < 512; i++) {
+		leaf_nodes[i] = (struct huffman_node) {
+			.symbol = i
+		};
+	}
+
+	j = 0;
+
+	/*
+	 * See lz77_encode_block() for the 41 byte threshold.
+	 */
+	if (remaining_size >= 41 && !DEBUG_NO_LZ77_MATCHES) {
+		while (pos + 3 <= block_end) {
+			size_t max_len = MIN(input_size - pos,
+					     MAX_MATCH_LENGTH);
+			struct match match = fast_find_match(search,
+							     input,
+							     pos,
+							     max_len);
+			size_t end;
+
+			if (match.there == NULL) {
+				uint8_t c = input[pos];
+				fast_insert(search, input, pos);
+				leaf_nodes[c].count++;
+				intermediate[j] = c;
+				j++;
+				pos++;
+				continue;
+			}
+
+			while (effort->lazy &&
+			       match.length < effort->nice_length &&
+			       pos + 4 <= block_end) {
+				/*
+				 * If the next position has a longer match, we
+				 * write this byte as a literal and take that
+				 * one instead.
+				 */
+				struct match next;
+				uint8_t c;
+
+				fast_insert(search, input, pos);
+				next = fast_find_match(search,
+						       input,
+						       pos + 1,
+						       max_len - 1);
+				if (next.length <= match.length) {
+					/* pos is in the chains now */
+					goto insert_rest;
+				}
+				c = input[pos];
+				leaf_nodes[c].count++;
+				intermediate[j] = c;
+				j++;
+				pos++;
+				max_len--;
+				match = next;
+			}
+
+			fast_insert(search, input, pos);
+		insert_rest:
+			end = pos + match.length;
+			if (match.length <= effort->max_insert) {
+				/*
+				 * Hash the positions inside the match,
+				 * skipping those that don't have three bytes
+				 * to hash.
+				 */
+				size_t k;
+				size_t insert_end = MIN(end, input_size - 2);
+				for (k = pos + 1; k < insert_end; k++) {
+					fast_insert(search, input, k);
+				}
+			}
+
+			j = fast_add_match(intermediate,
+					   j,
+					   leaf_nodes,
+					   match.length,
+					   input + pos - match.there);
+			/*
+			 * As with the reference, a match can take us past
+			 * the intended block length, extending the block.
+			 */
+			pos = end;
+		}
+	}
+
+	/*
+	 * There might be some bytes at the end.
+	 */
+	for (; pos < block_end; pos++) {
+		leaf_nodes[input[pos]].count++;
+		intermediate[j] = input[pos];
+		j++;
+	}
+
+	if (pos == input_size) {
+		/* add a trailing EOF marker (256) */
+		intermediate[j] = 0xffff;
+		intermediate[j + 1] = 0;
+		intermediate[j + 2] = 1;
+		j += 3;
+		leaf_nodes[256].count++;
+	}
+
+	intermediate_len = j;
+
+	cmp_ctx->prev_block_pos = cmp_ctx->input_pos;
+	cmp_ctx->input_pos = pos;
+
+	n_symbols = generate_huffman_codes(leaf_nodes,
+					   cmp_mem->internal_nodes,
+					   cmp_mem->symbol_values);
+	if (n_symbols < 0) {
+		return n_symbols;
+	}
+
+	return intermediate_len;
+}
+
+
+/*
+ * lzxpress_huffman_compress_fast()
+ *
+ * This works like lzxpress_huffman_compress(), but with a struct
+ * lzxhuff_fast_compressor_mem (which is too big for the stack) and an effort
+ * level between LZX_HUFF_EFFORT_MIN and LZX_HUFF_EFFORT_MAX.
+ *
+ * @param cmp_mem         a struct lzxhuff_fast_compressor_mem.
+ * @param effort          how hard to look for matches.
+ * @param input_bytes     memory to be compressed.
+ * @param input_size      length of the input buffer.
+ * @param output          destination for the compressed data.
+ * @param available_size  allocated output bytes.
+ *
+ * @return the number of bytes written or -1 on error.
+ */
+ssize_t lzxpress_huffman_compress_fast(struct lzxhuff_fast_compressor_mem *cmp_mem,
+				       int effort,
+				       const uint8_t *input_bytes,
+				       size_t input_size,
+				       uint8_t *output,
+				       size_t available_size)
+{
+	struct lzxhuff_compressor_context cmp_ctx = {
+		.input_bytes = input_bytes,
+		.input_size = input_size,
+		.output = output,
+		.available_size = available_size,
+	};
+	struct lzxhuff_fast_search search;
+	unsigned hash_bits;
+
+	if (input_size == 0 ||
+	    input_size > SSIZE_MAX ||
+	    input_size > UINT32_MAX ||
+	    available_size > SSIZE_MAX ||
+	    available_size > UINT32_MAX ||
+	    available_size == 0) {
+		/* see lzxpress_huffman_compress() */
+		return LZXPRESS_ERROR;
+	}
+
+	if (cmp_mem == NULL ||
+	    output == NULL ||
+	    input_bytes == NULL) {
+		return LZXPRESS_ERROR;
+	}
+
+	effort = MAX(effort, LZX_HUFF_EFFORT_MIN);
+	effort = MIN(effort, LZX_HUFF_EFFORT_MAX);
+
+	/*
+	 * Small messages (e.g. 4k SMB reads) don't need a big hash table,
+	 * and clearing it would be a good part of the cost.
+	 */
+	hash_bits = bitlen_nonzero_16(MIN(input_size, 65535));
+	hash_bits = MAX(hash_bits, 10);
+	hash_bits = MIN(hash_bits, LZX_HUFF_FAST_HASH_BITS);
+
+	search = (struct lzxhuff_fast_search) {
+		.effort = &lzxhuff_efforts[effort],
+		.head = cmp_mem->hash_head,
+		.chain = cmp_mem->hash_chain,
+		.hash_bits = hash_bits,
+	};
+	memset(cmp_mem->hash_head, 0, sizeof(uint32_t) << hash_bits);
+
+	while (cmp_ctx.input_pos < cmp_ctx.input_size) {
+		ssize_t ret;
+
+		if (cmp_ctx.available_size - cmp_ctx.output_pos < 260) {
+			/* huffman block + 4 bytes */
+			return LZXPRESS_ERROR;
+		}
+		ret = lz77_encode_block_fast(&cmp_ctx, &cmp_mem->base, &search);
+		ret = lzx_huffman_write_block(&cmp_ctx, &cmp_mem->base, ret);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return cmp_ctx.output_pos;
+}
+
+
+/*
+ * lzxpress_huffman_compress_fast_talloc()
+ *
+ * The fast counterpart of lzxpress_huffman_compress_talloc().
+ *
+ * @param mem_ctx      TALLOC_CTX parent for the compressed buffer.
+ * @param effort       how hard to look for matches.
+ * @param input_bytes  memory to be compressed.
+ * @param input_size   length of the input buffer.
+ * @param output       destination pointer for the compressed data.
+ *
+ * @return the number of bytes written or -1 on error.
+ */
+ssize_t lzxpress_huffman_compress_fast_talloc(TALLOC_CTX *mem_ctx,
+					      int effort,
+					      const uint8_t *input_bytes,
+					      size_t input_size,
+					      uint8_t **output)
+{
+	struct lzxhuff_fast_compressor_mem *cmp = NULL;
+	size_t alloc_size = lzxpress_huffman_max_compressed_size(input_size);
+	ssize_t output_size;
+
+	*output = talloc_array(mem_ctx, uint8_t, alloc_size);
+	if (*output == NULL) {
+		return LZXPRESS_ERROR;
+	}
+
+	cmp = talloc(mem_ctx, struct lzxhuff_fast_compressor_mem);
+	if (cmp == NULL) {
+		TALLOC_FREE(*output);
+		return LZXPRESS_ERROR;
+	}
+
+	output_size = lzxpress_huffman_compress_fast(cmp,
+						     effort,
+						     input_bytes,
+						     input_size,
+						     *output,
+						     alloc_size);
+
+	talloc_free(cmp);
+
+	if (output_size < 0) {
+		TALLOC_FREE(*output);
+		return LZXPRESS_ERROR;
+	}
+
+	*output = talloc_realloc(mem_ctx, *output, uint8_t, output_size);
+	if (*output == NULL) {
+		return LZXPRESS_ERROR;
+	}
+
+	return output_size;
+}
+
+
+/*
+ * The decoding table has an entry for every 15 bit sequence (15 bits being
+ * the longest code), giving the symbol whose code is a prefix of it, and the
+ * length of that code, in the lower 16 bits:
+ *
+ *    bits 0-8   symbol
+ *    bits 9-12  code length
+ *
+ * If the symbol is a literal and the rest of the 15 bits start with the whole
+ * code of another literal, the upper 16 bits have that one too:
+ *
+ *    bits 16-23 second literal
+ *    bits 24-27 combined code length
+ *    bit 31     there is a second literal
+ */
+#define FAST_TABLE_BITS 15
+#define FAST_TABLE_SIZE (1 << FAST_TABLE_BITS)
+#define FAST_TABLE_MASK (FAST_TABLE_SIZE - 1)
+
+#define FAST_ENTRY_SYMBOL(e)    ((e) & 511)
+#define FAST_ENTRY_LEN(e)       (((e) >> 9) & 15)
+#define FAST_ENTRY_PAIR         0x80000000U
+#define FAST_ENTRY_SYMBOL2(e)   (((e) >> 16) & 255)
+#define FAST_ENTRY_PAIR_LEN(e)  (((e) >> 24) & 15)
+
+struct fast_bitstream {
+	const uint8_t *bytes;
+	size_t byte_pos;
+	size_t byte_size;
+	uint32_t bits;
+	unsigned remaining_bits;
+	uint32_t *table;
+};
+
+
+static bool fill_fast_decomp_table(struct fast_bitstream *input)
+{
+	/*
+	 * See fill_decomp_table() for the format of the 256 byte header.
+	 * The canonical codes are the same, we just number them the way
+	 * DEFLATE implementations usually do.
+	 */
+	const uint8_t *table_bytes = input->bytes + input->byte_pos;
+	uint32_t *table = input->table;
+	uint8_t lengths[512];
+	uint32_t length_count[16] = {0};
+	uint32_t next_code[16];
+	uint32_t code;
+	uint32_t kraft = 0;
+	size_t i;
+
+	if (input->byte_pos + 260 > input->byte_size) {
+		return false;
+	}
+
+	for (i = 0; i < 256; i++) {
+		lengths[i * 2] = table_bytes[i] & 15;
+		lengths[i * 2 + 1] = table_bytes[i] >> 4;
+		length_count[lengths[i * 2]]++;
+		length_count[lengths[i * 2 + 1]]++;
+	}
+	input->byte_pos += 256;
+
+	/*
+	 * The code needs to be complete, as the reference checks with the
+	 * last code, otherwise the table would have holes.
+	 */
+	for (i = 1; i < 16; i++) {
+		kraft += length_count[i] << (FAST_TABLE_BITS - i);
+	}
+	if (kraft != FAST_TABLE_SIZE) {
+		return false;
+	}
+
+	code = 0;
+	length_count[0] = 0;
+	for (i = 1; i < 16; i++) {
+		code = (code + length_count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+
+	for (i = 0; i < 512; i++) {
+		uint8_t len = lengths[i];
+		uint32_t entry = i | (len << 9);
+		uint32_t start;
+		uint32_t end;
+		uint32_t k;
+
+		if (len == 0) {
+			continue;
+		}
+		start = next_code[len] << (FAST_TABLE_BITS - len);
+		end = start + (1U << (FAST_TABLE_BITS - len));
+		next_code[len]++;
+		for (k = start; k < end; k++) {
+			table[k] = entry;
+		}
+	}
+
+	/*
+	 * Now look for pairs of literals. The lower 16 bits of the entries
+	 * stay as they are, so it is fine to do this in place.
+	 */
+	for (i = 0; i < FAST_TABLE_SIZE; i++) {
+		uint32_t e = table[i];
+		uint32_t len = FAST_ENTRY_LEN(e);
+		uint32_t e2;
+		uint32_t len2;
+
+		if (FAST_ENTRY_SYMBOL(e) > 255 || len > FAST_TABLE_BITS - 1) {
+			continue;
+		}
+		e2 = table[(i << len) & FAST_TABLE_MASK];
+		len2 = FAST_ENTRY_LEN(e2);
+		if (FAST_ENTRY_SYMBOL(e2) > 255 ||
+		    len + len2 > FAST_TABLE_BITS) {
+			continue;
+		}
+		table[i] = (e & 0xffff) |
+			FAST_ENTRY_PAIR |
+			(FAST_ENTRY_SYMBOL(e2) << 16) |
+			((len + len2) << 24);
+	}
+	return true;
+}
+
+
+static inline uint32_t fast_peek_bits(struct fast_bitstream *input,
+				      unsigned n)
+{
+	return (input->bits >> (input->remaining_bits - n)) &
+		((1U << n) - 1);
+}
+
+
+static inline bool fast_refill_bits(struct fast_bitstream *input)
+{
+	if (input->byte_pos + 1 < input->byte_size) {
+		input->bits <<= 16;
+		input->bits |= PULL_LE_U16(input->bytes, input->byte_pos);
+		input->byte_pos += 2;
+		input->remaining_bits += 16;
+		return true;
+	}
+	if (input->byte_pos < input->byte_size) {
+		input->bits <<= 8;
+		input->bits |= input->bytes[input->byte_pos];
+		input->byte_pos++;
+		input->remaining_bits += 8;
+		return input->remaining_bits >= 16;
+	}
+	return false;
+}
+
+
+/*
+ * Consume n bits (n <= 15), keeping at least 16 bits in reserve.
+ *
+ * This refills at the same moments as the reference (which is not
+ * necessarily when it is convenient), because the match length bytes are
+ * read from wherever the input position is at the time.
+ */
+static inline bool fast_consume_bits(struct fast_bitstream *input,
+				     unsigned n)
+{
+	input->remaining_bits -= n;
+	if (likely(input->remaining_bits >= 16)) {
+		return true;
+	}
+	return fast_refill_bits(input);
+}
+
+
+static inline void fast_copy_match(uint8_t *here,
+				   size_t distance,
+				   size_t length,
+				   size_t available)
+{
+	const uint8_t *there = here - distance;
+	size_t i;
+
+	if (distance >= 8 && length + 8 <= available) {
+		/*
+		 * We can copy 8 bytes at a time, running over the end
+		 * of the match into space that will be written later.
+		 */
+		for (i = 0; i < length; i += 8) {
+			memcpy(here + i, there + i, 8);
+		}
+		return;
+	}
+	if (distance == 1) {
+		memset(here, there[0], length);
+		return;
+	}
+	for (i = 0; i < length; i++) {
+		here[i] = there[i];
+	}
+}
+
+
+/*
+ * The counterpart of lzx_huffman_decompress_block(), with the same
+ * arguments and results.
+ */
+static ssize_t lzx_huffman_decompress_block_fast(struct fast_bitstream *input,
+						 uint8_t *output,
+						 size_t block_size,
+						 size_t output_size,
+						 size_t previous_size)
+{
+	uint32_t *table = input->table;
+	size_t output_pos = 0;
+	uint32_t tmp;
+	uint32_t e;
+	bool ok;
+
+	ok = fill_fast_decomp_table(input);
+	if (! ok) {
+		return LZXPRESS_ERROR;
+	}
+
+	CHECK_READ_16(tmp);
+	CHECK_READ_16(input->bits);
+	input->bits |= tmp << 16;
+	input->remaining_bits = 32;
+
+	while (output_pos < block_size) {
+		uint16_t symbol;
+		uint32_t distance_bits;
+		size_t distance;
+		size_t length;
+		size_t end;
+
+		e = table[fast_peek_bits(input, FAST_TABLE_BITS)];
+
+		if ((e & FAST_ENTRY_PAIR) && output_pos + 1 < block_size) {
+			output[output_pos] = FAST_ENTRY_SYMBOL(e);
+			output[output_pos + 1] = FAST_ENTRY_SYMBOL2(e);
+			output_pos += 2;
+			ok = fast_consume_bits(input, FAST_ENTRY_PAIR_LEN(e));
+			if (!ok) {
+				return LZXPRESS_ERROR;
+			}
+			continue;
+		}
+
+		ok = fast_consume_bits(input, FAST_ENTRY_LEN(e));
+		if (!ok) {
+			return LZXPRESS_ERROR;
+		}
+		symbol = FAST_ENTRY_SYMBOL(e);
+		if (symbol < 256) {
+			output[output_pos] = symbol;
+			output_pos++;
+			continue;
+		}
+
+		/* a match, see lzx_huffman_decompress_block() */
+		distance_bits = (symbol >> 4) & 15;
+		length = symbol & 15;
+		if (length == 15) {
+			CHECK_READ_8(tmp);
+			length += tmp;
+			if (length == 255 + 15) {
+				CHECK_READ_16(length);
+				if (length == 0) {
+					CHECK_READ_32(length);
+				}
+			}
+		}
+		length += 3;
+
+		distance = 1 << distance_bits;
+		if (distance_bits != 0) {
+			distance |= fast_peek_bits(input, distance_bits);
+			ok = fast_consume_bits(input, distance_bits);
+			if (!ok) {
+				return LZXPRESS_ERROR;
+			}
+		}
+
+		end = output_pos + length;
+		if (end > output_size ||
+		    previous_size + output_pos < distance ||
+		    unlikely(end < output_pos)) {
+			return LZXPRESS_ERROR;
+		}
+		fast_copy_match(output + output_pos,
+				distance,
+				length,
+				output_size - output_pos);
+		output_pos = end;
+	}
+
+	if (input->byte_pos + 256 < input->byte_size) {
+		/* not the last block */
+		return output_pos;
+	}
+
+	/*
+	 * Now we want an EOF symbol followed by zero bits, as in
+	 * lzx_huffman_decompress_block(), which never looks at the last 16
+	 * bits.
+	 */
+	e = table[fast_peek_bits(input, FAST_TABLE_BITS)];
+	if (FAST_ENTRY_SYMBOL(e) != 256) {
+		return LZXPRESS_ERROR;
+	}
+	ok = fast_consume_bits(input, FAST_ENTRY_LEN(e));
+	if (!ok) {
+		return LZXPRESS_ERROR;
+	}
+	while (true) {
+		unsigned extra = input->remaining_bits - 16;
+		if (((input->bits >> 16) & ((1U << extra) - 1)) != 0) {
+			return LZXPRESS_ERROR;
+		}
+		if (input->byte_pos == input->byte_size) {
+			break;
+		}
+		/*
+		 * The reserve bits get checked after the refill, with the
+		 * new ones kept in reserve.
+		 */
+		input->remaining_bits = 16;
+		ok = fast_refill_bits(input);
+		if (!ok) {
+			return LZXPRESS_ERROR;
+		}
+	}
+
+	return output_pos;
+}
+
+
+static ssize_t lzxpress_huffman_decompress_fast_internal(
+	struct fast_bitstream *input,
+	uint8_t *output,
+	size_t output_size)
+{
+	size_t output_pos = 0;
+
+	if (input->byte_size < 260) {
+		return LZXPRESS_ERROR;
+	}
+
+	while (input->byte_pos < input->byte_size) {
+		ssize_t block_output_pos;
+		ssize_t block_output_size;
+		size_t remaining_output_size = output_size - output_pos;
+
+		block_output_size = MIN(65536, remaining_output_size);
+
+		block_output_pos = lzx_huffman_decompress_block_fast(
+			input,
+			output + output_pos,
+			block_output_size,
+			remaining_output_size,
+			output_pos);
+
+		if (block_output_pos < block_output_size) {
+			return LZXPRESS_ERROR;
+		}
+		output_pos += block_output_pos;
+		if (output_pos > output_size) {
+			/* not expecting to get here. */
+			return LZXPRESS_ERROR;
+		}
+	}
+
+	if (input->byte_pos != input->byte_size) {
+		return LZXPRESS_ERROR;
+	}
+
+	return output_pos;
+}
+
+
+/*
+ * lzxpress_huffman_decompress_fast()
+ *
+ * The fast counterpart of lzxpress_huffman_decompress(), with the same
+ * arguments and limits.
+ *
+ * @param input_bytes  memory to be decompressed.
+ * @param input_size   length of the compressed buffer.
+ * @param output       destination for the decompressed data.
+ * @param output_size  exact expected length of the decompressed data.
+ *
+ * @return the number of bytes written or -1 on error.
+ */
+ssize_t lzxpress_huffman_decompress_fast(const uint8_t *input_bytes,
+					 size_t input_size,
+					 uint8_t *output,
+					 size_t output_size)
+{
+	uint32_t table[FAST_TABLE_SIZE];
+	struct fast_bitstream input = {
+		.bytes = input_bytes,
+		.byte_size = input_size,
+		.table = table
+	};
+
+	if (input_size > SSIZE_MAX ||
+	    input_size > UINT32_MAX ||
+	    output_size > SSIZE_MAX ||
+	    output_size > UINT32_MAX ||
+	    input_size == 0 ||
+	    output_size == 0 ||
+	    input_bytes == NULL ||
+	    output == NULL) {
+		return LZXPRESS_ERROR;
+	}
+
+	return lzxpress_huffman_decompress_fast_internal(&input,
+							 output,
+							 output_size);
+}
+
+
+/*
+ * lzxpress_huffman_decompress_fast_talloc()
+ *
+ * The fast counterpart of lzxpress_huffman_decompress_talloc().
+ *
+ * @param mem_ctx      TALLOC_CTX parent for the decompressed buffer.
+ * @param input_bytes  memory to be decompressed.
+ * @param input_size   length of the compressed buffer.
+ * @param output_size  expected decompressed size.
+ *
+ * @return a talloc'ed buffer exactly output_size in length, or NULL.
+ */
+uint8_t *lzxpress_huffman_decompress_fast_talloc(TALLOC_CTX *mem_ctx,
+						 const uint8_t *input_bytes,
+						 size_t input_size,
+						 size_t output_size)
+{
+	ssize_t result;
+	uint8_t *output = NULL;
+	struct fast_bitstream input = {
+		.bytes = input_bytes,
+		.byte_size = input_size
+	};
+
+	output = talloc_array(mem_ctx, uint8_t, output_size);
+	if (output == NULL) {
+		return NULL;
+	}
+
+	input.table = talloc_array(mem_ctx, uint32_t, FAST_TABLE_SIZE);
+	if (input.table == NULL) {
+		talloc_free(output);
+		return NULL;
+	}
+	result = lzxpress_huffman_decompress_fast_internal(&input,
+							   output,
+							   output_size);
+	talloc_free(input.table);
+
+	if (result != output_size) {
+		talloc_free(output);
+		return NULL;
+	}
+	return output;
+}
@@ -83,6 +83,54 @@ uint8_t *lzxpress_huffman_decompress_talloc(TALLOC_CTX *mem_ctx,
 					    size_t input_size,
 					    size_t output_size);
 
+/*
+ * The "fast" engine produces and accepts exactly the same format as the
+ * functions above, which are kept as the reference implementation.
+ *
+ * For compression it uses hash chains over the last 64k instead of the small
+ * circular hash tables. How far along the chains it looks is decided by the
+ * effort level, from LZX_HUFF_EFFORT_MIN (fastest) to LZX_HUFF_EFFORT_MAX
+ * (best compression). Out of range values are clamped.
+ *
+ * The hash tables in the embedded struct lzxhuff_compressor_mem are not used.
+ * This struct is around 600k, so it wants to be on the heap.
+ */
+#define LZX_HUFF_FAST_HASH_BITS 15
+#define LZX_HUFF_FAST_WINDOW_SIZE 65536
+
+#define LZX_HUFF_EFFORT_MIN 1
+#define LZX_HUFF_EFFORT_DEFAULT 4
+#define LZX_HUFF_EFFORT_MAX 9
+
+struct lzxhuff_fast_compressor_mem {
+	struct lzxhuff_compressor_mem base;
+	uint32_t hash_head[1 << LZX_HUFF_FAST_HASH_BITS];
+	uint32_t hash_chain[LZX_HUFF_FAST_WINDOW_SIZE];
+};
+
+ssize_t lzxpress_huffman_compress_fast(struct lzxhuff_fast_compressor_mem *cmp,
+				       int effort,
+				       const uint8_t *input_bytes,
+				       size_t input_size,
+				       uint8_t *output,
+				       size_t available_size);
+
+ssize_t lzxpress_huffman_compress_fast_talloc(TALLOC_CTX *mem_ctx,
+					      int effort,
+					      const uint8_t *input_bytes,
+					      size_t input_size,
+					      uint8_t **output);
+
+ssize_t lzxpress_huffman_decompress_fast(const uint8_t *input,
+					 size_t input_size,
+					 uint8_t *output,
+					 size_t output_size);
+
+uint8_t *lzxpress_huffman_decompress_fast_talloc(TALLOC_CTX *mem_ctx,
+						 const uint8_t *input_bytes,
+						 size_t input_size,
+						 size_t output_size);
+
 /*
  * lzxpress_huffman_max_compressed_size()
  *
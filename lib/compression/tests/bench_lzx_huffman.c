@@ -0,0 +1,294 @@
+/*
+ * Samba compression library - LGPLv3
+ *
+ * Benchmark for the LZ77 + Huffman engines.
+ *
+ *  ** NOTE! The following LGPL license applies to this file.
+ *  ** It does NOT imply that all of Samba is released under the LGPL
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: lzx_huffman_bench [-t SECONDS] [FILE...]
+ *
+ * Without files, the corpus is the decompressed test vectors in
+ * testdata/compression/decompressed, so run it from the top of the source
+ * tree. Each engine compresses and decompresses every file repeatedly for
+ * at least SECONDS (default 1), and we print the throughput in MB/s of
+ * uncompressed data along with the compressed/uncompressed ratio.
+ */
+
+#include "replace.h"
+#include <talloc.h>
+#include "system/dir.h"
+#include "system/filesys.h"
+#include "system/time.h"
+#include "lzxpress_huffman.h"
+
+#define DEFAULT_CORPUS "testdata/compression/decompressed"
+
+struct corpus {
+	size_t n_files;
+	uint8_t **data;
+	size_t *size;
+	size_t total;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CUSTOM_CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool add_file(TALLOC_CTX *mem_ctx,
+		     struct corpus *c,
+		     const char *filename)
+{
+	FILE *fh = NULL;
+	struct stat st;
+	uint8_t *data = NULL;
+	size_t len;
+	int ret;
+
+	fh = fopen(filename, "rb");
+	if (fh == NULL) {
+		fprintf(stderr, "could not open %s\n", filename);
+		return false;
+	}
+	ret = fstat(fileno(fh), &st);
+	if (ret != 0 || st.st_size == 0) {
+		/* empty files can't be compressed */
+		fclose(fh);
+		return ret == 0;
+	}
+	data = talloc_array(mem_ctx, uint8_t, st.st_size);
+	if (data == NULL) {
+		fclose(fh);
+		return false;
+	}
+	len = fread(data, 1, st.st_size, fh);
+	fclose(fh);
+	if (len != st.st_size) {
+		fprintf(stderr, "short read on %s\n", filename);
+		return false;
+	}
+
+	c->data = talloc_realloc(mem_ctx, c->data, uint8_t *, c->n_files + 1);
+	c->size = talloc_realloc(mem_ctx, c->size, size_t, c->n_files + 1);
+	if (c->data == NULL || c->size == NULL) {
+		return false;
+	}
+	c->data[c->n_files] = data;
+	c->size[c->n_files] = len;
+	c->n_files++;
+	c->total += len;
+	return true;
+}
+
+static bool load_default_corpus(TALLOC_CTX *mem_ctx, struct corpus *c)
+{
+	DIR *dir = opendir(DEFAULT_CORPUS);
+	struct dirent *de = NULL;
+	bool ok = true;
+
+	if (dir == NULL) {
+		fprintf(stderr, "could not open %s, "
+			"run this from the top of the source tree\n",
+			DEFAULT_CORPUS);
+		return false;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		char *filename = NULL;
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		filename = talloc_asprintf(mem_ctx, "%s/%s",
+					   DEFAULT_CORPUS, de->d_name);
+		if (filename == NULL) {
+			ok = false;
+			break;
+		}
+		ok = add_file(mem_ctx, c, filename);
+		talloc_free(filename);
+		if (!ok) {
+			break;
+		}
+	}
+	closedir(dir);
+	return ok;
+}
+
+/*
+ * effort 0 means the reference implementation.
+ */
+static bool bench_engine(TALLOC_CTX *mem_ctx,
+			 const struct corpus *c,
+			 int effort,
+			 double min_time)
+{
+	struct lzxhuff_fast_compressor_mem *fast_mem = NULL;
+	struct lzxhuff_compressor_mem *ref_mem = NULL;
+	uint8_t **compressed = NULL;
+	ssize_t *compressed_size = NULL;
+	uint8_t *out = NULL;
+	size_t max_size = 0;
+	size_t compressed_total = 0;
+	double start, elapsed;
+	double comp_bytes = 0;
+	double decomp_bytes = 0;
+	double comp_rate, decomp_rate;
+	size_t i;
+
+	fast_mem = talloc(mem_ctx, struct lzxhuff_fast_compressor_mem);
+	ref_mem = talloc(mem_ctx, struct lzxhuff_compressor_mem);
+	compressed = talloc_array(mem_ctx, uint8_t *, c->n_files);
+	compressed_size = talloc_array(mem_ctx, ssize_t, c->n_files);
+	if (fast_mem == NULL || ref_mem == NULL ||
+	    compressed == NULL || compressed_size == NULL) {
+		return false;
+	}
+	for (i = 0; i < c->n_files; i++) {
+		size_t len = lzxpress_huffman_max_compressed_size(c->size[i]);
+		compressed[i] = talloc_array(compressed, uint8_t, len);
+		if (compressed[i] == NULL) {
+			return false;
+		}
+		max_size = MAX(max_size, c->size[i]);
+	}
+	out = talloc_array(mem_ctx, uint8_t, max_size);
+	if (out == NULL) {
+		return false;
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < c->n_files; i++) {
+			size_t avail = lzxpress_huffman_max_compressed_size(
+				c->size[i]);
+			if (effort == 0) {
+				compressed_size[i] = lzxpress_huffman_compress(
+					ref_mem,
+					c->data[i],
+					c->size[i],
+					compressed[i],
+					avail);
+			} else {
+				compressed_size[i] =
+					lzxpress_huffman_compress_fast(
+						fast_mem,
+						effort,
+						c->data[i],
+						c->size[i],
+						compressed[i],
+						avail);
+			}
+			if (compressed_size[i] < 0) {
+				fprintf(stderr, "compression failed\n");
+				return false;
+			}
+		}
+		comp_bytes += c->total;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+	comp_rate = comp_bytes / elapsed / (1024 * 1024);
+
+	for (i = 0; i < c->n_files; i++) {
+		compressed_total += compressed_size[i];
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < c->n_files; i++) {
+			ssize_t ret;
+			if (effort == 0) {
+				ret = lzxpress_huffman_decompress(
+					compressed[i],
+					compressed_size[i],
+					out,
+					c->size[i]);
+			} else {
+				ret = lzxpress_huffman_decompress_fast(
+					compressed[i],
+					compressed_size[i],
+					out,
+					c->size[i]);
+			}
+			if (ret != c->size[i] ||
+			    memcmp(out, c->data[i], c->size[i]) != 0) {
+				fprintf(stderr, "round trip failed\n");
+				return false;
+			}
+		}
+		decomp_bytes += c->total;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+	decomp_rate = decomp_bytes / elapsed / (1024 * 1024);
+
+	if (effort == 0) {
+		printf("%-16s", "reference");
+	} else {
+		printf("fast, effort %d  ", effort);
+	}
+	printf("%8.4f %14.1f %16.1f\n",
+	       (double)compressed_total / c->total,
+	       comp_rate,
+	       decomp_rate);
+
+	talloc_free(fast_mem);
+	talloc_free(ref_mem);
+	talloc_free(compressed);
+	talloc_free(compressed_size);
+	talloc_free(out);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct corpus c = {0};
+	double min_time = 1.0;
+	int effort;
+	int i = 1;
+	bool ok = true;
+
+	if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+		min_time = atof(argv[2]);
+		i = 3;
+	}
+	if (i == argc) {
+		ok = load_default_corpus(mem_ctx, &c);
+	}
+	for (; ok && i < argc; i++) {
+		ok = add_file(mem_ctx, &c, argv[i]);
+	}
+	if (!ok || c.n_files == 0) {
+		fprintf(stderr,
+			"Usage: %s [-t SECONDS] [FILE...]\n", argv[0]);
+		talloc_free(mem_ctx);
+		return 1;
+	}
+
+	printf("corpus: %zu files, %zu bytes\n\n", c.n_files, c.total);
+	printf("%-16s%8s %14s %16s\n",
+	       "engine", "ratio", "compress MB/s", "decompress MB/s");
+
+	for (effort = 0; ok && effort <= LZX_HUFF_EFFORT_MAX; effort++) {
+		ok = bench_engine(mem_ctx, &c, effort, min_time);
+	}
+
+	talloc_free(mem_ctx);
+	return ok ? 0 : 1;
+}
@@ -1227,6 +1227,394 @@ static void test_lzxpress_huffman_decompress_empty_or_null(void **state)
 }
 
 
+/*
+ * The fast engine should agree with the reference in both directions.
+ */
+
+static ssize_t attempt_fast_round_trip(TALLOC_CTX *mem_ctx,
+				       DATA_BLOB original,
+				       int effort)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+	uint8_t *compressed = NULL;
+	uint8_t *decompressed = talloc_array(tmp_ctx, uint8_t,
+					     original.length);
+	ssize_t comp_written, decomp_written;
+
+	comp_written = lzxpress_huffman_compress_fast_talloc(tmp_ctx,
+							     effort,
+							     original.data,
+							     original.length,
+							     &compressed);
+	if (comp_written <= 0) {
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	/* the reference decoder */
+	decomp_written = lzxpress_huffman_decompress(compressed,
+						     comp_written,
+						     decompressed,
+						     original.length);
+	if (decomp_written != original.length ||
+	    memcmp(decompressed, original.data, original.length) != 0) {
+		debug_message("\033[1;31mreference decoder failed "
+			      "at effort %d\033[0m\n", effort);
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	/* and the fast one */
+	memset(decompressed, 0, original.length);
+	decomp_written = lzxpress_huffman_decompress_fast(compressed,
+							  comp_written,
+							  decompressed,
+							  original.length);
+	if (decomp_written != original.length ||
+	    memcmp(decompressed, original.data, original.length) != 0) {
+		debug_message("\033[1;31mfast decoder failed "
+			      "at effort %d\033[0m\n", effort);
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	talloc_free(tmp_ctx);
+	return comp_written;
+}
+
+
+static void test_lzxpress_huffman_fast_decompress(void **state)
+{
+	size_t i;
+	ssize_t written;
+	uint8_t *dest = NULL;
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	for (i = 0; bidirectional_pairs[i].name != NULL; i++) {
+		struct lzx_pair p = bidirectional_pairs[i];
+		dest = talloc_array(mem_ctx, uint8_t, p.decompressed.length);
+
+		written = lzxpress_huffman_decompress_fast(p.compressed.data,
+							   p.compressed.length,
+							   dest,
+							   p.decompressed.length);
+		assert_int_equal(written, p.decompressed.length);
+		assert_memory_equal(dest, p.decompressed.data,
+				    p.decompressed.length);
+		talloc_free(dest);
+	}
+	talloc_free(mem_ctx);
+}
+
+
+static void test_lzxpress_huffman_fast_decompress_files(void **state)
+{
+	size_t i, j;
+	int score = 0;
+	int found = 0;
+	const char *dirs[] = {COMP_DIR, MORE_COMP_DIR};
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+
+	for (i = 0; file_names[i] != NULL; i++) {
+		for (j = 0; j < ARRAY_SIZE(dirs); j++) {
+			char filename[200];
+			uint8_t *dest = NULL;
+			TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+			struct lzx_pair p = {
+				.name = file_names[i]
+			};
+
+			snprintf(filename, sizeof(filename),
+				 "%s/%s.decomp", DECOMP_DIR, p.name);
+			p.decompressed = datablob_from_file(tmp_ctx, filename);
+			assert_non_null(p.decompressed.data);
+
+			snprintf(filename, sizeof(filename),
+				 "%s/%s.lzhuff", dirs[j], p.name);
+			p.compressed = datablob_from_file(tmp_ctx, filename);
+			if (p.compressed.data == NULL) {
+				/* not all are in the more-compressed dir */
+				talloc_free(tmp_ctx);
+				continue;
+			}
+			found++;
+
+			dest = lzxpress_huffman_decompress_fast_talloc(
+				tmp_ctx,
+				p.compressed.data,
+				p.compressed.length,
+				p.decompressed.length);
+			if (dest != NULL &&
+			    memcmp(dest, p.decompressed.data,
+				   p.decompressed.length) == 0) {
+				score++;
+			} else {
+				debug_message("\033[1;31mfailed to decompress "
+					      "%s/%s!\033[0m\n", dirs[j], p.name);
+			}
+			talloc_free(tmp_ctx);
+		}
+	}
+	debug_message("%d/%d correct\n", score, found);
+	assert_int_equal(score, found);
+	talloc_free(mem_ctx);
+}
+
+
+static void test_lzxpress_huffman_fast_round_trip(void **state)
+{
+	size_t i, j;
+	int score = 0;
+	int efforts[] = {
+		LZX_HUFF_EFFORT_MIN,
+		LZX_HUFF_EFFORT_DEFAULT,
+		LZX_HUFF_EFFORT_MAX,
+	};
+	ssize_t compressed_total[ARRAY_SIZE(efforts)] = {0};
+	ssize_t reference_total = 0;
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+
+	for (i = 0; file_names[i] != NULL; i++) {
+		char filename[200];
+		TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+		DATA_BLOB original;
+		uint8_t *ref = NULL;
+		ssize_t ref_size;
+
+		snprintf(filename, sizeof(filename),
+			 "%s/%s.decomp", DECOMP_DIR, file_names[i]);
+		original = datablob_from_file(tmp_ctx, filename);
+		assert_non_null(original.data);
+
+		ref_size = lzxpress_huffman_compress_talloc(tmp_ctx,
+							    original.data,
+							    original.length,
+							    &ref);
+		assert_true(ref_size > 0);
+		reference_total += ref_size;
+
+		for (j = 0; j < ARRAY_SIZE(efforts); j++) {
+			ssize_t comp_size;
+			comp_size = attempt_fast_round_trip(tmp_ctx,
+							    original,
+							    efforts[j]);
+			if (comp_size > 0) {
+				score++;
+				compressed_total[j] += comp_size;
+			} else {
+				debug_message("\033[1;31mfailed round trip "
+					      "%s effort %d\033[0m\n",
+					      file_names[i], efforts[j]);
+			}
+		}
+		talloc_free(tmp_ctx);
+	}
+
+	for (j = 0; j < ARRAY_SIZE(efforts); j++) {
+		print_message("effort %d: total compressed size %zd "
+			      "(reference %zd)\n",
+			      efforts[j], compressed_total[j], reference_total);
+	}
+	assert_int_equal(score, i * ARRAY_SIZE(efforts));
+
+	/*
+	 * The default effort should be about as good as the reference, and
+	 * more effort should never be worse overall.
+	 */
+	assert_true(compressed_total[1] < reference_total +
+		    reference_total / 50);
+	assert_true(compressed_total[2] <= compressed_total[1]);
+	assert_true(compressed_total[1] <= compressed_total[0]);
+	talloc_free(mem_ctx);
+}
+
+
+static void test_lzxpress_huffman_fast_edge_cases(void **state)
+{
+	size_t i, j;
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	DATA_BLOB original = data_blob_talloc(mem_ctx, NULL, 300 * 1024);
+	ssize_t lengths[] = {
+		1, 2, 3, 40, 41, 42, 274, 65535, 65536, 65537,
+		131072, 200000, 300 * 1024, -1
+	};
+	ssize_t comp_size;
+	struct jsf_rng rng;
+
+	/*
+	 * Long runs (which go over block boundaries), runs of short
+	 * repeats, and noise, each in a variety of lengths.
+	 */
+	jsf32_init(&rng, 3);
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < original.length; i++) {
+			switch (j) {
+			case 0:
+				original.data[i] = i < 150000 ? 'a' : 'b';
+				break;
+			case 1:
+				original.data[i] = "abcab"[i % 5];
+				break;
+			default:
+				original.data[i] = jsf32(&rng);
+				break;
+			}
+		}
+		for (i = 0; lengths[i] >= 0; i++) {
+			DATA_BLOB d = {
+				.data = original.data,
+				.length = lengths[i],
+			};
+			comp_size = attempt_fast_round_trip(mem_ctx, d,
+						LZX_HUFF_EFFORT_MIN);
+			assert_true(comp_size > 0);
+			comp_size = attempt_fast_round_trip(mem_ctx, d,
+						LZX_HUFF_EFFORT_MAX);
+			assert_true(comp_size > 0);
+		}
+	}
+	talloc_free(mem_ctx);
+}
+
+
+static void test_lzxpress_huffman_fast_decompress_agrees(void **state)
+{
+	/*
+	 * Damaged input should be rejected (or not) by the fast decoder
+	 * exactly as by the reference, and where it is accepted, the output
+	 * should be the same.
+	 */
+	size_t i, j;
+	size_t n_same = 0;
+	size_t n_tried = 0;
+	struct jsf_rng rng;
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+
+	jsf32_init(&rng, 4);
+
+	for (i = 0; file_names[i] != NULL; i++) {
+		char filename[200];
+		TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+		DATA_BLOB decompressed;
+		DATA_BLOB compressed;
+		uint8_t *damaged = NULL;
+		uint8_t *ref_out = NULL;
+		uint8_t *fast_out = NULL;
+
+		snprintf(filename, sizeof(filename),
+			 "%s/%s.decomp", DECOMP_DIR, file_names[i]);
+		decompressed = datablob_from_file(tmp_ctx, filename);
+		assert_non_null(decompressed.data);
+
+		snprintf(filename, sizeof(filename),
+			 "%s/%s.lzhuff", COMP_DIR, file_names[i]);
+		compressed = datablob_from_file(tmp_ctx, filename);
+		assert_non_null(compressed.data);
+
+		damaged = talloc_array(tmp_ctx, uint8_t, compressed.length);
+		ref_out = talloc_array(tmp_ctx, uint8_t, decompressed.length);
+		fast_out = talloc_array(tmp_ctx, uint8_t, decompressed.length);
+		assert_non_null(damaged);
+		assert_non_null(ref_out);
+		assert_non_null(fast_out);
+
+		for (j = 0; j < 20; j++) {
+			size_t len = compressed.length;
+			ssize_t ref_ret, fast_ret;
+			uint32_t r = jsf32(&rng);
+
+			memcpy(damaged, compressed.data, len);
+			switch (j % 4) {
+			case 0:
+				/* flip a bit in the data */
+				damaged[r % len] ^= 1 << (r >> 29);
+				break;
+			case 1:
+				/* flip a bit in the last few bytes */
+				damaged[len - 1 - r % MIN(len, 8)] ^= 1 << (r >> 29);
+				break;
+			case 2:
+				/* truncate */
+				len -= 1 + r % MIN(len, 4);
+				break;
+			default:
+				/* change a code length in the table */
+				damaged[r % 256] = r >> 24;
+				break;
+			}
+
+			ref_ret = lzxpress_huffman_decompress(damaged, len,
+							      ref_out,
+							      decompressed.length);
+			fast_ret = lzxpress_huffman_decompress_fast(damaged, len,
+								    fast_out,
+								    decompressed.length);
+			n_tried++;
+			if (ref_ret != fast_ret) {
+				debug_message("%s: reference %zd, fast %zd\n",
+					      file_names[i], ref_ret, fast_ret);
+				continue;
+			}
+			if (ref_ret > 0 &&
+			    memcmp(ref_out, fast_out, ref_ret) != 0) {
+				debug_message("%s: different output\n",
+					      file_names[i]);
+				continue;
+			}
+			n_same++;
+		}
+		talloc_free(tmp_ctx);
+	}
+	debug_message("%zu/%zu the same\n", n_same, n_tried);
+	assert_int_equal(n_same, n_tried);
+	talloc_free(mem_ctx);
+}
+
+
+static void test_lzxpress_huffman_fast_empty_or_null(void **state)
+{
+	ssize_t ret;
+	const uint8_t *input = bidirectional_pairs[0].decompressed.data;
+	size_t ilen = bidirectional_pairs[0].decompressed.length;
+	const uint8_t *cinput = bidirectional_pairs[0].compressed.data;
+	size_t clen = bidirectional_pairs[0].compressed.length;
+	uint8_t output[ilen + 300];
+	struct lzxhuff_fast_compressor_mem *cmp_mem =
+		talloc(NULL, struct lzxhuff_fast_compressor_mem);
+
+	assert_non_null(cmp_mem);
+
+	ret = lzxpress_huffman_compress_fast(cmp_mem, 1, input, 0,
+					     output, sizeof(output));
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_compress_fast(cmp_mem, 1, input, ilen,
+					     output, 0);
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_compress_fast(cmp_mem, 1, NULL, ilen,
+					     output, sizeof(output));
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_compress_fast(NULL, 1, input, ilen,
+					     output, sizeof(output));
+	assert_int_equal(ret, -1LL);
+	/* effort is clamped */
+	ret = lzxpress_huffman_compress_fast(cmp_mem, 100, input, ilen,
+					     output, sizeof(output));
+	assert_true(ret > 0);
+
+	ret = lzxpress_huffman_decompress_fast(cinput, 0, output, ilen);
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_decompress_fast(cinput, clen, output, 0);
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_decompress_fast(NULL, clen, output, ilen);
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_decompress_fast(cinput, clen, NULL, ilen);
+	assert_int_equal(ret, -1LL);
+	ret = lzxpress_huffman_decompress_fast(cinput, clen, output, ilen);
+	assert_int_equal(ret, ilen);
+
+	talloc_free(cmp_mem);
+}
+
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_lzxpress_huffman_short_boring_strings),
@@ -1247,6 +1635,12 @@ int main(void) {
 		cmocka_unit_test(test_lzxpress_huffman_overlong_matches),
 		cmocka_unit_test(test_lzxpress_huffman_decompress_empty_or_null),
 		cmocka_unit_test(test_lzxpress_huffman_compress_empty_or_null),
+		cmocka_unit_test(test_lzxpress_huffman_fast_decompress),
+		cmocka_unit_test(test_lzxpress_huffman_fast_decompress_files),
+		cmocka_unit_test(test_lzxpress_huffman_fast_round_trip),
+		cmocka_unit_test(test_lzxpress_huffman_fast_edge_cases),
+		cmocka_unit_test(test_lzxpress_huffman_fast_decompress_agrees),
+		cmocka_unit_test(test_lzxpress_huffman_fast_empty_or_null),
 	};
 	if (!isatty(1)) {
 		cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
@@ -456,6 +456,34 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Like dbwrap_traverse_read(), but backends may deliver the records
+ * in any order, possibly walking the database with several helper
+ * processes. f is always called in the calling process.
+ */
+NTSTATUS dbwrap_traverse_read_parallel(struct db_context *db,
+				       int (*f)(struct db_record*, void*),
+				       void *private_data,
+				       int *count)
+{
+	int ret;
+
+	if (db->traverse_read_parallel == NULL) {
+		return dbwrap_traverse_read(db, f, private_data, count);
+	}
+
+	ret = db->traverse_read_parallel(db, f, private_data);
+	if (ret < 0) {
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
+	}
+
+	if (count != NULL) {
+		*count = ret;
+	}
+
+	return NT_STATUS_OK;
+}
+
 NTSTATUS dbwrap_traverse_per_rec_persistent_read(
 	struct db_context *db,
 	int (*f)(struct db_record*, void*),
@@ -133,6 +133,10 @@ NTSTATUS dbwrap_traverse_per_rec_persistent_read(
 	int (*f)(struct db_record*, void*),
 	void *private_data,
 	int *count);
+NTSTATUS dbwrap_traverse_read_parallel(struct db_context *db,
+				       int (*f)(struct db_record*, void*),
+				       void *private_data,
+				       int *count);
 NTSTATUS dbwrap_parse_record(struct db_context *db, TDB_DATA key,
 			     void (*parser)(TDB_DATA key, TDB_DATA data,
 					    void *private_data),
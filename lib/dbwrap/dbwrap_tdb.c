@@ -687,6 +687,32 @@ static int db_tdb_traverse_read(struct db_context *db,
 	return nrecs;
 }
 
+static int db_tdb_traverse_read_parallel(
+	struct db_context *db,
+	int (*f)(struct db_record *rec, void *private_data),
+	void *private_data)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+	struct db_tdb_traverse_ctx ctx;
+	int nrecs;
+
+	ctx = (struct db_tdb_traverse_ctx) {
+		.db = db,
+		.f = f,
+		.private_data = private_data,
+	};
+
+	nrecs = tdb_traverse_read_parallel(db_ctx->wtdb->tdb,
+					   0,
+					   db_tdb_traverse_read_func,
+					   &ctx);
+	if (ctx.found_marker) {
+		nrecs--;
+	}
+	return nrecs;
+}
+
 static int db_tdb_traverse_per_rec_persistent_read(
 	struct db_context *db,
 	int (*f)(struct db_record *rec,
@@ -986,6 +1012,7 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 	result->do_locked = db_tdb_do_locked;
 	result->traverse = db_tdb_traverse;
 	result->traverse_read = db_tdb_traverse_read;
+	result->traverse_read_parallel = db_tdb_traverse_read_parallel;
 	result->parse_record = db_tdb_parse;
 	result->get_seqnum = db_tdb_get_seqnum;
 	result->persistent = ((tdb_flags & TDB_CLEAR_IF_FIRST) == 0);
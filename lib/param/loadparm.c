@@ -3030,6 +3030,7 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 	lpcfg_do_global_parameter(lp_ctx, "mangled names", "illegal");
 
 	lpcfg_do_global_parameter_var(lp_ctx, "smb2 max credits", "%u", DEFAULT_SMB2_MAX_CREDITS);
+	lpcfg_do_global_parameter(lp_ctx, "smb2 credits target latency", "0");
 
 	lpcfg_do_global_parameter(lp_ctx, "ldap ssl", "start tls");
 
@@ -3193,12 +3194,20 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 
 	lpcfg_do_global_parameter(lp_ctx, "aio max threads", "100");
 
+	lpcfg_do_global_parameter(lp_ctx, "smb3 crypto offload threshold", "0");
+	lpcfg_do_global_parameter(lp_ctx, "smbd zerocopy send threshold", "0");
+	lpcfg_do_global_parameter(lp_ctx, "smb2 channel io threads", "no");
+
 	lpcfg_do_global_parameter(lp_ctx, "smb2 leases", "yes");
 
 	lpcfg_do_global_parameter(lp_ctx, "smb3 directory leases", "Auto");
 
 	lpcfg_do_global_parameter(lp_ctx, "smb3 unix extensions", "yes");
 
+	lpcfg_do_global_parameter(lp_ctx, "smb3 compress data", "requested");
+
+	lpcfg_do_global_parameter(lp_ctx, "smb3 compression threshold", "4096");
+
 	lpcfg_do_global_parameter(lp_ctx, "server multi channel support", "yes");
 
 	lpcfg_do_global_parameter(lp_ctx, "kerberos encryption types", "all");
@@ -249,6 +249,13 @@ enum spotlight_backend_options {
 	SPOTLIGHT_BACKEND_ES,
 };
 
+/* SMB3 compression of READ responses */
+enum smb3_compress_data_options {
+	SMB3_COMPRESS_DATA_NO,
+	SMB3_COMPRESS_DATA_REQUESTED,
+	SMB3_COMPRESS_DATA_YES,
+};
+
 /* FIPS values */
 enum samba_weak_crypto {
 	SAMBA_WEAK_CRYPTO_UNKNOWN,
@@ -446,6 +446,17 @@ static const struct enum_list enum_spotlight_backend[] = {
 	{-1, NULL}
 };
 
+static const struct enum_list enum_smb3_compress_data[] = {
+	{SMB3_COMPRESS_DATA_NO, "no"},
+	{SMB3_COMPRESS_DATA_NO, "false"},
+	{SMB3_COMPRESS_DATA_NO, "off"},
+	{SMB3_COMPRESS_DATA_REQUESTED, "requested"},
+	{SMB3_COMPRESS_DATA_YES, "yes"},
+	{SMB3_COMPRESS_DATA_YES, "true"},
+	{SMB3_COMPRESS_DATA_YES, "on"},
+	{-1, NULL}
+};
+
 static const struct enum_list enum_debug_syslog_format[] = {
 	{DEBUG_SYSLOG_FORMAT_NO, "No"},
 	{DEBUG_SYSLOG_FORMAT_NO, "False"},
@@ -0,0 +1,3 @@
+BINDIR = '/tmp/tinst/bin'
+LIBDIR = '/tmp/tinst/lib64'
+PREFIX = '/tmp/tinst'
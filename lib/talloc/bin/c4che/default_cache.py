@@ -0,0 +1,584 @@
+ABI_CHECK = False
+AR = ['/usr/bin/ar']
+ARFLAGS = ['rcs']
+AUTOCONF_BUILD = ''
+AUTOCONF_HOST = ''
+AUTOCONF_PROGRAM_PREFIX = ''
+BINDIR = '${PREFIX}/bin'
+BOOL_DEFINED = 1
+BUILD_DIRECTORY = '/root/repo/lib/talloc/bin'
+BUILTIN_LIBRARIES = ['replace']
+BUNDLED_LIBS = ['']
+CC = ['/usr/bin/gcc']
+CCLNK_SRC_F = []
+CCLNK_TGT_F = ['-o']
+CC_NAME = 'gcc'
+CC_SRC_F = []
+CC_TGT_F = ['-c', '-o']
+CC_VERSION = ('12', '2', '0')
+CFLAGS = ['-MMD', '-D_GNU_SOURCE=1', '-D_XOPEN_SOURCE_EXTENDED=1']
+CFLAGS_MACBUNDLE = ['-fPIC']
+CFLAGS_PYEMBED = ['-g', '-fwrapv', '-O3']
+CFLAGS_PYEXT = ['-fno-strict-aliasing']
+CFLAGS_crypt = []
+CFLAGS_cshlib = ['-fPIC']
+COMPILER_CC = 'gcc'
+CPPPATH = ['/usr/local/include']
+CPPPATH_ST = '-I%s'
+CROSS_ANSWERS = ''
+CROSS_COMPILE = False
+CROSS_EXECUTE = ''
+CXXFLAGS_PYEMBED = ['-g', '-fwrapv', '-O3']
+CXXFLAGS_PYEXT = ['-g', '-fwrapv', '-O3']
+DATADIR = '/tmp/tinst/share'
+DATAROOTDIR = '/tmp/tinst/share'
+DEFINES = ['HAVE_PYEMBED=1', 'HAVE_PYEXT=1', 'HAVE_PYTHON_H=1']
+DEFINES_PYEMBED = ['NDEBUG']
+DEFINES_PYEXT = []
+DEFINES_ST = '-D%s'
+DEST_BINFMT = 'elf'
+DEST_CPU = 'x86_64'
+DEST_OS = 'linux'
+DLOPEN_TAKES_UNSIGNED_FLAGS = ()
+DOCDIR = '/tmp/tinst/share/doc/talloc'
+DVIDIR = '/tmp/tinst/share/doc/talloc'
+ENABLE_GCCDEPS = ['c']
+EXEC_PREFIX = '/tmp/tinst'
+EXTRA_CFLAGS = ['-fPIC', '-D__STDC_WANT_LIB_EXT1__=1', '-fstack-protector-strong', '-Wp,-U_FORTIFY_SOURCE,-D_FORTIFY_SOURCE=3', '-fstack-clash-protection']
+EXTRA_LDFLAGS = ['-Wl,-no-undefined']
+GIT = ['/usr/bin/git']
+GIT_LOCAL_CHANGES = False
+HAVE_ALLOCA_H = 1
+HAVE_ARPA_INET_H = 1
+HAVE_ARPA_NAMESER_H = 1
+HAVE_ASM_UNISTD_H = 1
+HAVE_ASPRINTF = 1
+HAVE_ASSERT_H = 1
+HAVE_ATOMIC_ADD_32 = ()
+HAVE_ATOMIC_THREAD_FENCE = 1
+HAVE_ATOMIC_THREAD_FENCE_SUPPORT = 1
+HAVE_BASENAME = 1
+HAVE_BIG_ENDIAN = ()
+HAVE_BINDTEXTDOMAIN = 1
+HAVE_BIND_TEXTDOMAIN_CODESET = 1
+HAVE_BLKCNT_T = 1
+HAVE_BLKSIZE_T = 1
+HAVE_BOOL = 1
+HAVE_BSD_STRTOLL = ()
+HAVE_C99_VSNPRINTF = 1
+HAVE_CHOWN = 1
+HAVE_CHROOT = 1
+HAVE_CHSIZE = ()
+HAVE_CLOCK_GETTIME = 1
+HAVE_CLOCK_MONOTONIC = 1
+HAVE_CLOCK_PROCESS_CPUTIME_ID = 1
+HAVE_CLOCK_REALTIME = 1
+HAVE_CLOSEFROM = 1
+HAVE_COMPARISON_FN_T = 1
+HAVE_CONNECT = 1
+HAVE_CONSTRUCTOR_ATTRIBUTE = 1
+HAVE_COPY_FILE_RANGE = 1
+HAVE_CRYPT = 1
+HAVE_CRYPT_H = 1
+HAVE_CRYPT_R = 1
+HAVE_CRYPT_RN = 1
+HAVE_CTYPE_H = 1
+HAVE_DECL_ASPRINTF = 1
+HAVE_DECL_BINDTEXTDOMAIN = 1
+HAVE_DECL_BIND_TEXTDOMAIN_CODESET = 1
+HAVE_DECL_DGETTEXT = 1
+HAVE_DECL_DLOPEN = 1
+HAVE_DECL_EWOULDBLOCK = 1
+HAVE_DECL_FDATASYNC = 1
+HAVE_DECL_GETGRENT_R = 1
+HAVE_DECL_GETPWENT_R = 1
+HAVE_DECL_GETTEXT = 1
+HAVE_DECL_GETTIMEOFDAY = 1
+HAVE_DECL_MALLOC = 1
+HAVE_DECL_MEMALIGN = 1
+HAVE_DECL_PTHREAD_MUTEX_ROBUST = 1
+HAVE_DECL_RL_EVENT_HOOK = 1
+HAVE_DECL_SNPRINTF = 1
+HAVE_DECL_STRPTIME = 1
+HAVE_DECL_TEXTDOMAIN = 1
+HAVE_DECL_VASPRINTF = 1
+HAVE_DECL_VSNPRINTF = 1
+HAVE_DESTRUCTOR_ATTRIBUTE = 1
+HAVE_DGETTEXT = 1
+HAVE_DIRENT_H = 1
+HAVE_DIRNAME = 1
+HAVE_DLCLOSE = 1
+HAVE_DLERROR = 1
+HAVE_DLFCN_H = 1
+HAVE_DLOPEN = 1
+HAVE_DLSYM = 1
+HAVE_DPRINTF = 1
+HAVE_DUP2 = 1
+HAVE_ENDIAN_H = 1
+HAVE_ENVIRON_DECL = 1
+HAVE_EPOLL = 1
+HAVE_EPOLL_CREATE1 = 1
+HAVE_ERRNO_DECL = 1
+HAVE_ERRNO_H = 1
+HAVE_EVENTFD = 1
+HAVE_FALLTHROUGH_ATTRIBUTE = 1
+HAVE_FCNTL_H = 1
+HAVE_FDATASYNC = 1
+HAVE_FLOAT_H = 1
+HAVE_FMEMOPEN = 1
+HAVE_FNMATCH_H = 1
+HAVE_FREEADDRINFO = 1
+HAVE_FREEIFADDRS = 1
+HAVE_FTRUNCATE = 1
+HAVE_FUNCTION_MACRO = 1
+HAVE_GAI_STRERROR = 1
+HAVE_GCC_VOLATILE_MEMORY_PROTECTION = 1
+HAVE_GETADDRINFO = 1
+HAVE_GETAUXVAL = 1
+HAVE_GETGRENT_R = 1
+HAVE_GETGRENT_R_DECL = 1
+HAVE_GETGRGID_R = 1
+HAVE_GETGRNAM_R = 1
+HAVE_GETGROUPLIST = 1
+HAVE_GETHOSTBYNAME = 1
+HAVE_GETIFADDRS = 1
+HAVE_GETNAMEINFO = 1
+HAVE_GETOPT_H = 1
+HAVE_GETPAGESIZE = 1
+HAVE_GETPEEREID = ()
+HAVE_GETPGRP = 1
+HAVE_GETPROGNAME = ()
+HAVE_GETPWENT_R = 1
+HAVE_GETPWENT_R_DECL = 1
+HAVE_GETPWNAM_R = 1
+HAVE_GETPWUID_R = 1
+HAVE_GETTEXT = 1
+HAVE_GETTIMEOFDAY_TZ = ()
+HAVE_GETTIMEOFDAY_TZ_VOID = 1
+HAVE_GETXATTR = 1
+HAVE_GET_CURRENT_DIR_NAME = 1
+HAVE_GLOB_H = 1
+HAVE_GRP_H = 1
+HAVE_ICONV_H = 1
+HAVE_IFACE_AIX = ()
+HAVE_IFACE_GETIFADDRS = ()
+HAVE_IFACE_IFCONF = ()
+HAVE_IFACE_IFREQ = ()
+HAVE_IFADDRS_H = 1
+HAVE_IF_NAMEINDEX = 1
+HAVE_IF_NAMETOINDEX = 1
+HAVE_IMMEDIATE_STRUCTURES = 1
+HAVE_INCOHERENT_MMAP = ()
+HAVE_INET_ATON = 1
+HAVE_INET_NTOA = 1
+HAVE_INET_NTOP = 1
+HAVE_INET_PTON = 1
+HAVE_INITGROUPS = 1
+HAVE_INOTIFY_INIT = 1
+HAVE_INO_T = 1
+HAVE_INT16_T = 1
+HAVE_INT32_T = 1
+HAVE_INT64_T = 1
+HAVE_INT8_T = 1
+HAVE_INTPTR_T = 1
+HAVE_INTTYPES_H = 1
+HAVE_IPV6 = 1
+HAVE_IPV6_V6ONLY = 1
+HAVE_ISATTY = 1
+HAVE_LANGINFO_H = 1
+HAVE_LARGEFILE = 1
+HAVE_LASTLOG_H = 1
+HAVE_LCHOWN = 1
+HAVE_LD_VERSION_SCRIPT = True
+HAVE_LIBCRYPT = 1
+HAVE_LIBGEN_H = 1
+HAVE_LIBINTL_H = 1
+HAVE_LIBREPLACE = 1
+HAVE_LIMITS_H = 1
+HAVE_LINK = 1
+HAVE_LINUX_OPENAT2_H = 1
+HAVE_LINUX_TYPES_H = 1
+HAVE_LITTLE_ENDIAN = 1
+HAVE_LOCALE_H = 1
+HAVE_LOFF_T = 1
+HAVE_LONG_LONG = 1
+HAVE_LSTAT = 1
+HAVE_MALLOC_H = 1
+HAVE_MEMALIGN = 1
+HAVE_MEMCPY = 1
+HAVE_MEMMEM = 1
+HAVE_MEMMOVE = 1
+HAVE_MEMORY_H = 1
+HAVE_MEMSET_EXPLICIT = ()
+HAVE_MEMSET_S = ()
+HAVE_MKDIR_MODE = 1
+HAVE_MKDTEMP = 1
+HAVE_MKTIME = 1
+HAVE_MMAP = 1
+HAVE_MNTENT_H = 1
+HAVE_MREMAP = 1
+HAVE_NETDB_H = 1
+HAVE_NETINET_IN_H = 1
+HAVE_NETINET_IN_SYSTM_H = 1
+HAVE_NETINET_IP_H = 1
+HAVE_NETINET_TCP_H = 1
+HAVE_NET_IF_H = 1
+HAVE_NSS_H = 1
+HAVE_OFFSET_T = ()
+HAVE_OPEN_O_DIRECT = 1
+HAVE_PEERCRED = 1
+HAVE_PIPE = 1
+HAVE_POLL = 1
+HAVE_POLL_H = 1
+HAVE_POSIX_FALLOCATE = 1
+HAVE_POSIX_MEMALIGN = 1
+HAVE_PRCTL = 1
+HAVE_PREAD = 1
+HAVE_PREAD_DECL = 1
+HAVE_PRINTF = 1
+HAVE_PROGRAM_INVOCATION_SHORT_NAME = 1
+HAVE_PTHREAD = '1'
+HAVE_PTHREAD_ATTR_INIT = 1
+HAVE_PTHREAD_CREATE = 1
+HAVE_PTHREAD_H = 1
+HAVE_PTHREAD_MUTEXATTR_SETROBUST = 1
+HAVE_PTHREAD_MUTEX_CONSISTENT = 1
+HAVE_PTRDIFF_T = 1
+HAVE_PWD_H = 1
+HAVE_PWRITE = 1
+HAVE_PWRITE_DECL = 1
+HAVE_PYEMBED = 1
+HAVE_PYEXT = 1
+HAVE_PYTHON_H = 1
+HAVE_RAND = 1
+HAVE_RANDOM = 1
+HAVE_READLINE_HISTORY_H = 1
+HAVE_READLINE_READLINE_H = 1
+HAVE_READLINK = 1
+HAVE_REALPATH = 1
+HAVE_RENAME = 1
+HAVE_RENAMEAT2 = 1
+HAVE_RESOLV_H = 1
+HAVE_RES_SEARCH = 1
+HAVE_ROBUST_MUTEXES = 1
+HAVE_RPC_NETTYPE_H = 1
+HAVE_RPC_RPC_H = 1
+HAVE_RPC_RPC_HEADERS = ()
+HAVE_SA_FAMILY_T = 1
+HAVE_SECURE_MKSTEMP = 1
+HAVE_SETBUFFER = 1
+HAVE_SETEGID = 1
+HAVE_SETENV = 1
+HAVE_SETENV_DECL = 1
+HAVE_SETEUID = 1
+HAVE_SETGID = 1
+HAVE_SETGROUPS = 1
+HAVE_SETJMP_H = 1
+HAVE_SETLINEBUF = 1
+HAVE_SETPROCTITLE = ()
+HAVE_SETPROCTITLE_INIT = ()
+HAVE_SETREGID = 1
+HAVE_SETRESGID = 1
+HAVE_SETRESGID_DECL = 1
+HAVE_SETRESUID = 1
+HAVE_SETRESUID_DECL = 1
+HAVE_SETREUID = 1
+HAVE_SETSID = 1
+HAVE_SETUID = 1
+HAVE_SHADOW_H = 1
+HAVE_SHARED_MMAP = 1
+HAVE_SHL_FINDSYM = ()
+HAVE_SHL_LOAD = ()
+HAVE_SHL_UNLOAD = ()
+HAVE_SIGACTION = 1
+HAVE_SIGBLOCK = 1
+HAVE_SIGGETMASK = 1
+HAVE_SIGNAL_H = 1
+HAVE_SIGPROCMASK = 1
+HAVE_SIGSET = 1
+HAVE_SIGSETMASK = 1
+HAVE_SIG_ATOMIC_T_TYPE = 1
+HAVE_SIMPLE_C_PROG = 1
+HAVE_SIZE_T = 1
+HAVE_SNPRINTF = 1
+HAVE_SOCKADDR_SA_LEN = ()
+HAVE_SOCKETPAIR = 1
+HAVE_SOCKLEN_T = 1
+HAVE_SOCK_SIN6_LEN = ()
+HAVE_SOCK_SIN_LEN = ()
+HAVE_SRAND = 1
+HAVE_SRANDOM = 1
+HAVE_SSIZE_T = 1
+HAVE_SS_FAMILY = 1
+HAVE_STDARG_H = 1
+HAVE_STDATOMIC_H = 1
+HAVE_STDBOOL_H = 1
+HAVE_STDDEF_H = 1
+HAVE_STDINT_H = 1
+HAVE_STDIO_H = 1
+HAVE_STDLIB_H = 1
+HAVE_STRCASESTR = 1
+HAVE_STRCPY = 1
+HAVE_STRDUP = 1
+HAVE_STRERROR = 1
+HAVE_STRERROR_R = 1
+HAVE_STRFTIME = 1
+HAVE_STRINGS_H = 1
+HAVE_STRING_H = 1
+HAVE_STRLCAT = ()
+HAVE_STRLCPY = ()
+HAVE_STRNCPY = 1
+HAVE_STRNDUP = 1
+HAVE_STRNLEN = 1
+HAVE_STRPTIME = 1
+HAVE_STRSEP = 1
+HAVE_STRTOK_R = 1
+HAVE_STRTOLL = 1
+HAVE_STRTOQ = 1
+HAVE_STRTOULL = 1
+HAVE_STRTOUQ = 1
+HAVE_STRUCT_ADDRINFO = 1
+HAVE_STRUCT_IFADDRS = 1
+HAVE_STRUCT_SOCKADDR = 1
+HAVE_STRUCT_SOCKADDR_IN6 = 1
+HAVE_STRUCT_SOCKADDR_STORAGE = 1
+HAVE_STRUCT_STAT_ST_RDEV = 1
+HAVE_STRUCT_TIMESPEC = 1
+HAVE_ST_RDEV = 1
+HAVE_SYMLINK = 1
+HAVE_SYSCALL = 1
+HAVE_SYSCALL_H = 1
+HAVE_SYSLOG = 1
+HAVE_SYSLOG_H = 1
+HAVE_SYS_AUXV_H = 1
+HAVE_SYS_CDEFS_H = 1
+HAVE_SYS_DIR_H = 1
+HAVE_SYS_EPOLL_H = 1
+HAVE_SYS_EVENTFD_H = 1
+HAVE_SYS_FCNTL_H = 1
+HAVE_SYS_FILE_H = 1
+HAVE_SYS_INOTIFY_H = 1
+HAVE_SYS_IOCTL_H = 1
+HAVE_SYS_IPC_H = 1
+HAVE_SYS_MMAN_H = 1
+HAVE_SYS_MOUNT_H = 1
+HAVE_SYS_PARAM_H = 1
+HAVE_SYS_PRCTL_H = 1
+HAVE_SYS_RESOURCE_H = 1
+HAVE_SYS_SELECT_H = 1
+HAVE_SYS_SHM_H = 1
+HAVE_SYS_SOCKET_H = 1
+HAVE_SYS_STATFS_H = 1
+HAVE_SYS_STATVFS_H = 1
+HAVE_SYS_STAT_H = 1
+HAVE_SYS_SYSCALL_H = 1
+HAVE_SYS_SYSCTL_H = ()
+HAVE_SYS_SYSLOG_H = 1
+HAVE_SYS_SYSMACROS_H = 1
+HAVE_SYS_TIME_H = 1
+HAVE_SYS_TYPES_H = 1
+HAVE_SYS_UCONTEXT_H = 1
+HAVE_SYS_UIO_H = 1
+HAVE_SYS_UNISTD_H = 1
+HAVE_SYS_UN_H = 1
+HAVE_SYS_UTSNAME_H = 1
+HAVE_SYS_VFS_H = 1
+HAVE_SYS_WAIT_H = 1
+HAVE_SYS_XATTR_H = 1
+HAVE_TERMIOS_H = 1
+HAVE_TERMIO_H = 1
+HAVE_TEXTDOMAIN = 1
+HAVE_TIMEGM = 1
+HAVE_TIME_H = 1
+HAVE_TIRPC = 1
+HAVE_UCONTEXT_T = 1
+HAVE_UINT16_T = 1
+HAVE_UINT32_T = 1
+HAVE_UINT64_T = 1
+HAVE_UINT8_T = 1
+HAVE_UINTPTR_T = 1
+HAVE_UINT_T = ()
+HAVE_UNISTD_H = 1
+HAVE_UNIXSOCKET = 1
+HAVE_UNSETENV = 1
+HAVE_USLEEP = 1
+HAVE_UTIME = 1
+HAVE_UTIMES = 1
+HAVE_UTIME_H = 1
+HAVE_UTMPX_H = 1
+HAVE_UTMP_H = 1
+HAVE_VASPRINTF = 1
+HAVE_VA_COPY = 1
+HAVE_VDPRINTF = 1
+HAVE_VISIBILITY_ATTR = 1
+HAVE_VOLATILE = 1
+HAVE_VSNPRINTF = 1
+HAVE_VSYSLOG = 1
+HAVE_WAIT4 = 1
+HAVE_WAITPID = 1
+HAVE_WNO_FORMAT_TRUNCATION = '1'
+HAVE_WNO_STRICT_OVERFLOW = '1'
+HAVE_WNO_UNUSED_BUT_SET_VARIABLE = '1'
+HAVE_WNO_UNUSED_FUNCTION = '1'
+HAVE_WORKING_STRPTIME = 1
+HAVE_WUSE_AFTER_FREE_1 = '1'
+HAVE_XATTR_SUPPORT = 1
+HAVE_XATTR_XATTR = 1
+HAVE_ZLIB_H = 1
+HAVE__STATIC_ASSERT = 1
+HAVE___ATOMIC_ADD_FETCH = 1
+HAVE___ATOMIC_ADD_LOAD = 1
+HAVE___ATTRIBUTE__ = 1
+HAVE___SS_FAMILY = ()
+HAVE___STRTOLL = ()
+HAVE___STRTOULL = ()
+HAVE___SYNC_ADD_AND_FETCH = 1
+HAVE___SYNC_FETCH_AND_ADD = 1
+HAVE___THREAD = 1
+HOSTCC = False
+HTMLDIR = '/tmp/tinst/share/doc/talloc'
+INCLUDEDIR = '/tmp/tinst/include'
+INCLUDES_PYEMBED = ['/root/.pyenv/versions/3.11.7/include/python3.11']
+INCLUDES_PYEXT = ['/root/.pyenv/versions/3.11.7/include/python3.11']
+INCLUDES_TIRPC = ['/usr/include/tirpc']
+INFODIR = '/tmp/tinst/share/info'
+INLINE_MACRO = 1
+LDFLAGS_crypt = []
+LIBDIR = '${PREFIX}/lib'
+LIBEXECDIR = '/tmp/tinst/libexec'
+LIBPATH = ['/usr/local/lib']
+LIBPATH_PYEMBED = ['/root/.pyenv/versions/3.11.7/lib']
+LIBPATH_PYEXT = ['/root/.pyenv/versions/3.11.7/lib']
+LIBPATH_ST = '-L%s'
+LIBREPLACE_NETWORK_CHECKS = 1
+LIB_CRYPT = ['crypt']
+LIB_PYEMBED = ['python3.11', 'dl', 'm', 'python3.11', 'dl', 'm']
+LIB_PYEXT = ['dl', 'm', 'dl', 'm']
+LIB_ST = '-l%s'
+LIB_TIRPC = ['tirpc']
+LIB_crypt = ['crypt']
+LINKFLAGS_MACBUNDLE = ['-bundle', '-undefined', 'dynamic_lookup']
+LINKFLAGS_cshlib = ['-shared']
+LINKFLAGS_cstlib = ['-Wl,-Bstatic']
+LINK_CC = ['/usr/bin/gcc']
+LINUX = '1'
+LOCALEDIR = '/tmp/tinst/share/locale'
+LOCALSTATEDIR = '/tmp/tinst/var'
+MANDIR = '/tmp/tinst/share/man'
+MODULESDIR = '${PREFIX}/modules'
+NONSHARED_BINARIES = ['']
+OLDINCLUDEDIR = '/usr/include'
+PACKAGE = 'talloc'
+PDFDIR = '/tmp/tinst/share/doc/talloc'
+PKGCONFIG = ['/usr/bin/pkg-config']
+PKGCONFIGDIR = '${LIBDIR}/pkgconfig'
+PREFIX = '/tmp/tinst'
+PRIVATELIBDIR = '${PREFIX}/lib/talloc'
+PRIVATE_EXTENSION = 'talloc'
+PRIVATE_EXTENSION_EXCEPTION = ['talloc']
+PRIVATE_LIBS = ['DEFAULT']
+PRIVATE_VERSION = 'talloc_2.5.0_talloc'
+PSDIR = '/tmp/tinst/share/doc/talloc'
+PYC = 1
+PYFLAGS = ''
+PYFLAGS_OPT = '-O'
+PYO = 1
+PYTAG = 'cpython-311'
+PYTHON = ['/root/.pyenv/versions/3.11.7/bin/python3']
+PYTHON3 = ['/root/.pyenv/versions/3.11.7/bin/python3']
+PYTHONARCHDIR = '/tmp/tinst/lib/python3.11/site-packages'
+PYTHONDIR = '/tmp/tinst/lib/python3.11/site-packages'
+PYTHON_CONFIG = ['/root/.pyenv/versions/3.11.7/bin/python3-config']
+PYTHON_LIBNAME_SO_ABI_FLAG = '.cpython-311-x86-64-linux-gnu'
+PYTHON_SO_ABI_FLAG = '.cpython-311-x86_64-linux-gnu'
+PYTHON_SPECIFIED = False
+PYTHON_VERSION = '3.11'
+RETSIGTYPE = 'void'
+RETSIGTYPE_INT = ()
+RPATH_ON_BUILD = True
+RPATH_ON_INSTALL = True
+RPATH_ON_INSTALL_PRIVATE = True
+RPATH_PYEMBED = ['/root/.pyenv/versions/3.11.7/lib', '/root/.pyenv/versions/3.11.7/lib']
+RPATH_PYEXT = ['/root/.pyenv/versions/3.11.7/lib', '/root/.pyenv/versions/3.11.7/lib']
+RPATH_ST = '-Wl,-rpath,%s'
+SBINDIR = '${PREFIX}/sbin'
+SHAREDSTATEDIR = '/tmp/tinst/com'
+SHLIBEXT = 'so'
+SHLIB_MARKER = '-Wl,-Bdynamic'
+SIZEOF_BOOL = 1
+SIZEOF_CHAR = 1
+SIZEOF_DEV_T = 8
+SIZEOF_INO_T = 8
+SIZEOF_INT = 4
+SIZEOF_INT16_T = 2
+SIZEOF_INT32_T = 4
+SIZEOF_INT64_T = 8
+SIZEOF_INT8_T = 1
+SIZEOF_LONG = 8
+SIZEOF_LONG_LONG = 8
+SIZEOF_OFF_T = 8
+SIZEOF_SHORT = 2
+SIZEOF_SIZE_T = 8
+SIZEOF_SSIZE_T = 8
+SIZEOF_TIME_T = 8
+SIZEOF_UINT16_T = 2
+SIZEOF_UINT32_T = 4
+SIZEOF_UINT64_T = 8
+SIZEOF_UINT8_T = 1
+SIZEOF_VOID_P = 8
+SOLARIS_GETGRENT_R = ()
+SOLARIS_GETPWENT_R = ()
+SONAME_ST = '-Wl,-h,%s'
+SRCDIR = '/root/repo'
+STANDARD_LIBPATH = ['/usr/lib/gcc/x86_64-linux-gnu/12', '/usr/x86_64-linux-gnu/lib/x86_64-linux-gnu/12', '/usr/x86_64-linux-gnu/lib/x86_64-linux-gnu', '/usr/x86_64-linux-gnu/lib', '/usr/lib/x86_64-linux-gnu/12', '/usr/lib/x86_64-linux-gnu', '/usr/lib', '/lib/x86_64-linux-gnu/12', '/lib/x86_64-linux-gnu', '/lib', '/usr/lib/x86_64-linux-gnu/12', '/usr/lib/x86_64-linux-gnu', '/usr/lib', '/usr/x86_64-linux-gnu/lib', '/usr/lib', '/lib', '/usr/lib']
+STDC_HEADERS = 1
+STLIBPATH_ST = '-L%s'
+STLIB_MARKER = '-Wl,-Bstatic'
+STLIB_ST = '-l%s'
+STRERROR_R_XSI_NOT_GNU = ()
+SYSCONFDIR = '/tmp/tinst/etc'
+SYSTEM_LIBS = ()
+SYSTEM_UNAME_MACHINE = 'x86_64'
+SYSTEM_UNAME_RELEASE = '6.18.44-fc-v130'
+SYSTEM_UNAME_SYSNAME = 'Linux'
+SYSTEM_UNAME_VERSION = '#1 SMP PREEMPT_DYNAMIC @0'
+TALLOC_BUILD_VERSION_MAJOR = 2
+TALLOC_BUILD_VERSION_MINOR = 5
+TALLOC_BUILD_VERSION_RELEASE = 0
+TALLOC_COMPAT1 = False
+TALLOC_VERSION = '2.5.0'
+TARGET_TYPE = {'inotify': 'EMPTY', 'tirpc': 'SYSLIB', 'bsd': 'EMPTY', 'setproctitle': 'EMPTY', 'attr': 'EMPTY', 'dl': 'EMPTY', 'resolv': 'EMPTY', 'intl': 'EMPTY', 'pthread': 'EMPTY', 'crypt': 'SYSLIB'}
+TIME_WITH_SYS_TIME = 1
+VISIBILITY_CFLAGS = '-fvisibility=hidden'
+WERROR_CFLAGS = ['-Werror']
+WORKING_GETCONF_LFS_CFLAGS = 1
+XATTR_ADDITIONAL_OPTIONS = ()
+_GNU_SOURCE = 1
+_POSIX_FALLOCATE_CAPABLE_LIBC = 1
+_XOPEN_SOURCE_EXTENDED = 1
+cfg_files = ['/root/repo/lib/talloc/bin/default/config.h']
+cprogram_PATTERN = '%s'
+cshlib_PATTERN = 'lib%s.so'
+cstlib_PATTERN = 'lib%s.a'
+define_key = ['PYTHONDIR', 'PYTHONARCHDIR', 'HAVE_PYEMBED', 'HAVE_PYEXT', 'HAVE_PYTHON_H']
+disable_python = False
+enable_afl_fuzzer = False
+enable_coverage = False
+enable_fuzzing = False
+enable_libfuzzer = False
+enable_rust = False
+hlist = ['stdio.h', 'sys/types.h', 'sys/stat.h', 'stdlib.h', 'stddef.h', 'memory.h', 'string.h', 'strings.h', 'inttypes.h', 'stdint.h', 'unistd.h', 'ctype.h', 'stdbool.h', 'stdarg.h']
+in_compound = 0
+intl_libs = ''
+macbundle_PATTERN = '%s.bundle'
+merge_config_header = True
+offset_t = 'loff_t'
+pyext_PATTERN = '%s.cpython-311-x86_64-linux-gnu.so'
+python_headers_checked = 'yes'
+python_interpreters = [['/root/.pyenv/versions/3.11.7/bin/python3']]
+srcdir = '/root/repo'
+standalone_replace = False
+standalone_talloc = True
+uint_t = 'unsigned int'
+undefined_ignore_ldflags = ['-Wl,-undefined,dynamic_lookup']
+undefined_ldflags = ['-Wl,-no-undefined']
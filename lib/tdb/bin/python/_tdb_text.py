@@ -0,0 +1 @@
+/root/repo/lib/tdb/_tdb_text.py
\ No newline at end of file
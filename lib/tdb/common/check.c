@@ -316,6 +316,14 @@ static bool tdb_check_free_record(struct tdb_context *tdb,
 	if (!tdb_check_record(tdb, off, rec))
 		return false;
 
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) &&
+	    rec->full_hash >= TDB_FREE_CLASSES) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Free record at offset %u has bad class %u\n",
+			 off, rec->full_hash));
+		return false;
+	}
+
 	/* Mark this offset as a known value for the free list. */
 	record_offset(hashes[0], off);
 	/* And similarly if the next pointer is valid. */
@@ -324,6 +332,47 @@ static bool tdb_check_free_record(struct tdb_context *tdb,
 	return true;
 }
 
+/* Check the split table of a hash chain, see tdb_hash_heads(). */
+static bool tdb_check_split_table(struct tdb_context *tdb,
+				  tdb_off_t off,
+				  const struct tdb_record *rec,
+				  unsigned char **hashes)
+{
+	uint32_t i, num = rec->data_len / sizeof(tdb_off_t);
+
+	if (!tdb_check_record(tdb, off, rec))
+		return false;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_HASH_GROWTH)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Split table at offset %u without hash growth\n",
+			 off));
+		return false;
+	}
+	if (rec->full_hash >= tdb->hash_size || rec->key_len != 0 ||
+	    rec->data_len % sizeof(tdb_off_t) != 0 ||
+	    num < 2 || num > TDB_HASH_SPLIT_MAX || (num & (num-1)) != 0 ||
+	    rec->data_len + sizeof(tdb_off_t) > rec->rec_len) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Split table at offset %u is invalid\n", off));
+		return false;
+	}
+
+	/* The hash top points to us, we point to the lists. */
+	record_offset(hashes[rec->full_hash+1], off | TDB_HASH_SPLIT_BIT);
+
+	for (i = 0; i < num; i++) {
+		tdb_off_t head;
+
+		if (tdb_ofs_read(tdb, off + sizeof(*rec) + i*sizeof(head),
+				 &head) == -1)
+			return false;
+		if (head)
+			record_offset(hashes[rec->full_hash+1], head);
+	}
+	return true;
+}
+
 /* Slow, but should be very rare. */
 size_t tdb_dead_space(struct tdb_context *tdb, tdb_off_t off)
 {
@@ -398,6 +447,17 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			record_offset(hashes[h], off);
 	}
 
+	/* The size class free lists belong to the freelist */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) {
+		for (h = 0; h < TDB_FREE_CLASSES; h++) {
+			if (tdb_ofs_read(tdb, TDB_FREE_CLASS_TOP(h),
+					 &off) == -1)
+				goto free;
+			if (off)
+				record_offset(hashes[0], off);
+		}
+	}
+
 	/* For each record, read it in and check it's ok. */
 	for (off = TDB_DATA_START(tdb->hash_size);
 	     off < tdb->map_size;
@@ -416,6 +476,10 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			if (!tdb_check_free_record(tdb, off, &rec, hashes))
 				goto free;
 			break;
+		case TDB_HASH_SPLIT_MAGIC:
+			if (!tdb_check_split_table(tdb, off, &rec, hashes))
+				goto free;
+			break;
 		/* If we crash after ftruncate, we can get zeroes or fill. */
 		case TDB_RECOVERY_INVALID_MAGIC:
 		case 0x42424242:
@@ -433,6 +497,8 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			rec.rec_len = dead - sizeof(rec);
 			break;
 		case TDB_RECOVERY_MAGIC:
+		case TDB_RECOVERY_GROUP_MAGIC:
+		case TDB_RECOVERY_PENDING_MAGIC:
 			if (recovery_start != off) {
 				TDB_LOG((tdb, TDB_DEBUG_ERROR,
 					 "Unexpected recovery record at offset %u\n",
@@ -62,34 +62,47 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 {
 	struct tdb_chainwalk_ctx chainwalk;
 	tdb_off_t rec_ptr, top;
+	uint32_t sub, num;
 
 	if (i == -1) {
-		top = FREELIST_TOP;
+		/* The size class list heads are in a row as well */
+		if (tdb_lock_free_lists(tdb, F_WRLCK) != 0)
+			return -1;
+		top = TDB_FREE_LIST_TOP(tdb, 0);
+		num = TDB_FREE_LISTS(tdb);
 	} else {
-		top = TDB_HASH_TOP(i);
+		if (tdb_lock(tdb, i, F_WRLCK) != 0)
+			return -1;
+		if (tdb_hash_heads(tdb, i, &top, &num) == -1)
+			return tdb_unlock(tdb, i, F_WRLCK);
 	}
 
-	if (tdb_lock(tdb, i, F_WRLCK) != 0)
-		return -1;
+	if (num > 1)
+		printf("hash=%d split into %u lists\n", i, (unsigned)num);
 
-	if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
-		return tdb_unlock(tdb, i, F_WRLCK);
+	for (sub = 0; sub < num; sub++) {
+		if (tdb_ofs_read(tdb, top + sub * sizeof(tdb_off_t),
+				 &rec_ptr) == -1)
+			break;
 
-	tdb_chainwalk_init(&chainwalk, rec_ptr);
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
 
-	if (rec_ptr)
-		printf("hash=%d\n", i);
+		if (rec_ptr)
+			printf("hash=%d\n", i);
 
-	while (rec_ptr) {
-		bool ok;
-		rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
-		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
-		if (!ok) {
-			printf("circular hash chain %d\n", i);
-			break;
+		while (rec_ptr) {
+			bool ok;
+			rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
+			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
+			if (!ok) {
+				printf("circular hash chain %d\n", i);
+				break;
+			}
 		}
 	}
 
+	if (i == -1)
+		return tdb_unlock_free_lists(tdb, F_WRLCK);
 	return tdb_unlock(tdb, i, F_WRLCK);
 }
 
@@ -109,41 +122,47 @@ _PUBLIC_ int tdb_printfreelist(struct tdb_context *tdb)
 	long total_free = 0;
 	tdb_off_t offset, rec_ptr;
 	struct tdb_record rec;
+	uint32_t i;
 
-	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
+	if ((ret = tdb_lock_free_lists(tdb, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
+	for (i = 0; i < TDB_FREE_LISTS(tdb); i++) {
+		offset = TDB_FREE_LIST_TOP(tdb, i);
 
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
-
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
-					   sizeof(rec), DOCONV()) == -1) {
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
+			tdb_unlock_free_lists(tdb, F_WRLCK);
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		if (TDB_FREE_LISTS(tdb) > 1) {
+			printf("size class %u ", (unsigned)i);
+		}
+		printf("freelist top=[0x%08x]\n", rec_ptr );
+		while (rec_ptr) {
+			if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
+						   sizeof(rec), DOCONV()) == -1) {
+				tdb_unlock_free_lists(tdb, F_WRLCK);
+				return -1;
+			}
+
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n", rec.magic);
+				tdb_unlock_free_lists(tdb, F_WRLCK);
+				return -1;
+			}
+
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
+			       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
 		}
-
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
-		       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
-		total_free += rec.rec_len;
-
-		/* move to the next record */
-		rec_ptr = rec.next;
 	}
 	printf("total rec_len = [0x%08lx (%lu)]\n", total_free, total_free);
 
-	return tdb_unlock(tdb, -1, F_WRLCK);
+	return tdb_unlock_free_lists(tdb, F_WRLCK);
 }
 
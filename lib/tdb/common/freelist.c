@@ -27,6 +27,19 @@
 
 #include "tdb_private.h"
 
+/* The size class list a free record of rec_len bytes belongs on */
+static uint32_t tdb_free_class(tdb_len_t len)
+{
+	uint32_t c = 0;
+
+	len >>= TDB_FREE_CLASS_SHIFT;
+	while (len != 0 && c < TDB_FREE_CLASSES-1) {
+		len >>= 1;
+		c += 1;
+	}
+	return c;
+}
+
 /* read a freelist record and check for simple errors */
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off, struct tdb_record *rec)
 {
@@ -171,12 +184,16 @@ static int merge_with_left_record(struct tdb_context *tdb,
  *
  * The current record is handed in with pointer and fully read record.
  *
+ * With size classes "cls" is the locked class list, only a left
+ * record on that list is merged. It's -1 for the freelist.
+ *
  * The left record pointer and struct can be retrieved as result
  * in lp and lr;
  */
 static int check_merge_with_left_record(struct tdb_context *tdb,
 					tdb_off_t rec_ptr,
 					struct tdb_record *rec,
+					int cls,
 					tdb_off_t *lp,
 					struct tdb_record *lr)
 {
@@ -193,6 +210,10 @@ static int check_merge_with_left_record(struct tdb_context *tdb,
 		return 0;
 	}
 
+	if (cls != -1 && left_rec.full_hash != cls) {
+		return 0;
+	}
+
 	/* It's free - expand to include it. */
 	ret = merge_with_left_record(tdb, left_ptr, &left_rec, rec);
 	if (ret != 0) {
@@ -274,10 +295,17 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
  *
  * This prevents db traverses from being O(n^2) after a lot of deletes.
  */
+static int tdb_free_to_class(struct tdb_context *tdb, tdb_off_t offset,
+			     struct tdb_record *rec);
+
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
 	int ret;
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) {
+		return tdb_free_to_class(tdb, offset, rec);
+	}
+
 	/* Allocation and tailer lock */
 	if (tdb_lock(tdb, -1, F_WRLCK) != 0)
 		return -1;
@@ -288,7 +316,7 @@ int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 		goto fail;
 	}
 
-	ret = check_merge_with_left_record(tdb, offset, rec, NULL, NULL);
+	ret = check_merge_with_left_record(tdb, offset, rec, -1, NULL, NULL);
 	if (ret == -1) {
 		goto fail;
 	}
@@ -318,6 +346,70 @@ done:
 	return -1;
 }
 
+/*
+ * tdb_free() with size classes: Merge into the left record under the
+ * lock of its list or prepend to the list for our size. We hold only
+ * one list lock at a time.
+ */
+static int tdb_free_to_class(struct tdb_context *tdb, tdb_off_t offset,
+			     struct tdb_record *rec)
+{
+	tdb_off_t left_ptr;
+	struct tdb_record left_rec;
+	uint32_t c;
+	int ret;
+
+	/* set an initial tailer, so if we fail we don't leave a bogus record */
+	if (update_tailer(tdb, offset, rec) != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: update_tailer failed!\n"));
+		return -1;
+	}
+
+	ret = read_record_on_left(tdb, offset, &left_ptr, &left_rec);
+	if (ret == 0 && left_rec.magic == TDB_FREE_MAGIC &&
+	    left_rec.full_hash < TDB_FREE_CLASSES) {
+		c = left_rec.full_hash;
+
+		if (tdb_lock_free_class(tdb, c, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+			return -1;
+		}
+
+		/*
+		 * We looked without the lock: It might have been
+		 * allocated or shrunk in the meantime.
+		 */
+		ret = check_merge_with_left_record(tdb, offset, rec, c,
+						   NULL, NULL);
+		tdb_unlock_free_class(tdb, c, F_WRLCK);
+
+		if (ret != 0) {
+			return (ret == 1) ? 0 : -1;
+		}
+	}
+
+	/* Nothing to merge, prepend to our list */
+
+	c = tdb_free_class(rec->rec_len);
+
+	if (tdb_lock_free_class(tdb, c, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+		return -1;
+	}
+
+	rec->magic = TDB_FREE_MAGIC;
+	rec->full_hash = c;
+
+	if (tdb_ofs_read(tdb, TDB_FREE_CLASS_TOP(c), &rec->next) == -1 ||
+	    tdb_rec_write(tdb, offset, rec) == -1 ||
+	    tdb_ofs_write(tdb, TDB_FREE_CLASS_TOP(c), &offset) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free record write failed at offset=%u\n", offset));
+		tdb_unlock_free_class(tdb, c, F_WRLCK);
+		return -1;
+	}
+
+	tdb_unlock_free_class(tdb, c, F_WRLCK);
+	return 0;
+}
+
 
 
 /*
@@ -377,14 +469,66 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 	return rec_ptr;
 }
 
-/* allocate some space from the free list. The offset returned points
-   to a unconnected tdb_record within the database with room for at
-   least length bytes of total data
+/*
+  After allocating from the end of the record at rec_ptr on the size
+  class list cls it might belong on a lower list. Move it there if we
+  get that lock without waiting, otherwise leave it, it will still be
+  found.
+ */
+static void tdb_free_class_move(struct tdb_context *tdb, tdb_off_t rec_ptr,
+				tdb_off_t last_ptr, uint32_t cls)
+{
+	struct tdb_record rec;
+	tdb_off_t top;
+	uint32_t c;
 
-   0 is returned if the space could not be allocated
+	if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+		return;
+	}
+
+	c = tdb_free_class(rec.rec_len);
+	if (c >= cls) {
+		return;
+	}
+
+	if (tdb_lock_free_class(tdb, c, F_WRLCK,
+				TDB_LOCK_NOWAIT|TDB_LOCK_PROBE) == -1) {
+		return;
+	}
+
+	if (tdb_ofs_read(tdb, TDB_FREE_CLASS_TOP(c), &top) == -1) {
+		goto unlock;
+	}
+
+	/* unlink it from the previous record */
+	if (tdb_ofs_write(tdb, last_ptr, &rec.next) == -1) {
+		goto unlock;
+	}
+
+	rec.next = top;
+	rec.full_hash = c;
+
+	if (tdb_rec_write(tdb, rec_ptr, &rec) == -1 ||
+	    tdb_ofs_write(tdb, TDB_FREE_CLASS_TOP(c), &rec_ptr) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free_class_move: "
+			 "record write failed at offset=%u\n", rec_ptr));
+	}
+
+unlock:
+	tdb_unlock_free_class(tdb, c, F_WRLCK);
+}
+
+/* allocate some space from the free list starting at "top", which
+   is FREELIST_TOP (cls == -1) or the head of the locked size class
+   list cls. *pnewrec_ptr points to a unconnected tdb_record within
+   the database with room for at least length bytes of total data
+
+   -1 is returned on error, 0 if nothing fit and 1 on success
  */
-static tdb_off_t tdb_allocate_from_freelist(
-	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+static int tdb_allocate_from_list(struct tdb_context *tdb, tdb_off_t top,
+				  int cls, tdb_len_t length,
+				  struct tdb_record *rec,
+				  tdb_off_t *pnewrec_ptr)
 {
 	tdb_off_t rec_ptr, last_ptr, newrec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
@@ -396,20 +540,13 @@ static tdb_off_t tdb_allocate_from_freelist(
 	float multiplier = 1.0;
 	bool merge_created_candidate;
 
-	/* over-allocate to reduce fragmentation */
-	length *= 1.25;
-
-	/* Extra bytes required for tailer */
-	length += sizeof(tdb_off_t);
-	length = TDB_ALIGN(length, TDB_ALIGNMENT);
-
  again:
 	merge_created_candidate = false;
-	last_ptr = FREELIST_TOP;
+	last_ptr = top;
 
 	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		return 0;
+	if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
+		return -1;
 
 	modified = false;
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -429,20 +566,20 @@ static tdb_off_t tdb_allocate_from_freelist(
 		struct tdb_record left_rec;
 
 		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
-		ret = check_merge_with_left_record(tdb, rec_ptr, rec,
+		ret = check_merge_with_left_record(tdb, rec_ptr, rec, cls,
 						   &left_ptr, &left_rec);
 		if (ret == -1) {
-			return 0;
+			return -1;
 		}
 		if (ret == 1) {
 			/* merged */
 			rec_ptr = rec->next;
 			ret = tdb_ofs_write(tdb, last_ptr, &rec->next);
 			if (ret == -1) {
-				return 0;
+				return -1;
 			}
 
 			/*
@@ -496,7 +633,7 @@ static tdb_off_t tdb_allocate_from_freelist(
 			bool ok;
 			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
 			if (!ok) {
-				return 0;
+				return -1;
 			}
 		}
 
@@ -518,18 +655,66 @@ static tdb_off_t tdb_allocate_from_freelist(
 
 	if (bestfit.rec_ptr != 0) {
 		if (tdb_rec_free_read(tdb, bestfit.rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
 		newrec_ptr = tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
 					      rec, bestfit.last_ptr);
-		return newrec_ptr;
+		if (newrec_ptr == 0) {
+			return -1;
+		}
+
+		if (cls != -1 && newrec_ptr != bestfit.rec_ptr) {
+			/* We took the end, the rest is still listed */
+			tdb_free_class_move(tdb, bestfit.rec_ptr,
+					    bestfit.last_ptr, cls);
+		}
+
+		*pnewrec_ptr = newrec_ptr;
+		return 1;
 	}
 
 	if (merge_created_candidate) {
 		goto again;
 	}
 
+	return 0;
+}
+
+/* over-allocate to reduce fragmentation, add the tailer */
+static tdb_len_t tdb_allocate_len(tdb_len_t length)
+{
+	length *= 1.25;
+
+	/* Extra bytes required for tailer */
+	length += sizeof(tdb_off_t);
+	return TDB_ALIGN(length, TDB_ALIGNMENT);
+}
+
+/* allocate some space from the free list. The offset returned points
+   to a unconnected tdb_record within the database with room for at
+   least length bytes of total data
+
+   0 is returned if the space could not be allocated
+ */
+static tdb_off_t tdb_allocate_from_freelist(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	tdb_off_t newrec_ptr;
+	int ret;
+
+	length = tdb_allocate_len(length);
+
+ again:
+	ret = tdb_allocate_from_list(tdb, FREELIST_TOP, -1, length, rec,
+				     &newrec_ptr);
+	if (ret == -1) {
+		return 0;
+	}
+	if (ret == 1) {
+		return newrec_ptr;
+	}
+
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
 	if (tdb_expand(tdb, length + sizeof(*rec)) == 0)
@@ -538,6 +723,48 @@ static tdb_off_t tdb_allocate_from_freelist(
 	return 0;
 }
 
+/* tdb_allocate_from_freelist() with size classes, see
+   TDB_FREE_CLASSES. Starting at the class of "length" all larger
+   classes are tried, each under its own lock. The smaller classes
+   come last, only records grown by merging can fit there. */
+static tdb_off_t tdb_allocate_from_classes(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	tdb_off_t newrec_ptr;
+	uint32_t i, cls;
+	int ret;
+
+	length = tdb_allocate_len(length);
+	cls = tdb_free_class(length);
+
+ again:
+	for (i = 0; i < TDB_FREE_CLASSES; i++) {
+		uint32_t c = (cls + i) % TDB_FREE_CLASSES;
+
+		if (tdb_lock_free_class(tdb, c, F_WRLCK,
+					TDB_LOCK_WAIT) == -1) {
+			return 0;
+		}
+		ret = tdb_allocate_from_list(tdb, TDB_FREE_CLASS_TOP(c), c,
+					     length, rec, &newrec_ptr);
+		tdb_unlock_free_class(tdb, c, F_WRLCK);
+
+		if (ret == -1) {
+			return 0;
+		}
+		if (ret == 1) {
+			return newrec_ptr;
+		}
+	}
+
+	/* tdb_expand() takes the freelist lock and frees the new
+	   space, we must not hold a class lock here */
+	if (tdb_expand(tdb, length + sizeof(*rec)) == 0)
+		goto again;
+
+	return 0;
+}
+
 static bool tdb_alloc_dead(
 	struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t *rec_ptr, struct tdb_record *rec)
@@ -576,6 +803,15 @@ tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t ret;
 	uint32_t i;
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) {
+		/*
+		 * There's no single freelist lock to avoid by
+		 * stealing dead records, just give ours back.
+		 */
+		tdb_purge_dead(tdb, hash);
+		return tdb_allocate_from_classes(tdb, length, rec);
+	}
+
 	if (tdb->max_dead_records == 0) {
 		/*
 		 * No dead records to expect anywhere. Do the blocking
@@ -648,41 +884,50 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 				       int *count_records, int *count_merged)
 {
 	tdb_off_t cur, next;
+	uint32_t i;
 	int count = 0;
 	int merged = 0;
 	int ret;
 
-	ret = tdb_lock(tdb, -1, F_RDLCK);
+	/*
+	 * With size classes we hold all list locks, so we can merge
+	 * into a left record on any list.
+	 */
+	ret = tdb_lock_free_lists(tdb, F_RDLCK);
 	if (ret == -1) {
 		return -1;
 	}
 
-	cur = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
-		tdb_off_t next2;
-
-		count++;
+	for (i = 0; i < TDB_FREE_LISTS(tdb); i++) {
+		cur = TDB_FREE_LIST_TOP(tdb, i);
+		while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+			tdb_off_t next2;
 
-		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
-		if (ret == -1) {
-			goto done;
-		}
-		if (ret == 1) {
-			/*
-			 * merged:
-			 * now let cur->next point to next2 instead of next
-			 */
+			count++;
 
-			ret = tdb_ofs_write(tdb, cur, &next2);
-			if (ret != 0) {
+			ret = check_merge_ptr_with_left_record(tdb, next,
+							       &next2);
+			if (ret == -1) {
 				goto done;
 			}
+			if (ret == 1) {
+				/*
+				 * merged:
+				 * now let cur->next point to next2
+				 * instead of next
+				 */
+
+				ret = tdb_ofs_write(tdb, cur, &next2);
+				if (ret != 0) {
+					goto done;
+				}
+
+				next = next2;
+				merged++;
+			}
 
-			next = next2;
-			merged++;
+			cur = next;
 		}
-
-		cur = next;
 	}
 
 	if (count_records != NULL) {
@@ -696,7 +941,7 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 	ret = 0;
 
 done:
-	tdb_unlock(tdb, -1, F_RDLCK);
+	tdb_unlock_free_lists(tdb, F_RDLCK);
 	return ret;
 }
 
@@ -706,18 +951,21 @@ done:
 static int tdb_freelist_size_no_merge(struct tdb_context *tdb)
 {
 	tdb_off_t ptr;
+	uint32_t i;
 	int count=0;
 
-	if (tdb_lock(tdb, -1, F_RDLCK) == -1) {
+	if (tdb_lock_free_lists(tdb, F_RDLCK) == -1) {
 		return -1;
 	}
 
-	ptr = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
-		count++;
+	for (i = 0; i < TDB_FREE_LISTS(tdb); i++) {
+		ptr = TDB_FREE_LIST_TOP(tdb, i);
+		while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
+			count++;
+		}
 	}
 
-	tdb_unlock(tdb, -1, F_RDLCK);
+	tdb_unlock_free_lists(tdb, F_RDLCK);
 	return count;
 }
 
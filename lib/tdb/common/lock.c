@@ -489,6 +489,11 @@ static int tdb_lock_list(struct tdb_context *tdb, int list, int ltype,
 		}
 		return tdb_lock_list(tdb, list, ltype, waitflag);
 	}
+
+	if (ret == 0 && ltype == F_WRLCK && tdb_group_commit_retire(tdb) == -1) {
+		tdb_nest_unlock(tdb, lock_offset(list), ltype, false);
+		return -1;
+	}
 	return ret;
 }
 
@@ -579,6 +584,71 @@ _PUBLIC_ int tdb_unlock(struct tdb_context *tdb, int list, int ltype)
 	return tdb_nest_unlock(tdb, lock_offset(list), ltype, false);
 }
 
+/*
+ * Lock one of the size class free lists. The lock is on the list head
+ * in the header, see TDB_FREE_CLASS_TOP(). Mutexes only cover the
+ * freelist and the hash chains, so these are always fcntl locks.
+ */
+int tdb_lock_free_class(struct tdb_context *tdb, uint32_t c, int ltype,
+			enum tdb_lock_flags flags)
+{
+	if (tdb->allrecord_lock.count) {
+		return tdb_lock_covered_by_allrecord_lock(tdb, ltype);
+	}
+
+	return tdb_nest_lock(tdb, TDB_FREE_CLASS_TOP(c), ltype, flags);
+}
+
+int tdb_unlock_free_class(struct tdb_context *tdb, uint32_t c, int ltype)
+{
+	if (tdb->allrecord_lock.count) {
+		return tdb_lock_covered_by_allrecord_lock(tdb, ltype);
+	}
+
+	return tdb_nest_unlock(tdb, TDB_FREE_CLASS_TOP(c), ltype, false);
+}
+
+/*
+ * Lock all free lists for walking them: The freelist or, with size
+ * classes, all class lists in ascending order.
+ */
+int tdb_lock_free_lists(struct tdb_context *tdb, int ltype)
+{
+	uint32_t c;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES)) {
+		return tdb_lock(tdb, -1, ltype);
+	}
+
+	for (c = 0; c < TDB_FREE_CLASSES; c++) {
+		if (tdb_lock_free_class(tdb, c, ltype, TDB_LOCK_WAIT) == -1) {
+			while (c > 0) {
+				c -= 1;
+				tdb_unlock_free_class(tdb, c, ltype);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int tdb_unlock_free_lists(struct tdb_context *tdb, int ltype)
+{
+	uint32_t c;
+	int ret = 0;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES)) {
+		return tdb_unlock(tdb, -1, ltype);
+	}
+
+	for (c = TDB_FREE_CLASSES; c > 0; c--) {
+		if (tdb_unlock_free_class(tdb, c-1, ltype) == -1) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 /*
   get the transaction lock
  */
@@ -733,6 +803,13 @@ int tdb_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return tdb_allrecord_lock(tdb, ltype, flags, upgradable);
 	}
 
+	if (ltype == F_WRLCK && !upgradable &&
+	    !(flags & TDB_LOCK_MARK_ONLY) &&
+	    tdb_group_commit_retire(tdb) == -1) {
+		tdb_allrecord_unlock(tdb, ltype, false);
+		return -1;
+	}
+
 	return 0;
 }
 
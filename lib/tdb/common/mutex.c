@@ -73,6 +73,12 @@ struct tdb_mutexes {
 	 * one mutex per hashchain.
 	 */
 	pthread_mutex_t hashchains[1];
+
+	/*
+	 * With TDB_FEATURE_FLAG_SEQLOCK the hashchains array is
+	 * followed by one uint32_t generation counter per entry, see
+	 * tdb_mutex_gen_begin().
+	 */
 };
 
 bool tdb_have_mutexes(struct tdb_context *tdb)
@@ -91,9 +97,74 @@ size_t tdb_mutex_size(struct tdb_context *tdb)
 	mutex_size = sizeof(struct tdb_mutexes);
 	mutex_size += tdb->hash_size * sizeof(pthread_mutex_t);
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		mutex_size += (tdb->hash_size + 1) * sizeof(uint32_t);
+	}
+
 	return TDB_ALIGN(mutex_size, tdb->page_size);
 }
 
+#if TDB_SUPPORTED_SEQLOCK
+
+static uint32_t *tdb_mutex_gen(struct tdb_context *tdb, unsigned idx)
+{
+	struct tdb_mutexes *m = tdb->mutexes;
+	uint32_t *gens = (uint32_t *)&m->hashchains[tdb->hash_size + 1];
+
+	return &gens[idx];
+}
+
+/*
+ * The generation counters make lookups without locking possible: A
+ * reader notes the counter of the hash chain and the one for the
+ * allrecord lock at index 0, walks the chain and checks the counters
+ * afterwards. If they changed or are odd, someone might have changed
+ * the chain under its feet.
+ *
+ * The counter is odd while the mutex is held. It's only written by
+ * the mutex holder. Read locks count as well, with mutexes we don't
+ * know whether a read lock is upgraded in tdb_nest_lock().
+ */
+static void tdb_mutex_gen_begin(struct tdb_context *tdb, unsigned idx)
+{
+	uint32_t *gen;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)) {
+		return;
+	}
+	gen = tdb_mutex_gen(tdb, idx);
+
+	/* A holder that died might have left it odd */
+	__atomic_store_n(gen, (*gen + 1) | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void tdb_mutex_gen_end(struct tdb_context *tdb, unsigned idx)
+{
+	uint32_t *gen;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)) {
+		return;
+	}
+	gen = tdb_mutex_gen(tdb, idx);
+
+	__atomic_store_n(gen, (*gen + 1) & ~1U, __ATOMIC_RELEASE);
+}
+
+#else
+
+static void tdb_mutex_gen_begin(struct tdb_context *tdb, unsigned idx)
+{
+	return;
+}
+
+static void tdb_mutex_gen_end(struct tdb_context *tdb, unsigned idx)
+{
+	return;
+}
+
+#endif
+
 /*
  * Get the index for a chain mutex
  */
@@ -193,8 +264,9 @@ static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
 	return pthread_mutex_consistent(m);
 }
 
-static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
+static int allrecord_mutex_lock(struct tdb_context *tdb, bool waitflag)
 {
+	struct tdb_mutexes *m = tdb->mutexes;
 	int ret;
 
 	if (waitflag) {
@@ -212,6 +284,7 @@ static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
 	 * tdb_needs_recovery.
 	 */
 	m->allrecord_lock = F_UNLCK;
+	tdb_mutex_gen_end(tdb, 0);
 
 	return pthread_mutex_consistent(&m->allrecord_mutex);
 }
@@ -268,6 +341,7 @@ again:
 		 * chain lock.
 		 */
 
+		tdb_mutex_gen_begin(tdb, idx);
 		*pret = 0;
 		return true;
 	}
@@ -293,6 +367,7 @@ again:
 	}
 
 	if (allrecord_ok) {
+		tdb_mutex_gen_begin(tdb, idx);
 		*pret = 0;
 		return true;
 	}
@@ -304,7 +379,7 @@ again:
 		errno = ret;
 		goto fail;
 	}
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (ret == EBUSY) {
 		ret = EAGAIN;
 	}
@@ -344,6 +419,10 @@ bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 	}
 	chain = &m->hashchains[idx];
 
+	if (idx != 0) {
+		tdb_mutex_gen_end(tdb, idx);
+	}
+
 	ret = pthread_mutex_unlock(chain);
 	if (ret == 0) {
 		*pret = 0;
@@ -371,7 +450,7 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return 0;
 	}
 
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (!waitflag && (ret == EBUSY)) {
 		errno = EAGAIN;
 		tdb->ecode = TDB_ERR_LOCK;
@@ -422,6 +501,10 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			goto fail_unroll_allrecord_lock;
 		}
 	}
+	if (ltype != F_RDLCK) {
+		tdb_mutex_gen_begin(tdb, 0);
+	}
+
 	/*
 	 * We leave this routine with m->allrecord_mutex locked
 	 */
@@ -488,6 +571,8 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 		}
 	}
 
+	tdb_mutex_gen_begin(tdb, 0);
+
 	return 0;
 
 fail_unroll_allrecord_lock:
@@ -513,6 +598,7 @@ void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb)
 		return;
 	}
 
+	tdb_mutex_gen_end(tdb, 0);
 	m->allrecord_lock = F_RDLCK;
 	return;
 }
@@ -543,10 +629,16 @@ int tdb_mutex_allrecord_unlock(struct tdb_context *tdb)
 	}
 
 	old = m->allrecord_lock;
+	if (old == F_WRLCK) {
+		tdb_mutex_gen_end(tdb, 0);
+	}
 	m->allrecord_lock = F_UNLCK;
 
 	ret = pthread_mutex_unlock(&m->allrecord_mutex);
 	if (ret != 0) {
+		if (old == F_WRLCK) {
+			tdb_mutex_gen_begin(tdb, 0);
+		}
 		m->allrecord_lock = old;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "pthread_mutex_unlock"
 			 "(allrecord_mutex) failed: %s\n", strerror(ret)));
@@ -555,6 +647,210 @@ int tdb_mutex_allrecord_unlock(struct tdb_context *tdb)
 	return 0;
 }
 
+#if TDB_SUPPORTED_SEQLOCK
+
+/*
+ * Read from the mmap without locking. A bogus offset is not an error
+ * here, it just means we raced with a writer.
+ */
+static bool tdb_mutex_map_read(struct tdb_context *tdb, tdb_off_t off,
+			       void *buf, tdb_len_t len)
+{
+	if ((off + len < off) || (off + len > tdb->map_size)) {
+		return false;
+	}
+	memcpy(buf, (char *)tdb->map_ptr + off, len);
+	return true;
+}
+
+/*
+ * Racing writers could send us in circles, give up after this many
+ * records.
+ */
+#define TDB_MUTEX_FETCH_MAX_CHAIN 4096
+
+/*
+ * The lookup part of tdb_find() on the mmap without locking. Returns
+ * 1 with the data copied to *data, 0 if the key does not exist and
+ * -1 if we have to take the lock.
+ */
+static int tdb_mutex_find(struct tdb_context *tdb, TDB_DATA key,
+			  uint32_t hash, unsigned char *buf, size_t buflen,
+			  TDB_DATA *data)
+{
+	struct tdb_record rec;
+	tdb_off_t rec_ptr;
+	unsigned steps = 0;
+
+	if (!tdb_mutex_map_read(tdb, TDB_HASH_TOP(hash), &rec_ptr,
+				sizeof(rec_ptr))) {
+		return -1;
+	}
+
+	if (rec_ptr & TDB_HASH_SPLIT_BIT) {
+		tdb_off_t head;
+		uint32_t num;
+
+		if (!(tdb->feature_flags & TDB_FEATURE_FLAG_HASH_GROWTH)) {
+			return -1;
+		}
+		rec_ptr &= ~TDB_HASH_SPLIT_BIT;
+
+		if (!tdb_mutex_map_read(tdb, rec_ptr, &rec, sizeof(rec))) {
+			return -1;
+		}
+		num = rec.data_len / sizeof(tdb_off_t);
+
+		if ((rec.magic != TDB_HASH_SPLIT_MAGIC) ||
+		    (num < 2) || (num > TDB_HASH_SPLIT_MAX) ||
+		    ((num & (num-1)) != 0)) {
+			return -1;
+		}
+
+		head = rec_ptr + sizeof(rec) +
+			TDB_HASH_SUB(hash, num) * sizeof(tdb_off_t);
+
+		if (!tdb_mutex_map_read(tdb, head, &rec_ptr,
+					sizeof(rec_ptr))) {
+			return -1;
+		}
+	}
+
+	while (rec_ptr != 0) {
+		const unsigned char *p;
+		tdb_off_t ofs;
+
+		if (++steps > TDB_MUTEX_FETCH_MAX_CHAIN) {
+			return -1;
+		}
+		if (!tdb_mutex_map_read(tdb, rec_ptr, &rec, sizeof(rec))) {
+			return -1;
+		}
+		if (TDB_BAD_MAGIC(&rec)) {
+			return -1;
+		}
+
+		if (TDB_DEAD(&rec) || (rec.full_hash != hash) ||
+		    (rec.key_len != key.dsize)) {
+			rec_ptr = rec.next;
+			continue;
+		}
+
+		ofs = rec_ptr + sizeof(rec);
+
+		if (((uint64_t)ofs + rec.key_len + rec.data_len) >
+		    tdb->map_size) {
+			return -1;
+		}
+		p = (const unsigned char *)tdb->map_ptr + ofs;
+
+		if (memcmp(p, key.dptr, key.dsize) != 0) {
+			rec_ptr = rec.next;
+			continue;
+		}
+
+		if (buf != NULL) {
+			if (rec.data_len > buflen) {
+				return -1;
+			}
+			data->dptr = buf;
+		} else {
+			/* Like tdb_alloc_read(), never return NULL */
+			data->dptr = malloc(rec.data_len ? rec.data_len : 1);
+			if (data->dptr == NULL) {
+				return -1;
+			}
+		}
+		memcpy(data->dptr, p + rec.key_len, rec.data_len);
+		data->dsize = rec.data_len;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Look up a record without taking the chain mutex, see
+ * tdb_mutex_gen_begin(). The data is copied to buf, records that
+ * don't fit are left to the locked path. Without buf the data is
+ * copied to a malloc'ed buffer the caller has to free.
+ *
+ * Returns false if the caller has to do the lookup with the chain
+ * lock held. Otherwise *pret is 0 if the record was found and -1
+ * with TDB_ERR_NOEXIST if not.
+ */
+bool tdb_mutex_fetch(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
+		     unsigned char *buf, size_t buflen, TDB_DATA *data,
+		     int *pret)
+{
+	uint32_t *allrecord_gen, *chain_gen;
+	int tries;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)) {
+		return false;
+	}
+	if ((tdb->flags & TDB_NOLOCK) || (tdb->mutexes == NULL) ||
+	    (tdb->map_ptr == NULL) || (tdb->transaction != NULL) ||
+	    DOCONV()) {
+		return false;
+	}
+
+	allrecord_gen = tdb_mutex_gen(tdb, 0);
+	chain_gen = tdb_mutex_gen(tdb, BUCKET(hash) + 1);
+
+	for (tries = 0; tries < 3; tries++) {
+		uint32_t g0, gc;
+		int ret;
+
+		g0 = __atomic_load_n(allrecord_gen, __ATOMIC_ACQUIRE);
+		gc = __atomic_load_n(chain_gen, __ATOMIC_ACQUIRE);
+
+		if ((g0 | gc) & 1) {
+			/*
+			 * Someone holds the lock, better wait for it
+			 * than spin.
+			 */
+			return false;
+		}
+
+		ret = tdb_mutex_find(tdb, key, hash, buf, buflen, data);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if ((__atomic_load_n(allrecord_gen, __ATOMIC_RELAXED) == g0) &&
+		    (__atomic_load_n(chain_gen, __ATOMIC_RELAXED) == gc)) {
+			if (ret == -1) {
+				return false;
+			}
+			if (ret == 0) {
+				tdb->ecode = TDB_ERR_NOEXIST;
+				*pret = -1;
+				return true;
+			}
+			*pret = 0;
+			return true;
+		}
+
+		if ((ret == 1) && (buf == NULL)) {
+			free(data->dptr);
+		}
+	}
+
+	return false;
+}
+
+#else
+
+bool tdb_mutex_fetch(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
+		     unsigned char *buf, size_t buflen, TDB_DATA *data,
+		     int *pret)
+{
+	return false;
+}
+
+#endif
+
 int tdb_mutex_init(struct tdb_context *tdb)
 {
 	struct tdb_mutexes *m;
@@ -594,6 +890,11 @@ int tdb_mutex_init(struct tdb_context *tdb)
 		}
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		memset(&m->hashchains[tdb->hash_size+1], 0,
+		       (tdb->hash_size+1) * sizeof(uint32_t));
+	}
+
 	m->allrecord_lock = F_UNLCK;
 
 	ret = pthread_mutex_init(&m->allrecord_mutex, &ma);
@@ -1052,6 +1353,13 @@ void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb)
 	return;
 }
 
+bool tdb_mutex_fetch(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
+		     unsigned char *buf, size_t buflen, TDB_DATA *data,
+		     int *pret)
+{
+	return false;
+}
+
 int tdb_mutex_mmap(struct tdb_context *tdb)
 {
 	errno = ENOSYS;
@@ -85,6 +85,27 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	if (tdb->flags & TDB_GROW_HASH) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_HASH_GROWTH;
+	}
+
+	if (tdb->flags & TDB_FREELIST_CLASSES) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_FREE_CLASSES;
+	}
+
+	if (tdb->flags & TDB_GROUP_COMMIT) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_GROUP_COMMIT;
+	}
+
+	/*
+	 * Without support we just create the database without
+	 * optimistic reads, they're an optimization.
+	 */
+	if ((tdb->flags & TDB_OPTIMISTIC_READS) &&
+	    (newdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)) {
+		newdb->feature_flags |= TDB_SUPPORTED_SEQLOCK;
+	}
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -291,6 +312,10 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	if (tdb_flags & TDB_MUTEX_LOCKING) {
 		tdb_flags |= TDB_INCOMPATIBLE_HASH;
 	}
+	if (tdb_flags & TDB_GROW_HASH) {
+		/* Splitting hash chains needs good hash bits */
+		tdb_flags |= TDB_INCOMPATIBLE_HASH;
+	}
 
 	tdb->fd = -1;
 #ifdef TDB_TRACE
@@ -720,6 +745,9 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	if (tdb_transaction_recover(tdb) == -1) {
 		goto fail;
 	}
+	if (tdb_group_commit_recover(tdb) == -1) {
+		goto fail;
+	}
 
  internal:
 	/* Internal (memory-only) databases skip all the code above to
@@ -173,6 +173,47 @@ static void mark_free_area(struct found_table *found, tdb_off_t head,
 	}
 }
 
+/* Walk a hash chain (h != 0) or the freelist (h == 0) from "top". */
+static void walk_chain(struct tdb_context *tdb, struct found_table *found,
+		       tdb_off_t h, tdb_off_t top)
+{
+	bool slow_chase = false;
+	tdb_off_t slow_off = top;
+	tdb_off_t off;
+	struct tdb_record rec;
+
+	if (tdb_ofs_read(tdb, top, &off) == -1)
+		return;
+
+	while (off && off != slow_off) {
+		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
+					   DOCONV()) != 0) {
+			break;
+		}
+
+		/* 0 is the free list, rest are hash chains. */
+		if (h == 0) {
+			/* Don't mark garbage as free. */
+			if (rec.magic != TDB_FREE_MAGIC) {
+				break;
+			}
+			mark_free_area(found, off,
+				       sizeof(rec) + rec.rec_len);
+		} else {
+			found_in_hashchain(found, off);
+		}
+
+		off = rec.next;
+
+		/* Loop detection using second pointer at half-speed */
+		if (slow_chase) {
+			/* First entry happens to be next ptr */
+			tdb_ofs_read(tdb, slow_off, &slow_off);
+		}
+		slow_chase = !slow_chase;
+	}
+}
+
 static int cmp_key(const void *a, const void *b)
 {
 	const struct found *fa = a, *fb = b;
@@ -250,39 +291,37 @@ _PUBLIC_ int tdb_rescue(struct tdb_context *tdb,
 
 	/* Walk hash chains to positive vet. */
 	for (h = 0; h < 1+tdb->hash_size; h++) {
-		bool slow_chase = false;
-		tdb_off_t slow_off = FREELIST_TOP + h*sizeof(tdb_off_t);
+		tdb_off_t top = FREELIST_TOP + h*sizeof(tdb_off_t);
 
-		if (tdb_ofs_read(tdb, FREELIST_TOP + h*sizeof(tdb_off_t),
-				 &off) == -1)
+		if (tdb_ofs_read(tdb, top, &off) == -1)
 			continue;
 
-		while (off && off != slow_off) {
+		if (h != 0 && (off & TDB_HASH_SPLIT_BIT)) {
+			/* Walk all lists of a split hash chain */
+			off &= ~TDB_HASH_SPLIT_BIT;
 			if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
 						   DOCONV()) != 0) {
-				break;
+				continue;
 			}
-
-			/* 0 is the free list, rest are hash chains. */
-			if (h == 0) {
-				/* Don't mark garbage as free. */
-				if (rec.magic != TDB_FREE_MAGIC) {
-					break;
-				}
-				mark_free_area(&found, off,
-					       sizeof(rec) + rec.rec_len);
-			} else {
-				found_in_hashchain(&found, off);
+			if (rec.magic != TDB_HASH_SPLIT_MAGIC ||
+			    rec.data_len > rec.rec_len) {
+				continue;
+			}
+			for (i = 0; i < rec.data_len / sizeof(tdb_off_t); i++) {
+				walk_chain(tdb, &found, h,
+					   off + sizeof(rec)
+					   + i*sizeof(tdb_off_t));
 			}
+			continue;
+		}
 
-			off = rec.next;
+		walk_chain(tdb, &found, h, top);
+	}
 
-			/* Loop detection using second pointer at half-speed */
-			if (slow_chase) {
-				/* First entry happens to be next ptr */
-				tdb_ofs_read(tdb, slow_off, &slow_off);
-			}
-			slow_chase = !slow_chase;
+	/* The size class free lists, if any */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) {
+		for (i = 0; i < TDB_FREE_CLASSES; i++) {
+			walk_chain(tdb, &found, 0, TDB_FREE_CLASS_TOP(i));
 		}
 	}
 
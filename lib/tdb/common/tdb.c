@@ -117,16 +117,90 @@ bool tdb_chainwalk_check(struct tdb_context *tdb,
 	return true;
 }
 
+/*
+ * Find the list heads of bucket "list": Either just the hash top, or
+ * the array in the split table the hash top points at.
+ */
+int tdb_hash_heads(struct tdb_context *tdb, uint32_t list,
+		   tdb_off_t *pfirst, uint32_t *pnum)
+{
+	struct tdb_record rec;
+	tdb_off_t top;
+	uint32_t num;
+	int ret;
+
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_HASH_GROWTH) == 0) {
+		*pfirst = TDB_HASH_TOP(list);
+		*pnum = 1;
+		return 0;
+	}
+
+	ret = tdb_ofs_read(tdb, TDB_HASH_TOP(list), &top);
+	if (ret == -1) {
+		return -1;
+	}
+
+	if ((top & TDB_HASH_SPLIT_BIT) == 0) {
+		*pfirst = TDB_HASH_TOP(list);
+		*pnum = 1;
+		return 0;
+	}
+
+	top &= ~TDB_HASH_SPLIT_BIT;
+
+	ret = tdb->methods->tdb_read(tdb, top, &rec, sizeof(rec), DOCONV());
+	if (ret == -1) {
+		return -1;
+	}
+
+	num = rec.data_len / sizeof(tdb_off_t);
+
+	if ((rec.magic != TDB_HASH_SPLIT_MAGIC) ||
+	    (rec.full_hash != list) ||
+	    (num < 2) || (num > TDB_HASH_SPLIT_MAX) ||
+	    ((num & (num-1)) != 0) ||
+	    (rec.data_len > rec.rec_len)) {
+		tdb->ecode = TDB_ERR_CORRUPT;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_hash_heads: bad split "
+			 "table at offset %u for hash %u\n", top, list));
+		return -1;
+	}
+
+	*pfirst = top + sizeof(rec);
+	*pnum = num;
+	return 0;
+}
+
+/* Find the offset of the head of the list "hash" belongs to */
+static int tdb_hash_head(struct tdb_context *tdb, uint32_t hash,
+			 tdb_off_t *phead)
+{
+	tdb_off_t first;
+	uint32_t num;
+	int ret;
+
+	ret = tdb_hash_heads(tdb, BUCKET(hash), &first, &num);
+	if (ret == -1) {
+		return -1;
+	}
+
+	*phead = first + TDB_HASH_SUB(hash, num) * sizeof(tdb_off_t);
+	return 0;
+}
+
 /* Returns 0 on fail.  On success, return offset of record, and fills
    in rec */
 static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 			struct tdb_record *r)
 {
-	tdb_off_t rec_ptr;
+	tdb_off_t rec_ptr, head;
 	struct tdb_chainwalk_ctx chainwalk;
 
+	if (tdb_hash_head(tdb, hash, &head) == -1)
+		return 0;
+
 	/* read in the hash top */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, head, &rec_ptr) == -1)
 		return 0;
 
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -274,9 +348,18 @@ static TDB_DATA _tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
 	struct tdb_record rec;
 	TDB_DATA ret;
 	uint32_t hash;
+	int found;
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
+
+	if (tdb_mutex_fetch(tdb, key, hash, NULL, 0, &ret, &found)) {
+		if (found == -1) {
+			return tdb_null;
+		}
+		return ret;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec)))
 		return tdb_null;
 
@@ -320,12 +403,22 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 {
 	tdb_off_t rec_ptr;
 	struct tdb_record rec;
+	unsigned char buf[256];
+	TDB_DATA data;
 	int ret;
 	uint32_t hash;
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
 
+	if (tdb_mutex_fetch(tdb, key, hash, buf, sizeof(buf), &data, &ret)) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, ret);
+		if (ret == -1) {
+			return -1;
+		}
+		return parser(key, data, private_data);
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec))) {
 		/* record not found */
 		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
@@ -413,7 +506,10 @@ int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
 	int num_dead = 0;
 	int ret;
 
-	last_ptr = TDB_HASH_TOP(hash);
+	ret = tdb_hash_head(tdb, hash, &last_ptr);
+	if (ret == -1) {
+		return -1;
+	}
 
 	/*
 	 * Init chainwalk with the pointer to the hash top. It might
@@ -449,10 +545,14 @@ int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
 
 			if (num_dead > tdb->max_dead_records) {
 
-				if (!locked_freelist) {
+				if (!locked_freelist &&
+				    !(tdb->feature_flags &
+				      TDB_FEATURE_FLAG_FREE_CLASSES)) {
 					/*
 					 * Lock the freelist only if
-					 * it's really required.
+					 * it's really required. Size
+					 * class lists are locked by
+					 * tdb_free() itself.
 					 */
 					ret = tdb_lock(tdb, -1, F_WRLCK);
 					if (ret == -1) {
@@ -555,41 +655,48 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 			struct tdb_record *r, tdb_len_t length,
 			tdb_off_t *p_last_ptr)
 {
-	tdb_off_t rec_ptr, last_ptr;
+	tdb_off_t rec_ptr, last_ptr, first;
 	struct tdb_chainwalk_ctx chainwalk;
 	tdb_off_t best_rec_ptr = 0;
 	tdb_off_t best_last_ptr = 0;
 	struct tdb_record best = { .rec_len = UINT32_MAX };
+	uint32_t i, num;
 
 	length += sizeof(tdb_off_t); /* tailer */
 
-	last_ptr = TDB_HASH_TOP(hash);
-
-	/* read in the hash top */
-	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
+	if (tdb_hash_heads(tdb, BUCKET(hash), &first, &num) == -1)
 		return 0;
 
-	tdb_chainwalk_init(&chainwalk, rec_ptr);
+	/* look through all lists of the bucket */
+	for (i = 0; i < num; i++) {
+		last_ptr = first + i * sizeof(tdb_off_t);
 
-	/* keep looking until we find the right record */
-	while (rec_ptr) {
-		bool ok;
-
-		if (tdb_rec_read(tdb, rec_ptr, r) == -1)
+		/* read in the hash top */
+		if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
 			return 0;
 
-		if (TDB_DEAD(r) && (r->rec_len >= length) &&
-		    (r->rec_len < best.rec_len)) {
-			best_rec_ptr = rec_ptr;
-			best_last_ptr = last_ptr;
-			best = *r;
-		}
-		last_ptr = rec_ptr;
-		rec_ptr = r->next;
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
 
-		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
-		if (!ok) {
-			return 0;
+		/* keep looking until we find the right record */
+		while (rec_ptr) {
+			bool ok;
+
+			if (tdb_rec_read(tdb, rec_ptr, r) == -1)
+				return 0;
+
+			if (TDB_DEAD(r) && (r->rec_len >= length) &&
+			    (r->rec_len < best.rec_len)) {
+				best_rec_ptr = rec_ptr;
+				best_last_ptr = last_ptr;
+				best = *r;
+			}
+			last_ptr = rec_ptr;
+			rec_ptr = r->next;
+
+			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
+			if (!ok) {
+				return 0;
+			}
 		}
 	}
 
@@ -602,12 +709,186 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 	return best_rec_ptr;
 }
 
+struct tdb_hash_grow_rec {
+	tdb_off_t off;
+	uint32_t full_hash;
+};
+
+/*
+ * Double the number of lists of the bucket "hash" is in if the list
+ * of "hash" got too long. The chain must be write locked.
+ *
+ * All records of the bucket are relinked. This can't be done while
+ * someone traverses the bucket, tdb_next_lock() follows rec->next of
+ * the record it holds a lock on after it re-locked the chain. In that
+ * case we leave the bucket alone and try again with a later store.
+ */
+static int tdb_hash_grow(struct tdb_context *tdb, uint32_t hash)
+{
+	uint32_t list = BUCKET(hash);
+	struct tdb_chainwalk_ctx chainwalk;
+	struct tdb_hash_grow_rec *recs = NULL;
+	tdb_off_t *heads = NULL;
+	struct tdb_record rec, table;
+	tdb_off_t first, rec_ptr, table_ptr, top;
+	uint32_t i, num, new_num, len;
+	size_t count = 0, alloced = 0;
+	int ret = -1;
+
+	if (tdb_hash_heads(tdb, list, &first, &num) == -1) {
+		return -1;
+	}
+
+	new_num = num * 2;
+	if (new_num > TDB_HASH_SPLIT_MAX) {
+		return 0;
+	}
+	if (new_num - 1 > UINT32_MAX / tdb->hash_size) {
+		/* No hash bits left to tell the new lists apart */
+		return 0;
+	}
+
+	if (tdb_ofs_read(tdb, first + TDB_HASH_SUB(hash, num) * sizeof(tdb_off_t),
+			 &rec_ptr) == -1) {
+		return -1;
+	}
+
+	for (len = 0; (rec_ptr != 0) && (len <= TDB_HASH_SPLIT_CHAIN); len++) {
+		if (tdb_rec_read(tdb, rec_ptr, &rec) == -1) {
+			return -1;
+		}
+		rec_ptr = rec.next;
+	}
+	if (len <= TDB_HASH_SPLIT_CHAIN) {
+		return 0;
+	}
+
+	/*
+	 * Allocate first: tdb_allocate() might take dead records out
+	 * of this bucket.
+	 */
+	table_ptr = tdb_allocate(tdb, hash, new_num * sizeof(tdb_off_t),
+				 &table);
+	if (table_ptr == 0) {
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (tdb_ofs_read(tdb, first + i * sizeof(tdb_off_t),
+				 &rec_ptr) == -1) {
+			goto fail;
+		}
+
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
+
+		while (rec_ptr != 0) {
+			if (tdb_rec_read(tdb, rec_ptr, &rec) == -1) {
+				goto fail;
+			}
+
+			if (tdb_write_lock_record(tdb, rec_ptr) == -1) {
+				/* Someone traversing here: try later */
+				ret = 0;
+				goto fail;
+			}
+			if (tdb_write_unlock_record(tdb, rec_ptr) == -1) {
+				goto fail;
+			}
+
+			if (count == alloced) {
+				struct tdb_hash_grow_rec *tmp;
+
+				alloced = (alloced == 0) ? 32 : alloced * 2;
+				tmp = realloc(recs, alloced * sizeof(*recs));
+				if (tmp == NULL) {
+					tdb->ecode = TDB_ERR_OOM;
+					goto fail;
+				}
+				recs = tmp;
+			}
+			recs[count].off = rec_ptr;
+			recs[count].full_hash = rec.full_hash;
+			count += 1;
+
+			rec_ptr = rec.next;
+
+			if (!tdb_chainwalk_check(tdb, &chainwalk, rec_ptr)) {
+				goto fail;
+			}
+		}
+	}
+
+	heads = calloc(new_num, sizeof(tdb_off_t));
+	if (heads == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		goto fail;
+	}
+
+	/*
+	 * Prepend backwards to keep the order of the records within
+	 * the lists. rec->next is the first field of a record.
+	 */
+	for (i = count; i > 0; i--) {
+		struct tdb_hash_grow_rec *r = &recs[i-1];
+		uint32_t sub = TDB_HASH_SUB(r->full_hash, new_num);
+
+		if (tdb_ofs_write(tdb, r->off, &heads[sub]) == -1) {
+			goto fail;
+		}
+		heads[sub] = r->off;
+	}
+
+	table.next = 0;
+	table.key_len = 0;
+	table.data_len = new_num * sizeof(tdb_off_t);
+	table.full_hash = list;
+	table.magic = TDB_HASH_SPLIT_MAGIC;
+
+	if (tdb_rec_write(tdb, table_ptr, &table) == -1) {
+		goto fail;
+	}
+	if (DOCONV()) {
+		tdb_convert(heads, new_num * sizeof(tdb_off_t));
+	}
+	if (tdb->methods->tdb_write(tdb, table_ptr + sizeof(table), heads,
+				    new_num * sizeof(tdb_off_t)) == -1) {
+		goto fail;
+	}
+
+	top = table_ptr | TDB_HASH_SPLIT_BIT;
+	if (tdb_ofs_write(tdb, TDB_HASH_TOP(list), &top) == -1) {
+		goto fail;
+	}
+	table_ptr = 0;
+
+	if (num > 1) {
+		/* Give back the old split table */
+		rec_ptr = first - sizeof(rec);
+		if (tdb->methods->tdb_read(tdb, rec_ptr, &rec, sizeof(rec),
+					   DOCONV()) == -1) {
+			goto fail;
+		}
+		if (tdb_free(tdb, rec_ptr, &rec) == -1) {
+			goto fail;
+		}
+	}
+
+	ret = 0;
+fail:
+	if (table_ptr != 0) {
+		tdb_free(tdb, table_ptr, &table);
+	}
+	free(heads);
+	free(recs);
+	return ret;
+}
+
 static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 		       const TDB_DATA *dbufs, int num_dbufs,
 		       int flag, uint32_t hash)
 {
 	struct tdb_record rec;
-	tdb_off_t rec_ptr, ofs;
+	tdb_off_t rec_ptr, ofs, head;
 	tdb_len_t rec_len, dbufs_len;
 	int i;
 	int ret = -1;
@@ -671,7 +952,9 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 	}
 
 	/* Read hash top into next ptr */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec.next) == -1)
+	if (tdb_hash_head(tdb, hash, &head) == -1)
+		goto fail;
+	if (tdb_ofs_read(tdb, head, &rec.next) == -1)
 		goto fail;
 
 	rec.key_len = key.dsize;
@@ -707,12 +990,24 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 		ofs += dbufs[i].dsize;
 	}
 
-	ret = tdb_ofs_write(tdb, TDB_HASH_TOP(hash), &rec_ptr);
+	ret = tdb_ofs_write(tdb, head, &rec_ptr);
 	if (ret == -1) {
 		/* Need to tdb_unallocate() here */
 		goto fail;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_GROWTH) {
+		/*
+		 * The record is stored, not being able to split the
+		 * list now is not an error for the caller.
+		 */
+		if (tdb_hash_grow(tdb, hash) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_store: "
+				 "failed to grow hash chain %u\n",
+				 BUCKET(hash)));
+		}
+	}
+
  done:
 	ret = 0;
  fail:
@@ -1012,9 +1307,11 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	}
 
 	/* wipe the freelist */
-	if (tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
-		goto failed;
+	for (i=0;i<TDB_FREE_LISTS(tdb);i++) {
+		if (tdb_ofs_write(tdb, TDB_FREE_LIST_TOP(tdb, i), &offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
+			goto failed;
+		}
 	}
 
 	/* add all the rest of the file to the freelist, possibly leaving a gap
@@ -52,8 +52,11 @@ typedef uint32_t tdb_off_t;
 #define TDB_DEAD_MAGIC (0xFEE1DEAD)
 #define TDB_RECOVERY_MAGIC (0xf53bc0e7U)
 #define TDB_RECOVERY_INVALID_MAGIC (0x0)
+#define TDB_RECOVERY_GROUP_MAGIC (0xf53bc1e7U)
+#define TDB_RECOVERY_PENDING_MAGIC (0xf53bc2e7U)
 #define TDB_HASH_RWLOCK_MAGIC (0xbad1a51U)
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
+#define TDB_HASH_SPLIT_MAGIC (0xbad1a53U)
 #define TDB_ALIGNMENT 4
 #define DEFAULT_HASH_SIZE 131
 #define FREELIST_TOP (sizeof(struct tdb_header))
@@ -70,9 +73,27 @@ typedef uint32_t tdb_off_t;
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_HASH_GROWTH 0x00000002
+#define TDB_FEATURE_FLAG_FREE_CLASSES 0x00000004
+#define TDB_FEATURE_FLAG_SEQLOCK 0x00000008
+#define TDB_FEATURE_FLAG_GROUP_COMMIT 0x00000010
+
+/*
+ * The optimistic readers of TDB_FEATURE_FLAG_SEQLOCK need the mutex
+ * area and the compiler's atomics
+ */
+#if defined(USE_TDB_MUTEX_LOCKING) && defined(HAVE___ATOMIC_ADD_LOAD)
+#define TDB_SUPPORTED_SEQLOCK TDB_FEATURE_FLAG_SEQLOCK
+#else
+#define TDB_SUPPORTED_SEQLOCK 0
+#endif
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_HASH_GROWTH | \
+	TDB_FEATURE_FLAG_FREE_CLASSES | \
+	TDB_SUPPORTED_SEQLOCK | \
+	TDB_FEATURE_FLAG_GROUP_COMMIT | \
 	0)
 
 /* NB assumes there is a local variable called "tdb" that is the
@@ -120,6 +141,7 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
 #define OPEN_LOCK        0
 #define ACTIVE_LOCK      4
 #define TRANSACTION_LOCK 8
+#define GROUP_SYNC_LOCK  12
 
 /* free memory if the pointer is valid and zero the pointer */
 #ifndef SAFE_FREE
@@ -144,6 +166,57 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
  */
 #define BUCKET(hash) ((hash) % tdb->hash_size)
 
+/*
+ * With TDB_FEATURE_FLAG_HASH_GROWTH a hash top can have the
+ * TDB_HASH_SPLIT_BIT set. The rest of it is then the offset of a
+ * record with TDB_HASH_SPLIT_MAGIC, its data_len is the size of an
+ * array of "num" list heads, "num" being a power of two. The list a
+ * record is in is selected by the hash bits above the ones used for
+ * BUCKET(). The lock for the bucket covers all its lists.
+ *
+ * When a list gets longer than TDB_HASH_SPLIT_CHAIN, the number of
+ * lists of the bucket is doubled, up to TDB_HASH_SPLIT_MAX.
+ */
+#define TDB_HASH_SPLIT_BIT 1
+#define TDB_HASH_SPLIT_CHAIN 8
+#define TDB_HASH_SPLIT_MAX 1024
+#define TDB_HASH_SUB(hash, num) (((hash) / tdb->hash_size) & ((num)-1))
+
+/*
+ * With TDB_FEATURE_FLAG_FREE_CLASSES free records are not on the list
+ * at FREELIST_TOP but on one of TDB_FREE_CLASSES lists by size, the
+ * heads of which are in the reserved part of the header. Class 0 is
+ * for records smaller than 128 bytes, each further class doubles the
+ * size, the last one takes everything bigger. A free record has the
+ * number of the list it is on in its full_hash field.
+ *
+ * Each list has its own lock on its head, so allocations and frees of
+ * different sizes don't wait for each other. A free record on a list
+ * may only be changed with the list lock held. Nobody waits for a
+ * list lock while holding another one, the freelist lock (-1) is
+ * still taken around tdb_expand(), before any list lock.
+ */
+#define TDB_FREE_CLASSES 8
+#define TDB_FREE_CLASS_SHIFT 7
+#define TDB_FREE_CLASS_TOP(c) \
+	(offsetof(struct tdb_header, reserved) + (c)*sizeof(tdb_off_t))
+#define TDB_FREE_LISTS(tdb) \
+	(((tdb)->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) ? \
+	 TDB_FREE_CLASSES : 1)
+#define TDB_FREE_LIST_TOP(tdb, i) \
+	(((tdb)->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES) ? \
+	 TDB_FREE_CLASS_TOP(i) : FREELIST_TOP)
+
+/*
+ * With TDB_FEATURE_FLAG_GROUP_COMMIT transactions count their commits
+ * in the header. TDB_GROUP_COMMITTED_OFS is the number of the last
+ * commit written, TDB_GROUP_SYNCED_OFS the last one known to be on
+ * disk. Both are changed outside of transactions and are left out
+ * when the recovery code compares blocks, see transaction.c.
+ */
+#define TDB_GROUP_COMMITTED_OFS TDB_FREE_CLASS_TOP(TDB_FREE_CLASSES)
+#define TDB_GROUP_SYNCED_OFS (TDB_GROUP_COMMITTED_OFS + sizeof(tdb_off_t))
+
 #define DOCONV() (tdb->flags & TDB_CONVERT)
 #define CONVERT(x) (DOCONV() ? tdb_convert(&x, sizeof(x)) : &x)
 
@@ -278,6 +351,11 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 int tdb_nest_unlock(struct tdb_context *tdb, uint32_t offset, int ltype,
 		    bool mark_lock);
 int tdb_unlock(struct tdb_context *tdb, int list, int ltype);
+int tdb_lock_free_class(struct tdb_context *tdb, uint32_t c, int ltype,
+			enum tdb_lock_flags flags);
+int tdb_unlock_free_class(struct tdb_context *tdb, uint32_t c, int ltype);
+int tdb_lock_free_lists(struct tdb_context *tdb, int ltype);
+int tdb_unlock_free_lists(struct tdb_context *tdb, int ltype);
 int tdb_brlock(struct tdb_context *tdb,
 	       int rw_type, tdb_off_t offset, size_t len,
 	       enum tdb_lock_flags flags);
@@ -322,6 +400,7 @@ int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_lock_record(struct tdb_context *tdb, tdb_off_t off);
 int tdb_unlock_record(struct tdb_context *tdb, tdb_off_t off);
 bool tdb_needs_recovery(struct tdb_context *tdb);
+int tdb_group_commit_retire(struct tdb_context *tdb);
 int tdb_rec_read(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
 int tdb_rec_write(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
 unsigned char *tdb_alloc_read(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t len);
@@ -336,6 +415,8 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 			struct tdb_record *r, tdb_len_t length,
 			tdb_off_t *p_last_ptr);
 int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash);
+int tdb_hash_heads(struct tdb_context *tdb, uint32_t list,
+		   tdb_off_t *pfirst, uint32_t *pnum);
 void tdb_io_init(struct tdb_context *tdb);
 int tdb_expand(struct tdb_context *tdb, tdb_off_t size);
 tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size);
@@ -343,6 +424,7 @@ int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off,
 		      struct tdb_record *rec);
 bool tdb_write_all(int fd, const void *buf, size_t count);
 int tdb_transaction_recover(struct tdb_context *tdb);
+int tdb_group_commit_recover(struct tdb_context *tdb);
 void tdb_header_hash(struct tdb_context *tdb,
 		     uint32_t *magic1_hash, uint32_t *magic2_hash);
 unsigned int tdb_old_hash(TDB_DATA *key);
@@ -366,5 +448,8 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 int tdb_mutex_allrecord_unlock(struct tdb_context *tdb);
 int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb);
 void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb);
+bool tdb_mutex_fetch(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
+		     unsigned char *buf, size_t buflen, TDB_DATA *data,
+		     int *pret);
 
 #endif /* TDB_PRIVATE_H */
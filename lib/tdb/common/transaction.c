@@ -75,6 +75,17 @@
     needed per commit to prevent race conditions. It might be possible
     to reduce this to 3 or even 2 with some more work.
 
+  - with TDB_GROUP_COMMIT the recovery record carries a checksum and
+    a hash of every block the commit writes, so it can be written and
+    synced in one go, and after a crash the recovery code can tell
+    whether the new data made it to disk. The commit then writes the
+    data without syncing it, marks the record "pending" and waits for
+    a sync that covers its commit number. A process that finds
+    someone else's sync covering it does not need its own, and the
+    next commit's sync covers the data of the previous one. Writers
+    outside of transactions first make sure a pending commit is on
+    disk, see tdb_group_commit_retire().
+
   - check for a valid recovery record on open of the tdb, while the
     open lock is held. Automatically recover from the transaction
     recovery area if needed, then continue with the open as
@@ -141,6 +152,9 @@ struct tdb_transaction {
 
 	/* did we expand in this transaction */
 	bool expanded;
+
+	/* the commit number with TDB_GROUP_COMMIT */
+	uint32_t group_seq;
 };
 
 
@@ -594,6 +608,159 @@ static int transaction_sync(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t
 	return 0;
 }
 
+static bool tdb_group_commit(struct tdb_context *tdb)
+{
+	return (tdb->feature_flags & TDB_FEATURE_FLAG_GROUP_COMMIT) != 0;
+}
+
+/*
+  read and write the group commit counters, always on the real file
+*/
+static int tdb_group_read(struct tdb_context *tdb,
+			  const struct tdb_methods *methods,
+			  tdb_off_t offset, uint32_t *seq)
+{
+	return methods->tdb_read(tdb, offset, seq, sizeof(*seq), DOCONV());
+}
+
+static int tdb_group_write(struct tdb_context *tdb,
+			   const struct tdb_methods *methods,
+			   tdb_off_t offset, uint32_t seq)
+{
+	CONVERT(seq);
+	return methods->tdb_write(tdb, offset, &seq, sizeof(seq));
+}
+
+/*
+  make sure commit number seq is on disk. The sync covers everything
+  committed so far, so a commit that finds its number already synced
+  by someone else has nothing to do
+*/
+static int tdb_group_sync(struct tdb_context *tdb,
+			  const struct tdb_methods *methods,
+			  uint32_t seq, tdb_len_t length)
+{
+	uint32_t synced, committed;
+	int ret;
+
+	if (tdb_nest_lock(tdb, GROUP_SYNC_LOCK, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+		return -1;
+	}
+
+	ret = tdb_group_read(tdb, methods, TDB_GROUP_SYNCED_OFS, &synced);
+	if (ret == -1 || (int32_t)(synced - seq) >= 0) {
+		goto done;
+	}
+
+	ret = tdb_group_read(tdb, methods, TDB_GROUP_COMMITTED_OFS, &committed);
+	if (ret == -1) {
+		goto done;
+	}
+
+	ret = transaction_sync(tdb, 0, length);
+	if (ret == -1) {
+		goto done;
+	}
+
+	ret = tdb_group_write(tdb, methods, TDB_GROUP_SYNCED_OFS, committed);
+
+done:
+	tdb_nest_unlock(tdb, GROUP_SYNC_LOCK, F_WRLCK, false);
+	return ret;
+}
+
+static void tdb_group_blank(unsigned char *buf, tdb_off_t offset,
+			    tdb_len_t length, tdb_off_t start, tdb_len_t len)
+{
+	tdb_off_t end = start + len;
+
+	if (start >= offset + length || end <= offset) {
+		return;
+	}
+	if (start < offset) {
+		start = offset;
+	}
+	if (end > offset + length) {
+		end = offset + length;
+	}
+	memset(buf + (start - offset), 0, end - start);
+}
+
+/*
+  hash a block as written by a commit. The recovery area and the
+  commit counters change after the data has been written, so they
+  are left out. This modifies buf.
+*/
+static uint32_t tdb_group_block_hash(unsigned char *buf, tdb_off_t offset,
+				     tdb_len_t length,
+				     tdb_off_t recovery_head,
+				     tdb_len_t recovery_len)
+{
+	TDB_DATA block = { .dptr = buf, .dsize = length };
+
+	tdb_group_blank(buf, offset, length, recovery_head, recovery_len);
+	tdb_group_blank(buf, offset, length, TDB_GROUP_COMMITTED_OFS,
+			2 * sizeof(uint32_t));
+
+	return tdb_jenkins_hash(&block);
+}
+
+/*
+  once a group commit is complete in the file, make sure it is on disk
+  and then drop the recovery record, so nothing can undo it after
+  other changes have been made
+*/
+static int tdb_group_retire_record(struct tdb_context *tdb,
+				   tdb_off_t recovery_head)
+{
+	const uint32_t invalid = TDB_RECOVERY_INVALID_MAGIC;
+	uint32_t committed;
+
+	if (tdb_group_read(tdb, tdb->methods, TDB_GROUP_COMMITTED_OFS,
+			   &committed) == -1 ||
+	    tdb_group_sync(tdb, tdb->methods, committed, tdb->map_size) == -1) {
+		return -1;
+	}
+
+	if (tdb->methods->tdb_write(tdb, recovery_head +
+				    offsetof(struct tdb_record, magic),
+				    &invalid, sizeof(invalid)) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_group_retire_record: failed to remove recovery magic\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	return transaction_sync(tdb, recovery_head, sizeof(struct tdb_record));
+}
+
+/*
+  Called with a write lock held, before anything changes the data
+  outside of a transaction. The recovery code can only check a pending
+  group commit as long as nothing else modified the blocks it wrote.
+*/
+int tdb_group_commit_retire(struct tdb_context *tdb)
+{
+	tdb_off_t recovery_head;
+	struct tdb_record rec;
+
+	if (!tdb_group_commit(tdb)) {
+		return 0;
+	}
+	if ((tdb->transaction != NULL) || tdb->read_only ||
+	    (tdb->flags & TDB_NOLOCK)) {
+		return 0;
+	}
+
+	if (tdb_recovery_area(tdb, tdb->methods, &recovery_head, &rec) == -1) {
+		return -1;
+	}
+	if ((recovery_head == 0) || (rec.magic != TDB_RECOVERY_PENDING_MAGIC)) {
+		return 0;
+	}
+
+	return tdb_group_retire_record(tdb, recovery_head);
+}
+
 
 static int _tdb_transaction_cancel(struct tdb_context *tdb)
 {
@@ -687,6 +854,24 @@ static bool tdb_recovery_size(struct tdb_context *tdb, tdb_len_t *result)
 		}
 	}
 
+	if (tdb_group_commit(tdb)) {
+		/* seq, new eof and block count, then offset, length
+		   and hash of every block we write */
+		if (!tdb_add_len_t(recovery_size, 3*sizeof(uint32_t),
+				   &recovery_size)) {
+			return false;
+		}
+		for (i=0;i<tdb->transaction->num_blocks;i++) {
+			if (tdb->transaction->blocks[i] == NULL) {
+				continue;
+			}
+			if (!tdb_add_len_t(recovery_size, 3*sizeof(uint32_t),
+					   &recovery_size)) {
+				return false;
+			}
+		}
+	}
+
 	*result = recovery_size;
 	return true;
 }
@@ -714,6 +899,8 @@ int tdb_recovery_area(struct tdb_context *tdb,
 
 	/* ignore invalid recovery regions: can happen in crash */
 	if (rec->magic != TDB_RECOVERY_MAGIC &&
+	    rec->magic != TDB_RECOVERY_GROUP_MAGIC &&
+	    rec->magic != TDB_RECOVERY_PENDING_MAGIC &&
 	    rec->magic != TDB_RECOVERY_INVALID_MAGIC) {
 		*recovery_offset = 0;
 		rec->rec_len = 0;
@@ -837,6 +1024,71 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 }
 
 
+/*
+  append what a group commit will write to the recovery data: the
+  commit number, the new file size and the hashes of all blocks
+*/
+static unsigned char *transaction_group_digest(struct tdb_context *tdb,
+					       unsigned char *p, uint32_t seq,
+					       tdb_off_t recovery_offset,
+					       tdb_len_t recovery_len)
+{
+	unsigned char *buf;
+	uint32_t num = 0;
+	uint32_t i;
+
+	buf = malloc(tdb->transaction->block_size);
+	if (buf == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return NULL;
+	}
+
+	for (i=0;i<tdb->transaction->num_blocks;i++) {
+		if (tdb->transaction->blocks[i] != NULL) {
+			num++;
+		}
+	}
+
+	memcpy(p, &seq, 4);
+	memcpy(p+4, &tdb->map_size, 4);
+	memcpy(p+8, &num, 4);
+	if (DOCONV()) {
+		tdb_convert(p, 12);
+	}
+	p += 12;
+
+	for (i=0;i<tdb->transaction->num_blocks;i++) {
+		tdb_off_t offset;
+		tdb_len_t length;
+		uint32_t hash;
+
+		if (tdb->transaction->blocks[i] == NULL) {
+			continue;
+		}
+
+		offset = i * tdb->transaction->block_size;
+		length = tdb->transaction->block_size;
+		if (i == tdb->transaction->num_blocks-1) {
+			length = tdb->transaction->last_block_size;
+		}
+
+		memcpy(buf, tdb->transaction->blocks[i], length);
+		hash = tdb_group_block_hash(buf, offset, length,
+					    recovery_offset, recovery_len);
+
+		memcpy(p, &offset, 4);
+		memcpy(p+4, &length, 4);
+		memcpy(p+8, &hash, 4);
+		if (DOCONV()) {
+			tdb_convert(p, 12);
+		}
+		p += 12;
+	}
+
+	free(buf);
+	return p;
+}
+
 /*
   setup the recovery data that will be used on a crash during commit
 */
@@ -850,8 +1102,24 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 	tdb_off_t recovery_offset, recovery_max_size;
 	tdb_off_t old_map_size = tdb->transaction->old_map_size;
 	uint32_t magic, tailer;
+	uint32_t seq = 0;
 	uint32_t i;
 
+	if (tdb_group_commit(tdb)) {
+		uint32_t committed;
+
+		/* the recovery area might still be needed for the
+		   last commit until that is on disk */
+		if (tdb_group_read(tdb, methods, TDB_GROUP_COMMITTED_OFS,
+				   &committed) == -1 ||
+		    tdb_group_sync(tdb, methods, committed,
+				   old_map_size) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to sync previous commit\n"));
+			return -1;
+		}
+		seq = committed + 1;
+	}
+
 	/*
 	  check that the recovery area has enough space
 	*/
@@ -872,7 +1140,6 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 	rec->data_len = recovery_size;
 	rec->rec_len  = recovery_max_size;
 	rec->key_len  = old_map_size;
-	CONVERT(*rec);
 
 	data = (unsigned char *)rec;
 
@@ -918,6 +1185,20 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 		p += 8 + length;
 	}
 
+	if (tdb_group_commit(tdb)) {
+		/* the undo data is followed by the digest, and a
+		   checksum tells a complete record from a torn one */
+		rec->magic = TDB_RECOVERY_GROUP_MAGIC;
+		rec->next = p - (data + sizeof(*rec));
+
+		p = transaction_group_digest(tdb, p, seq, recovery_offset,
+					     sizeof(*rec) + recovery_max_size);
+		if (p == NULL) {
+			free(data);
+			return -1;
+		}
+	}
+
 	/* and the tailer */
 	tailer = sizeof(*rec) + recovery_max_size;
 	memcpy(p, &tailer, 4);
@@ -925,6 +1206,15 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 		tdb_convert(p, 4);
 	}
 
+	if (tdb_group_commit(tdb)) {
+		TDB_DATA blob = {
+			.dptr = data + sizeof(*rec), .dsize = recovery_size
+		};
+		rec->full_hash = tdb_jenkins_hash(&blob);
+	}
+
+	CONVERT(*rec);
+
 	/* write the recovery data to the recovery area */
 	if (methods->tdb_write(tdb, recovery_offset, data, sizeof(*rec) + recovery_size) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery data\n"));
@@ -949,11 +1239,17 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 
 	free(data);
 
+	*magic_offset = recovery_offset + offsetof(struct tdb_record, magic);
+
+	if (tdb_group_commit(tdb)) {
+		/* the group magic was in the record we just synced */
+		tdb->transaction->group_seq = seq;
+		return 0;
+	}
+
 	magic = TDB_RECOVERY_MAGIC;
 	CONVERT(magic);
 
-	*magic_offset = recovery_offset + offsetof(struct tdb_record, magic);
-
 	if (methods->tdb_write(tdb, *magic_offset, &magic, sizeof(magic)) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery magic\n"));
 		tdb->ecode = TDB_ERR_IO;
@@ -1091,17 +1387,20 @@ static bool repack_worthwhile(struct tdb_context *tdb)
 	tdb_off_t ptr;
 	struct tdb_record rec;
 	tdb_len_t total = 0, largest = 0;
+	uint32_t i;
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &ptr) == -1) {
-		return false;
-	}
+	for (i = 0; i < TDB_FREE_LISTS(tdb); i++) {
+		if (tdb_ofs_read(tdb, TDB_FREE_LIST_TOP(tdb, i), &ptr) == -1) {
+			return false;
+		}
 
-	while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
-		total += rec.rec_len;
-		if (rec.rec_len > largest) {
-			largest = rec.rec_len;
+		while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
+			total += rec.rec_len;
+			if (rec.rec_len > largest) {
+				largest = rec.rec_len;
+			}
+			ptr = rec.next;
 		}
-		ptr = rec.next;
 	}
 
 	return total > largest * 2;
@@ -1115,6 +1414,8 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	const struct tdb_methods *methods;
 	uint32_t i;
 	bool need_repack = false;
+	bool group = false;
+	uint32_t group_seq = 0;
 
 	if (tdb->transaction == NULL) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_transaction_commit: no transaction\n"));
@@ -1190,9 +1491,35 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	SAFE_FREE(tdb->transaction->blocks);
 	tdb->transaction->num_blocks = 0;
 
-	/* ensure the new data is on disk */
-	if (transaction_sync(tdb, 0, tdb->map_size) == -1) {
-		return -1;
+	if (tdb_group_commit(tdb)) {
+		uint32_t pending = TDB_RECOVERY_PENDING_MAGIC;
+
+		group = true;
+		group_seq = tdb->transaction->group_seq;
+
+		/* leave the sync to tdb_group_sync() below: from
+		   now on the recovery code checks whether the data
+		   made it to disk instead of undoing it right away */
+		CONVERT(pending);
+		if (tdb_group_write(tdb, methods, TDB_GROUP_COMMITTED_OFS,
+				    group_seq) == -1 ||
+		    methods->tdb_write(tdb, tdb->transaction->magic_offset,
+				       &pending, sizeof(pending)) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_commit: failed to mark commit pending\n"));
+			tdb->methods = methods;
+			tdb_transaction_recover(tdb);
+			_tdb_transaction_cancel(tdb);
+			tdb->ecode = TDB_ERR_IO;
+			return -1;
+		}
+
+		/* don't let the cancel below remove it */
+		tdb->transaction->magic_offset = 0;
+	} else {
+		/* ensure the new data is on disk */
+		if (transaction_sync(tdb, 0, tdb->map_size) == -1) {
+			return -1;
+		}
 	}
 
 	/*
@@ -1212,6 +1539,14 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	   transaction locks */
 	_tdb_transaction_cancel(tdb);
 
+	/* wait for our commit to be on disk, possibly along with
+	   others running concurrently */
+	if (group && tdb_group_sync(tdb, tdb->methods, group_seq,
+				    tdb->map_size) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_commit: failed to sync commit\n"));
+		return -1;
+	}
+
 	if (need_repack) {
 		int ret = tdb_repack(tdb);
 		if (ret != 0) {
@@ -1243,42 +1578,99 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 
 
 /*
-  recover from an aborted transaction. Must be called with exclusive
-  database write access already established (including the open
-  lock to prevent new processes attaching)
+  check whether a group commit made it to the file completely. Returns
+  1 if the data has to be restored, 0 if it must be kept, -1 on error.
 */
-int tdb_transaction_recover(struct tdb_context *tdb)
+static int tdb_group_recovery_needed(struct tdb_context *tdb,
+				     tdb_off_t recovery_head,
+				     const struct tdb_record *rec,
+				     unsigned char *data)
 {
-	tdb_off_t recovery_head, recovery_eof;
-	unsigned char *data, *p;
-	uint32_t zero = 0;
-	struct tdb_record rec;
+	TDB_DATA blob = { .dptr = data, .dsize = rec->data_len };
+	unsigned char *p, *buf;
+	uint32_t new_eof, num, i;
+	int ret = 0;
 
-	/* find the recovery area */
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery head\n"));
-		tdb->ecode = TDB_ERR_IO;
-		return -1;
+	if (tdb_jenkins_hash(&blob) != rec->full_hash) {
+		/* torn before the data was touched */
+		return 0;
 	}
 
-	if (recovery_head == 0) {
-		/* we have never allocated a recovery record */
-		return 0;
+	if ((rec->next > rec->data_len) ||
+	    (rec->data_len - rec->next < 4*sizeof(uint32_t))) {
+		goto corrupt;
 	}
+	p = data + rec->next;
 
-	/* read the recovery record */
-	if (tdb->methods->tdb_read(tdb, recovery_head, &rec,
-				   sizeof(rec), DOCONV()) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery record\n"));
-		tdb->ecode = TDB_ERR_IO;
-		return -1;
+	memcpy(&new_eof, p+4, 4);
+	memcpy(&num, p+8, 4);
+	if (DOCONV()) {
+		tdb_convert(&new_eof, 4);
+		tdb_convert(&num, 4);
 	}
+	p += 12;
 
-	if (rec.magic != TDB_RECOVERY_MAGIC) {
-		/* there is no valid recovery data */
-		return 0;
+	if (rec->data_len - rec->next - 4*sizeof(uint32_t) != (uint64_t)num * 12) {
+		goto corrupt;
+	}
+
+	if (tdb->methods->tdb_oob(tdb, 0, new_eof, 1) != 0) {
+		/* the file was not even expanded */
+		return 1;
 	}
 
+	for (i=0; i<num; i++, p += 12) {
+		uint32_t ofs, len, hash;
+
+		memcpy(&ofs, p, 4);
+		memcpy(&len, p+4, 4);
+		memcpy(&hash, p+8, 4);
+		if (DOCONV()) {
+			tdb_convert(&ofs, 4);
+			tdb_convert(&len, 4);
+			tdb_convert(&hash, 4);
+		}
+
+		buf = malloc(len);
+		if (buf == NULL) {
+			tdb->ecode = TDB_ERR_OOM;
+			return -1;
+		}
+		if (tdb->methods->tdb_read(tdb, ofs, buf, len, 0) == -1) {
+			free(buf);
+			return -1;
+		}
+		if (tdb_group_block_hash(buf, ofs, len, recovery_head,
+					 sizeof(*rec) + rec->rec_len) != hash) {
+			ret = 1;
+		}
+		free(buf);
+
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	return ret;
+
+corrupt:
+	TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_group_recovery_needed: invalid group commit record\n"));
+	tdb->ecode = TDB_ERR_CORRUPT;
+	return -1;
+}
+
+/*
+  restore the data from the recovery record
+*/
+static int tdb_recovery_apply(struct tdb_context *tdb,
+			      tdb_off_t recovery_head,
+			      struct tdb_record rec)
+{
+	tdb_off_t recovery_eof;
+	tdb_len_t undo_len;
+	unsigned char *data, *p;
+	uint32_t zero = 0;
+
 	if (tdb->read_only) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: attempt to recover read only database\n"));
 		tdb->ecode = TDB_ERR_CORRUPT;
@@ -1303,9 +1695,26 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 		return -1;
 	}
 
+	undo_len = rec.data_len;
+
+	if (rec.magic != TDB_RECOVERY_MAGIC) {
+		int ret;
+
+		ret = tdb_group_recovery_needed(tdb, recovery_head, &rec, data);
+		if (ret == -1) {
+			free(data);
+			return -1;
+		}
+		if (ret == 0) {
+			free(data);
+			return tdb_group_retire_record(tdb, recovery_head);
+		}
+		undo_len = rec.next;
+	}
+
 	/* recover the file data */
 	p = data;
-	while (p+8 < data + rec.data_len) {
+	while (p+8 < data + undo_len) {
 		uint32_t ofs, len;
 		if (DOCONV()) {
 			tdb_convert(p, 8);
@@ -1360,6 +1769,98 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	return 0;
 }
 
+static int tdb_recovery_record(struct tdb_context *tdb,
+			       tdb_off_t *recovery_head,
+			       struct tdb_record *rec)
+{
+	/* find the recovery area */
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, recovery_head) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery head\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	if (*recovery_head == 0) {
+		/* we have never allocated a recovery record */
+		rec->magic = TDB_RECOVERY_INVALID_MAGIC;
+		return 0;
+	}
+
+	/* read the recovery record */
+	if (tdb->methods->tdb_read(tdb, *recovery_head, rec,
+				   sizeof(*rec), DOCONV()) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery record\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+  recover from an aborted transaction. Must be called with exclusive
+  database write access already established (including the open
+  lock to prevent new processes attaching)
+*/
+int tdb_transaction_recover(struct tdb_context *tdb)
+{
+	tdb_off_t recovery_head;
+	struct tdb_record rec;
+
+	if (tdb_recovery_record(tdb, &recovery_head, &rec) == -1) {
+		return -1;
+	}
+
+	/*
+	 * A pending group commit is complete unless the machine
+	 * crashed, and other processes can use the database while
+	 * it is pending: see tdb_group_commit_recover()
+	 */
+	if (rec.magic != TDB_RECOVERY_MAGIC &&
+	    rec.magic != TDB_RECOVERY_GROUP_MAGIC) {
+		/* there is no valid recovery data */
+		return 0;
+	}
+
+	return tdb_recovery_apply(tdb, recovery_head, rec);
+}
+
+/*
+  check a pending group commit on open, with the open lock held. If
+  nobody else has the database locked we might be the first to open
+  it after a crash, and the data the commit wrote might not have made
+  it to disk.
+*/
+int tdb_group_commit_recover(struct tdb_context *tdb)
+{
+	tdb_off_t recovery_head;
+	struct tdb_record rec;
+	int ret;
+
+	if (!tdb_group_commit(tdb) || tdb->read_only) {
+		return 0;
+	}
+
+	if (tdb_recovery_record(tdb, &recovery_head, &rec) == -1) {
+		return -1;
+	}
+	if (rec.magic != TDB_RECOVERY_PENDING_MAGIC) {
+		return 0;
+	}
+
+	if (tdb_brlock(tdb, F_WRLCK, FREELIST_TOP, 0,
+		       TDB_LOCK_NOWAIT|TDB_LOCK_PROBE) == -1) {
+		/* in use, so it's not a crash */
+		return 0;
+	}
+
+	ret = tdb_recovery_apply(tdb, recovery_head, rec);
+
+	tdb_brunlock(tdb, F_WRLCK, FREELIST_TOP, 0);
+
+	return ret;
+}
+
 /* Any I/O failures we say "needs recovery". */
 bool tdb_needs_recovery(struct tdb_context *tdb)
 {
@@ -1382,5 +1883,6 @@ bool tdb_needs_recovery(struct tdb_context *tdb)
 		return true;
 	}
 
-	return (rec.magic == TDB_RECOVERY_MAGIC);
+	return (rec.magic == TDB_RECOVERY_MAGIC ||
+		rec.magic == TDB_RECOVERY_GROUP_MAGIC);
 }
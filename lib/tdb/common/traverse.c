@@ -35,6 +35,8 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 			 struct tdb_record *rec)
 {
 	int want_next = (tlock->off != 0);
+	tdb_off_t first;
+	uint32_t num, sub;
 
 	/* Lock each chain from the start one. */
 	for (; tlock->list < tdb->hash_size; tlock->list++) {
@@ -76,10 +78,13 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 		if (tdb_lock(tdb, tlock->list, tlock->lock_rw) == -1)
 			return TDB_NEXT_LOCK_ERR;
 
+		if (tdb_hash_heads(tdb, tlock->list, &first, &num) == -1)
+			goto fail;
+
 		/* No previous record?  Start at top of chain. */
+		sub = 0;
 		if (!tlock->off) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tlock->list),
-				     &tlock->off) == -1)
+			if (tdb_ofs_read(tdb, first, &tlock->off) == -1)
 				goto fail;
 		} else {
 			/* Otherwise unlock the previous record. */
@@ -91,11 +96,28 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 			/* We have offset of old record: grab next */
 			if (tdb_rec_read(tdb, tlock->off, rec) == -1)
 				goto fail;
+			/*
+			 * The bucket can't have been split while we held
+			 * the record lock, see tdb_hash_grow()
+			 */
+			sub = TDB_HASH_SUB(rec->full_hash, num);
 			tlock->off = rec->next;
 		}
 
 		/* Iterate through chain */
-		while( tlock->off) {
+		while (true) {
+			if (tlock->off == 0) {
+				/* Continue with the next list of a split bucket */
+				sub += 1;
+				if (sub >= num) {
+					break;
+				}
+				if (tdb_ofs_read(tdb, first + sub * sizeof(tdb_off_t),
+						 &tlock->off) == -1)
+					goto fail;
+				continue;
+			}
+
 			if (tdb_rec_read(tdb, tlock->off, rec) == -1)
 				goto fail;
 
@@ -399,38 +421,25 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 	return key;
 }
 
-_PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
-				unsigned chain,
-				tdb_traverse_func fn,
-				void *private_data)
+/*
+ * Call fn for the records in the list starting at "head". Returns -1
+ * on error, 1 if fn asked to stop, 0 otherwise.
+ */
+static int tdb_traverse_list(struct tdb_context *tdb,
+			     tdb_off_t head,
+			     tdb_traverse_func fn,
+			     void *private_data,
+			     int *count)
 {
 	tdb_off_t rec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
-	int count = 0;
 	int ret;
 
-	if (chain >= tdb->hash_size) {
-		tdb->ecode = TDB_ERR_EINVAL;
-		return -1;
-	}
-
-	if (tdb->traverse_read != 0) {
-		tdb->ecode = TDB_ERR_LOCK;
-		return -1;
-	}
-
-	ret = tdb_lock(tdb, chain, F_RDLCK);
+	ret = tdb_ofs_read(tdb, head, &rec_ptr);
 	if (ret == -1) {
 		return -1;
 	}
 
-	tdb->traverse_read += 1;
-
-	ret = tdb_ofs_read(tdb, TDB_HASH_TOP(chain), &rec_ptr);
-	if (ret == -1) {
-		goto fail;
-	}
-
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
 
 	while (rec_ptr != 0) {
@@ -439,7 +448,7 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 
 		ret = tdb_rec_read(tdb, rec_ptr, &rec);
 		if (ret == -1) {
-			goto fail;
+			return -1;
 		}
 
 		if (!TDB_DEAD(&rec)) {
@@ -455,13 +464,13 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			    (tdb->map_ptr != NULL)) {
 				ret = tdb_oob(tdb, key_ofs, full_len, 0);
 				if (ret == -1) {
-					goto fail;
+					return -1;
 				}
 				key.dptr = (uint8_t *)tdb->map_ptr + key_ofs;
 			} else {
 				buf = tdb_alloc_read(tdb, key_ofs, full_len);
 				if (buf == NULL) {
-					goto fail;
+					return -1;
 				}
 				key.dptr = buf;
 			}
@@ -470,10 +479,10 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			ret = fn(tdb, key, data, private_data);
 			free(buf);
 
-			count += 1;
+			*count += 1;
 
 			if (ret != 0) {
-				break;
+				return 1;
 			}
 		}
 
@@ -481,8 +490,54 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 
 		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
 		if (!ok) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+_PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
+				unsigned chain,
+				tdb_traverse_func fn,
+				void *private_data)
+{
+	tdb_off_t first;
+	uint32_t i, num;
+	int count = 0;
+	int ret;
+
+	if (chain >= tdb->hash_size) {
+		tdb->ecode = TDB_ERR_EINVAL;
+		return -1;
+	}
+
+	if (tdb->traverse_read != 0) {
+		tdb->ecode = TDB_ERR_LOCK;
+		return -1;
+	}
+
+	ret = tdb_lock(tdb, chain, F_RDLCK);
+	if (ret == -1) {
+		return -1;
+	}
+
+	tdb->traverse_read += 1;
+
+	ret = tdb_hash_heads(tdb, chain, &first, &num);
+	if (ret == -1) {
+		goto fail;
+	}
+
+	for (i = 0; i < num; i++) {
+		ret = tdb_traverse_list(tdb, first + i * sizeof(tdb_off_t),
+					fn, private_data, &count);
+		if (ret == -1) {
 			goto fail;
 		}
+		if (ret == 1) {
+			break;
+		}
 	}
 	tdb->traverse_read -= 1;
 	tdb_unlock(tdb, chain, F_RDLCK);
@@ -508,3 +563,366 @@ _PUBLIC_ int tdb_traverse_key_chain(struct tdb_context *tdb,
 
 	return ret;
 }
+
+/*
+ * tdb_traverse_read_parallel() forks one helper per range of hash
+ * chains. A helper collects the records of each chain under the chain
+ * read lock and sends them through a pipe as key length, data length
+ * (both native uint32_t), key and data.
+ */
+
+#define TDB_PARALLEL_MAX_HELPERS 64
+#define TDB_PARALLEL_BUFSIZE 65536
+
+struct tdb_parallel_buf {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	bool oom;
+};
+
+static bool tdb_parallel_buf_reserve(struct tdb_parallel_buf *b,
+				     size_t needed)
+{
+	size_t size;
+	uint8_t *buf;
+
+	if (b->size - b->len >= needed) {
+		return true;
+	}
+	if (b->len + needed < needed) {
+		return false;
+	}
+
+	size = MAX(b->size * 2, b->len + needed);
+	buf = realloc(b->buf, size);
+	if (buf == NULL) {
+		return false;
+	}
+	b->buf = buf;
+	b->size = size;
+	return true;
+}
+
+static int tdb_parallel_collect(struct tdb_context *tdb, TDB_DATA key,
+				TDB_DATA data, void *private_data)
+{
+	struct tdb_parallel_buf *out = private_data;
+	uint32_t lens[2] = { key.dsize, data.dsize };
+
+	if (!tdb_parallel_buf_reserve(out, sizeof(lens) +
+				      (size_t)key.dsize + data.dsize)) {
+		out->oom = true;
+		return -1;
+	}
+
+	memcpy(out->buf + out->len, lens, sizeof(lens));
+	out->len += sizeof(lens);
+	memcpy(out->buf + out->len, key.dptr, key.dsize);
+	out->len += key.dsize;
+	memcpy(out->buf + out->len, data.dptr, data.dsize);
+	out->len += data.dsize;
+
+	return 0;
+}
+
+static bool tdb_parallel_flush(int fd, struct tdb_parallel_buf *out)
+{
+	size_t done = 0;
+
+	while (done < out->len) {
+		ssize_t ret = write(fd, out->buf + done, out->len - done);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			return false;
+		}
+		done += ret;
+	}
+	out->len = 0;
+	return true;
+}
+
+/* Runs in the helper: send all records in chains [start, end) */
+static int tdb_parallel_range(struct tdb_context *tdb, int fd,
+			      uint32_t start, uint32_t end)
+{
+	struct tdb_parallel_buf out = { .buf = NULL };
+	uint32_t chain;
+	int ret = 0;
+
+	for (chain = start; chain < end; chain++) {
+		if (chain != start) {
+			/*
+			 * Skip empty chains without locking, see
+			 * tdb_next_lock(). The first chain is always
+			 * locked to get a coherent view of the heads.
+			 */
+			tdb->methods->next_hash_chain(tdb, &chain);
+			if (chain >= end) {
+				break;
+			}
+		}
+
+		ret = tdb_traverse_chain(tdb, chain, tdb_parallel_collect,
+					 &out);
+		if (ret == -1 || out.oom) {
+			ret = -1;
+			break;
+		}
+		ret = 0;
+
+		if ((out.len >= TDB_PARALLEL_BUFSIZE) &&
+		    !tdb_parallel_flush(fd, &out)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if ((ret == 0) && !tdb_parallel_flush(fd, &out)) {
+		ret = -1;
+	}
+
+	free(out.buf);
+	return ret;
+}
+
+struct tdb_parallel_helper {
+	pid_t pid;
+	int fd;
+	struct tdb_parallel_buf in;
+};
+
+/*
+ * Read what a helper sent and call fn on the complete records.
+ * Returns -1 on error, 1 if fn asked to stop, 0 otherwise. h->fd is
+ * set to -1 once the helper is done.
+ */
+static int tdb_parallel_receive(struct tdb_context *tdb,
+				struct tdb_parallel_helper *h,
+				tdb_traverse_func fn, void *private_data,
+				int *count)
+{
+	uint8_t *p;
+	size_t left;
+	ssize_t nread;
+
+	if (!tdb_parallel_buf_reserve(&h->in, TDB_PARALLEL_BUFSIZE)) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+
+	nread = read(h->fd, h->in.buf + h->in.len, h->in.size - h->in.len);
+	if (nread == -1) {
+		if (errno == EINTR || errno == EAGAIN) {
+			return 0;
+		}
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+	if (nread == 0) {
+		/* a partial record left means the helper died, the
+		   exit status will tell */
+		close(h->fd);
+		h->fd = -1;
+		h->in.len = 0;
+		return 0;
+	}
+	h->in.len += nread;
+
+	p = h->in.buf;
+	left = h->in.len;
+
+	while (left >= 2 * sizeof(uint32_t)) {
+		uint32_t lens[2];
+		TDB_DATA key, data;
+		size_t full_len;
+
+		memcpy(lens, p, sizeof(lens));
+		full_len = sizeof(lens) + (size_t)lens[0] + lens[1];
+		if (left < full_len) {
+			break;
+		}
+
+		key = (TDB_DATA) { .dptr = p + sizeof(lens),
+				   .dsize = lens[0] };
+		data = (TDB_DATA) { .dptr = key.dptr + key.dsize,
+				    .dsize = lens[1] };
+
+		p += full_len;
+		left -= full_len;
+
+		*count += 1;
+		if (fn && fn(tdb, key, data, private_data)) {
+			return 1;
+		}
+	}
+
+	memmove(h->in.buf, p, left);
+	h->in.len = left;
+
+	return 0;
+}
+
+_PUBLIC_ int tdb_traverse_read_parallel(struct tdb_context *tdb,
+					unsigned num_ranges,
+					tdb_traverse_func fn,
+					void *private_data)
+{
+	struct tdb_parallel_helper *helpers = NULL;
+	struct pollfd *pfds = NULL;
+	unsigned i, num_helpers = 0;
+	int count = 0;
+	int ret = 0;
+
+	if (num_ranges == 0) {
+		long ncpus = -1;
+#ifdef _SC_NPROCESSORS_ONLN
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		num_ranges = (ncpus > 0) ? ncpus : 1;
+	}
+	num_ranges = MIN(num_ranges, TDB_PARALLEL_MAX_HELPERS);
+	num_ranges = MIN(num_ranges, tdb->hash_size);
+
+	/*
+	 * The helpers could not see our transaction, and they don't
+	 * inherit our locks: Walk the database ourselves then.
+	 */
+	if ((num_ranges < 2) ||
+	    (tdb->flags & TDB_INTERNAL) ||
+	    (tdb->transaction != NULL) ||
+	    (tdb->traverse_read != 0) ||
+	    (tdb->traverse_write != 0) ||
+	    tdb_have_extra_locks(tdb)) {
+		return tdb_traverse_read(tdb, fn, private_data);
+	}
+
+	helpers = calloc(num_ranges, sizeof(*helpers));
+	pfds = calloc(num_ranges, sizeof(*pfds));
+	if ((helpers == NULL) || (pfds == NULL)) {
+		tdb->ecode = TDB_ERR_OOM;
+		ret = -1;
+		goto done;
+	}
+
+	tdb_trace(tdb, "tdb_traverse_read_parallel_start");
+
+	for (i = 0; i < num_ranges; i++) {
+		uint32_t start = (uint64_t)tdb->hash_size * i / num_ranges;
+		uint32_t end = (uint64_t)tdb->hash_size * (i+1) / num_ranges;
+		int fds[2];
+		pid_t pid;
+
+		if (pipe(fds) == -1) {
+			tdb->ecode = TDB_ERR_IO;
+			ret = -1;
+			goto done;
+		}
+
+		pid = fork();
+		if (pid == -1) {
+			close(fds[0]);
+			close(fds[1]);
+			tdb->ecode = TDB_ERR_IO;
+			ret = -1;
+			goto done;
+		}
+
+		if (pid == 0) {
+			unsigned j;
+
+			close(fds[0]);
+			for (j = 0; j < num_helpers; j++) {
+				close(helpers[j].fd);
+			}
+			ret = tdb_parallel_range(tdb, fds[1], start, end);
+			_exit((ret == 0) ? 0 : 1);
+		}
+
+		close(fds[1]);
+		helpers[num_helpers].pid = pid;
+		helpers[num_helpers].fd = fds[0];
+		num_helpers += 1;
+	}
+
+	while (ret == 0) {
+		nfds_t nfds = 0;
+		int nready;
+
+		for (i = 0; i < num_helpers; i++) {
+			if (helpers[i].fd == -1) {
+				continue;
+			}
+			pfds[nfds] = (struct pollfd) {
+				.fd = helpers[i].fd, .events = POLLIN,
+			};
+			nfds += 1;
+		}
+		if (nfds == 0) {
+			break;
+		}
+
+		nready = poll(pfds, nfds, -1);
+		if (nready == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			tdb->ecode = TDB_ERR_IO;
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; (i < num_helpers) && (ret == 0); i++) {
+			nfds_t j;
+
+			for (j = 0; j < nfds; j++) {
+				if (pfds[j].fd == helpers[i].fd) {
+					break;
+				}
+			}
+			if ((j == nfds) || (pfds[j].revents == 0)) {
+				continue;
+			}
+			ret = tdb_parallel_receive(tdb, &helpers[i], fn,
+						   private_data, &count);
+		}
+	}
+
+done:
+	for (i = 0; i < num_helpers; i++) {
+		int status = 0;
+		pid_t pid;
+
+		if (helpers[i].fd != -1) {
+			close(helpers[i].fd);
+		}
+		if (ret != 0) {
+			/* we stop early, don't wait for the rest */
+			kill(helpers[i].pid, SIGKILL);
+		}
+		do {
+			pid = waitpid(helpers[i].pid, &status, 0);
+		} while ((pid == -1) && (errno == EINTR));
+
+		if ((ret == 0) &&
+		    ((pid == -1) || !WIFEXITED(status) ||
+		     (WEXITSTATUS(status) != 0))) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR,
+				 "tdb_traverse_read_parallel: helper for "
+				 "range %u failed\n", i));
+			tdb->ecode = TDB_ERR_IO;
+			ret = -1;
+		}
+		free(helpers[i].in.buf);
+	}
+	free(helpers);
+	free(pfds);
+
+	if (ret == -1) {
+		return -1;
+	}
+	tdb_trace_ret(tdb, "tdb_traverse_read_parallel_end", count);
+	return count;
+}
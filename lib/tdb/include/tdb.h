@@ -97,6 +97,14 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_GROW_HASH 8192 /** grow hash chains online when they get long,
+                               only with tdb >= 1.4.16 */
+#define TDB_FREELIST_CLASSES 16384 /** separate free lists by record size,
+                                      only with tdb >= 1.4.16 */
+#define TDB_OPTIMISTIC_READS 32768 /** fetch without locking if possible,
+                                      only with TDB_MUTEX_LOCKING and tdb >= 1.4.16 */
+#define TDB_GROUP_COMMIT 65536 /** share fsyncs between transaction commits,
+                                  only with tdb >= 1.4.16 */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -165,6 +173,18 @@ struct tdb_logging_context {
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_GROW_HASH - Split long hash chains while the database is in use,
+ *                                         can't be opened by tdb < 1.4.16.\n
+ *                         TDB_FREELIST_CLASSES - Keep free records on separate lists by size,
+ *                                                each with its own lock,
+ *                                                can't be opened by tdb < 1.4.16.\n
+ *                         TDB_OPTIMISTIC_READS - With TDB_MUTEX_LOCKING let tdb_fetch() and
+ *                                                tdb_parse_record() read without the chain
+ *                                                lock and retry if a writer interfered,
+ *                                                can't be opened by tdb < 1.4.16.\n
+ *                         TDB_GROUP_COMMIT - Let transaction commits share fsyncs with
+ *                                            the commits before and after them,
+ *                                            can't be opened by tdb < 1.4.16.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -206,6 +226,18 @@ _PUBLIC_ struct tdb_context *tdb_open(const char *name, int hash_size, int tdb_f
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_GROW_HASH - Split long hash chains while the database is in use,
+ *                                         can't be opened by tdb < 1.4.16.\n
+ *                         TDB_FREELIST_CLASSES - Keep free records on separate lists by size,
+ *                                                each with its own lock,
+ *                                                can't be opened by tdb < 1.4.16.\n
+ *                         TDB_OPTIMISTIC_READS - With TDB_MUTEX_LOCKING let tdb_fetch() and
+ *                                                tdb_parse_record() read without the chain
+ *                                                lock and retry if a writer interfered,
+ *                                                can't be opened by tdb < 1.4.16.\n
+ *                         TDB_GROUP_COMMIT - Let transaction commits share fsyncs with
+ *                                            the commits before and after them,
+ *                                            can't be opened by tdb < 1.4.16.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -320,6 +352,9 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key);
  * call other tdb routines from within the parser. Also, for good performance
  * you should make the parser fast to allow parallel operations.
  *
+ * With TDB_OPTIMISTIC_READS small records may be looked up without the
+ * lock, the parser then gets a copy of the record.
+ *
  * @param[in]  tdb      The tdb to parse the record.
  *
  * @param[in]  key      The key to parse.
@@ -493,6 +528,36 @@ _PUBLIC_ int tdb_traverse(struct tdb_context *tdb, tdb_traverse_func fn, void *p
  */
 _PUBLIC_ int tdb_traverse_read(struct tdb_context *tdb, tdb_traverse_func fn, void *private_data);
 
+/**
+ * @brief Traverse the entire database using helper processes.
+ *
+ * This is like tdb_traverse_read(), but the hash chains are split into
+ * num_ranges ranges, and a forked helper process walks each range with
+ * its own read locks. The records are handed to fn(tdb, key, data, state)
+ * in the calling process as they arrive from the helpers, so records of
+ * different ranges come in no particular order. No lock is held while fn
+ * is called.
+ *
+ * Within a transaction, with locks held or if num_ranges is 1 this just
+ * calls tdb_traverse_read().
+ *
+ * @param[in]  tdb      The database to traverse.
+ *
+ * @param[in]  num_ranges The number of ranges to walk in parallel, 0 for
+ *                        one per online CPU.
+ *
+ * @param[in]  fn       The function to call on each entry.
+ *
+ * @param[in]  private_data The private data which should be passed to the
+ *                          traversing function.
+ *
+ * @return              The record count traversed, -1 on error.
+ */
+_PUBLIC_ int tdb_traverse_read_parallel(struct tdb_context *tdb,
+					unsigned num_ranges,
+					tdb_traverse_func fn,
+					void *private_data);
+
 /**
  * @brief Traverse a single hash chain
  *
@@ -0,0 +1,163 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/freelistcheck.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 1000
+
+static bool store_range(struct tdb_context *tdb, uint32_t start, uint32_t end)
+{
+	static unsigned char buf[20000];
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data = { buf, 0 };
+
+	for (j = start; j < end; j++) {
+		/* Spread the records over all size classes */
+		data.dsize = (j * 97) % sizeof(buf);
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool delete_range(struct tdb_context *tdb, uint32_t start,
+			 uint32_t end, uint32_t step)
+{
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+
+	for (j = start; j < end; j += step) {
+		if (tdb_delete(tdb, key) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Every free record must be on a class list of its size or of a
+ * smaller size, with the class in full_hash. Returns the number of
+ * non-empty lists or -1.
+ */
+static int check_classes(struct tdb_context *tdb)
+{
+	tdb_off_t ptr;
+	struct tdb_record rec;
+	uint32_t c;
+	int used = 0;
+
+	if (tdb_ofs_read(tdb, FREELIST_TOP, &ptr) == -1 || ptr != 0) {
+		return -1;
+	}
+
+	for (c = 0; c < TDB_FREE_CLASSES; c++) {
+		if (tdb_ofs_read(tdb, TDB_FREE_CLASS_TOP(c), &ptr) == -1) {
+			return -1;
+		}
+		if (ptr != 0) {
+			used += 1;
+		}
+		while (ptr != 0) {
+			if (tdb_rec_free_read(tdb, ptr, &rec) == -1) {
+				return -1;
+			}
+			if (rec.full_hash != c ||
+			    tdb_free_class(rec.rec_len) < c) {
+				return -1;
+			}
+			ptr = rec.next;
+		}
+	}
+	return used;
+}
+
+static bool check_db(struct tdb_context *tdb)
+{
+	int num;
+
+	if (tdb_validate_freelist(tdb, &num) != 0) {
+		return false;
+	}
+	if (tdb->flags & TDB_INTERNAL) {
+		return true;
+	}
+	return tdb_check(tdb, NULL, NULL) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	struct tdb_context *tdb;
+	int flags[] = { TDB_INTERNAL, TDB_DEFAULT, TDB_NOMMAP,
+			TDB_INTERNAL|TDB_CONVERT, TDB_CONVERT,
+			TDB_NOMMAP|TDB_CONVERT };
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 19 + 3);
+
+	ok1(tdb_free_class(0) == 0);
+	ok1(tdb_free_class(128) == 1);
+	ok1(tdb_free_class(0xffffffff) == TDB_FREE_CLASSES-1);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		tdb = tdb_open_ex("run-freelist-classes.tdb", 131,
+				  flags[i]|TDB_FREELIST_CLASSES,
+				  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx,
+				  NULL);
+		ok1(tdb);
+		if (!tdb)
+			continue;
+
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_FREE_CLASSES);
+		ok1(store_range(tdb, 0, NUM_RECORDS));
+		ok1(check_db(tdb));
+
+		/* Leave holes of all sizes behind */
+		ok1(delete_range(tdb, 0, NUM_RECORDS, 2));
+		ok1(check_classes(tdb) > 1);
+		ok1(check_db(tdb));
+
+		/* Store them all again, reusing and splitting the holes */
+		ok1(store_range(tdb, 0, NUM_RECORDS));
+		ok1(check_classes(tdb) > 0);
+		ok1(check_db(tdb));
+
+		/* Neighbouring free records on any lists get merged */
+		ok1(delete_range(tdb, 0, NUM_RECORDS, 1));
+		ok1(tdb_freelist_size(tdb) > 0);
+		ok1(check_classes(tdb) > 0);
+		ok1(check_db(tdb));
+
+		/* Records freed in a cancelled transaction come back */
+		if (flags[i] & TDB_INTERNAL) {
+			skip(2, "no transactions on internal databases");
+		} else {
+			ok1(tdb_transaction_start(tdb) == 0);
+			ok1(store_range(tdb, 0, NUM_RECORDS) &&
+			    tdb_transaction_cancel(tdb) == 0);
+		}
+		ok1(check_db(tdb));
+
+		/* Wiping leaves everything on the class lists */
+		ok1(tdb_wipe_all(tdb) == 0);
+		ok1(check_classes(tdb) > 0);
+		ok1(check_db(tdb));
+
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
@@ -0,0 +1,184 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define TEST_DB "run-group-commit.tdb"
+
+static uint32_t recovery_magic(struct tdb_context *tdb)
+{
+	tdb_off_t off;
+	struct tdb_record rec;
+
+	if (tdb_recovery_area(tdb, tdb->methods, &off, &rec) == -1 ||
+	    off == 0) {
+		return 0;
+	}
+	return rec.magic;
+}
+
+static uint32_t group_counter(struct tdb_context *tdb, tdb_off_t ofs)
+{
+	tdb_off_t v;
+
+	if (tdb_ofs_read(tdb, ofs, &v) == -1) {
+		return 0xffffffff;
+	}
+	return v;
+}
+
+static bool commit_store(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data)
+{
+	return tdb_transaction_start(tdb) == 0 &&
+		tdb_store(tdb, key, data, TDB_REPLACE) == 0 &&
+		tdb_transaction_commit(tdb) == 0;
+}
+
+static bool has_value(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data)
+{
+	TDB_DATA d = tdb_fetch(tdb, key);
+	bool ret;
+
+	ret = (d.dsize == data.dsize) &&
+		(memcmp(d.dptr, data.dptr, d.dsize) == 0);
+	free(d.dptr);
+	return ret;
+}
+
+static struct tdb_context *reopen(struct tdb_context *tdb, int tdb_flags)
+{
+	tdb_close(tdb);
+	return tdb_open_ex(TEST_DB, 7, tdb_flags, O_RDWR, 0600,
+			   &taplogctx, NULL);
+}
+
+/* Die after the recovery record is written, before the data is */
+static int do_child(int tdb_flags, TDB_DATA key, TDB_DATA data)
+{
+	struct tdb_context *tdb;
+
+	tdb = tdb_open_ex(TEST_DB, 7, tdb_flags, O_RDWR, 0600,
+			  &taplogctx, NULL);
+	if (tdb == NULL ||
+	    tdb_transaction_start(tdb) != 0 ||
+	    tdb_store(tdb, key, data, TDB_REPLACE) != 0 ||
+	    tdb_transaction_prepare_commit(tdb) != 0) {
+		return 1;
+	}
+	if (recovery_magic(tdb) != TDB_RECOVERY_GROUP_MAGIC) {
+		return 1;
+	}
+	_exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	TDB_DATA key1 = { discard_const_p(uint8_t, "key1"), 4 };
+	TDB_DATA key2 = { discard_const_p(uint8_t, "key2"), 4 };
+	TDB_DATA data1 = { discard_const_p(uint8_t, "data1"), 5 };
+	TDB_DATA data2 = { discard_const_p(uint8_t, "data2"), 5 };
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT };
+	unsigned int i;
+	int tdb_flags, status;
+	tdb_off_t off;
+	pid_t child;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 25 + 5);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		struct tdb_record rec;
+		uint32_t v;
+
+		tdb_flags = flags[i]|TDB_GROUP_COMMIT;
+
+		tdb = tdb_open_ex(TEST_DB, 7, tdb_flags,
+				  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx,
+				  NULL);
+		ok1(tdb);
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_GROUP_COMMIT);
+
+		/* Commits stay pending, and are synced by themselves */
+		ok1(commit_store(tdb, key1, data1));
+		ok1(recovery_magic(tdb) == TDB_RECOVERY_PENDING_MAGIC);
+		ok1(group_counter(tdb, TDB_GROUP_COMMITTED_OFS) == 1);
+		ok1(group_counter(tdb, TDB_GROUP_SYNCED_OFS) == 1);
+
+		/* Writers outside transactions retire them */
+		ok1(tdb_store(tdb, key2, data1, TDB_INSERT) == 0);
+		ok1(recovery_magic(tdb) == TDB_RECOVERY_INVALID_MAGIC);
+		ok1(tdb_delete(tdb, key2) == 0);
+
+		/* A complete commit is kept after a crash */
+		ok1(commit_store(tdb, key2, data2));
+		ok1(group_counter(tdb, TDB_GROUP_COMMITTED_OFS) == 2);
+		tdb = reopen(tdb, tdb_flags);
+		ok1(tdb);
+		ok1(recovery_magic(tdb) == TDB_RECOVERY_INVALID_MAGIC);
+		ok1(has_value(tdb, key2, data2));
+		ok1(tdb_delete(tdb, key2) == 0);
+
+		/* If the crash lost some of the data, all of it is undone */
+		ok1(commit_store(tdb, key2, data2));
+		off = 0;
+		v = tdb->hash_fn(&key2);
+		ok1(tdb->methods->tdb_write(tdb, TDB_HASH_TOP(v), &off,
+					    sizeof(off)) == 0);
+		tdb = reopen(tdb, tdb_flags);
+		ok1(tdb);
+		ok1(tdb_exists(tdb, key2) == 0 && has_value(tdb, key1, data1));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		/* A torn record did not touch the data */
+		ok1(commit_store(tdb, key1, data2));
+		ok1(tdb_recovery_area(tdb, tdb->methods, &off, &rec) == 0);
+		v = rec.full_hash + 1;
+		CONVERT(v);
+		ok1(tdb->methods->tdb_write(tdb, off + offsetof(struct tdb_record,
+								 full_hash),
+					    &v, sizeof(v)) == 0);
+		tdb = reopen(tdb, tdb_flags);
+		ok1(tdb && has_value(tdb, key1, data2) &&
+		    recovery_magic(tdb) == TDB_RECOVERY_INVALID_MAGIC);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		tdb_close(tdb);
+	}
+
+	/* A committer dying before writing the data is undone */
+	tdb_flags = TDB_DEFAULT|TDB_GROUP_COMMIT;
+	tdb = tdb_open_ex(TEST_DB, 7, tdb_flags, O_RDWR|O_CREAT|O_TRUNC,
+			  0600, &taplogctx, NULL);
+	ok1(tdb && commit_store(tdb, key1, data1));
+	tdb_close(tdb);
+
+	child = fork();
+	if (child == 0) {
+		return do_child(tdb_flags, key1, data2);
+	}
+	ok1(waitpid(child, &status, 0) == child &&
+	    WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	tdb = tdb_open_ex(TEST_DB, 7, tdb_flags, O_RDWR, 0600,
+			  &taplogctx, NULL);
+	ok1(tdb);
+	ok1(has_value(tdb, key1, data1) &&
+	    recovery_magic(tdb) == TDB_RECOVERY_INVALID_MAGIC);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,208 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 1000
+
+static uint32_t num_lists(struct tdb_context *tdb)
+{
+	tdb_off_t first;
+	uint32_t num;
+
+	if (tdb_hash_heads(tdb, 0, &first, &num) == -1) {
+		return 0;
+	}
+	return num;
+}
+
+/* Internal databases don't have a header tdb_check() accepts */
+static bool check_db(struct tdb_context *tdb)
+{
+	if (tdb->flags & TDB_INTERNAL) {
+		return true;
+	}
+	return tdb_check(tdb, NULL, NULL) == 0;
+}
+
+static bool store_range(struct tdb_context *tdb, uint32_t start, uint32_t end)
+{
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+
+	for (j = start; j < end; j++) {
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool fetch_range(struct tdb_context *tdb, uint32_t start, uint32_t end)
+{
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+
+	for (j = start; j < end; j++) {
+		TDB_DATA data = tdb_fetch(tdb, key);
+		bool ok;
+
+		ok = (data.dsize == sizeof(j)) &&
+			(memcmp(data.dptr, &j, sizeof(j)) == 0);
+		free(data.dptr);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int count_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		    void *private_data)
+{
+	unsigned *count = private_data;
+	(*count)++;
+	return 0;
+}
+
+static int delete_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		     void *private_data)
+{
+	unsigned *count = private_data;
+	(*count)++;
+	return tdb_delete(tdb, key);
+}
+
+/*
+ * Walk with tdb_firstkey/tdb_nextkey, adding records to the only
+ * hash chain while doing so: None of the original records must be
+ * missed or seen twice.
+ */
+static bool traverse_while_storing(struct tdb_context *tdb)
+{
+	bool seen[2*NUM_RECORDS] = { false };
+	uint32_t lists = num_lists(tdb);
+	TDB_DATA key, next;
+	uint32_t j;
+	bool ok = true;
+
+	key = tdb_firstkey(tdb);
+	if (key.dptr == NULL) {
+		return false;
+	}
+
+	if (!store_range(tdb, NUM_RECORDS, 2*NUM_RECORDS)) {
+		free(key.dptr);
+		return false;
+	}
+
+	/* The traversal's record lock must have prevented splitting */
+	if (num_lists(tdb) != lists) {
+		ok = false;
+	}
+
+	while (key.dptr != NULL) {
+		memcpy(&j, key.dptr, sizeof(j));
+		if (j >= 2*NUM_RECORDS || seen[j]) {
+			ok = false;
+		} else {
+			seen[j] = true;
+		}
+		next = tdb_nextkey(tdb, key);
+		free(key.dptr);
+		key = next;
+	}
+
+	for (j = 0; j < NUM_RECORDS; j++) {
+		if (!seen[j]) {
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, count;
+	struct tdb_context *tdb;
+	uint32_t lists;
+	int flags[] = { TDB_INTERNAL, TDB_DEFAULT, TDB_NOMMAP,
+			TDB_INTERNAL|TDB_CONVERT, TDB_CONVERT,
+			TDB_NOMMAP|TDB_CONVERT };
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 22 + 3);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		/* One hash chain, all records end up in it */
+		tdb = tdb_open_ex("run-grow-hash.tdb", 1,
+				  flags[i]|TDB_GROW_HASH,
+				  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx,
+				  NULL);
+		ok1(tdb);
+		if (!tdb)
+			continue;
+
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_HASH_GROWTH);
+		ok1(store_range(tdb, 0, NUM_RECORDS));
+		lists = num_lists(tdb);
+		ok1(lists >= NUM_RECORDS / TDB_HASH_SPLIT_CHAIN / 4);
+		ok1(check_db(tdb));
+		ok1(fetch_range(tdb, 0, NUM_RECORDS));
+
+		count = 0;
+		ok1(tdb_traverse(tdb, count_fn, &count) == NUM_RECORDS);
+		ok1(count == NUM_RECORDS);
+
+		count = 0;
+		ok1(tdb_traverse_chain(tdb, 0, count_fn, &count)
+		    == NUM_RECORDS);
+
+		ok1(traverse_while_storing(tdb));
+		ok1(fetch_range(tdb, 0, 2*NUM_RECORDS));
+
+		/* Now that the traversal is done we can grow again */
+		ok1(store_range(tdb, 2*NUM_RECORDS, 3*NUM_RECORDS));
+		ok1(num_lists(tdb) > lists);
+		ok1(check_db(tdb));
+
+		/* Records added in a cancelled transaction go away */
+		if (flags[i] & TDB_INTERNAL) {
+			skip(4, "no transactions on internal databases");
+		} else {
+			ok1(tdb_transaction_start(tdb) == 0);
+			ok1(store_range(tdb, 4*NUM_RECORDS, 5*NUM_RECORDS));
+			ok1(tdb_transaction_cancel(tdb) == 0);
+			ok1(check_db(tdb));
+		}
+
+		/* Deleting while traversing marks the records dead */
+		count = 0;
+		ok1(tdb_traverse(tdb, delete_fn, &count) == 3*NUM_RECORDS);
+		ok1(count == 3*NUM_RECORDS);
+		ok1(tdb_traverse(tdb, count_fn, &count) == 0);
+		ok1(check_db(tdb));
+
+		tdb_close(tdb);
+	}
+
+	/* Without TDB_GROW_HASH nothing changes */
+	tdb = tdb_open_ex("run-grow-hash.tdb", 1, TDB_DEFAULT,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(store_range(tdb, 0, NUM_RECORDS));
+	ok1(num_lists(tdb) == 1);
+	tdb_close(tdb);
+
+	return exit_status();
+}
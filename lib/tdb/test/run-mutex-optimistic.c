@@ -0,0 +1,217 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define NUM_RECORDS 100
+#define NUM_UPDATES 20000
+
+/* The data is a run of one byte, its length depends on the byte */
+static void make_data(uint8_t *buf, uint8_t v, TDB_DATA *data)
+{
+	data->dptr = buf;
+	data->dsize = 16 + (v % 64) * 8;
+	memset(buf, v, data->dsize);
+}
+
+static bool data_ok(TDB_DATA data)
+{
+	size_t i;
+
+	if ((data.dptr == NULL) || (data.dsize < 16) ||
+	    (data.dsize != 16 + (data.dptr[0] % 64) * 8)) {
+		return false;
+	}
+	for (i = 1; i < data.dsize; i++) {
+		if (data.dptr[i] != data.dptr[0]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int parse_fn(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	bool *ok = private_data;
+	*ok = data_ok(data);
+	return 0;
+}
+
+/* Overwrite and delete records with other sizes while the parent reads */
+static int do_child(int tdb_flags, int from)
+{
+	struct tdb_context *tdb;
+	uint8_t buf[1024];
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data;
+	unsigned i;
+	char c;
+
+	if (read(from, &c, sizeof(c)) != sizeof(c)) {
+		return 1;
+	}
+
+	tdb = tdb_open_ex("run-mutex-optimistic.tdb", 7, tdb_flags,
+			  O_RDWR|O_CREAT, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 1;
+	}
+
+	for (i = 0; i < NUM_UPDATES; i++) {
+		j = random() % NUM_RECORDS;
+		if (i % 10 == 0) {
+			tdb_delete(tdb, key);
+			continue;
+		}
+		make_data(buf, random(), &data);
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return 1;
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+static bool gens_even(struct tdb_context *tdb)
+{
+	uint32_t i;
+
+	for (i = 0; i < tdb->hash_size + 1; i++) {
+		if (*tdb_mutex_gen(tdb, i) & 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	uint8_t buf[1024], small[256];
+	uint32_t j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data;
+	int tdb_flags, ret, status;
+	bool ok, all_ok;
+	pid_t child;
+	int tochild[2];
+	char c = 0;
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		skip(1, "No robust mutex support");
+		return exit_status();
+	}
+	if (!TDB_SUPPORTED_SEQLOCK) {
+		skip(1, "No atomics for optimistic reads");
+		return exit_status();
+	}
+
+	plan_tests(19);
+
+	tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_MUTEX_LOCKING|
+		TDB_CLEAR_IF_FIRST|TDB_OPTIMISTIC_READS;
+
+	/* The child has to open the database itself, after us */
+	ok1(pipe(tochild) == 0);
+	child = fork();
+	if (child == 0) {
+		close(tochild[1]);
+		return do_child(tdb_flags, tochild[0]);
+	}
+	close(tochild[0]);
+
+	tdb = tdb_open_ex("run-mutex-optimistic.tdb", 7, tdb_flags,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK);
+
+	all_ok = true;
+	for (j = 0; j < NUM_RECORDS; j++) {
+		make_data(buf, j, &data);
+		if (tdb_store(tdb, key, data, TDB_INSERT) != 0) {
+			all_ok = false;
+		}
+	}
+	ok1(all_ok);
+	ok1(gens_even(tdb));
+
+	/* Small records are found without taking the chain lock */
+	j = 1;
+	ok1(tdb_mutex_fetch(tdb, key, tdb->hash_fn(&key), small,
+			    sizeof(small), &data, &ret));
+	ok1(ret == 0 && data.dptr == small && data_ok(data));
+
+	all_ok = true;
+	for (j = 0; j < NUM_RECORDS; j++) {
+		data = tdb_fetch(tdb, key);
+		all_ok &= data_ok(data) && (data.dptr[0] == j);
+		free(data.dptr);
+		ok = false;
+		all_ok &= (tdb_parse_record(tdb, key, parse_fn, &ok) == 0);
+		all_ok &= ok;
+	}
+	ok1(all_ok);
+
+	j = NUM_RECORDS;
+	data = tdb_fetch(tdb, key);
+	ok1(data.dptr == NULL && tdb_error(tdb) == TDB_ERR_NOEXIST);
+	ok1(tdb_parse_record(tdb, key, parse_fn, &ok) == -1);
+
+	/* Records that don't fit the buffer are left to the locked path */
+	j = 63;
+	ok1(!tdb_mutex_fetch(tdb, key, tdb->hash_fn(&key), small,
+			     sizeof(small), &data, &ret));
+	ok = false;
+	ok1(tdb_parse_record(tdb, key, parse_fn, &ok) == 0 && ok);
+
+	/* Nothing can be trusted while the chain is locked */
+	j = 1;
+	ok1(tdb_chainlock(tdb, key) == 0);
+	ok1(!tdb_mutex_fetch(tdb, key, tdb->hash_fn(&key), small,
+			     sizeof(small), &data, &ret));
+	tdb_chainunlock(tdb, key);
+
+	/* Readers must never see a half written record */
+	ok1(write(tochild[1], &c, sizeof(c)) == sizeof(c));
+
+	all_ok = true;
+	while (waitpid(child, &status, WNOHANG) == 0) {
+		j = random() % NUM_RECORDS;
+		data = tdb_fetch(tdb, key);
+		if (data.dptr == NULL) {
+			all_ok &= (tdb_error(tdb) == TDB_ERR_NOEXIST);
+			continue;
+		}
+		all_ok &= data_ok(data);
+		free(data.dptr);
+
+		ok = true;
+		if (tdb_parse_record(tdb, key, parse_fn, &ok) == -1) {
+			all_ok &= (tdb_error(tdb) == TDB_ERR_NOEXIST);
+		}
+		all_ok &= ok;
+	}
+	ok1(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ok1(all_ok);
+	ok1(gens_even(tdb));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
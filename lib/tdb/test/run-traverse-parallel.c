@@ -0,0 +1,153 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 2000
+
+struct seen {
+	uint8_t count[NUM_RECORDS + 1];
+	bool data_ok;
+	unsigned stop_after;
+	unsigned calls;
+};
+
+static int seen_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		   void *private_data)
+{
+	struct seen *seen = private_data;
+	uint32_t j;
+
+	seen->calls += 1;
+
+	if (key.dsize != sizeof(j)) {
+		seen->data_ok = false;
+		return 0;
+	}
+	memcpy(&j, key.dptr, sizeof(j));
+	if (j > NUM_RECORDS) {
+		seen->data_ok = false;
+		return 0;
+	}
+	seen->count[j] += 1;
+
+	/* The data is the key repeated j % 100 times */
+	if (data.dsize != (j % 100) * sizeof(j)) {
+		seen->data_ok = false;
+	} else {
+		size_t i;
+		for (i = 0; i < data.dsize; i += sizeof(j)) {
+			if (memcmp(data.dptr + i, &j, sizeof(j)) != 0) {
+				seen->data_ok = false;
+			}
+		}
+	}
+
+	return (seen->stop_after != 0) && (seen->calls == seen->stop_after);
+}
+
+static bool store_one(struct tdb_context *tdb, uint32_t j)
+{
+	uint32_t buf[100];
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data = { (unsigned char *)buf, (j % 100) * sizeof(j) };
+	unsigned i;
+
+	for (i = 0; i < j % 100; i++) {
+		buf[i] = j;
+	}
+	return tdb_store(tdb, key, data, TDB_INSERT) == 0;
+}
+
+/* Every record exactly once */
+static bool all_seen_once(const struct seen *seen, uint32_t num)
+{
+	uint32_t j;
+
+	for (j = 0; j <= NUM_RECORDS; j++) {
+		if (seen->count[j] != (j < num ? 1 : 0)) {
+			return false;
+		}
+	}
+	return seen->data_ok;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	struct tdb_context *tdb;
+	struct seen seen;
+	uint32_t j;
+	bool ok;
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT, TDB_INTERNAL,
+			TDB_GROW_HASH };
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 10);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		tdb = tdb_open_ex("run-traverse-parallel.tdb", 97, flags[i],
+				  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx,
+				  NULL);
+		ok1(tdb);
+		if (!tdb) {
+			skip(9, "open failed");
+			continue;
+		}
+
+		ok = true;
+		for (j = 0; j < NUM_RECORDS; j++) {
+			ok &= store_one(tdb, j);
+		}
+		ok1(ok);
+
+		/* More ranges than CPUs, fewer than chains */
+		seen = (struct seen) { .data_ok = true };
+		ok1(tdb_traverse_read_parallel(tdb, 8, seen_fn, &seen)
+		    == NUM_RECORDS);
+		ok1(all_seen_once(&seen, NUM_RECORDS));
+
+		/* More ranges than chains, and one per CPU */
+		seen = (struct seen) { .data_ok = true };
+		ok1(tdb_traverse_read_parallel(tdb, 1000, seen_fn, &seen)
+		    == NUM_RECORDS);
+		seen = (struct seen) { .data_ok = true };
+		ok1(tdb_traverse_read_parallel(tdb, 0, seen_fn, &seen)
+		    == NUM_RECORDS && all_seen_once(&seen, NUM_RECORDS));
+
+		/* Stopping early */
+		seen = (struct seen) { .data_ok = true, .stop_after = 10 };
+		ok1(tdb_traverse_read_parallel(tdb, 4, seen_fn, &seen) == 10);
+		ok1(seen.calls == 10);
+
+		/* A transaction's changes are seen */
+		if (flags[i] & TDB_INTERNAL) {
+			skip(1, "no transactions on internal databases");
+		} else {
+			ok = tdb_transaction_start(tdb) == 0 &&
+				store_one(tdb, NUM_RECORDS);
+			seen = (struct seen) { .data_ok = true };
+			ok1(ok && tdb_traverse_read_parallel(
+				    tdb, 4, seen_fn, &seen) == NUM_RECORDS + 1 &&
+			    all_seen_once(&seen, NUM_RECORDS + 1));
+			tdb_transaction_cancel(tdb);
+		}
+
+		/* Nothing is left locked */
+		ok1(tdb_lockall(tdb) == 0 && tdb_unlockall(tdb) == 0);
+
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
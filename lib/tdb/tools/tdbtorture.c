@@ -34,6 +34,11 @@ static int hash_size = 2;
 static unsigned loopnum;
 static int count_pipe;
 static bool mutex = false;
+static bool grow_hash = false;
+static bool free_classes = false;
+static bool optimistic = false;
+static bool group_commit = false;
+static bool parallel_traverse = false;
 static struct tdb_logging_context log_ctx;
 
 #ifdef PRINTF_ATTRIBUTE
@@ -82,6 +87,14 @@ static char *randbuf(int len)
 	return buf;
 }
 
+static int traverse_read(struct tdb_context *tdb)
+{
+	if (parallel_traverse) {
+		return tdb_traverse_read_parallel(tdb, 4, NULL, NULL);
+	}
+	return tdb_traverse_read(tdb, NULL, NULL);
+}
+
 static int cull_traverse(struct tdb_context *tdb, TDB_DATA key, TDB_DATA dbuf,
 			 void *state)
 {
@@ -206,7 +219,7 @@ static void addrec_db(void)
 
 #if TRAVERSE_READ_PROB
 	if (random() % TRAVERSE_READ_PROB == 0) {
-		tdb_traverse_read(db, NULL, NULL);
+		traverse_read(db);
 		goto next;
 	}
 #endif
@@ -228,7 +241,7 @@ static int traverse_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA dbuf,
 
 static void usage(void)
 {
-	printf("Usage: tdbtorture [-t] [-k] [-m] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
+	printf("Usage: tdbtorture [-t] [-k] [-m] [-g] [-f] [-o] [-c] [-p] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
 	exit(0);
 }
 
@@ -251,6 +264,18 @@ static int run_child(const char *filename, int i, int seed, unsigned num_loops,
 	if (mutex) {
 		tdb_flags |= TDB_MUTEX_LOCKING;
 	}
+	if (grow_hash) {
+		tdb_flags |= TDB_GROW_HASH;
+	}
+	if (free_classes) {
+		tdb_flags |= TDB_FREELIST_CLASSES;
+	}
+	if (optimistic) {
+		tdb_flags |= TDB_OPTIMISTIC_READS;
+	}
+	if (group_commit) {
+		tdb_flags |= TDB_GROUP_COMMIT;
+	}
 
 	db = tdb_open_ex(filename, hash_size, tdb_flags,
 			 O_RDWR | O_CREAT, 0600, &log_ctx, NULL);
@@ -270,7 +295,7 @@ static int run_child(const char *filename, int i, int seed, unsigned num_loops,
 	}
 
 	if (error_count == 0) {
-		tdb_traverse_read(db, NULL, NULL);
+		traverse_read(db);
 		if (always_transaction) {
 			while (in_transaction) {
 				tdb_transaction_cancel(db);
@@ -324,7 +349,7 @@ int main(int argc, char * const *argv)
 
 	log_ctx.log_fn = tdb_log;
 
-	while ((c = getopt(argc, argv, "n:l:s:H:thkm")) != -1) {
+	while ((c = getopt(argc, argv, "n:l:s:H:thkmgfocp")) != -1) {
 		switch (c) {
 		case 'n':
 			num_procs = strtoul(optarg, NULL, 0);
@@ -351,6 +376,21 @@ int main(int argc, char * const *argv)
 				exit(1);
 			}
 			break;
+		case 'g':
+			grow_hash = true;
+			break;
+		case 'f':
+			free_classes = true;
+			break;
+		case 'o':
+			optimistic = true;
+			break;
+		case 'c':
+			group_commit = true;
+			break;
+		case 'p':
+			parallel_traverse = true;
+			break;
 		default:
 			usage();
 		}
@@ -0,0 +1,684 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB 3.1.1 compression transform
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include <talloc.h>
+#include "lib/util/debug.h"
+#include "lib/util/samba_util.h"
+#include "lib/util/iov_buf.h"
+#include "lib/util/bytearray.h"
+#include "libcli/smb/smb_constants.h"
+#include "libcli/smb/smb2_constants.h"
+#include "libcli/smb/smb2_compression.h"
+#include "lib/compression/lzxpress.h"
+#include "lib/compression/lzxpress_huffman.h"
+
+/*
+ * Runs of the same byte shorter than this are left
+ * to the real compression algorithm.
+ */
+#define SMB2_COMPRESSION_PATTERN_MIN_RUN 64
+
+static const struct {
+	uint16_t algo;
+	const char *name;
+	bool supported;
+} smb3_compression_algorithms[] = {
+	{ SMB2_COMPRESSION_NONE,         "NONE",         false },
+	{ SMB2_COMPRESSION_LZNT1,        "LZNT1",        false },
+	{ SMB2_COMPRESSION_LZ77,         "LZ77",         true },
+	{ SMB2_COMPRESSION_LZ77_HUFFMAN, "LZ77+Huffman", true },
+	{ SMB2_COMPRESSION_PATTERN_V1,   "Pattern_V1",   true },
+	{ SMB2_COMPRESSION_LZ4,          "LZ4",          false },
+};
+
+const char *smb3_compression_algorithm_name(uint16_t algo)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(smb3_compression_algorithms); i++) {
+		if (smb3_compression_algorithms[i].algo == algo) {
+			return smb3_compression_algorithms[i].name;
+		}
+	}
+
+	return "Unknown";
+}
+
+uint16_t smb3_compression_algorithm_by_name(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(smb3_compression_algorithms); i++) {
+		if (strequal(smb3_compression_algorithms[i].name, name)) {
+			return smb3_compression_algorithms[i].algo;
+		}
+	}
+
+	return SMB2_COMPRESSION_INVALID_ALGO;
+}
+
+static bool smb3_compression_algorithm_supported(uint16_t algo)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(smb3_compression_algorithms); i++) {
+		if (smb3_compression_algorithms[i].algo == algo) {
+			return smb3_compression_algorithms[i].supported;
+		}
+	}
+
+	return false;
+}
+
+bool smb3_compression_capabilities_have(
+	const struct smb3_compression_capabilities *c,
+	uint16_t algo)
+{
+	uint16_t i;
+
+	for (i = 0; i < c->num_algos; i++) {
+		if (c->algos[i] == algo) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void smb3_compression_capabilities_parse(
+	const char *const *algos,
+	struct smb3_compression_capabilities *c)
+{
+	size_t i;
+
+	*c = (struct smb3_compression_capabilities) { .num_algos = 0, };
+
+	for (i = 0; algos != NULL && algos[i] != NULL; i++) {
+		uint16_t algo = smb3_compression_algorithm_by_name(algos[i]);
+
+		if (!smb3_compression_algorithm_supported(algo)) {
+			DBG_WARNING("Ignoring unsupported "
+				    "compression algorithm [%s]\n",
+				    algos[i]);
+			continue;
+		}
+		if (smb3_compression_capabilities_have(c, algo)) {
+			continue;
+		}
+		if (c->num_algos >= ARRAY_SIZE(c->algos)) {
+			break;
+		}
+		c->algos[c->num_algos++] = algo;
+	}
+}
+
+struct smb2_compression_mem {
+	struct lzxhuff_fast_compressor_mem *lzxhuff;
+};
+
+struct smb2_compression_mem *smb2_compression_mem_create(TALLOC_CTX *mem_ctx)
+{
+	return talloc_zero(mem_ctx, struct smb2_compression_mem);
+}
+
+static uint16_t smb3_compression_capabilities_first(
+	const struct smb3_compression_capabilities *c)
+{
+	uint16_t i;
+
+	for (i = 0; i < c->num_algos; i++) {
+		if (c->algos[i] != SMB2_COMPRESSION_PATTERN_V1) {
+			return c->algos[i];
+		}
+	}
+
+	return SMB2_COMPRESSION_NONE;
+}
+
+/*
+ * Returns the compressed size or -1 if the result
+ * would not fit into out_len bytes.
+ */
+static ssize_t smb2_compression_compress_one(struct smb2_compression_mem *cmem,
+					     uint16_t algo,
+					     const uint8_t *in,
+					     size_t in_len,
+					     uint8_t *out,
+					     size_t out_len)
+{
+	ssize_t ret = -1;
+
+	if (in_len == 0 || out_len == 0 || in_len > UINT32_MAX) {
+		return -1;
+	}
+	out_len = MIN(out_len, UINT32_MAX);
+
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		ret = lzxpress_compress(in, in_len, out, out_len);
+		/*
+		 * lzxpress_compress() stops silently when the
+		 * output buffer is full, so we can't use a
+		 * result that filled it.
+		 */
+		if (ret >= (ssize_t)out_len) {
+			ret = -1;
+		}
+		break;
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		if (cmem->lzxhuff == NULL) {
+			cmem->lzxhuff = talloc(cmem,
+					struct lzxhuff_fast_compressor_mem);
+			if (cmem->lzxhuff == NULL) {
+				return -1;
+			}
+		}
+		ret = lzxpress_huffman_compress_fast(cmem->lzxhuff,
+						     LZX_HUFF_EFFORT_DEFAULT,
+						     in,
+						     in_len,
+						     out,
+						     out_len);
+		break;
+	default:
+		break;
+	}
+
+	if (ret <= 0) {
+		return -1;
+	}
+	return ret;
+}
+
+static NTSTATUS smb2_compression_decompress_one(uint16_t algo,
+						const uint8_t *in,
+						size_t in_len,
+						uint8_t *out,
+						size_t out_len)
+{
+	ssize_t ret = -1;
+
+	if (in_len > UINT32_MAX || out_len > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (out_len == 0) {
+		return NT_STATUS_OK;
+	}
+
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		ret = lzxpress_decompress(in, in_len, out, out_len);
+		break;
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		ret = lzxpress_huffman_decompress_fast(in, in_len, out, out_len);
+		break;
+	default:
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (ret < 0 || (size_t)ret != out_len) {
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+	return NT_STATUS_OK;
+}
+
+static size_t smb2_compression_run_fwd(const uint8_t *p, size_t len)
+{
+	size_t n = 1;
+
+	while (n < len && p[n] == p[0]) {
+		n++;
+	}
+	return n;
+}
+
+static size_t smb2_compression_run_bwd(const uint8_t *p, size_t len)
+{
+	size_t n = 1;
+
+	while (n < len && p[len - 1 - n] == p[len - 1]) {
+		n++;
+	}
+	return n;
+}
+
+static uint8_t *smb2_compression_push_payload(uint8_t *p,
+					      uint16_t algo,
+					      uint16_t flags,
+					      uint32_t length)
+{
+	PUSH_LE_U16(p, SMB2_CTF_PAYLOAD_ALGORITHM, algo);
+	PUSH_LE_U16(p, SMB2_CTF_PAYLOAD_FLAGS, flags);
+	PUSH_LE_U32(p, SMB2_CTF_PAYLOAD_LENGTH, length);
+	return p + SMB2_CTF_PAYLOAD_HDR_SIZE;
+}
+
+static uint8_t *smb2_compression_push_pattern(uint8_t *p,
+					      uint16_t flags,
+					      uint8_t pattern,
+					      uint32_t repetitions)
+{
+	p = smb2_compression_push_payload(p,
+					  SMB2_COMPRESSION_PATTERN_V1,
+					  flags,
+					  SMB2_CTF_PATTERN_V1_SIZE);
+	PUSH_LE_U8(p, 0, pattern);
+	PUSH_LE_U8(p, 1, 0);  /* Reserved1 */
+	PUSH_LE_U16(p, 2, 0); /* Reserved2 */
+	PUSH_LE_U32(p, 4, repetitions);
+	return p + SMB2_CTF_PATTERN_V1_SIZE;
+}
+
+/*
+ * [MS-SMB2] 3.1.4.4 Compressing the Message, chained variant:
+ *
+ * The uncompressed prefix goes into a NONE payload, leading and
+ * trailing runs of a single byte into Pattern_V1 payloads (if
+ * negotiated) and whatever is left in the middle is compressed
+ * with the preferred algorithm.
+ */
+static size_t smb2_compression_chained(struct smb2_compression_mem *cmem,
+				       uint16_t algo,
+				       bool pattern_v1,
+				       const uint8_t *msg,
+				       size_t msg_len,
+				       size_t prefix,
+				       uint8_t *out)
+{
+	const uint8_t *data = msg + prefix;
+	size_t data_len = msg_len - prefix;
+	size_t lead = 0;
+	size_t trail = 0;
+	const uint8_t *mid = NULL;
+	size_t mid_len;
+	uint8_t *p = out;
+	uint16_t flags = SMB2_COMPRESSION_FLAG_CHAINED;
+
+	if (pattern_v1) {
+		lead = smb2_compression_run_fwd(data, data_len);
+		if (lead < SMB2_COMPRESSION_PATTERN_MIN_RUN) {
+			lead = 0;
+		}
+		if (lead < data_len) {
+			trail = smb2_compression_run_bwd(data + lead,
+							 data_len - lead);
+			if (trail < SMB2_COMPRESSION_PATTERN_MIN_RUN) {
+				trail = 0;
+			}
+		}
+	}
+	mid = data + lead;
+	mid_len = data_len - lead - trail;
+
+	PUSH_LE_U32(p, SMB2_CTF_PROTOCOL_ID, SMB2_CTF_MAGIC);
+	PUSH_LE_U32(p, SMB2_CTF_ORIGINAL_SIZE, msg_len);
+	p += SMB2_CTF_CHAINED_HDR_SIZE;
+
+	/*
+	 * Only the first payload header carries
+	 * SMB2_COMPRESSION_FLAG_CHAINED, it overlays
+	 * the Flags field of the unchained header.
+	 */
+
+	if (prefix > 0) {
+		p = smb2_compression_push_payload(p,
+						  SMB2_COMPRESSION_NONE,
+						  flags,
+						  prefix);
+		memcpy(p, msg, prefix);
+		p += prefix;
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (lead > 0) {
+		p = smb2_compression_push_pattern(p, flags, data[0], lead);
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (mid_len > 0) {
+		uint8_t *hdr = p;
+		uint8_t *dst = p + SMB2_CTF_PAYLOAD_HDR_SIZE + 4;
+		ssize_t clen = -1;
+
+		/*
+		 * It has to beat a NONE payload,
+		 * which has no OriginalPayloadSize.
+		 */
+		if (mid_len > 4) {
+			clen = smb2_compression_compress_one(cmem,
+							     algo,
+							     mid,
+							     mid_len,
+							     dst,
+							     mid_len - 4);
+		}
+		if (clen > 0) {
+			p = smb2_compression_push_payload(hdr,
+							  algo,
+							  flags,
+							  clen + 4);
+			PUSH_LE_U32(p, 0, mid_len);
+			p += 4 + clen;
+		} else {
+			p = smb2_compression_push_payload(hdr,
+							  SMB2_COMPRESSION_NONE,
+							  flags,
+							  mid_len);
+			memcpy(p, mid, mid_len);
+			p += mid_len;
+		}
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (trail > 0) {
+		p = smb2_compression_push_pattern(p,
+						  flags,
+						  data[data_len - 1],
+						  trail);
+	}
+
+	return p - out;
+}
+
+static size_t smb2_compression_unchained(struct smb2_compression_mem *cmem,
+					 uint16_t algo,
+					 const uint8_t *msg,
+					 size_t msg_len,
+					 size_t prefix,
+					 uint8_t *out)
+{
+	size_t hdr_len = SMB2_CTF_HDR_SIZE + prefix;
+	ssize_t clen;
+
+	if (msg_len <= hdr_len + 1) {
+		return 0;
+	}
+
+	clen = smb2_compression_compress_one(cmem,
+					     algo,
+					     msg + prefix,
+					     msg_len - prefix,
+					     out + hdr_len,
+					     msg_len - hdr_len - 1);
+	if (clen <= 0) {
+		return 0;
+	}
+
+	PUSH_LE_U32(out, SMB2_CTF_PROTOCOL_ID, SMB2_CTF_MAGIC);
+	PUSH_LE_U32(out, SMB2_CTF_ORIGINAL_SIZE, msg_len);
+	PUSH_LE_U16(out, SMB2_CTF_ALGORITHM, algo);
+	PUSH_LE_U16(out, SMB2_CTF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+	PUSH_LE_U32(out, SMB2_CTF_OFFSET, prefix);
+	memcpy(out + SMB2_CTF_HDR_SIZE, msg, prefix);
+
+	return hdr_len + clen;
+}
+
+NTSTATUS smb2_compression_compress(TALLOC_CTX *mem_ctx,
+				   struct smb2_compression_mem *cmem,
+				   const struct smb3_compression_capabilities *c,
+				   const struct iovec *iov,
+				   int count,
+				   size_t uncompressed_prefix,
+				   DATA_BLOB *out)
+{
+	uint16_t algo = smb3_compression_capabilities_first(c);
+	bool pattern_v1 = false;
+	uint8_t *msg = NULL;
+	ssize_t msg_len;
+	uint8_t *buf = NULL;
+	size_t buf_len;
+	size_t out_len;
+
+	*out = data_blob_null;
+
+	if (algo == SMB2_COMPRESSION_NONE) {
+		return NT_STATUS_OK;
+	}
+
+	msg_len = iov_buflen(iov, count);
+	if (msg_len == -1 || (size_t)msg_len > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+	if ((size_t)msg_len <= uncompressed_prefix) {
+		return NT_STATUS_OK;
+	}
+
+	msg = talloc_array(mem_ctx, uint8_t, msg_len);
+	if (msg == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	iov_buf(iov, count, msg, msg_len);
+
+	/*
+	 * Room for the chained header, four payload headers
+	 * and the OriginalPayloadSize, the result is only used
+	 * if it is smaller than msg_len anyway.
+	 */
+	buf_len = msg_len + SMB2_CTF_CHAINED_HDR_SIZE +
+		  4 * SMB2_CTF_PAYLOAD_HDR_SIZE + 4 +
+		  2 * SMB2_CTF_PATTERN_V1_SIZE;
+	buf = talloc_array(mem_ctx, uint8_t, buf_len);
+	if (buf == NULL) {
+		TALLOC_FREE(msg);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (c->chained) {
+		pattern_v1 = smb3_compression_capabilities_have(
+				c, SMB2_COMPRESSION_PATTERN_V1);
+		out_len = smb2_compression_chained(cmem,
+						   algo,
+						   pattern_v1,
+						   msg,
+						   msg_len,
+						   uncompressed_prefix,
+						   buf);
+	} else {
+		out_len = smb2_compression_unchained(cmem,
+						     algo,
+						     msg,
+						     msg_len,
+						     uncompressed_prefix,
+						     buf);
+	}
+	TALLOC_FREE(msg);
+
+	if (out_len == 0 || out_len >= (size_t)msg_len) {
+		TALLOC_FREE(buf);
+		return NT_STATUS_OK;
+	}
+
+	*out = data_blob_const(buf, out_len);
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_decompress_chained(
+	const struct smb3_compression_capabilities *c,
+	const uint8_t *buf,
+	size_t buflen,
+	uint8_t *dst,
+	size_t dst_len)
+{
+	size_t ofs = SMB2_CTF_CHAINED_HDR_SIZE;
+	size_t dst_ofs = 0;
+	NTSTATUS status;
+
+	while (ofs < buflen) {
+		const uint8_t *payload = NULL;
+		uint16_t algo;
+		uint32_t length;
+		uint32_t size;
+
+		if (buflen - ofs < SMB2_CTF_PAYLOAD_HDR_SIZE) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		algo = PULL_LE_U16(buf, ofs + SMB2_CTF_PAYLOAD_ALGORITHM);
+		length = PULL_LE_U32(buf, ofs + SMB2_CTF_PAYLOAD_LENGTH);
+		ofs += SMB2_CTF_PAYLOAD_HDR_SIZE;
+
+		if (length > buflen - ofs) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		payload = buf + ofs;
+		ofs += length;
+
+		switch (algo) {
+		case SMB2_COMPRESSION_NONE:
+			if (length > dst_len - dst_ofs) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			memcpy(dst + dst_ofs, payload, length);
+			dst_ofs += length;
+			break;
+
+		case SMB2_COMPRESSION_PATTERN_V1:
+			if (!smb3_compression_capabilities_have(c, algo)) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			if (length != SMB2_CTF_PATTERN_V1_SIZE) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			size = PULL_LE_U32(payload, 4);
+			if (size > dst_len - dst_ofs) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			memset(dst + dst_ofs, PULL_LE_U8(payload, 0), size);
+			dst_ofs += size;
+			break;
+
+		default:
+			if (!smb3_compression_capabilities_have(c, algo)) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			if (length < 4) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			size = PULL_LE_U32(payload, 0);
+			if (size > dst_len - dst_ofs) {
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+			status = smb2_compression_decompress_one(algo,
+								 payload + 4,
+								 length - 4,
+								 dst + dst_ofs,
+								 size);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+			dst_ofs += size;
+			break;
+		}
+	}
+
+	if (dst_ofs != dst_len) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_decompress_unchained(
+	const struct smb3_compression_capabilities *c,
+	const uint8_t *buf,
+	size_t buflen,
+	uint8_t *dst,
+	size_t dst_len)
+{
+	uint16_t algo = PULL_LE_U16(buf, SMB2_CTF_ALGORITHM);
+	uint32_t offset = PULL_LE_U32(buf, SMB2_CTF_OFFSET);
+	const uint8_t *payload = buf + SMB2_CTF_HDR_SIZE;
+	size_t payload_len = buflen - SMB2_CTF_HDR_SIZE;
+
+	if (algo == SMB2_COMPRESSION_PATTERN_V1 ||
+	    !smb3_compression_capabilities_have(c, algo))
+	{
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (offset > payload_len || offset > dst_len) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	memcpy(dst, payload, offset);
+
+	return smb2_compression_decompress_one(algo,
+					       payload + offset,
+					       payload_len - offset,
+					       dst + offset,
+					       dst_len - offset);
+}
+
+NTSTATUS smb2_compression_decompress(TALLOC_CTX *mem_ctx,
+				     const struct smb3_compression_capabilities *c,
+				     const uint8_t *buf,
+				     size_t buflen,
+				     size_t max_size,
+				     DATA_BLOB *out)
+{
+	uint32_t original_size;
+	uint16_t flags;
+	uint8_t *dst = NULL;
+	NTSTATUS status;
+
+	*out = data_blob_null;
+
+	/*
+	 * Both variants are at least 16 bytes, the chained
+	 * one needs at least one payload header.
+	 */
+	if (buflen < SMB2_CTF_HDR_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (PULL_LE_U32(buf, SMB2_CTF_PROTOCOL_ID) != SMB2_CTF_MAGIC) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	original_size = PULL_LE_U32(buf, SMB2_CTF_ORIGINAL_SIZE);
+	if (original_size == 0 || original_size > max_size) {
+		DBG_INFO("OriginalCompressedSegmentSize %" PRIu32
+			 " not in range 1..%zu\n",
+			 original_size, max_size);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	dst = talloc_array(mem_ctx, uint8_t, original_size);
+	if (dst == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	flags = PULL_LE_U16(buf, SMB2_CTF_FLAGS);
+	if (flags & SMB2_COMPRESSION_FLAG_CHAINED) {
+		if (!c->chained) {
+			status = NT_STATUS_INVALID_PARAMETER;
+		} else {
+			status = smb2_compression_decompress_chained(
+				c, buf, buflen, dst, original_size);
+		}
+	} else {
+		status = smb2_compression_decompress_unchained(
+			c, buf, buflen, dst, original_size);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(dst);
+		return status;
+	}
+
+	*out = data_blob_const(dst, original_size);
+	return NT_STATUS_OK;
+}
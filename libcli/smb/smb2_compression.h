@@ -0,0 +1,95 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB 3.1.1 compression transform
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBCLI_SMB_SMB2_COMPRESSION_H_
+#define _LIBCLI_SMB_SMB2_COMPRESSION_H_
+
+#include "lib/util/data_blob.h"
+#include "libcli/util/ntstatus.h"
+
+struct iovec;
+struct smb2_compression_mem;
+
+/*
+ * The negotiated state, algos are ordered by preference,
+ * the first one that is not SMB2_COMPRESSION_PATTERN_V1 is
+ * used for compression.
+ */
+struct smb3_compression_capabilities {
+#define SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS 3
+	uint16_t num_algos;
+	uint16_t algos[SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+	bool chained;
+};
+
+const char *smb3_compression_algorithm_name(uint16_t algo);
+uint16_t smb3_compression_algorithm_by_name(const char *name);
+
+/*
+ * Fill c with the algorithms from the
+ * "server smb3 compression algorithms" style list
+ * we are able to handle.
+ */
+void smb3_compression_capabilities_parse(
+	const char *const *algos,
+	struct smb3_compression_capabilities *c);
+
+bool smb3_compression_capabilities_have(
+	const struct smb3_compression_capabilities *c,
+	uint16_t algo);
+
+/*
+ * Scratch memory of the compressors, the LZ77+Huffman one
+ * is about 600 KB. It's allocated on first use and reused
+ * for all messages compressed with the same mem, so keep
+ * one per connection. It must not be used by two threads
+ * at the same time.
+ */
+struct smb2_compression_mem *smb2_compression_mem_create(TALLOC_CTX *mem_ctx);
+
+/*
+ * Builds an SMB2_COMPRESSION_TRANSFORM message out of the
+ * SMB2 message in iov. The first uncompressed_prefix bytes
+ * are passed as is, typically the SMB2 header and the fixed
+ * size response body.
+ *
+ * *out is set to data_blob_null if compression does not
+ * make the message smaller, the caller is expected to send
+ * the message uncompressed then.
+ */
+NTSTATUS smb2_compression_compress(TALLOC_CTX *mem_ctx,
+				   struct smb2_compression_mem *cmem,
+				   const struct smb3_compression_capabilities *c,
+				   const struct iovec *iov,
+				   int count,
+				   size_t uncompressed_prefix,
+				   DATA_BLOB *out);
+
+/*
+ * Decompresses the SMB2_COMPRESSION_TRANSFORM message in buf.
+ * The result is never larger than max_size and only the
+ * algorithms from c are accepted.
+ */
+NTSTATUS smb2_compression_decompress(TALLOC_CTX *mem_ctx,
+				     const struct smb3_compression_capabilities *c,
+				     const uint8_t *buf,
+				     size_t buflen,
+				     size_t max_size,
+				     DATA_BLOB *out);
+
+#endif /* _LIBCLI_SMB_SMB2_COMPRESSION_H_ */
@@ -0,0 +1,336 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Tests for the SMB 3.1.1 compression transform
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "lib/replace/replace.h"
+#include "system/filesys.h"
+#include <talloc.h>
+
+#include "lib/util/bytearray.h"
+#include "libcli/smb/smb2_constants.h"
+#include "libcli/smb/smb2_compression.h"
+
+#define TEST_PREFIX 0x50 /* SMB2 header and READ response body */
+
+static uint8_t *test_message(TALLOC_CTX *mem_ctx, size_t len)
+{
+	uint8_t *msg = talloc_array(mem_ctx, uint8_t, len);
+	size_t i;
+
+	assert_non_null(msg);
+
+	for (i = 0; i < TEST_PREFIX; i++) {
+		msg[i] = i;
+	}
+	/*
+	 * Leading zeros, some text and trailing 0xff,
+	 * like a sparse region in a VM image.
+	 */
+	memset(msg + TEST_PREFIX, 0, 4096);
+	for (i = TEST_PREFIX + 4096; i < len - 1024; i++) {
+		msg[i] = "The quick brown fox jumps over the lazy dog. "[i % 45];
+	}
+	memset(msg + len - 1024, 0xff, 1024);
+
+	return msg;
+}
+
+static void test_roundtrip(struct smb3_compression_capabilities *c)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	size_t len = 65536;
+	uint8_t *msg = test_message(frame, len);
+	struct iovec iov[2] = {
+		{ .iov_base = msg, .iov_len = TEST_PREFIX, },
+		{ .iov_base = msg + TEST_PREFIX, .iov_len = len - TEST_PREFIX, },
+	};
+	struct smb2_compression_mem *cmem = smb2_compression_mem_create(frame);
+	DATA_BLOB compressed = data_blob_null;
+	DATA_BLOB again = data_blob_null;
+	DATA_BLOB plain = data_blob_null;
+	NTSTATUS status;
+
+	assert_non_null(cmem);
+
+	status = smb2_compression_compress(frame, cmem, c, iov, 2, TEST_PREFIX,
+					   &compressed);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(compressed.length > 0);
+	assert_true(compressed.length < len);
+	assert_int_equal(PULL_LE_U32(compressed.data, 0), SMB2_CTF_MAGIC);
+	assert_int_equal(PULL_LE_U32(compressed.data, SMB2_CTF_ORIGINAL_SIZE),
+			 len);
+
+	status = smb2_compression_decompress(frame, c,
+					     compressed.data,
+					     compressed.length,
+					     len,
+					     &plain);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(plain.length, len);
+	assert_memory_equal(plain.data, msg, len);
+
+	/* Too large for the caller */
+	status = smb2_compression_decompress(frame, c,
+					     compressed.data,
+					     compressed.length,
+					     len - 1,
+					     &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	/* Reusing the scratch memory gives the same result */
+	status = smb2_compression_compress(frame, cmem, c, iov, 2, TEST_PREFIX,
+					   &again);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(again.length, compressed.length);
+	assert_memory_equal(again.data, compressed.data, compressed.length);
+
+	TALLOC_FREE(frame);
+}
+
+static void test_unchained_lz77(void **state)
+{
+	struct smb3_compression_capabilities c = {
+		.num_algos = 1,
+		.algos = { SMB2_COMPRESSION_LZ77, },
+	};
+
+	test_roundtrip(&c);
+}
+
+static void test_unchained_lz77_huffman(void **state)
+{
+	struct smb3_compression_capabilities c = {
+		.num_algos = 1,
+		.algos = { SMB2_COMPRESSION_LZ77_HUFFMAN, },
+	};
+
+	test_roundtrip(&c);
+}
+
+static void test_chained_pattern_v1(void **state)
+{
+	struct smb3_compression_capabilities c = {
+		.num_algos = 2,
+		.algos = {
+			SMB2_COMPRESSION_LZ77,
+			SMB2_COMPRESSION_PATTERN_V1,
+		},
+		.chained = true,
+	};
+
+	test_roundtrip(&c);
+}
+
+static void test_chained_pattern_only_data(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	struct smb3_compression_capabilities c = {
+		.num_algos = 2,
+		.algos = {
+			SMB2_COMPRESSION_LZ77_HUFFMAN,
+			SMB2_COMPRESSION_PATTERN_V1,
+		},
+		.chained = true,
+	};
+	uint8_t hdr[TEST_PREFIX] = { 0x42, };
+	uint8_t *data = talloc_zero_array(frame, uint8_t, 1024 * 1024);
+	struct iovec iov[2] = {
+		{ .iov_base = hdr, .iov_len = sizeof(hdr), },
+		{ .iov_base = data, .iov_len = 1024 * 1024, },
+	};
+	DATA_BLOB compressed = data_blob_null;
+	DATA_BLOB plain = data_blob_null;
+	NTSTATUS status;
+
+	status = smb2_compression_compress(frame,
+					   smb2_compression_mem_create(frame),
+					   &c, iov, 2, sizeof(hdr),
+					   &compressed);
+	assert_true(NT_STATUS_IS_OK(status));
+	/* header, NONE payload with the prefix and one Pattern_V1 payload */
+	assert_int_equal(compressed.length,
+			 SMB2_CTF_CHAINED_HDR_SIZE +
+			 SMB2_CTF_PAYLOAD_HDR_SIZE + sizeof(hdr) +
+			 SMB2_CTF_PAYLOAD_HDR_SIZE + SMB2_CTF_PATTERN_V1_SIZE);
+	assert_int_equal(PULL_LE_U16(compressed.data, SMB2_CTF_FLAGS),
+			 SMB2_COMPRESSION_FLAG_CHAINED);
+
+	status = smb2_compression_decompress(frame, &c,
+					     compressed.data,
+					     compressed.length,
+					     sizeof(hdr) + 1024 * 1024,
+					     &plain);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_memory_equal(plain.data, hdr, sizeof(hdr));
+	assert_memory_equal(plain.data + sizeof(hdr), data, 1024 * 1024);
+
+	/* Pattern_V1 was not negotiated */
+	c.num_algos = 1;
+	status = smb2_compression_decompress(frame, &c,
+					     compressed.data,
+					     compressed.length,
+					     sizeof(hdr) + 1024 * 1024,
+					     &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	/* Chaining was not negotiated */
+	c.num_algos = 2;
+	c.chained = false;
+	status = smb2_compression_decompress(frame, &c,
+					     compressed.data,
+					     compressed.length,
+					     sizeof(hdr) + 1024 * 1024,
+					     &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	TALLOC_FREE(frame);
+}
+
+static void test_incompressible(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	struct smb3_compression_capabilities c = {
+		.num_algos = 1,
+		.algos = { SMB2_COMPRESSION_LZ77, },
+	};
+	uint8_t buf[4096];
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf), };
+	DATA_BLOB compressed = data_blob_null;
+	uint32_t x = 0x12345678;
+	size_t i;
+	NTSTATUS status;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		/* xorshift */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+
+	status = smb2_compression_compress(frame,
+					   smb2_compression_mem_create(frame),
+					   &c, &iov, 1, TEST_PREFIX,
+					   &compressed);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(compressed.length, 0);
+
+	TALLOC_FREE(frame);
+}
+
+static void test_decompress_invalid(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	struct smb3_compression_capabilities c = {
+		.num_algos = 2,
+		.algos = {
+			SMB2_COMPRESSION_LZ77,
+			SMB2_COMPRESSION_PATTERN_V1,
+		},
+		.chained = true,
+	};
+	uint8_t buf[SMB2_CTF_CHAINED_HDR_SIZE +
+		    SMB2_CTF_PAYLOAD_HDR_SIZE +
+		    SMB2_CTF_PATTERN_V1_SIZE] = { 0, };
+	DATA_BLOB plain = data_blob_null;
+	NTSTATUS status;
+
+	PUSH_LE_U32(buf, SMB2_CTF_PROTOCOL_ID, SMB2_CTF_MAGIC);
+	PUSH_LE_U32(buf, SMB2_CTF_ORIGINAL_SIZE, 100);
+	PUSH_LE_U16(buf, 8 + SMB2_CTF_PAYLOAD_ALGORITHM,
+		    SMB2_COMPRESSION_PATTERN_V1);
+	PUSH_LE_U16(buf, 8 + SMB2_CTF_PAYLOAD_FLAGS,
+		    SMB2_COMPRESSION_FLAG_CHAINED);
+	PUSH_LE_U32(buf, 8 + SMB2_CTF_PAYLOAD_LENGTH,
+		    SMB2_CTF_PATTERN_V1_SIZE);
+	PUSH_LE_U8(buf, 16, 'A');
+	PUSH_LE_U32(buf, 16 + 4, 100);
+
+	status = smb2_compression_decompress(frame, &c, buf, sizeof(buf),
+					     100, &plain);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(plain.length, 100);
+	assert_int_equal(plain.data[99], 'A');
+
+	/* The pattern overflows OriginalCompressedSegmentSize */
+	PUSH_LE_U32(buf, 16 + 4, 101);
+	status = smb2_compression_decompress(frame, &c, buf, sizeof(buf),
+					     100, &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	/* The pattern does not fill OriginalCompressedSegmentSize */
+	PUSH_LE_U32(buf, 16 + 4, 99);
+	status = smb2_compression_decompress(frame, &c, buf, sizeof(buf),
+					     100, &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	/* Payload length beyond the buffer */
+	PUSH_LE_U32(buf, 16 + 4, 100);
+	PUSH_LE_U32(buf, 8 + SMB2_CTF_PAYLOAD_LENGTH,
+		    SMB2_CTF_PATTERN_V1_SIZE + 1);
+	status = smb2_compression_decompress(frame, &c, buf, sizeof(buf),
+					     100, &plain);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	TALLOC_FREE(frame);
+}
+
+static void test_capabilities_parse(void **state)
+{
+	const char *algos[] = {
+		"lz77+huffman", "LZNT1", "lz77", "LZ77", "pattern_v1", NULL,
+	};
+	struct smb3_compression_capabilities c;
+
+	smb3_compression_capabilities_parse(algos, &c);
+	assert_int_equal(c.num_algos, 3);
+	assert_int_equal(c.algos[0], SMB2_COMPRESSION_LZ77_HUFFMAN);
+	assert_int_equal(c.algos[1], SMB2_COMPRESSION_LZ77);
+	assert_int_equal(c.algos[2], SMB2_COMPRESSION_PATTERN_V1);
+	assert_false(c.chained);
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_unchained_lz77),
+		cmocka_unit_test(test_unchained_lz77_huffman),
+		cmocka_unit_test(test_chained_pattern_v1),
+		cmocka_unit_test(test_chained_pattern_only_data),
+		cmocka_unit_test(test_incompressible),
+		cmocka_unit_test(test_decompress_invalid),
+		cmocka_unit_test(test_capabilities_parse),
+	};
+
+	if (argc == 2) {
+		cmocka_set_test_filter(argv[1]);
+	}
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -3724,6 +3724,19 @@ sub provision($$)
 	vfs objects = error_inject
 	include = $errorinjectconf
 
+[write_behind]
+	copy = tmp
+	vfs objects = write_behind
+	write_behind:durability = relaxed
+	write_behind:delay = 60000
+
+[write_behind_error_inject]
+	copy = tmp
+	vfs objects = write_behind error_inject
+	write_behind:durability = relaxed
+	write_behind:delay = 60000
+	include = $errorinjectconf
+
 [delay_inject]
 	copy = tmp
 	vfs objects = delay_inject
@@ -3772,6 +3785,10 @@ sub provision($$)
 	copy = tmp
 	acl flag inherited canonicalization = no
 
+[casefold_index]
+	copy = tmp
+	casefold index = yes
+
 [full_audit_success_bad_name]
 	copy = tmp
 	full_audit:success = badname
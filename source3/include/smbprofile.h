@@ -62,11 +62,13 @@ struct tevent_context;
 	SMBPROFILE_STATS_BASIC(syscall_readdir) \
 	SMBPROFILE_STATS_BASIC(syscall_rewinddir) \
 	SMBPROFILE_STATS_BASIC(syscall_mkdirat) \
+	SMBPROFILE_STATS_BYTES(syscall_asys_mkdirat) \
 	SMBPROFILE_STATS_BASIC(syscall_closedir) \
 	SMBPROFILE_STATS_BASIC(syscall_open) \
 	SMBPROFILE_STATS_BASIC(syscall_openat) \
 	SMBPROFILE_STATS_BASIC(syscall_createfile) \
 	SMBPROFILE_STATS_BASIC(syscall_close) \
+	SMBPROFILE_STATS_BYTES(syscall_asys_close) \
 	SMBPROFILE_STATS_BYTES(syscall_pread) \
 	SMBPROFILE_STATS_BYTES(syscall_asys_pread) \
 	SMBPROFILE_STATS_BYTES(syscall_pwrite) \
@@ -75,6 +77,7 @@ struct tevent_context;
 	SMBPROFILE_STATS_BYTES(syscall_sendfile) \
 	SMBPROFILE_STATS_BYTES(syscall_recvfile) \
 	SMBPROFILE_STATS_BASIC(syscall_renameat) \
+	SMBPROFILE_STATS_BYTES(syscall_asys_renameat) \
 	SMBPROFILE_STATS_BASIC(syscall_rename_stream) \
 	SMBPROFILE_STATS_BYTES(syscall_asys_fsync) \
 	SMBPROFILE_STATS_BASIC(syscall_stat) \
@@ -83,6 +86,7 @@ struct tevent_context;
 	SMBPROFILE_STATS_BASIC(syscall_fstatat) \
 	SMBPROFILE_STATS_BASIC(syscall_get_alloc_size) \
 	SMBPROFILE_STATS_BASIC(syscall_unlinkat) \
+	SMBPROFILE_STATS_BYTES(syscall_asys_unlinkat) \
 	SMBPROFILE_STATS_BASIC(syscall_chmod) \
 	SMBPROFILE_STATS_BASIC(syscall_fchmod) \
 	SMBPROFILE_STATS_BASIC(syscall_fchown) \
@@ -98,6 +102,7 @@ struct tevent_context;
 	SMBPROFILE_STATS_BASIC(syscall_readlinkat) \
 	SMBPROFILE_STATS_BASIC(syscall_symlinkat) \
 	SMBPROFILE_STATS_BASIC(syscall_linkat) \
+	SMBPROFILE_STATS_BYTES(syscall_asys_linkat) \
 	SMBPROFILE_STATS_BASIC(syscall_mknodat) \
 	SMBPROFILE_STATS_BASIC(syscall_realpath) \
 	SMBPROFILE_STATS_BASIC(syscall_get_quota) \
@@ -128,6 +133,17 @@ struct tevent_context;
 	SMBPROFILE_STATS_COUNT(statcache_hits) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
+	SMBPROFILE_STATS_SECTION_START(readahead, "Readahead") \
+	SMBPROFILE_STATS_COUNT(readahead_prefetches) \
+	SMBPROFILE_STATS_COUNT(readahead_hits) \
+	SMBPROFILE_STATS_COUNT(readahead_misses) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(write_behind, "Write behind") \
+	SMBPROFILE_STATS_COUNT(write_behind_coalesced) \
+	SMBPROFILE_STATS_COUNT(write_behind_flushes) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
 	SMBPROFILE_STATS_SECTION_START(SMB, "SMB Calls") \
 	SMBPROFILE_STATS_BASIC(SMBmkdir) \
 	SMBPROFILE_STATS_BASIC(SMBrmdir) \
@@ -259,6 +275,13 @@ struct tevent_context;
 	SMBPROFILE_STATS_IOBYTES(smb2_break) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
+	SMBPROFILE_STATS_SECTION_START(smb2_credits, "SMB2 Credits") \
+	SMBPROFILE_STATS_COUNT(smb2_credits_granted) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_window) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_window_grow) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_window_shrink) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
 	SMBPROFILE_STATS_END
 
 
@@ -813,6 +836,29 @@ int smbprofile_persvc_collect_tdb(struct tdb_context *tdb,
 		SMBPROFILE_BYTES_ASYNC_END(__profasync_persvc_##x); \
 	} while (0)
 
+#define SMBPROFILE_COUNT_INCREMENT_X(_snum, _name, _v)                     \
+	do {                                                               \
+		struct profile_stats *_px = smbprofile_persvc_get(_snum);  \
+		_SMBPROFILE_COUNT_INCREMENT(_name##_stats, profile_p, _v); \
+		if (_px != NULL) {                                         \
+			_SMBPROFILE_COUNT_INCREMENT(_name##_stats,         \
+						    _px,                   \
+						    _v);                   \
+		}                                                          \
+	} while (0)
+
+/*
+ * Transient values like the number of open files,
+ * they are only maintained per service.
+ */
+#define SMBPROFILE_COUNT_SET_PERSVC(_snum, _name, _v)                      \
+	do {                                                               \
+		struct profile_stats *_px = smbprofile_persvc_get(_snum);  \
+		if (_px != NULL) {                                         \
+			_px->values._name##_stats.count = (_v);            \
+		}                                                          \
+	} while (0)
+
 #define SMBPROFILE_BYTES_ASYNC_STATE_X(_async_name, _async_persvc_name) \
 	struct smbprofile_stats_bytes_async _async_name;                \
 	struct smbprofile_stats_bytes_async _async_persvc_name;
@@ -890,6 +936,8 @@ int smbprofile_persvc_collect_tdb(struct tdb_context *tdb,
 
 #else /* WITH_PROFILE */
 
+#define SMBPROFILE_COUNT_INCREMENT_X(_snum, _name, _v)
+#define SMBPROFILE_COUNT_SET_PERSVC(_snum, _name, _v)
 #define START_PROFILE_X(_snum, x)
 #define START_PROFILE_BYTES_X(_snum, x, n)
 #define END_PROFILE_X(x)
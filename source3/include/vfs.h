@@ -405,6 +405,16 @@
  * Version 53 - Add fsp to SET_QUOTA
  * Version 53 - Remove GETWD
  * Version 53 - Add open_share_root
+ * Version 53 - Add file_id_link, fd_link and lease_link to files_struct,
+ *              use fsp_set_file_id() to change files_struct.file_id
+ * Version 53 - Add SMB_VFS_MKDIRAT_SEND/RECV
+ * Version 53 - Add SMB_VFS_RENAMEAT_SEND/RECV
+ * Version 53 - Add SMB_VFS_UNLINKAT_SEND/RECV
+ * Version 53 - Add SMB_VFS_LINKAT_SEND/RECV
+ * Version 53 - Add fsp_flags.delete_on_close_unlinked
+ * Version 53 - Add SMB_VFS_CLOSE_SEND/RECV
+ * Version 53 - Add SMB_VFS_FLUSH_CACHED_WRITES
+ * Version 53 - Add SMB_VFS_SPLICE_READ_FD
  */
 
 #define SMB_VFS_INTERFACE_VERSION 53
@@ -443,8 +453,22 @@ struct fsp_lease {
 	struct smb2_lease lease;
 };
 
+/*
+ * Entry of a files_struct in one of the hash indexes
+ * of the open files table, see source3/smbd/files.c
+ */
+struct files_index_link {
+	struct files_index_link *prev, *next;
+	struct files_struct *fsp;
+	uint32_t hash;
+	bool linked;
+};
+
 typedef struct files_struct {
 	struct files_struct *next, *prev;
+	struct files_index_link file_id_link;
+	struct files_index_link fd_link;
+	struct files_index_link lease_link;
 	uint64_t fnum;
 	struct smbXsrv_open *op;
 	struct connection_struct *conn;
@@ -471,6 +495,11 @@ typedef struct files_struct {
 		bool aio_write_behind : 1;
 		bool initial_delete_on_close : 1;
 		bool delete_on_close : 1;
+		/*
+		 * The file was already unlinked by an async delete on
+		 * close, see close_file_unlink_send().
+		 */
+		bool delete_on_close_unlinked : 1;
 		bool is_sparse : 1;
 		bool backup_intent : 1;
 		bool use_ofd_locks : 1;
@@ -1043,6 +1072,15 @@ struct vfs_fn_pointers {
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
 			mode_t mode);
+	struct tevent_req *(*mkdirat_send_fn)(
+				TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				struct vfs_handle_struct *handle,
+				struct files_struct *dirfsp,
+				const struct smb_filename *smb_fname,
+				mode_t mode);
+	int (*mkdirat_recv_fn)(struct tevent_req *req,
+			       struct vfs_aio_state *aio_state);
 	int (*closedir_fn)(struct vfs_handle_struct *handle, DIR *dir);
 
 	/* File operations */
@@ -1072,6 +1110,11 @@ struct vfs_fn_pointers {
 				   const struct smb2_create_blobs *in_context_blobs,
 				   struct smb2_create_blobs *out_context_blobs);
 	int (*close_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp);
+	struct tevent_req *(*close_send_fn)(struct vfs_handle_struct *handle,
+					    TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct files_struct *fsp);
+	int (*close_recv_fn)(struct tevent_req *req, struct vfs_aio_state *state);
 	ssize_t (*pread_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp, void *data, size_t n, off_t offset);
 	struct tevent_req *(*pread_send_fn)(struct vfs_handle_struct *handle,
 					    TALLOC_CTX *mem_ctx,
@@ -1090,6 +1133,10 @@ struct vfs_fn_pointers {
 	ssize_t (*pwrite_recv_fn)(struct tevent_req *req, struct vfs_aio_state *state);
 	off_t (*lseek_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp, off_t offset, int whence);
 	ssize_t (*sendfile_fn)(struct vfs_handle_struct *handle, int tofd, files_struct *fromfsp, const DATA_BLOB *header, off_t offset, size_t count);
+	int (*splice_read_fd_fn)(struct vfs_handle_struct *handle,
+				 struct files_struct *fsp,
+				 off_t offset,
+				 size_t count);
 	ssize_t (*recvfile_fn)(struct vfs_handle_struct *handle, int fromfd, files_struct *tofsp, off_t offset, size_t count);
 	int (*renameat_fn)(struct vfs_handle_struct *handle,
 			 struct files_struct *srcdir_fsp,
@@ -1097,6 +1144,17 @@ struct vfs_fn_pointers {
 			 struct files_struct *dstdir_fsp,
 			 const struct smb_filename *smb_fname_dst,
 			 const struct vfs_rename_how *how);
+	struct tevent_req *(*renameat_send_fn)(
+				TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				struct vfs_handle_struct *handle,
+				struct files_struct *srcdir_fsp,
+				const struct smb_filename *smb_fname_src,
+				struct files_struct *dstdir_fsp,
+				const struct smb_filename *smb_fname_dst,
+				const struct vfs_rename_how *how);
+	int (*renameat_recv_fn)(struct tevent_req *req,
+				struct vfs_aio_state *aio_state);
 	int (*rename_stream_fn)(struct vfs_handle_struct *handle,
 				struct files_struct *src_fsp,
 				const char *dst_name,
@@ -1106,6 +1164,8 @@ struct vfs_fn_pointers {
 					    struct tevent_context *ev,
 					    struct files_struct *fsp);
 	int (*fsync_recv_fn)(struct tevent_req *req, struct vfs_aio_state *state);
+	NTSTATUS (*flush_cached_writes_fn)(struct vfs_handle_struct *handle,
+					   struct files_struct *fsp);
 	int (*stat_fn)(struct vfs_handle_struct *handle, struct smb_filename *smb_fname);
 	int (*fstat_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp, SMB_STRUCT_STAT *sbuf);
 	int (*lstat_fn)(struct vfs_handle_struct *handle, struct smb_filename *smb_filename);
@@ -1120,6 +1180,15 @@ struct vfs_fn_pointers {
 			struct files_struct *srcdir_fsp,
 			const struct smb_filename *smb_fname,
 			int flags);
+	struct tevent_req *(*unlinkat_send_fn)(
+				TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				struct vfs_handle_struct *handle,
+				struct files_struct *dirfsp,
+				const struct smb_filename *smb_fname,
+				int flags);
+	int (*unlinkat_recv_fn)(struct tevent_req *req,
+				struct vfs_aio_state *aio_state);
 	int (*fchmod_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp, mode_t mode);
 	int (*fchown_fn)(struct vfs_handle_struct *handle, struct files_struct *fsp, uid_t uid, gid_t gid);
 	int (*lchown_fn)(struct vfs_handle_struct *handle,
@@ -1161,6 +1230,17 @@ struct vfs_fn_pointers {
 				struct files_struct *dstfsp,
 				const struct smb_filename *new_smb_fname,
 				int flags);
+	struct tevent_req *(*linkat_send_fn)(
+				TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				struct vfs_handle_struct *handle,
+				struct files_struct *srcfsp,
+				const struct smb_filename *old_smb_fname,
+				struct files_struct *dstfsp,
+				const struct smb_filename *new_smb_fname,
+				int flags);
+	int (*linkat_recv_fn)(struct tevent_req *req,
+			      struct vfs_aio_state *aio_state);
 	int (*mknodat_fn)(struct vfs_handle_struct *handle,
 				struct files_struct *dirfsp,
 				const struct smb_filename *smb_fname,
@@ -1510,6 +1590,15 @@ int smb_vfs_call_mkdirat(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
 			mode_t mode);
+struct tevent_req *smb_vfs_call_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode);
+int smb_vfs_call_mkdirat_recv(struct tevent_req *req,
+			      struct vfs_aio_state *aio_state);
 int smb_vfs_call_closedir(struct vfs_handle_struct *handle,
 			  DIR *dir);
 int smb_vfs_call_openat(struct vfs_handle_struct *handle,
@@ -1538,6 +1627,12 @@ NTSTATUS smb_vfs_call_create_file(struct vfs_handle_struct *handle,
 				  struct smb2_create_blobs *out_context_blobs);
 int smb_vfs_call_close(struct vfs_handle_struct *handle,
 		       struct files_struct *fsp);
+struct tevent_req *smb_vfs_call_close_send(struct vfs_handle_struct *handle,
+					   TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct files_struct *fsp);
+int smb_vfs_call_close_recv(struct tevent_req *req,
+			    struct vfs_aio_state *state);
 ssize_t smb_vfs_call_pread(struct vfs_handle_struct *handle,
 			   struct files_struct *fsp, void *data, size_t n,
 			   off_t offset);
@@ -1568,6 +1663,10 @@ off_t smb_vfs_call_lseek(struct vfs_handle_struct *handle,
 ssize_t smb_vfs_call_sendfile(struct vfs_handle_struct *handle, int tofd,
 			      files_struct *fromfsp, const DATA_BLOB *header,
 			      off_t offset, size_t count);
+int smb_vfs_call_splice_read_fd(struct vfs_handle_struct *handle,
+				struct files_struct *fsp,
+				off_t offset,
+				size_t count);
 ssize_t smb_vfs_call_recvfile(struct vfs_handle_struct *handle, int fromfd,
 			      files_struct *tofsp, off_t offset,
 			      size_t count);
@@ -1577,6 +1676,17 @@ int smb_vfs_call_renameat(struct vfs_handle_struct *handle,
 			struct files_struct *dstfsp,
 			const struct smb_filename *smb_fname_dst,
 			const struct vfs_rename_how *how);
+struct tevent_req *smb_vfs_call_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *srcfsp,
+			const struct smb_filename *smb_fname_src,
+			struct files_struct *dstfsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how);
+int smb_vfs_call_renameat_recv(struct tevent_req *req,
+			       struct vfs_aio_state *aio_state);
 int smb_vfs_call_rename_stream(struct vfs_handle_struct *handle,
 			       struct files_struct *src_fsp,
 			       const char *dst_name,
@@ -1590,6 +1700,8 @@ int smb_vfs_call_fsync_recv(struct tevent_req *req,
 			    struct vfs_aio_state *state);
 
 int smb_vfs_fsync_sync(files_struct *fsp);
+NTSTATUS smb_vfs_call_flush_cached_writes(struct vfs_handle_struct *handle,
+					  struct files_struct *fsp);
 int smb_vfs_call_stat(struct vfs_handle_struct *handle,
 		      struct smb_filename *smb_fname);
 int smb_vfs_call_fstat(struct vfs_handle_struct *handle,
@@ -1609,6 +1721,15 @@ int smb_vfs_call_unlinkat(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
 			int flags);
+struct tevent_req *smb_vfs_call_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			int flags);
+int smb_vfs_call_unlinkat_recv(struct tevent_req *req,
+			       struct vfs_aio_state *aio_state);
 int smb_vfs_call_fchmod(struct vfs_handle_struct *handle,
 			struct files_struct *fsp, mode_t mode);
 int smb_vfs_call_fchown(struct vfs_handle_struct *handle,
@@ -1661,6 +1782,17 @@ int smb_vfs_call_linkat(struct vfs_handle_struct *handle,
 			struct files_struct *dstfsp,
 			const struct smb_filename *new_smb_fname,
 			int flags);
+struct tevent_req *smb_vfs_call_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *srcfsp,
+			const struct smb_filename *old_smb_fname,
+			struct files_struct *dstfsp,
+			const struct smb_filename *new_smb_fname,
+			int flags);
+int smb_vfs_call_linkat_recv(struct tevent_req *req,
+			     struct vfs_aio_state *aio_state);
 int smb_vfs_call_mknodat(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
@@ -1956,6 +2088,15 @@ int vfs_not_implemented_mkdirat(vfs_handle_struct *handle,
 		struct files_struct *dirfsp,
 		const struct smb_filename *smb_fname,
 		mode_t mode);
+struct tevent_req *vfs_not_implemented_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode);
+int vfs_not_implemented_mkdirat_recv(struct tevent_req *req,
+				     struct vfs_aio_state *aio_state);
 int vfs_not_implemented_closedir(vfs_handle_struct *handle, DIR *dir);
 int vfs_not_implemented_open(vfs_handle_struct *handle,
 			     struct smb_filename *smb_fname,
@@ -1984,6 +2125,12 @@ NTSTATUS vfs_not_implemented_create_file(struct vfs_handle_struct *handle,
 				const struct smb2_create_blobs *in_context_blobs,
 				struct smb2_create_blobs *out_context_blobs);
 int vfs_not_implemented_close_fn(vfs_handle_struct *handle, files_struct *fsp);
+struct tevent_req *vfs_not_implemented_close_send(struct vfs_handle_struct *handle,
+						  TALLOC_CTX *mem_ctx,
+						  struct tevent_context *ev,
+						  struct files_struct *fsp);
+int vfs_not_implemented_close_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state);
 ssize_t vfs_not_implemented_pread(vfs_handle_struct *handle, files_struct *fsp,
 				  void *data, size_t n, off_t offset);
 struct tevent_req *vfs_not_implemented_pread_send(struct vfs_handle_struct *handle,
@@ -2008,6 +2155,10 @@ off_t vfs_not_implemented_lseek(vfs_handle_struct *handle, files_struct *fsp,
 ssize_t vfs_not_implemented_sendfile(vfs_handle_struct *handle, int tofd,
 				     files_struct *fromfsp, const DATA_BLOB *hdr,
 				     off_t offset, size_t n);
+int vfs_not_implemented_splice_read_fd(vfs_handle_struct *handle,
+				       files_struct *fsp,
+				       off_t offset,
+				       size_t n);
 ssize_t vfs_not_implemented_recvfile(vfs_handle_struct *handle, int fromfd,
 				     files_struct *tofsp, off_t offset, size_t n);
 int vfs_not_implemented_renameat(vfs_handle_struct *handle,
@@ -2016,6 +2167,17 @@ int vfs_not_implemented_renameat(vfs_handle_struct *handle,
 			       files_struct *dstfsp,
 			       const struct smb_filename *smb_fname_dst,
 			       const struct vfs_rename_how *how);
+struct tevent_req *vfs_not_implemented_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *srcfsp,
+			const struct smb_filename *smb_fname_src,
+			files_struct *dstfsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how);
+int vfs_not_implemented_renameat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state);
 int vfs_not_implemented_rename_stream(struct vfs_handle_struct *handle,
 				      struct files_struct *src_fsp,
 				      const char *dst_name,
@@ -2026,6 +2188,9 @@ struct tevent_req *vfs_not_implemented_fsync_send(struct vfs_handle_struct *hand
 						  struct files_struct *fsp);
 int vfs_not_implemented_fsync_recv(struct tevent_req *req,
 				   struct vfs_aio_state *vfs_aio_state);
+NTSTATUS vfs_not_implemented_flush_cached_writes(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp);
 int vfs_not_implemented_stat(vfs_handle_struct *handle, struct smb_filename *smb_fname);
 int vfs_not_implemented_fstat(vfs_handle_struct *handle, files_struct *fsp,
 			SMB_STRUCT_STAT *sbuf);
@@ -2044,6 +2209,15 @@ int vfs_not_implemented_unlinkat(vfs_handle_struct *handle,
 				struct files_struct *dirfsp,
 				const struct smb_filename *smb_fname,
 				int flags);
+struct tevent_req *vfs_not_implemented_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			int flags);
+int vfs_not_implemented_unlinkat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state);
 int vfs_not_implemented_fchmod(vfs_handle_struct *handle, files_struct *fsp,
 			       mode_t mode);
 int vfs_not_implemented_fchown(vfs_handle_struct *handle, files_struct *fsp,
@@ -2092,6 +2266,17 @@ int vfs_not_implemented_linkat(vfs_handle_struct *handle,
 			struct files_struct *dstfsp,
 			const struct smb_filename *new_smb_fname,
 			int flags);
+struct tevent_req *vfs_not_implemented_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *srcfsp,
+			const struct smb_filename *old_smb_fname,
+			struct files_struct *dstfsp,
+			const struct smb_filename *new_smb_fname,
+			int flags);
+int vfs_not_implemented_linkat_recv(struct tevent_req *req,
+				    struct vfs_aio_state *aio_state);
 int vfs_not_implemented_mknodat(vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
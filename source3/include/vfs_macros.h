@@ -137,6 +137,18 @@
 #define SMB_VFS_NEXT_MKDIRAT(handle, dirfsp, smb_fname, mode) \
 	smb_vfs_call_mkdirat((handle)->next,(dirfsp), (smb_fname), (mode))
 
+#define SMB_VFS_MKDIRAT_SEND(mem_ctx, ev, dirfsp, smb_fname, mode) \
+	smb_vfs_call_mkdirat_send((mem_ctx), (ev), \
+				  (dirfsp)->conn->vfs_handles, \
+				  (dirfsp), (smb_fname), (mode))
+#define SMB_VFS_MKDIRAT_RECV(req, aio_state) \
+	smb_vfs_call_mkdirat_recv((req), (aio_state))
+#define SMB_VFS_NEXT_MKDIRAT_SEND(mem_ctx, ev, handle, dirfsp, smb_fname, mode) \
+	smb_vfs_call_mkdirat_send((mem_ctx), (ev), (handle)->next, \
+				  (dirfsp), (smb_fname), (mode))
+#define SMB_VFS_NEXT_MKDIRAT_RECV(req, aio_state) \
+	smb_vfs_call_mkdirat_recv((req), (aio_state))
+
 #define SMB_VFS_CLOSEDIR(conn, dir) \
 	smb_vfs_call_closedir((conn)->vfs_handles, dir)
 #define SMB_VFS_NEXT_CLOSEDIR(handle, dir) \
@@ -166,6 +178,17 @@
 #define SMB_VFS_NEXT_CLOSE(handle, fsp) \
 	smb_vfs_call_close((handle)->next, (fsp))
 
+#define SMB_VFS_CLOSE_SEND(mem_ctx, ev, fsp) \
+	smb_vfs_call_close_send((fsp)->conn->vfs_handles, (mem_ctx), (ev), \
+				(fsp))
+#define SMB_VFS_CLOSE_RECV(req, aio_state) \
+	smb_vfs_call_close_recv((req), (aio_state))
+
+#define SMB_VFS_NEXT_CLOSE_SEND(mem_ctx, ev, handle, fsp) \
+	smb_vfs_call_close_send((handle)->next, (mem_ctx), (ev), (fsp))
+#define SMB_VFS_NEXT_CLOSE_RECV(req, aio_state) \
+	smb_vfs_call_close_recv((req), (aio_state))
+
 #define SMB_VFS_PREAD(fsp, data, n, off) \
 	smb_vfs_call_pread((fsp)->conn->vfs_handles, (fsp), (data), (n), (off))
 #define SMB_VFS_NEXT_PREAD(handle, fsp, data, n, off) \
@@ -210,6 +233,11 @@
 #define SMB_VFS_NEXT_SENDFILE(handle, tofd, fromfsp, header, offset, count) \
 	smb_vfs_call_sendfile((handle)->next, (tofd), (fromfsp), (header), (offset), (count))
 
+#define SMB_VFS_SPLICE_READ_FD(fsp, offset, count) \
+	smb_vfs_call_splice_read_fd((fsp)->conn->vfs_handles, (fsp), (offset), (count))
+#define SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, count) \
+	smb_vfs_call_splice_read_fd((handle)->next, (fsp), (offset), (count))
+
 #define SMB_VFS_RECVFILE(fromfd, tofsp, offset, count) \
 	smb_vfs_call_recvfile((tofsp)->conn->vfs_handles, (fromfd), (tofsp), (offset), (count))
 #define SMB_VFS_NEXT_RECVFILE(handle, fromfd, tofsp, offset, count) \
@@ -220,6 +248,18 @@
 #define SMB_VFS_NEXT_RENAMEAT(handle, oldfsp, old, newfsp, newname, how) \
 	smb_vfs_call_renameat((handle)->next, (oldfsp), (old), (newfsp), (newname), (how))
 
+#define SMB_VFS_RENAMEAT_SEND(mem_ctx, ev, oldfsp, old, newfsp, newname, how) \
+	smb_vfs_call_renameat_send((mem_ctx), (ev), \
+				   (oldfsp)->conn->vfs_handles, \
+				   (oldfsp), (old), (newfsp), (newname), (how))
+#define SMB_VFS_RENAMEAT_RECV(req, aio_state) \
+	smb_vfs_call_renameat_recv((req), (aio_state))
+#define SMB_VFS_NEXT_RENAMEAT_SEND(mem_ctx, ev, handle, oldfsp, old, newfsp, newname, how) \
+	smb_vfs_call_renameat_send((mem_ctx), (ev), (handle)->next, \
+				   (oldfsp), (old), (newfsp), (newname), (how))
+#define SMB_VFS_NEXT_RENAMEAT_RECV(req, aio_state) \
+	smb_vfs_call_renameat_recv((req), (aio_state))
+
 #define SMB_VFS_RENAME_STREAM(conn, src_fsp, dst_name, replace_if_exists) \
 	smb_vfs_call_rename_stream((conn)->vfs_handles,                   \
 				   (src_fsp),                             \
@@ -245,6 +285,11 @@
 #define SMB_VFS_NEXT_FSYNC_RECV(req, aio_state) \
 	smb_vfs_call_fsync_recv((req), (aio_state))
 
+#define SMB_VFS_FLUSH_CACHED_WRITES(fsp) \
+	smb_vfs_call_flush_cached_writes((fsp)->conn->vfs_handles, (fsp))
+#define SMB_VFS_NEXT_FLUSH_CACHED_WRITES(handle, fsp) \
+	smb_vfs_call_flush_cached_writes((handle)->next, (fsp))
+
 #define SMB_VFS_STAT(conn, smb_fname) \
 	smb_vfs_call_stat((conn)->vfs_handles, (smb_fname))
 #define SMB_VFS_NEXT_STAT(handle, smb_fname) \
@@ -277,6 +322,18 @@
 #define SMB_VFS_NEXT_UNLINKAT(handle, dirfsp, path, flags) \
 	smb_vfs_call_unlinkat((handle)->next, (dirfsp), (path), (flags))
 
+#define SMB_VFS_UNLINKAT_SEND(mem_ctx, ev, dirfsp, path, flags) \
+	smb_vfs_call_unlinkat_send((mem_ctx), (ev), \
+				   (dirfsp)->conn->vfs_handles, \
+				   (dirfsp), (path), (flags))
+#define SMB_VFS_UNLINKAT_RECV(req, aio_state) \
+	smb_vfs_call_unlinkat_recv((req), (aio_state))
+#define SMB_VFS_NEXT_UNLINKAT_SEND(mem_ctx, ev, handle, dirfsp, path, flags) \
+	smb_vfs_call_unlinkat_send((mem_ctx), (ev), (handle)->next, \
+				   (dirfsp), (path), (flags))
+#define SMB_VFS_NEXT_UNLINKAT_RECV(req, aio_state) \
+	smb_vfs_call_unlinkat_recv((req), (aio_state))
+
 #define SMB_VFS_FCHMOD(fsp, mode) \
 	smb_vfs_call_fchmod((fsp)->conn->vfs_handles, (fsp), (mode))
 #define SMB_VFS_NEXT_FCHMOD(handle, fsp, mode) \
@@ -359,6 +416,18 @@
 #define SMB_VFS_NEXT_LINKAT(handle, srcfsp, oldpath, dstfsp, newpath, flags) \
 	smb_vfs_call_linkat((handle)->next, (srcfsp), (oldpath), (dstfsp), (newpath), (flags))
 
+#define SMB_VFS_LINKAT_SEND(mem_ctx, ev, srcfsp, oldpath, dstfsp, newpath, flags) \
+	smb_vfs_call_linkat_send((mem_ctx), (ev), \
+				 (srcfsp)->conn->vfs_handles, \
+				 (srcfsp), (oldpath), (dstfsp), (newpath), (flags))
+#define SMB_VFS_LINKAT_RECV(req, aio_state) \
+	smb_vfs_call_linkat_recv((req), (aio_state))
+#define SMB_VFS_NEXT_LINKAT_SEND(mem_ctx, ev, handle, srcfsp, oldpath, dstfsp, newpath, flags) \
+	smb_vfs_call_linkat_send((mem_ctx), (ev), (handle)->next, \
+				 (srcfsp), (oldpath), (dstfsp), (newpath), (flags))
+#define SMB_VFS_NEXT_LINKAT_RECV(req, aio_state) \
+	smb_vfs_call_linkat_recv((req), (aio_state))
+
 #define SMB_VFS_MKNODAT(conn, dirfsp, smb_fname, mode, dev) \
 	smb_vfs_call_mknodat((conn)->vfs_handles, (dirfsp), (smb_fname), (mode), (dev))
 #define SMB_VFS_NEXT_MKNODAT(handle, dirfsp, smb_fname, mode, dev) \
@@ -143,6 +143,60 @@ struct db_context *db_open_ex(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (tdb_flags & TDB_CLEAR_IF_FIRST) {
+		/*
+		 * Volatile databases are recreated on first open, so
+		 * this is where the hash growth and free list formats
+		 * and the optimistic read counters (only used with
+		 * mutexes) can be chosen.
+		 */
+		bool grow_hash = false;
+		bool freelist_classes = false;
+		bool optimistic_reads = false;
+
+		grow_hash = lp_parm_bool(-1, "dbwrap_tdb_grow_hash", "*", grow_hash);
+		grow_hash = lp_parm_bool(-1, "dbwrap_tdb_grow_hash", base, grow_hash);
+
+		if (grow_hash) {
+			tdb_flags |= TDB_GROW_HASH;
+		}
+
+		freelist_classes = lp_parm_bool(-1, "dbwrap_tdb_freelist_classes",
+						"*", freelist_classes);
+		freelist_classes = lp_parm_bool(-1, "dbwrap_tdb_freelist_classes",
+						base, freelist_classes);
+
+		if (freelist_classes) {
+			tdb_flags |= TDB_FREELIST_CLASSES;
+		}
+
+		optimistic_reads = lp_parm_bool(-1, "dbwrap_tdb_optimistic_reads",
+						"*", optimistic_reads);
+		optimistic_reads = lp_parm_bool(-1, "dbwrap_tdb_optimistic_reads",
+						base, optimistic_reads);
+
+		if (optimistic_reads) {
+			tdb_flags |= TDB_OPTIMISTIC_READS;
+		}
+	}
+
+	if (persistent) {
+		/*
+		 * Only used when the database file is created,
+		 * existing persistent databases keep their format.
+		 */
+		bool group_commit = false;
+
+		group_commit = lp_parm_bool(-1, "dbwrap_tdb_group_commit",
+					    "*", group_commit);
+		group_commit = lp_parm_bool(-1, "dbwrap_tdb_group_commit",
+					    base, group_commit);
+
+		if (group_commit) {
+			tdb_flags |= TDB_GROUP_COMMIT;
+		}
+	}
+
 	if (lp_clustering()) {
 		const char *sockname;
 
@@ -34,6 +34,7 @@
 #include "serverid.h"
 #include "messages.h"
 #include "util_tdb.h"
+#include "lib/util/stable_sort.h"
 #include "source3/locking/share_mode_lock.h"
 #include "../librpc/gen_ndr/ndr_open_files.h"
 
@@ -44,11 +45,21 @@
 
 static struct db_context *brlock_db;
 
+/*
+ * lock_data is kept sorted by start offset, locks with the same
+ * start are kept in the order they were added. Together with
+ * max_size, an upper bound of the size of all locks in lock_data,
+ * this limits the locks that can overlap a given range to a window
+ * found by binary search, see brl_lock_window().
+ */
+
 struct byte_range_lock {
 	struct files_struct *fsp;
 	TALLOC_CTX *req_mem_ctx;
 	const struct GUID *req_guid;
 	unsigned int num_locks;
+	unsigned int num_posix_locks;
+	uint64_t max_size;
 	bool modified;
 	struct lock_struct *lock_data;
 	struct db_record *record;
@@ -337,6 +348,125 @@ static bool brl_conflict_other(const struct lock_struct *lock,
 	return false;
 }
 
+/****************************************************************************
+ Number of bytes covered by a lock, used for br_lck->max_size.
+****************************************************************************/
+
+static uint64_t brl_lock_size(const struct lock_struct *lck)
+{
+	if (!byte_range_valid(lck->start, lck->size)) {
+		return UINT64_MAX;
+	}
+	return lck->size;
+}
+
+/****************************************************************************
+ Find the index of the first lock starting at or (if after is true)
+ behind offset.
+****************************************************************************/
+
+static unsigned int brl_find_start(const struct byte_range_lock *br_lck,
+				   uint64_t offset,
+				   bool after)
+{
+	unsigned int lo = 0;
+	unsigned int hi = br_lck->num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		uint64_t start = br_lck->lock_data[mid].start;
+
+		if ((start < offset) || (after && (start == offset))) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/****************************************************************************
+ Return the range [*first, *last) of locks that can overlap or touch the
+ range [start, start+size). Every lock outside this window is known to
+ neither overlap nor be adjacent to the range.
+****************************************************************************/
+
+static void brl_lock_window(const struct byte_range_lock *br_lck,
+			    uint64_t start,
+			    uint64_t size,
+			    unsigned int *first,
+			    unsigned int *last)
+{
+	uint64_t lowest = 0;
+	uint64_t highest = UINT64_MAX;
+
+	if (start > br_lck->max_size) {
+		lowest = start - br_lck->max_size;
+	}
+	if (size <= UINT64_MAX - start) {
+		highest = start + size;
+	}
+
+	*first = brl_find_start(br_lck, lowest, false);
+	*last = brl_find_start(br_lck, highest, true);
+}
+
+/****************************************************************************
+ Replace the locks [first, last) by the num_new locks in new_locks, which
+ have to sort into this position.
+****************************************************************************/
+
+static bool brl_replace_locks(struct byte_range_lock *br_lck,
+			      unsigned int first,
+			      unsigned int last,
+			      const struct lock_struct *new_locks,
+			      unsigned int num_new)
+{
+	struct lock_struct *locks = br_lck->lock_data;
+	unsigned int num_old = last - first;
+	unsigned int num_locks = br_lck->num_locks - num_old + num_new;
+	unsigned int i;
+
+	SMB_ASSERT(first <= last);
+	SMB_ASSERT(last <= br_lck->num_locks);
+
+	if (num_new > num_old) {
+		locks = talloc_realloc(br_lck,
+				       locks,
+				       struct lock_struct,
+				       num_locks);
+		if (locks == NULL) {
+			return false;
+		}
+		br_lck->lock_data = locks;
+	}
+
+	if (num_new != num_old) {
+		memmove(&locks[first + num_new],
+			&locks[last],
+			(br_lck->num_locks - last) * sizeof(struct lock_struct));
+	}
+
+	for (i = 0; i < num_new; i++) {
+		locks[first + i] = new_locks[i];
+		br_lck->max_size = MAX(br_lck->max_size,
+				       brl_lock_size(&new_locks[i]));
+	}
+
+	br_lck->num_locks = num_locks;
+	br_lck->modified = true;
+	return true;
+}
+
+static int brl_lock_cmp(const void *p1, const void *p2)
+{
+	const struct lock_struct *lck1 = p1;
+	const struct lock_struct *lck2 = p2;
+
+	return NUMERIC_CMP(lck1->start, lck2->start);
+}
+
 /****************************************************************************
  Open up the brlock.tdb database.
 ****************************************************************************/
@@ -392,7 +522,7 @@ void brl_shutdown(void)
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				  struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, first, last;
 	files_struct *fsp = br_lck->fsp;
 	struct lock_struct *locks = br_lck->lock_data;
 	NTSTATUS status;
@@ -405,7 +535,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	brl_lock_window(br_lck, plock->start, plock->size, &first, &last);
+
+	for (i=first; i < last; i++) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -427,13 +559,18 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 
 	if (lp_posix_locking(fsp->conn->params)) {
 		int errno_ret;
+
+		/*
+		 * Only the locks in the window can overlap the
+		 * new one, the others don't matter for the mapping.
+		 */
 		if (!set_posix_lock_windows_flavour(fsp,
 				plock->start,
 				plock->size,
 				plock->lock_type,
 				&plock->context,
-				locks,
-				br_lck->num_locks,
+				&locks[first],
+				last - first,
 				&errno_ret)) {
 
 			/* We don't know who blocked us. */
@@ -449,19 +586,13 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		}
 	}
 
-	/* no conflicts - add it to the list of locks */
-	locks = talloc_realloc(br_lck, locks, struct lock_struct,
-			       (br_lck->num_locks + 1));
-	if (!locks) {
+	/* no conflicts - add it behind all locks starting before or with it */
+	i = brl_find_start(br_lck, plock->start, true);
+	if (!brl_replace_locks(br_lck, i, i, plock, 1)) {
 		status = NT_STATUS_NO_MEMORY;
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
-	br_lck->num_locks += 1;
-	br_lck->lock_data = locks;
-	br_lck->modified = True;
-
 	return NT_STATUS_OK;
  fail:
 	contend_level2_oplocks_end(fsp, LEVEL2_CONTEND_WINDOWS_BRL);
@@ -765,7 +896,7 @@ OR
 static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 			       struct lock_struct *plock)
 {
-	unsigned int i, count, posix_count;
+	unsigned int i, first, last, count, posix_count;
 	struct lock_struct *locks = br_lck->lock_data;
 	struct lock_struct *tp;
 	bool break_oplocks = false;
@@ -783,18 +914,27 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_PARAMETER;
 	}
 
+	/*
+	 * Only the locks in the window can conflict with, or be
+	 * merged into plock. They are replaced by the result of the
+	 * split/merge below, all others stay as they are.
+	 */
+
+	brl_lock_window(br_lck, plock->start, plock->size, &first, &last);
+
 	/* The worst case scenario here is we have to split an
 	   existing POSIX lock range into two, and add our lock,
 	   so we need at most 2 more entries. */
 
-	tp = talloc_array(br_lck, struct lock_struct, br_lck->num_locks + 2);
+	tp = talloc_array(br_lck, struct lock_struct, (last - first) + 2);
 	if (!tp) {
 		return NT_STATUS_NO_MEMORY;
 	}
 
-	count = posix_count = 0;
+	count = 0;
+	posix_count = br_lck->num_posix_locks;
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i=first; i < last; i++) {
 		struct lock_struct *curr_lock = &locks[i];
 
 		if (curr_lock->lock_flav == WINDOWS_LOCK) {
@@ -817,6 +957,9 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 		} else {
 			unsigned int tmp_count = 0;
 
+			/* Recounted below if it survives the split/merge. */
+			posix_count -= 1;
+
 			/* POSIX conflict semantics are different. */
 			if (brl_conflict_posix(curr_lock, plock)) {
 				if (!serverid_exists(&curr_lock->context.pid)) {
@@ -853,21 +996,19 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
+	/*
+	 * Add the lock behind all locks with the same start and
+	 * sort the window again, splitting may have moved starts.
+	 */
+	memcpy(&tp[count], plock, sizeof(struct lock_struct));
+	count++;
 
-	if (i < count) {
-		memmove(&tp[i+1], &tp[i],
-			(count - i)*sizeof(struct lock_struct));
+	if (!stable_sort_talloc(tp, tp, count, sizeof(struct lock_struct),
+				brl_lock_cmp)) {
+		TALLOC_FREE(tp);
+		status = NT_STATUS_NO_MEMORY;
+		goto fail;
 	}
-	memcpy(&tp[i], plock, sizeof(struct lock_struct));
-	count++;
 
 	/* We can get the POSIX lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
@@ -902,21 +1043,14 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 		}
 	}
 
-	/* If we didn't use all the allocated size,
-	 * Realloc so we don't leak entries per lock call. */
-	if (count < br_lck->num_locks + 2) {
-		tp = talloc_realloc(br_lck, tp, struct lock_struct, count);
-		if (!tp) {
-			status = NT_STATUS_NO_MEMORY;
-			goto fail;
-		}
+	if (!brl_replace_locks(br_lck, first, last, tp, count)) {
+		TALLOC_FREE(tp);
+		status = NT_STATUS_NO_MEMORY;
+		goto fail;
 	}
+	TALLOC_FREE(tp);
 
-	br_lck->num_locks = count;
-	TALLOC_FREE(br_lck->lock_data);
-	br_lck->lock_data = tp;
-	locks = tp;
-	br_lck->modified = True;
+	br_lck->num_posix_locks = posix_count + 1;
 
 	/* A successful downgrade from write to read lock can trigger a lock
 	   re-evalutation where waiting readers can now proceed. */
@@ -985,28 +1119,29 @@ NTSTATUS brl_lock(
 bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 				const struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, first, last;
 	struct lock_struct *locks = br_lck->lock_data;
 	enum brl_type deleted_lock_type = READ_LOCK; /* shut the compiler up.... */
 
 	SMB_ASSERT(plock->lock_type == UNLOCK_LOCK);
 
-
-	for (i = 0; i < br_lck->num_locks; i++) {
+	/* Only locks with the same start can match. */
+	for (i = brl_find_start(br_lck, plock->start, false);
+	     i < br_lck->num_locks && locks[i].start == plock->start;
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
 		/* Only remove our own locks that match in start, size, and flavour. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 					lock->fnum == plock->fnum &&
 					lock->lock_flav == WINDOWS_LOCK &&
-					lock->start == plock->start &&
 					lock->size == plock->size ) {
 			deleted_lock_type = lock->lock_type;
 			break;
 		}
 	}
 
-	if (i == br_lck->num_locks) {
+	if (i == br_lck->num_locks || locks[i].start != plock->start) {
 		/* we didn't find it */
 		return False;
 	}
@@ -1017,13 +1152,15 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
+		brl_lock_window(br_lck, plock->start, plock->size,
+				&first, &last);
 		release_posix_lock_windows_flavour(br_lck->fsp,
 				plock->start,
 				plock->size,
 				deleted_lock_type,
 				&plock->context,
-				locks,
-				br_lck->num_locks);
+				&locks[first],
+				last - first);
 	}
 
 	contend_level2_oplocks_end(br_lck->fsp, LEVEL2_CONTEND_WINDOWS_BRL);
@@ -1037,7 +1174,7 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 			     struct lock_struct *plock)
 {
-	unsigned int i, count;
+	unsigned int i, first, last, count, posix_count;
 	struct lock_struct *tp;
 	struct lock_struct *locks = br_lck->lock_data;
 	bool overlap_found = False;
@@ -1056,18 +1193,23 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 		return False;
 	}
 
+	/* Only the locks in the window can overlap the unlocked range. */
+	brl_lock_window(br_lck, plock->start, plock->size, &first, &last);
+
 	/* The worst case scenario here is we have to split an
 	   existing POSIX lock range into two, so we need at most
 	   1 more entry. */
 
-	tp = talloc_array(br_lck, struct lock_struct, br_lck->num_locks + 1);
+	tp = talloc_array(br_lck, struct lock_struct, (last - first) + 1);
 	if (!tp) {
 		DEBUG(10,("brl_unlock_posix: malloc fail\n"));
 		return False;
 	}
 
 	count = 0;
-	for (i = 0; i < br_lck->num_locks; i++) {
+	posix_count = br_lck->num_posix_locks;
+
+	for (i = first; i < last; i++) {
 		struct lock_struct *lock = &locks[i];
 		unsigned int tmp_count;
 
@@ -1092,6 +1234,7 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 
 		/* Work out overlaps. */
 		tmp_count = brlock_posix_split_merge(&tp[count], lock, plock);
+		posix_count = posix_count - 1 + tmp_count;
 
 		if (tmp_count == 0) {
 			/* plock overlapped the existing lock completely,
@@ -1112,12 +1255,12 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 
 			/* Optimisation... */
 			/* We know we're finished here as we can't overlap any
-			   more POSIX locks. Copy the rest of the lock array. */
+			   more POSIX locks. Copy the rest of the window. */
 
-			if (i < br_lck->num_locks - 1) {
+			if (i < last - 1) {
 				memcpy(&tp[count], &locks[i+1],
-					sizeof(*locks)*((br_lck->num_locks-1) - i));
-				count += ((br_lck->num_locks-1) - i);
+					sizeof(*locks)*((last-1) - i));
+				count += ((last-1) - i);
 			}
 			break;
 		}
@@ -1131,38 +1274,36 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 		return True;
 	}
 
+	/* Splitting may have moved the start of the upper part. */
+	if (!stable_sort_talloc(tp, tp, count, sizeof(struct lock_struct),
+				brl_lock_cmp)) {
+		TALLOC_FREE(tp);
+		DEBUG(10,("brl_unlock_posix: sort fail\n"));
+		return False;
+	}
+
+	if (!brl_replace_locks(br_lck, first, last, tp, count)) {
+		TALLOC_FREE(tp);
+		DEBUG(10,("brl_unlock_posix: realloc fail\n"));
+		return False;
+	}
+	TALLOC_FREE(tp);
+
+	br_lck->num_posix_locks = posix_count;
+
 	/* Unlock any POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
 		release_posix_lock_posix_flavour(br_lck->fsp,
 						plock->start,
 						plock->size,
 						&plock->context,
-						tp,
-						count);
-	}
-
-	/* Realloc so we don't leak entries per unlock call. */
-	if (count) {
-		tp = talloc_realloc(br_lck, tp, struct lock_struct, count);
-		if (!tp) {
-			DEBUG(10,("brl_unlock_posix: realloc fail\n"));
-			return False;
-		}
-	} else {
-		/* We deleted the last lock. */
-		TALLOC_FREE(tp);
-		tp = NULL;
+						br_lck->lock_data,
+						br_lck->num_locks);
 	}
 
 	contend_level2_oplocks_end(br_lck->fsp,
 				   LEVEL2_CONTEND_POSIX_BRL);
 
-	br_lck->num_locks = count;
-	TALLOC_FREE(br_lck->lock_data);
-	locks = tp;
-	br_lck->lock_data = tp;
-	br_lck->modified = True;
-
 	return True;
 }
 
@@ -1206,12 +1347,15 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 		  bool upgradable)
 {
 	bool ret = True;
-	unsigned int i;
+	unsigned int i, first, last;
 	struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
 
+	brl_lock_window(br_lck, rw_probe->start, rw_probe->size,
+			&first, &last);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i=first; i < last; i++) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1274,7 +1418,7 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 		enum brl_type *plock_type,
 		enum brl_flavour lock_flav)
 {
-	unsigned int i;
+	unsigned int i, first, last;
 	struct lock_struct lock;
 	const struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
@@ -1288,8 +1432,10 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_type = *plock_type;
 	lock.lock_flav = lock_flav;
 
+	brl_lock_window(br_lck, lock.start, lock.size, &first, &last);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i=first; i < last; i++) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1604,7 +1750,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
-	unsigned i;
+	unsigned i, num_locks;
 	struct lock_struct *locks = br_lck->lock_data;
 	bool have_persistent_lock = false;
 
@@ -1613,23 +1759,28 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
+	num_locks = 0;
 
-	while (i < br_lck->num_locks) {
+	for (i = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
 			/*
 			 * Autocleanup, the process conflicted and does not
-			 * exist anymore.
+			 * exist anymore. Keep the others sorted.
 			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
+			if (locks[i].lock_flav == POSIX_LOCK) {
+				br_lck->num_posix_locks -= 1;
+			}
 			continue;
 		}
 		if (locks[i].persistent) {
 			have_persistent_lock = true;
 		}
-		i += 1;
+		if (num_locks != i) {
+			locks[num_locks] = locks[i];
+		}
+		num_locks += 1;
 	}
+	br_lck->num_locks = num_locks;
 
 	if (br_lck->num_locks == 0) {
 		/* No locks - delete this entry. */
@@ -1683,6 +1834,8 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 {
 	size_t data_len = data.dsize;
 	uint32_t version;
+	unsigned int i;
+	bool sorted = true;
 
 	if (data_len == 0) {
 		return true;
@@ -1718,6 +1871,37 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 		DEBUG(1, ("talloc_memdup failed\n"));
 		return false;
 	}
+
+	br_lck->num_posix_locks = 0;
+	br_lck->max_size = 0;
+
+	for (i = 0; i < br_lck->num_locks; i++) {
+		const struct lock_struct *lck = &br_lck->lock_data[i];
+
+		if (lck->lock_flav == POSIX_LOCK) {
+			br_lck->num_posix_locks += 1;
+		}
+		br_lck->max_size = MAX(br_lck->max_size, brl_lock_size(lck));
+
+		if ((i > 0) && (lck->start < br_lck->lock_data[i-1].start)) {
+			sorted = false;
+		}
+	}
+
+	if (!sorted) {
+		/*
+		 * Written by an older smbd that did not keep the
+		 * locks sorted.
+		 */
+		if (!stable_sort_talloc(br_lck,
+					br_lck->lock_data,
+					br_lck->num_locks,
+					sizeof(struct lock_struct),
+					brl_lock_cmp)) {
+			DBG_WARNING("stable_sort_talloc failed\n");
+			return false;
+		}
+	}
 	return true;
 }
 
@@ -2075,7 +2259,7 @@ void brl_set_modified(struct byte_range_lock *br_lck, bool modified)
 bool file_has_brlocks(files_struct *fsp)
 {
 	struct byte_range_lock *br_lck = NULL;
-	uint i, num_locks;
+	uint num_locks;
 
 	if (!lp_locking(fsp->conn->params)) {
 		return false;
@@ -2091,14 +2275,8 @@ bool file_has_brlocks(files_struct *fsp)
 		return false;
 	}
 
-	for (i = 0; i < num_locks; i++) {
-		struct lock_struct *l = &br_lck->lock_data[i];
-
-		if (l->start < fsp->fsp_name->st.st_ex_size) {
-			return true;
-		}
-	}
-	return false;
+	/* The locks are sorted by start, the first one starts lowest. */
+	return (br_lck->lock_data[0].start < fsp->fsp_name->st.st_ex_size);
 }
 
 NTSTATUS brlock_wipe(struct dbwrap_wipe_flags flags)
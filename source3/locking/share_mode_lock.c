@@ -97,11 +97,20 @@ static NTSTATUS share_mode_g_lock_dump(TDB_DATA key,
 	return g_lock_dump(lock_ctx, key, fn, private_data);
 }
 
+/*
+ * Bumped with every change to the locked record, pointers
+ * into it obtained via locking_tdb_data_peek() are only
+ * valid as long as this does not change.
+ */
+static uint64_t share_mode_g_lock_write_gen;
+
 static NTSTATUS share_mode_g_lock_writev(TDB_DATA key,
 					 const TDB_DATA *dbufs,
 					 size_t num_dbufs,
 					 int flags)
 {
+	share_mode_g_lock_write_gen += 1;
+
 	if (share_mode_g_lock_within_cb(key)) {
 		return g_lock_lock_cb_writev(current_share_mode_glck,
 					     dbufs, num_dbufs, flags);
@@ -525,6 +534,53 @@ done:
 	return NT_STATUS_OK;
 }
 
+struct locking_tdb_data_peek_state {
+	const uint8_t *data;
+	size_t datalen;
+};
+
+static void locking_tdb_data_peek_fn(
+	struct server_id exclusive,
+	size_t num_shared,
+	const struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data)
+{
+	struct locking_tdb_data_peek_state *state = private_data;
+	state->data = data;
+	state->datalen = datalen;
+}
+
+/*
+ * Like locking_tdb_data_fetch(), but without copying the record.
+ *
+ * Only possible while we run in the g_lock_lock() callback for key,
+ * where the record can't change under us. The result points into
+ * the record and is only valid until the next
+ * share_mode_g_lock_writev(). Returns false if we can't peek, the
+ * caller has to use locking_tdb_data_fetch() then.
+ */
+static bool locking_tdb_data_peek(
+	TDB_DATA key, struct locking_tdb_data *ltdb)
+{
+	struct locking_tdb_data_peek_state state = { .data = NULL, };
+	NTSTATUS status;
+
+	if (!share_mode_g_lock_within_cb(key)) {
+		return false;
+	}
+
+	status = g_lock_lock_cb_dump(current_share_mode_glck,
+				     locking_tdb_data_peek_fn,
+				     &state);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	return locking_tdb_data_parse(ltdb, state.data, state.datalen);
+}
+
 static NTSTATUS locking_tdb_data_store(
 	TDB_DATA key,
 	const struct locking_tdb_data *ltdb,
@@ -2228,6 +2284,40 @@ done:
 	return NT_STATUS_IS_OK(status);
 }
 
+/*
+ * The share entries share_mode_forall_entries() walks over. Most
+ * walks don't change anything, so within the g_lock_lock() callback
+ * we look at the record in place and only copy it once an entry has
+ * to be changed or removed.
+ */
+struct share_mode_forall_entries_buf {
+	TDB_DATA key;
+	struct locking_tdb_data *ltdb;	/* our copy, NULL while peeking */
+	uint8_t *data;
+	size_t num_share_modes;
+	uint64_t write_gen;		/* for the peeked record */
+};
+
+static bool share_mode_forall_entries_copy(
+	struct share_mode_forall_entries_buf *buf)
+{
+	NTSTATUS status;
+
+	if (buf->ltdb != NULL) {
+		return true;
+	}
+
+	status = locking_tdb_data_fetch(buf->key, talloc_tos(), &buf->ltdb);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("locking_tdb_data_fetch failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+
+	buf->data = discard_const_p(uint8_t, buf->ltdb->share_entries);
+	return true;
+}
+
 static bool share_mode_for_one_entry(
 	struct share_mode_data *d,
 	bool (*fn)(struct share_mode_entry *e,
@@ -2235,12 +2325,11 @@ static bool share_mode_for_one_entry(
 		   void *private_data),
 	void *private_data,
 	size_t *i,
-	uint8_t *data,
-	size_t *num_share_modes,
+	struct share_mode_forall_entries_buf *buf,
 	bool *writeback)
 {
 	DATA_BLOB blob = {
-		.data = data + (*i) * SHARE_MODE_ENTRY_SIZE,
+		.data = buf->data + (*i) * SHARE_MODE_ENTRY_SIZE,
 		.length = SHARE_MODE_ENTRY_SIZE,
 	};
 	struct share_mode_entry e = {.pid.pid=0};
@@ -2249,6 +2338,7 @@ static bool share_mode_for_one_entry(
 	bool stop = false;
 	struct server_id e_pid;
 	uint64_t e_share_file_id;
+	bool ok;
 
 	ndr_err = ndr_pull_struct_blob_all_noalloc(
 		&blob,
@@ -2274,19 +2364,70 @@ static bool share_mode_for_one_entry(
 		  (int)modified,
 		  (int)e.stale);
 
+	if ((buf->ltdb == NULL) &&
+	    (buf->write_gen != share_mode_g_lock_write_gen)) {
+		struct locking_tdb_data peeked = { .num_share_entries = 0, };
+		struct share_mode_entry tmp;
+		bool found;
+
+		/*
+		 * fn changed the record, our pointers are gone. Look
+		 * at it again and find our place in it.
+		 */
+		ok = locking_tdb_data_peek(buf->key, &peeked);
+		if (ok) {
+			buf->data = discard_const_p(
+				uint8_t, peeked.share_entries);
+			buf->num_share_modes = peeked.num_share_entries;
+			buf->write_gen = share_mode_g_lock_write_gen;
+		} else {
+			ok = share_mode_forall_entries_copy(buf);
+			if (!ok) {
+				return true;
+			}
+			buf->num_share_modes = buf->ltdb->num_share_entries;
+		}
+
+		*i = share_mode_entry_find(buf->data,
+					   buf->num_share_modes,
+					   e_pid,
+					   e_share_file_id,
+					   &tmp,
+					   &found);
+		if (!found) {
+			/*
+			 * Gone, nothing left to update
+			 */
+			return stop;
+		}
+		blob.data = buf->data + (*i) * SHARE_MODE_ENTRY_SIZE;
+	}
+
+	if (e.stale || modified) {
+		ok = share_mode_forall_entries_copy(buf);
+		if (!ok) {
+			/*
+			 * Not much we can do, just ignore it
+			 */
+			*i += 1;
+			return stop;
+		}
+		blob.data = buf->data + (*i) * SHARE_MODE_ENTRY_SIZE;
+	}
+
 	if (e.stale) {
 		if (DEBUGLEVEL>=10) {
 			DBG_DEBUG("share_mode_entry:\n");
 			NDR_PRINT_DEBUG(share_mode_entry, &e);
 		}
 
-		if (*i < *num_share_modes) {
+		if (*i < buf->num_share_modes) {
 			memmove(blob.data,
 				blob.data + SHARE_MODE_ENTRY_SIZE,
-				(*num_share_modes - *i - 1) *
+				(buf->num_share_modes - *i - 1) *
 				SHARE_MODE_ENTRY_SIZE);
 		}
-		*num_share_modes -= 1;
+		buf->num_share_modes -= 1;
 		if (e.flags & SHARE_ENTRY_FLAG_PERSISTENT_OPEN) {
 			SMB_ASSERT(d->num_persistent > 0);
 			d->num_persistent--;
@@ -2342,13 +2483,15 @@ bool share_mode_forall_entries(
 {
 	struct file_id id = share_mode_lock_file_id(lck);
 	struct share_mode_data *d = NULL;
-	TDB_DATA key = locking_key(&id);
-	struct locking_tdb_data *ltdb = NULL;
-	uint8_t *share_entries = NULL;
-	size_t num_share_entries;
+	struct share_mode_forall_entries_buf buf = {
+		.key = locking_key(&id),
+	};
+	struct locking_tdb_data peeked = { .num_share_entries = 0, };
+	size_t orig_num_share_entries;
 	bool writeback = false;
 	NTSTATUS status;
 	bool stop = false;
+	bool ok;
 	size_t i;
 
 	status = share_mode_lock_access_private_data(lck, &d);
@@ -2362,26 +2505,35 @@ bool share_mode_forall_entries(
 		return false;
 	}
 
-	status = locking_tdb_data_fetch(key, talloc_tos(), &ltdb);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("locking_tdb_data_fetch failed: %s\n",
-			nt_errstr(status));
-		return false;
+	ok = locking_tdb_data_peek(buf.key, &peeked);
+	if (ok) {
+		buf.data = discard_const_p(uint8_t, peeked.share_entries);
+		buf.num_share_modes = peeked.num_share_entries;
+		buf.write_gen = share_mode_g_lock_write_gen;
+	} else {
+		status = locking_tdb_data_fetch(buf.key, talloc_tos(), &buf.ltdb);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("locking_tdb_data_fetch failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
+		buf.data = discard_const_p(uint8_t, buf.ltdb->share_entries);
+		buf.num_share_modes = buf.ltdb->num_share_entries;
 	}
-	DBG_DEBUG("num_share_modes=%zu\n", ltdb->num_share_entries);
+	orig_num_share_entries = buf.num_share_modes;
 
-	num_share_entries = ltdb->num_share_entries;
-	share_entries = discard_const_p(uint8_t, ltdb->share_entries);
+	DBG_DEBUG("num_share_modes=%zu, peeked=%d\n",
+		  buf.num_share_modes,
+		  (int)(buf.ltdb == NULL));
 
 	i = 0;
-	while (i<num_share_entries) {
+	while (i<buf.num_share_modes) {
 		stop = share_mode_for_one_entry(
 			d,
 			fn,
 			private_data,
 			&i,
-			share_entries,
-			&num_share_entries,
+			&buf,
 			&writeback);
 		if (stop) {
 			break;
@@ -2389,15 +2541,15 @@ bool share_mode_forall_entries(
 	}
 
 	DBG_DEBUG("num_share_entries=%zu, writeback=%d\n",
-		  num_share_entries,
+		  buf.num_share_modes,
 		  (int)writeback);
 
 	if (!writeback) {
-		TALLOC_FREE(ltdb);
+		TALLOC_FREE(buf.ltdb);
 		return true;
 	}
 
-	if ((ltdb->num_share_entries != 0 ) && (num_share_entries == 0)) {
+	if ((orig_num_share_entries != 0) && (buf.num_share_modes == 0)) {
 		/*
 		 * This routine wiped all share entries, let
 		 * share_mode_data_store() delete the record
@@ -2405,11 +2557,11 @@ bool share_mode_forall_entries(
 		d->modified = true;
 	}
 
-	ltdb->num_share_entries = num_share_entries;
-	ltdb->share_entries = share_entries;
+	buf.ltdb->num_share_entries = buf.num_share_modes;
+	buf.ltdb->share_entries = buf.data;
 
-	status = share_mode_data_ltdb_store(d, key, ltdb, NULL, 0);
-	TALLOC_FREE(ltdb);
+	status = share_mode_data_ltdb_store(d, buf.key, buf.ltdb, NULL, 0);
+	TALLOC_FREE(buf.ltdb);
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_ERR("share_mode_data_ltdb_store failed: %s\n",
 			nt_errstr(status));
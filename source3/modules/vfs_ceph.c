@@ -709,6 +709,19 @@ static ssize_t cephwrap_sendfile(struct vfs_handle_struct *handle,
 	return -1;
 }
 
+static int cephwrap_splice_read_fd(struct vfs_handle_struct *handle,
+				   files_struct *fsp,
+				   off_t offset,
+				   size_t n)
+{
+	/*
+	 * No kernel fd to splice from, libcephfs is in user space.
+	 */
+	DBG_DEBUG("[CEPH] cephwrap_splice_read_fd\n");
+	errno = ENOTSUP;
+	return -1;
+}
+
 static ssize_t cephwrap_recvfile(struct vfs_handle_struct *handle,
 			int fromfd,
 			files_struct *tofsp,
@@ -1829,6 +1842,7 @@ static struct vfs_fn_pointers ceph_fns = {
 	.pwrite_recv_fn = cephwrap_pwrite_recv,
 	.lseek_fn = cephwrap_lseek,
 	.sendfile_fn = cephwrap_sendfile,
+	.splice_read_fd_fn = cephwrap_splice_read_fd,
 	.recvfile_fn = cephwrap_recvfile,
 	.renameat_fn = cephwrap_renameat,
 	.fsync_send_fn = cephwrap_fsync_send,
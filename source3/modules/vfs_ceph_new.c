@@ -3328,6 +3328,22 @@ static ssize_t vfs_ceph_sendfile(struct vfs_handle_struct *handle,
 	return -1;
 }
 
+static int vfs_ceph_splice_read_fd(struct vfs_handle_struct *handle,
+				   files_struct *fsp,
+				   off_t offset,
+				   size_t n)
+{
+	/*
+	 * No kernel fd to splice from, libcephfs is in user space.
+	 */
+	DBG_DEBUG("[CEPH] splice_read_fd: fsp_name=%s offset=%zd n=%zu\n",
+		  fsp_str_dbg(fsp),
+		  offset,
+		  n);
+	errno = ENOTSUP;
+	return -1;
+}
+
 static ssize_t vfs_ceph_recvfile(struct vfs_handle_struct *handle,
 			int fromfd,
 			files_struct *tofsp,
@@ -4671,6 +4687,7 @@ static struct vfs_fn_pointers ceph_new_fns = {
 	.pwrite_recv_fn = vfs_ceph_pwrite_recv,
 	.lseek_fn = vfs_ceph_lseek,
 	.sendfile_fn = vfs_ceph_sendfile,
+	.splice_read_fd_fn = vfs_ceph_splice_read_fd,
 	.recvfile_fn = vfs_ceph_recvfile,
 	.renameat_fn = vfs_ceph_renameat,
 	.fsync_send_fn = vfs_ceph_fsync_send,
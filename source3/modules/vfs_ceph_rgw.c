@@ -2593,6 +2593,7 @@ static struct vfs_fn_pointers ceph_rgw_fns = {
 	.pwrite_recv_fn = vfs_not_implemented_pwrite_recv,
 	.lseek_fn = vfs_not_implemented_lseek,
 	.sendfile_fn = vfs_not_implemented_sendfile,
+	.splice_read_fd_fn = vfs_not_implemented_splice_read_fd,
 	.recvfile_fn = vfs_not_implemented_recvfile,
 	.renameat_fn = vfs_ceph_rgw_renameat,
 	.fsync_send_fn = vfs_ceph_rgw_fsync_send,
@@ -39,6 +39,10 @@
 #include "lib/util/string_wrappers.h"
 #include "lib/util/statvfs.h"
 
+#if defined(HAVE_LINUX_MAGIC_H)
+#include <linux/magic.h>
+#endif
+
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
 
@@ -205,6 +209,113 @@ static int vfswrap_fstatvfs(struct vfs_handle_struct *handle,
 	return ret;
 }
 
+#ifndef BCACHEFS_SUPER_MAGIC
+#define BCACHEFS_SUPER_MAGIC 0xca451a4e
+#endif
+
+#if defined(HAVE_FSTATFS) && defined(HAVE_LINUX_MAGIC_H) && \
+	defined(HAVE_LINUX_IOCTL)
+/*
+ * XFS_IOC_FSGEOMETRY_V4 from xfs_fs.h, the oldest geometry call that
+ * reports reflink support. It is not limited to root.
+ */
+#define XFS_FSOP_GEOM_FLAGS_REFLINK	(1 << 20)
+struct xfs_fsop_geom_v4 {
+	uint32_t blocksize;
+	uint32_t rtextsize;
+	uint32_t agblocks;
+	uint32_t agcount;
+	uint32_t logblocks;
+	uint32_t sectsize;
+	uint32_t inodesize;
+	uint32_t imaxpct;
+	uint64_t datablocks;
+	uint64_t rtblocks;
+	uint64_t rtextents;
+	uint64_t logstart;
+	unsigned char uuid[16];
+	uint32_t sunit;
+	uint32_t swidth;
+	int32_t version;
+	uint32_t flags;
+	uint32_t logsectsize;
+	uint32_t rtsectsize;
+	uint32_t dirblocksize;
+	uint32_t logsunit;
+};
+#define XFS_IOC_FSGEOMETRY_V4 _IOR('X', 124, struct xfs_fsop_geom_v4)
+
+/*
+ * XFS filesystems can be created with "reflink=0", ask the
+ * filesystem instead of going by its type.
+ */
+static bool vfswrap_xfs_has_reflink(struct connection_struct *conn)
+{
+	struct xfs_fsop_geom_v4 geom = {};
+	int fd, ret;
+
+	fd = open(conn->connectpath, O_RDONLY|O_DIRECTORY);
+	if (fd == -1) {
+		DBG_DEBUG("open of %s failed: %s\n",
+			  conn->connectpath,
+			  strerror(errno));
+		return false;
+	}
+
+	ret = ioctl(fd, XFS_IOC_FSGEOMETRY_V4, &geom);
+	close(fd);
+	if (ret == -1) {
+		DBG_DEBUG("XFS_IOC_FSGEOMETRY_V4 on %s failed: %s\n",
+			  conn->connectpath,
+			  strerror(errno));
+		return false;
+	}
+
+	return (geom.flags & XFS_FSOP_GEOM_FLAGS_REFLINK) != 0;
+}
+#endif
+
+/*
+ * Check whether the share lives on a filesystem that can share blocks
+ * between files, so FSCTL_DUP_EXTENTS_TO_FILE can be mapped to
+ * FICLONERANGE and server side copies can be done by cloning extents.
+ *
+ * This is called once per tree connect. btrfs and bcachefs always
+ * support reflinks, XFS only if it was created with them.
+ * "vfs_default:reflink = no" turns this off for a share.
+ */
+static bool vfswrap_fs_supports_reflink(struct connection_struct *conn)
+{
+#if defined(HAVE_FSTATFS) && defined(HAVE_LINUX_MAGIC_H) && \
+	defined(HAVE_LINUX_IOCTL)
+	struct statfs sbuf = {};
+	int ret;
+
+	if (!lp_parm_bool(SNUM(conn), "vfs_default", "reflink", true)) {
+		return false;
+	}
+
+	ret = statfs(conn->connectpath, &sbuf);
+	if (ret == -1) {
+		DBG_DEBUG("statfs on %s failed: %s\n",
+			  conn->connectpath,
+			  strerror(errno));
+		return false;
+	}
+
+	switch (sbuf.f_type) {
+	case BTRFS_SUPER_MAGIC:
+	case BCACHEFS_SUPER_MAGIC:
+		return true;
+	case XFS_SUPER_MAGIC:
+		return vfswrap_xfs_has_reflink(conn);
+	default:
+		break;
+	}
+#endif
+	return false;
+}
+
 static uint32_t vfswrap_fs_capabilities(struct vfs_handle_struct *handle,
 		enum timestamp_set_resolution *p_ts_res)
 {
@@ -214,6 +325,10 @@ static uint32_t vfswrap_fs_capabilities(struct vfs_handle_struct *handle,
 	caps |= FILE_VOLUME_QUOTAS;
 #endif
 
+	if (vfswrap_fs_supports_reflink(handle->conn)) {
+		caps |= FILE_SUPPORTS_BLOCK_REFCOUNTING;
+	}
+
 	return caps;
 }
 
@@ -812,6 +927,157 @@ static int vfswrap_close(vfs_handle_struct *handle, files_struct *fsp)
 	return result;
 }
 
+struct vfswrap_close_state {
+	int ret;
+	int fd;
+
+	struct vfs_aio_state vfs_aio_state;
+	SMBPROFILE_BYTES_ASYNC_STATE_X(profile_bytes, profile_bytes_x);
+};
+
+static void vfs_close_do(void *private_data);
+static void vfs_close_done(struct tevent_req *subreq);
+static int vfs_close_state_destructor(struct vfswrap_close_state *state);
+
+static struct tevent_req *vfswrap_close_send(struct vfs_handle_struct *handle,
+					     TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct files_struct *fsp)
+{
+	struct tevent_req *req, *subreq;
+	struct vfswrap_close_state *state;
+	bool simple_close;
+
+	req = tevent_req_create(mem_ctx, &state, struct vfswrap_close_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	state->ret = -1;
+	state->fd = fsp_get_pathref_fd(fsp);
+
+	/*
+	 * Only a plain close() can be moved to a worker thread. With
+	 * POSIX locking fd_close_posix() has to look at the lock
+	 * reference counts and the pending close database, do that
+	 * synchronously as before.
+	 */
+	simple_close = !lp_locking(fsp->conn->params) ||
+		       !lp_posix_locking(fsp->conn->params) ||
+		       fsp->fsp_flags.use_ofd_locks;
+
+	if (!simple_close) {
+		state->ret = vfswrap_close(handle, fsp);
+		if (state->ret == -1) {
+			tevent_req_error(req, errno);
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START_X(SNUM(handle->conn),
+				       syscall_asys_close,
+				       state->profile_bytes,
+				       state->profile_bytes_x,
+				       0);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE_X(state->profile_bytes,
+					  state->profile_bytes_x);
+
+	subreq = pthreadpool_tevent_job_send(
+		state, ev, handle->conn->sconn->pool, vfs_close_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, vfs_close_done, req);
+
+	talloc_set_destructor(state, vfs_close_state_destructor);
+
+	return req;
+}
+
+static void vfs_close_do(void *private_data)
+{
+	struct vfswrap_close_state *state = talloc_get_type_abort(
+		private_data, struct vfswrap_close_state);
+	struct timespec start_time;
+	struct timespec end_time;
+
+	SMBPROFILE_BYTES_ASYNC_SET_BUSY_X(state->profile_bytes,
+					  state->profile_bytes_x);
+
+	PROFILE_TIMESTAMP(&start_time);
+
+	/*
+	 * Don't retry on EINTR, on Linux the fd is gone even if
+	 * close() was interrupted.
+	 */
+	state->ret = close(state->fd);
+	if (state->ret == -1) {
+		state->vfs_aio_state.error = errno;
+	}
+
+	PROFILE_TIMESTAMP(&end_time);
+
+	state->vfs_aio_state.duration = nsec_time_diff(&end_time, &start_time);
+
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE_X(state->profile_bytes,
+					  state->profile_bytes_x);
+}
+
+static int vfs_close_state_destructor(struct vfswrap_close_state *state)
+{
+	return -1;
+}
+
+static void vfs_close_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfswrap_close_state *state = tevent_req_data(
+		req, struct vfswrap_close_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	SMBPROFILE_BYTES_ASYNC_END_X(state->profile_bytes,
+				     state->profile_bytes_x);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_error(req, ret);
+			return;
+		}
+		/*
+		 * If we get EAGAIN from pthreadpool_tevent_job_recv() this
+		 * means the lower level pthreadpool failed to create a new
+		 * thread. Fallback to sync processing in that case to allow
+		 * some progress for the client.
+		 */
+		vfs_close_do(state);
+	}
+
+	if (state->ret == -1) {
+		tevent_req_error(req, state->vfs_aio_state.error);
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static int vfswrap_close_recv(struct tevent_req *req,
+			      struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfswrap_close_state *state = tevent_req_data(
+		req, struct vfswrap_close_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
 static ssize_t vfswrap_pread(vfs_handle_struct *handle, files_struct *fsp, void *data,
 			size_t n, off_t offset)
 {
@@ -1279,6 +1545,16 @@ static int vfswrap_fsync_recv(struct tevent_req *req,
 	return state->ret;
 }
 
+static NTSTATUS vfswrap_flush_cached_writes(vfs_handle_struct *handle,
+					    files_struct *fsp)
+{
+	/*
+	 * We don't keep acknowledged writes in memory, they went
+	 * straight to the kernel.
+	 */
+	return NT_STATUS_OK;
+}
+
 static off_t vfswrap_lseek(vfs_handle_struct *handle, files_struct *fsp, off_t offset, int whence)
 {
 	off_t result = 0;
@@ -1313,6 +1589,25 @@ static ssize_t vfswrap_sendfile(vfs_handle_struct *handle, int tofd, files_struc
 	return result;
 }
 
+/*
+ * The kernel fd is all smbd needs to splice from the page cache.
+ * Hand out a dup, the caller owns it and may still use it after a
+ * CLOSE later in the same compound.
+ */
+static int vfswrap_splice_read_fd(vfs_handle_struct *handle,
+				  files_struct *fsp,
+				  off_t offset,
+				  size_t n)
+{
+	int fd = fsp_get_io_fd(fsp);
+
+	if (fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	return dup(fd);
+}
+
 static ssize_t vfswrap_recvfile(vfs_handle_struct *handle,
 			int fromfd,
 			files_struct *tofsp,
@@ -2373,6 +2668,7 @@ static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 	ssize_t nwritten;
 	NTSTATUS status;
 	bool same_file;
+	bool try_reflink;
 	bool ok;
 	static bool try_copy_file_range = true;
 
@@ -2421,7 +2717,10 @@ static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 		goto done;
 	}
 
-	if (!try_copy_file_range) {
+	try_reflink = (state->dst_fsp->conn->fs_capabilities &
+		       FILE_SUPPORTS_BLOCK_REFCOUNTING);
+
+	if (!try_copy_file_range && !try_reflink) {
 		return NT_STATUS_MORE_PROCESSING_REQUIRED;
 	}
 
@@ -2458,6 +2757,41 @@ static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 		return NT_STATUS_FILE_LOCK_CONFLICT;
 	}
 
+	if (try_reflink) {
+		int ret;
+
+		/*
+		 * Try to clone the extents first, this is instant and
+		 * doesn't use additional space. This only works for
+		 * block aligned ranges on the same filesystem, on any
+		 * error fall back to copy_file_range().
+		 */
+		ret = copy_reflink(fsp_get_io_fd(state->src_fsp),
+				   state->src_off,
+				   fsp_get_io_fd(state->dst_fsp),
+				   state->dst_off,
+				   state->remaining);
+		if (ret == 0) {
+			state->src_off += state->remaining;
+			state->dst_off += state->remaining;
+			state->copied += state->remaining;
+			state->remaining = 0;
+			goto done;
+		}
+		DBG_DEBUG("copy_reflink src [%s]:[%jd] dst [%s]:[%jd] "
+			  "n [%jd] failed: %s\n",
+			  fsp_str_dbg(state->src_fsp),
+			  (intmax_t)state->src_off,
+			  fsp_str_dbg(state->dst_fsp),
+			  (intmax_t)state->dst_off,
+			  (intmax_t)state->remaining,
+			  strerror(errno));
+	}
+
+	if (!try_copy_file_range) {
+		return NT_STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
 	while (state->remaining > 0) {
 		nwritten = copy_file_range(fsp_get_io_fd(state->src_fsp),
 					   &state->src_off,
@@ -3911,6 +4245,484 @@ static ssize_t vfswrap_getxattrat_recv(struct tevent_req *req,
 	return xattr_size;
 }
 
+/****************************************************************
+ Asynchronous namespace operations.
+
+ mkdirat, renameat, unlinkat and linkat only take directory fds and
+ names, so the worker thread just needs the callers credentials, it
+ doesn't have to change its working directory.
+*****************************************************************/
+
+enum vfswrap_nsop {
+	VFSWRAP_NSOP_MKDIRAT,
+	VFSWRAP_NSOP_RENAMEAT,
+	VFSWRAP_NSOP_UNLINKAT,
+	VFSWRAP_NSOP_LINKAT,
+};
+
+struct vfswrap_nsop_state {
+	struct vfs_pthreadpool_job_state job_state;
+
+	enum vfswrap_nsop op;
+	files_struct *dst_dir_fsp;
+	const struct smb_filename *dst_smb_fname;
+	mode_t mode;
+	int flags;
+	struct vfs_rename_how how;
+
+	/*
+	 * Copies for the worker thread, talloced off state, see
+	 * struct vfs_pthreadpool_job_state.
+	 */
+	int src_dirfd;
+	int dst_dirfd;
+	char *dst_name;
+
+	int result;
+};
+
+static int vfswrap_nsop_state_destructor(struct vfswrap_nsop_state *state)
+{
+	return -1;
+}
+
+static void vfswrap_nsop_do_sync(struct tevent_req *req);
+static void vfswrap_nsop_do_async(void *private_data);
+static void vfswrap_nsop_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfswrap_nsop_create(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			enum vfswrap_nsop op,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			struct vfswrap_nsop_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct vfswrap_nsop_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state, struct vfswrap_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct vfswrap_nsop_state) {
+		.job_state.ev = ev,
+		.job_state.handle = handle,
+		.job_state.dir_fsp = dir_fsp,
+		.job_state.smb_fname = smb_fname,
+		.op = op,
+		.src_dirfd = -1,
+		.dst_dirfd = -1,
+		.result = -1,
+	};
+
+	*pstate = state;
+	return req;
+}
+
+static struct tevent_req *vfswrap_nsop_start(struct tevent_req *req)
+{
+	struct vfswrap_nsop_state *state = tevent_req_data(
+		req, struct vfswrap_nsop_state);
+	struct tevent_context *ev = state->job_state.ev;
+	files_struct *dir_fsp = state->job_state.dir_fsp;
+	struct tevent_req *subreq = NULL;
+	bool do_async;
+
+	do_async = vfswrap_check_async_with_thread_creds(
+		dir_fsp->conn->sconn->pool);
+	if (!do_async) {
+		vfswrap_nsop_do_sync(req);
+		return tevent_req_post(req, ev);
+	}
+
+	state->src_dirfd = fsp_get_pathref_fd(dir_fsp);
+	if (state->src_dirfd == -1) {
+		DBG_ERR("Need a valid directory fd\n");
+		tevent_req_error(req, EINVAL);
+		return tevent_req_post(req, ev);
+	}
+
+	state->job_state.name = talloc_strdup(
+		state, state->job_state.smb_fname->base_name);
+	if (tevent_req_nomem(state->job_state.name, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (state->dst_dir_fsp != NULL) {
+		state->dst_dirfd = fsp_get_pathref_fd(state->dst_dir_fsp);
+		if (state->dst_dirfd == -1) {
+			DBG_ERR("Need a valid directory fd\n");
+			tevent_req_error(req, EINVAL);
+			return tevent_req_post(req, ev);
+		}
+
+		state->dst_name = talloc_strdup(
+			state, state->dst_smb_fname->base_name);
+		if (tevent_req_nomem(state->dst_name, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	/*
+	 * Unlike getxattrat these are also called under become_root()
+	 * or with a pushed security context (e.g. the delete on close
+	 * token), so take whatever we are currently running as.
+	 */
+	state->job_state.token = copy_unix_token(
+		state, get_current_utok(dir_fsp->conn));
+	if (tevent_req_nomem(state->job_state.token, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE_X(state->job_state.profile_bytes,
+					  state->job_state.profile_bytes_x);
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     ev,
+					     dir_fsp->conn->sconn->pool,
+					     vfswrap_nsop_do_async,
+					     state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, vfswrap_nsop_done, req);
+
+	talloc_set_destructor(state, vfswrap_nsop_state_destructor);
+
+	return req;
+}
+
+static void vfswrap_nsop_do_sync(struct tevent_req *req)
+{
+	struct vfswrap_nsop_state *state = tevent_req_data(
+		req, struct vfswrap_nsop_state);
+	struct vfs_handle_struct *handle = state->job_state.handle;
+	files_struct *dir_fsp = state->job_state.dir_fsp;
+	const struct smb_filename *smb_fname = state->job_state.smb_fname;
+
+	switch (state->op) {
+	case VFSWRAP_NSOP_MKDIRAT:
+		state->result = vfswrap_mkdirat(handle,
+						dir_fsp,
+						smb_fname,
+						state->mode);
+		break;
+	case VFSWRAP_NSOP_RENAMEAT:
+		state->result = vfswrap_renameat(handle,
+						 dir_fsp,
+						 smb_fname,
+						 state->dst_dir_fsp,
+						 state->dst_smb_fname,
+						 &state->how);
+		break;
+	case VFSWRAP_NSOP_UNLINKAT:
+		state->result = vfswrap_unlinkat(handle,
+						 dir_fsp,
+						 smb_fname,
+						 state->flags);
+		break;
+	case VFSWRAP_NSOP_LINKAT:
+		state->result = vfswrap_linkat(handle,
+					       dir_fsp,
+					       smb_fname,
+					       state->dst_dir_fsp,
+					       state->dst_smb_fname,
+					       state->flags);
+		break;
+	}
+
+	if (state->result == -1) {
+		tevent_req_error(req, errno);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static void vfswrap_nsop_do_async(void *private_data)
+{
+	struct vfswrap_nsop_state *state = talloc_get_type_abort(
+		private_data, struct vfswrap_nsop_state);
+	struct timespec start_time;
+	struct timespec end_time;
+	int rename_flags = 0;
+	int ret;
+
+	PROFILE_TIMESTAMP(&start_time);
+	SMBPROFILE_BYTES_ASYNC_SET_BUSY_X(state->job_state.profile_bytes,
+					  state->job_state.profile_bytes_x);
+
+	/* Become the correct credential on this thread. */
+	ret = set_thread_credentials(state->job_state.token->uid,
+				     state->job_state.token->gid,
+				     (size_t)state->job_state.token->ngroups,
+				     state->job_state.token->groups);
+	if (ret != 0) {
+		state->result = -1;
+		state->job_state.vfs_aio_state.error = errno;
+		goto end_profile;
+	}
+
+	switch (state->op) {
+	case VFSWRAP_NSOP_MKDIRAT:
+		state->result = mkdirat(state->src_dirfd,
+					state->job_state.name,
+					state->mode);
+		break;
+	case VFSWRAP_NSOP_RENAMEAT:
+		if (state->how.flags & VFS_RENAME_HOW_NO_REPLACE) {
+			rename_flags |= RENAME_NOREPLACE;
+		}
+		state->result = renameat2(state->src_dirfd,
+					  state->job_state.name,
+					  state->dst_dirfd,
+					  state->dst_name,
+					  rename_flags);
+		break;
+	case VFSWRAP_NSOP_UNLINKAT:
+		state->result = unlinkat(state->src_dirfd,
+					 state->job_state.name,
+					 state->flags);
+		break;
+	case VFSWRAP_NSOP_LINKAT:
+		state->result = linkat(state->src_dirfd,
+				       state->job_state.name,
+				       state->dst_dirfd,
+				       state->dst_name,
+				       state->flags);
+		break;
+	}
+	if (state->result == -1) {
+		state->job_state.vfs_aio_state.error = errno;
+	}
+
+end_profile:
+	PROFILE_TIMESTAMP(&end_time);
+	state->job_state.vfs_aio_state.duration = nsec_time_diff(&end_time, &start_time);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE_X(state->job_state.profile_bytes,
+					  state->job_state.profile_bytes_x);
+}
+
+static void vfswrap_nsop_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfswrap_nsop_state *state = tevent_req_data(
+		req, struct vfswrap_nsop_state);
+	int ret;
+	bool ok;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	SMBPROFILE_BYTES_ASYNC_END_X(state->job_state.profile_bytes,
+				     state->job_state.profile_bytes_x);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_error(req, ret);
+			return;
+		}
+		/*
+		 * If we get EAGAIN from pthreadpool_tevent_job_recv() this
+		 * means the lower level pthreadpool failed to create a new
+		 * thread. Fallback to sync processing in that case to allow
+		 * some progress for the client, as the user the job
+		 * would have run as.
+		 */
+		ok = push_sec_ctx();
+		if (!ok) {
+			tevent_req_error(req, ENOMEM);
+			return;
+		}
+		set_sec_ctx(state->job_state.token->uid,
+			    state->job_state.token->gid,
+			    state->job_state.token->ngroups,
+			    state->job_state.token->groups,
+			    NULL);
+		vfswrap_nsop_do_sync(req);
+		pop_sec_ctx();
+		return;
+	}
+
+	if (state->result == -1) {
+		tevent_req_error(req, state->job_state.vfs_aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static int vfswrap_nsop_recv(struct tevent_req *req,
+			     struct vfs_aio_state *aio_state)
+{
+	struct vfswrap_nsop_state *state = tevent_req_data(
+		req, struct vfswrap_nsop_state);
+	int result;
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	*aio_state = state->job_state.vfs_aio_state;
+	result = state->result;
+
+	tevent_req_received(req);
+	return result;
+}
+
+static struct tevent_req *vfswrap_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode)
+{
+	struct tevent_req *req = NULL;
+	struct vfswrap_nsop_state *state = NULL;
+
+	req = vfswrap_nsop_create(mem_ctx,
+				  ev,
+				  handle,
+				  VFSWRAP_NSOP_MKDIRAT,
+				  dirfsp,
+				  smb_fname,
+				  &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->mode = mode;
+
+	SMBPROFILE_BYTES_ASYNC_START_X(SNUM(handle->conn),
+				       syscall_asys_mkdirat,
+				       state->job_state.profile_bytes,
+				       state->job_state.profile_bytes_x,
+				       0);
+
+	return vfswrap_nsop_start(req);
+}
+
+static struct tevent_req *vfswrap_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dirfsp,
+			const struct smb_filename *smb_fname_src,
+			files_struct *dst_dirfsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how)
+{
+	struct tevent_req *req = NULL;
+	struct vfswrap_nsop_state *state = NULL;
+
+	SMB_ASSERT(!is_named_stream(smb_fname_src));
+	SMB_ASSERT(!is_named_stream(smb_fname_dst));
+
+	req = vfswrap_nsop_create(mem_ctx,
+				  ev,
+				  handle,
+				  VFSWRAP_NSOP_RENAMEAT,
+				  src_dirfsp,
+				  smb_fname_src,
+				  &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->dst_dir_fsp = dst_dirfsp;
+	state->dst_smb_fname = smb_fname_dst;
+	state->how = *how;
+
+	SMBPROFILE_BYTES_ASYNC_START_X(SNUM(handle->conn),
+				       syscall_asys_renameat,
+				       state->job_state.profile_bytes,
+				       state->job_state.profile_bytes_x,
+				       0);
+
+	if (how->flags & ~VFS_RENAME_HOW_NO_REPLACE) {
+		tevent_req_error(req, EINVAL);
+		return tevent_req_post(req, ev);
+	}
+
+	return vfswrap_nsop_start(req);
+}
+
+static struct tevent_req *vfswrap_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct vfswrap_nsop_state *state = NULL;
+
+	SMB_ASSERT(!is_named_stream(smb_fname));
+
+	req = vfswrap_nsop_create(mem_ctx,
+				  ev,
+				  handle,
+				  VFSWRAP_NSOP_UNLINKAT,
+				  dirfsp,
+				  smb_fname,
+				  &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->flags = flags;
+
+	SMBPROFILE_BYTES_ASYNC_START_X(SNUM(handle->conn),
+				       syscall_asys_unlinkat,
+				       state->job_state.profile_bytes,
+				       state->job_state.profile_bytes_x,
+				       0);
+
+	return vfswrap_nsop_start(req);
+}
+
+static struct tevent_req *vfswrap_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dirfsp,
+			const struct smb_filename *old_smb_fname,
+			files_struct *dst_dirfsp,
+			const struct smb_filename *new_smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct vfswrap_nsop_state *state = NULL;
+
+	SMB_ASSERT(!is_named_stream(old_smb_fname));
+	SMB_ASSERT(!is_named_stream(new_smb_fname));
+
+	req = vfswrap_nsop_create(mem_ctx,
+				  ev,
+				  handle,
+				  VFSWRAP_NSOP_LINKAT,
+				  src_dirfsp,
+				  old_smb_fname,
+				  &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->dst_dir_fsp = dst_dirfsp;
+	state->dst_smb_fname = new_smb_fname;
+	state->flags = flags;
+
+	SMBPROFILE_BYTES_ASYNC_START_X(SNUM(handle->conn),
+				       syscall_asys_linkat,
+				       state->job_state.profile_bytes,
+				       state->job_state.profile_bytes_x,
+				       0);
+
+	return vfswrap_nsop_start(req);
+}
+
 static ssize_t vfswrap_flistxattr(struct vfs_handle_struct *handle, struct files_struct *fsp, char *list, size_t size)
 {
 	int fd = fsp_get_pathref_fd(fsp);
@@ -4098,6 +4910,8 @@ static struct vfs_fn_pointers vfs_default_fns = {
 	.freaddir_attr_fn = vfswrap_freaddir_attr,
 	.rewind_dir_fn = vfswrap_rewinddir,
 	.mkdirat_fn = vfswrap_mkdirat,
+	.mkdirat_send_fn = vfswrap_mkdirat_send,
+	.mkdirat_recv_fn = vfswrap_nsop_recv,
 	.closedir_fn = vfswrap_closedir,
 
 	/* File operations */
@@ -4105,6 +4919,8 @@ static struct vfs_fn_pointers vfs_default_fns = {
 	.openat_fn = vfswrap_openat,
 	.create_file_fn = vfswrap_create_file,
 	.close_fn = vfswrap_close,
+	.close_send_fn = vfswrap_close_send,
+	.close_recv_fn = vfswrap_close_recv,
 	.pread_fn = vfswrap_pread,
 	.pread_send_fn = vfswrap_pread_send,
 	.pread_recv_fn = vfswrap_pread_recv,
@@ -4113,17 +4929,23 @@ static struct vfs_fn_pointers vfs_default_fns = {
 	.pwrite_recv_fn = vfswrap_pwrite_recv,
 	.lseek_fn = vfswrap_lseek,
 	.sendfile_fn = vfswrap_sendfile,
+	.splice_read_fd_fn = vfswrap_splice_read_fd,
 	.recvfile_fn = vfswrap_recvfile,
 	.renameat_fn = vfswrap_renameat,
+	.renameat_send_fn = vfswrap_renameat_send,
+	.renameat_recv_fn = vfswrap_nsop_recv,
 	.rename_stream_fn = vfswrap_rename_stream,
 	.fsync_send_fn = vfswrap_fsync_send,
 	.fsync_recv_fn = vfswrap_fsync_recv,
+	.flush_cached_writes_fn = vfswrap_flush_cached_writes,
 	.stat_fn = vfswrap_stat,
 	.fstat_fn = vfswrap_fstat,
 	.lstat_fn = vfswrap_lstat,
 	.fstatat_fn = vfswrap_fstatat,
 	.get_alloc_size_fn = vfswrap_get_alloc_size,
 	.unlinkat_fn = vfswrap_unlinkat,
+	.unlinkat_send_fn = vfswrap_unlinkat_send,
+	.unlinkat_recv_fn = vfswrap_nsop_recv,
 	.fchmod_fn = vfswrap_fchmod,
 	.fchown_fn = vfswrap_fchown,
 	.lchown_fn = vfswrap_lchown,
@@ -4139,6 +4961,8 @@ static struct vfs_fn_pointers vfs_default_fns = {
 	.symlinkat_fn = vfswrap_symlinkat,
 	.readlinkat_fn = vfswrap_readlinkat,
 	.linkat_fn = vfswrap_linkat,
+	.linkat_send_fn = vfswrap_linkat_send,
+	.linkat_recv_fn = vfswrap_nsop_recv,
 	.mknodat_fn = vfswrap_mknodat,
 	.realpath_fn = vfswrap_realpath,
 	.fchflags_fn = vfswrap_fchflags,
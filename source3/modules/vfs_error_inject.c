@@ -20,6 +20,7 @@
 #include "includes.h"
 #include "smbd/smbd.h"
 #include "librpc/gen_ndr/ndr_open_files.h"
+#include "lib/util/tevent_unix.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
@@ -110,6 +111,76 @@ static ssize_t vfs_error_inject_pwrite(vfs_handle_struct *handle,
 	return SMB_VFS_NEXT_PWRITE(handle, fsp, data, n, offset);
 }
 
+struct vfs_error_inject_pwrite_state {
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void vfs_error_inject_pwrite_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_error_inject_pwrite_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	const void *data,
+	size_t n,
+	off_t offset)
+{
+	struct tevent_req *req = NULL, *subreq = NULL;
+	struct vfs_error_inject_pwrite_state *state = NULL;
+	int error;
+
+	req = tevent_req_create(mem_ctx,
+				&state,
+				struct vfs_error_inject_pwrite_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	error = inject_unix_error("pwrite", handle);
+	if (error != 0) {
+		state->ret = -1;
+		state->vfs_aio_state.error = error;
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp, data,
+					 n, offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, vfs_error_inject_pwrite_done, req);
+	return req;
+}
+
+static void vfs_error_inject_pwrite_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_error_inject_pwrite_state *state = tevent_req_data(
+		req, struct vfs_error_inject_pwrite_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_error_inject_pwrite_recv(
+	struct tevent_req *req,
+	struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfs_error_inject_pwrite_state *state = tevent_req_data(
+		req, struct vfs_error_inject_pwrite_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
 static int vfs_error_inject_openat(struct vfs_handle_struct *handle,
 				   const struct files_struct *dirfsp,
 				   const struct smb_filename *smb_fname,
@@ -286,6 +357,8 @@ static NTSTATUS vfs_error_inject_durable_reconnect(struct vfs_handle_struct *han
 static struct vfs_fn_pointers vfs_error_inject_fns = {
 	.chdir_fn = vfs_error_inject_chdir,
 	.pwrite_fn = vfs_error_inject_pwrite,
+	.pwrite_send_fn = vfs_error_inject_pwrite_send,
+	.pwrite_recv_fn = vfs_error_inject_pwrite_recv,
 	.openat_fn = vfs_error_inject_openat,
 	.unlinkat_fn = vfs_error_inject_unlinkat,
 	.durable_reconnect_fn = vfs_error_inject_durable_reconnect,
@@ -114,6 +114,8 @@ typedef enum _vfs_op_type {
 	SMB_VFS_OP_READDIR,
 	SMB_VFS_OP_REWINDDIR,
 	SMB_VFS_OP_MKDIRAT,
+	SMB_VFS_OP_MKDIRAT_SEND,
+	SMB_VFS_OP_MKDIRAT_RECV,
 	SMB_VFS_OP_CLOSEDIR,
 
 	/* File operations */
@@ -122,6 +124,8 @@ typedef enum _vfs_op_type {
 	SMB_VFS_OP_OPENAT,
 	SMB_VFS_OP_CREATE_FILE,
 	SMB_VFS_OP_CLOSE,
+	SMB_VFS_OP_CLOSE_SEND,
+	SMB_VFS_OP_CLOSE_RECV,
 	SMB_VFS_OP_READ,
 	SMB_VFS_OP_PREAD,
 	SMB_VFS_OP_PREAD_SEND,
@@ -132,17 +136,23 @@ typedef enum _vfs_op_type {
 	SMB_VFS_OP_PWRITE_RECV,
 	SMB_VFS_OP_LSEEK,
 	SMB_VFS_OP_SENDFILE,
+	SMB_VFS_OP_SPLICE_READ_FD,
 	SMB_VFS_OP_RECVFILE,
 	SMB_VFS_OP_RENAMEAT,
+	SMB_VFS_OP_RENAMEAT_SEND,
+	SMB_VFS_OP_RENAMEAT_RECV,
 	SMB_VFS_OP_RENAME_STREAM,
 	SMB_VFS_OP_FSYNC_SEND,
 	SMB_VFS_OP_FSYNC_RECV,
+	SMB_VFS_OP_FLUSH_CACHED_WRITES,
 	SMB_VFS_OP_STAT,
 	SMB_VFS_OP_FSTAT,
 	SMB_VFS_OP_LSTAT,
 	SMB_VFS_OP_FSTATAT,
 	SMB_VFS_OP_GET_ALLOC_SIZE,
 	SMB_VFS_OP_UNLINKAT,
+	SMB_VFS_OP_UNLINKAT_SEND,
+	SMB_VFS_OP_UNLINKAT_RECV,
 	SMB_VFS_OP_FCHMOD,
 	SMB_VFS_OP_FCHOWN,
 	SMB_VFS_OP_LCHOWN,
@@ -159,6 +169,8 @@ typedef enum _vfs_op_type {
 	SMB_VFS_OP_SYMLINKAT,
 	SMB_VFS_OP_READLINKAT,
 	SMB_VFS_OP_LINKAT,
+	SMB_VFS_OP_LINKAT_SEND,
+	SMB_VFS_OP_LINKAT_RECV,
 	SMB_VFS_OP_MKNODAT,
 	SMB_VFS_OP_REALPATH,
 	SMB_VFS_OP_FCHFLAGS,
@@ -252,11 +264,15 @@ static struct {
 	{ SMB_VFS_OP_READDIR,	"readdir" },
 	{ SMB_VFS_OP_REWINDDIR, "rewinddir" },
 	{ SMB_VFS_OP_MKDIRAT,	"mkdirat" },
+	{ SMB_VFS_OP_MKDIRAT_SEND,	"mkdirat_send" },
+	{ SMB_VFS_OP_MKDIRAT_RECV,	"mkdirat_recv" },
 	{ SMB_VFS_OP_CLOSEDIR,	"closedir" },
 	{ SMB_VFS_OP_OPEN,	"open" },
 	{ SMB_VFS_OP_OPENAT,	"openat" },
 	{ SMB_VFS_OP_CREATE_FILE, "create_file" },
 	{ SMB_VFS_OP_CLOSE,	"close" },
+	{ SMB_VFS_OP_CLOSE_SEND,	"close_send" },
+	{ SMB_VFS_OP_CLOSE_RECV,	"close_recv" },
 	{ SMB_VFS_OP_READ,	"read" },
 	{ SMB_VFS_OP_PREAD,	"pread" },
 	{ SMB_VFS_OP_PREAD_SEND,	"pread_send" },
@@ -267,17 +283,23 @@ static struct {
 	{ SMB_VFS_OP_PWRITE_RECV,	"pwrite_recv" },
 	{ SMB_VFS_OP_LSEEK,	"lseek" },
 	{ SMB_VFS_OP_SENDFILE,	"sendfile" },
+	{ SMB_VFS_OP_SPLICE_READ_FD,	"splice_read_fd" },
 	{ SMB_VFS_OP_RECVFILE,  "recvfile" },
 	{ SMB_VFS_OP_RENAMEAT,	"renameat" },
+	{ SMB_VFS_OP_RENAMEAT_SEND,	"renameat_send" },
+	{ SMB_VFS_OP_RENAMEAT_RECV,	"renameat_recv" },
 	{ SMB_VFS_OP_RENAME_STREAM,	"rename_stream" },
 	{ SMB_VFS_OP_FSYNC_SEND,	"fsync_send" },
 	{ SMB_VFS_OP_FSYNC_RECV,	"fsync_recv" },
+	{ SMB_VFS_OP_FLUSH_CACHED_WRITES,	"flush_cached_writes" },
 	{ SMB_VFS_OP_STAT,	"stat" },
 	{ SMB_VFS_OP_FSTAT,	"fstat" },
 	{ SMB_VFS_OP_LSTAT,	"lstat" },
 	{ SMB_VFS_OP_FSTATAT,	"fstatat" },
 	{ SMB_VFS_OP_GET_ALLOC_SIZE,	"get_alloc_size" },
 	{ SMB_VFS_OP_UNLINKAT,	"unlinkat" },
+	{ SMB_VFS_OP_UNLINKAT_SEND,	"unlinkat_send" },
+	{ SMB_VFS_OP_UNLINKAT_RECV,	"unlinkat_recv" },
 	{ SMB_VFS_OP_FCHMOD,	"fchmod" },
 	{ SMB_VFS_OP_FCHOWN,	"fchown" },
 	{ SMB_VFS_OP_LCHOWN,	"lchown" },
@@ -294,6 +316,8 @@ static struct {
 	{ SMB_VFS_OP_SYMLINKAT,	"symlinkat" },
 	{ SMB_VFS_OP_READLINKAT,"readlinkat" },
 	{ SMB_VFS_OP_LINKAT,	"linkat" },
+	{ SMB_VFS_OP_LINKAT_SEND,	"linkat_send" },
+	{ SMB_VFS_OP_LINKAT_RECV,	"linkat_recv" },
 	{ SMB_VFS_OP_MKNODAT,	"mknodat" },
 	{ SMB_VFS_OP_REALPATH,	"realpath" },
 	{ SMB_VFS_OP_FCHFLAGS,	"fchflags" },
@@ -1484,6 +1508,24 @@ static ssize_t smb_full_audit_sendfile(vfs_handle_struct *handle, int tofd,
 	return result;
 }
 
+static int smb_full_audit_splice_read_fd(vfs_handle_struct *handle,
+					 files_struct *fsp,
+					 off_t offset,
+					 size_t n)
+{
+	int result;
+
+	result = SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+
+	do_log(SMB_VFS_OP_SPLICE_READ_FD,
+	       errmsg_unix(result),
+	       handle,
+	       "%s",
+	       fsp_str_do_log(fsp));
+
+	return result;
+}
+
 static ssize_t smb_full_audit_recvfile(vfs_handle_struct *handle, int fromfd,
 		      files_struct *tofsp,
 			      off_t offset,
@@ -1684,6 +1726,409 @@ static int smb_full_audit_fsync_recv(struct tevent_req *req,
 	return state->ret;
 }
 
+/*
+ * The directory entry and close operations below share one state and
+ * one completion: they only differ in the NEXT recv function to call.
+ * The names are logged from a copy taken at send time, the caller's
+ * smb_filenames and fsp don't necessarily live until recv.
+ */
+
+struct smb_full_audit_nsop_state {
+	vfs_handle_struct *handle;
+	vfs_op_type recv_op;
+	const char *names;
+	int ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void smb_full_audit_nsop_done(struct tevent_req *subreq);
+
+static struct tevent_req *smb_full_audit_nsop_create(
+	TALLOC_CTX *mem_ctx,
+	vfs_handle_struct *handle,
+	vfs_op_type send_op,
+	vfs_op_type recv_op,
+	const char *names,
+	struct smb_full_audit_nsop_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+
+	if (names == NULL) {
+		do_log(send_op, strerror(ENOMEM), handle, "");
+		return NULL;
+	}
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smb_full_audit_nsop_state);
+	if (req == NULL) {
+		do_log(send_op, strerror(ENOMEM), handle, "%s", names);
+		return NULL;
+	}
+	state->handle = handle;
+	state->recv_op = recv_op;
+	state->names = talloc_strdup(state, names);
+	if (state->names == NULL) {
+		do_log(send_op, strerror(ENOMEM), handle, "%s", names);
+		TALLOC_FREE(req);
+		return NULL;
+	}
+
+	*pstate = state;
+	return req;
+}
+
+static struct tevent_req *smb_full_audit_nsop_sent(
+	struct tevent_req *req,
+	struct tevent_req *subreq,
+	struct tevent_context *ev,
+	vfs_op_type send_op)
+{
+	struct smb_full_audit_nsop_state *state = tevent_req_data(
+		req, struct smb_full_audit_nsop_state);
+
+	if (tevent_req_nomem(subreq, req)) {
+		do_log(send_op,
+		       strerror(ENOMEM),
+		       state->handle,
+		       "%s",
+		       state->names);
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smb_full_audit_nsop_done, req);
+
+	do_log(send_op, NULL, state->handle, "%s", state->names);
+	return req;
+}
+
+static void smb_full_audit_nsop_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smb_full_audit_nsop_state *state = tevent_req_data(
+		req, struct smb_full_audit_nsop_state);
+
+	switch (state->recv_op) {
+	case SMB_VFS_OP_MKDIRAT_RECV:
+		state->ret = SMB_VFS_NEXT_MKDIRAT_RECV(subreq,
+						       &state->vfs_aio_state);
+		break;
+	case SMB_VFS_OP_RENAMEAT_RECV:
+		state->ret = SMB_VFS_NEXT_RENAMEAT_RECV(subreq,
+							&state->vfs_aio_state);
+		break;
+	case SMB_VFS_OP_UNLINKAT_RECV:
+		state->ret = SMB_VFS_NEXT_UNLINKAT_RECV(subreq,
+							&state->vfs_aio_state);
+		break;
+	case SMB_VFS_OP_LINKAT_RECV:
+		state->ret = SMB_VFS_NEXT_LINKAT_RECV(subreq,
+						      &state->vfs_aio_state);
+		break;
+	case SMB_VFS_OP_CLOSE_RECV:
+		state->ret = SMB_VFS_NEXT_CLOSE_RECV(subreq,
+						     &state->vfs_aio_state);
+		break;
+	default:
+		smb_panic(__location__);
+	}
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static int smb_full_audit_nsop_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	struct smb_full_audit_nsop_state *state = tevent_req_data(
+		req, struct smb_full_audit_nsop_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		do_log(state->recv_op,
+		       strerror(vfs_aio_state->error),
+		       state->handle,
+		       "%s",
+		       state->names);
+		return -1;
+	}
+
+	do_log(state->recv_op,
+	       state->ret == -1 ?
+			strerror(state->vfs_aio_state.error) : NULL,
+	       state->handle,
+	       "%s",
+	       state->names);
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+/*
+ * Logged as "path" or "path|path" like the synchronous operations.
+ */
+static char *smb_full_audit_atname_str(TALLOC_CTX *mem_ctx,
+				       vfs_handle_struct *handle,
+				       struct files_struct *dirfsp,
+				       const struct smb_filename *smb_fname)
+{
+	struct smb_filename *full_fname = NULL;
+	char *str = NULL;
+
+	full_fname = full_path_from_dirfsp_atname(talloc_tos(),
+						  dirfsp,
+						  smb_fname);
+	if (full_fname == NULL) {
+		return NULL;
+	}
+	str = talloc_strdup(mem_ctx,
+			    smb_fname_str_do_log(handle->conn, full_fname));
+	TALLOC_FREE(full_fname);
+	return str;
+}
+
+static char *smb_full_audit_atnames_str(
+	TALLOC_CTX *mem_ctx,
+	vfs_handle_struct *handle,
+	struct files_struct *src_dirfsp,
+	const struct smb_filename *src_fname,
+	struct files_struct *dst_dirfsp,
+	const struct smb_filename *dst_fname)
+{
+	char *src = NULL;
+	char *dst = NULL;
+	char *str = NULL;
+
+	src = smb_full_audit_atname_str(talloc_tos(),
+					handle,
+					src_dirfsp,
+					src_fname);
+	dst = smb_full_audit_atname_str(talloc_tos(),
+					handle,
+					dst_dirfsp,
+					dst_fname);
+	if (src != NULL && dst != NULL) {
+		str = talloc_asprintf(mem_ctx, "%s|%s", src, dst);
+	}
+	TALLOC_FREE(src);
+	TALLOC_FREE(dst);
+	return str;
+}
+
+static struct tevent_req *smb_full_audit_mkdirat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *dirfsp,
+	const struct smb_filename *smb_fname,
+	mode_t mode)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+	char *names = NULL;
+
+	names = smb_full_audit_atname_str(talloc_tos(),
+					  handle,
+					  dirfsp,
+					  smb_fname);
+	req = smb_full_audit_nsop_create(mem_ctx,
+					 handle,
+					 SMB_VFS_OP_MKDIRAT_SEND,
+					 SMB_VFS_OP_MKDIRAT_RECV,
+					 names,
+					 &state);
+	TALLOC_FREE(names);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_MKDIRAT_SEND(state,
+					   ev,
+					   handle,
+					   dirfsp,
+					   smb_fname,
+					   mode);
+	return smb_full_audit_nsop_sent(req,
+					subreq,
+					ev,
+					SMB_VFS_OP_MKDIRAT_SEND);
+}
+
+static struct tevent_req *smb_full_audit_renameat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *src_dirfsp,
+	const struct smb_filename *smb_fname_src,
+	struct files_struct *dst_dirfsp,
+	const struct smb_filename *smb_fname_dst,
+	const struct vfs_rename_how *how)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+	char *names = NULL;
+
+	names = smb_full_audit_atnames_str(talloc_tos(),
+					   handle,
+					   src_dirfsp,
+					   smb_fname_src,
+					   dst_dirfsp,
+					   smb_fname_dst);
+	req = smb_full_audit_nsop_create(mem_ctx,
+					 handle,
+					 SMB_VFS_OP_RENAMEAT_SEND,
+					 SMB_VFS_OP_RENAMEAT_RECV,
+					 names,
+					 &state);
+	TALLOC_FREE(names);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_RENAMEAT_SEND(state,
+					    ev,
+					    handle,
+					    src_dirfsp,
+					    smb_fname_src,
+					    dst_dirfsp,
+					    smb_fname_dst,
+					    how);
+	return smb_full_audit_nsop_sent(req,
+					subreq,
+					ev,
+					SMB_VFS_OP_RENAMEAT_SEND);
+}
+
+static struct tevent_req *smb_full_audit_unlinkat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *dirfsp,
+	const struct smb_filename *smb_fname,
+	int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+	char *names = NULL;
+
+	names = smb_full_audit_atname_str(talloc_tos(),
+					  handle,
+					  dirfsp,
+					  smb_fname);
+	req = smb_full_audit_nsop_create(mem_ctx,
+					 handle,
+					 SMB_VFS_OP_UNLINKAT_SEND,
+					 SMB_VFS_OP_UNLINKAT_RECV,
+					 names,
+					 &state);
+	TALLOC_FREE(names);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_UNLINKAT_SEND(state,
+					    ev,
+					    handle,
+					    dirfsp,
+					    smb_fname,
+					    flags);
+	return smb_full_audit_nsop_sent(req,
+					subreq,
+					ev,
+					SMB_VFS_OP_UNLINKAT_SEND);
+}
+
+static struct tevent_req *smb_full_audit_linkat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *src_dirfsp,
+	const struct smb_filename *old_smb_fname,
+	struct files_struct *dst_dirfsp,
+	const struct smb_filename *new_smb_fname,
+	int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+	char *names = NULL;
+
+	names = smb_full_audit_atnames_str(talloc_tos(),
+					   handle,
+					   src_dirfsp,
+					   old_smb_fname,
+					   dst_dirfsp,
+					   new_smb_fname);
+	req = smb_full_audit_nsop_create(mem_ctx,
+					 handle,
+					 SMB_VFS_OP_LINKAT_SEND,
+					 SMB_VFS_OP_LINKAT_RECV,
+					 names,
+					 &state);
+	TALLOC_FREE(names);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_LINKAT_SEND(state,
+					  ev,
+					  handle,
+					  src_dirfsp,
+					  old_smb_fname,
+					  dst_dirfsp,
+					  new_smb_fname,
+					  flags);
+	return smb_full_audit_nsop_sent(req,
+					subreq,
+					ev,
+					SMB_VFS_OP_LINKAT_SEND);
+}
+
+static struct tevent_req *smb_full_audit_close_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_full_audit_nsop_state *state = NULL;
+
+	req = smb_full_audit_nsop_create(mem_ctx,
+					 handle,
+					 SMB_VFS_OP_CLOSE_SEND,
+					 SMB_VFS_OP_CLOSE_RECV,
+					 fsp_str_do_log(fsp),
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_CLOSE_SEND(state, ev, handle, fsp);
+	return smb_full_audit_nsop_sent(req,
+					subreq,
+					ev,
+					SMB_VFS_OP_CLOSE_SEND);
+}
+
+static NTSTATUS smb_full_audit_flush_cached_writes(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp)
+{
+	NTSTATUS result;
+
+	result = SMB_VFS_NEXT_FLUSH_CACHED_WRITES(handle, fsp);
+
+	do_log(SMB_VFS_OP_FLUSH_CACHED_WRITES,
+	       errmsg_ntstatus(result),
+	       handle,
+	       "%s",
+	       fsp_str_do_log(fsp));
+
+	return result;
+}
+
 static int smb_full_audit_stat(vfs_handle_struct *handle,
 			       struct smb_filename *smb_fname)
 {
@@ -3158,10 +3603,14 @@ static struct vfs_fn_pointers vfs_full_audit_fns = {
 	.readdir_fn = smb_full_audit_readdir,
 	.rewind_dir_fn = smb_full_audit_rewinddir,
 	.mkdirat_fn = smb_full_audit_mkdirat,
+	.mkdirat_send_fn = smb_full_audit_mkdirat_send,
+	.mkdirat_recv_fn = smb_full_audit_nsop_recv,
 	.closedir_fn = smb_full_audit_closedir,
 	.openat_fn = smb_full_audit_openat,
 	.create_file_fn = smb_full_audit_create_file,
 	.close_fn = smb_full_audit_close,
+	.close_send_fn = smb_full_audit_close_send,
+	.close_recv_fn = smb_full_audit_nsop_recv,
 	.pread_fn = smb_full_audit_pread,
 	.pread_send_fn = smb_full_audit_pread_send,
 	.pread_recv_fn = smb_full_audit_pread_recv,
@@ -3170,17 +3619,23 @@ static struct vfs_fn_pointers vfs_full_audit_fns = {
 	.pwrite_recv_fn = smb_full_audit_pwrite_recv,
 	.lseek_fn = smb_full_audit_lseek,
 	.sendfile_fn = smb_full_audit_sendfile,
+	.splice_read_fd_fn = smb_full_audit_splice_read_fd,
 	.recvfile_fn = smb_full_audit_recvfile,
 	.renameat_fn = smb_full_audit_renameat,
+	.renameat_send_fn = smb_full_audit_renameat_send,
+	.renameat_recv_fn = smb_full_audit_nsop_recv,
 	.rename_stream_fn = smb_full_audit_rename_stream,
 	.fsync_send_fn = smb_full_audit_fsync_send,
 	.fsync_recv_fn = smb_full_audit_fsync_recv,
+	.flush_cached_writes_fn = smb_full_audit_flush_cached_writes,
 	.stat_fn = smb_full_audit_stat,
 	.fstat_fn = smb_full_audit_fstat,
 	.lstat_fn = smb_full_audit_lstat,
 	.fstatat_fn = smb_full_audit_fstatat,
 	.get_alloc_size_fn = smb_full_audit_get_alloc_size,
 	.unlinkat_fn = smb_full_audit_unlinkat,
+	.unlinkat_send_fn = smb_full_audit_unlinkat_send,
+	.unlinkat_recv_fn = smb_full_audit_nsop_recv,
 	.fchmod_fn = smb_full_audit_fchmod,
 	.fchown_fn = smb_full_audit_fchown,
 	.lchown_fn = smb_full_audit_lchown,
@@ -3196,6 +3651,8 @@ static struct vfs_fn_pointers vfs_full_audit_fns = {
 	.symlinkat_fn = smb_full_audit_symlinkat,
 	.readlinkat_fn = smb_full_audit_readlinkat,
 	.linkat_fn = smb_full_audit_linkat,
+	.linkat_send_fn = smb_full_audit_linkat_send,
+	.linkat_recv_fn = smb_full_audit_nsop_recv,
 	.mknodat_fn = smb_full_audit_mknodat,
 	.realpath_fn = smb_full_audit_realpath,
 	.fchflags_fn = smb_full_audit_fchflags,
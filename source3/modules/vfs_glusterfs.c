@@ -1268,6 +1268,14 @@ static ssize_t vfs_gluster_sendfile(struct vfs_handle_struct *handle, int tofd,
 	return -1;
 }
 
+static int vfs_gluster_splice_read_fd(struct vfs_handle_struct *handle,
+				      files_struct *fsp,
+				      off_t offset, size_t n)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
 static ssize_t vfs_gluster_recvfile(struct vfs_handle_struct *handle,
 				    int fromfd, files_struct *tofsp,
 				    off_t offset, size_t n)
@@ -2621,6 +2629,7 @@ static struct vfs_fn_pointers glusterfs_fns = {
 	.pwrite_recv_fn = vfs_gluster_pwrite_recv,
 	.lseek_fn = vfs_gluster_lseek,
 	.sendfile_fn = vfs_gluster_sendfile,
+	.splice_read_fd_fn = vfs_gluster_splice_read_fd,
 	.recvfile_fn = vfs_gluster_recvfile,
 	.renameat_fn = vfs_gluster_renameat,
 	.fsync_send_fn = vfs_gluster_fsync_send,
@@ -2109,6 +2109,18 @@ static ssize_t vfs_gpfs_sendfile(vfs_handle_struct *handle, int tofd,
 	return SMB_VFS_NEXT_SENDFILE(handle, tofd, fsp, hdr, offset, n);
 }
 
+static int vfs_gpfs_splice_read_fd(vfs_handle_struct *handle,
+				   files_struct *fsp,
+				   off_t offset,
+				   size_t n)
+{
+	if (vfs_gpfs_fsp_is_offline(handle, fsp)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	return SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+}
+
 static int vfs_gpfs_connect(struct vfs_handle_struct *handle,
 			    const char *service, const char *user)
 {
@@ -2700,6 +2712,7 @@ static struct vfs_fn_pointers vfs_gpfs_fns = {
 	.fntimes_fn = vfs_gpfs_fntimes,
 	.aio_force_fn = vfs_gpfs_aio_force,
 	.sendfile_fn = vfs_gpfs_sendfile,
+	.splice_read_fd_fn = vfs_gpfs_splice_read_fd,
 	.fallocate_fn = vfs_gpfs_fallocate,
 	.openat_fn = vfs_gpfs_openat,
 	.pread_fn = vfs_gpfs_pread,
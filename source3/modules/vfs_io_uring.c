@@ -50,6 +50,19 @@ struct open_how;
 
 struct vfs_io_uring_request;
 
+/*
+ * Path based requests are punted to kernel worker threads, which
+ * don't run with the credentials of the impersonated user. They
+ * are issued with a personality registered for the user instead.
+ */
+#define VFS_IO_URING_MAX_PERSONALITIES 16
+
+struct vfs_io_uring_personality {
+	struct vfs_io_uring_personality *prev, *next;
+	struct security_unix_token *utok;
+	int id;
+};
+
 struct vfs_io_uring_config {
 	struct io_uring uring;
 	struct tevent_fd *fde;
@@ -59,6 +72,32 @@ struct vfs_io_uring_config {
 	bool need_retry;
 	struct vfs_io_uring_request *queue;
 	struct vfs_io_uring_request *pending;
+
+	/*
+	 * IORING_OP_GETXATTR/FGETXATTR and
+	 * IORING_OP_UNLINKAT/RENAMEAT/MKDIRAT/LINKAT are usable,
+	 * see vfs_io_uring_probe_ops().
+	 */
+	bool have_getxattr;
+	bool have_nsops;
+
+	struct vfs_io_uring_personality *personalities;
+	unsigned num_personalities;
+
+	/*
+	 * Table of registered files, slots are handed
+	 * out on first io on an fsp and returned in close.
+	 */
+	struct {
+		unsigned num;
+		unsigned *free;
+		unsigned num_free;
+	} fixed_files;
+};
+
+struct vfs_io_uring_fsp {
+	int fd;
+	unsigned slot;
 };
 
 struct vfs_io_uring_request {
@@ -121,6 +160,15 @@ static void vfs_io_uring_config_destroy(struct vfs_io_uring_config *config,
 		TALLOC_FREE(config->fde);
 		io_uring_queue_exit(&config->uring);
 		config->uring.ring_fd = -1;
+		config->fixed_files.num = 0;
+		config->fixed_files.num_free = 0;
+		while (config->personalities != NULL) {
+			struct vfs_io_uring_personality *p =
+				config->personalities;
+			DLIST_REMOVE(config->personalities, p);
+			TALLOC_FREE(p);
+		}
+		config->num_personalities = 0;
 	}
 
 	PROFILE_TIMESTAMP(&end_time);
@@ -173,6 +221,220 @@ static void vfs_io_uring_fd_handler(struct tevent_context *ev,
 				    uint16_t flags,
 				    void *private_data);
 
+static int vfs_io_uring_register_fixed_files(vfs_handle_struct *handle,
+					     struct vfs_io_uring_config *config)
+{
+	unsigned num;
+	int *fds = NULL;
+	unsigned i;
+	int ret;
+
+	num = lp_parm_ulong(SNUM(handle->conn),
+			    "io_uring",
+			    "fixed_files",
+			    0);
+	if (num == 0) {
+		return 0;
+	}
+
+	config->fixed_files.free = talloc_array(config, unsigned, num);
+	if (config->fixed_files.free == NULL) {
+		return -ENOMEM;
+	}
+
+	fds = talloc_array(talloc_tos(), int, num);
+	if (fds == NULL) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num; i++) {
+		/* An empty slot, filled on first io on an fsp */
+		fds[i] = -1;
+		/* Hand out the low slots first */
+		config->fixed_files.free[i] = num - 1 - i;
+	}
+
+	ret = io_uring_register_files(&config->uring, fds, num);
+	TALLOC_FREE(fds);
+	if (ret < 0) {
+		DBG_ERR("io_uring_register_files(%u) failed: %s\n",
+			num, strerror(-ret));
+		TALLOC_FREE(config->fixed_files.free);
+		return ret;
+	}
+
+	config->fixed_files.num = num;
+	config->fixed_files.num_free = num;
+	return 0;
+}
+
+/*
+ * Returns the fd to be used in the sqe and sets *fixed
+ * if that's an index into the registered files.
+ */
+static int vfs_io_uring_fsp_fd(vfs_handle_struct *handle,
+			       struct vfs_io_uring_config *config,
+			       struct files_struct *fsp,
+			       bool *fixed)
+{
+	struct vfs_io_uring_fsp *ext = NULL;
+	int fd = fsp_get_io_fd(fsp);
+	unsigned slot;
+	int ret;
+
+	*fixed = false;
+
+	if (config->fixed_files.num == 0) {
+		return fd;
+	}
+
+	ext = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (ext != NULL && ext->fd == fd) {
+		*fixed = true;
+		return ext->slot;
+	}
+
+	if (ext == NULL) {
+		if (config->fixed_files.num_free == 0) {
+			return fd;
+		}
+		config->fixed_files.num_free -= 1;
+		slot = config->fixed_files.free[config->fixed_files.num_free];
+	} else {
+		/* The fd changed under us, reuse the slot */
+		slot = ext->slot;
+	}
+
+	ret = io_uring_register_files_update(&config->uring, slot, &fd, 1);
+	if (ret < 0) {
+		DBG_DEBUG("io_uring_register_files_update(%u, %d) "
+			  "failed: %s\n", slot, fd, strerror(-ret));
+		if (ext != NULL) {
+			VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+		}
+		config->fixed_files.free[config->fixed_files.num_free] = slot;
+		config->fixed_files.num_free += 1;
+		return fd;
+	}
+
+	if (ext == NULL) {
+		ext = VFS_ADD_FSP_EXTENSION(handle, fsp,
+					    struct vfs_io_uring_fsp,
+					    NULL);
+		if (ext == NULL) {
+			int empty = -1;
+
+			io_uring_register_files_update(&config->uring,
+						       slot,
+						       &empty,
+						       1);
+			config->fixed_files.free[
+				config->fixed_files.num_free] = slot;
+			config->fixed_files.num_free += 1;
+			return fd;
+		}
+	}
+	*ext = (struct vfs_io_uring_fsp) {
+		.fd = fd,
+		.slot = slot,
+	};
+
+	*fixed = true;
+	return slot;
+}
+
+static void vfs_io_uring_probe_ops(struct vfs_io_uring_config *config)
+{
+	struct io_uring_probe *probe = NULL;
+
+	probe = io_uring_get_probe_ring(&config->uring);
+	if (probe == NULL) {
+		return;
+	}
+#if defined(HAVE_IO_URING_PREP_GETXATTR) && defined(HAVE_IO_URING_PREP_FGETXATTR)
+	config->have_getxattr =
+		io_uring_opcode_supported(probe, IORING_OP_GETXATTR) &&
+		io_uring_opcode_supported(probe, IORING_OP_FGETXATTR);
+#endif
+#if defined(HAVE_IO_URING_PREP_UNLINKAT) && \
+	defined(HAVE_IO_URING_PREP_RENAMEAT) && \
+	defined(HAVE_IO_URING_PREP_MKDIRAT) && \
+	defined(HAVE_IO_URING_PREP_LINKAT)
+	config->have_nsops =
+		io_uring_opcode_supported(probe, IORING_OP_UNLINKAT) &&
+		io_uring_opcode_supported(probe, IORING_OP_RENAMEAT) &&
+		io_uring_opcode_supported(probe, IORING_OP_MKDIRAT) &&
+		io_uring_opcode_supported(probe, IORING_OP_LINKAT);
+#endif
+	io_uring_free_probe(probe);
+}
+
+static bool vfs_io_uring_utok_equal(const struct security_unix_token *a,
+				    const struct security_unix_token *b)
+{
+	if ((a->uid != b->uid) || (a->gid != b->gid) ||
+	    (a->ngroups != b->ngroups)) {
+		return false;
+	}
+	if (a->ngroups == 0) {
+		return true;
+	}
+	return memcmp(a->groups, b->groups,
+		      sizeof(*a->groups) * a->ngroups) == 0;
+}
+
+/*
+ * Return the personality for the credentials we currently run
+ * with, registering them on first use. Returns -1 if they can't be
+ * registered, the caller has to leave the request to the next
+ * module then.
+ */
+static int vfs_io_uring_personality(struct vfs_io_uring_config *config,
+				    struct connection_struct *conn)
+{
+	const struct security_unix_token *utok = get_current_utok(conn);
+	struct vfs_io_uring_personality *p = NULL;
+	int id;
+
+	if (utok == NULL) {
+		return -1;
+	}
+
+	for (p = config->personalities; p != NULL; p = p->next) {
+		if (vfs_io_uring_utok_equal(p->utok, utok)) {
+			return p->id;
+		}
+	}
+
+	if (config->num_personalities >= VFS_IO_URING_MAX_PERSONALITIES) {
+		return -1;
+	}
+
+	p = talloc_zero(config, struct vfs_io_uring_personality);
+	if (p == NULL) {
+		return -1;
+	}
+	p->utok = copy_unix_token(p, utok);
+	if (p->utok == NULL) {
+		TALLOC_FREE(p);
+		return -1;
+	}
+
+	id = io_uring_register_personality(&config->uring);
+	if (id < 0) {
+		DBG_DEBUG("io_uring_register_personality failed: %s\n",
+			  strerror(-id));
+		TALLOC_FREE(p);
+		return -1;
+	}
+	p->id = id;
+
+	DLIST_ADD(config->personalities, p);
+	config->num_personalities += 1;
+
+	return p->id;
+}
+
 static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 			    const char *user)
 {
@@ -180,7 +442,7 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	struct vfs_io_uring_config *config;
 	unsigned num_entries;
 	bool sqpoll;
-	unsigned flags = 0;
+	struct io_uring_params params = { .flags = 0, };
 
 	config = talloc_zero(handle->conn, struct vfs_io_uring_config);
 	if (config == NULL) {
@@ -208,10 +470,25 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 			     "sqpoll",
 			     false);
 	if (sqpoll) {
-		flags |= IORING_SETUP_SQPOLL;
+		int sqpoll_cpu;
+
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = lp_parm_ulong(SNUM(handle->conn),
+						      "io_uring",
+						      "sqpoll_idle",
+						      0);
+
+		sqpoll_cpu = lp_parm_int(SNUM(handle->conn),
+					 "io_uring",
+					 "sqpoll_cpu",
+					 -1);
+		if (sqpoll_cpu >= 0) {
+			params.flags |= IORING_SETUP_SQ_AFF;
+			params.sq_thread_cpu = sqpoll_cpu;
+		}
 	}
 
-	ret = io_uring_queue_init(num_entries, &config->uring, flags);
+	ret = io_uring_queue_init_params(num_entries, &config->uring, &params);
 	if (ret < 0) {
 		SMB_VFS_NEXT_DISCONNECT(handle);
 		errno = -ret;
@@ -229,6 +506,15 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	}
 #endif /* HAVE_IO_URING_RING_DONTFORK */
 
+	vfs_io_uring_probe_ops(config);
+
+	ret = vfs_io_uring_register_fixed_files(handle, config);
+	if (ret < 0) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = -ret;
+		return -1;
+	}
+
 	config->fde = tevent_add_fd(handle->conn->sconn->ev_ctx,
 				    config,
 				    config->uring.ring_fd,
@@ -432,8 +718,43 @@ static int vfs_io_uring_openat(struct vfs_handle_struct *handle,
 	return SMB_VFS_NEXT_OPENAT(handle, dirfsp, smb_fname, fsp, how);
 }
 
+static int vfs_io_uring_close(struct vfs_handle_struct *handle,
+			      struct files_struct *fsp)
+{
+	struct vfs_io_uring_config *config = NULL;
+	struct vfs_io_uring_fsp *ext = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	ext = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (ext != NULL) {
+		/*
+		 * Drop the ring's reference on the file
+		 * before the fd gets closed.
+		 */
+		if (config->fixed_files.num != 0) {
+			int empty = -1;
+
+			io_uring_register_files_update(&config->uring,
+						       ext->slot,
+						       &empty,
+						       1);
+			config->fixed_files.free[
+				config->fixed_files.num_free] = ext->slot;
+			config->fixed_files.num_free += 1;
+		}
+		VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+	}
+
+	return SMB_VFS_NEXT_CLOSE(handle, fsp);
+}
+
 struct vfs_io_uring_pread_state {
 	struct files_struct *fsp;
+	int fd;
+	bool fixed_file;
 	off_t offset;
 	struct iovec iov;
 	size_t nread;
@@ -480,6 +801,8 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 	}
 
 	state->fsp = fsp;
+	state->fd = vfs_io_uring_fsp_fd(handle, config, fsp,
+					&state->fixed_file);
 	state->offset = offset;
 	state->iov.iov_base = (void *)data;
 	state->iov.iov_len = n;
@@ -496,9 +819,12 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 static void vfs_io_uring_pread_submit(struct vfs_io_uring_pread_state *state)
 {
 	io_uring_prep_readv(&state->ur.sqe,
-			    fsp_get_io_fd(state->fsp),
+			    state->fd,
 			    &state->iov, 1,
 			    state->offset);
+	if (state->fixed_file) {
+		state->ur.sqe.flags |= IOSQE_FIXED_FILE;
+	}
 	vfs_io_uring_request_submit(&state->ur);
 }
 
@@ -582,6 +908,8 @@ static ssize_t vfs_io_uring_pread_recv(struct tevent_req *req,
 
 struct vfs_io_uring_pwrite_state {
 	struct files_struct *fsp;
+	int fd;
+	bool fixed_file;
 	off_t offset;
 	struct iovec iov;
 	size_t nwritten;
@@ -629,6 +957,8 @@ static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *han
 	}
 
 	state->fsp = fsp;
+	state->fd = vfs_io_uring_fsp_fd(handle, config, fsp,
+					&state->fixed_file);
 	state->offset = offset;
 	state->iov.iov_base = discard_const(data);
 	state->iov.iov_len = n;
@@ -646,14 +976,14 @@ static void vfs_io_uring_pwrite_submit(struct vfs_io_uring_pwrite_state *state)
 {
 	if (!state->fsp->fsp_flags.posix_append) {
 		io_uring_prep_writev(&state->ur.sqe,
-				     fsp_get_io_fd(state->fsp),
+				     state->fd,
 				     &state->iov, 1,
 				     state->offset);
 	}
 	else {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
 		io_uring_prep_writev2(&state->ur.sqe,
-				      fsp_get_io_fd(state->fsp),
+				      state->fd,
 				      &state->iov, 1,
 				      -1,
 				      RWF_APPEND);
@@ -662,6 +992,9 @@ static void vfs_io_uring_pwrite_submit(struct vfs_io_uring_pwrite_state *state)
 		smb_panic("Unexpected POSIX append-IO");
 #endif
 	}
+	if (state->fixed_file) {
+		state->ur.sqe.flags |= IOSQE_FIXED_FILE;
+	}
 	vfs_io_uring_request_submit(&state->ur);
 }
 
@@ -758,6 +1091,8 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 	struct tevent_req *req = NULL;
 	struct vfs_io_uring_fsync_state *state = NULL;
 	struct vfs_io_uring_config *config = NULL;
+	bool fixed_file = false;
+	int fd;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct vfs_io_uring_config,
@@ -776,9 +1111,13 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 				     state->ur.profile_bytes, 0);
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
 
+	fd = vfs_io_uring_fsp_fd(handle, config, fsp, &fixed_file);
 	io_uring_prep_fsync(&state->ur.sqe,
-			    fsp_get_io_fd(fsp),
+			    fd,
 			    0); /* fsync_flags */
+	if (fixed_file) {
+		state->ur.sqe.flags |= IOSQE_FIXED_FILE;
+	}
 	vfs_io_uring_request_submit(&state->ur);
 
 	if (!tevent_req_is_in_progress(req)) {
@@ -835,15 +1174,742 @@ static int vfs_io_uring_fsync_recv(struct tevent_req *req,
 	return 0;
 }
 
+struct vfs_io_uring_getxattrat_state {
+	struct vfs_io_uring_request ur;
+	bool use_uring;
+	uint64_t next_duration;
+	struct sys_proc_fd_path_buf buf;
+	const char *path;
+	const char *xattr_name;
+	uint8_t *xattr_value;
+	ssize_t xattr_size;
+};
+
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location);
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_getxattrat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			const char *xattr_name,
+			size_t alloc_hint)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_getxattrat_state *state = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct files_struct *fsp = smb_fname->fsp;
+	int personality = -1;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	SMB_ASSERT(!is_named_stream(smb_fname));
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_getxattrat_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ur.config = config;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_getxattrat_completion;
+
+	if (config->have_getxattr) {
+		personality = vfs_io_uring_personality(config, handle->conn);
+	}
+
+	if (!config->have_getxattr ||
+	    personality == -1 ||
+	    fsp == NULL ||
+	    (fsp->fsp_flags.is_pathref && !fsp->fsp_flags.have_proc_fds) ||
+	    alloc_hint > UINT_MAX)
+	{
+		/*
+		 * Leave it to the next module. Without a
+		 * /proc/self/fd path we would have to use a path
+		 * relative to our current directory, which is not
+		 * stable while the request is pending.
+		 */
+		struct tevent_req *subreq = NULL;
+
+		subreq = SMB_VFS_NEXT_GETXATTRAT_SEND(state,
+						      ev,
+						      handle,
+						      dir_fsp,
+						      smb_fname,
+						      xattr_name,
+						      alloc_hint);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_getxattrat_next_done,
+					req);
+		return req;
+	}
+
+#if defined(HAVE_IO_URING_PREP_GETXATTR) && defined(HAVE_IO_URING_PREP_FGETXATTR)
+	state->use_uring = true;
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_getxattrat, profile_p,
+				     state->ur.profile_bytes, 0);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	if (fsp_get_pathref_fd(dir_fsp) == -1) {
+		DBG_ERR("Need a valid directory fd\n");
+		tevent_req_error(req, EINVAL);
+		return tevent_req_post(req, ev);
+	}
+
+	if (alloc_hint > 0) {
+		state->xattr_value = talloc_zero_array(state,
+						       uint8_t,
+						       alloc_hint);
+		if (tevent_req_nomem(state->xattr_value, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	/*
+	 * The kernel reads the name and path only once the sqe
+	 * is submitted, which might be deferred if the ring is
+	 * full. Keep our own copies.
+	 */
+	state->xattr_name = talloc_strdup(state, xattr_name);
+	if (tevent_req_nomem(state->xattr_name, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (!fsp->fsp_flags.is_pathref) {
+		bool fixed_file = false;
+		int fd;
+
+		fd = vfs_io_uring_fsp_fd(handle, config, fsp, &fixed_file);
+		io_uring_prep_fgetxattr(&state->ur.sqe,
+					fd,
+					state->xattr_name,
+					(char *)state->xattr_value,
+					alloc_hint);
+		if (fixed_file) {
+			state->ur.sqe.flags |= IOSQE_FIXED_FILE;
+		}
+	} else {
+		state->path = sys_proc_fd_path(fsp_get_pathref_fd(fsp),
+					       &state->buf);
+		io_uring_prep_getxattr(&state->ur.sqe,
+				       state->xattr_name,
+				       (char *)state->xattr_value,
+				       state->path,
+				       alloc_hint);
+	}
+	state->ur.sqe.personality = personality;
+	vfs_io_uring_request_submit(&state->ur);
+
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	tevent_req_defer_callback(req, ev);
+	return req;
+#else
+	/* vfs_io_uring_probe_ops() never sets have_getxattr */
+	smb_panic(__location__);
+	return NULL;
+#endif
+}
+
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		cur->req, struct vfs_io_uring_getxattrat_state);
+
+	/*
+	 * We rely on being inside the _send() function
+	 * or tevent_req_defer_callback() being called
+	 * already.
+	 */
+
+	if (cur->cqe.res < 0) {
+		int err = -cur->cqe.res;
+		_tevent_req_error(cur->req, err, location);
+		return;
+	}
+
+	state->xattr_size = cur->cqe.res;
+
+	if (state->xattr_value == NULL) {
+		/*
+		 * The caller only wanted the size.
+		 */
+		tevent_req_done(cur->req);
+		return;
+	}
+
+	if ((size_t)state->xattr_size > talloc_array_length(state->xattr_value)) {
+		/* This is not expected! */
+		DBG_ERR("got cur->cqe.res=%d > %zu\n",
+			(int)cur->cqe.res,
+			talloc_array_length(state->xattr_value));
+		tevent_req_error(cur->req, EIO);
+		return;
+	}
+
+	/*
+	 * shrink the buffer to the returned size.
+	 * (can't fail). It means NULL if size is 0.
+	 */
+	state->xattr_value = talloc_realloc(state,
+					    state->xattr_value,
+					    uint8_t,
+					    state->xattr_size);
+
+	tevent_req_done(cur->req);
+}
+
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+	struct vfs_aio_state aio_state = { .error = 0, };
+
+	state->xattr_size = SMB_VFS_NEXT_GETXATTRAT_RECV(subreq,
+							 &aio_state,
+							 state,
+							 &state->xattr_value);
+	TALLOC_FREE(subreq);
+	state->next_duration = aio_state.duration;
+	if (state->xattr_size == -1) {
+		tevent_req_error(req, aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_io_uring_getxattrat_recv(struct tevent_req *req,
+					    struct vfs_aio_state *aio_state,
+					    TALLOC_CTX *mem_ctx,
+					    uint8_t **xattr_value)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+	ssize_t xattr_size;
+
+	if (state->use_uring) {
+		SMBPROFILE_BYTES_ASYNC_END(state->ur.profile_bytes);
+		aio_state->duration = nsec_time_diff(&state->ur.end_time,
+						     &state->ur.start_time);
+	} else {
+		aio_state->duration = state->next_duration;
+	}
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	aio_state->error = 0;
+	xattr_size = state->xattr_size;
+	if (xattr_value != NULL) {
+		*xattr_value = talloc_move(mem_ctx, &state->xattr_value);
+	}
+
+	tevent_req_received(req);
+	return xattr_size;
+}
+
+/*
+ * unlinkat, renameat, mkdirat and linkat only need the directory fds
+ * and names. If the ring can't do them they are left to the next
+ * module, which is usually vfs_default with its pthreadpool.
+ */
+
+enum vfs_io_uring_nsop {
+	VFS_IO_URING_NSOP_MKDIRAT,
+	VFS_IO_URING_NSOP_RENAMEAT,
+	VFS_IO_URING_NSOP_UNLINKAT,
+	VFS_IO_URING_NSOP_LINKAT,
+};
+
+struct vfs_io_uring_nsop_state {
+	struct vfs_io_uring_request ur;
+	enum vfs_io_uring_nsop op;
+	bool use_uring;
+	uint64_t next_duration;
+	int dirfd;
+	int dst_dirfd;
+	char *name;
+	char *dst_name;
+	int personality;
+};
+
+static void vfs_io_uring_nsop_completion(struct vfs_io_uring_request *cur,
+					 const char *location);
+static void vfs_io_uring_nsop_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_nsop_create(
+			TALLOC_CTX *mem_ctx,
+			struct vfs_handle_struct *handle,
+			enum vfs_io_uring_nsop op,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			files_struct *dst_dir_fsp,
+			const struct smb_filename *dst_smb_fname,
+			struct vfs_io_uring_nsop_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_nsop_state *state = NULL;
+	struct vfs_io_uring_config *config = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ur.config = config;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_nsop_completion;
+	state->op = op;
+	state->dirfd = -1;
+	state->dst_dirfd = -1;
+	state->personality = -1;
+	*pstate = state;
+
+	if (!config->have_nsops) {
+		return req;
+	}
+
+	state->dirfd = fsp_get_pathref_fd(dir_fsp);
+	if (state->dirfd == -1) {
+		return req;
+	}
+	if (dst_dir_fsp != NULL) {
+		state->dst_dirfd = fsp_get_pathref_fd(dst_dir_fsp);
+		if (state->dst_dirfd == -1) {
+			return req;
+		}
+	}
+
+	state->personality = vfs_io_uring_personality(config, handle->conn);
+	if (state->personality == -1) {
+		return req;
+	}
+
+	/*
+	 * The kernel reads the names only once the sqe is
+	 * submitted, which might be deferred if the ring is
+	 * full. Keep our own copies.
+	 */
+	state->name = talloc_strdup(state, smb_fname->base_name);
+	if (state->name == NULL) {
+		return req;
+	}
+	if (dst_smb_fname != NULL) {
+		state->dst_name = talloc_strdup(state,
+						dst_smb_fname->base_name);
+		if (state->dst_name == NULL) {
+			return req;
+		}
+	}
+
+	state->use_uring = true;
+	return req;
+}
+
+static struct tevent_req *vfs_io_uring_nsop_submit(
+			struct tevent_req *req,
+			struct tevent_context *ev)
+{
+	struct vfs_io_uring_nsop_state *state = tevent_req_data(
+		req, struct vfs_io_uring_nsop_state);
+
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	state->ur.sqe.personality = state->personality;
+	vfs_io_uring_request_submit(&state->ur);
+
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	tevent_req_defer_callback(req, ev);
+	return req;
+}
+
+static void vfs_io_uring_nsop_completion(struct vfs_io_uring_request *cur,
+					 const char *location)
+{
+	/*
+	 * We rely on being inside the _send() function
+	 * or tevent_req_defer_callback() being called
+	 * already.
+	 */
+
+	if (cur->cqe.res < 0) {
+		int err = -cur->cqe.res;
+		_tevent_req_error(cur->req, err, location);
+		return;
+	}
+
+	tevent_req_done(cur->req);
+}
+
+static void vfs_io_uring_nsop_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_nsop_state *state = tevent_req_data(
+		req, struct vfs_io_uring_nsop_state);
+	struct vfs_aio_state aio_state = { .error = 0, };
+	int ret = -1;
+
+	switch (state->op) {
+	case VFS_IO_URING_NSOP_MKDIRAT:
+		ret = SMB_VFS_NEXT_MKDIRAT_RECV(subreq, &aio_state);
+		break;
+	case VFS_IO_URING_NSOP_RENAMEAT:
+		ret = SMB_VFS_NEXT_RENAMEAT_RECV(subreq, &aio_state);
+		break;
+	case VFS_IO_URING_NSOP_UNLINKAT:
+		ret = SMB_VFS_NEXT_UNLINKAT_RECV(subreq, &aio_state);
+		break;
+	case VFS_IO_URING_NSOP_LINKAT:
+		ret = SMB_VFS_NEXT_LINKAT_RECV(subreq, &aio_state);
+		break;
+	}
+	TALLOC_FREE(subreq);
+	state->next_duration = aio_state.duration;
+	if (ret == -1) {
+		tevent_req_error(req, aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static int vfs_io_uring_nsop_recv(struct tevent_req *req,
+				  struct vfs_aio_state *aio_state)
+{
+	struct vfs_io_uring_nsop_state *state = tevent_req_data(
+		req, struct vfs_io_uring_nsop_state);
+
+	if (state->use_uring) {
+		SMBPROFILE_BYTES_ASYNC_END(state->ur.profile_bytes);
+		aio_state->duration = nsec_time_diff(&state->ur.end_time,
+						     &state->ur.start_time);
+	} else {
+		aio_state->duration = state->next_duration;
+	}
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	aio_state->error = 0;
+	tevent_req_received(req);
+	return 0;
+}
+
+static struct tevent_req *vfs_io_uring_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_nsop_state *state = NULL;
+
+	req = vfs_io_uring_nsop_create(mem_ctx,
+				       handle,
+				       VFS_IO_URING_NSOP_MKDIRAT,
+				       dir_fsp,
+				       smb_fname,
+				       NULL,
+				       NULL,
+				       &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!state->use_uring) {
+		subreq = SMB_VFS_NEXT_MKDIRAT_SEND(state,
+						   ev,
+						   handle,
+						   dir_fsp,
+						   smb_fname,
+						   mode);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_nsop_next_done,
+					req);
+		return req;
+	}
+
+#ifdef HAVE_IO_URING_PREP_MKDIRAT
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_mkdirat, profile_p,
+				     state->ur.profile_bytes, 0);
+	io_uring_prep_mkdirat(&state->ur.sqe,
+			      state->dirfd,
+			      state->name,
+			      mode);
+	return vfs_io_uring_nsop_submit(req, ev);
+#else
+	/* vfs_io_uring_probe_ops() never sets have_nsops */
+	smb_panic(__location__);
+	return NULL;
+#endif
+}
+
+static int vfs_io_uring_mkdirat_recv(struct tevent_req *req,
+				     struct vfs_aio_state *aio_state)
+{
+	return vfs_io_uring_nsop_recv(req, aio_state);
+}
+
+static struct tevent_req *vfs_io_uring_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dir_fsp,
+			const struct smb_filename *smb_fname_src,
+			files_struct *dst_dir_fsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_nsop_state *state = NULL;
+
+	req = vfs_io_uring_nsop_create(mem_ctx,
+				       handle,
+				       VFS_IO_URING_NSOP_RENAMEAT,
+				       src_dir_fsp,
+				       smb_fname_src,
+				       dst_dir_fsp,
+				       smb_fname_dst,
+				       &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!state->use_uring ||
+	    (how->flags & ~VFS_RENAME_HOW_NO_REPLACE) ||
+	    is_named_stream(smb_fname_src) ||
+	    is_named_stream(smb_fname_dst))
+	{
+		/*
+		 * Leave anything unusual to the next module, it
+		 * knows how to fail it.
+		 */
+		state->use_uring = false;
+		subreq = SMB_VFS_NEXT_RENAMEAT_SEND(state,
+						    ev,
+						    handle,
+						    src_dir_fsp,
+						    smb_fname_src,
+						    dst_dir_fsp,
+						    smb_fname_dst,
+						    how);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_nsop_next_done,
+					req);
+		return req;
+	}
+
+#ifdef HAVE_IO_URING_PREP_RENAMEAT
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_renameat, profile_p,
+				     state->ur.profile_bytes, 0);
+	io_uring_prep_renameat(&state->ur.sqe,
+			       state->dirfd,
+			       state->name,
+			       state->dst_dirfd,
+			       state->dst_name,
+			       (how->flags & VFS_RENAME_HOW_NO_REPLACE) ?
+			       RENAME_NOREPLACE : 0);
+	return vfs_io_uring_nsop_submit(req, ev);
+#else
+	/* vfs_io_uring_probe_ops() never sets have_nsops */
+	smb_panic(__location__);
+	return NULL;
+#endif
+}
+
+static int vfs_io_uring_renameat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state)
+{
+	return vfs_io_uring_nsop_recv(req, aio_state);
+}
+
+static struct tevent_req *vfs_io_uring_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_nsop_state *state = NULL;
+
+	req = vfs_io_uring_nsop_create(mem_ctx,
+				       handle,
+				       VFS_IO_URING_NSOP_UNLINKAT,
+				       dir_fsp,
+				       smb_fname,
+				       NULL,
+				       NULL,
+				       &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!state->use_uring || is_named_stream(smb_fname)) {
+		state->use_uring = false;
+		subreq = SMB_VFS_NEXT_UNLINKAT_SEND(state,
+						    ev,
+						    handle,
+						    dir_fsp,
+						    smb_fname,
+						    flags);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_nsop_next_done,
+					req);
+		return req;
+	}
+
+#ifdef HAVE_IO_URING_PREP_UNLINKAT
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_unlinkat, profile_p,
+				     state->ur.profile_bytes, 0);
+	io_uring_prep_unlinkat(&state->ur.sqe,
+			       state->dirfd,
+			       state->name,
+			       flags);
+	return vfs_io_uring_nsop_submit(req, ev);
+#else
+	/* vfs_io_uring_probe_ops() never sets have_nsops */
+	smb_panic(__location__);
+	return NULL;
+#endif
+}
+
+static int vfs_io_uring_unlinkat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state)
+{
+	return vfs_io_uring_nsop_recv(req, aio_state);
+}
+
+static struct tevent_req *vfs_io_uring_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dir_fsp,
+			const struct smb_filename *old_smb_fname,
+			files_struct *dst_dir_fsp,
+			const struct smb_filename *new_smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_nsop_state *state = NULL;
+
+	req = vfs_io_uring_nsop_create(mem_ctx,
+				       handle,
+				       VFS_IO_URING_NSOP_LINKAT,
+				       src_dir_fsp,
+				       old_smb_fname,
+				       dst_dir_fsp,
+				       new_smb_fname,
+				       &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!state->use_uring) {
+		subreq = SMB_VFS_NEXT_LINKAT_SEND(state,
+						  ev,
+						  handle,
+						  src_dir_fsp,
+						  old_smb_fname,
+						  dst_dir_fsp,
+						  new_smb_fname,
+						  flags);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_nsop_next_done,
+					req);
+		return req;
+	}
+
+#ifdef HAVE_IO_URING_PREP_LINKAT
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_linkat, profile_p,
+				     state->ur.profile_bytes, 0);
+	io_uring_prep_linkat(&state->ur.sqe,
+			     state->dirfd,
+			     state->name,
+			     state->dst_dirfd,
+			     state->dst_name,
+			     flags);
+	return vfs_io_uring_nsop_submit(req, ev);
+#else
+	/* vfs_io_uring_probe_ops() never sets have_nsops */
+	smb_panic(__location__);
+	return NULL;
+#endif
+}
+
+static int vfs_io_uring_linkat_recv(struct tevent_req *req,
+				    struct vfs_aio_state *aio_state)
+{
+	return vfs_io_uring_nsop_recv(req, aio_state);
+}
+
 static struct vfs_fn_pointers vfs_io_uring_fns = {
 	.connect_fn = vfs_io_uring_connect,
 	.openat_fn = vfs_io_uring_openat,
+	.close_fn = vfs_io_uring_close,
 	.pread_send_fn = vfs_io_uring_pread_send,
 	.pread_recv_fn = vfs_io_uring_pread_recv,
 	.pwrite_send_fn = vfs_io_uring_pwrite_send,
 	.pwrite_recv_fn = vfs_io_uring_pwrite_recv,
 	.fsync_send_fn = vfs_io_uring_fsync_send,
 	.fsync_recv_fn = vfs_io_uring_fsync_recv,
+	.getxattrat_send_fn = vfs_io_uring_getxattrat_send,
+	.getxattrat_recv_fn = vfs_io_uring_getxattrat_recv,
+	.mkdirat_send_fn = vfs_io_uring_mkdirat_send,
+	.mkdirat_recv_fn = vfs_io_uring_mkdirat_recv,
+	.renameat_send_fn = vfs_io_uring_renameat_send,
+	.renameat_recv_fn = vfs_io_uring_renameat_recv,
+	.unlinkat_send_fn = vfs_io_uring_unlinkat_send,
+	.unlinkat_recv_fn = vfs_io_uring_unlinkat_recv,
+	.linkat_send_fn = vfs_io_uring_linkat_send,
+	.linkat_recv_fn = vfs_io_uring_linkat_recv,
 };
 
 static_decl_vfs;
@@ -201,6 +201,58 @@ int vfs_not_implemented_mkdirat(vfs_handle_struct *handle,
 	return -1;
 }
 
+struct vfs_not_implemented_nsop_state {
+	uint8_t dummy;
+};
+
+static struct tevent_req *vfs_not_implemented_nsop_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_not_implemented_nsop_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_not_implemented_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	tevent_req_error(req, ENOSYS);
+	return tevent_req_post(req, ev);
+}
+
+static int vfs_not_implemented_nsop_recv(struct tevent_req *req,
+					 struct vfs_aio_state *aio_state)
+{
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	tevent_req_received(req);
+	return 0;
+}
+
+_PUBLIC_
+struct tevent_req *vfs_not_implemented_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode)
+{
+	return vfs_not_implemented_nsop_send(mem_ctx, ev);
+}
+
+_PUBLIC_
+int vfs_not_implemented_mkdirat_recv(struct tevent_req *req,
+				     struct vfs_aio_state *aio_state)
+{
+	return vfs_not_implemented_nsop_recv(req, aio_state);
+}
+
 _PUBLIC_
 int vfs_not_implemented_closedir(vfs_handle_struct *handle, DIR *dir)
 {
@@ -319,6 +371,16 @@ ssize_t vfs_not_implemented_sendfile(vfs_handle_struct *handle, int tofd,
 	return -1;
 }
 
+_PUBLIC_
+int vfs_not_implemented_splice_read_fd(vfs_handle_struct *handle,
+				       files_struct *fsp,
+				       off_t offset,
+				       size_t n)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
 _PUBLIC_
 ssize_t vfs_not_implemented_recvfile(vfs_handle_struct *handle, int fromfd,
 				     files_struct *tofsp, off_t offset, size_t n)
@@ -339,6 +401,27 @@ int vfs_not_implemented_renameat(vfs_handle_struct *handle,
 	return -1;
 }
 
+_PUBLIC_
+struct tevent_req *vfs_not_implemented_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dirfsp,
+			const struct smb_filename *smb_fname_src,
+			files_struct *dst_dirfsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how)
+{
+	return vfs_not_implemented_nsop_send(mem_ctx, ev);
+}
+
+_PUBLIC_
+int vfs_not_implemented_renameat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state)
+{
+	return vfs_not_implemented_nsop_recv(req, aio_state);
+}
+
 _PUBLIC_
 int vfs_not_implemented_rename_stream(struct vfs_handle_struct *handle,
 				      struct files_struct *src_fsp,
@@ -349,6 +432,22 @@ int vfs_not_implemented_rename_stream(struct vfs_handle_struct *handle,
 	return -1;
 }
 
+_PUBLIC_
+struct tevent_req *vfs_not_implemented_close_send(struct vfs_handle_struct *handle,
+						  TALLOC_CTX *mem_ctx,
+						  struct tevent_context *ev,
+						  struct files_struct *fsp)
+{
+	return vfs_not_implemented_nsop_send(mem_ctx, ev);
+}
+
+_PUBLIC_
+int vfs_not_implemented_close_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state)
+{
+	return vfs_not_implemented_nsop_recv(req, vfs_aio_state);
+}
+
 _PUBLIC_
 struct tevent_req *vfs_not_implemented_fsync_send(struct vfs_handle_struct *handle,
 						  TALLOC_CTX *mem_ctx,
@@ -366,6 +465,14 @@ int vfs_not_implemented_fsync_recv(struct tevent_req *req,
 	return -1;
 }
 
+_PUBLIC_
+NTSTATUS vfs_not_implemented_flush_cached_writes(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp)
+{
+	return NT_STATUS_NOT_IMPLEMENTED;
+}
+
 _PUBLIC_
 int vfs_not_implemented_stat(vfs_handle_struct *handle, struct smb_filename *smb_fname)
 {
@@ -420,6 +527,25 @@ int vfs_not_implemented_unlinkat(vfs_handle_struct *handle,
 	return -1;
 }
 
+_PUBLIC_
+struct tevent_req *vfs_not_implemented_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			int flags)
+{
+	return vfs_not_implemented_nsop_send(mem_ctx, ev);
+}
+
+_PUBLIC_
+int vfs_not_implemented_unlinkat_recv(struct tevent_req *req,
+				      struct vfs_aio_state *aio_state)
+{
+	return vfs_not_implemented_nsop_recv(req, aio_state);
+}
+
 _PUBLIC_
 int vfs_not_implemented_fchmod(vfs_handle_struct *handle, files_struct *fsp,
 			       mode_t mode)
@@ -556,6 +682,27 @@ int vfs_not_implemented_linkat(vfs_handle_struct *handle,
 	return -1;
 }
 
+_PUBLIC_
+struct tevent_req *vfs_not_implemented_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *src_dirfsp,
+			const struct smb_filename *old_smb_fname,
+			files_struct *dst_dirfsp,
+			const struct smb_filename *new_smb_fname,
+			int flags)
+{
+	return vfs_not_implemented_nsop_send(mem_ctx, ev);
+}
+
+_PUBLIC_
+int vfs_not_implemented_linkat_recv(struct tevent_req *req,
+				    struct vfs_aio_state *aio_state)
+{
+	return vfs_not_implemented_nsop_recv(req, aio_state);
+}
+
 _PUBLIC_
 int vfs_not_implemented_mknodat(vfs_handle_struct *handle,
 			files_struct *dirfsp,
@@ -1076,6 +1223,8 @@ static struct vfs_fn_pointers vfs_not_implemented_fns = {
 	.readdir_fn = vfs_not_implemented_readdir,
 	.rewind_dir_fn = vfs_not_implemented_rewind_dir,
 	.mkdirat_fn = vfs_not_implemented_mkdirat,
+	.mkdirat_send_fn = vfs_not_implemented_mkdirat_send,
+	.mkdirat_recv_fn = vfs_not_implemented_mkdirat_recv,
 	.closedir_fn = vfs_not_implemented_closedir,
 
 	/* File operations */
@@ -1083,6 +1232,8 @@ static struct vfs_fn_pointers vfs_not_implemented_fns = {
 	.openat_fn = vfs_not_implemented_openat,
 	.create_file_fn = vfs_not_implemented_create_file,
 	.close_fn = vfs_not_implemented_close_fn,
+	.close_send_fn = vfs_not_implemented_close_send,
+	.close_recv_fn = vfs_not_implemented_close_recv,
 	.pread_fn = vfs_not_implemented_pread,
 	.pread_send_fn = vfs_not_implemented_pread_send,
 	.pread_recv_fn = vfs_not_implemented_pread_recv,
@@ -1091,17 +1242,23 @@ static struct vfs_fn_pointers vfs_not_implemented_fns = {
 	.pwrite_recv_fn = vfs_not_implemented_pwrite_recv,
 	.lseek_fn = vfs_not_implemented_lseek,
 	.sendfile_fn = vfs_not_implemented_sendfile,
+	.splice_read_fd_fn = vfs_not_implemented_splice_read_fd,
 	.recvfile_fn = vfs_not_implemented_recvfile,
 	.renameat_fn = vfs_not_implemented_renameat,
+	.renameat_send_fn = vfs_not_implemented_renameat_send,
+	.renameat_recv_fn = vfs_not_implemented_renameat_recv,
 	.rename_stream_fn = vfs_not_implemented_rename_stream,
 	.fsync_send_fn = vfs_not_implemented_fsync_send,
 	.fsync_recv_fn = vfs_not_implemented_fsync_recv,
+	.flush_cached_writes_fn = vfs_not_implemented_flush_cached_writes,
 	.stat_fn = vfs_not_implemented_stat,
 	.fstat_fn = vfs_not_implemented_fstat,
 	.lstat_fn = vfs_not_implemented_lstat,
 	.fstatat_fn = vfs_not_implemented_fstatat,
 	.get_alloc_size_fn = vfs_not_implemented_get_alloc_size,
 	.unlinkat_fn = vfs_not_implemented_unlinkat,
+	.unlinkat_send_fn = vfs_not_implemented_unlinkat_send,
+	.unlinkat_recv_fn = vfs_not_implemented_unlinkat_recv,
 	.fchmod_fn = vfs_not_implemented_fchmod,
 	.fchown_fn = vfs_not_implemented_fchown,
 	.lchown_fn = vfs_not_implemented_lchown,
@@ -1117,6 +1274,8 @@ static struct vfs_fn_pointers vfs_not_implemented_fns = {
 	.symlinkat_fn = vfs_not_implemented_symlinkat,
 	.readlinkat_fn = vfs_not_implemented_vfs_readlinkat,
 	.linkat_fn = vfs_not_implemented_linkat,
+	.linkat_send_fn = vfs_not_implemented_linkat_send,
+	.linkat_recv_fn = vfs_not_implemented_linkat_recv,
 	.mknodat_fn = vfs_not_implemented_mknodat,
 	.realpath_fn = vfs_not_implemented_realpath,
 	.fchflags_fn = vfs_not_implemented_fchflags,
@@ -18,6 +18,8 @@
 #include "includes.h"
 #include "system/filesys.h"
 #include "smbd/smbd.h"
+#include "smbprofile.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #if defined(HAVE_LINUX_READAHEAD) && ! defined(HAVE_READAHEAD_DECL)
 ssize_t readahead(int fd, off_t offset, size_t count);
@@ -27,6 +29,44 @@ struct readahead_data {
 	off_t off_bound;
 	off_t len;
 	bool didmsg;
+
+	/* readahead:adaptive */
+	bool adaptive;
+	off_t min_window;
+	off_t max_window;
+	unsigned int trigger;
+	unsigned int reorder;
+};
+
+/*
+ * Per open state of the adaptive readahead.
+ *
+ * A read is sequential if it starts close to the highest offset read
+ * so far. "Close" allows for the reordering of a client issuing
+ * several reads in parallel (multi-credit SMB2 reads): up to
+ * readahead:reorder reads of the current size before or after that
+ * offset count as sequential.
+ *
+ * A read is strided if it starts at the same distance from the
+ * previous read as the previous read from the one before it, with a
+ * gap in between.
+ *
+ * Once readahead:trigger reads in a row matched one of the patterns,
+ * the data ahead of the reader is prefetched asynchronously. The
+ * window starts at readahead:min window and doubles with every
+ * prefetch up to readahead:max window. Any other read resets the
+ * window.
+ */
+struct readahead_fsp {
+	off_t last_off;
+	off_t max_end;
+	off_t stride;
+	unsigned int matches;
+	off_t window;
+
+	/* The range covered by the prefetches issued so far */
+	off_t ra_start;
+	off_t ra_end;
 };
 
 /* 
@@ -35,6 +75,271 @@ struct readahead_data {
  * the buffer cache to be filled in advance.
  */
 
+/*******************************************************************
+ Asynchronous prefetch of count ranges of len bytes, stride bytes
+ apart, run in the smbd threadpool.
+
+ The job works on a dup() of the fd, so it doesn't matter if the file
+ is closed in the meantime.
+*******************************************************************/
+
+/* Upper limit of strided ranges prefetched in one go */
+#define READAHEAD_MAX_STRIDES 64
+
+struct readahead_prefetch_state {
+	int fd;
+	off_t off;
+	off_t len;
+	off_t stride;
+	unsigned int count;
+};
+
+static void readahead_prefetch_do(void *private_data);
+static void readahead_prefetch_done(struct tevent_req *subreq);
+
+static int readahead_prefetch_state_destructor(
+	struct readahead_prefetch_state *state)
+{
+	return -1;
+}
+
+static bool readahead_prefetch(struct vfs_handle_struct *handle,
+			       struct files_struct *fsp,
+			       off_t off,
+			       off_t len,
+			       off_t stride,
+			       unsigned int count)
+{
+	struct tevent_context *ev = handle->conn->sconn->ev_ctx;
+	struct tevent_req *subreq = NULL;
+	struct readahead_prefetch_state *state = NULL;
+
+	/*
+	 * The prefetch is not tied to any request, hang it off the
+	 * connection.
+	 */
+	state = talloc(handle->conn, struct readahead_prefetch_state);
+	if (state == NULL) {
+		return false;
+	}
+	*state = (struct readahead_prefetch_state) {
+		.off = off,
+		.len = len,
+		.stride = stride,
+		.count = count,
+	};
+
+	state->fd = dup(fsp_get_io_fd(fsp));
+	if (state->fd == -1) {
+		DBG_DEBUG("dup failed: %s\n", strerror(errno));
+		TALLOC_FREE(state);
+		return false;
+	}
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     ev,
+					     handle->conn->sconn->pool,
+					     readahead_prefetch_do,
+					     state);
+	if (subreq == NULL) {
+		close(state->fd);
+		TALLOC_FREE(state);
+		return false;
+	}
+	tevent_req_set_callback(subreq, readahead_prefetch_done, state);
+
+	talloc_set_destructor(state, readahead_prefetch_state_destructor);
+
+	return true;
+}
+
+static void readahead_prefetch_do(void *private_data)
+{
+	struct readahead_prefetch_state *state = talloc_get_type_abort(
+		private_data, struct readahead_prefetch_state);
+	unsigned int i;
+
+	for (i = 0; i < state->count; i++) {
+		off_t off = state->off + i * state->stride;
+		int ret;
+
+#if defined(HAVE_LINUX_READAHEAD)
+		ret = readahead(state->fd, off, (size_t)state->len);
+#elif defined(HAVE_POSIX_FADVISE)
+		ret = posix_fadvise(state->fd,
+				    off,
+				    state->len,
+				    POSIX_FADV_WILLNEED);
+#else
+		ret = -1;
+#endif
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	close(state->fd);
+	state->fd = -1;
+}
+
+static void readahead_prefetch_done(struct tevent_req *subreq)
+{
+	struct readahead_prefetch_state *state = tevent_req_callback_data(
+		subreq, struct readahead_prefetch_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		/*
+		 * The job didn't run, e.g. we got EAGAIN because no
+		 * thread could be created. It's just a hint, don't
+		 * block the main thread with it.
+		 */
+		DBG_DEBUG("prefetch job failed: %s\n", strerror(ret));
+		if (state->fd != -1) {
+			close(state->fd);
+		}
+	}
+	TALLOC_FREE(state);
+}
+
+/*******************************************************************
+ Look at a read of n bytes at offset and prefetch ahead of it if it
+ is part of a sequential or strided stream.
+*******************************************************************/
+
+static void readahead_adaptive(struct vfs_handle_struct *handle,
+			       struct files_struct *fsp,
+			       off_t offset,
+			       size_t n)
+{
+	struct readahead_data *rhd = (struct readahead_data *)handle->data;
+	struct readahead_fsp *rfsp = NULL;
+	off_t end = offset + n;
+	off_t reorder = (off_t)n * rhd->reorder;
+	off_t stride;
+	bool sequential;
+	bool strided;
+	bool ok;
+
+	if (n == 0 || fsp_get_io_fd(fsp) == -1) {
+		return;
+	}
+
+	rfsp = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (rfsp == NULL) {
+		rfsp = VFS_ADD_FSP_EXTENSION(handle,
+					     fsp,
+					     struct readahead_fsp,
+					     NULL);
+		if (rfsp == NULL) {
+			return;
+		}
+		*rfsp = (struct readahead_fsp) {
+			.last_off = offset,
+			.max_end = end,
+			.window = rhd->min_window,
+		};
+		return;
+	}
+
+	if (rfsp->ra_end > rfsp->ra_start) {
+		if (offset >= rfsp->ra_start && end <= rfsp->ra_end) {
+			SMBPROFILE_COUNT_INCREMENT_X(SNUM(handle->conn),
+						     readahead_hits,
+						     1);
+		} else {
+			SMBPROFILE_COUNT_INCREMENT_X(SNUM(handle->conn),
+						     readahead_misses,
+						     1);
+		}
+	}
+
+	sequential = (offset >= rfsp->max_end - reorder) &&
+		     (offset <= rfsp->max_end + reorder);
+
+	stride = offset - rfsp->last_off;
+	strided = !sequential &&
+		  (stride > (off_t)n) &&
+		  (stride == rfsp->stride);
+
+	rfsp->stride = stride;
+	rfsp->last_off = offset;
+
+	if (!sequential && !strided) {
+		rfsp->matches = 0;
+		rfsp->max_end = end;
+		rfsp->window = rhd->min_window;
+		rfsp->ra_start = 0;
+		rfsp->ra_end = 0;
+		return;
+	}
+
+	rfsp->max_end = MAX(rfsp->max_end, end);
+	rfsp->matches += 1;
+
+	if (rfsp->matches < rhd->trigger) {
+		return;
+	}
+
+	if (sequential) {
+		off_t start = MAX(rfsp->ra_end, rfsp->max_end);
+
+		/*
+		 * Only refill once the reader got into the second half
+		 * of what was prefetched.
+		 */
+		if (rfsp->ra_end - end > rfsp->window / 2) {
+			return;
+		}
+
+		ok = readahead_prefetch(handle,
+					fsp,
+					start,
+					rfsp->max_end + rfsp->window - start,
+					0,
+					1);
+		if (!ok) {
+			return;
+		}
+		if (rfsp->ra_end != start) {
+			rfsp->ra_start = start;
+		}
+		rfsp->ra_end = rfsp->max_end + rfsp->window;
+	} else {
+		off_t start = offset + stride;
+		unsigned int count;
+
+		if (rfsp->ra_end > start) {
+			/* Still covered by the last prefetch */
+			return;
+		}
+
+		count = MIN(MAX(rfsp->window / stride, 1),
+			    READAHEAD_MAX_STRIDES);
+
+		ok = readahead_prefetch(handle,
+					fsp,
+					start,
+					(off_t)n,
+					stride,
+					count);
+		if (!ok) {
+			return;
+		}
+		rfsp->ra_start = start;
+		rfsp->ra_end = start + (count - 1) * stride + (off_t)n;
+	}
+
+	SMBPROFILE_COUNT_INCREMENT_X(SNUM(handle->conn),
+				     readahead_prefetches,
+				     1);
+
+	rfsp->window = MIN(rfsp->window * 2, rhd->max_window);
+}
+
 /*******************************************************************
  sendfile wrapper that does readahead/posix_fadvise.
 *******************************************************************/
@@ -48,7 +353,9 @@ static ssize_t readahead_sendfile(struct vfs_handle_struct *handle,
 {
 	struct readahead_data *rhd = (struct readahead_data *)handle->data;
 
-	if ( offset % rhd->off_bound == 0) {
+	if (rhd->adaptive) {
+		readahead_adaptive(handle, fromfsp, offset, count);
+	} else if ( offset % rhd->off_bound == 0) {
 #if defined(HAVE_LINUX_READAHEAD)
 		int err = readahead(fsp_get_io_fd(fromfsp), offset, (size_t)rhd->len);
 		DEBUG(10,("readahead_sendfile: readahead on fd %u, offset %llu, len %u returned %d\n",
@@ -90,7 +397,9 @@ static ssize_t readahead_pread(vfs_handle_struct *handle,
 {
 	struct readahead_data *rhd = (struct readahead_data *)handle->data;
 
-	if ( offset % rhd->off_bound == 0) {
+	if (rhd->adaptive) {
+		readahead_adaptive(handle, fsp, offset, count);
+	} else if ( offset % rhd->off_bound == 0) {
 #if defined(HAVE_LINUX_READAHEAD)
 		int err = readahead(fsp_get_io_fd(fsp), offset, (size_t)rhd->len);
 		DEBUG(10,("readahead_pread: readahead on fd %u, offset %llu, len %u returned %d\n",
@@ -115,6 +424,35 @@ static ssize_t readahead_pread(vfs_handle_struct *handle,
         return SMB_VFS_NEXT_PREAD(handle, fsp, data, count, offset);
 }
 
+/*******************************************************************
+ pread_send wrapper, SMB2 reads come in here. Only the adaptive mode
+ looks at them, the request itself is passed through.
+*******************************************************************/
+
+static struct tevent_req *readahead_pread_send(struct vfs_handle_struct *handle,
+					       TALLOC_CTX *mem_ctx,
+					       struct tevent_context *ev,
+					       struct files_struct *fsp,
+					       void *data,
+					       size_t n,
+					       off_t offset)
+{
+	struct readahead_data *rhd = (struct readahead_data *)handle->data;
+
+	if (rhd->adaptive) {
+		readahead_adaptive(handle, fsp, offset, n);
+	}
+
+	return SMB_VFS_NEXT_PREAD_SEND(mem_ctx, ev, handle, fsp, data,
+				       n, offset);
+}
+
+static ssize_t readahead_pread_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	return SMB_VFS_PREAD_RECV(req, vfs_aio_state);
+}
+
 /*******************************************************************
  Directly called from main smbd when freeing handle.
 *******************************************************************/
@@ -162,6 +500,43 @@ static int readahead_connect(struct vfs_handle_struct *handle,
 		rhd->len = rhd->off_bound;
 	}
 
+	rhd->adaptive = lp_parm_bool(SNUM(handle->conn),
+				     "readahead",
+				     "adaptive",
+				     false);
+	rhd->min_window = conv_str_size(lp_parm_const_string(
+						SNUM(handle->conn),
+						"readahead",
+						"min window",
+						NULL));
+	if (rhd->min_window == 0) {
+		rhd->min_window = 0x40000;
+	}
+	rhd->max_window = conv_str_size(lp_parm_const_string(
+						SNUM(handle->conn),
+						"readahead",
+						"max window",
+						NULL));
+	if (rhd->max_window == 0) {
+		rhd->max_window = 0x1000000;
+	}
+	rhd->max_window = MAX(rhd->max_window, rhd->min_window);
+	rhd->trigger = lp_parm_int(SNUM(handle->conn),
+				   "readahead",
+				   "trigger",
+				   2);
+	rhd->reorder = lp_parm_int(SNUM(handle->conn),
+				   "readahead",
+				   "reorder",
+				   8);
+
+#if !defined(HAVE_LINUX_READAHEAD) && !defined(HAVE_POSIX_FADVISE)
+	if (rhd->adaptive) {
+		DBG_WARNING("no readahead on this platform\n");
+		rhd->adaptive = false;
+	}
+#endif
+
 	handle->data = (void *)rhd;
 	handle->free_data = free_readahead_data;
 	return 0;
@@ -170,6 +545,8 @@ static int readahead_connect(struct vfs_handle_struct *handle,
 static struct vfs_fn_pointers vfs_readahead_fns = {
 	.sendfile_fn = readahead_sendfile,
 	.pread_fn = readahead_pread,
+	.pread_send_fn = readahead_pread_send,
+	.pread_recv_fn = readahead_pread_recv,
 	.connect_fn = readahead_connect
 };
 
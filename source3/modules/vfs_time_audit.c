@@ -916,6 +916,27 @@ static ssize_t smb_time_audit_sendfile(vfs_handle_struct *handle, int tofd,
 	return result;
 }
 
+static int smb_time_audit_splice_read_fd(vfs_handle_struct *handle,
+					 files_struct *fsp,
+					 off_t offset,
+					 size_t n)
+{
+	int result;
+	struct timespec ts1,ts2;
+	double timediff;
+
+	clock_gettime_mono(&ts1);
+	result = SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+	clock_gettime_mono(&ts2);
+	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
+
+	if (timediff > audit_timeout) {
+		smb_time_audit_log_fsp("splice_read_fd", timediff, fsp);
+	}
+
+	return result;
+}
+
 static ssize_t smb_time_audit_recvfile(vfs_handle_struct *handle, int fromfd,
 				       files_struct *tofsp,
 				       off_t offset,
@@ -1066,6 +1087,282 @@ static int smb_time_audit_fsync_recv(struct tevent_req *req,
 	return state->ret;
 }
 
+/*
+ * The directory entry and close operations below share one state:
+ * they are timed from send to completion, not every backend fills in
+ * vfs_aio_state.duration for them.
+ */
+
+struct smb_time_audit_nsop_state {
+	const char *syscallname;
+	char *msg;
+	int (*recv_fn)(struct tevent_req *req,
+		       struct vfs_aio_state *aio_state);
+	struct timespec ts1;
+	double timediff;
+	int ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void smb_time_audit_nsop_done(struct tevent_req *subreq);
+
+static struct tevent_req *smb_time_audit_nsop_create(
+	TALLOC_CTX *mem_ctx,
+	const char *syscallname,
+	int (*recv_fn)(struct tevent_req *req,
+		       struct vfs_aio_state *aio_state),
+	struct smb_time_audit_nsop_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smb_time_audit_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct smb_time_audit_nsop_state) {
+		.syscallname = syscallname,
+		.recv_fn = recv_fn,
+	};
+	clock_gettime_mono(&state->ts1);
+
+	*pstate = state;
+	return req;
+}
+
+static struct tevent_req *smb_time_audit_nsop_sent(
+	struct tevent_req *req,
+	struct tevent_req *subreq,
+	struct tevent_context *ev)
+{
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smb_time_audit_nsop_done, req);
+	return req;
+}
+
+static void smb_time_audit_nsop_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smb_time_audit_nsop_state *state = tevent_req_data(
+		req, struct smb_time_audit_nsop_state);
+	struct timespec ts2;
+
+	state->ret = state->recv_fn(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+
+	clock_gettime_mono(&ts2);
+	state->timediff = nsec_time_diff(&ts2, &state->ts1) * 1.0e-9;
+
+	tevent_req_done(req);
+}
+
+static int smb_time_audit_nsop_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	struct smb_time_audit_nsop_state *state = tevent_req_data(
+		req, struct smb_time_audit_nsop_state);
+
+	if (state->timediff > audit_timeout) {
+		smb_time_audit_log_msg(state->syscallname,
+				       state->timediff,
+				       state->msg);
+	}
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static char *smb_time_audit_at_msg(TALLOC_CTX *mem_ctx,
+				   const struct files_struct *dir_fsp,
+				   const struct smb_filename *smb_fname)
+{
+	return talloc_asprintf(mem_ctx,
+			       "filename = \"%s/%s/%s\"",
+			       dir_fsp->conn->connectpath,
+			       dir_fsp->fsp_name->base_name,
+			       smb_fname->base_name);
+}
+
+static struct tevent_req *smb_time_audit_mkdirat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *dirfsp,
+	const struct smb_filename *smb_fname,
+	mode_t mode)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = smb_time_audit_nsop_create(mem_ctx,
+					 "async mkdirat",
+					 smb_vfs_call_mkdirat_recv,
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->msg = smb_time_audit_at_msg(state, dirfsp, smb_fname);
+
+	subreq = SMB_VFS_NEXT_MKDIRAT_SEND(state,
+					   ev,
+					   handle,
+					   dirfsp,
+					   smb_fname,
+					   mode);
+	return smb_time_audit_nsop_sent(req, subreq, ev);
+}
+
+static struct tevent_req *smb_time_audit_renameat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *src_dirfsp,
+	const struct smb_filename *smb_fname_src,
+	struct files_struct *dst_dirfsp,
+	const struct smb_filename *smb_fname_dst,
+	const struct vfs_rename_how *how)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = smb_time_audit_nsop_create(mem_ctx,
+					 "async renameat",
+					 smb_vfs_call_renameat_recv,
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->msg = smb_time_audit_at_msg(state, src_dirfsp, smb_fname_src);
+
+	subreq = SMB_VFS_NEXT_RENAMEAT_SEND(state,
+					    ev,
+					    handle,
+					    src_dirfsp,
+					    smb_fname_src,
+					    dst_dirfsp,
+					    smb_fname_dst,
+					    how);
+	return smb_time_audit_nsop_sent(req, subreq, ev);
+}
+
+static struct tevent_req *smb_time_audit_unlinkat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *dirfsp,
+	const struct smb_filename *smb_fname,
+	int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = smb_time_audit_nsop_create(mem_ctx,
+					 "async unlinkat",
+					 smb_vfs_call_unlinkat_recv,
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->msg = smb_time_audit_at_msg(state, dirfsp, smb_fname);
+
+	subreq = SMB_VFS_NEXT_UNLINKAT_SEND(state,
+					    ev,
+					    handle,
+					    dirfsp,
+					    smb_fname,
+					    flags);
+	return smb_time_audit_nsop_sent(req, subreq, ev);
+}
+
+static struct tevent_req *smb_time_audit_linkat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_handle_struct *handle,
+	struct files_struct *src_dirfsp,
+	const struct smb_filename *old_smb_fname,
+	struct files_struct *dst_dirfsp,
+	const struct smb_filename *new_smb_fname,
+	int flags)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = smb_time_audit_nsop_create(mem_ctx,
+					 "async linkat",
+					 smb_vfs_call_linkat_recv,
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->msg = smb_time_audit_at_msg(state, dst_dirfsp, new_smb_fname);
+
+	subreq = SMB_VFS_NEXT_LINKAT_SEND(state,
+					  ev,
+					  handle,
+					  src_dirfsp,
+					  old_smb_fname,
+					  dst_dirfsp,
+					  new_smb_fname,
+					  flags);
+	return smb_time_audit_nsop_sent(req, subreq, ev);
+}
+
+static struct tevent_req *smb_time_audit_close_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb_time_audit_nsop_state *state = NULL;
+
+	req = smb_time_audit_nsop_create(mem_ctx,
+					 "async close",
+					 smb_vfs_call_close_recv,
+					 &state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->msg = talloc_asprintf(state,
+				     "filename = \"%s\"",
+				     fsp_str_dbg(fsp));
+
+	subreq = SMB_VFS_NEXT_CLOSE_SEND(state, ev, handle, fsp);
+	return smb_time_audit_nsop_sent(req, subreq, ev);
+}
+
+static NTSTATUS smb_time_audit_flush_cached_writes(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp)
+{
+	NTSTATUS result;
+	struct timespec ts1,ts2;
+	double timediff;
+
+	clock_gettime_mono(&ts1);
+	result = SMB_VFS_NEXT_FLUSH_CACHED_WRITES(handle, fsp);
+	clock_gettime_mono(&ts2);
+	timediff = nsec_time_diff(&ts2,&ts1)*1.0e-9;
+
+	if (timediff > audit_timeout) {
+		smb_time_audit_log_fsp("flush_cached_writes", timediff, fsp);
+	}
+
+	return result;
+}
+
 static int smb_time_audit_stat(vfs_handle_struct *handle,
 			       struct smb_filename *fname)
 {
@@ -2700,10 +2997,14 @@ static struct vfs_fn_pointers vfs_time_audit_fns = {
 	.readdir_fn = smb_time_audit_readdir,
 	.rewind_dir_fn = smb_time_audit_rewinddir,
 	.mkdirat_fn = smb_time_audit_mkdirat,
+	.mkdirat_send_fn = smb_time_audit_mkdirat_send,
+	.mkdirat_recv_fn = smb_time_audit_nsop_recv,
 	.closedir_fn = smb_time_audit_closedir,
 	.openat_fn = smb_time_audit_openat,
 	.create_file_fn = smb_time_audit_create_file,
 	.close_fn = smb_time_audit_close,
+	.close_send_fn = smb_time_audit_close_send,
+	.close_recv_fn = smb_time_audit_nsop_recv,
 	.pread_fn = smb_time_audit_pread,
 	.pread_send_fn = smb_time_audit_pread_send,
 	.pread_recv_fn = smb_time_audit_pread_recv,
@@ -2712,17 +3013,23 @@ static struct vfs_fn_pointers vfs_time_audit_fns = {
 	.pwrite_recv_fn = smb_time_audit_pwrite_recv,
 	.lseek_fn = smb_time_audit_lseek,
 	.sendfile_fn = smb_time_audit_sendfile,
+	.splice_read_fd_fn = smb_time_audit_splice_read_fd,
 	.recvfile_fn = smb_time_audit_recvfile,
 	.renameat_fn = smb_time_audit_renameat,
+	.renameat_send_fn = smb_time_audit_renameat_send,
+	.renameat_recv_fn = smb_time_audit_nsop_recv,
 	.rename_stream_fn = smb_time_audit_rename_stream,
 	.fsync_send_fn = smb_time_audit_fsync_send,
 	.fsync_recv_fn = smb_time_audit_fsync_recv,
+	.flush_cached_writes_fn = smb_time_audit_flush_cached_writes,
 	.stat_fn = smb_time_audit_stat,
 	.fstat_fn = smb_time_audit_fstat,
 	.lstat_fn = smb_time_audit_lstat,
 	.fstatat_fn = smb_time_audit_fstatat,
 	.get_alloc_size_fn = smb_time_audit_get_alloc_size,
 	.unlinkat_fn = smb_time_audit_unlinkat,
+	.unlinkat_send_fn = smb_time_audit_unlinkat_send,
+	.unlinkat_recv_fn = smb_time_audit_nsop_recv,
 	.fchmod_fn = smb_time_audit_fchmod,
 	.fchown_fn = smb_time_audit_fchown,
 	.lchown_fn = smb_time_audit_lchown,
@@ -2738,6 +3045,8 @@ static struct vfs_fn_pointers vfs_time_audit_fns = {
 	.symlinkat_fn = smb_time_audit_symlinkat,
 	.readlinkat_fn = smb_time_audit_readlinkat,
 	.linkat_fn = smb_time_audit_linkat,
+	.linkat_send_fn = smb_time_audit_linkat_send,
+	.linkat_recv_fn = smb_time_audit_nsop_recv,
 	.mknodat_fn = smb_time_audit_mknodat,
 	.realpath_fn = smb_time_audit_realpath,
 	.fchflags_fn = smb_time_audit_fchflags,
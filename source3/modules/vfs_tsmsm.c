@@ -449,6 +449,20 @@ static ssize_t tsmsm_sendfile(vfs_handle_struct *handle, int tofd, files_struct
 	return SMB_VFS_NEXT_SENDFILE(handle, tofd, fsp, hdr, offset, n);
 }
 
+static int tsmsm_splice_read_fd(vfs_handle_struct *handle, files_struct *fsp,
+				off_t offset, size_t n)
+{
+	bool file_offline = tsmsm_aio_force(handle, fsp);
+
+	if (file_offline) {
+		DEBUG(10,("tsmsm_splice_read_fd on offline file - rejecting\n"));
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+}
+
 /* We do overload pread to allow notification when file becomes online after offline status */
 /* We don't intercept SMB_VFS_READ here because all file I/O now goes through SMB_VFS_PREAD instead */
 static ssize_t tsmsm_pread(struct vfs_handle_struct *handle, struct files_struct *fsp,
@@ -568,6 +582,7 @@ static struct vfs_fn_pointers tsmsm_fns = {
 	.pwrite_send_fn = tsmsm_pwrite_send,
 	.pwrite_recv_fn = tsmsm_pwrite_recv,
 	.sendfile_fn = tsmsm_sendfile,
+	.splice_read_fd_fn = tsmsm_splice_read_fd,
 	.fset_dos_attributes_fn = tsmsm_fset_dos_attributes,
 	.get_dos_attributes_send_fn = vfs_not_implemented_get_dos_attributes_send,
 	.get_dos_attributes_recv_fn = vfs_not_implemented_get_dos_attributes_recv,
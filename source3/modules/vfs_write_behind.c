@@ -0,0 +1,2269 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *  Coalescing and write-behind of small sequential writes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Clients writing a file sequentially in small chunks keep a number
+ * of writes in flight. This module collects adjacent writes of up to
+ * write_behind:max write bytes per open file into a buffer of up to
+ * write_behind:buffer size bytes and hands them to the next module as
+ * one write.
+ *
+ * With write_behind:durability = strict (the default) a write is only
+ * acknowledged once the buffer it went into has been written. The
+ * first write of a sequence is sent on immediately, the ones arriving
+ * while it is in flight are collected and sent as one write when it
+ * comes back. Nothing the client has been told is written lives in
+ * smbd memory only.
+ *
+ * With write_behind:durability = relaxed writes are acknowledged as
+ * soon as they are in the buffer, but only while the handle holds a
+ * write caching oplock or lease: the client is then the only one
+ * looking at the file, and it caches writes itself. The buffer is
+ * handed to the next module with SMB_VFS_NEXT_PWRITE_SEND() and kept
+ * until the write is done. That happens
+ *
+ *  - when it is full, up to the last write_behind:alignment boundary,
+ *  - write_behind:delay milliseconds after it was started,
+ *  - on byte range locks,
+ *  - before reads of it or of anything in front of it, writes that
+ *    can't go into a buffer, FLUSH, CLOSE and server side copies.
+ *    These wait for the buffers of the file to be written.
+ *
+ * Each handle has at most one write-out in flight, and the buffers of
+ * a file never overlap: a write that would overlap one waits for the
+ * buffers of the file and is passed on. stat reports the size including
+ * the buffers.
+ *
+ * Callers of the sync VFS functions can't wait. Before a break removing
+ * write caching is sent to the client, on a sync close, truncate,
+ * allocation and sync reads and writes the buffers are written
+ * synchronously, those in flight again. Sync changes are redone once
+ * the write-outs in flight at that time have landed.
+ *
+ * A failed write-behind is reported by the next write, FLUSH or CLOSE
+ * of the handle.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbprofile.h"
+#include "lib/util/tevent_unix.h"
+#include "lib/util/tevent_ntstatus.h"
+#include "lib/util/dlinklist.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_VFS
+
+#define MODULE_NAME "write_behind"
+
+enum write_behind_durability {
+	WRITE_BEHIND_STRICT,
+	WRITE_BEHIND_RELAXED,
+};
+
+static const struct enum_list write_behind_durability_list[] = {
+	{ WRITE_BEHIND_STRICT, "strict" },
+	{ WRITE_BEHIND_RELAXED, "relaxed" },
+	{ -1, NULL }
+};
+
+struct write_behind_config {
+	enum write_behind_durability durability;
+	size_t max_write;
+	size_t buffer_size;
+	size_t alignment;
+	int delay_ms;
+};
+
+struct write_behind_fsp;
+
+/*
+ * Relaxed mode: a sync change of the file made while a write-out was in
+ * flight. The write-out might land after it, so it is done again.
+ */
+enum write_behind_replay_op {
+	WRITE_BEHIND_REPLAY_PWRITE,
+	WRITE_BEHIND_REPLAY_FTRUNCATE,
+	WRITE_BEHIND_REPLAY_FALLOCATE,
+};
+
+struct write_behind_replay {
+	struct write_behind_replay *prev, *next;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	enum write_behind_replay_op op;
+	uint8_t *data;
+	uint32_t mode;
+	off_t offset;
+	off_t len;
+};
+
+/*
+ * Adjacent writes to be sent on as one. In strict mode reqs[] are the
+ * writes waiting for it, entries are NULL once a caller went away.
+ */
+struct write_behind_buf {
+	struct write_behind_buf *prev, *next;
+	struct write_behind_fsp *wb;
+	struct tevent_context *ev;
+	uint8_t *data;
+	off_t ofs;
+	size_t len;
+	struct tevent_req **reqs;
+	struct tevent_req *subreq;
+
+	/* relaxed mode only from here */
+	struct file_id id;
+
+	/* Waiters don't wait for buffers started after them */
+	uint64_t seq;
+
+	/* Write-out after write_behind:delay */
+	struct tevent_timer *te;
+
+	/* Bytes written by the next module so far */
+	size_t written;
+
+	/* Write-out requested while the handle had one in flight */
+	bool queued;
+
+	/* Written synchronously while in flight */
+	bool rewritten;
+
+	/* The fd written to, kept open after the handle was closed */
+	int fd;
+
+	struct write_behind_replay *replays;
+};
+
+struct write_behind_fsp {
+	struct write_behind_fsp *prev, *next;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	const struct write_behind_config *config;
+
+	/* The buffer collecting writes */
+	struct write_behind_buf *buf;
+
+	/* strict: buffers in flight to the next module */
+	struct write_behind_buf *issued;
+
+	/* relaxed: buffers of this handle on write_behind_inflight */
+	unsigned num_inflight;
+
+	/* relaxed: the fd while write_behind_close_send() waits */
+	int close_fd;
+
+	/* relaxed: the error of a failed write-behind, reported once */
+	int error;
+};
+
+struct write_behind_wait_state;
+
+/*
+ * Relaxed mode. Several handles can share a write caching lease, they
+ * all have to see the data of each other.
+ *
+ * write_behind_dirty: handles with acknowledged data in their buffer
+ * write_behind_inflight: buffers being written by the next module
+ * write_behind_waiters: requests waiting for buffers to be written
+ */
+static struct write_behind_fsp *write_behind_dirty;
+static struct write_behind_buf *write_behind_inflight;
+static struct write_behind_wait_state *write_behind_waiters;
+static uint64_t write_behind_seq;
+
+struct write_behind_pwrite_state {
+	struct tevent_context *ev;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	const void *data;
+	struct write_behind_buf *buf;
+	size_t idx;
+	size_t n;
+	off_t offset;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void write_behind_wake(void);
+
+static void write_behind_buf_detach(struct write_behind_buf *buf)
+{
+	size_t i, num_reqs = talloc_array_length(buf->reqs);
+
+	for (i = 0; i < num_reqs; i++) {
+		struct write_behind_pwrite_state *state = NULL;
+
+		if (buf->reqs[i] == NULL) {
+			continue;
+		}
+		state = tevent_req_data(buf->reqs[i],
+					struct write_behind_pwrite_state);
+		state->buf = NULL;
+		buf->reqs[i] = NULL;
+	}
+}
+
+static int write_behind_buf_destructor(struct write_behind_buf *buf)
+{
+	if (buf->subreq != NULL) {
+		/* The next module still writes from buf->data */
+		return -1;
+	}
+	write_behind_buf_detach(buf);
+	return 0;
+}
+
+static void write_behind_fsp_destroy(void *p_data)
+{
+	struct write_behind_fsp *wb = (struct write_behind_fsp *)p_data;
+	struct write_behind_buf *buf = NULL;
+	bool dropped = false;
+
+	if (wb->config->durability == WRITE_BEHIND_RELAXED &&
+	    wb->buf != NULL)
+	{
+		DBG_WARNING("Dropping %zu unwritten bytes at %jd of %s\n",
+			    wb->buf->len,
+			    (intmax_t)wb->buf->ofs,
+			    fsp_str_dbg(wb->fsp));
+		DLIST_REMOVE(write_behind_dirty, wb);
+		dropped = true;
+	}
+	TALLOC_FREE(wb->buf);
+
+	for (buf = wb->issued; buf != NULL; buf = buf->next) {
+		buf->wb = NULL;
+	}
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if (buf->wb == wb) {
+			buf->wb = NULL;
+		}
+	}
+
+	if (dropped) {
+		write_behind_wake();
+	}
+}
+
+static struct write_behind_fsp *write_behind_fsp_get(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp)
+{
+	struct write_behind_config *config = NULL;
+	struct write_behind_fsp *wb = NULL;
+
+	wb = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (wb != NULL) {
+		return wb;
+	}
+
+	SMB_VFS_HANDLE_GET_DATA(handle,
+				config,
+				struct write_behind_config,
+				return NULL);
+
+	wb = VFS_ADD_FSP_EXTENSION(handle,
+				   fsp,
+				   struct write_behind_fsp,
+				   write_behind_fsp_destroy);
+	if (wb == NULL) {
+		return NULL;
+	}
+	*wb = (struct write_behind_fsp) {
+		.handle = handle,
+		.fsp = fsp,
+		.config = config,
+		.close_fd = -1,
+	};
+	return wb;
+}
+
+static struct write_behind_buf *write_behind_buf_new(
+	struct write_behind_fsp *wb,
+	struct tevent_context *ev,
+	off_t ofs)
+{
+	struct write_behind_buf *buf = NULL;
+
+	buf = talloc_zero(wb->handle->conn, struct write_behind_buf);
+	if (buf == NULL) {
+		return NULL;
+	}
+	buf->data = talloc_array(buf, uint8_t, wb->config->buffer_size);
+	if (buf->data == NULL) {
+		TALLOC_FREE(buf);
+		return NULL;
+	}
+	buf->wb = wb;
+	buf->ev = ev;
+	buf->ofs = ofs;
+	buf->id = wb->fsp->file_id;
+	buf->seq = ++write_behind_seq;
+	buf->fd = -1;
+	talloc_set_destructor(buf, write_behind_buf_destructor);
+	return buf;
+}
+
+static bool write_behind_buf_fits(const struct write_behind_buf *buf,
+				  size_t buffer_size,
+				  size_t n,
+				  off_t offset)
+{
+	if (offset != buf->ofs + (off_t)buf->len) {
+		return false;
+	}
+	return (buffer_size - buf->len) >= n;
+}
+
+static void write_behind_buf_append(struct write_behind_fsp *wb,
+				    const void *data,
+				    size_t n)
+{
+	struct write_behind_buf *buf = wb->buf;
+
+	memcpy(buf->data + buf->len, data, n);
+	buf->len += n;
+
+	if (buf->len != n) {
+		SMBPROFILE_COUNT_INCREMENT_X(SNUM(wb->handle->conn),
+					     write_behind_coalesced,
+					     1);
+	}
+}
+
+static off_t write_behind_buf_end(const struct write_behind_buf *buf)
+{
+	return buf->ofs + (off_t)buf->len;
+}
+
+/*
+ * Relaxed mode: only cache while nobody else can look at the file.
+ */
+static bool write_behind_may_cache(struct files_struct *fsp)
+{
+	if (!(fsp_lease_type(fsp) & SMB2_LEASE_WRITE)) {
+		return false;
+	}
+	if (fsp->sent_oplock_break != NO_BREAK_SENT) {
+		return false;
+	}
+	if ((fsp->oplock_type == LEASE_OPLOCK) &&
+	    (fsp->lease->lease.lease_flags &
+	     SMB2_LEASE_FLAG_BREAK_IN_PROGRESS))
+	{
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Does a read of [offset, offset+count) of the file id have to see buf?
+ * id == NULL means all files, count == 0 the whole file. Buffers behind
+ * the range count as well: they might extend the file, and a read
+ * beyond the old EOF has to return the zeros up to them instead of a
+ * short read.
+ */
+static bool write_behind_buf_matches(const struct write_behind_buf *buf,
+				     const struct file_id *id,
+				     off_t offset,
+				     off_t count)
+{
+	if ((id != NULL) && !file_id_equal(&buf->id, id)) {
+		return false;
+	}
+	if (count == 0) {
+		return true;
+	}
+	return offset < write_behind_buf_end(buf);
+}
+
+static void write_behind_set_buf(struct write_behind_fsp *wb,
+				 struct write_behind_buf *buf)
+{
+	if ((wb->buf == NULL) && (buf != NULL)) {
+		DLIST_ADD(write_behind_dirty, wb);
+	}
+	if ((wb->buf != NULL) && (buf == NULL)) {
+		DLIST_REMOVE(write_behind_dirty, wb);
+	}
+	wb->buf = buf;
+}
+
+/*
+ * Relaxed mode: a write to [offset, offset+n) can't go into the buffer
+ * of wb if it overlaps data buffered or being written, buffers of a file
+ * are written in any order. Neither while sync changes wait to be done
+ * again.
+ */
+static bool write_behind_conflicts(struct write_behind_fsp *wb,
+				   off_t offset,
+				   size_t n)
+{
+	const struct file_id *id = &wb->fsp->file_id;
+	off_t end = offset + (off_t)n;
+	struct write_behind_buf *buf = NULL;
+	struct write_behind_fsp *w = NULL;
+
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if (!file_id_equal(&buf->id, id)) {
+			continue;
+		}
+		if (buf->replays != NULL) {
+			return true;
+		}
+		if ((offset < write_behind_buf_end(buf)) && (end > buf->ofs)) {
+			return true;
+		}
+	}
+
+	for (w = write_behind_dirty; w != NULL; w = w->next) {
+		buf = w->buf;
+
+		if (!file_id_equal(&buf->id, id)) {
+			continue;
+		}
+		if ((offset < write_behind_buf_end(buf)) && (end > buf->ofs)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * write_behind_close_send() gives the fd of a handle to its caller
+ * before the buffers are written, lend it back to the next module.
+ */
+static bool write_behind_lend_fd(struct write_behind_fsp *wb)
+{
+	if ((wb == NULL) || (wb->close_fd == -1)) {
+		return false;
+	}
+	fsp_set_fd(wb->fsp, wb->close_fd);
+	return true;
+}
+
+static void write_behind_return_fd(struct write_behind_fsp *wb, bool lent)
+{
+	if (lent) {
+		fsp_set_fd(wb->fsp, -1);
+	}
+}
+
+/*
+ * Relaxed mode: synchronously write data for wb, a failure is kept for
+ * the client.
+ */
+static int write_behind_write_sync(struct write_behind_fsp *wb,
+				   const uint8_t *data,
+				   size_t len,
+				   off_t ofs)
+{
+	bool lent = write_behind_lend_fd(wb);
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret;
+
+		ret = SMB_VFS_NEXT_PWRITE(wb->handle,
+					  wb->fsp,
+					  data + done,
+					  len - done,
+					  ofs + done);
+		if (ret == 0) {
+			errno = ENOSPC;
+			ret = -1;
+		}
+		if (ret == -1) {
+			wb->error = errno;
+			DBG_WARNING("Writing %zu bytes at %jd of %s failed: "
+				    "%s\n",
+				    len - done,
+				    (intmax_t)(ofs + done),
+				    fsp_str_dbg(wb->fsp),
+				    strerror(wb->error));
+			write_behind_return_fd(wb, lent);
+			errno = wb->error;
+			return -1;
+		}
+		done += ret;
+	}
+	write_behind_return_fd(wb, lent);
+	return 0;
+}
+
+static void write_behind_timer(struct tevent_context *ev,
+			       struct tevent_timer *te,
+			       struct timeval current_time,
+			       void *private_data);
+
+static struct write_behind_buf *write_behind_buf_start(
+	struct write_behind_fsp *wb,
+	struct tevent_context *ev,
+	off_t ofs)
+{
+	struct write_behind_buf *buf = NULL;
+
+	buf = write_behind_buf_new(wb, ev, ofs);
+	if (buf == NULL) {
+		return NULL;
+	}
+	buf->te = tevent_add_timer(ev,
+				   buf,
+				   timeval_current_ofs_msec(wb->config->delay_ms),
+				   write_behind_timer,
+				   wb);
+	if (buf->te == NULL) {
+		TALLOC_FREE(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static void write_behind_buf_written_out(struct tevent_req *subreq);
+
+static bool write_behind_buf_submit(struct write_behind_buf *buf)
+{
+	struct write_behind_fsp *wb = buf->wb;
+	bool lent = write_behind_lend_fd(wb);
+
+	buf->subreq = SMB_VFS_NEXT_PWRITE_SEND(buf,
+					       buf->ev,
+					       wb->handle,
+					       wb->fsp,
+					       buf->data + buf->written,
+					       buf->len - buf->written,
+					       buf->ofs + buf->written);
+	write_behind_return_fd(wb, lent);
+	if (buf->subreq == NULL) {
+		return false;
+	}
+	tevent_req_set_callback(buf->subreq, write_behind_buf_written_out, buf);
+	return true;
+}
+
+/*
+ * Relaxed mode: hand the first len bytes of the buffer to the next
+ * module, the rest stays in the buffer.
+ */
+static void write_behind_issue(struct write_behind_fsp *wb, size_t len)
+{
+	struct write_behind_buf *buf = wb->buf;
+	struct write_behind_buf *rest = NULL;
+	bool ok;
+
+	if (len < buf->len) {
+		rest = write_behind_buf_start(wb, buf->ev, buf->ofs + len);
+	}
+	if (rest != NULL) {
+		memcpy(rest->data, buf->data + len, buf->len - len);
+		rest->len = buf->len - len;
+		rest->seq = buf->seq;
+		rest->queued = buf->queued;
+		buf->len = len;
+	}
+
+	TALLOC_FREE(buf->te);
+	buf->queued = false;
+	write_behind_set_buf(wb, NULL);
+	write_behind_set_buf(wb, rest);
+
+	ok = write_behind_buf_submit(buf);
+	if (!ok) {
+		DBG_WARNING("Could not write %zu bytes at %jd of %s\n",
+			    buf->len,
+			    (intmax_t)buf->ofs,
+			    fsp_str_dbg(wb->fsp));
+		wb->error = ENOMEM;
+		TALLOC_FREE(buf);
+		return;
+	}
+	DLIST_ADD_END(write_behind_inflight, buf);
+	wb->num_inflight += 1;
+
+	SMBPROFILE_COUNT_INCREMENT_X(SNUM(wb->handle->conn),
+				     write_behind_flushes,
+				     1);
+}
+
+/*
+ * Relaxed mode: write the buffer of wb as soon as the handle has no
+ * other write-out in flight.
+ */
+static void write_behind_request(struct write_behind_fsp *wb)
+{
+	if (wb->buf == NULL) {
+		return;
+	}
+	if (wb->num_inflight != 0) {
+		wb->buf->queued = true;
+		return;
+	}
+	write_behind_issue(wb, wb->buf->len);
+}
+
+static void write_behind_timer(struct tevent_context *ev,
+			       struct tevent_timer *te,
+			       struct timeval current_time,
+			       void *private_data)
+{
+	struct write_behind_fsp *wb = (struct write_behind_fsp *)private_data;
+
+	wb->buf->te = NULL;
+	write_behind_request(wb);
+}
+
+/*
+ * Relaxed mode: do the sync changes made while buf was in flight again,
+ * buf might just have overwritten them.
+ */
+static void write_behind_replay(struct write_behind_buf *buf)
+{
+	struct write_behind_replay *r = NULL;
+
+	while ((r = buf->replays) != NULL) {
+		struct write_behind_fsp *wb = VFS_FETCH_FSP_EXTENSION(r->handle,
+								      r->fsp);
+		bool lent = write_behind_lend_fd(wb);
+		ssize_t nwritten;
+		int ret = 0;
+
+		DLIST_REMOVE(buf->replays, r);
+
+		switch (r->op) {
+		case WRITE_BEHIND_REPLAY_PWRITE:
+			nwritten = SMB_VFS_NEXT_PWRITE(r->handle,
+						       r->fsp,
+						       r->data,
+						       r->len,
+						       r->offset);
+			if ((nwritten >= 0) && (nwritten != r->len)) {
+				errno = ENOSPC;
+				nwritten = -1;
+			}
+			ret = (nwritten == -1) ? -1 : 0;
+			break;
+		case WRITE_BEHIND_REPLAY_FTRUNCATE:
+			ret = SMB_VFS_NEXT_FTRUNCATE(r->handle, r->fsp, r->len);
+			break;
+		case WRITE_BEHIND_REPLAY_FALLOCATE:
+			ret = SMB_VFS_NEXT_FALLOCATE(r->handle,
+						     r->fsp,
+						     r->mode,
+						     r->offset,
+						     r->len);
+			break;
+		}
+		write_behind_return_fd(wb, lent);
+		if (ret == -1) {
+			DBG_WARNING("Redoing a change of %s failed: %s\n",
+				    fsp_str_dbg(r->fsp),
+				    strerror(errno));
+		}
+		TALLOC_FREE(r);
+	}
+}
+
+/*
+ * Relaxed mode: fsp changed the file by a sync call after
+ * write_behind_flush_sync() wrote the buffers in flight again. Do the
+ * change again when they have landed.
+ */
+static void write_behind_add_replay(struct vfs_handle_struct *handle,
+				    struct files_struct *fsp,
+				    const struct write_behind_replay *change,
+				    const void *data)
+{
+	struct write_behind_buf *buf = NULL;
+
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		struct write_behind_replay *r = NULL;
+
+		if (!file_id_equal(&buf->id, &fsp->file_id)) {
+			continue;
+		}
+
+		r = talloc(buf, struct write_behind_replay);
+		if (r == NULL) {
+			DBG_WARNING("Can't remember a change of %s\n",
+				    fsp_str_dbg(fsp));
+			continue;
+		}
+		*r = *change;
+		r->prev = r->next = NULL;
+		r->handle = handle;
+		r->fsp = fsp;
+
+		if (change->op == WRITE_BEHIND_REPLAY_PWRITE) {
+			r->data = talloc_memdup(r, data, change->len);
+			if (r->data == NULL) {
+				DBG_WARNING("Can't remember a change of %s\n",
+					    fsp_str_dbg(fsp));
+				TALLOC_FREE(r);
+				continue;
+			}
+		}
+		DLIST_ADD_END(buf->replays, r);
+	}
+}
+
+/*
+ * Relaxed mode: fsp goes away, the changes it made have to be done again
+ * through the handle of the write-out.
+ */
+static void write_behind_forget(struct files_struct *fsp)
+{
+	struct write_behind_buf *buf = NULL;
+
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		struct write_behind_replay *r = NULL;
+		struct write_behind_replay *next = NULL;
+
+		if (!file_id_equal(&buf->id, &fsp->file_id)) {
+			continue;
+		}
+
+		for (r = buf->replays; r != NULL; r = next) {
+			next = r->next;
+
+			if (r->fsp != fsp) {
+				continue;
+			}
+			if ((buf->wb != NULL) && (buf->wb->fsp != fsp)) {
+				r->handle = buf->wb->handle;
+				r->fsp = buf->wb->fsp;
+				continue;
+			}
+			DBG_NOTICE("Not redoing a change of %s after close\n",
+				   fsp_str_dbg(fsp));
+			DLIST_REMOVE(buf->replays, r);
+			TALLOC_FREE(r);
+		}
+	}
+}
+
+static void write_behind_buf_written_out(struct tevent_req *subreq)
+{
+	struct write_behind_buf *buf = tevent_req_callback_data(
+		subreq, struct write_behind_buf);
+	struct write_behind_fsp *wb = buf->wb;
+	struct vfs_aio_state aio_state = { 0 };
+	ssize_t ret;
+	bool ok;
+
+	ret = SMB_VFS_PWRITE_RECV(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+	buf->subreq = NULL;
+
+	if (ret == 0) {
+		aio_state.error = ENOSPC;
+		ret = -1;
+	}
+	if (ret > 0) {
+		buf->written += ret;
+	}
+	if ((ret > 0) && (buf->written < buf->len) && (wb != NULL)) {
+		ok = write_behind_buf_submit(buf);
+		if (ok) {
+			return;
+		}
+		aio_state.error = ENOMEM;
+		ret = -1;
+	}
+	if ((ret == -1) && !buf->rewritten && (wb != NULL)) {
+		DBG_WARNING("Writing %zu bytes at %jd of %s failed: %s\n",
+			    buf->len - buf->written,
+			    (intmax_t)(buf->ofs + buf->written),
+			    fsp_str_dbg(wb->fsp),
+			    strerror(aio_state.error));
+		wb->error = aio_state.error;
+	}
+
+	DLIST_REMOVE(write_behind_inflight, buf);
+	if (wb != NULL) {
+		wb->num_inflight -= 1;
+	}
+
+	write_behind_replay(buf);
+
+	if (buf->fd != -1) {
+		close(buf->fd);
+		buf->fd = -1;
+	}
+	TALLOC_FREE(buf);
+
+	if ((wb != NULL) && (wb->buf != NULL) && wb->buf->queued) {
+		write_behind_issue(wb, wb->buf->len);
+	}
+	write_behind_wake();
+}
+
+/*
+ * Relaxed mode: start writing the buffers a read of [offset,
+ * offset+count) of the file id has to see, see
+ * write_behind_buf_matches(). Returns whether any of those started no
+ * later than seq are still unwritten.
+ */
+static bool write_behind_pending(const struct file_id *id,
+				 off_t offset,
+				 off_t count,
+				 uint64_t seq)
+{
+	struct write_behind_fsp *wb = NULL;
+	struct write_behind_fsp *next = NULL;
+	struct write_behind_buf *buf = NULL;
+
+	for (wb = write_behind_dirty; wb != NULL; wb = next) {
+		next = wb->next;
+
+		if ((wb->buf->seq <= seq) &&
+		    write_behind_buf_matches(wb->buf, id, offset, count))
+		{
+			write_behind_request(wb);
+		}
+	}
+
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if ((buf->seq <= seq) &&
+		    write_behind_buf_matches(buf, id, offset, count))
+		{
+			return true;
+		}
+	}
+	for (wb = write_behind_dirty; wb != NULL; wb = wb->next) {
+		if ((wb->buf->seq <= seq) &&
+		    write_behind_buf_matches(wb->buf, id, offset, count))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+struct write_behind_wait_state {
+	struct write_behind_wait_state *prev, *next;
+	struct tevent_req *req;
+	bool all_files;
+	struct file_id id;
+	off_t offset;
+	off_t count;
+	uint64_t seq;
+};
+
+static bool write_behind_wait_pending(struct write_behind_wait_state *state)
+{
+	return write_behind_pending(state->all_files ? NULL : &state->id,
+				    state->offset,
+				    state->count,
+				    state->seq);
+}
+
+static int write_behind_wait_state_destructor(
+	struct write_behind_wait_state *state)
+{
+	DLIST_REMOVE(write_behind_waiters, state);
+	return 0;
+}
+
+/*
+ * Relaxed mode: wait until the buffers a read of [offset, offset+count)
+ * of the file id has to see are written. Buffers started later don't
+ * hold us up.
+ */
+static struct tevent_req *write_behind_wait_send(TALLOC_CTX *mem_ctx,
+						 struct tevent_context *ev,
+						 const struct file_id *id,
+						 off_t offset,
+						 off_t count)
+{
+	struct tevent_req *req = NULL;
+	struct write_behind_wait_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_wait_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->req = req;
+	state->all_files = (id == NULL);
+	if (id != NULL) {
+		state->id = *id;
+	}
+	state->offset = offset;
+	state->count = count;
+	state->seq = write_behind_seq;
+
+	if (!write_behind_wait_pending(state)) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	/*
+	 * We're woken up from the callback of a write-out, which goes
+	 * on with the next buffer afterwards.
+	 */
+	tevent_req_defer_callback(req, ev);
+
+	DLIST_ADD_END(write_behind_waiters, state);
+	talloc_set_destructor(state, write_behind_wait_state_destructor);
+	return req;
+}
+
+static int write_behind_wait_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_unix(req);
+}
+
+static void write_behind_wake(void)
+{
+	struct write_behind_wait_state *state = NULL;
+	struct write_behind_wait_state *next = NULL;
+
+	for (state = write_behind_waiters; state != NULL; state = next) {
+		next = state->next;
+
+		if (write_behind_wait_pending(state)) {
+			continue;
+		}
+		DLIST_REMOVE(write_behind_waiters, state);
+		talloc_set_destructor(state, NULL);
+		tevent_req_done(state->req);
+	}
+}
+
+/*
+ * Relaxed mode, for callers that can't wait: synchronously write the
+ * buffers a read of [offset, offset+count) of fsp has to see, only
+ * those of wb "only" if given.
+ */
+static int write_behind_flush_sync(struct files_struct *fsp,
+				   struct write_behind_fsp *only,
+				   off_t offset,
+				   off_t count)
+{
+	struct write_behind_fsp *wb = NULL;
+	struct write_behind_fsp *next = NULL;
+	struct write_behind_buf *buf = NULL;
+	bool dropped = false;
+	int result = 0;
+	int err = 0;
+	int ret;
+
+	/*
+	 * There's no waiting for a write-out in flight, write its data
+	 * again. It was started before anything still collecting.
+	 */
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if (buf->rewritten || (buf->wb == NULL)) {
+			continue;
+		}
+		if ((only != NULL) && (buf->wb != only)) {
+			continue;
+		}
+		if (!write_behind_buf_matches(buf,
+					      &fsp->file_id,
+					      offset,
+					      count))
+		{
+			continue;
+		}
+
+		ret = write_behind_write_sync(buf->wb,
+					      buf->data,
+					      buf->len,
+					      buf->ofs);
+		if (ret == -1) {
+			if (result == 0) {
+				result = -1;
+				err = errno;
+			}
+			continue;
+		}
+		buf->rewritten = true;
+	}
+
+	for (wb = write_behind_dirty; wb != NULL; wb = next) {
+		next = wb->next;
+
+		if ((only != NULL) && (wb != only)) {
+			continue;
+		}
+		if (!write_behind_buf_matches(wb->buf,
+					      &fsp->file_id,
+					      offset,
+					      count))
+		{
+			continue;
+		}
+
+		buf = wb->buf;
+		write_behind_set_buf(wb, NULL);
+		dropped = true;
+
+		ret = write_behind_write_sync(wb, buf->data, buf->len, buf->ofs);
+		TALLOC_FREE(buf);
+		if (ret == -1 && result == 0) {
+			result = -1;
+			err = errno;
+		}
+
+		SMBPROFILE_COUNT_INCREMENT_X(SNUM(wb->handle->conn),
+					     write_behind_flushes,
+					     1);
+	}
+
+	if (dropped) {
+		write_behind_wake();
+	}
+
+	if (result == -1) {
+		errno = err;
+	}
+	return result;
+}
+
+/*
+ * Relaxed mode: the handle of wb is closed synchronously with its
+ * write-out still in flight, there's at most one. Keep the fd the
+ * write-out goes to open until it is done, the close gets a copy.
+ */
+static void write_behind_keep_fd(struct write_behind_fsp *wb)
+{
+	struct write_behind_buf *buf = NULL;
+	int fd;
+	int dup_fd;
+
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if (buf->wb == wb) {
+			break;
+		}
+	}
+	if (buf == NULL) {
+		return;
+	}
+
+	fd = fsp_get_io_fd(wb->fsp);
+	dup_fd = dup(fd);
+	if (dup_fd == -1) {
+		DBG_ERR("dup() failed: %s, closing %s under a write\n",
+			strerror(errno),
+			fsp_str_dbg(wb->fsp));
+		return;
+	}
+	fsp_set_fd(wb->fsp, -1);
+	fsp_set_fd(wb->fsp, dup_fd);
+
+	buf->fd = fd;
+	buf->wb = NULL;
+	wb->num_inflight -= 1;
+}
+
+static int write_behind_take_error(struct write_behind_fsp *wb)
+{
+	int err;
+
+	if (wb == NULL) {
+		return 0;
+	}
+	err = wb->error;
+	wb->error = 0;
+	return err;
+}
+
+/*
+ * Relaxed mode: put an acknowledged write into the buffer. Returns false
+ * if it has to be passed on once the buffers of the file are written.
+ */
+static bool write_behind_cache(struct write_behind_fsp *wb,
+			       struct tevent_context *ev,
+			       const void *data,
+			       size_t n,
+			       off_t offset)
+{
+	const struct write_behind_config *config = wb->config;
+	struct write_behind_buf *buf = wb->buf;
+
+	if (write_behind_conflicts(wb, offset, n)) {
+		return false;
+	}
+
+	if ((buf != NULL) && (offset != write_behind_buf_end(buf))) {
+		if (wb->num_inflight != 0) {
+			return false;
+		}
+		write_behind_issue(wb, buf->len);
+	}
+
+	buf = wb->buf;
+	if ((buf != NULL) &&
+	    !write_behind_buf_fits(buf, config->buffer_size, n, offset))
+	{
+		off_t end = write_behind_buf_end(buf);
+		off_t aligned = end - (end % config->alignment);
+		size_t len = buf->len;
+
+		if (wb->num_inflight != 0) {
+			return false;
+		}
+		if (aligned > buf->ofs) {
+			len = aligned - buf->ofs;
+		}
+		write_behind_issue(wb, len);
+	}
+
+	buf = wb->buf;
+	if ((buf != NULL) &&
+	    !write_behind_buf_fits(buf, config->buffer_size, n, offset))
+	{
+		/* The rest has to wait for the part in flight */
+		return false;
+	}
+
+	if (wb->buf == NULL) {
+		buf = write_behind_buf_start(wb, ev, offset);
+		if (buf == NULL) {
+			return false;
+		}
+		write_behind_set_buf(wb, buf);
+	}
+
+	write_behind_buf_append(wb, data, n);
+	return true;
+}
+
+/*
+ * Strict mode: hand the buffer to the next module, the writes in it
+ * complete when it comes back.
+ */
+static void write_behind_buf_written(struct tevent_req *subreq);
+
+static void write_behind_buf_complete(struct write_behind_buf *buf,
+				      ssize_t ret,
+				      const struct vfs_aio_state *aio_state)
+{
+	size_t i, num_reqs = talloc_array_length(buf->reqs);
+
+	for (i = 0; i < num_reqs; i++) {
+		struct tevent_req *req = buf->reqs[i];
+		struct write_behind_pwrite_state *state = NULL;
+		off_t done;
+
+		if (req == NULL) {
+			continue;
+		}
+		state = tevent_req_data(req, struct write_behind_pwrite_state);
+		state->buf = NULL;
+		buf->reqs[i] = NULL;
+
+		/*
+		 * Callers might close the file in their callback, don't
+		 * run them under our feet.
+		 */
+		tevent_req_defer_callback(req, buf->ev);
+
+		if (ret == -1) {
+			tevent_req_error(req, aio_state->error);
+			continue;
+		}
+
+		done = ret - (state->offset - buf->ofs);
+		state->ret = MIN(MAX(done, 0), (off_t)state->n);
+		state->vfs_aio_state = *aio_state;
+		tevent_req_done(req);
+	}
+}
+
+static void write_behind_buf_issue(struct write_behind_fsp *wb)
+{
+	struct write_behind_buf *buf = wb->buf;
+
+	wb->buf = NULL;
+
+	buf->subreq = SMB_VFS_NEXT_PWRITE_SEND(buf,
+					       buf->ev,
+					       wb->handle,
+					       wb->fsp,
+					       buf->data,
+					       buf->len,
+					       buf->ofs);
+	if (buf->subreq == NULL) {
+		struct vfs_aio_state aio_state = { .error = ENOMEM };
+
+		write_behind_buf_complete(buf, -1, &aio_state);
+		TALLOC_FREE(buf);
+		return;
+	}
+	tevent_req_set_callback(buf->subreq, write_behind_buf_written, buf);
+	DLIST_ADD_END(wb->issued, buf);
+
+	SMBPROFILE_COUNT_INCREMENT_X(SNUM(wb->handle->conn),
+				     write_behind_flushes,
+				     1);
+}
+
+static void write_behind_buf_written(struct tevent_req *subreq)
+{
+	struct write_behind_buf *buf = tevent_req_callback_data(
+		subreq, struct write_behind_buf);
+	struct write_behind_fsp *wb = buf->wb;
+	struct vfs_aio_state aio_state = { 0 };
+	ssize_t ret;
+
+	ret = SMB_VFS_PWRITE_RECV(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+	buf->subreq = NULL;
+
+	write_behind_buf_complete(buf, ret, &aio_state);
+
+	if (wb != NULL) {
+		DLIST_REMOVE(wb->issued, buf);
+	}
+	TALLOC_FREE(buf);
+
+	if ((wb != NULL) && (wb->issued == NULL) && (wb->buf != NULL)) {
+		write_behind_buf_issue(wb);
+	}
+}
+
+static int write_behind_pwrite_state_destructor(
+	struct write_behind_pwrite_state *state)
+{
+	if (state->buf != NULL) {
+		state->buf->reqs[state->idx] = NULL;
+		state->buf = NULL;
+	}
+	return 0;
+}
+
+static bool write_behind_buf_add_req(struct write_behind_buf *buf,
+				     struct tevent_req *req)
+{
+	struct write_behind_pwrite_state *state = tevent_req_data(
+		req, struct write_behind_pwrite_state);
+	size_t num_reqs = talloc_array_length(buf->reqs);
+	struct tevent_req **reqs = NULL;
+
+	reqs = talloc_realloc(buf, buf->reqs, struct tevent_req *,
+			      num_reqs + 1);
+	if (reqs == NULL) {
+		return false;
+	}
+	reqs[num_reqs] = req;
+	buf->reqs = reqs;
+
+	state->buf = buf;
+	state->idx = num_reqs;
+	talloc_set_destructor(state, write_behind_pwrite_state_destructor);
+	return true;
+}
+
+static void write_behind_pwrite_waited(struct tevent_req *subreq);
+static void write_behind_pwrite_next(struct tevent_req *req);
+static void write_behind_pwrite_done(struct tevent_req *subreq);
+
+static struct tevent_req *write_behind_pwrite_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	const void *data,
+	size_t n,
+	off_t offset)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct write_behind_pwrite_state *state = NULL;
+	struct write_behind_fsp *wb = NULL;
+	const struct write_behind_config *config = NULL;
+	bool ok;
+	int ret;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_pwrite_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->handle = handle;
+	state->fsp = fsp;
+	state->data = data;
+	state->n = n;
+	state->offset = offset;
+
+	wb = write_behind_fsp_get(handle, fsp);
+	if (tevent_req_nomem(wb, req)) {
+		return tevent_req_post(req, ev);
+	}
+	config = wb->config;
+
+	if (config->durability == WRITE_BEHIND_RELAXED) {
+		ret = write_behind_take_error(wb);
+		if (ret != 0) {
+			tevent_req_error(req, ret);
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	if ((n == 0) || (n > config->max_write) ||
+	    fsp->fsp_flags.posix_append)
+	{
+		goto pass_through;
+	}
+
+	if (config->durability == WRITE_BEHIND_RELAXED) {
+		if (!write_behind_may_cache(fsp)) {
+			goto pass_through;
+		}
+		ok = write_behind_cache(wb, ev, data, n, offset);
+		if (!ok) {
+			goto pass_through;
+		}
+		state->ret = n;
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	if (wb->buf != NULL) {
+		if (offset != wb->buf->ofs + (off_t)wb->buf->len) {
+			/*
+			 * Not part of the sequence we collect, don't make
+			 * it wait.
+			 */
+			goto pass_through;
+		}
+		if (!write_behind_buf_fits(wb->buf,
+					   config->buffer_size,
+					   n,
+					   offset))
+		{
+			write_behind_buf_issue(wb);
+		}
+	}
+
+	if (wb->buf == NULL) {
+		wb->buf = write_behind_buf_new(wb, ev, offset);
+		if (tevent_req_nomem(wb->buf, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	ok = write_behind_buf_add_req(wb->buf, req);
+	if (!ok) {
+		tevent_req_oom(req);
+		return tevent_req_post(req, ev);
+	}
+	write_behind_buf_append(wb, data, n);
+
+	if (wb->issued == NULL) {
+		write_behind_buf_issue(wb);
+	}
+	return req;
+
+pass_through:
+	/*
+	 * Relaxed mode: go behind everything acknowledged before, the
+	 * write might overlap it.
+	 */
+	if (write_behind_pending(&fsp->file_id, 0, 0, write_behind_seq)) {
+		subreq = write_behind_wait_send(state, ev, &fsp->file_id, 0, 0);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, write_behind_pwrite_waited, req);
+		return req;
+	}
+
+	write_behind_pwrite_next(req);
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void write_behind_pwrite_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = write_behind_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	write_behind_pwrite_next(req);
+}
+
+static void write_behind_pwrite_next(struct tevent_req *req)
+{
+	struct write_behind_pwrite_state *state = tevent_req_data(
+		req, struct write_behind_pwrite_state);
+	struct tevent_req *subreq = NULL;
+
+	subreq = SMB_VFS_NEXT_PWRITE_SEND(state,
+					  state->ev,
+					  state->handle,
+					  state->fsp,
+					  state->data,
+					  state->n,
+					  state->offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, write_behind_pwrite_done, req);
+}
+
+static void write_behind_pwrite_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_behind_pwrite_state *state = tevent_req_data(
+		req, struct write_behind_pwrite_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static ssize_t write_behind_pwrite_recv(struct tevent_req *req,
+					struct vfs_aio_state *vfs_aio_state)
+{
+	struct write_behind_pwrite_state *state = tevent_req_data(
+		req, struct write_behind_pwrite_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static ssize_t write_behind_pwrite(struct vfs_handle_struct *handle,
+				   struct files_struct *fsp,
+				   const void *data,
+				   size_t n,
+				   off_t offset)
+{
+	struct write_behind_fsp *wb = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	ssize_t nwritten;
+	int ret;
+
+	if ((wb != NULL) && (wb->config->durability == WRITE_BEHIND_RELAXED)) {
+		ret = write_behind_take_error(wb);
+		if (ret != 0) {
+			errno = ret;
+			return -1;
+		}
+	}
+
+	ret = write_behind_flush_sync(fsp, NULL, 0, 0);
+	if (ret == -1) {
+		return -1;
+	}
+	nwritten = SMB_VFS_NEXT_PWRITE(handle, fsp, data, n, offset);
+	if (nwritten > 0) {
+		struct write_behind_replay change = {
+			.op = WRITE_BEHIND_REPLAY_PWRITE,
+			.offset = offset,
+			.len = nwritten,
+		};
+		write_behind_add_replay(handle, fsp, &change, data);
+	}
+	return nwritten;
+}
+
+static ssize_t write_behind_pread(struct vfs_handle_struct *handle,
+				  struct files_struct *fsp,
+				  void *data,
+				  size_t n,
+				  off_t offset)
+{
+	int ret;
+
+	ret = write_behind_flush_sync(fsp, NULL, offset, n);
+	if (ret == -1) {
+		return -1;
+	}
+	return SMB_VFS_NEXT_PREAD(handle, fsp, data, n, offset);
+}
+
+struct write_behind_pread_state {
+	struct tevent_context *ev;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	void *data;
+	size_t n;
+	off_t offset;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void write_behind_pread_waited(struct tevent_req *subreq);
+static void write_behind_pread_next(struct tevent_req *req);
+static void write_behind_pread_done(struct tevent_req *subreq);
+
+static struct tevent_req *write_behind_pread_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	void *data,
+	size_t n,
+	off_t offset)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct write_behind_pread_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_pread_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->handle = handle;
+	state->fsp = fsp;
+	state->data = data;
+	state->n = n;
+	state->offset = offset;
+
+	if (write_behind_pending(&fsp->file_id, offset, n, write_behind_seq)) {
+		subreq = write_behind_wait_send(state,
+						ev,
+						&fsp->file_id,
+						offset,
+						n);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, write_behind_pread_waited, req);
+		return req;
+	}
+
+	write_behind_pread_next(req);
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void write_behind_pread_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = write_behind_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	write_behind_pread_next(req);
+}
+
+static void write_behind_pread_next(struct tevent_req *req)
+{
+	struct write_behind_pread_state *state = tevent_req_data(
+		req, struct write_behind_pread_state);
+	struct tevent_req *subreq = NULL;
+
+	subreq = SMB_VFS_NEXT_PREAD_SEND(state,
+					 state->ev,
+					 state->handle,
+					 state->fsp,
+					 state->data,
+					 state->n,
+					 state->offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, write_behind_pread_done, req);
+}
+
+static void write_behind_pread_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_behind_pread_state *state = tevent_req_data(
+		req, struct write_behind_pread_state);
+
+	state->ret = SMB_VFS_PREAD_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static ssize_t write_behind_pread_recv(struct tevent_req *req,
+				       struct vfs_aio_state *vfs_aio_state)
+{
+	struct write_behind_pread_state *state = tevent_req_data(
+		req, struct write_behind_pread_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static ssize_t write_behind_sendfile(struct vfs_handle_struct *handle,
+				     int tofd,
+				     files_struct *fromfsp,
+				     const DATA_BLOB *hdr,
+				     off_t offset,
+				     size_t n)
+{
+	int ret;
+
+	ret = write_behind_flush_sync(fromfsp, NULL, offset, n);
+	if (ret == -1) {
+		return -1;
+	}
+	return SMB_VFS_NEXT_SENDFILE(handle, tofd, fromfsp, hdr, offset, n);
+}
+
+static int write_behind_splice_read_fd(struct vfs_handle_struct *handle,
+				       files_struct *fsp,
+				       off_t offset,
+				       size_t n)
+{
+	int ret;
+
+	ret = write_behind_flush_sync(fsp, NULL, offset, n);
+	if (ret == -1) {
+		return -1;
+	}
+	return SMB_VFS_NEXT_SPLICE_READ_FD(handle, fsp, offset, n);
+}
+
+static int write_behind_fstat(struct vfs_handle_struct *handle,
+			      struct files_struct *fsp,
+			      SMB_STRUCT_STAT *sbuf)
+{
+	struct write_behind_fsp *wb = NULL;
+	struct write_behind_buf *buf = NULL;
+	int ret;
+
+	ret = SMB_VFS_NEXT_FSTAT(handle, fsp, sbuf);
+	if (ret == -1) {
+		return -1;
+	}
+
+	/*
+	 * The buffers are part of the file, no need to write them for
+	 * the size.
+	 */
+	for (buf = write_behind_inflight; buf != NULL; buf = buf->next) {
+		if (file_id_equal(&buf->id, &fsp->file_id)) {
+			sbuf->st_ex_size = MAX(sbuf->st_ex_size,
+					       write_behind_buf_end(buf));
+		}
+	}
+	for (wb = write_behind_dirty; wb != NULL; wb = wb->next) {
+		if (file_id_equal(&wb->buf->id, &fsp->file_id)) {
+			sbuf->st_ex_size = MAX(sbuf->st_ex_size,
+					       write_behind_buf_end(wb->buf));
+		}
+	}
+	return 0;
+}
+
+static int write_behind_ftruncate(struct vfs_handle_struct *handle,
+				  struct files_struct *fsp,
+				  off_t len)
+{
+	struct write_behind_replay change = {
+		.op = WRITE_BEHIND_REPLAY_FTRUNCATE,
+		.len = len,
+	};
+	int ret;
+
+	ret = write_behind_flush_sync(fsp, NULL, 0, 0);
+	if (ret == -1) {
+		return -1;
+	}
+	ret = SMB_VFS_NEXT_FTRUNCATE(handle, fsp, len);
+	if (ret == 0) {
+		write_behind_add_replay(handle, fsp, &change, NULL);
+	}
+	return ret;
+}
+
+static int write_behind_fallocate(struct vfs_handle_struct *handle,
+				  struct files_struct *fsp,
+				  uint32_t mode,
+				  off_t offset,
+				  off_t len)
+{
+	struct write_behind_replay change = {
+		.op = WRITE_BEHIND_REPLAY_FALLOCATE,
+		.mode = mode,
+		.offset = offset,
+		.len = len,
+	};
+	int ret;
+
+	ret = write_behind_flush_sync(fsp, NULL, 0, 0);
+	if (ret == -1) {
+		return -1;
+	}
+	ret = SMB_VFS_NEXT_FALLOCATE(handle, fsp, mode, offset, len);
+	if (ret == 0) {
+		write_behind_add_replay(handle, fsp, &change, NULL);
+	}
+	return ret;
+}
+
+static NTSTATUS write_behind_brl_lock_windows(struct vfs_handle_struct *handle,
+					      struct byte_range_lock *br_lck,
+					      struct lock_struct *plock)
+{
+	struct files_struct *fsp = brl_fsp(br_lck);
+	struct write_behind_fsp *wb = NULL;
+	struct write_behind_fsp *next = NULL;
+
+	/*
+	 * Only another handle under the same lease can look at the
+	 * range, and its reads wait for the buffers anyway. Just don't
+	 * sit on them.
+	 */
+	for (wb = write_behind_dirty; wb != NULL; wb = next) {
+		next = wb->next;
+
+		if (file_id_equal(&wb->buf->id, &fsp->file_id)) {
+			write_behind_request(wb);
+		}
+	}
+	return SMB_VFS_NEXT_BRL_LOCK_WINDOWS(handle, br_lck, plock);
+}
+
+static NTSTATUS write_behind_flush_cached_writes(
+	struct vfs_handle_struct *handle,
+	struct files_struct *fsp)
+{
+	int ret;
+
+	ret = write_behind_flush_sync(fsp, NULL, 0, 0);
+	if (ret == -1) {
+		return map_nt_error_from_unix(errno);
+	}
+	return SMB_VFS_NEXT_FLUSH_CACHED_WRITES(handle, fsp);
+}
+
+struct write_behind_fsync_state {
+	struct tevent_context *ev;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	int ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void write_behind_fsync_waited(struct tevent_req *subreq);
+static void write_behind_fsync_next(struct tevent_req *req);
+static void write_behind_fsync_done(struct tevent_req *subreq);
+
+static struct tevent_req *write_behind_fsync_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct write_behind_fsync_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_fsync_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->handle = handle;
+	state->fsp = fsp;
+
+	if (write_behind_pending(&fsp->file_id, 0, 0, write_behind_seq)) {
+		subreq = write_behind_wait_send(state, ev, &fsp->file_id, 0, 0);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, write_behind_fsync_waited, req);
+		return req;
+	}
+
+	write_behind_fsync_next(req);
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void write_behind_fsync_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = write_behind_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	write_behind_fsync_next(req);
+}
+
+static void write_behind_fsync_next(struct tevent_req *req)
+{
+	struct write_behind_fsync_state *state = tevent_req_data(
+		req, struct write_behind_fsync_state);
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	ret = write_behind_take_error(
+		VFS_FETCH_FSP_EXTENSION(state->handle, state->fsp));
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+
+	subreq = SMB_VFS_NEXT_FSYNC_SEND(state,
+					 state->ev,
+					 state->handle,
+					 state->fsp);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, write_behind_fsync_done, req);
+}
+
+static void write_behind_fsync_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_behind_fsync_state *state = tevent_req_data(
+		req, struct write_behind_fsync_state);
+
+	state->ret = SMB_VFS_FSYNC_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static int write_behind_fsync_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state)
+{
+	struct write_behind_fsync_state *state = tevent_req_data(
+		req, struct write_behind_fsync_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static int write_behind_close(struct vfs_handle_struct *handle,
+			      struct files_struct *fsp)
+{
+	struct write_behind_fsp *wb = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	int err = 0;
+	int ret;
+
+	if (wb != NULL) {
+		/*
+		 * Write what is left of the buffers of fsp before it goes
+		 * away, the error is the first one the client has not
+		 * seen yet.
+		 */
+		(void)write_behind_flush_sync(fsp, wb, 0, 0);
+		write_behind_keep_fd(wb);
+		err = write_behind_take_error(wb);
+	}
+	write_behind_forget(fsp);
+
+	ret = SMB_VFS_NEXT_CLOSE(handle, fsp);
+	if ((ret == 0) && (err != 0)) {
+		errno = err;
+		ret = -1;
+	}
+	return ret;
+}
+
+struct write_behind_close_state {
+	struct tevent_context *ev;
+	struct vfs_handle_struct *handle;
+	struct files_struct *fsp;
+	int err;
+	int ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void write_behind_close_waited(struct tevent_req *subreq);
+static void write_behind_close_next(struct tevent_req *req);
+static void write_behind_close_done(struct tevent_req *subreq);
+
+static struct tevent_req *write_behind_close_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct write_behind_close_state *state = NULL;
+	struct write_behind_fsp *wb = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_close_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->handle = handle;
+	state->fsp = fsp;
+
+	if ((wb != NULL) && ((wb->buf != NULL) || (wb->num_inflight != 0))) {
+		subreq = write_behind_wait_send(state, ev, &fsp->file_id, 0, 0);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, write_behind_close_waited, req);
+
+		/*
+		 * Our caller takes the fd away once we return, the
+		 * write-outs and the close still need it.
+		 */
+		wb->close_fd = fsp_get_io_fd(fsp);
+		return req;
+	}
+
+	write_behind_close_next(req);
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void write_behind_close_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = write_behind_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	write_behind_close_next(req);
+}
+
+static void write_behind_close_next(struct tevent_req *req)
+{
+	struct write_behind_close_state *state = tevent_req_data(
+		req, struct write_behind_close_state);
+	struct write_behind_fsp *wb = VFS_FETCH_FSP_EXTENSION(state->handle,
+							      state->fsp);
+	struct tevent_req *subreq = NULL;
+	bool lent = false;
+
+	if (wb != NULL) {
+		state->err = write_behind_take_error(wb);
+		lent = write_behind_lend_fd(wb);
+		wb->close_fd = -1;
+	}
+	write_behind_forget(state->fsp);
+
+	subreq = SMB_VFS_NEXT_CLOSE_SEND(state,
+					 state->ev,
+					 state->handle,
+					 state->fsp);
+	write_behind_return_fd(wb, lent);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, write_behind_close_done, req);
+}
+
+static void write_behind_close_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_behind_close_state *state = tevent_req_data(
+		req, struct write_behind_close_state);
+
+	state->ret = SMB_VFS_CLOSE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+
+	if ((state->ret == 0) && (state->err != 0)) {
+		state->ret = -1;
+		state->vfs_aio_state.error = state->err;
+	}
+	tevent_req_done(req);
+}
+
+static int write_behind_close_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state)
+{
+	struct write_behind_close_state *state = tevent_req_data(
+		req, struct write_behind_close_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+struct write_behind_offload_write_state {
+	struct tevent_context *ev;
+	struct vfs_handle_struct *handle;
+	uint32_t fsctl;
+	DATA_BLOB *token;
+	off_t transfer_offset;
+	struct files_struct *dest_fsp;
+	off_t dest_off;
+	off_t num;
+	off_t copied;
+};
+
+static void write_behind_offload_write_waited(struct tevent_req *subreq);
+static void write_behind_offload_write_next(struct tevent_req *req);
+static void write_behind_offload_write_done(struct tevent_req *subreq);
+
+static struct tevent_req *write_behind_offload_write_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	uint32_t fsctl,
+	DATA_BLOB *token,
+	off_t transfer_offset,
+	struct files_struct *dest_fsp,
+	off_t dest_off,
+	off_t num)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct write_behind_offload_write_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_behind_offload_write_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct write_behind_offload_write_state) {
+		.ev = ev,
+		.handle = handle,
+		.fsctl = fsctl,
+		.token = token,
+		.transfer_offset = transfer_offset,
+		.dest_fsp = dest_fsp,
+		.dest_off = dest_off,
+		.num = num,
+	};
+
+	/*
+	 * The source is only known by its token here, and the copy
+	 * might bypass SMB_VFS_PREAD. Wait for all buffers.
+	 */
+	if (write_behind_pending(NULL, 0, 0, write_behind_seq)) {
+		subreq = write_behind_wait_send(state, ev, NULL, 0, 0);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					write_behind_offload_write_waited,
+					req);
+		return req;
+	}
+
+	write_behind_offload_write_next(req);
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static void write_behind_offload_write_waited(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	int ret;
+
+	ret = write_behind_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		tevent_req_nterror(req, map_nt_error_from_unix(ret));
+		return;
+	}
+	write_behind_offload_write_next(req);
+}
+
+static void write_behind_offload_write_next(struct tevent_req *req)
+{
+	struct write_behind_offload_write_state *state = tevent_req_data(
+		req, struct write_behind_offload_write_state);
+	struct tevent_req *subreq = NULL;
+
+	subreq = SMB_VFS_NEXT_OFFLOAD_WRITE_SEND(state->handle,
+						 state,
+						 state->ev,
+						 state->fsctl,
+						 state->token,
+						 state->transfer_offset,
+						 state->dest_fsp,
+						 state->dest_off,
+						 state->num);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, write_behind_offload_write_done, req);
+}
+
+static void write_behind_offload_write_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_behind_offload_write_state *state = tevent_req_data(
+		req, struct write_behind_offload_write_state);
+	NTSTATUS status;
+
+	status = SMB_VFS_NEXT_OFFLOAD_WRITE_RECV(state->handle,
+						 subreq,
+						 &state->copied);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static NTSTATUS write_behind_offload_write_recv(
+	struct vfs_handle_struct *handle,
+	struct tevent_req *req,
+	off_t *copied)
+{
+	struct write_behind_offload_write_state *state = tevent_req_data(
+		req, struct write_behind_offload_write_state);
+	NTSTATUS status;
+
+	*copied = state->copied;
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
+
+static int write_behind_connect(struct vfs_handle_struct *handle,
+				const char *service,
+				const char *user)
+{
+	struct write_behind_config *config = NULL;
+	int snum = SNUM(handle->conn);
+	int ret;
+
+	ret = SMB_VFS_NEXT_CONNECT(handle, service, user);
+	if (ret < 0) {
+		return ret;
+	}
+
+	config = talloc_zero(handle->conn, struct write_behind_config);
+	if (config == NULL) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		DBG_ERR("talloc_zero() failed\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	config->durability = lp_parm_enum(snum,
+					  MODULE_NAME,
+					  "durability",
+					  write_behind_durability_list,
+					  WRITE_BEHIND_STRICT);
+	config->max_write = conv_str_size(lp_parm_const_string(snum,
+							       MODULE_NAME,
+							       "max write",
+							       NULL));
+	if (config->max_write == 0) {
+		config->max_write = 64 * 1024;
+	}
+	config->buffer_size = conv_str_size(lp_parm_const_string(
+						    snum,
+						    MODULE_NAME,
+						    "buffer size",
+						    NULL));
+	if (config->buffer_size == 0) {
+		config->buffer_size = 1024 * 1024;
+	}
+	config->buffer_size = MAX(config->buffer_size, config->max_write);
+	config->alignment = conv_str_size(lp_parm_const_string(snum,
+							       MODULE_NAME,
+							       "alignment",
+							       NULL));
+	if (config->alignment == 0) {
+		config->alignment = 64 * 1024;
+	}
+	config->delay_ms = lp_parm_int(snum, MODULE_NAME, "delay", 100);
+	config->delay_ms = MAX(config->delay_ms, 0);
+
+	SMB_VFS_HANDLE_SET_DATA(handle,
+				config,
+				NULL,
+				struct write_behind_config,
+				return -1);
+
+	return 0;
+}
+
+static struct vfs_fn_pointers vfs_write_behind_fns = {
+	.connect_fn = write_behind_connect,
+	.close_fn = write_behind_close,
+	.close_send_fn = write_behind_close_send,
+	.close_recv_fn = write_behind_close_recv,
+	.pread_fn = write_behind_pread,
+	.pread_send_fn = write_behind_pread_send,
+	.pread_recv_fn = write_behind_pread_recv,
+	.pwrite_fn = write_behind_pwrite,
+	.pwrite_send_fn = write_behind_pwrite_send,
+	.pwrite_recv_fn = write_behind_pwrite_recv,
+	.sendfile_fn = write_behind_sendfile,
+	.splice_read_fd_fn = write_behind_splice_read_fd,
+	.fsync_send_fn = write_behind_fsync_send,
+	.fsync_recv_fn = write_behind_fsync_recv,
+	.flush_cached_writes_fn = write_behind_flush_cached_writes,
+	.fstat_fn = write_behind_fstat,
+	.ftruncate_fn = write_behind_ftruncate,
+	.fallocate_fn = write_behind_fallocate,
+	.brl_lock_windows_fn = write_behind_brl_lock_windows,
+	.offload_write_send_fn = write_behind_offload_write_send,
+	.offload_write_recv_fn = write_behind_offload_write_recv,
+};
+
+static_decl_vfs;
+NTSTATUS vfs_write_behind_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION,
+				MODULE_NAME,
+				&vfs_write_behind_fns);
+}
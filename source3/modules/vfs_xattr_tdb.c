@@ -473,7 +473,7 @@ static int xattr_tdb_openat(struct vfs_handle_struct *handle,
 		return -1;
 	}
 
-	fsp->file_id = SMB_VFS_FILE_ID_CREATE(fsp->conn, &sbuf);
+	fsp_set_file_id(fsp, SMB_VFS_FILE_ID_CREATE(fsp->conn, &sbuf));
 
 	xattr_tdb_remove_all_attrs(config->db, &fsp->file_id);
 
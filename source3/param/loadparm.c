@@ -254,6 +254,7 @@ static const struct loadparm_service _sDefault =
 	.nt_acl_support = true,
 	.force_unknown_acl_user = false,
 	._use_sendfile = false,
+	.use_splice = false,
 	.map_acl_inherit = false,
 	.afs_share = false,
 	.ea_support = true,
@@ -276,6 +277,8 @@ static const struct loadparm_service _sDefault =
 	.honor_change_notify_privilege = false,
 	.volume_serial_number = -1,
 	.smb3_unix_extensions = true,
+	.smb3_compress_data = SMB3_COMPRESS_DATA_REQUESTED,
+	.smb3_compression_threshold = 4096,
 	.dummy = ""
 };
 
@@ -896,6 +899,7 @@ void loadparm_s3_init_globals(struct loadparm_context *lp_ctx,
 	Globals.smb2_max_write = DEFAULT_SMB2_MAX_WRITE;
 	Globals.smb2_max_trans = DEFAULT_SMB2_MAX_TRANSACT;
 	Globals.smb2_max_credits = DEFAULT_SMB2_MAX_CREDITS;
+	Globals.smb2_credits_target_latency = 0;
 	Globals.smb2_leases = true;
 	Globals._smb3_directory_leases = Auto;
 	Globals.server_multi_channel_support = true;
@@ -986,6 +990,9 @@ void loadparm_s3_init_globals(struct loadparm_context *lp_ctx,
 	Globals.winbind_debug_traceid = true;
 
 	Globals.aio_max_threads = 100;
+	Globals.smb3_crypto_offload_threshold = 0;
+	Globals.smbd_zerocopy_send_threshold = 0;
+	Globals.smb2_channel_io_threads = false;
 
 	lpcfg_string_set(Globals.ctx,
 			 &Globals.rpc_server_dynamic_port_range,
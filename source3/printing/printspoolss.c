@@ -226,7 +226,8 @@ NTSTATUS print_spool_open(files_struct *fsp,
 		goto done;
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(fsp->conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(fsp->conn, &fsp->fsp_name->st));
 	fsp_set_fd(fsp, fd);
 
 	fsp->vuid = current_vuid;
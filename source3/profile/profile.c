@@ -266,13 +266,15 @@ void smbprofile_dump(struct smbd_server_connection *sconn)
 
 	if (sconn != NULL) {
 		/*
-		 * Sessions, tcons and files don't add up, they are
-		 * transient counters
+		 * Sessions, tcons, files and the credit window
+		 * don't add up, they are transient counters
 		 */
 		profile_p->values.num_sessions_stats.count = sconn->num_users;
 		profile_p->values.num_tcons_stats.count =
 			sconn->num_connections;
 		profile_p->values.num_files_stats.count = sconn->num_files;
+		profile_p->values.smb2_credits_window_stats.count =
+			smbd_smb2_credits_window(sconn);
 	}
 
 	tdb_store(smbprofile_state.internal.db->tdb, key,
@@ -331,11 +333,13 @@ void smbprofile_cleanup(pid_t pid, pid_t dst)
 	smbprofile_stats_accumulate(&acc, &s);
 
 	/*
-	 * Sessions, tcons and files don't add up, they are transient.
+	 * Sessions, tcons, files and the credit window
+	 * don't add up, they are transient.
 	 */
 	acc.values.num_sessions_stats.count = 0;
 	acc.values.num_tcons_stats.count = 0;
 	acc.values.num_files_stats.count = 0;
+	acc.values.smb2_credits_window_stats.count = 0;
 
 	acc.magic = profile_p->magic;
 	acc.summary_record = true;
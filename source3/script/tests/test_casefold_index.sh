@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Blackbox test for "casefold index": a name found in the shared index
+# must not be handed out to a user who can't list the directory.
+#
+
+if [ $# -lt 6 ]; then
+	cat <<EOF
+Usage: test_casefold_index.sh SERVER SERVER_IP USERNAME PASSWORD LOCAL_PATH SMBCLIENT
+EOF
+	exit 1
+fi
+
+SERVER=${1}
+SERVER_IP=${2}
+USERNAME=${3}
+PASSWORD=${4}
+LOCAL_PATH=${5}
+SMBCLIENT=${6}
+SMBCLIENT="$VALGRIND ${SMBCLIENT}"
+
+incdir=$(dirname $0)/../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+
+dir=$LOCAL_PATH/casefold_index
+
+#
+# Enough entries for the directory to be indexed. The index is only
+# stored for directories that have not changed for two seconds.
+#
+setup_dir()
+{
+	mode=$1
+
+	rm -rf $dir
+	mkdir $dir || return 1
+	i=0
+	while [ $i -lt 100 ]; do
+		touch $dir/file$i.txt || return 1
+		i=$(expr $i + 1)
+	done
+	chmod $mode $dir || return 1
+	sleep 3
+}
+
+lookup()
+{
+	user=$1
+
+	cmd='CLI_FORCE_INTERACTIVE=yes $SMBCLIENT -mSMB3 -U$user%$PASSWORD //$SERVER/casefold_index -I $SERVER_IP -c "allinfo casefold_index\\FiLe50.TxT" 2>&1'
+	out=$(eval $cmd)
+	ret=$?
+	echo "$out"
+
+	if [ $ret -ne 0 ]; then
+		return 1
+	fi
+	echo "$out" | grep -q "NT_STATUS_" && return 1
+	return 0
+}
+
+test_index_for_listing_user()
+{
+	setup_dir 0755 || return 1
+	lookup $USERNAME || return 1
+	lookup user1 || return 1
+}
+
+test_index_for_traverse_only_user()
+{
+	setup_dir 0711 || return 1
+	# Builds the index
+	lookup $USERNAME || return 1
+	# Must not be answered from the index
+	lookup user1 && return 1
+	# The owner still gets it
+	lookup $USERNAME || return 1
+}
+
+testit "a user who can list the directory finds the name" \
+	test_index_for_listing_user ||
+	failed=$(expr $failed + 1)
+
+testit "a user who can't list the directory doesn't find the name" \
+	test_index_for_traverse_only_user ||
+	failed=$(expr $failed + 1)
+
+rm -rf $dir
+
+exit $failed
@@ -0,0 +1,445 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *  Case insensitive name index for directories
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * casefold.tdb holds one record per directory, keyed by file_id and
+ * share name. The record is the directory's ctime followed by all its
+ * names, sorted by their upper case version:
+ *
+ * 0:  ctime.tv_sec (uint64)
+ * 8:  ctime.tv_nsec (uint32)
+ * 12: num_entries (uint32)
+ * 16: num_entries offsets (uint32), relative to the start of the record
+ * ...: num_entries times "UPPER\0OnDisk\0"
+ *
+ * Every change to the directory's entries updates its ctime, so a
+ * record with a ctime different from the directory's current one is
+ * ignored and replaced. To not miss changes within the ctime
+ * granularity, directories changed very recently are not stored.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "smbd/casefold_db.h"
+#include "source3/smbd/dir.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+#include "lib/util/tsort.h"
+
+/*
+ * Smaller directories are scanned quickly enough,
+ * don't fill the database with them.
+ */
+#define CASEFOLD_DB_MIN_ENTRIES 64
+
+/*
+ * Don't store directories whose ctime is younger than this,
+ * a change in the same timestamp tick could go unnoticed.
+ */
+#define CASEFOLD_DB_RACY_SEC 2
+
+#define CASEFOLD_DB_HDR_SIZE 16
+
+static struct db_context *casefold_db;
+
+bool casefold_db_init(void)
+{
+	char *db_path;
+
+	if (casefold_db != NULL) {
+		return true;
+	}
+
+	db_path = lock_path(talloc_tos(), "casefold.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	casefold_db = db_open(NULL, db_path,
+			      SMBD_VOLATILE_TDB_HASH_SIZE,
+			      SMBD_VOLATILE_TDB_FLAGS,
+			      O_RDWR|O_CREAT, 0600,
+			      DBWRAP_LOCK_ORDER_NONE, DBWRAP_FLAG_NONE);
+	TALLOC_FREE(db_path);
+	if (casefold_db == NULL) {
+		DBG_ERR("Failed to open casefold.tdb\n");
+		return false;
+	}
+
+	return true;
+}
+
+static TDB_DATA casefold_db_key(TALLOC_CTX *mem_ctx,
+				struct files_struct *dirfsp,
+				const struct stat_ex *st)
+{
+	struct file_id id = vfs_file_id_from_sbuf(dirfsp->conn, st);
+	const char *share = lp_const_servicename(SNUM(dirfsp->conn));
+	size_t sharelen = strlen(share) + 1;
+	uint8_t *buf = NULL;
+
+	buf = talloc_array(mem_ctx, uint8_t, 24 + sharelen);
+	if (buf == NULL) {
+		return (TDB_DATA) { .dsize = 0, };
+	}
+	SBVAL(buf, 0, id.devid);
+	SBVAL(buf, 8, id.inode);
+	SBVAL(buf, 16, id.extid);
+	memcpy(buf + 24, share, sharelen);
+
+	return (TDB_DATA) { .dptr = buf, .dsize = talloc_get_size(buf), };
+}
+
+static bool casefold_db_entry(TDB_DATA data,
+			      uint32_t i,
+			      const char **_folded,
+			      const char **_name)
+{
+	const char *folded = NULL;
+	size_t off, len;
+
+	off = IVAL(data.dptr, CASEFOLD_DB_HDR_SIZE + i * 4);
+	if (off >= data.dsize) {
+		return false;
+	}
+	folded = (const char *)data.dptr + off;
+	len = strnlen(folded, data.dsize - off);
+	if (len == data.dsize - off) {
+		return false;
+	}
+	off += len + 1;
+	if (off >= data.dsize) {
+		return false;
+	}
+	len = strnlen((const char *)data.dptr + off, data.dsize - off);
+	if (len == data.dsize - off) {
+		return false;
+	}
+
+	*_folded = folded;
+	*_name = (const char *)data.dptr + off;
+	return true;
+}
+
+struct casefold_db_find_state {
+	const char *folded;
+	struct timespec ctime;
+	TALLOC_CTX *mem_ctx;
+	char *found_name;
+	NTSTATUS status;
+};
+
+static void casefold_db_find_parser(TDB_DATA key,
+				    TDB_DATA data,
+				    void *private_data)
+{
+	struct casefold_db_find_state *state = private_data;
+	struct timespec ctime;
+	const char *folded = NULL;
+	const char *name = NULL;
+	uint32_t num, lo, hi;
+	bool ok;
+
+	/*
+	 * Anything unexpected means the caller has to scan
+	 */
+	state->status = NT_STATUS_NOT_FOUND;
+
+	if (data.dsize < CASEFOLD_DB_HDR_SIZE) {
+		return;
+	}
+	ctime = (struct timespec) {
+		.tv_sec = BVAL(data.dptr, 0),
+		.tv_nsec = IVAL(data.dptr, 8),
+	};
+	if (timespec_compare(&ctime, &state->ctime) != 0) {
+		return;
+	}
+	num = IVAL(data.dptr, 12);
+	if (num > (data.dsize - CASEFOLD_DB_HDR_SIZE) / 4) {
+		return;
+	}
+
+	/*
+	 * Find the first entry not smaller than what we look for.
+	 * Equal names are sorted in directory order, so we return
+	 * the same name a directory scan would have found.
+	 */
+	lo = 0;
+	hi = num;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		ok = casefold_db_entry(data, mid, &folded, &name);
+		if (!ok) {
+			return;
+		}
+		if (strcmp(folded, state->folded) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == num) {
+		state->status = NT_STATUS_OBJECT_NAME_NOT_FOUND;
+		return;
+	}
+	ok = casefold_db_entry(data, lo, &folded, &name);
+	if (!ok) {
+		return;
+	}
+	if (strcmp(folded, state->folded) != 0) {
+		state->status = NT_STATUS_OBJECT_NAME_NOT_FOUND;
+		return;
+	}
+
+	state->found_name = talloc_strdup(state->mem_ctx, name);
+	if (state->found_name == NULL) {
+		state->status = NT_STATUS_NO_MEMORY;
+		return;
+	}
+	state->status = NT_STATUS_OK;
+}
+
+struct casefold_db_name {
+	char *folded;
+	char *name;
+	uint32_t idx;
+};
+
+static int casefold_db_name_cmp(const struct casefold_db_name *n1,
+				const struct casefold_db_name *n2)
+{
+	int cmp = strcmp(n1->folded, n2->folded);
+
+	if (cmp != 0) {
+		return cmp;
+	}
+	return NUMERIC_CMP(n1->idx, n2->idx);
+}
+
+static NTSTATUS casefold_db_build(TALLOC_CTX *mem_ctx,
+				  struct files_struct *dirfsp,
+				  const struct timespec *ctime,
+				  TDB_DATA *_data,
+				  uint32_t *_num)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct smb_Dir *dir_hnd = NULL;
+	struct casefold_db_name *names = NULL;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	uint32_t i, num = 0;
+	size_t len, ofs;
+	uint8_t *buf = NULL;
+	NTSTATUS status;
+
+	status = OpenDir_from_pathref(frame, dirfsp, NULL, 0, &dir_hnd);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_NOTICE("OpenDir_from_pathref(%s) failed: %s\n",
+			   fsp_str_dbg(dirfsp),
+			   nt_errstr(status));
+		TALLOC_FREE(frame);
+		return status;
+	}
+
+	while ((dname = ReadDirName(dir_hnd, &talloced)) != NULL) {
+		struct casefold_db_name *n = NULL;
+
+		if (ISDOT(dname) || ISDOTDOT(dname)) {
+			TALLOC_FREE(talloced);
+			continue;
+		}
+		if (num == UINT32_MAX / 4) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_BUFFER_OVERFLOW;
+		}
+
+		if (num == talloc_array_length(names)) {
+			names = talloc_realloc(frame,
+					       names,
+					       struct casefold_db_name,
+					       MAX(num * 2, 256));
+			if (names == NULL) {
+				TALLOC_FREE(frame);
+				return NT_STATUS_NO_MEMORY;
+			}
+		}
+		n = &names[num];
+
+		n->name = talloc_strdup(names, dname);
+		TALLOC_FREE(talloced);
+		if (n->name == NULL) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_NO_MEMORY;
+		}
+		n->folded = talloc_strdup_upper(names, n->name);
+		if (n->folded == NULL) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_NO_MEMORY;
+		}
+		n->idx = num++;
+	}
+	TALLOC_FREE(dir_hnd);
+
+	TYPESAFE_QSORT(names, num, casefold_db_name_cmp);
+
+	len = CASEFOLD_DB_HDR_SIZE + (size_t)num * 4;
+	for (i = 0; i < num; i++) {
+		len += strlen(names[i].folded) + 1;
+		len += strlen(names[i].name) + 1;
+		if (len > UINT32_MAX) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_BUFFER_OVERFLOW;
+		}
+	}
+
+	buf = talloc_array(mem_ctx, uint8_t, len);
+	if (buf == NULL) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	SBVAL(buf, 0, ctime->tv_sec);
+	SIVAL(buf, 8, ctime->tv_nsec);
+	SIVAL(buf, 12, num);
+
+	ofs = CASEFOLD_DB_HDR_SIZE + (size_t)num * 4;
+	for (i = 0; i < num; i++) {
+		size_t flen = strlen(names[i].folded) + 1;
+		size_t nlen = strlen(names[i].name) + 1;
+
+		SIVAL(buf, CASEFOLD_DB_HDR_SIZE + i * 4, ofs);
+		memcpy(buf + ofs, names[i].folded, flen);
+		ofs += flen;
+		memcpy(buf + ofs, names[i].name, nlen);
+		ofs += nlen;
+	}
+
+	TALLOC_FREE(frame);
+
+	*_data = (TDB_DATA) { .dptr = buf, .dsize = len, };
+	*_num = num;
+	return NT_STATUS_OK;
+}
+
+NTSTATUS casefold_db_find(struct files_struct *dirfsp,
+			  const char *name,
+			  TALLOC_CTX *mem_ctx,
+			  char **found_name)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct casefold_db_find_state state = {
+		.mem_ctx = mem_ctx,
+	};
+	struct stat_ex st = { .st_ex_nlink = 0, };
+	struct stat_ex st2 = { .st_ex_nlink = 0, };
+	struct timespec now;
+	TDB_DATA key;
+	TDB_DATA data;
+	uint32_t num;
+	NTSTATUS status;
+	int ret;
+	bool ok;
+
+	ok = casefold_db_init();
+	if (!ok) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	/*
+	 * dirfsp->fsp_name->st might be from before
+	 * the last change to the directory.
+	 */
+	ret = SMB_VFS_FSTAT(dirfsp, &st);
+	if (ret == -1) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NOT_FOUND;
+	}
+	state.ctime = st.st_ex_ctime;
+
+	key = casefold_db_key(frame, dirfsp, &st);
+	state.folded = talloc_strdup_upper(frame, name);
+	if ((key.dptr == NULL) || (state.folded == NULL)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = dbwrap_parse_record(casefold_db,
+				     key,
+				     casefold_db_find_parser,
+				     &state);
+	if (NT_STATUS_IS_OK(status) &&
+	    !NT_STATUS_EQUAL(state.status, NT_STATUS_NOT_FOUND))
+	{
+		DBG_DEBUG("%s in %s: %s\n",
+			  name,
+			  fsp_str_dbg(dirfsp),
+			  nt_errstr(state.status));
+		goto done;
+	}
+
+	/*
+	 * No or an outdated index, we have to scan
+	 * the directory anyway, so rebuild it.
+	 */
+	status = casefold_db_build(frame, dirfsp, &st.st_ex_ctime, &data, &num);
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	casefold_db_find_parser(key, data, &state);
+
+	if (num < CASEFOLD_DB_MIN_ENTRIES) {
+		goto done;
+	}
+
+	/*
+	 * Only store the index if the directory did not
+	 * change while we read it and if later changes
+	 * will show up as a different ctime.
+	 */
+	ret = SMB_VFS_FSTAT(dirfsp, &st2);
+	if ((ret == -1) ||
+	    (timespec_compare(&st.st_ex_ctime, &st2.st_ex_ctime) != 0))
+	{
+		goto done;
+	}
+	now = timespec_current();
+	if (now.tv_sec - st.st_ex_ctime.tv_sec < CASEFOLD_DB_RACY_SEC) {
+		goto done;
+	}
+
+	status = dbwrap_store(casefold_db, key, data, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_store failed: %s\n", nt_errstr(status));
+	}
+
+done:
+	if (NT_STATUS_IS_OK(state.status)) {
+		*found_name = state.found_name;
+	}
+	TALLOC_FREE(frame);
+	return state.status;
+}
@@ -0,0 +1,40 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *  Case insensitive name index for directories
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CASEFOLD_DB_H_
+#define _CASEFOLD_DB_H_
+
+struct files_struct;
+
+bool casefold_db_init(void);
+
+/*
+ * Find the on-disk name matching "name" case insensitively in the
+ * directory dirfsp, using (and if needed building) the index in
+ * casefold.tdb.
+ *
+ * Returns NT_STATUS_OBJECT_NAME_NOT_FOUND if there is no such name,
+ * and NT_STATUS_NOT_FOUND if the index can't be used, the caller
+ * then has to scan the directory itself.
+ */
+NTSTATUS casefold_db_find(struct files_struct *dirfsp,
+			  const char *name,
+			  TALLOC_CTX *mem_ctx,
+			  char **found_name);
+
+#endif /* _CASEFOLD_DB_H_ */
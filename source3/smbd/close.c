@@ -35,6 +35,7 @@
 #include "librpc/gen_ndr/ndr_open_files.h"
 #include "lib/util/tevent_ntstatus.h"
 #include "source3/smbd/dir.h"
+#include "libcli/security/security_token.h"
 
 /****************************************************************************
  Run a file if it is a magic script.
@@ -529,6 +530,13 @@ static NTSTATUS close_remove_share_mode(files_struct *fsp,
 	DBG_INFO("%s. Delete on close was set - deleting file.\n",
 		 fsp_str_dbg(fsp));
 
+	if (fsp->fsp_flags.delete_on_close_unlinked) {
+		/*
+		 * Already done by close_file_unlink_send()
+		 */
+		goto unlinked;
+	}
+
 	if (lck_state.got_tokens &&
 	    !unix_token_equal(lck_state.del_token, get_current_utok(conn)))
 	{
@@ -648,6 +656,7 @@ static NTSTATUS close_remove_share_mode(files_struct *fsp,
 		status = map_nt_error_from_unix(errno);
 	}
 
+unlinked:
 	/* As we now have POSIX opens which can unlink
  	 * with other open files we may have taken
  	 * this code path with more than one share mode
@@ -712,6 +721,222 @@ static NTSTATUS close_remove_share_mode(files_struct *fsp,
 	return status;
 }
 
+/****************************************************************************
+ Unlink a delete on close file before the last close, in a worker thread.
+
+ This only does the unlink itself, the share mode entry is removed
+ and delete on close is reset by the following close_file_smb() as
+ usual. Any case we can't handle here (directories, streams, other
+ opens, errors) is left to the synchronous code in
+ close_remove_share_mode().
+
+ Once delete on close is set in the share mode record no new open
+ can succeed on the file, so the unlink doesn't need to happen
+ under the share mode lock, which can't be held across the async
+ wait anyway.
+****************************************************************************/
+
+struct close_file_unlink_state {
+	struct tevent_context *ev;
+	struct files_struct *fsp;
+	struct smb_filename *parent_fname;
+};
+
+static void close_file_unlink_done(struct tevent_req *subreq);
+
+struct tevent_req *close_file_unlink_send(TALLOC_CTX *mem_ctx,
+					  struct tevent_context *ev,
+					  struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct close_file_unlink_state *state = NULL;
+	connection_struct *conn = fsp->conn;
+	struct share_mode_lock *lck = NULL;
+	const struct security_unix_token *del_token = NULL;
+	const struct security_token *del_nt_token = NULL;
+	struct smb2_lease_key parent_lease_key;
+	struct smb_filename *base_fname = NULL;
+	struct file_id id;
+	bool delete_object;
+	bool got_tokens;
+	NTSTATUS status;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct close_file_unlink_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->fsp = fsp;
+
+	if (!fsp->fsp_flags.initial_delete_on_close &&
+	    !fsp->fsp_flags.delete_on_close)
+	{
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	if (!fsp->fsp_flags.is_fsa ||
+	    fsp->fsp_flags.is_directory ||
+	    fsp->fsp_flags.kernel_share_modes_taken ||
+	    fsp_is_alternate_stream(fsp) ||
+	    (fh_get_refcount(fsp->fh) > 1))
+	{
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	lck = get_existing_share_mode_lock(state, fsp->file_id);
+	if (lck == NULL) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	if (fsp->fsp_flags.initial_delete_on_close &&
+	    !is_delete_on_close_set(lck, fsp->name_hash)) {
+		/*
+		 * Same as close_share_mode_lock_prepare(), which
+		 * won't do it again.
+		 */
+		fsp->fsp_flags.delete_on_close = true;
+		set_delete_on_close_lck(fsp, lck,
+					conn->session_info->security_token,
+					conn->session_info->unix_token);
+	}
+
+	delete_object = is_delete_on_close_set(lck, fsp->name_hash) &&
+		!has_other_nonposix_opens(lck, fsp);
+	if (!delete_object) {
+		TALLOC_FREE(lck);
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	got_tokens = get_delete_on_close_token(lck,
+					       fsp->name_hash,
+					       &del_nt_token,
+					       &del_token,
+					       &parent_lease_key);
+	if (got_tokens) {
+		del_token = copy_unix_token(state, del_token);
+		del_nt_token = security_token_duplicate(state, del_nt_token);
+		if ((del_token == NULL) || (del_nt_token == NULL)) {
+			TALLOC_FREE(lck);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
+	}
+	TALLOC_FREE(lck);
+
+	if (!got_tokens) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	/* Become the user who requested the delete. */
+
+	if (!push_sec_ctx()) {
+		smb_panic("close_file_unlink_send: failed to push sec_ctx");
+	}
+	set_sec_ctx(del_token->uid,
+		    del_token->gid,
+		    del_token->ngroups,
+		    del_token->groups,
+		    del_nt_token);
+
+	/* We can only delete the file if the name we have is still valid and
+	   hasn't been renamed. */
+
+	status = vfs_stat_fsp(fsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto sync;
+	}
+
+	id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	if (!file_id_equal(&fsp->file_id, &id)) {
+		goto sync;
+	}
+
+	status = parent_pathref(state,
+				conn->cwd_fsp,
+				fsp->fsp_name,
+				&state->parent_fname,
+				&base_fname);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto sync;
+	}
+
+	if (conn->fs_capabilities & FILE_NAMED_STREAMS) {
+		status = delete_all_streams(fsp,
+					    state->parent_fname->fsp,
+					    base_fname);
+		if (!NT_STATUS_IS_OK(status)) {
+			goto sync;
+		}
+	}
+
+	subreq = SMB_VFS_UNLINKAT_SEND(state,
+				       ev,
+				       state->parent_fname->fsp,
+				       base_fname,
+				       0);
+	pop_sec_ctx();
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, close_file_unlink_done, req);
+	return req;
+
+sync:
+	pop_sec_ctx();
+	tevent_req_done(req);
+	return tevent_req_post(req, ev);
+}
+
+static void close_file_unlink_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct close_file_unlink_state *state = tevent_req_data(
+		req, struct close_file_unlink_state);
+	struct vfs_aio_state aio_state = { .error = 0, };
+	int ret;
+	bool ok;
+
+	ret = SMB_VFS_UNLINKAT_RECV(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+
+	/*
+	 * Make sure we run as the user again
+	 */
+	ok = change_to_user_and_service_by_fsp(state->fsp);
+	SMB_ASSERT(ok);
+
+	TALLOC_FREE(state->parent_fname);
+
+	if (ret != 0) {
+		/*
+		 * Leave it to close_remove_share_mode(), it retries
+		 * and reports the error.
+		 */
+		DBG_INFO("file %s. Delete on close was set and async "
+			 "unlink failed with error %s\n",
+			 fsp_str_dbg(state->fsp),
+			 strerror(aio_state.error));
+		tevent_req_done(req);
+		return;
+	}
+
+	state->fsp->fsp_flags.delete_on_close_unlinked = true;
+	tevent_req_done(req);
+}
+
+NTSTATUS close_file_unlink_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
 /*
  * This is now only used for SMB1 closes that send an
  * explicit write time.
@@ -897,15 +1122,15 @@ static bool close_durable(struct smb_request *req,
 }
 
 /****************************************************************************
- Close a file.
-
- close_type can be NORMAL_CLOSE=0,SHUTDOWN_CLOSE,ERROR_CLOSE.
- printing and magic scripts are only run on normal close.
- delete on close is done on normal and shutdown close.
+ First part of closing a file, everything before the fd is closed.
+ Returns true in *_is_durable if the handle was preserved as durable
+ handle, there's nothing left to do then.
 ****************************************************************************/
 
-static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
-				  enum file_close_type close_type)
+static NTSTATUS close_normal_file_begin(struct smb_request *req,
+					files_struct *fsp,
+					enum file_close_type close_type,
+					bool *_is_durable)
 {
 	NTSTATUS status = NT_STATUS_OK;
 	NTSTATUS tmp;
@@ -923,6 +1148,7 @@ static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
 	}
 
 	is_durable = close_durable(req, fsp, close_type);
+	*_is_durable = is_durable;
 	if (is_durable) {
 		return NT_STATUS_OK;
 	}
@@ -964,8 +1190,19 @@ static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
 	}
 	status = ntstatus_keeperror(status, tmp);
 
-	tmp = fd_close(fsp);
-	status = ntstatus_keeperror(status, tmp);
+	return status;
+}
+
+/****************************************************************************
+ Last part of closing a file, after the fd is closed.
+****************************************************************************/
+
+static NTSTATUS close_normal_file_end(files_struct *fsp,
+				      enum file_close_type close_type,
+				      NTSTATUS status)
+{
+	connection_struct *conn = fsp->conn;
+	NTSTATUS tmp;
 
 	/* check for magic scripts */
 	if (close_type == NORMAL_CLOSE) {
@@ -981,6 +1218,32 @@ static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
 	return status;
 }
 
+/****************************************************************************
+ Close a file.
+
+ close_type can be NORMAL_CLOSE=0,SHUTDOWN_CLOSE,ERROR_CLOSE.
+ printing and magic scripts are only run on normal close.
+ delete on close is done on normal and shutdown close.
+****************************************************************************/
+
+static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
+				  enum file_close_type close_type)
+{
+	NTSTATUS status;
+	NTSTATUS tmp;
+	bool is_durable;
+
+	status = close_normal_file_begin(req, fsp, close_type, &is_durable);
+	if (is_durable) {
+		return NT_STATUS_OK;
+	}
+
+	tmp = fd_close(fsp);
+	status = ntstatus_keeperror(status, tmp);
+
+	return close_normal_file_end(fsp, close_type, status);
+}
+
 NTSTATUS recursive_rmdir_fsp(struct files_struct *fsp)
 {
 	struct connection_struct *conn = fsp->conn;
@@ -1483,6 +1746,137 @@ NTSTATUS close_file_free(struct smb_request *req,
 	return status;
 }
 
+/****************************************************************************
+ Async version of close_file_smb(). For regular files the close of the
+ fd is handed to SMB_VFS_CLOSE_SEND(), so a slow close() (e.g. flushing
+ dirty pages on a network filesystem) doesn't block smbd. Everything
+ else is closed synchronously.
+
+ Once SMB_VFS_CLOSE_SEND() has been called the fd belongs to the
+ request, the fsp is marked closed right away.
+****************************************************************************/
+
+struct close_file_smb_state {
+	struct smb_request *smbreq;
+	struct files_struct *fsp;
+	enum file_close_type close_type;
+	NTSTATUS status;
+};
+
+static void close_file_smb_closed(struct tevent_req *subreq);
+
+struct tevent_req *close_file_smb_send(TALLOC_CTX *mem_ctx,
+				       struct tevent_context *ev,
+				       struct smb_request *smbreq,
+				       struct files_struct *fsp,
+				       enum file_close_type close_type)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct close_file_smb_state *state = NULL;
+	NTSTATUS status;
+	NTSTATUS tmp;
+	bool is_durable;
+	bool close_fd;
+
+	req = tevent_req_create(mem_ctx, &state, struct close_file_smb_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->smbreq = smbreq;
+	state->fsp = fsp;
+	state->close_type = close_type;
+
+	SMB_ASSERT(!fsp->fsp_flags.is_dirfsp);
+	SMB_ASSERT(fsp->stream_fsp == NULL);
+
+	if ((fsp->fake_file_handle != NULL) ||
+	    (fsp->print_file != NULL) ||
+	    !fsp->fsp_flags.is_fsa ||
+	    fsp->fsp_flags.is_directory ||
+	    fsp_is_alternate_stream(fsp))
+	{
+		state->status = close_file_smb(smbreq, fsp, close_type);
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	status = close_normal_file_begin(smbreq, fsp, close_type, &is_durable);
+	if (is_durable) {
+		fsp_unbind_smb(smbreq, fsp);
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	tmp = fd_close_begin(fsp, &close_fd);
+	if (!close_fd) {
+		state->status = close_normal_file_end(fsp, close_type, status);
+		fsp_unbind_smb(smbreq, fsp);
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+	state->status = ntstatus_keeperror(status, tmp);
+
+	subreq = SMB_VFS_CLOSE_SEND(state, ev, fsp);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	fsp_set_fd(fsp, -1);
+	tevent_req_set_callback(subreq, close_file_smb_closed, req);
+	return req;
+}
+
+static void close_file_smb_closed(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct close_file_smb_state *state = tevent_req_data(
+		req, struct close_file_smb_state);
+	struct files_struct *fsp = state->fsp;
+	struct vfs_aio_state aio_state = { .error = 0 };
+	int ret;
+	bool ok;
+
+	ret = SMB_VFS_CLOSE_RECV(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+	if (ret == -1) {
+		state->status = ntstatus_keeperror(
+			map_nt_error_from_unix(aio_state.error),
+			state->status);
+	}
+
+	/*
+	 * Make sure we run as the user again, check_magic() might run
+	 * a script.
+	 */
+	ok = change_to_user_and_service_by_fsp(fsp);
+	if (!ok) {
+		tevent_req_nterror(req, NT_STATUS_ACCESS_DENIED);
+		return;
+	}
+
+	state->status = close_normal_file_end(fsp,
+					      state->close_type,
+					      state->status);
+	fsp_unbind_smb(state->smbreq, fsp);
+	tevent_req_done(req);
+}
+
+NTSTATUS close_file_smb_recv(struct tevent_req *req)
+{
+	struct close_file_smb_state *state = tevent_req_data(
+		req, struct close_file_smb_state);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+	status = state->status;
+	tevent_req_received(req);
+	return status;
+}
+
 /****************************************************************************
  Deal with an (authorized) message to close a file given the share mode
  entry.
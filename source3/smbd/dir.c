@@ -70,6 +70,17 @@ struct dptr_struct {
 		struct smb_filename *smb_fname;
 		uint32_t mode;
 	} overflow;
+
+	/*
+	 * Names already read from the directory by
+	 * dptr_read_ahead(), but not yet returned by
+	 * dptr_ReadDirName().
+	 */
+	struct {
+		char **names;
+		size_t num;
+		size_t next;
+	} read_ahead;
 };
 
 static NTSTATUS OpenDir_fsp(
@@ -355,11 +366,99 @@ void dptr_RewindDir(struct dptr_struct *dptr)
 	dptr->did_stat = false;
 	TALLOC_FREE(dptr->overflow.fname);
 	TALLOC_FREE(dptr->overflow.smb_fname);
+	TALLOC_FREE(dptr->read_ahead.names);
+	dptr->read_ahead.num = 0;
+	dptr->read_ahead.next = 0;
 }
 
 unsigned int dptr_FileNumber(struct dptr_struct *dptr)
 {
-	return dptr->dir_hnd->file_number;
+	/*
+	 * Names we read ahead have not been seen by the caller yet.
+	 */
+	size_t pending = dptr->read_ahead.num - dptr->read_ahead.next;
+
+	return dptr->dir_hnd->file_number - pending;
+}
+
+size_t dptr_read_ahead_pending(struct dptr_struct *dptr)
+{
+	return dptr->read_ahead.num - dptr->read_ahead.next;
+}
+
+/****************************************************************************
+ Read up to count names ahead of the caller, so they can be looked
+ at in bulk before smbd_dirptr_get_entry() walks over them one by one.
+ Names read ahead earlier and not yet consumed are returned first.
+ Only for real directory traverses, returns NULL otherwise.
+****************************************************************************/
+
+const char * const *dptr_read_ahead(struct dptr_struct *dptr,
+				    size_t count,
+				    size_t *_num)
+{
+	char **names = dptr->read_ahead.names;
+	size_t pending = dptr->read_ahead.num - dptr->read_ahead.next;
+	size_t i;
+
+	*_num = 0;
+
+	if (!dptr->has_wild) {
+		return NULL;
+	}
+
+	if (pending >= count) {
+		*_num = pending;
+		return (const char * const *)&names[dptr->read_ahead.next];
+	}
+
+	if (dptr->read_ahead.next != 0) {
+		/*
+		 * Move what is left to the front, the consumed
+		 * slots have already been talloc_move()d away.
+		 */
+		memmove(names,
+			&names[dptr->read_ahead.next],
+			pending * sizeof(char *));
+		dptr->read_ahead.num = pending;
+		dptr->read_ahead.next = 0;
+	}
+
+	if (talloc_array_length(names) < count) {
+		names = talloc_realloc(dptr, names, char *, count);
+		if (names == NULL) {
+			*_num = pending;
+			return (const char * const *)dptr->read_ahead.names;
+		}
+		dptr->read_ahead.names = names;
+	}
+
+	for (i = pending; i < count; i++) {
+		const char *name = NULL;
+		char *talloced = NULL;
+
+		name = ReadDirName(dptr->dir_hnd, &talloced);
+		if (name == NULL) {
+			break;
+		}
+		if (talloced != NULL) {
+			names[i] = talloc_move(names, &talloced);
+		} else {
+			names[i] = talloc_strdup(names, name);
+		}
+		if (names[i] == NULL) {
+			/*
+			 * The name is lost for this pass, this
+			 * is no worse than a failing allocation in
+			 * dptr_ReadDirName().
+			 */
+			break;
+		}
+	}
+	dptr->read_ahead.num = i;
+
+	*_num = i;
+	return (const char * const *)names;
 }
 
 bool dptr_has_wild(struct dptr_struct *dptr)
@@ -407,6 +506,13 @@ char *dptr_ReadDirName(TALLOC_CTX *ctx, struct dptr_struct *dptr)
 	if (dptr->has_wild) {
 		const char *name_temp = NULL;
 		char *talloced = NULL;
+
+		if (dptr->read_ahead.next < dptr->read_ahead.num) {
+			char **names = dptr->read_ahead.names;
+			return talloc_move(ctx,
+					   &names[dptr->read_ahead.next++]);
+		}
+
 		name_temp = ReadDirName(dir_hnd, &talloced);
 		if (name_temp == NULL) {
 			return NULL;
@@ -29,6 +29,10 @@
 #include "lib/util/tevent_ntstatus.h"
 #include "lib/util/string_wrappers.h"
 #include "fake_file.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 static void dos_mode_debug_print(const char *func, uint32_t mode)
 {
@@ -384,6 +388,219 @@ NTSTATUS parse_dos_attribute_blob(struct smb_filename *smb_fname,
 	return NT_STATUS_OK;
 }
 
+/****************************************************************************
+ Cache of the DOS attribute EA shared between all smbd processes.
+
+ This only saves the SMB_VFS_FGETXATTR() call. It's not a stat
+ cache: the key is taken from the stat of an already open fsp, path
+ resolution and the stat calls it does are not touched.
+
+ dosattrib_cache.tdb is used as a direct mapped table with
+ "shared dos attributes cache size" slots: the file_id picks the
+ slot, a new file in the same slot replaces the old one. Every
+ change to an EA updates the ctime of the file, so a record is only
+ used if it was stored for the ctime we see in our stat. Files whose
+ ctime is very recent are not cached, a second change in the same
+ timestamp tick would not be noticed.
+****************************************************************************/
+
+#define DOS_ATTRIBUTES_CACHE_HDR_SIZE 36
+#define DOS_ATTRIBUTES_CACHE_RACY_SEC 2
+
+static struct db_context *dos_attributes_cache_db(uint32_t *_slots)
+{
+	static struct db_context *db;
+	static bool tried;
+	int slots = lp_shared_dos_attributes_cache_size();
+	char *db_path = NULL;
+
+	if (slots <= 0) {
+		return NULL;
+	}
+	*_slots = slots;
+
+	if (db != NULL || tried) {
+		return db;
+	}
+	tried = true;
+
+	db_path = lock_path(talloc_tos(), "dosattrib_cache.tdb");
+	if (db_path == NULL) {
+		return NULL;
+	}
+
+	db = db_open(NULL, db_path,
+		     SMBD_VOLATILE_TDB_HASH_SIZE,
+		     SMBD_VOLATILE_TDB_FLAGS,
+		     O_RDWR|O_CREAT, 0600,
+		     DBWRAP_LOCK_ORDER_NONE, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		DBG_ERR("Failed to open %s\n", db_path);
+	}
+	TALLOC_FREE(db_path);
+	return db;
+}
+
+static struct db_context *dos_attributes_cache_key(
+	const struct files_struct *fsp,
+	struct file_id *id,
+	uint8_t keybuf[4],
+	TDB_DATA *key)
+{
+	struct db_context *db = NULL;
+	uint8_t idbuf[24];
+	TDB_DATA idkey = { .dptr = idbuf, .dsize = sizeof(idbuf), };
+	uint32_t slots = 0;
+
+	if (!VALID_STAT(fsp->fsp_name->st)) {
+		return NULL;
+	}
+
+	db = dos_attributes_cache_db(&slots);
+	if (db == NULL) {
+		return NULL;
+	}
+
+	*id = vfs_file_id_from_sbuf(fsp->conn, &fsp->fsp_name->st);
+	SBVAL(idbuf, 0, id->devid);
+	SBVAL(idbuf, 8, id->inode);
+	SBVAL(idbuf, 16, id->extid);
+
+	SIVAL(keybuf, 0, tdb_jenkins_hash(&idkey) % slots);
+	*key = (TDB_DATA) { .dptr = keybuf, .dsize = 4, };
+
+	return db;
+}
+
+struct dos_attributes_cache_fetch_state {
+	struct file_id id;
+	struct timespec ctime;
+	char *buf;
+	size_t buflen;
+	ssize_t len;
+};
+
+static void dos_attributes_cache_fetch_fn(TDB_DATA key,
+					  TDB_DATA data,
+					  void *private_data)
+{
+	struct dos_attributes_cache_fetch_state *state = private_data;
+	struct file_id id;
+	struct timespec ctime;
+	size_t len;
+
+	if (data.dsize < DOS_ATTRIBUTES_CACHE_HDR_SIZE) {
+		return;
+	}
+	id = (struct file_id) {
+		.devid = BVAL(data.dptr, 0),
+		.inode = BVAL(data.dptr, 8),
+		.extid = BVAL(data.dptr, 16),
+	};
+	ctime = (struct timespec) {
+		.tv_sec = BVAL(data.dptr, 24),
+		.tv_nsec = IVAL(data.dptr, 32),
+	};
+	if (!file_id_equal(&id, &state->id) ||
+	    timespec_compare(&ctime, &state->ctime) != 0) {
+		return;
+	}
+
+	len = data.dsize - DOS_ATTRIBUTES_CACHE_HDR_SIZE;
+	if (len > state->buflen) {
+		return;
+	}
+	memcpy(state->buf, data.dptr + DOS_ATTRIBUTES_CACHE_HDR_SIZE, len);
+	state->len = len;
+}
+
+static ssize_t dos_attributes_cache_fetch(const struct files_struct *fsp,
+					  char *buf,
+					  size_t buflen)
+{
+	struct dos_attributes_cache_fetch_state state = {
+		.ctime = fsp->fsp_name->st.st_ex_ctime,
+		.buf = buf,
+		.buflen = buflen,
+		.len = -1,
+	};
+	struct db_context *db = NULL;
+	uint8_t keybuf[4];
+	TDB_DATA key;
+	NTSTATUS status;
+
+	db = dos_attributes_cache_key(fsp, &state.id, keybuf, &key);
+	if (db == NULL) {
+		return -1;
+	}
+
+	status = dbwrap_parse_record(db,
+				     key,
+				     dos_attributes_cache_fetch_fn,
+				     &state);
+	if (!NT_STATUS_IS_OK(status)) {
+		return -1;
+	}
+	return state.len;
+}
+
+static void dos_attributes_cache_store(const struct files_struct *fsp,
+				       const char *blob,
+				       size_t bloblen)
+{
+	const struct timespec *ctime = &fsp->fsp_name->st.st_ex_ctime;
+	struct timespec now = timespec_current();
+	struct db_context *db = NULL;
+	uint8_t buf[DOS_ATTRIBUTES_CACHE_HDR_SIZE + sizeof(fstring)];
+	TDB_DATA data = { .dptr = buf, };
+	struct file_id id;
+	uint8_t keybuf[4];
+	TDB_DATA key;
+	NTSTATUS status;
+
+	if ((now.tv_sec - ctime->tv_sec < DOS_ATTRIBUTES_CACHE_RACY_SEC) ||
+	    (bloblen > sizeof(fstring))) {
+		return;
+	}
+
+	db = dos_attributes_cache_key(fsp, &id, keybuf, &key);
+	if (db == NULL) {
+		return;
+	}
+
+	SBVAL(buf, 0, id.devid);
+	SBVAL(buf, 8, id.inode);
+	SBVAL(buf, 16, id.extid);
+	SBVAL(buf, 24, ctime->tv_sec);
+	SIVAL(buf, 32, ctime->tv_nsec);
+	memcpy(buf + DOS_ATTRIBUTES_CACHE_HDR_SIZE, blob, bloblen);
+	data.dsize = DOS_ATTRIBUTES_CACHE_HDR_SIZE + bloblen;
+
+	status = dbwrap_store(db, key, data, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_store failed: %s\n", nt_errstr(status));
+	}
+}
+
+static void dos_attributes_cache_delete(const struct files_struct *fsp)
+{
+	struct db_context *db = NULL;
+	struct file_id id;
+	uint8_t keybuf[4];
+	TDB_DATA key;
+
+	db = dos_attributes_cache_key(fsp, &id, keybuf, &key);
+	if (db == NULL) {
+		return;
+	}
+
+	/*
+	 * The slot might belong to another file, dropping
+	 * that one from the cache does no harm.
+	 */
+	dbwrap_delete(db, key);
+}
+
 NTSTATUS fget_ea_dos_attribute(struct files_struct *fsp,
 			      uint32_t *pattr)
 {
@@ -399,6 +616,11 @@ NTSTATUS fget_ea_dos_attribute(struct files_struct *fsp,
 	/* Don't reset pattr to zero as we may already have filename-based attributes we
 	   need to preserve. */
 
+	sizeret = dos_attributes_cache_fetch(fsp, attrstr, sizeof(attrstr));
+	if (sizeret != -1) {
+		goto parse;
+	}
+
 	sizeret = SMB_VFS_FGETXATTR(fsp,
 				    SAMBA_XATTR_DOS_ATTRIB,
 				    attrstr,
@@ -423,6 +645,9 @@ NTSTATUS fget_ea_dos_attribute(struct files_struct *fsp,
 		return map_nt_error_from_unix(errno);
 	}
 
+	dos_attributes_cache_store(fsp, attrstr, sizeret);
+
+parse:
 	blob.data = (uint8_t *)attrstr;
 	blob.length = sizeret;
 
@@ -543,6 +768,8 @@ NTSTATUS set_ea_dos_attribute(connection_struct *conn,
 		}
 	}
 
+	dos_attributes_cache_delete(smb_fname->fsp);
+
 	/*
 	 * We correctly stored the create time.
 	 * We *always* set XATTR_DOSINFO_CREATE_TIME,
@@ -914,6 +1141,131 @@ NTSTATUS dos_mode_at_recv(struct tevent_req *req, uint32_t *dosmode)
 	return NT_STATUS_OK;
 }
 
+/*
+ * Async version of fdos_mode(). If the attributes of fsp are not cached
+ * yet and "smbd async dosmode" is enabled they are read in a worker
+ * thread via dos_mode_at_send() and cached in fsp->fsp_name->st,
+ * otherwise this is just fdos_mode().
+ *
+ * The caller has to make sure fsp stays around until the request is
+ * done.
+ */
+
+struct fdos_mode_state {
+	struct files_struct *fsp;
+	uint32_t dosmode;
+};
+
+static void fdos_mode_done(struct tevent_req *subreq);
+
+static bool fdos_mode_use_async(struct files_struct *fsp)
+{
+	struct connection_struct *conn = fsp->conn;
+	size_t max_threads;
+
+	if (fsp->fake_file_handle != NULL) {
+		return false;
+	}
+	if (!VALID_STAT(fsp->fsp_name->st)) {
+		return false;
+	}
+	if (!S_ISREG(fsp->fsp_name->st.st_ex_mode) &&
+	    !S_ISDIR(fsp->fsp_name->st.st_ex_mode)) {
+		return false;
+	}
+	if (fsp->fsp_name->st.cached_dos_attributes != FILE_ATTRIBUTE_INVALID) {
+		return false;
+	}
+	if (fsp_is_alternate_stream(fsp)) {
+		return false;
+	}
+	if (fsp_get_pathref_fd(fsp) == -1) {
+		return false;
+	}
+	if (!lp_smbd_async_dosmode(SNUM(conn))) {
+		return false;
+	}
+
+	max_threads = pthreadpool_tevent_max_threads(conn->sconn->pool);
+	if (max_threads == 0 || !per_thread_cwd_supported()) {
+		return false;
+	}
+
+	return true;
+}
+
+struct tevent_req *fdos_mode_send(TALLOC_CTX *mem_ctx,
+				  struct tevent_context *ev,
+				  struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct fdos_mode_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state, struct fdos_mode_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->fsp = fsp;
+
+	if (!fdos_mode_use_async(fsp)) {
+		state->dosmode = fdos_mode(fsp);
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	/*
+	 * The attributes are read via fsp's own fd, so fsp also serves
+	 * as the "directory" handle dos_mode_at_send() wants.
+	 */
+	subreq = dos_mode_at_send(state, ev, fsp, fsp->fsp_name);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, fdos_mode_done, req);
+	return req;
+}
+
+static void fdos_mode_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct fdos_mode_state *state = tevent_req_data(
+		req, struct fdos_mode_state);
+	struct files_struct *fsp = state->fsp;
+	NTSTATUS status;
+
+	status = dos_mode_at_recv(subreq, &state->dosmode);
+	TALLOC_FREE(subreq);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dos_mode_at_recv for %s failed: %s\n",
+			  fsp_str_dbg(fsp),
+			  nt_errstr(status));
+		state->dosmode = fdos_mode(fsp);
+		tevent_req_done(req);
+		return;
+	}
+
+	fsp->fsp_name->st.cached_dos_attributes = state->dosmode;
+	tevent_req_done(req);
+}
+
+NTSTATUS fdos_mode_recv(struct tevent_req *req, uint32_t *dosmode)
+{
+	struct fdos_mode_state *state = tevent_req_data(
+		req, struct fdos_mode_state);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+
+	*dosmode = state->dosmode;
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
+
 /*******************************************************************
  chmod a file - but preserve some bits.
  If "store dos attributes" is also set it will store the create time
@@ -755,11 +755,12 @@ static NTSTATUS vfs_default_durable_reconnect_lease(
 	}
 
 fsp_lease:
-	fsp->lease = find_fsp_lease(fsp,
-				    &e->lease_key,
-				    current_state,
-				    lease_version,
-				    epoch);
+	fsp_set_lease(fsp,
+		      find_fsp_lease(fsp,
+				     &e->lease_key,
+				     current_state,
+				     lease_version,
+				     epoch));
 	if (fsp->lease == NULL) {
 		return NT_STATUS_NO_MEMORY;
 	}
@@ -1085,7 +1086,7 @@ NTSTATUS vfs_default_durable_reconnect(struct connection_struct *conn,
 		DBG_ERR("failed to create new fsp\n");
 		return NT_STATUS_NO_MEMORY;
 	}
-	state.fsp->file_id = file_id;
+	fsp_set_file_id(state.fsp, file_id);
 	state.fsp->file_pid = smb1req->smbpid;
 	state.fsp->vuid = smb1req->vuid;
 	state.fsp->fnum = op->local_id;
@@ -18,6 +18,7 @@
 */
 
 #include "includes.h"
+#include "smbd/smbd.h"
 #include "fd_handle.h"
 
 struct fd_handle {
@@ -127,5 +128,10 @@ void fsp_set_fd(struct files_struct *fsp, int fd)
 		   fd == -1 ||
 		   fd == AT_FDCWD);
 
+	if (fsp->fh->fd == fd) {
+		return;
+	}
 	fsp->fh->fd = fd;
+
+	fsp_update_fd_index(fsp);
 }
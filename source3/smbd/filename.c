@@ -31,6 +31,7 @@
 #include "smbd/globals.h"
 #include "libcli/smb/reparse.h"
 #include "source3/smbd/dir.h"
+#include "source3/smbd/casefold_db.h"
 
 uint32_t ucf_flags_from_smb_request(struct smb_request *req)
 {
@@ -315,6 +316,32 @@ static NTSTATUS get_real_filename_full_scan_at(struct files_struct *dirfsp,
 		}
 	}
 
+	if (!mangled && !conn->case_sensitive &&
+	    lp_casefold_index(SNUM(conn))) {
+		/*
+		 * The index may have been built by someone else's
+		 * scan, only hand out names to those allowed to list
+		 * the directory themselves.
+		 */
+		status = smbd_check_access_rights_fsp(conn->cwd_fsp,
+						      dirfsp,
+						      false,
+						      SEC_DIR_LIST);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_DEBUG("no LIST access to %s: %s\n",
+				  fsp_str_dbg(dirfsp),
+				  nt_errstr(status));
+			TALLOC_FREE(unmangled_name);
+			return status;
+		}
+
+		status = casefold_db_find(dirfsp, name, mem_ctx, found_name);
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+			TALLOC_FREE(unmangled_name);
+			return status;
+		}
+	}
+
 	/* open the directory */
 	status = OpenDir_from_pathref(talloc_tos(), dirfsp, NULL, 0, &cur_dir);
 	if (!NT_STATUS_IS_OK(status)) {
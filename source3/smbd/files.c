@@ -33,6 +33,220 @@
 static bool fsp_attach_smb_fname(struct files_struct *fsp,
 				 struct smb_filename **_smb_fname);
 
+/*
+ * Hash indexes of sconn->files. Clients like backup agents keep
+ * tens of thousands of handles open on one connection, walking
+ * the list for every lookup by file_id, fd or lease key would
+ * make every open and oplock break O(n).
+ *
+ * Each files_struct has one embedded link per index. An index is
+ * an array of doubly linked bucket lists, doubled when it holds
+ * more than FILES_INDEX_LOAD entries per bucket. The files with
+ * the same key are in the same bucket, so file_find_di_next()
+ * walks the bucket instead of the whole list.
+ */
+
+#define FILES_INDEX_MIN_BUCKETS 64
+#define FILES_INDEX_LOAD 2
+
+struct files_index {
+	struct files_index_link **buckets;
+	size_t num_buckets;
+	size_t num_entries;
+};
+
+static uint32_t files_index_mix(uint64_t v)
+{
+	/* The MurmurHash3 finalizer */
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+	return (uint32_t)v;
+}
+
+static uint32_t files_index_hash_file_id(const struct file_id *id)
+{
+	return files_index_mix(id->inode ^
+			       files_index_mix(id->devid ^
+					       files_index_mix(id->extid)));
+}
+
+static uint32_t files_index_hash_fd(int fd)
+{
+	return files_index_mix((uint64_t)(int64_t)fd);
+}
+
+static uint32_t files_index_hash_lease_key(const struct smb2_lease_key *key)
+{
+	return files_index_mix(key->data[0] ^ files_index_mix(key->data[1]));
+}
+
+static struct files_index_link **files_index_bucket(struct files_index *idx,
+						    uint32_t hash)
+{
+	return &idx->buckets[hash & (idx->num_buckets - 1)];
+}
+
+static void files_index_grow(struct files_index *idx)
+{
+	struct files_index_link **old = idx->buckets;
+	size_t old_num = idx->num_buckets;
+	struct files_index_link **buckets = NULL;
+	size_t i;
+
+	buckets = talloc_zero_array(idx,
+				    struct files_index_link *,
+				    old_num * 2);
+	if (buckets == NULL) {
+		/* Just live with longer chains */
+		return;
+	}
+	idx->buckets = buckets;
+	idx->num_buckets = old_num * 2;
+
+	for (i = 0; i < old_num; i++) {
+		struct files_index_link *l = NULL;
+
+		while ((l = old[i]) != NULL) {
+			DLIST_REMOVE(old[i], l);
+			DLIST_ADD_END(*files_index_bucket(idx, l->hash), l);
+		}
+	}
+
+	TALLOC_FREE(old);
+}
+
+static void files_index_add(struct smbd_server_connection *sconn,
+			    struct files_index **_idx,
+			    struct files_index_link *l,
+			    struct files_struct *fsp,
+			    uint32_t hash)
+{
+	struct files_index *idx = *_idx;
+
+	SMB_ASSERT(!l->linked);
+
+	if (idx == NULL) {
+		idx = talloc_zero(sconn, struct files_index);
+		if (idx == NULL) {
+			smb_panic("talloc failed");
+		}
+		idx->buckets = talloc_zero_array(idx,
+						 struct files_index_link *,
+						 FILES_INDEX_MIN_BUCKETS);
+		if (idx->buckets == NULL) {
+			smb_panic("talloc failed");
+		}
+		idx->num_buckets = FILES_INDEX_MIN_BUCKETS;
+		*_idx = idx;
+	}
+
+	if (idx->num_entries >= idx->num_buckets * FILES_INDEX_LOAD) {
+		files_index_grow(idx);
+	}
+
+	*l = (struct files_index_link) {
+		.fsp = fsp,
+		.hash = hash,
+		.linked = true,
+	};
+	DLIST_ADD(*files_index_bucket(idx, hash), l);
+	idx->num_entries += 1;
+}
+
+static void files_index_del(struct files_index *idx,
+			    struct files_index_link *l)
+{
+	if (!l->linked) {
+		return;
+	}
+	DLIST_REMOVE(*files_index_bucket(idx, l->hash), l);
+	SMB_ASSERT(idx->num_entries > 0);
+	idx->num_entries -= 1;
+	l->linked = false;
+}
+
+/**
+ * Change fsp->file_id, this must be used for all fsps
+ * created by fsp_new() to keep the index in sync.
+ */
+void fsp_set_file_id(struct files_struct *fsp, struct file_id id)
+{
+	struct smbd_server_connection *sconn = NULL;
+
+	if (!fsp->file_id_link.linked) {
+		fsp->file_id = id;
+		return;
+	}
+	sconn = fsp->conn->sconn;
+
+	files_index_del(sconn->files_by_file_id, &fsp->file_id_link);
+	fsp->file_id = id;
+	files_index_add(sconn,
+			&sconn->files_by_file_id,
+			&fsp->file_id_link,
+			fsp,
+			files_index_hash_file_id(&id));
+}
+
+/**
+ * Set fsp->lease, the lease key must already be filled in
+ */
+void fsp_set_lease(struct files_struct *fsp, struct fsp_lease *lease)
+{
+	struct smbd_server_connection *sconn = NULL;
+
+	fsp->lease = lease;
+
+	if (fsp->conn == NULL || fsp->conn->sconn == NULL) {
+		return;
+	}
+	sconn = fsp->conn->sconn;
+
+	if (fsp->lease_link.linked) {
+		files_index_del(sconn->files_by_lease_key, &fsp->lease_link);
+	}
+	if (lease == NULL || !fsp->file_id_link.linked) {
+		return;
+	}
+	files_index_add(sconn,
+			&sconn->files_by_lease_key,
+			&fsp->lease_link,
+			fsp,
+			files_index_hash_lease_key(&lease->lease.lease_key));
+}
+
+/**
+ * Called by fsp_set_fd() after the fd changed
+ */
+void fsp_update_fd_index(struct files_struct *fsp)
+{
+	struct smbd_server_connection *sconn = NULL;
+	int fd;
+
+	if (!fsp->file_id_link.linked) {
+		/* Not in sconn->files */
+		return;
+	}
+	sconn = fsp->conn->sconn;
+
+	if (fsp->fd_link.linked) {
+		files_index_del(sconn->files_by_fd, &fsp->fd_link);
+	}
+
+	fd = fsp_get_pathref_fd(fsp);
+	if (fd == -1) {
+		return;
+	}
+	files_index_add(sconn,
+			&sconn->files_by_fd,
+			&fsp->fd_link,
+			fsp,
+			files_index_hash_fd(fd));
+}
+
 /**
  * create new fsp to be used for file_new or a durable handle reconnect
  */
@@ -71,6 +285,11 @@ struct files_struct *fsp_new(TALLOC_CTX *mem_ctx,
 
 	DLIST_ADD(sconn->files, fsp);
 	sconn->num_files += 1;
+	files_index_add(sconn,
+			&sconn->files_by_file_id,
+			&fsp->file_id_link,
+			fsp,
+			files_index_hash_file_id(&fsp->file_id));
 
 	conn->num_files_open++;
 
@@ -150,7 +369,6 @@ NTSTATUS fsp_bind_smb(struct files_struct *fsp, struct smb_request *req)
 NTSTATUS file_new(struct smb_request *req, connection_struct *conn,
 		  files_struct **result)
 {
-	struct smbd_server_connection *sconn = conn->sconn;
 	files_struct *fsp;
 	NTSTATUS status;
 
@@ -180,13 +398,6 @@ NTSTATUS file_new(struct smb_request *req, connection_struct *conn,
 
 	DBG_INFO("new file %s\n", fsp_fnum_dbg(fsp));
 
-	/* A new fsp invalidates the positive and
-	  negative fsp_fi_cache as the new fsp is pushed
-	  at the start of the list and we search from
-	  a cache hit to the *end* of the list. */
-
-	ZERO_STRUCT(sconn->fsp_fi_cache);
-
 	*result = fsp;
 	return NT_STATUS_OK;
 }
@@ -282,7 +493,8 @@ NTSTATUS open_internal_dirfsp(connection_struct *conn,
 		return NT_STATUS_NOT_A_DIRECTORY;
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	*_fsp = fsp;
 	return NT_STATUS_OK;
@@ -424,7 +636,6 @@ static NTSTATUS openat_pathref_fullname(
 	}
 
 	GetTimeOfDay(&fsp->open_time);
-	ZERO_STRUCT(conn->sconn->fsp_fi_cache);
 
 	fsp->fsp_flags.is_pathref = true;
 
@@ -471,7 +682,8 @@ static NTSTATUS openat_pathref_fullname(
 
 	fsp->fsp_flags.is_directory = S_ISDIR(fsp->fsp_name->st.st_ex_mode);
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	ok = fsp_smb_fname_link(fsp, &smb_fname->fsp_link, &smb_fname->fsp);
 	if (!ok) {
@@ -623,7 +835,6 @@ static NTSTATUS openat_pathref_fsp_simple_openat(TALLOC_CTX *mem_ctx,
 	}
 
 	GetTimeOfDay(&fsp->open_time);
-	ZERO_STRUCT(conn->sconn->fsp_fi_cache);
 
 	fsp->fsp_flags.is_pathref = true;
 
@@ -674,7 +885,8 @@ static NTSTATUS openat_pathref_fsp_simple_openat(TALLOC_CTX *mem_ctx,
 	fsp->fsp_flags.is_directory = S_ISDIR(fsp->fsp_name->st.st_ex_mode);
 	fsp->fsp_flags.posix_open = ((fname->flags & SMB_FILENAME_POSIX_PATH) !=
 				     0);
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	fname->st = fsp->fsp_name->st;
 
@@ -752,7 +964,6 @@ NTSTATUS open_stream_pathref_fsp(
 	}
 
 	GetTimeOfDay(&fsp->open_time);
-	ZERO_STRUCT(conn->sconn->fsp_fi_cache);
 
 	fsp->fsp_flags.is_pathref = true;
 
@@ -782,7 +993,8 @@ NTSTATUS open_stream_pathref_fsp(
 	smb_fname->st = fsp->fsp_name->st;
 
 	fsp->fsp_flags.is_directory = S_ISDIR(fsp->fsp_name->st.st_ex_mode);
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	ok = fsp_smb_fname_link(fsp, &smb_fname->fsp_link, &smb_fname->fsp);
 	if (!ok) {
@@ -1150,7 +1362,6 @@ NTSTATUS openat_pathref_fsp_nosymlink(
 	}
 
 	GetTimeOfDay(&fsp->open_time);
-	ZERO_STRUCT(conn->sconn->fsp_fi_cache);
 
 	fsp->fsp_name = &full_fname;
 
@@ -1524,7 +1735,8 @@ done:
 	 * open.c will use this to check if delete_on_close
 	 * has been set on the dirfsp.
 	 */
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	result = cp_smb_filename(mem_ctx, fsp->fsp_name);
 	if (result == NULL) {
@@ -1619,7 +1831,6 @@ NTSTATUS openat_pathref_fsp_lcomp(struct files_struct *dirfsp,
 	}
 
 	GetTimeOfDay(&fsp->open_time);
-	ZERO_STRUCT(conn->sconn->fsp_fi_cache);
 
 	fsp->fsp_flags.is_pathref = true;
 
@@ -1708,7 +1919,8 @@ NTSTATUS openat_pathref_fsp_lcomp(struct files_struct *dirfsp,
 	fsp->fsp_flags.is_directory = S_ISDIR(fsp->fsp_name->st.st_ex_mode);
 	fsp->fsp_flags.posix_open =
 		((smb_fname_rel->flags & SMB_FILENAME_POSIX_PATH) != 0);
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st);
+	fsp_set_file_id(fsp,
+			vfs_file_id_from_sbuf(conn, &fsp->fsp_name->st));
 
 	smb_fname_rel->st = fsp->fsp_name->st;
 
@@ -2135,15 +2347,16 @@ struct files_struct *files_forall(
 
 files_struct *file_find_fd(struct smbd_server_connection *sconn, int fd)
 {
-	int count=0;
-	files_struct *fsp;
+	struct files_index_link *l = NULL;
 
-	for (fsp=sconn->files; fsp; fsp=fsp->next,count++) {
-		if (fsp_get_pathref_fd(fsp) == fd) {
-			if (count > 10) {
-				DLIST_PROMOTE(sconn->files, fsp);
-			}
-			return fsp;
+	if (fd == -1 || sconn->files_by_fd == NULL) {
+		return NULL;
+	}
+
+	l = *files_index_bucket(sconn->files_by_fd, files_index_hash_fd(fd));
+	for (; l != NULL; l = l->next) {
+		if (fsp_get_pathref_fd(l->fsp) == fd) {
+			return l->fsp;
 		}
 	}
 
@@ -2157,14 +2370,20 @@ files_struct *file_find_fd(struct smbd_server_connection *sconn, int fd)
 files_struct *file_find_dif(struct smbd_server_connection *sconn,
 			    struct file_id id, unsigned long gen_id)
 {
-	int count=0;
-	files_struct *fsp;
+	struct files_index_link *l = NULL;
 
 	if (gen_id == 0) {
 		return NULL;
 	}
+	if (sconn->files_by_file_id == NULL) {
+		return NULL;
+	}
+
+	l = *files_index_bucket(sconn->files_by_file_id,
+				files_index_hash_file_id(&id));
+	for (; l != NULL; l = l->next) {
+		struct files_struct *fsp = l->fsp;
 
-	for (fsp = sconn->files; fsp; fsp = fsp->next,count++) {
 		/*
 		 * We can have a fsp->fh->fd == -1 here as it could be a stat
 		 * open.
@@ -2178,9 +2397,6 @@ files_struct *file_find_dif(struct smbd_server_connection *sconn,
 		if (fh_get_gen_id(fsp->fh) != gen_id) {
 			continue;
 		}
-		if (count > 10) {
-			DLIST_PROMOTE(sconn->files, fsp);
-		}
 		return fsp;
 	}
 
@@ -2188,40 +2404,47 @@ files_struct *file_find_dif(struct smbd_server_connection *sconn,
 }
 
 /****************************************************************************
- Find the first fsp given a device and inode.
- We use a singleton cache here to speed up searching from getfilepathinfo
- calls.
+ Find the first fsp in the file_id index bucket starting at l
+ having the given device and inode.
 ****************************************************************************/
 
-files_struct *file_find_di_first(struct smbd_server_connection *sconn,
-				 struct file_id id,
-				 bool need_fsa)
+static files_struct *file_find_di_from(struct files_index_link *l,
+				       const struct file_id *id,
+				       bool need_fsa)
 {
-	files_struct *fsp;
-
-	if (file_id_equal(&sconn->fsp_fi_cache.id, &id)) {
-		/* Positive or negative cache hit. */
-		return sconn->fsp_fi_cache.fsp;
-	}
-
-	sconn->fsp_fi_cache.id = id;
+	for (; l != NULL; l = l->next) {
+		struct files_struct *fsp = l->fsp;
 
-	for (fsp=sconn->files;fsp;fsp=fsp->next) {
 		if (need_fsa && !fsp->fsp_flags.is_fsa) {
 			continue;
 		}
-		if (file_id_equal(&fsp->file_id, &id)) {
-			/* Setup positive cache. */
-			sconn->fsp_fi_cache.fsp = fsp;
+		if (file_id_equal(&fsp->file_id, id)) {
 			return fsp;
 		}
 	}
 
-	/* Setup negative cache. */
-	sconn->fsp_fi_cache.fsp = NULL;
 	return NULL;
 }
 
+/****************************************************************************
+ Find the first fsp given a device and inode.
+****************************************************************************/
+
+files_struct *file_find_di_first(struct smbd_server_connection *sconn,
+				 struct file_id id,
+				 bool need_fsa)
+{
+	struct files_index_link *l = NULL;
+
+	if (sconn->files_by_file_id == NULL) {
+		return NULL;
+	}
+
+	l = *files_index_bucket(sconn->files_by_file_id,
+				files_index_hash_file_id(&id));
+	return file_find_di_from(l, &id, need_fsa);
+}
+
 /****************************************************************************
  Find the next fsp having the same device and inode.
 ****************************************************************************/
@@ -2229,27 +2452,30 @@ files_struct *file_find_di_first(struct smbd_server_connection *sconn,
 files_struct *file_find_di_next(files_struct *start_fsp,
 				bool need_fsa)
 {
-	files_struct *fsp;
-
-	for (fsp = start_fsp->next;fsp;fsp=fsp->next) {
-		if (need_fsa && !fsp->fsp_flags.is_fsa) {
-			continue;
-		}
-		if (file_id_equal(&fsp->file_id, &start_fsp->file_id)) {
-			return fsp;
-		}
+	if (!start_fsp->file_id_link.linked) {
+		return NULL;
 	}
 
-	return NULL;
+	return file_find_di_from(start_fsp->file_id_link.next,
+				 &start_fsp->file_id,
+				 need_fsa);
 }
 
 struct files_struct *file_find_one_fsp_from_lease_key(
 	struct smbd_server_connection *sconn,
 	const struct smb2_lease_key *lease_key)
 {
-	struct files_struct *fsp;
+	struct files_index_link *l = NULL;
+
+	if (sconn->files_by_lease_key == NULL) {
+		return NULL;
+	}
+
+	l = *files_index_bucket(sconn->files_by_lease_key,
+				files_index_hash_lease_key(lease_key));
+	for (; l != NULL; l = l->next) {
+		struct files_struct *fsp = l->fsp;
 
-	for (fsp = sconn->files; fsp; fsp=fsp->next) {
 		if ((fsp->lease != NULL) &&
 		    (fsp->lease->lease.lease_key.data[0] ==
 		     lease_key->data[0]) &&
@@ -2324,9 +2550,13 @@ static void fsp_free(files_struct *fsp)
 {
 	struct smbd_server_connection *sconn = fsp->conn->sconn;
 
-	if (fsp == sconn->fsp_fi_cache.fsp) {
-		ZERO_STRUCT(sconn->fsp_fi_cache);
+	if (fsp->lease_link.linked) {
+		files_index_del(sconn->files_by_lease_key, &fsp->lease_link);
+	}
+	if (fsp->fd_link.linked) {
+		files_index_del(sconn->files_by_fd, &fsp->fd_link);
 	}
+	files_index_del(sconn->files_by_file_id, &fsp->file_id_link);
 
 	DLIST_REMOVE(sconn->files, fsp);
 	SMB_ASSERT(sconn->num_files > 0);
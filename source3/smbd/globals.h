@@ -24,18 +24,13 @@
 #include "system/select.h"
 #include "librpc/gen_ndr/smbXsrv.h"
 #include "smbprofile.h"
+#include "libcli/smb/smb2_compression.h"
 
 #ifdef USE_DMAPI
 struct smbd_dmapi_context;
 extern struct smbd_dmapi_context *dmapi_ctx;
 #endif
 
-/* A singleton cache to speed up searching by dev/inode. */
-struct fsp_singleton_cache {
-	files_struct *fsp;
-	struct file_id id;
-};
-
 extern const struct mangle_fns *mangle_fns;
 
 extern unsigned char *chartest;
@@ -208,6 +203,12 @@ const char *smb2_opcode_name(uint16_t opcode);
 bool smbd_is_smb2_header(const uint8_t *inbuf, size_t size);
 bool smbd_smb2_is_compound(const struct smbd_smb2_request *req);
 bool smbd_smb2_is_last_in_compound(const struct smbd_smb2_request *req);
+uint64_t smbd_smb2_credits_window(struct smbd_server_connection *sconn);
+bool smbd_smb2_request_can_splice(struct smbd_smb2_request *req);
+NTSTATUS smbd_smb2_request_splice_read(struct smbd_smb2_request *req,
+				       int fd,
+				       off_t offset,
+				       size_t length);
 
 NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 			     enum smb_transport_type transport_type,
@@ -325,6 +326,13 @@ struct smbXsrv_preauth {
 	uint8_t sha512_value[64];
 };
 
+struct smbd_smb2_credit_ctrl {
+	uint16_t window;
+	uint32_t samples;
+	/* smoothed request latency */
+	uint64_t latency_usec;
+};
+
 struct smbXsrv_connection {
 	struct smbXsrv_connection *prev, *next;
 
@@ -345,6 +353,16 @@ struct smbXsrv_connection {
 		struct tevent_queue *shutdown_wait_queue;
 		int sock;
 		struct tevent_fd *fde;
+		/*
+		 * Only used with "smbd io uring transport = yes",
+		 * fde is then only used to own the socket.
+		 */
+		struct smbd_smb2_uring *uring;
+		/*
+		 * Only used with "smb2 channel io threads = yes",
+		 * see smbd/smb2_io_thread.c.
+		 */
+		struct smbd_smb2_io_thread *io_thread;
 		enum smb_transport_type type;
 		bool trusted_quic;
 
@@ -444,9 +462,42 @@ struct smbXsrv_connection {
 			size_t pktlen;
 			uint8_t *pktbuf;
 		} request_read_state;
+		/*
+		 * The request being decrypted by a worker thread,
+		 * we don't read the next one before it's done.
+		 */
+		struct smbd_smb2_request *decrypt_req;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
 
+		/*
+		 * Sent queue entries waiting for their
+		 * MSG_ZEROCOPY completion.
+		 */
+		struct {
+			bool enabled;
+			bool used;
+			size_t threshold;
+			uint32_t next_id;
+			uint32_t completed_id;
+			struct smbd_smb2_send_queue *queue;
+		} zerocopy;
+		struct smbd_smb2_splice_pipe *splice_pipe;
+		/*
+		 * Splicing leaves the socket non-blocking,
+		 * see smbd_smb2_set_sock_blocking().
+		 */
+		bool sock_nonblocking;
+
+		/*
+		 * The jobs running on transport.io_thread,
+		 * at most one in each direction.
+		 */
+		struct {
+			struct tevent_req *send_req;
+			struct tevent_req *recv_req;
+		} io_thread;
+
 		struct {
 			/*
 			 * seq_low is the lowest sequence number
@@ -491,6 +542,24 @@ struct smbXsrv_connection {
 			 */
 			struct bitmap *bitmap;
 			bool multicredit;
+			/*
+			 * With "smb2 credits target latency" the
+			 * credits are limited by a window below max,
+			 * which shrinks if requests take longer
+			 * than the target and grows if they are
+			 * faster and the client uses the window.
+			 *
+			 * Requests on a tree connect use the window
+			 * of the share, others the one of the
+			 * connection.
+			 */
+			struct {
+				uint64_t target_usec;
+				uint16_t min_window;
+				struct smbd_smb2_credit_ctrl conn;
+				/* indexed by snum */
+				struct smbd_smb2_credit_ctrl *shares;
+			} adaptive;
 		} credits;
 
 		bool allow_2ff;
@@ -512,9 +581,16 @@ struct smbXsrv_connection {
 			uint32_t max_write;
 			uint16_t sign_algo;
 			uint16_t cipher;
+			struct smb3_compression_capabilities compression;
 			bool posix_extensions_negotiated;
 		} server;
 
+		/*
+		 * Scratch memory of the compressor,
+		 * created with the first compressed response.
+		 */
+		struct smb2_compression_mem *compression_mem;
+
 		struct smbXsrv_preauth preauth;
 
 		struct smbd_smb2_request *requests;
@@ -585,6 +661,19 @@ NTSTATUS smbXsrv_tcon_global_traverse(
 
 bool smbXsrv_set_crypto_flag(uint8_t *flags, uint8_t flag);
 
+/*
+ * A READ response whose data is spliced from the page cache,
+ * see smbd_smb2_request_splice_read().
+ */
+struct smbd_smb2_splice {
+	int fd;
+	off_t offset;
+	size_t length;
+	size_t sent;
+	size_t in_pipe;
+	bool short_file;
+};
+
 struct smbd_smb2_send_queue {
 	struct smbd_smb2_send_queue *prev, *next;
 
@@ -596,6 +685,29 @@ struct smbd_smb2_send_queue {
 	struct iovec *vector;
 	int count;
 
+	/*
+	 * The vector is still being signed or encrypted
+	 * by a worker thread, nothing behind this entry
+	 * can be sent.
+	 */
+	bool busy;
+
+	/*
+	 * The data of the iovec with iov_base == NULL
+	 * comes from splice->fd.
+	 */
+	struct smbd_smb2_splice *splice;
+
+	/*
+	 * The last MSG_ZEROCOPY id used for the vector,
+	 * the buffers need to stay until the kernel
+	 * reported the completion of this id.
+	 */
+	struct {
+		bool pending;
+		uint32_t id;
+	} zerocopy;
+
 	struct {
 		struct tevent_req *req;
 		struct timeval timeout;
@@ -628,6 +740,19 @@ struct smbd_smb2_request {
 	bool was_encrypted;
 	/* Should we encrypt? */
 	bool do_encryption;
+	/* Should we compress the response? */
+	bool do_compression;
+	/*
+	 * A worker thread signs, encrypts or decrypts
+	 * our buffers, see smbd_smb2_crypto_send().
+	 */
+	struct {
+		bool busy;
+		bool orphaned;
+		bool decrypted;
+		uint8_t *inbuf;
+		size_t inbuf_len;
+	} crypto;
 	struct tevent_timer *async_te;
 	bool compound_related;
 	NTSTATUS compound_create_err;
@@ -652,6 +777,8 @@ struct smbd_smb2_request {
 	struct smbXsrv_preauth *preauth;
 
 	struct timeval request_time;
+	/* the start of the current request of the compound */
+	struct timespec dispatch_time;
 
 	SMBPROFILE_IOBYTES_ASYNC_STATE_X(profile, profile_x);
 
@@ -801,7 +928,14 @@ struct smbd_server_connection {
 	struct files_struct *files;
 
 	int real_max_open_files;
-	struct fsp_singleton_cache fsp_fi_cache;
+
+	/*
+	 * Hash indexes of "files" by file_id,
+	 * by fd and by lease key, see files.c
+	 */
+	struct files_index *files_by_file_id;
+	struct files_index *files_by_fd;
+	struct files_index *files_by_lease_key;
 
 	struct pending_message_list *deferred_open_queue;
 
@@ -628,13 +628,16 @@ done:
 }
 
 /****************************************************************************
- Close the file associated with a fsp.
+ First half of closing the file associated with a fsp: everything up to
+ the actual close of the fd. Returns false in *_close_fd if there is no
+ fd that needs to be closed via SMB_VFS_CLOSE().
 ****************************************************************************/
 
-NTSTATUS fd_close(files_struct *fsp)
+NTSTATUS fd_close_begin(files_struct *fsp, bool *_close_fd)
 {
 	NTSTATUS stat_status = NT_STATUS_OK;
-	int ret;
+
+	*_close_fd = false;
 
 	if (fsp == fsp->conn->cwd_fsp) {
 		return NT_STATUS_OK;
@@ -663,6 +666,25 @@ NTSTATUS fd_close(files_struct *fsp)
 		return NT_STATUS_OK; /* Shared handle. Only close last reference. */
 	}
 
+	*_close_fd = true;
+	return stat_status;
+}
+
+/****************************************************************************
+ Close the file associated with a fsp.
+****************************************************************************/
+
+NTSTATUS fd_close(files_struct *fsp)
+{
+	NTSTATUS stat_status;
+	bool close_fd;
+	int ret;
+
+	stat_status = fd_close_begin(fsp, &close_fd);
+	if (!close_fd) {
+		return NT_STATUS_OK;
+	}
+
 	ret = SMB_VFS_CLOSE(fsp);
 	fsp_set_fd(fsp, -1);
 	if (ret == -1) {
@@ -1397,7 +1419,7 @@ static NTSTATUS open_file(
 		}
 	}
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_fname->st);
+	fsp_set_file_id(fsp, vfs_file_id_from_sbuf(conn, &smb_fname->st));
 	fsp->vuid = req ? req->vuid : UID_FIELD_INVALID;
 	fsp->file_pid = req ? req->smbpid : 0;
 	if (file_existed && S_ISLNK(smb_fname->st.st_ex_mode)) {
@@ -2021,11 +2043,7 @@ struct fsp_lease *find_fsp_lease(struct files_struct *new_fsp,
 				 uint16_t lease_epoch)
 {
 	struct files_struct *fsp;
-
-	/*
-	 * TODO: Measure how expensive this loop is with thousands of open
-	 * handles...
-	 */
+	struct fsp_lease *new_lease = NULL;
 
 	for (fsp = file_find_di_first(new_fsp->conn->sconn, new_fsp->file_id, true);
 	     fsp != NULL;
@@ -2044,22 +2062,22 @@ struct fsp_lease *find_fsp_lease(struct files_struct *new_fsp,
 	}
 
 	/* Not found - must be leased in another smbd. */
-	new_fsp->lease = talloc_zero(new_fsp->conn->sconn, struct fsp_lease);
-	if (new_fsp->lease == NULL) {
+	new_lease = talloc_zero(new_fsp->conn->sconn, struct fsp_lease);
+	if (new_lease == NULL) {
 		return NULL;
 	}
-	new_fsp->lease->ref_count = 1;
-	new_fsp->lease->sconn = new_fsp->conn->sconn;
-	new_fsp->lease->lease.lease_key = *key;
-	new_fsp->lease->lease.lease_state = current_state;
+	new_lease->ref_count = 1;
+	new_lease->sconn = new_fsp->conn->sconn;
+	new_lease->lease.lease_key = *key;
+	new_lease->lease.lease_state = current_state;
 	/*
 	 * We internally treat all leases as V2 and update
 	 * the epoch, but when sending breaks it matters if
 	 * the requesting lease was v1 or v2.
 	 */
-	new_fsp->lease->lease.lease_version = lease_version;
-	new_fsp->lease->lease.lease_epoch = lease_epoch;
-	return new_fsp->lease;
+	new_lease->lease.lease_version = lease_version;
+	new_lease->lease.lease_epoch = lease_epoch;
+	return new_lease;
 }
 
 static NTSTATUS try_lease_upgrade(struct files_struct *fsp,
@@ -2089,12 +2107,12 @@ static NTSTATUS try_lease_upgrade(struct files_struct *fsp,
 		return status;
 	}
 
-	fsp->lease = find_fsp_lease(
-		fsp,
-		&lease->lease_key,
-		current_state,
-		lease_version,
-		epoch);
+	fsp_set_lease(fsp,
+		      find_fsp_lease(fsp,
+				     &lease->lease_key,
+				     current_state,
+				     lease_version,
+				     epoch));
 	if (fsp->lease == NULL) {
 		DEBUG(1, ("Did not find existing lease for file %s\n",
 			  fsp_str_dbg(fsp)));
@@ -2168,23 +2186,25 @@ NTSTATUS grant_new_fsp_lease(struct files_struct *fsp,
 			     uint32_t granted,
 			     bool bump_epoch)
 {
+	struct fsp_lease *new_lease = NULL;
 	NTSTATUS status;
 
-	fsp->lease = talloc_zero(fsp->conn->sconn, struct fsp_lease);
-	if (fsp->lease == NULL) {
+	new_lease = talloc_zero(fsp->conn->sconn, struct fsp_lease);
+	if (new_lease == NULL) {
 		return NT_STATUS_INSUFFICIENT_RESOURCES;
 	}
-	fsp->lease->ref_count = 1;
-	fsp->lease->sconn = fsp->conn->sconn;
-	fsp->lease->lease.lease_version = lease->lease_version;
-	fsp->lease->lease.lease_key = lease->lease_key;
-	fsp->lease->lease.parent_lease_key = lease->parent_lease_key;
-	fsp->lease->lease.lease_flags = lease->lease_flags;
-	fsp->lease->lease.lease_state = granted;
-	fsp->lease->lease.lease_epoch = lease->lease_epoch;
+	new_lease->ref_count = 1;
+	new_lease->sconn = fsp->conn->sconn;
+	new_lease->lease.lease_version = lease->lease_version;
+	new_lease->lease.lease_key = lease->lease_key;
+	new_lease->lease.parent_lease_key = lease->parent_lease_key;
+	new_lease->lease.lease_flags = lease->lease_flags;
+	new_lease->lease.lease_state = granted;
+	new_lease->lease.lease_epoch = lease->lease_epoch;
 	if (granted != 0 && bump_epoch) {
-		fsp->lease->lease.lease_epoch++;
+		new_lease->lease.lease_epoch++;
 	}
+	fsp_set_lease(fsp, new_lease);
 
 	status = leases_db_add(client_guid,
 			       &lease->lease_key,
@@ -2198,7 +2218,8 @@ NTSTATUS grant_new_fsp_lease(struct files_struct *fsp,
 	if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(10, ("%s: leases_db_add failed: %s\n", __func__,
 			   nt_errstr(status)));
-		TALLOC_FREE(fsp->lease);
+		fsp_set_lease(fsp, NULL);
+		TALLOC_FREE(new_lease);
 		return NT_STATUS_INSUFFICIENT_RESOURCES;
 	}
 
@@ -4175,7 +4196,8 @@ static NTSTATUS open_file_ntcreate(
 		 * this won't do anything useful until the file
 		 * exists and has a valid stat struct.
 		 */
-		fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_fname->st);
+		fsp_set_file_id(fsp,
+				vfs_file_id_from_sbuf(conn, &smb_fname->st));
 	}
 	fsp_apply_private_ntcreatex_flags(fsp, private_flags);
 	fsp->access_mask = open_access_mask; /* We change this to the
@@ -4874,6 +4896,13 @@ static NTSTATUS mkdir_internal(connection_struct *conn,
 	first_atname = tmp_atname;
 
 mkdir_first:
+	/*
+	 * TODO: this is still the sync SMB_VFS_MKDIRAT(). Moving it
+	 * to SMB_VFS_MKDIRAT_SEND() needs open_directory() and the
+	 * SMB2 create path to become async up to this point, as the
+	 * ACL inheritance and the open of the new directory below
+	 * depend on it.
+	 */
 	ret = SMB_VFS_MKDIRAT(conn, dirfsp, first_atname, mode);
 	if (ret != 0) {
 		status = map_nt_error_from_unix(errno);
@@ -5306,7 +5335,7 @@ static NTSTATUS open_directory(connection_struct *conn,
 	 * Setup the files_struct for it.
 	 */
 
-	fsp->file_id = vfs_file_id_from_sbuf(conn, &smb_dname->st);
+	fsp_set_file_id(fsp, vfs_file_id_from_sbuf(conn, &smb_dname->st));
 	fsp->vuid = req ? req->vuid : UID_FIELD_INVALID;
 	fsp->file_pid = req ? req->smbpid : 0;
 	fsp->fsp_flags.can_lock = false;
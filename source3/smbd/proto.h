@@ -131,6 +131,16 @@ NTSTATUS close_file_smb(struct smb_request *req,
 NTSTATUS close_file_free(struct smb_request *req,
 			 struct files_struct **_fsp,
 			 enum file_close_type close_type);
+struct tevent_req *close_file_smb_send(TALLOC_CTX *mem_ctx,
+				       struct tevent_context *ev,
+				       struct smb_request *smbreq,
+				       struct files_struct *fsp,
+				       enum file_close_type close_type);
+NTSTATUS close_file_smb_recv(struct tevent_req *req);
+struct tevent_req *close_file_unlink_send(TALLOC_CTX *mem_ctx,
+					  struct tevent_context *ev,
+					  struct files_struct *fsp);
+NTSTATUS close_file_unlink_recv(struct tevent_req *req);
 void msg_close_file(struct messaging_context *msg_ctx,
 		    void *private_data,
 		    uint32_t msg_type,
@@ -219,6 +229,10 @@ struct tevent_req *dos_mode_at_send(TALLOC_CTX *mem_ctx,
 				    files_struct *dir_fsp,
 				    struct smb_filename *smb_fname);
 NTSTATUS dos_mode_at_recv(struct tevent_req *req, uint32_t *dosmode);
+struct tevent_req *fdos_mode_send(TALLOC_CTX *mem_ctx,
+				  struct tevent_context *ev,
+				  struct files_struct *fsp);
+NTSTATUS fdos_mode_recv(struct tevent_req *req, uint32_t *dosmode);
 int file_set_dosmode(connection_struct *conn,
 		     struct smb_filename *smb_fname,
 		     uint32_t dosmode,
@@ -342,6 +356,9 @@ struct files_struct *file_find_one_fsp_from_lease_key(
 	struct smbd_server_connection *sconn,
 	const struct smb2_lease_key *lease_key);
 bool file_find_subpath(files_struct *dir_fsp);
+void fsp_set_file_id(struct files_struct *fsp, struct file_id id);
+void fsp_set_lease(struct files_struct *fsp, struct fsp_lease *lease);
+void fsp_update_fd_index(struct files_struct *fsp);
 void fsp_unbind_smb(struct smb_request *req, files_struct *fsp);
 void file_free(struct smb_request *req, files_struct *fsp);
 struct files_struct *file_fsp_get(struct smbd_smb2_request *smb2req,
@@ -647,6 +664,7 @@ NTSTATUS fd_openat(const struct files_struct *dirfsp,
 		   struct smb_filename *smb_fname,
 		   files_struct *fsp,
 		   const struct vfs_open_how *how);
+NTSTATUS fd_close_begin(files_struct *fsp, bool *_close_fd);
 NTSTATUS fd_close(files_struct *fsp);
 NTSTATUS reopen_from_fsp(struct files_struct *dirfsp,
 			 struct smb_filename *smb_fname,
@@ -918,6 +936,14 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 			      uint32_t attrs,
 			      const char *newname,
 			      bool replace_if_exists);
+struct tevent_req *rename_internals_fsp_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     connection_struct *conn,
+					     files_struct *fsp,
+					     uint32_t attrs,
+					     const char *newname,
+					     bool replace_if_exists);
+NTSTATUS rename_internals_fsp_recv(struct tevent_req *req);
 NTSTATUS rename_internals(TALLOC_CTX *ctx,
 			  connection_struct *conn,
 			  struct smb_request *req,
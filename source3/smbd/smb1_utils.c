@@ -108,8 +108,9 @@ struct files_struct *fcb_or_dos_open(
 	new_fsp->fh = fsp->fh;
 	new_refcount = fh_get_refcount(new_fsp->fh) + 1;
 	fh_set_refcount(new_fsp->fh, new_refcount);
+	fsp_update_fd_index(new_fsp);
 
-	new_fsp->file_id = fsp->file_id;
+	fsp_set_file_id(new_fsp, fsp->file_id);
 	new_fsp->initial_allocation_size = fsp->initial_allocation_size;
 	new_fsp->file_pid = fsp->file_pid;
 	new_fsp->vuid = fsp->vuid;
@@ -180,74 +180,8 @@ static void setup_close_full_information(connection_struct *conn,
 	*out_allocation_size = SMB_VFS_GET_ALLOC_SIZE(conn, NULL, &smb_fname->st);
 }
 
-static NTSTATUS smbd_smb2_close(struct smbd_smb2_request *req,
-				struct files_struct **_fsp,
-				uint16_t in_flags,
-				uint16_t *out_flags,
-				struct timespec *out_creation_ts,
-				struct timespec *out_last_access_ts,
-				struct timespec *out_last_write_ts,
-				struct timespec *out_change_ts,
-				uint64_t *out_allocation_size,
-				uint64_t *out_end_of_file,
-				uint32_t *out_file_attributes)
-{
-	NTSTATUS status;
-	struct smb_request *smbreq;
-	connection_struct *conn = req->tcon->compat;
-	struct files_struct *fsp = *_fsp;
-	struct smb_filename *smb_fname = NULL;
-
-	*out_creation_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
-	*out_last_access_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
-	*out_last_write_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
-	*out_change_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
-
-	*out_flags = 0;
-	*out_allocation_size = 0;
-	*out_end_of_file = 0;
-	*out_file_attributes = 0;
-
-	DEBUG(10,("smbd_smb2_close: %s - %s\n",
-		  fsp_str_dbg(fsp), fsp_fnum_dbg(fsp)));
-
-	smbreq = smbd_smb2_fake_smb_request(req, fsp);
-	if (smbreq == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	if (in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION) {
-		*out_file_attributes = fdos_mode(fsp);
-		fsp->fsp_flags.fstat_before_close = true;
-	}
-
-	status = close_file_smb(smbreq, fsp, NORMAL_CLOSE);
-	if (!NT_STATUS_IS_OK(status)) {
-		DEBUG(5,("smbd_smb2_close: close_file[%s]: %s\n",
-			 smb_fname_str_dbg(smb_fname), nt_errstr(status)));
-		file_free(smbreq, fsp);
-		*_fsp = fsp = NULL;
-		return status;
-	}
-
-	if (in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION) {
-		setup_close_full_information(conn,
-				fsp->fsp_name,
-				out_creation_ts,
-				out_last_access_ts,
-				out_last_write_ts,
-				out_change_ts,
-				out_flags,
-				out_allocation_size,
-				out_end_of_file);
-	}
-
-	file_free(smbreq, fsp);
-	*_fsp = fsp = NULL;
-	return NT_STATUS_OK;
-}
-
 struct smbd_smb2_close_state {
+	struct tevent_context *ev;
 	struct smbd_smb2_request *smb2req;
 	struct files_struct *in_fsp;
 	uint16_t in_flags;
@@ -260,10 +194,17 @@ struct smbd_smb2_close_state {
 	uint64_t out_end_of_file;
 	uint32_t out_file_attributes;
 	struct tevent_queue *wait_queue;
+	struct smb_request *smbreq;
 };
 
 static void smbd_smb2_close_wait_done(struct tevent_req *subreq);
 static void smbd_smb2_close_delay_lease_break_done(struct tevent_req *subreq);
+static void smbd_smb2_close_do_close(struct tevent_req *req);
+static void smbd_smb2_close_unlink_done(struct tevent_req *subreq);
+static void smbd_smb2_close_get_dosmode(struct tevent_req *req);
+static void smbd_smb2_close_dosmode_done(struct tevent_req *subreq);
+static void smbd_smb2_close_file(struct tevent_req *req);
+static void smbd_smb2_close_file_done(struct tevent_req *subreq);
 
 static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 					       struct tevent_context *ev,
@@ -290,9 +231,14 @@ static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->ev = ev;
 	state->smb2req = smb2req;
 	state->in_fsp = in_fsp;
 	state->in_flags = in_flags;
+	state->out_creation_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
+	state->out_last_access_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
+	state->out_last_write_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
+	state->out_change_ts = (struct timespec){0, SAMBA_UTIME_OMIT};
 
 	in_fsp->fsp_flags.closing = true;
 
@@ -396,29 +342,93 @@ static struct tevent_req *smbd_smb2_close_send(TALLOC_CTX *mem_ctx,
 	}
 
 do_close:
-	status = smbd_smb2_close(smb2req,
-				 &state->in_fsp,
-				 state->in_flags,
-				 &state->out_flags,
-				 &state->out_creation_ts,
-				 &state->out_last_access_ts,
-				 &state->out_last_write_ts,
-				 &state->out_change_ts,
-				 &state->out_allocation_size,
-				 &state->out_end_of_file,
-				 &state->out_file_attributes);
-	if (tevent_req_nterror(req, status)) {
-		DBG_INFO("%s - %s: close file failed: %s\n",
-			 fsp_name_str, fsp_fnum_str,
-			 nt_errstr(status));
+	smbd_smb2_close_do_close(req);
+	if (!tevent_req_is_in_progress(req)) {
 		return tevent_req_post(req, ev);
 	}
+	return req;
+}
 
-	tevent_req_done(req);
-	return tevent_req_post(req, ev);
+/*
+ * The close is a chain of async steps: if the file is going to be
+ * deleted it's unlinked first, then the DOS attributes for
+ * SMB2_CLOSE_FLAGS_FULL_INFORMATION are fetched and finally the fd is
+ * closed.
+ */
+static void smbd_smb2_close_do_close(struct tevent_req *req)
+{
+	struct smbd_smb2_close_state *state = tevent_req_data(
+		req, struct smbd_smb2_close_state);
+	struct files_struct *fsp = state->in_fsp;
+	struct tevent_req *subreq = NULL;
+
+	if (smbd_smb2_is_compound(state->smb2req) &&
+	    !smbd_smb2_is_last_in_compound(state->smb2req)) {
+		/*
+		 * Can't go async if we're not the
+		 * last request in a compound request.
+		 */
+		smb2_request_set_async_internal(state->smb2req, true);
+	}
+
+	if (fsp->fsp_flags.initial_delete_on_close ||
+	    fsp->fsp_flags.delete_on_close)
+	{
+		subreq = close_file_unlink_send(state, state->ev, fsp);
+		if (tevent_req_nomem(subreq, req)) {
+			return;
+		}
+		tevent_req_set_callback(subreq,
+					smbd_smb2_close_unlink_done,
+					req);
+		return;
+	}
+
+	smbd_smb2_close_get_dosmode(req);
 }
 
-static void smbd_smb2_close_wait_done(struct tevent_req *subreq)
+static void smbd_smb2_close_unlink_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	NTSTATUS status;
+
+	status = close_file_unlink_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (!NT_STATUS_IS_OK(status)) {
+		/*
+		 * Not fatal, the close itself will try the unlink
+		 * again.
+		 */
+		DBG_DEBUG("close_file_unlink failed: %s\n",
+			  nt_errstr(status));
+	}
+
+	smbd_smb2_close_get_dosmode(req);
+}
+
+static void smbd_smb2_close_get_dosmode(struct tevent_req *req)
+{
+	struct smbd_smb2_close_state *state = tevent_req_data(
+		req, struct smbd_smb2_close_state);
+	struct files_struct *fsp = state->in_fsp;
+	struct tevent_req *subreq = NULL;
+
+	if (!(state->in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION)) {
+		smbd_smb2_close_file(req);
+		return;
+	}
+
+	fsp->fsp_flags.fstat_before_close = true;
+
+	subreq = fdos_mode_send(state, state->ev, fsp);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_close_dosmode_done, req);
+}
+
+static void smbd_smb2_close_dosmode_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
@@ -426,26 +436,85 @@ static void smbd_smb2_close_wait_done(struct tevent_req *subreq)
 		req, struct smbd_smb2_close_state);
 	NTSTATUS status;
 
-	tevent_queue_wait_recv(subreq);
+	status = fdos_mode_recv(subreq, &state->out_file_attributes);
 	TALLOC_FREE(subreq);
-
-	status = smbd_smb2_close(state->smb2req,
-				 &state->in_fsp,
-				 state->in_flags,
-				 &state->out_flags,
-				 &state->out_creation_ts,
-				 &state->out_last_access_ts,
-				 &state->out_last_write_ts,
-				 &state->out_change_ts,
-				 &state->out_allocation_size,
-				 &state->out_end_of_file,
-				 &state->out_file_attributes);
 	if (tevent_req_nterror(req, status)) {
 		return;
 	}
+
+	smbd_smb2_close_file(req);
+}
+
+static void smbd_smb2_close_file(struct tevent_req *req)
+{
+	struct smbd_smb2_close_state *state = tevent_req_data(
+		req, struct smbd_smb2_close_state);
+	struct files_struct *fsp = state->in_fsp;
+	struct tevent_req *subreq = NULL;
+
+	state->smbreq = smbd_smb2_fake_smb_request(state->smb2req, fsp);
+	if (tevent_req_nomem(state->smbreq, req)) {
+		return;
+	}
+
+	subreq = close_file_smb_send(state,
+				     state->ev,
+				     state->smbreq,
+				     fsp,
+				     NORMAL_CLOSE);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_close_file_done, req);
+}
+
+static void smbd_smb2_close_file_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_close_state *state = tevent_req_data(
+		req, struct smbd_smb2_close_state);
+	struct files_struct *fsp = state->in_fsp;
+	NTSTATUS status;
+
+	status = close_file_smb_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_INFO("close_file_smb failed: %s\n", nt_errstr(status));
+		file_free(state->smbreq, fsp);
+		state->in_fsp = NULL;
+		tevent_req_nterror(req, status);
+		return;
+	}
+
+	if (state->in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION) {
+		setup_close_full_information(fsp->conn,
+					     fsp->fsp_name,
+					     &state->out_creation_ts,
+					     &state->out_last_access_ts,
+					     &state->out_last_write_ts,
+					     &state->out_change_ts,
+					     &state->out_flags,
+					     &state->out_allocation_size,
+					     &state->out_end_of_file);
+	}
+
+	file_free(state->smbreq, fsp);
+	state->in_fsp = NULL;
 	tevent_req_done(req);
 }
 
+static void smbd_smb2_close_wait_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+
+	tevent_queue_wait_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	smbd_smb2_close_do_close(req);
+}
+
 static void smbd_smb2_close_delay_lease_break_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(subreq, struct tevent_req);
@@ -473,21 +542,7 @@ static void smbd_smb2_close_delay_lease_break_done(struct tevent_req *subreq)
 		return;
 	}
 
-	status = smbd_smb2_close(state->smb2req,
-				 &state->in_fsp,
-				 state->in_flags,
-				 &state->out_flags,
-				 &state->out_creation_ts,
-				 &state->out_last_access_ts,
-				 &state->out_last_write_ts,
-				 &state->out_change_ts,
-				 &state->out_allocation_size,
-				 &state->out_end_of_file,
-				 &state->out_file_attributes);
-	if (tevent_req_nterror(req, status)) {
-		return;
-	}
-	tevent_req_done(req);
+	smbd_smb2_close_do_close(req);
 }
 
 static NTSTATUS smbd_smb2_close_recv(struct tevent_req *req,
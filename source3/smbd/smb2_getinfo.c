@@ -216,8 +216,103 @@ struct smbd_smb2_getinfo_state {
 	struct smbd_smb2_request *smb2req;
 	NTSTATUS status;
 	DATA_BLOB out_output_buffer;
+
+	/* Used by the async SMB2_0_INFO_FILE path */
+	struct smb_request *smbreq;
+	struct files_struct *fsp;
+	uint16_t file_info_level;
+	bool delete_pending;
+	uint32_t in_output_buffer_length;
 };
 
+static NTSTATUS smbd_smb2_getinfo_file(struct smbd_smb2_getinfo_state *state)
+{
+	struct files_struct *fsp = state->fsp;
+	char *data = NULL;
+	unsigned int data_size = 0;
+	size_t fixed_portion;
+	NTSTATUS status;
+
+	status = smbd_do_qfilepathinfo(fsp->conn, state,
+				       state->smbreq,
+				       state->file_info_level,
+				       fsp,
+				       fsp->fsp_name,
+				       state->delete_pending,
+				       NULL,
+				       STR_UNICODE,
+				       state->in_output_buffer_length,
+				       &fixed_portion,
+				       &data,
+				       &data_size);
+	if (!NT_STATUS_IS_OK(status)) {
+		SAFE_FREE(data);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_INVALID_LEVEL)) {
+			status = NT_STATUS_INVALID_INFO_CLASS;
+		}
+		return status;
+	}
+	if (state->in_output_buffer_length < fixed_portion) {
+		SAFE_FREE(data);
+		return NT_STATUS_INFO_LENGTH_MISMATCH;
+	}
+	if (data_size > 0) {
+		state->out_output_buffer = data_blob_talloc(state,
+							    data,
+							    data_size);
+		SAFE_FREE(data);
+		if (state->out_output_buffer.data == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		if (data_size > state->in_output_buffer_length) {
+			state->out_output_buffer.length =
+				state->in_output_buffer_length;
+			status = STATUS_BUFFER_OVERFLOW;
+		}
+	}
+	SAFE_FREE(data);
+	return status;
+}
+
+static void smbd_smb2_getinfo_file_dosmode_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_getinfo_state *state = tevent_req_data(
+		req, struct smbd_smb2_getinfo_state);
+	uint32_t dosmode;
+	NTSTATUS status;
+	bool ok;
+
+	/*
+	 * The attributes are cached in fsp->fsp_name->st now,
+	 * smbd_do_qfilepathinfo() picks them up from there.
+	 */
+	status = fdos_mode_recv(subreq, &dosmode);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	/*
+	 * Make sure we run as the user again
+	 */
+	ok = change_to_user_and_service_by_fsp(state->fsp);
+	if (!ok) {
+		tevent_req_nterror(req, NT_STATUS_ACCESS_DENIED);
+		return;
+	}
+
+	status = smbd_smb2_getinfo_file(state);
+	if (!NT_STATUS_IS_OK(status) &&
+	    !NT_STATUS_EQUAL(status, STATUS_BUFFER_OVERFLOW)) {
+		tevent_req_nterror(req, status);
+		return;
+	}
+	state->status = status;
+	tevent_req_done(req);
+}
+
 static void smb2_ipc_getinfo(struct tevent_req *req,
 				struct smbd_smb2_getinfo_state *state,
 				struct tevent_context *ev,
@@ -292,12 +387,8 @@ static struct tevent_req *smbd_smb2_getinfo_send(TALLOC_CTX *mem_ctx,
 	case SMB2_0_INFO_FILE:
 	{
 		uint16_t file_info_level;
-		char *data = NULL;
-		unsigned int data_size = 0;
 		bool delete_pending = false;
 		struct file_id fileid;
-		size_t fixed_portion;
-
 
 		/*
 		 * MS-SMB2 3.3.5.20.1 "Handling SMB2_0_INFO_FILE"
@@ -409,47 +500,72 @@ static struct tevent_req *smbd_smb2_getinfo_send(TALLOC_CTX *mem_ctx,
 			}
 		}
 
-		status = smbd_do_qfilepathinfo(conn, state,
-					       smbreq,
-					       file_info_level,
-					       fsp,
-					       fsp->fsp_name,
-					       delete_pending,
-					       NULL,
-					       STR_UNICODE,
-					       in_output_buffer_length,
-					       &fixed_portion,
-					       &data,
-					       &data_size);
-		if (!NT_STATUS_IS_OK(status)) {
-			SAFE_FREE(data);
-			if (NT_STATUS_EQUAL(status, NT_STATUS_INVALID_LEVEL)) {
-				status = NT_STATUS_INVALID_INFO_CLASS;
-			}
-			tevent_req_nterror(req, status);
-			return tevent_req_post(req, ev);
-		}
-		if (in_output_buffer_length < fixed_portion) {
-			SAFE_FREE(data);
-			tevent_req_nterror(
-				req, NT_STATUS_INFO_LENGTH_MISMATCH);
-			return tevent_req_post(req, ev);
-		}
-		if (data_size > 0) {
-			state->out_output_buffer = data_blob_talloc(state,
-								    data,
-								    data_size);
-			SAFE_FREE(data);
-			if (tevent_req_nomem(state->out_output_buffer.data, req)) {
+		state->smbreq = smbreq;
+		state->fsp = fsp;
+		state->file_info_level = file_info_level;
+		state->delete_pending = delete_pending;
+		state->in_output_buffer_length = in_output_buffer_length;
+
+		if ((fsp->fake_file_handle == NULL) &&
+		    (fsp->fsp_name->st.cached_dos_attributes ==
+		     FILE_ATTRIBUTE_INVALID) &&
+		    lp_smbd_async_dosmode(SNUM(conn)))
+		{
+			struct tevent_req *subreq = NULL;
+			uint32_t dosmode;
+
+			/*
+			 * Fetch the DOS attributes in a worker thread
+			 * before building the reply.
+			 */
+			subreq = fdos_mode_send(state, ev, fsp);
+			if (tevent_req_nomem(subreq, req)) {
 				return tevent_req_post(req, ev);
 			}
-			if (data_size > in_output_buffer_length) {
-				state->out_output_buffer.length =
-					in_output_buffer_length;
-				status = STATUS_BUFFER_OVERFLOW;
+			if (tevent_req_is_in_progress(subreq)) {
+				tevent_req_set_callback(
+					subreq,
+					smbd_smb2_getinfo_file_dosmode_done,
+					req);
+
+				if (smbd_smb2_is_compound(smb2req) &&
+				    !smbd_smb2_is_last_in_compound(smb2req)) {
+					/*
+					 * Can't go async if we're not the
+					 * last request in a compound request.
+					 */
+					smb2_request_set_async_internal(
+						smb2req, true);
+				}
+
+				/*
+				 * Ensure any close request knows about
+				 * this request.
+				 */
+				if (!aio_add_req_to_fsp(fsp, req)) {
+					tevent_req_nterror(
+						req, NT_STATUS_NO_MEMORY);
+					return tevent_req_post(req, ev);
+				}
+				return req;
+			}
+
+			/*
+			 * Already done synchronously
+			 */
+			status = fdos_mode_recv(subreq, &dosmode);
+			TALLOC_FREE(subreq);
+			if (tevent_req_nterror(req, status)) {
+				return tevent_req_post(req, ev);
 			}
 		}
-		SAFE_FREE(data);
+
+		status = smbd_smb2_getinfo_file(state);
+		if (!NT_STATUS_IS_OK(status) &&
+		    !NT_STATUS_EQUAL(status, STATUS_BUFFER_OVERFLOW)) {
+			tevent_req_nterror(req, status);
+			return tevent_req_post(req, ev);
+		}
 		break;
 	}
 
@@ -0,0 +1,389 @@
+/*
+   Unix SMB/CIFS implementation.
+   Per channel io threads for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/network.h"
+#include "smbd/smb2_io_thread.h"
+#include "lib/util/iov_buf.h"
+#include "lib/util/tevent_ntstatus.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+
+/*
+ * Every channel of a multichannel session gets its own
+ * threads. A large request keeps a thread blocked in
+ * recvmsg() until it's complete, so receiving has a
+ * pool with a single thread of its own. The other pool
+ * sends large responses and signs or encrypts the ones
+ * of this channel, so channels don't wait for each other
+ * and a slow client sending a request never holds up
+ * the responses.
+ *
+ * The threads only move bytes between the socket and
+ * buffers owned by the main thread. Parsing, dispatching
+ * and everything that changes state stays in the main
+ * event loop.
+ */
+#define SMBD_SMB2_IO_THREAD_RECV_THREADS 1
+#define SMBD_SMB2_IO_THREAD_MAX_THREADS 2
+
+struct smbd_smb2_io_thread {
+	/*
+	 * Our own dup() of the socket, the threads can't
+	 * see it closed and reused under them.
+	 */
+	int sock;
+	struct pthreadpool_tevent *recv_pool;
+	struct pthreadpool_tevent *pool;
+};
+
+static int smbd_smb2_io_thread_destructor(struct smbd_smb2_io_thread *t)
+{
+	TALLOC_FREE(t->recv_pool);
+	TALLOC_FREE(t->pool);
+	if (t->sock != -1) {
+		close(t->sock);
+		t->sock = -1;
+	}
+	return 0;
+}
+
+NTSTATUS smbd_smb2_io_thread_create(TALLOC_CTX *mem_ctx,
+				    int sock,
+				    struct smbd_smb2_io_thread **_t)
+{
+	struct smbd_smb2_io_thread *t = NULL;
+	int ret;
+
+	t = talloc_zero(mem_ctx, struct smbd_smb2_io_thread);
+	if (t == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	t->sock = -1;
+	talloc_set_destructor(t, smbd_smb2_io_thread_destructor);
+
+	ret = pthreadpool_tevent_init(t,
+				      SMBD_SMB2_IO_THREAD_RECV_THREADS,
+				      &t->recv_pool);
+	if (ret != 0) {
+		TALLOC_FREE(t);
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	ret = pthreadpool_tevent_init(t,
+				      SMBD_SMB2_IO_THREAD_MAX_THREADS,
+				      &t->pool);
+	if (ret != 0) {
+		TALLOC_FREE(t);
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	t->sock = dup(sock);
+	if (t->sock == -1) {
+		NTSTATUS status = map_nt_error_from_unix_common(errno);
+		TALLOC_FREE(t);
+		return status;
+	}
+
+	*_t = t;
+	return NT_STATUS_OK;
+}
+
+struct pthreadpool_tevent *smbd_smb2_io_thread_pool(
+	struct smbd_smb2_io_thread *t)
+{
+	return t->pool;
+}
+
+void smbd_smb2_io_thread_shutdown(struct smbd_smb2_io_thread *t)
+{
+	if (t->sock == -1) {
+		return;
+	}
+	shutdown(t->sock, SHUT_RDWR);
+}
+
+struct smbd_smb2_io_thread_state {
+	struct tevent_context *ev;
+	int sock;
+	bool do_recv;
+	struct iovec *iov;
+	int iovcnt;
+	size_t done;
+	bool eof;
+	int err;
+	struct tevent_fd *fde;
+};
+
+static void smbd_smb2_io_thread_do(void *private_data);
+static void smbd_smb2_io_thread_done(struct tevent_req *subreq);
+static void smbd_smb2_io_thread_nonblock(struct tevent_req *req);
+
+static int smbd_smb2_io_thread_state_destructor(
+	struct smbd_smb2_io_thread_state *state)
+{
+	/*
+	 * The thread still uses state->iov,
+	 * smbd_smb2_io_thread_done() removes us.
+	 */
+	return -1;
+}
+
+static struct tevent_req *smbd_smb2_io_thread_job_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_io_thread *t,
+	bool do_recv,
+	const struct iovec *iov,
+	int iovcnt)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smbd_smb2_io_thread_state *state = NULL;
+	struct pthreadpool_tevent *pool = do_recv ? t->recv_pool : t->pool;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_io_thread_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->sock = t->sock;
+	state->do_recv = do_recv;
+	state->iovcnt = iovcnt;
+
+	state->iov = talloc_memdup(state, iov, sizeof(struct iovec) * iovcnt);
+	if (tevent_req_nomem(state->iov, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = pthreadpool_tevent_job_send(state, ev, pool,
+					     smbd_smb2_io_thread_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_io_thread_done, req);
+
+	talloc_set_destructor(state, smbd_smb2_io_thread_state_destructor);
+
+	return req;
+}
+
+/*
+ * Move as much as possible, with MSG_DONTWAIT
+ * in flags this returns when the socket would block.
+ */
+static void smbd_smb2_io_thread_io(struct smbd_smb2_io_thread_state *state,
+				   int flags)
+{
+#ifdef MSG_NOSIGNAL
+	if (!state->do_recv) {
+		flags |= MSG_NOSIGNAL;
+	}
+#endif
+
+	while (state->iovcnt > 0) {
+		struct msghdr msg = {
+			.msg_iov = state->iov,
+			.msg_iovlen = state->iovcnt,
+		};
+		ssize_t n;
+		bool ok;
+
+		if (state->do_recv) {
+			n = recvmsg(state->sock, &msg, flags);
+		} else {
+			n = sendmsg(state->sock, &msg, flags);
+		}
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((flags & MSG_DONTWAIT) &&
+			    (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+			state->err = errno;
+			return;
+		}
+		if (n == 0) {
+			state->eof = true;
+			return;
+		}
+
+		state->done += n;
+		ok = iov_advance(&state->iov, &state->iovcnt, n);
+		if (!ok) {
+			state->err = EINVAL;
+			return;
+		}
+	}
+}
+
+static void smbd_smb2_io_thread_do(void *private_data)
+{
+	struct smbd_smb2_io_thread_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_io_thread_state);
+
+	/*
+	 * The socket is in blocking mode, the main
+	 * thread only uses MSG_DONTWAIT on it.
+	 */
+	smbd_smb2_io_thread_io(state, state->do_recv ? MSG_WAITALL : 0);
+}
+
+static void smbd_smb2_io_thread_finish(struct tevent_req *req)
+{
+	struct smbd_smb2_io_thread_state *state = tevent_req_data(
+		req, struct smbd_smb2_io_thread_state);
+
+	TALLOC_FREE(state->fde);
+
+	if (state->eof) {
+		tevent_req_nterror(req, NT_STATUS_END_OF_FILE);
+		return;
+	}
+	if (state->err != 0) {
+		tevent_req_nterror(req,
+			map_nt_error_from_unix_common(state->err));
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static void smbd_smb2_io_thread_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_io_thread_state *state = tevent_req_data(
+		req, struct smbd_smb2_io_thread_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_nterror(req,
+				map_nt_error_from_unix_common(ret));
+			return;
+		}
+		/*
+		 * If we get EAGAIN from pthreadpool_tevent_job_recv() this
+		 * means the lower level pthreadpool failed to create a new
+		 * thread. Fallback to non-blocking io driven by the main
+		 * event loop in that case to allow some progress for the
+		 * client, without blocking the other channels.
+		 */
+		smbd_smb2_io_thread_nonblock(req);
+		return;
+	}
+
+	smbd_smb2_io_thread_finish(req);
+}
+
+static void smbd_smb2_io_thread_fd_handler(struct tevent_context *ev,
+					   struct tevent_fd *fde,
+					   uint16_t flags,
+					   void *private_data)
+{
+	struct tevent_req *req = talloc_get_type_abort(
+		private_data, struct tevent_req);
+
+	smbd_smb2_io_thread_nonblock(req);
+}
+
+static void smbd_smb2_io_thread_nonblock(struct tevent_req *req)
+{
+	struct smbd_smb2_io_thread_state *state = tevent_req_data(
+		req, struct smbd_smb2_io_thread_state);
+
+	smbd_smb2_io_thread_io(state, MSG_DONTWAIT);
+
+	if (state->iovcnt == 0 || state->eof || state->err != 0) {
+		smbd_smb2_io_thread_finish(req);
+		return;
+	}
+
+	if (state->fde != NULL) {
+		return;
+	}
+
+	state->fde = tevent_add_fd(state->ev,
+				   state,
+				   state->sock,
+				   state->do_recv ?
+				   TEVENT_FD_READ : TEVENT_FD_WRITE,
+				   smbd_smb2_io_thread_fd_handler,
+				   req);
+	if (tevent_req_nomem(state->fde, req)) {
+		return;
+	}
+}
+
+static NTSTATUS smbd_smb2_io_thread_job_recv(struct tevent_req *req,
+					     size_t *ndone)
+{
+	struct smbd_smb2_io_thread_state *state = tevent_req_data(
+		req, struct smbd_smb2_io_thread_state);
+	NTSTATUS status;
+
+	*ndone = state->done;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
+
+struct tevent_req *smbd_smb2_io_thread_sendv_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_io_thread *t,
+	const struct iovec *iov,
+	int iovcnt)
+{
+	return smbd_smb2_io_thread_job_send(mem_ctx, ev, t, false,
+					    iov, iovcnt);
+}
+
+NTSTATUS smbd_smb2_io_thread_sendv_recv(struct tevent_req *req,
+					size_t *nwritten)
+{
+	return smbd_smb2_io_thread_job_recv(req, nwritten);
+}
+
+struct tevent_req *smbd_smb2_io_thread_recvv_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_io_thread *t,
+	const struct iovec *iov,
+	int iovcnt)
+{
+	return smbd_smb2_io_thread_job_send(mem_ctx, ev, t, true,
+					    iov, iovcnt);
+}
+
+NTSTATUS smbd_smb2_io_thread_recvv_recv(struct tevent_req *req,
+					size_t *nread)
+{
+	return smbd_smb2_io_thread_job_recv(req, nread);
+}
@@ -0,0 +1,77 @@
+/*
+   Unix SMB/CIFS implementation.
+   Per channel io threads for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SMBD_SMB2_IO_THREAD_H_
+#define _SMBD_SMB2_IO_THREAD_H_
+
+/*
+ * Reads and writes smaller than this are done inline
+ * by the main thread, handing them over to a thread
+ * costs more than the copy.
+ */
+#define SMBD_SMB2_IO_THREAD_MIN_SIZE (64 * 1024)
+
+/*
+ * Maximum number of iovecs handed to a single sendv job.
+ */
+#define SMBD_SMB2_IO_THREAD_MAX_IOV 128
+
+struct smbd_smb2_io_thread;
+struct pthreadpool_tevent;
+
+NTSTATUS smbd_smb2_io_thread_create(TALLOC_CTX *mem_ctx,
+				    int sock,
+				    struct smbd_smb2_io_thread **_t);
+struct pthreadpool_tevent *smbd_smb2_io_thread_pool(
+	struct smbd_smb2_io_thread *t);
+
+/*
+ * Write all of iov to the socket from a worker thread.
+ *
+ * The caller needs to make sure the buffers iov points
+ * to are not touched (or freed) until the request is done.
+ */
+struct tevent_req *smbd_smb2_io_thread_sendv_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_io_thread *t,
+	const struct iovec *iov,
+	int iovcnt);
+NTSTATUS smbd_smb2_io_thread_sendv_recv(struct tevent_req *req,
+					size_t *nwritten);
+
+/*
+ * Fill all of iov from the socket from a worker thread,
+ * same rules for the buffers as above.
+ */
+struct tevent_req *smbd_smb2_io_thread_recvv_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_io_thread *t,
+	const struct iovec *iov,
+	int iovcnt);
+NTSTATUS smbd_smb2_io_thread_recvv_recv(struct tevent_req *req,
+					size_t *nread);
+
+/*
+ * Wakes up jobs blocked on the socket,
+ * they complete with an error.
+ */
+void smbd_smb2_io_thread_shutdown(struct smbd_smb2_io_thread *t);
+
+#endif /* _SMBD_SMB2_IO_THREAD_H_ */
@@ -218,6 +218,7 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	struct smb2_negotiate_context *in_cipher = NULL;
 	struct smb2_negotiate_context *in_sign_algo = NULL;
 	struct smb2_negotiate_context *in_transport_caps = NULL;
+	struct smb2_negotiate_context *in_compression = NULL;
 	struct smb2_negotiate_contexts out_c = { .num_contexts = 0, };
 	const struct smb311_capabilities default_smb3_capabilities =
 		smb311_capabilities_parse(
@@ -384,6 +385,8 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 					SMB2_SIGNING_CAPABILITIES);
 	in_transport_caps =  smb2_negotiate_context_find(&in_c,
 					SMB2_TRANSPORT_CAPABILITIES);
+	in_compression = smb2_negotiate_context_find(&in_c,
+					SMB2_COMPRESSION_CAPABILITIES);
 
 	negprot_spnego_blob = negprot_spnego(req, xconn);
 	if (negprot_spnego_blob.data == NULL) {
@@ -721,6 +724,110 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		}
 	}
 
+	if (in_compression != NULL) {
+		struct smb3_compression_capabilities srv_compression;
+		struct smb3_compression_capabilities *neg =
+			&xconn->smb2.server.compression;
+		uint8_t buf[8 + 2 * SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+		size_t needed = 8;
+		uint16_t algo_count;
+		uint32_t flags;
+		const uint8_t *p;
+		uint16_t si;
+		size_t i;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		algo_count = SVAL(in_compression->data.data, 0);
+		flags = IVAL(in_compression->data.data, 4);
+		if (algo_count == 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		p = in_compression->data.data + needed;
+		needed += algo_count * 2;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		smb3_compression_capabilities_parse(
+			lp_server_smb3_compression_algorithms(),
+			&srv_compression);
+
+		*neg = (struct smb3_compression_capabilities) {
+			.chained = (flags &
+				    SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED),
+		};
+
+		/*
+		 * The server algorithms are listed
+		 * with the lowest idx being preferred.
+		 */
+		for (si = 0; si < srv_compression.num_algos; si++) {
+			uint16_t algo = srv_compression.algos[si];
+
+			if (algo == SMB2_COMPRESSION_PATTERN_V1 &&
+			    !neg->chained)
+			{
+				continue;
+			}
+
+			for (i = 0; i < algo_count; i++) {
+				if (SVAL(p, i * 2) == algo) {
+					neg->algos[neg->num_algos++] = algo;
+					break;
+				}
+			}
+		}
+
+		/*
+		 * Pattern_V1 alone is not useful,
+		 * we need a real algorithm.
+		 */
+		if (neg->num_algos == 1 &&
+		    neg->algos[0] == SMB2_COMPRESSION_PATTERN_V1)
+		{
+			neg->num_algos = 0;
+		}
+		if (neg->num_algos == 0) {
+			neg->chained = false;
+		}
+
+		/*
+		 * If compression is disabled we don't
+		 * reply with SMB2_COMPRESSION_CAPABILITIES.
+		 */
+		if (srv_compression.num_algos != 0) {
+			uint16_t count = MAX(neg->num_algos, 1);
+
+			SSVAL(buf, 0, count); /* CompressionAlgorithmCount */
+			SSVAL(buf, 2, 0);     /* Padding */
+			SIVAL(buf, 4, neg->chained ?
+			      SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED :
+			      SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE);
+			SSVAL(buf, 8, SMB2_COMPRESSION_NONE);
+			for (i = 0; i < neg->num_algos; i++) {
+				SSVAL(buf, 8 + i * 2, neg->algos[i]);
+			}
+
+			status = smb2_negotiate_context_add(
+				req,
+				&out_c,
+				SMB2_COMPRESSION_CAPABILITIES,
+				buf,
+				8 + count * 2);
+			if (!NT_STATUS_IS_OK(status)) {
+				return smbd_smb2_request_error(req, status);
+			}
+		}
+	}
+
 	status = smb311_capabilities_check(&default_smb3_capabilities,
 					   "smb2srv_negprot",
 					   DBGLVL_NOTICE,
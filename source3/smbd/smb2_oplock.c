@@ -837,6 +837,25 @@ static void add_oplock_timeout_handler(files_struct *fsp)
 	}
 }
 
+/*******************************************************************
+ Once the client loses write caching other openers will look at the
+ file, make sure writes the VFS has acknowledged but not yet issued
+ are visible to them.
+*******************************************************************/
+
+static void break_flush_cached_writes(files_struct *fsp)
+{
+	NTSTATUS status;
+
+	status = SMB_VFS_FLUSH_CACHED_WRITES(fsp);
+	if (!NT_STATUS_IS_OK(status) &&
+	    !NT_STATUS_EQUAL(status, NT_STATUS_NOT_IMPLEMENTED)) {
+		DBG_NOTICE("SMB_VFS_FLUSH_CACHED_WRITES on %s failed: %s\n",
+			   fsp_str_dbg(fsp),
+			   nt_errstr(status));
+	}
+}
+
 /*******************************************************************
  This handles the generic oplock break message from another smbd.
 *******************************************************************/
@@ -1045,6 +1064,11 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 		return;
 	}
 
+	if ((break_from & SMB2_LEASE_WRITE) &&
+	    !(break_to & SMB2_LEASE_WRITE)) {
+		break_flush_cached_writes(fsp);
+	}
+
 	/* Need to wait before sending a break
 	   message if we sent ourselves this message. */
 	if (server_id_equal(&self, &src)) {
@@ -1133,6 +1157,8 @@ static void process_kernel_oplock_break(struct messaging_context *msg_ctx,
 		return;
 	}
 
+	break_flush_cached_writes(fsp);
+
 #if defined(WITH_SMB1SERVER)
 	if (conn_using_smb2(sconn)) {
 #endif
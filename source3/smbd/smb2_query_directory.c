@@ -209,6 +209,15 @@ static struct tevent_req *fetch_dos_mode_send(
 
 static NTSTATUS fetch_dos_mode_recv(struct tevent_req *req);
 
+static struct tevent_req *dir_prefetch_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *dir_fsp,
+	const char * const *names,
+	size_t num_names);
+
+static NTSTATUS dir_prefetch_recv(struct tevent_req *req);
+
 struct smbd_smb2_query_directory_state {
 	struct tevent_context *ev;
 	struct smbd_smb2_request *smb2req;
@@ -231,11 +240,15 @@ struct smbd_smb2_query_directory_state {
 	int last_entry_off;
 	size_t max_async_dosmode_active;
 	uint32_t async_dosmode_active;
+	size_t prefetch_window;
+	uint32_t prefetch_active;
 	bool done;
 };
 
 static bool smb2_query_directory_next_entry(struct tevent_req *req);
 static void smb2_query_directory_dos_mode_done(struct tevent_req *subreq);
+static void smb2_query_directory_prefetch(struct tevent_req *req);
+static void smb2_query_directory_prefetch_done(struct tevent_req *subreq);
 static void smb2_query_directory_waited(struct tevent_req *subreq);
 
 static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
@@ -485,7 +498,28 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		}
 	}
 
-	if (state->async_dosmode) {
+	/*
+	 * Only real directory traverses that return
+	 * more than a name per entry are worth
+	 * looking at in bulk.
+	 */
+	if (dptr_has_wild(fsp->dptr) &&
+	    !state->dont_descend &&
+	    state->max_count > 1 &&
+	    state->info_level != SMB_FIND_FILE_NAMES_INFO &&
+	    lp_smbd_async_dir_prefetch(SNUM(conn)) &&
+	    vfswrap_check_async_with_thread_creds(conn->sconn->pool))
+	{
+		/*
+		 * Roughly the number of entries that fit
+		 * into the response.
+		 */
+		state->prefetch_window = in_output_buffer_length / 96;
+		state->prefetch_window = MAX(state->prefetch_window, 32);
+		state->prefetch_window = MIN(state->prefetch_window, 4096);
+	}
+
+	if (state->async_dosmode || state->prefetch_window > 0) {
 		/*
 		 * Should we only set async_internal
 		 * if we're not the last request in
@@ -533,6 +567,22 @@ static bool smb2_query_directory_next_entry(struct tevent_req *req)
 
 	SMB_ASSERT(space_remaining >= 0);
 
+	if (state->prefetch_window > 0 &&
+	    dptr_read_ahead_pending(state->dirfsp->dptr) == 0)
+	{
+		smb2_query_directory_prefetch(req);
+		if (!tevent_req_is_in_progress(req)) {
+			return true;
+		}
+		if (state->prefetch_active > 0) {
+			/*
+			 * We go on in
+			 * smb2_query_directory_prefetch_done()
+			 */
+			return true;
+		}
+	}
+
 	status = smbd_dirptr_lanman2_entry(state,
 					   state->dirfsp,
 					   state->smbreq->flags2,
@@ -654,6 +704,98 @@ last_entry_done:
 
 static void smb2_query_directory_check_next_entry(struct tevent_req *req);
 
+/*
+ * Read the next response window of names from the directory and
+ * look them up in parallel on the worker threads. That warms the
+ * dentry, inode and xattr caches, so packing the entries one by one
+ * via smbd_dirptr_get_entry() afterwards doesn't wait for the disk
+ * once per entry.
+ */
+static void smb2_query_directory_prefetch(struct tevent_req *req)
+{
+	struct smbd_smb2_query_directory_state *state = tevent_req_data(
+		req, struct smbd_smb2_query_directory_state);
+	struct files_struct *dirfsp = state->dirfsp;
+	struct pthreadpool_tevent *pool = dirfsp->conn->sconn->pool;
+	const char * const *names = NULL;
+	size_t num_names = 0;
+	size_t max_jobs;
+	size_t per_job;
+	size_t i;
+
+	if (fsp_get_pathref_fd(dirfsp) == -1) {
+		return;
+	}
+
+	names = dptr_read_ahead(dirfsp->dptr,
+				state->prefetch_window,
+				&num_names);
+	if (num_names == 0) {
+		return;
+	}
+
+	/*
+	 * Not too small chunks, handing over a single
+	 * lookup costs about as much as doing it.
+	 */
+	max_jobs = pthreadpool_tevent_max_threads(pool);
+	max_jobs = MIN(max_jobs, (num_names + 15) / 16);
+	max_jobs = MAX(max_jobs, 1);
+	per_job = (num_names + max_jobs - 1) / max_jobs;
+
+	for (i = 0; i < num_names; i += per_job) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = dir_prefetch_send(state,
+					   state->ev,
+					   dirfsp,
+					   &names[i],
+					   MIN(per_job, num_names - i));
+		if (tevent_req_nomem(subreq, req)) {
+			return;
+		}
+		tevent_req_set_callback(subreq,
+					smb2_query_directory_prefetch_done,
+					req);
+		state->prefetch_active++;
+	}
+}
+
+static void smb2_query_directory_prefetch_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req =
+		tevent_req_callback_data(subreq,
+		struct tevent_req);
+	struct smbd_smb2_query_directory_state *state =
+		tevent_req_data(req,
+		struct smbd_smb2_query_directory_state);
+	NTSTATUS status;
+	bool ok;
+
+	status = dir_prefetch_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (!NT_STATUS_IS_OK(status)) {
+		/*
+		 * Only a hint, the entries get looked
+		 * up again anyway.
+		 */
+		DBG_DEBUG("dir_prefetch failed: %s\n", nt_errstr(status));
+	}
+
+	state->prefetch_active--;
+	if (state->prefetch_active > 0) {
+		return;
+	}
+
+	/*
+	 * Make sure we run as the user again
+	 */
+	ok = change_to_user_and_service_by_fsp(state->dirfsp);
+	SMB_ASSERT(ok);
+
+	smb2_query_directory_check_next_entry(req);
+}
+
 static void smb2_query_directory_dos_mode_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req =
@@ -877,3 +1019,179 @@ static NTSTATUS fetch_dos_mode_recv(struct tevent_req *req)
 	tevent_req_received(req);
 	return NT_STATUS_OK;
 }
+
+struct dir_prefetch_state {
+	int dirfd;
+	char **names;
+	bool dos_xattr;
+	struct security_unix_token *token;
+	int err;
+};
+
+static void dir_prefetch_do_async(void *private_data);
+static void dir_prefetch_done(struct tevent_req *subreq);
+
+static int dir_prefetch_state_destructor(struct dir_prefetch_state *state)
+{
+	/*
+	 * The thread still uses state->names,
+	 * dir_prefetch_done() removes us.
+	 */
+	return -1;
+}
+
+static struct tevent_req *dir_prefetch_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *dir_fsp,
+	const char * const *names,
+	size_t num_names)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct dir_prefetch_state *state = NULL;
+	connection_struct *conn = dir_fsp->conn;
+	size_t i;
+
+	req = tevent_req_create(mem_ctx, &state, struct dir_prefetch_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct dir_prefetch_state) {
+		.dirfd = fsp_get_pathref_fd(dir_fsp),
+		.dos_xattr = lp_store_dos_attributes(SNUM(conn)),
+	};
+
+	/*
+	 * The names in the dptr read ahead buffer are handed out
+	 * by dptr_ReadDirName(), the thread gets its own copy.
+	 */
+	state->names = talloc_array(state, char *, num_names);
+	if (tevent_req_nomem(state->names, req)) {
+		return tevent_req_post(req, ev);
+	}
+	for (i = 0; i < num_names; i++) {
+		state->names[i] = talloc_strdup(state->names, names[i]);
+		if (tevent_req_nomem(state->names[i], req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	if (geteuid() == sec_initial_uid()) {
+		state->token = root_unix_token(state);
+	} else {
+		state->token = copy_unix_token(
+					state,
+					conn->session_info->unix_token);
+	}
+	if (tevent_req_nomem(state->token, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     ev,
+					     conn->sconn->pool,
+					     dir_prefetch_do_async,
+					     state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, dir_prefetch_done, req);
+
+	talloc_set_destructor(state, dir_prefetch_state_destructor);
+
+	return req;
+}
+
+static void dir_prefetch_do_async(void *private_data)
+{
+	struct dir_prefetch_state *state = talloc_get_type_abort(
+		private_data, struct dir_prefetch_state);
+	size_t num_names = talloc_array_length(state->names);
+	size_t i;
+	int ret;
+
+	/*
+	 * We need our own cwd for the
+	 * getxattr() on the relative name below.
+	 */
+	per_thread_cwd_activate();
+
+	/* Become the correct credential on this thread. */
+	ret = set_thread_credentials(state->token->uid,
+				     state->token->gid,
+				     (size_t)state->token->ngroups,
+				     state->token->groups);
+	if (ret != 0) {
+		state->err = errno;
+		return;
+	}
+
+	ret = fchdir(state->dirfd);
+	if (ret == -1) {
+		state->err = errno;
+		return;
+	}
+
+	/*
+	 * The results are thrown away, smbd_dirptr_get_entry()
+	 * looks at every entry through the VFS again.
+	 */
+	for (i = 0; i < num_names; i++) {
+		const char *name = state->names[i];
+		struct stat st;
+		char buf[256];
+
+		if (ISDOT(name) || ISDOTDOT(name)) {
+			continue;
+		}
+
+		ret = fstatat(state->dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+		if (ret == -1) {
+			continue;
+		}
+		if (!state->dos_xattr || S_ISLNK(st.st_mode)) {
+			continue;
+		}
+		(void)getxattr(name, SAMBA_XATTR_DOS_ATTRIB, buf, sizeof(buf));
+	}
+}
+
+static void dir_prefetch_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct dir_prefetch_state *state = tevent_req_data(
+		req, struct dir_prefetch_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_nterror(req,
+				map_nt_error_from_unix_common(ret));
+			return;
+		}
+		/*
+		 * Running the lookups sync in the main thread
+		 * would only do them twice, just go on.
+		 */
+		tevent_req_done(req);
+		return;
+	}
+
+	if (state->err != 0) {
+		tevent_req_nterror(req,
+			map_nt_error_from_unix_common(state->err));
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static NTSTATUS dir_prefetch_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
@@ -345,6 +345,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * We cannot use sendfile if...
 	 * We were not configured to do so OR
 	 * Signing is active OR
+	 * The response gets compressed OR
 	 * This is a compound SMB2 operation OR
 	 * fsp is a STREAM file OR
 	 * It's not a regular file OR
@@ -357,6 +358,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	if (!lp__use_sendfile(SNUM(fsp->conn)) ||
 	    smb2req->do_signing ||
 	    smb2req->do_encryption ||
+	    smb2req->do_compression ||
 	    smbd_smb2_is_compound(smb2req) ||
 	    fsp_is_alternate_stream(fsp) ||
 	    (!S_ISREG(fsp->fsp_name->st.st_ex_mode)) ||
@@ -376,8 +378,120 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Below this the splice() and pipe overhead
+ * is larger than the memcpy we save.
+ */
+#define SMBD_SMB2_SPLICE_READ_MIN (64 * 1024)
+
+static NTSTATUS schedule_smb2_splice_read(struct smbd_smb2_request *smb2req,
+					  struct smbd_smb2_read_state *state)
+{
+	files_struct *fsp = state->fsp;
+	const SMB_STRUCT_STAT *st = &fsp->fsp_name->st;
+	NTSTATUS status;
+	int fd;
+
+	/*
+	 * Like sendfile, but it also works within a compound.
+	 * The data needs to end on an 8 byte boundary there,
+	 * as we can't add padding behind it.
+	 */
+
+	if (!lp_use_splice(SNUM(fsp->conn)) ||
+	    smb2req->do_signing ||
+	    smb2req->do_encryption ||
+	    smb2req->do_compression ||
+	    state->in_length < SMBD_SMB2_SPLICE_READ_MIN ||
+	    (smbd_smb2_is_compound(smb2req) && (state->in_length % 8) != 0) ||
+	    fsp_is_alternate_stream(fsp) ||
+	    (!S_ISREG(st->st_ex_mode)) ||
+	    !smbd_smb2_request_can_splice(smb2req))
+	{
+		return NT_STATUS_RETRY;
+	}
+
+	/*
+	 * Modules without a kernel fd, or holding data the
+	 * page cache doesn't have yet, refuse or write it out
+	 * first. Any failure means we just read normally.
+	 */
+	fd = SMB_VFS_SPLICE_READ_FD(fsp, state->in_offset, state->in_length);
+	if (fd == -1) {
+		DBG_DEBUG("SMB_VFS_SPLICE_READ_FD failed for %s: %s\n",
+			  fsp_str_dbg(fsp),
+			  strerror(errno));
+		return NT_STATUS_RETRY;
+	}
+
+	/*
+	 * The header announces in_length bytes, so the size has
+	 * to be current: the one from open time is stale if the
+	 * file was truncated or written since.
+	 */
+	status = vfs_stat_fsp(fsp);
+	if (!NT_STATUS_IS_OK(status) ||
+	    (state->in_offset >= st->st_ex_size) ||
+	    (st->st_ex_size < state->in_offset + state->in_length))
+	{
+		close(fd);
+		return NT_STATUS_RETRY;
+	}
+
+	status = smbd_smb2_request_splice_read(smb2req,
+					       fd,
+					       state->in_offset,
+					       state->in_length);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_SUPPORTED)) {
+		return NT_STATUS_RETRY;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	/* We've already checked there's this amount of data
+	   to read. */
+	state->out_data.length = state->in_length;
+	state->out_remaining = 0;
+	return NT_STATUS_OK;
+}
+
 static void smbd_smb2_read_pipe_done(struct tevent_req *subreq);
 
+/*
+ * [MS-SMB2] 3.3.5.12: compress the response if the client
+ * asked for it or the share has SMB2_SHAREFLAG_COMPRESS_DATA.
+ */
+static bool smbd_smb2_read_want_compression(struct smbd_smb2_request *smb2req,
+					    connection_struct *conn,
+					    uint8_t in_flags,
+					    uint32_t in_length)
+{
+	struct smbXsrv_connection *xconn = smb2req->xconn;
+	int snum = SNUM(conn);
+
+	if (xconn->smb2.server.compression.num_algos == 0) {
+		return false;
+	}
+	if (smbd_smb2_is_compound(smb2req)) {
+		return false;
+	}
+	if (in_length < (uint32_t)lp_smb3_compression_threshold(snum)) {
+		return false;
+	}
+
+	switch (lp_smb3_compress_data(snum)) {
+	case SMB3_COMPRESS_DATA_REQUESTED:
+		return (in_flags & SMB2_READFLAG_REQUEST_COMPRESSED);
+	case SMB3_COMPRESS_DATA_YES:
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
 /*******************************************************************
  Common read complete processing function for both synchronous and
  asynchronous reads.
@@ -549,6 +663,11 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	smb2req->do_compression = smbd_smb2_read_want_compression(smb2req,
+								  conn,
+								  in_flags,
+								  in_length);
+
 	status = schedule_smb2_aio_read(fsp->conn,
 				smbreq,
 				fsp,
@@ -597,6 +716,16 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	status = schedule_smb2_splice_read(smb2req, state);
+	if (NT_STATUS_IS_OK(status)) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+		tevent_req_nterror(req, status);
+		return tevent_req_post(req, ev);
+	}
+
 	/* Ok, read into memory. Allocate the out buffer. */
 	state->out_data = data_blob_talloc(state, NULL, in_length);
 	if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
@@ -1338,64 +1338,32 @@ static struct files_struct *rename_check_open_fn(struct files_struct *fsp,
 }
 
 /****************************************************************************
- Rename an open file - given an fsp.
+ Check a rename of an open file (not a stream) and work out the
+ destination. Returns NT_STATUS_OK with *_smb_fname_dst_rel == NULL if
+ there's nothing to do.
 ****************************************************************************/
 
-NTSTATUS rename_internals_fsp(connection_struct *conn,
-			      struct files_struct *src_dirfsp,
-			      files_struct *fsp,
-			      struct smb_filename *smb_fname_src_rel,
-			      struct share_mode_lock **_lck,
-			      uint32_t attrs,
-			      const char *newname,
-			      bool replace_if_exists)
+static NTSTATUS rename_internals_fsp_prepare(
+	TALLOC_CTX *ctx,
+	connection_struct *conn,
+	struct files_struct *src_dirfsp,
+	files_struct *fsp,
+	struct smb_filename *smb_fname_src_rel,
+	uint32_t attrs,
+	const char *newname,
+	bool replace_if_exists,
+	struct files_struct **_dst_dirfsp,
+	struct smb_filename **_smb_fname_dst,
+	struct smb_filename **_smb_fname_dst_rel)
 {
-	TALLOC_CTX *ctx = talloc_stackframe();
 	struct smb_filename *smb_fname_src = fsp->fsp_name;
 	struct files_struct *dst_dirfsp = NULL;
 	struct smb_filename *smb_fname_dst = NULL;
 	struct smb_filename *smb_fname_dst_rel = NULL;
-	NTSTATUS status = NT_STATUS_OK;
-	struct share_mode_lock *lck = NULL;
-	int ret;
+	NTSTATUS status;
 	bool case_preserve = fsp->fsp_flags.posix_open || conn->case_preserve;
-	struct vfs_rename_how rhow = { .flags = 0, };
-
-	if (file_has_open_streams(fsp)) {
-		status = NT_STATUS_ACCESS_DENIED;
-		goto out;
-	}
-
-	if (fsp_is_alternate_stream(fsp)) {
-		if (newname[0] != ':') {
-			status = NT_STATUS_INVALID_PARAMETER;
-			goto out;
-		}
-
-		smb_fname_dst = synthetic_smb_fname(ctx,
-						    smb_fname_src->base_name,
-						    newname,
-						    NULL,
-						    0,
-						    smb_fname_src->flags);
-		if (smb_fname_dst == NULL) {
-			status = NT_STATUS_NO_MEMORY;
-			goto out;
-		}
-
-		if (is_ntfs_default_stream_smb_fname(smb_fname_dst)) {
-			status = replace_if_exists
-					 ? NT_STATUS_NOT_SUPPORTED
-					 : NT_STATUS_OBJECT_NAME_COLLISION;
-			goto out;
-		}
 
-		ret = SMB_VFS_RENAME_STREAM(fsp->conn,
-					    fsp,
-					    newname,
-					    replace_if_exists);
-		goto inform_others;
-	}
+	*_smb_fname_dst_rel = NULL;
 
 	status = filename_convert_dirfsp(ctx,
 					 conn,
@@ -1408,15 +1376,14 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 					 &dst_dirfsp,
 					 &smb_fname_dst);
 	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
+		return status;
 	}
 
 	if (is_ntfs_stream_smb_fname(smb_fname_dst)) {
 		/*
-		 * We handled streams above
+		 * Streams are handled by our callers
 		 */
-		status = NT_STATUS_OBJECT_NAME_INVALID;
-		goto out;
+		return NT_STATUS_OBJECT_NAME_INVALID;
 	}
 
 	{
@@ -1429,8 +1396,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 
 		char *lcomp = get_original_lcomp(ctx, conn, newname, 0);
 		if (lcomp == NULL) {
-			status = NT_STATUS_NO_MEMORY;
-			goto out;
+			return NT_STATUS_NO_MEMORY;
 		}
 
 		smb_fname_dst_rel = synthetic_smb_fname(
@@ -1438,8 +1404,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 		TALLOC_FREE(lcomp);
 
 		if (smb_fname_dst_rel == NULL) {
-			status = NT_STATUS_NO_MEMORY;
-			goto out;
+			return NT_STATUS_NO_MEMORY;
 		}
 	}
 
@@ -1451,8 +1416,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 		 * case. Because we don't preserve the case, we can
 		 * just return success. Streams handled above.
 		 */
-		status = NT_STATUS_OK;
-		goto out;
+		return NT_STATUS_OK;
 	}
 
 	if (strcsequal(src_dirfsp->fsp_name->base_name,
@@ -1467,8 +1431,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 			/*
 			 * No file name change
 			 */
-			status = NT_STATUS_OK;
-			goto out;
+			return NT_STATUS_OK;
 		}
 
 		if (strequal(smb_fname_src_rel->base_name,
@@ -1494,8 +1457,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 				   "%s -> %s\n",
 				   smb_fname_str_dbg(smb_fname_src),
 				   smb_fname_str_dbg(smb_fname_dst));
-			status = NT_STATUS_OBJECT_NAME_COLLISION;
-			goto out;
+			return NT_STATUS_OBJECT_NAME_COLLISION;
 		}
 
 		check_state.fileid = vfs_file_id_from_sbuf(conn,
@@ -1506,8 +1468,7 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 					  &check_state);
 		if (found_open != NULL) {
 			DBG_NOTICE("Target file open\n");
-			status = NT_STATUS_ACCESS_DENIED;
-			goto out;
+			return NT_STATUS_ACCESS_DENIED;
 		}
 	}
 
@@ -1520,12 +1481,11 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 			   smb_fname_str_dbg(smb_fname_dst));
 		if (NT_STATUS_EQUAL(status,NT_STATUS_SHARING_VIOLATION))
 			status = NT_STATUS_ACCESS_DENIED;
-		goto out;
+		return status;
 	}
 
 	if (rename_path_prefix_equal(fsp->fsp_name, smb_fname_dst)) {
-		status = NT_STATUS_ACCESS_DENIED;
-		goto out;
+		return NT_STATUS_ACCESS_DENIED;
 	}
 
 	status = check_parent_access_fsp(dst_dirfsp,
@@ -1537,17 +1497,29 @@ NTSTATUS rename_internals_fsp(connection_struct *conn,
 			"dst %s returned %s\n",
 			smb_fname_str_dbg(smb_fname_dst),
 			nt_errstr(status));
-		goto out;
+		return status;
 	}
 
-	ret = SMB_VFS_RENAMEAT(conn,
-			       src_dirfsp,
-			       smb_fname_src_rel,
-			       dst_dirfsp,
-			       smb_fname_dst_rel,
-			       &rhow);
+	*_dst_dirfsp = dst_dirfsp;
+	*_smb_fname_dst = smb_fname_dst;
+	*_smb_fname_dst_rel = smb_fname_dst_rel;
+	return NT_STATUS_OK;
+}
 
-inform_others:
+/****************************************************************************
+ Tell the other opens of a file about the result of its rename.
+ ret and err are the result and errno of the rename call.
+****************************************************************************/
+
+static NTSTATUS rename_internals_fsp_finish(connection_struct *conn,
+					    files_struct *fsp,
+					    struct share_mode_lock **_lck,
+					    struct smb_filename *smb_fname_dst,
+					    int ret,
+					    int err)
+{
+	struct share_mode_lock *lck = NULL;
+	NTSTATUS status;
 
 	if (_lck != NULL) {
 		lck = talloc_move(talloc_tos(), _lck);
@@ -1572,9 +1544,8 @@ inform_others:
 
 		old_fname = cp_smb_filename(talloc_tos(), fsp->fsp_name);
 		if (old_fname == NULL) {
-			status = NT_STATUS_NO_MEMORY;
 			TALLOC_FREE(lck);
-			goto out;
+			return NT_STATUS_NO_MEMORY;
 		}
 		rename_open_files(conn, lck, fsp->file_id, fsp->name_hash,
 				  smb_fname_dst);
@@ -1612,16 +1583,15 @@ inform_others:
 			      smb_fname_dst);
 
 		TALLOC_FREE(old_fname);
-		status = NT_STATUS_OK;
-		goto out;
+		return NT_STATUS_OK;
 	}
 
 	TALLOC_FREE(lck);
 
-	if (errno == ENOTDIR || errno == EISDIR) {
+	if (err == ENOTDIR || err == EISDIR) {
 		status = NT_STATUS_OBJECT_NAME_COLLISION;
 	} else {
-		status = map_nt_error_from_unix(errno);
+		status = map_nt_error_from_unix(err);
 	}
 
 	DBG_NOTICE("Error %s rename %s -> %s\n",
@@ -1629,11 +1599,238 @@ inform_others:
 		   smb_fname_str_dbg(fsp->fsp_name),
 		   smb_fname_str_dbg(smb_fname_dst));
 
+	return status;
+}
+
+/****************************************************************************
+ Rename an open file - given an fsp.
+****************************************************************************/
+
+NTSTATUS rename_internals_fsp(connection_struct *conn,
+			      struct files_struct *src_dirfsp,
+			      files_struct *fsp,
+			      struct smb_filename *smb_fname_src_rel,
+			      struct share_mode_lock **_lck,
+			      uint32_t attrs,
+			      const char *newname,
+			      bool replace_if_exists)
+{
+	TALLOC_CTX *ctx = talloc_stackframe();
+	struct smb_filename *smb_fname_src = fsp->fsp_name;
+	struct files_struct *dst_dirfsp = NULL;
+	struct smb_filename *smb_fname_dst = NULL;
+	struct smb_filename *smb_fname_dst_rel = NULL;
+	NTSTATUS status = NT_STATUS_OK;
+	int ret;
+	struct vfs_rename_how rhow = { .flags = 0, };
+
+	if (file_has_open_streams(fsp)) {
+		status = NT_STATUS_ACCESS_DENIED;
+		goto out;
+	}
+
+	if (fsp_is_alternate_stream(fsp)) {
+		if (newname[0] != ':') {
+			status = NT_STATUS_INVALID_PARAMETER;
+			goto out;
+		}
+
+		smb_fname_dst = synthetic_smb_fname(ctx,
+						    smb_fname_src->base_name,
+						    newname,
+						    NULL,
+						    0,
+						    smb_fname_src->flags);
+		if (smb_fname_dst == NULL) {
+			status = NT_STATUS_NO_MEMORY;
+			goto out;
+		}
+
+		if (is_ntfs_default_stream_smb_fname(smb_fname_dst)) {
+			status = replace_if_exists
+					 ? NT_STATUS_NOT_SUPPORTED
+					 : NT_STATUS_OBJECT_NAME_COLLISION;
+			goto out;
+		}
+
+		ret = SMB_VFS_RENAME_STREAM(fsp->conn,
+					    fsp,
+					    newname,
+					    replace_if_exists);
+		goto inform_others;
+	}
+
+	status = rename_internals_fsp_prepare(ctx,
+					      conn,
+					      src_dirfsp,
+					      fsp,
+					      smb_fname_src_rel,
+					      attrs,
+					      newname,
+					      replace_if_exists,
+					      &dst_dirfsp,
+					      &smb_fname_dst,
+					      &smb_fname_dst_rel);
+	if (!NT_STATUS_IS_OK(status) || (smb_fname_dst_rel == NULL)) {
+		goto out;
+	}
+
+	ret = SMB_VFS_RENAMEAT(conn,
+			       src_dirfsp,
+			       smb_fname_src_rel,
+			       dst_dirfsp,
+			       smb_fname_dst_rel,
+			       &rhow);
+
+inform_others:
+	status = rename_internals_fsp_finish(conn,
+					     fsp,
+					     _lck,
+					     smb_fname_dst,
+					     ret,
+					     errno);
  out:
 	TALLOC_FREE(ctx);
 	return status;
 }
 
+/****************************************************************************
+ Rename an open file, doing the rename itself in a worker thread if the
+ VFS supports that. The caller must not hold the share mode lock, it's
+ only taken again after the rename to update the other opens. Streams
+ are renamed synchronously.
+****************************************************************************/
+
+struct rename_internals_fsp_state {
+	struct files_struct *fsp;
+	struct smb_filename *smb_fname_src_parent;
+	struct smb_filename *smb_fname_src_rel;
+	struct files_struct *dst_dirfsp;
+	struct smb_filename *smb_fname_dst;
+	struct smb_filename *smb_fname_dst_rel;
+	struct vfs_rename_how rhow;
+};
+
+static void rename_internals_fsp_done(struct tevent_req *subreq);
+
+struct tevent_req *rename_internals_fsp_send(TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     connection_struct *conn,
+					     files_struct *fsp,
+					     uint32_t attrs,
+					     const char *newname,
+					     bool replace_if_exists)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct rename_internals_fsp_state *state = NULL;
+	NTSTATUS status;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct rename_internals_fsp_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->fsp = fsp;
+
+	status = parent_pathref(state,
+				conn->cwd_fsp,
+				fsp->fsp_name,
+				&state->smb_fname_src_parent,
+				&state->smb_fname_src_rel);
+	if (tevent_req_nterror(req, status)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (fsp_is_alternate_stream(fsp) || file_has_open_streams(fsp)) {
+		status = rename_internals_fsp(conn,
+					      state->smb_fname_src_parent->fsp,
+					      fsp,
+					      state->smb_fname_src_rel,
+					      NULL,
+					      attrs,
+					      newname,
+					      replace_if_exists);
+		if (tevent_req_nterror(req, status)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	status = rename_internals_fsp_prepare(state,
+					      conn,
+					      state->smb_fname_src_parent->fsp,
+					      fsp,
+					      state->smb_fname_src_rel,
+					      attrs,
+					      newname,
+					      replace_if_exists,
+					      &state->dst_dirfsp,
+					      &state->smb_fname_dst,
+					      &state->smb_fname_dst_rel);
+	if (tevent_req_nterror(req, status)) {
+		return tevent_req_post(req, ev);
+	}
+	if (state->smb_fname_dst_rel == NULL) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = SMB_VFS_RENAMEAT_SEND(state,
+				       ev,
+				       state->smb_fname_src_parent->fsp,
+				       state->smb_fname_src_rel,
+				       state->dst_dirfsp,
+				       state->smb_fname_dst_rel,
+				       &state->rhow);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, rename_internals_fsp_done, req);
+	return req;
+}
+
+static void rename_internals_fsp_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct rename_internals_fsp_state *state = tevent_req_data(
+		req, struct rename_internals_fsp_state);
+	struct vfs_aio_state aio_state = { .error = 0, };
+	NTSTATUS status;
+	int ret;
+	bool ok;
+
+	ret = SMB_VFS_RENAMEAT_RECV(subreq, &aio_state);
+	TALLOC_FREE(subreq);
+
+	/*
+	 * Make sure we run as the user again
+	 */
+	ok = change_to_user_and_service_by_fsp(state->fsp);
+	if (!ok) {
+		tevent_req_nterror(req, NT_STATUS_ACCESS_DENIED);
+		return;
+	}
+
+	status = rename_internals_fsp_finish(state->fsp->conn,
+					     state->fsp,
+					     NULL,
+					     state->smb_fname_dst,
+					     ret,
+					     aio_state.error);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+NTSTATUS rename_internals_fsp_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
 /****************************************************************************
  The guts of the rename command, split out so it may be called by the NT SMB
  code.
@@ -37,6 +37,12 @@
 #include "auth.h"
 #include "libcli/smb/smbXcli_base.h"
 #include "source3/lib/substitute.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "lib/util/sys_rw.h"
+#ifdef WITH_SMB2_URING
+#include "smbd/smb2_uring.h"
+#endif
+#include "smbd/smb2_io_thread.h"
 
 #if defined(LINUX)
 /* SIOCOUTQ TIOCOUTQ are the same */
@@ -53,6 +59,14 @@
 #include <gnutls/gnutls.h>
 #include <gnutls/crypto.h>
 
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_SMBD_MSG_ZEROCOPY 1
+#endif
+
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
 
@@ -61,6 +75,9 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 uint16_t flags,
 					 void *private_data);
 static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
+#ifdef WITH_SMB2_URING
+static NTSTATUS smbd_smb2_uring_setup(struct smbXsrv_connection *xconn);
+#endif
 
 static const struct smbd_smb2_dispatch_table {
 	uint16_t opcode;
@@ -294,6 +311,195 @@ bool smbd_smb2_is_last_in_compound(const struct smbd_smb2_request *req)
 		req->in.vector_count);
 }
 
+static int smbd_smb2_splice_destructor(struct smbd_smb2_splice *s)
+{
+	if (s->fd != -1) {
+		close(s->fd);
+		s->fd = -1;
+	}
+	return 0;
+}
+
+/*
+ * Can the READ response of req be spliced? Check this before
+ * asking the VFS for an fd via SMB_VFS_SPLICE_READ_FD().
+ */
+bool smbd_smb2_request_can_splice(struct smbd_smb2_request *req)
+{
+#ifdef HAVE_LINUX_SPLICE
+	struct smbXsrv_connection *xconn = req->xconn;
+
+	/*
+	 * smbd_smb2_flush_splice() switches the socket to
+	 * non-blocking mode, which would break the blocking
+	 * io thread jobs.
+	 */
+	if (xconn->transport.uring != NULL ||
+	    xconn->transport.io_thread != NULL ||
+	    xconn->transport.type == SMB_TRANSPORT_TYPE_QUIC)
+	{
+		return false;
+	}
+
+	/*
+	 * Only one response in a compound chain can be spliced.
+	 */
+	if (req->queue_entry.splice != NULL) {
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * The data of the READ response, the dyn iovec with iov_base == NULL
+ * and iov_len == length, is spliced from fd to the socket by
+ * smbd_smb2_flush_send_queue(). fd comes from SMB_VFS_SPLICE_READ_FD()
+ * and is ours: it's closed with the response or right away on
+ * failure. As it's our own fd, this also works if a later request in
+ * the compound closes the file.
+ */
+NTSTATUS smbd_smb2_request_splice_read(struct smbd_smb2_request *req,
+				       int fd,
+				       off_t offset,
+				       size_t length)
+{
+#ifdef HAVE_LINUX_SPLICE
+	struct smbd_smb2_splice *s = NULL;
+
+	if (!smbd_smb2_request_can_splice(req)) {
+		close(fd);
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	s = talloc(req, struct smbd_smb2_splice);
+	if (s == NULL) {
+		close(fd);
+		return NT_STATUS_NO_MEMORY;
+	}
+	*s = (struct smbd_smb2_splice) {
+		.fd = fd,
+		.offset = offset,
+		.length = length,
+	};
+	talloc_set_destructor(s, smbd_smb2_splice_destructor);
+
+	req->queue_entry.splice = s;
+	return NT_STATUS_OK;
+#else
+	close(fd);
+	return NT_STATUS_NOT_SUPPORTED;
+#endif
+}
+
+/*
+ * Read the data of a spliced response into memory,
+ * in case it needs to be encrypted after all.
+ */
+static NTSTATUS smbd_smb2_request_unsplice(struct smbd_smb2_request *req)
+{
+	struct smbd_smb2_splice *s = req->queue_entry.splice;
+	int i;
+
+	if (s == NULL) {
+		return NT_STATUS_OK;
+	}
+
+	for (i = 0; i < req->out.vector_count; i++) {
+		struct iovec *v = &req->out.vector[i];
+		uint8_t *buf = NULL;
+		ssize_t nread;
+
+		if (v->iov_base != NULL || v->iov_len == 0) {
+			continue;
+		}
+
+		/*
+		 * A short read leaves zeros,
+		 * like sendfile_short_send().
+		 */
+		buf = talloc_zero_array(req, uint8_t, v->iov_len);
+		if (buf == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		nread = sys_pread_full(s->fd, buf, v->iov_len, s->offset);
+		if (nread == -1) {
+			return map_nt_error_from_unix_common(errno);
+		}
+		v->iov_base = (void *)buf;
+		break;
+	}
+
+	TALLOC_FREE(req->queue_entry.splice);
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_zerocopy_setup(struct smbXsrv_connection *xconn)
+{
+#ifdef HAVE_SMBD_MSG_ZEROCOPY
+	int threshold = lp_smbd_zerocopy_send_threshold();
+	int one = 1;
+	int ret;
+
+	if (threshold <= 0) {
+		return;
+	}
+
+	/*
+	 * The io_uring transport doesn't use sendmsg()
+	 */
+	if (xconn->transport.uring != NULL ||
+	    xconn->transport.type == SMB_TRANSPORT_TYPE_QUIC)
+	{
+		return;
+	}
+
+	ret = setsockopt(xconn->transport.sock,
+			 SOL_SOCKET,
+			 SO_ZEROCOPY,
+			 &one,
+			 sizeof(one));
+	if (ret == -1) {
+		DBG_INFO("SO_ZEROCOPY not available: %s\n", strerror(errno));
+		return;
+	}
+
+	xconn->smb2.zerocopy.enabled = true;
+	xconn->smb2.zerocopy.threshold = threshold;
+	/*
+	 * No id is completed yet, the first one is 0.
+	 */
+	xconn->smb2.zerocopy.completed_id = UINT32_MAX;
+#endif
+}
+
+static void smbd_smb2_credits_adaptive_setup(struct smbXsrv_connection *xconn)
+{
+	int target = lp_smb2_credits_target_latency();
+	uint16_t max = xconn->smb2.credits.max;
+
+	if (target <= 0) {
+		return;
+	}
+
+	xconn->smb2.credits.adaptive.target_usec = target;
+	/*
+	 * Never go below what a single client needs for
+	 * a few large reads and writes in parallel.
+	 */
+	xconn->smb2.credits.adaptive.min_window = MIN(MAX(max / 64, 32), max);
+	/*
+	 * Like Windows Server < 2016 we start with 1/16th
+	 * of the max and grow from there.
+	 */
+	xconn->smb2.credits.adaptive.conn = (struct smbd_smb2_credit_ctrl) {
+		.window = MAX(max / 16, xconn->smb2.credits.adaptive.min_window),
+	};
+}
+
 static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 				     uint64_t expected_seq_low)
 {
@@ -309,6 +515,8 @@ static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 		return NT_STATUS_NO_MEMORY;
 	}
 
+	smbd_smb2_credits_adaptive_setup(xconn);
+
 	tevent_fd_set_close_fn(xconn->transport.fde, NULL);
 	TALLOC_FREE(xconn->transport.fde);
 
@@ -326,6 +534,41 @@ static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 	}
 	tevent_fd_set_auto_close(xconn->transport.fde);
 
+#ifdef WITH_SMB2_URING
+	if (lp_smbd_io_uring_transport()) {
+		NTSTATUS status;
+
+		status = smbd_smb2_uring_setup(xconn);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_WARNING("io_uring transport not available, "
+				    "falling back to sendmsg/recvmsg: %s\n",
+				    nt_errstr(status));
+		}
+	}
+#endif
+
+#ifdef MSG_DONTWAIT
+	/*
+	 * The io threads rely on the socket being in
+	 * blocking mode, see below.
+	 */
+	if (lp_smb2_channel_io_threads() &&
+	    xconn->transport.uring == NULL &&
+	    xconn->transport.type != SMB_TRANSPORT_TYPE_QUIC)
+	{
+		NTSTATUS status;
+
+		status = smbd_smb2_io_thread_create(xconn,
+						    xconn->transport.sock,
+						    &xconn->transport.io_thread);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_WARNING("channel io threads not available, "
+				    "falling back to sendmsg/recvmsg: %s\n",
+				    nt_errstr(status));
+		}
+	}
+#endif
+
 	/*
 	 * Ensure child is set to non-blocking mode,
 	 * unless the system supports MSG_DONTWAIT,
@@ -344,6 +587,8 @@ static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 	}
 #endif
 
+	smbd_smb2_zerocopy_setup(xconn);
+
 	return NT_STATUS_OK;
 }
 
@@ -376,6 +621,14 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->crypto.busy) {
+		/*
+		 * A worker thread still uses our buffers,
+		 * smbd_smb2_request_crypto_done() frees us.
+		 */
+		req->crypto.orphaned = true;
+		return -1;
+	}
 	TALLOC_FREE(req->first_enc_key);
 	TALLOC_FREE(req->last_sign_key);
 	return 0;
@@ -546,17 +799,74 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key,
-							  tf_iov, 2);
-			if (!NT_STATUS_IS_OK(status)) {
-				TALLOC_FREE(iov_alloc);
-				return status;
+			if (req->crypto.decrypted) {
+				/*
+				 * smbd_smb2_request_decrypt_offload()
+				 * already did it on the pthreadpool.
+				 */
+				req->crypto.decrypted = false;
+			} else {
+				status = smb2_signing_decrypt_pdu(
+						s->global->decryption_key,
+						tf_iov, 2);
+				if (!NT_STATUS_IS_OK(status)) {
+					TALLOC_FREE(iov_alloc);
+					return status;
+				}
 			}
 
 			verified_buflen = taken + enc_len;
 			len = enc_len;
 		}
 
+		if (len >= 4 && IVAL(hdr, 0) == SMB2_CTF_MAGIC) {
+			DATA_BLOB plain = data_blob_null;
+			NTSTATUS status;
+
+			if (xconn->smb2.server.compression.num_algos == 0) {
+				DBG_INFO("Got SMB2_COMPRESSION_TRANSFORM "
+					 "header, but not negotiated\n");
+				goto inval;
+			}
+
+			/*
+			 * The compressed message needs to be the
+			 * whole (decrypted) buffer, it may contain
+			 * a compound chain itself.
+			 */
+			if (num_iov != 1) {
+				goto inval;
+			}
+			if (tf != NULL && verified_buflen != buflen) {
+				goto inval;
+			}
+
+			status = smb2_compression_decompress(
+				mem_ctx,
+				&xconn->smb2.server.compression,
+				hdr,
+				len,
+				0x00FFFFFF, /* max NBT length */
+				&plain);
+			if (!NT_STATUS_IS_OK(status)) {
+				DBG_INFO("Decompression failed: %s\n",
+					 nt_errstr(status));
+				TALLOC_FREE(iov_alloc);
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+
+			first_hdr = plain.data;
+			buflen = plain.length;
+			taken = 0;
+			if (tf != NULL) {
+				verified_buflen = buflen;
+			} else {
+				verified_buflen = 0;
+			}
+			hdr = first_hdr;
+			len = buflen;
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -926,7 +1236,203 @@ static NTSTATUS smbd_smb2_request_validate(struct smbd_smb2_request *req)
 	return NT_STATUS_OK;
 }
 
+static struct smbd_smb2_credit_ctrl *smbd_smb2_credit_ctrl(
+	struct smbXsrv_connection *xconn,
+	int snum)
+{
+	struct smbd_smb2_credit_ctrl *shares = xconn->smb2.credits.adaptive.shares;
+	size_t num_shares = talloc_array_length(shares);
+
+	if (xconn->smb2.credits.adaptive.target_usec == 0) {
+		return NULL;
+	}
+
+	if (snum == GLOBAL_SECTION_SNUM) {
+		return &xconn->smb2.credits.adaptive.conn;
+	}
+
+	if ((size_t)snum >= num_shares) {
+		size_t i;
+
+		shares = talloc_realloc(xconn,
+					shares,
+					struct smbd_smb2_credit_ctrl,
+					snum + 1);
+		if (shares == NULL) {
+			return &xconn->smb2.credits.adaptive.conn;
+		}
+		for (i = num_shares; i < (size_t)snum + 1; i++) {
+			/*
+			 * A new share starts where the
+			 * connection currently is.
+			 */
+			shares[i] = (struct smbd_smb2_credit_ctrl) {
+				.window = xconn->smb2.credits.adaptive.conn.window,
+			};
+		}
+		xconn->smb2.credits.adaptive.shares = shares;
+	}
+
+	return &shares[snum];
+}
+
+static int smbd_smb2_request_credit_snum(const struct smbd_smb2_request *req)
+{
+	if (req->tcon == NULL || req->tcon->compat == NULL) {
+		return GLOBAL_SECTION_SNUM;
+	}
+	return SNUM(req->tcon->compat);
+}
+
+/*
+ * Adjust the credit window from the latency of a completed
+ * request, a delay based congestion control loop: The window
+ * shrinks by 1/4 if the smoothed latency is above the target
+ * and grows if it is below, but only if the client actually
+ * uses the window. Far below the target it grows quickly,
+ * close to it only slowly.
+ */
+static void smbd_smb2_credit_ctrl_sample(struct smbXsrv_connection *xconn,
+					 struct smbd_smb2_credit_ctrl *c,
+					 int snum,
+					 uint64_t usec)
+{
+	uint64_t target = xconn->smb2.credits.adaptive.target_usec;
+	uint16_t min_window = xconn->smb2.credits.adaptive.min_window;
+	uint16_t max = xconn->smb2.credits.max;
+	uint16_t window = c->window;
+
+	if (c->latency_usec == 0) {
+		c->latency_usec = usec;
+	} else {
+		c->latency_usec = (7 * c->latency_usec + usec) / 8;
+	}
+
+	/*
+	 * Decide about once per 1/8th of the window,
+	 * so the latency reflects the current window.
+	 */
+	c->samples += 1;
+	if (c->samples < (uint32_t)MAX(c->window / 8, 8)) {
+		return;
+	}
+	c->samples = 0;
+
+	if (c->latency_usec > target) {
+		window = MAX(window - window / 4, min_window);
+	} else if (xconn->smb2.credits.seq_range >= c->window / 2) {
+		uint16_t inc;
+
+		if (c->latency_usec < target / 2) {
+			inc = MAX(window / 4, 1);
+		} else {
+			inc = MAX(window / 16, 1);
+		}
+		window = MIN((uint32_t)window + inc, max);
+	}
+
+	if (window == c->window) {
+		return;
+	}
+
+	DBGC_DEBUG(DBGC_SMB2_CREDITS,
+		   "snum %d: latency %" PRIu64 "/%" PRIu64 " usec, "
+		   "window %u => %u\n",
+		   snum,
+		   c->latency_usec,
+		   target,
+		   (unsigned int)c->window,
+		   (unsigned int)window);
+
+	if (window > c->window) {
+		SMBPROFILE_COUNT_INCREMENT_X(snum, smb2_credits_window_grow, 1);
+	} else {
+		SMBPROFILE_COUNT_INCREMENT_X(snum, smb2_credits_window_shrink, 1);
+	}
+	c->window = window;
+	if (snum != GLOBAL_SECTION_SNUM) {
+		SMBPROFILE_COUNT_SET_PERSVC(snum, smb2_credits_window, window);
+	}
+}
+
+static void smbd_smb2_request_credit_sample(struct smbd_smb2_request *req,
+					    uint16_t opcode)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_credit_ctrl *c = NULL;
+	struct timespec now;
+	int64_t nsec;
+	int snum;
+
+	if (xconn->smb2.credits.adaptive.target_usec == 0) {
+		return;
+	}
+
+	switch (opcode) {
+	case SMB2_OP_CREATE:
+	case SMB2_OP_CLOSE:
+	case SMB2_OP_FLUSH:
+	case SMB2_OP_READ:
+	case SMB2_OP_WRITE:
+	case SMB2_OP_QUERY_DIRECTORY:
+	case SMB2_OP_GETINFO:
+	case SMB2_OP_SETINFO:
+		break;
+	default:
+		/*
+		 * Authentication, locks, notifies and
+		 * ioctls wait for other things than
+		 * the file system.
+		 */
+		return;
+	}
+
+	if (req->dispatch_time.tv_sec == 0 && req->dispatch_time.tv_nsec == 0) {
+		/* failed before smbd_smb2_request_dispatch() */
+		return;
+	}
+
+	clock_gettime_mono(&now);
+	nsec = nsec_time_diff(&now, &req->dispatch_time);
+	req->dispatch_time = (struct timespec) { .tv_sec = 0, };
+	if (nsec < 0) {
+		return;
+	}
+
+	snum = smbd_smb2_request_credit_snum(req);
+	if (snum != GLOBAL_SECTION_SNUM) {
+		c = smbd_smb2_credit_ctrl(xconn, snum);
+		smbd_smb2_credit_ctrl_sample(xconn, c, snum, nsec / 1000);
+	}
+	c = smbd_smb2_credit_ctrl(xconn, GLOBAL_SECTION_SNUM);
+	smbd_smb2_credit_ctrl_sample(xconn, c, GLOBAL_SECTION_SNUM, nsec / 1000);
+}
+
+uint64_t smbd_smb2_credits_window(struct smbd_server_connection *sconn)
+{
+	struct smbXsrv_connection *xconn = NULL;
+	uint64_t window = 0;
+
+	if (sconn->client == NULL) {
+		return 0;
+	}
+
+	for (xconn = sconn->client->connections;
+	     xconn != NULL;
+	     xconn = xconn->next)
+	{
+		if (xconn->smb2.credits.adaptive.target_usec != 0) {
+			window += xconn->smb2.credits.adaptive.conn.window;
+		} else {
+			window += xconn->smb2.credits.max;
+		}
+	}
+
+	return window;
+}
+
 static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
+				      struct smbd_smb2_credit_ctrl *ctrl,
 				      const struct iovec *in_vector,
 				      struct iovec *out_vector)
 {
@@ -959,6 +1465,9 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 	 * but new servers use all credits (8192 by default).
 	 */
 	current_max_credits = xconn->smb2.credits.max;
+	if (ctrl != NULL) {
+		current_max_credits = MIN(current_max_credits, ctrl->window);
+	}
 	current_max_credits = MAX(current_max_credits, 1);
 
 	if (xconn->smb2.credits.multicredit) {
@@ -1046,13 +1555,36 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 		credits_possible -= 1;
 	}
 	credits_possible = MIN(credits_possible, current_max_credits);
-	credits_possible -= xconn->smb2.credits.seq_range;
+	if (credits_possible > xconn->smb2.credits.seq_range) {
+		credits_possible -= xconn->smb2.credits.seq_range;
+	} else {
+		/*
+		 * The adaptive window shrank below
+		 * what the client already has.
+		 */
+		credits_possible = 0;
+	}
+
+	if (credits_possible == 0 &&
+	    ctrl != NULL &&
+	    xconn->smb2.credits.granted == 0 &&
+	    xconn->smb2.credits.seq_range < xconn->smb2.credits.max &&
+	    xconn->smb2.credits.seq_low + xconn->smb2.credits.seq_range <
+	    UINT64_MAX - 1)
+	{
+		/*
+		 * The client needs at least one credit
+		 * to send its next request.
+		 */
+		credits_possible = 1;
+	}
 
 	credits_granted = MIN(credits_granted, credits_possible);
 
 	SSVAL(outhdr, SMB2_HDR_CREDIT, credits_granted);
 	xconn->smb2.credits.granted += credits_granted;
 	xconn->smb2.credits.seq_range += credits_granted;
+	SMBPROFILE_COUNT_INCREMENT(smb2_credits_granted, profile_p, credits_granted);
 
 	DBGC_DEBUG(DBGC_SMB2_CREDITS,
 		"smb2_set_operation_credit: requested %u, charge %u, "
@@ -1072,9 +1604,13 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 static void smb2_calculate_credits(const struct smbd_smb2_request *inreq,
 				struct smbd_smb2_request *outreq)
 {
+	struct smbd_smb2_credit_ctrl *ctrl = NULL;
 	int count, idx;
 	uint16_t total_credits = 0;
 
+	ctrl = smbd_smb2_credit_ctrl(outreq->xconn,
+				     smbd_smb2_request_credit_snum(inreq));
+
 	count = outreq->out.vector_count;
 
 	for (idx=1; idx < count; idx += SMBD_SMB2_NUM_IOV_PER_REQ) {
@@ -1082,7 +1618,7 @@ static void smb2_calculate_credits(const struct smbd_smb2_request *inreq,
 		struct iovec *outhdr_v = SMBD_SMB2_IDX_HDR_IOV(outreq,out,idx);
 		uint8_t *outhdr = (uint8_t *)outhdr_v->iov_base;
 
-		smb2_set_operation_credit(outreq->xconn, inhdr_v, outhdr_v);
+		smb2_set_operation_credit(outreq->xconn, ctrl, inhdr_v, outhdr_v);
 
 		/* To match Windows, count up what we
 		   just granted. */
@@ -1568,13 +2104,35 @@ void smbXsrv_connection_disconnect_transport(struct smbXsrv_connection *xconn,
 	}
 
 	xconn->transport.status = status;
-	TALLOC_FREE(xconn->transport.fde);
+#ifdef WITH_SMB2_URING
+	if (xconn->transport.uring != NULL) {
+		/*
+		 * This terminates pending operations before
+		 * the send queue entries are freed below.
+		 */
+		smbd_smb2_uring_shutdown(xconn->transport.uring);
+	}
+#endif
+	if (xconn->transport.io_thread != NULL) {
+		/*
+		 * Wake up blocked jobs, smbXsrv_connection_shutdown_send()
+		 * waits for them before the buffers they use go away.
+		 */
+		smbd_smb2_io_thread_shutdown(xconn->transport.io_thread);
+	}
+	TALLOC_FREE(xconn->transport.fde);
 	if (xconn->transport.sock != -1) {
 		xconn->transport.sock = -1;
 	}
 	smbd_smb2_send_queue_ack_fail(&xconn->ack.queue, status);
 	smbd_smb2_send_queue_ack_fail(&xconn->smb2.send_queue, status);
 	xconn->smb2.send_queue_len = 0;
+	while (xconn->smb2.zerocopy.queue != NULL) {
+		struct smbd_smb2_send_queue *e = xconn->smb2.zerocopy.queue;
+
+		DLIST_REMOVE(xconn->smb2.zerocopy.queue, e);
+		talloc_free(e->mem_ctx);
+	}
 	DO_PROFILE_INC(disconnect);
 }
 
@@ -1658,6 +2216,27 @@ static struct tevent_req *smbXsrv_connection_shutdown_send(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (xconn->smb2.io_thread.send_req != NULL) {
+		/*
+		 * The io thread may still read from the
+		 * buffers of already finished requests.
+		 */
+		subreq = tevent_queue_wait_send(xconn->smb2.io_thread.send_req,
+					ev,
+					xconn->transport.shutdown_wait_queue);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+	if (xconn->smb2.io_thread.recv_req != NULL) {
+		subreq = tevent_queue_wait_send(xconn->smb2.io_thread.recv_req,
+					ev,
+					xconn->transport.shutdown_wait_queue);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
 	/*
 	 * This may attach sessions with num_channels == 0
 	 * to xconn->transport.shutdown_wait_queue.
@@ -2000,7 +2579,7 @@ static struct smbd_smb2_request *dup_smb2_req(const struct smbd_smb2_request *re
 	return newreq;
 }
 
-static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request *req)
+static NTSTATUS smb2_send_async_interim_response(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
 	int first_idx = 1;
@@ -2022,6 +2601,9 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	   ones we'll be using for the async reply. */
 	nreq->out.vector_count -= SMBD_SMB2_NUM_IOV_PER_REQ;
 
+	/* A spliced READ response is part of the interim reply */
+	nreq->queue_entry.splice = talloc_move(nreq, &req->queue_entry.splice);
+
 	ok = smb2_setup_nbt_length(nreq->out.vector,
 				   nreq->out.vector_count);
 	if (!ok) {
@@ -2052,6 +2634,10 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	 * we need to sign/encrypt here with the last/first key we remembered
 	 */
 	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+		status = smbd_smb2_request_unsplice(nreq);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
 		status = smb2_signing_encrypt_pdu(req->first_enc_key,
 					firsttf,
 					nreq->out.vector_count - first_idx);
@@ -3460,6 +4046,8 @@ skipped_signing:
 #define _INBYTES(_r) \
 	iov_buflen(SMBD_SMB2_IN_HDR_IOV(_r), SMBD_SMB2_NUM_IOV_PER_REQ-1)
 
+	clock_gettime_mono(&req->dispatch_time);
+
 	switch (opcode) {
 	case SMB2_OP_NEGPROT:
 		SMBPROFILE_IOBYTES_ASYNC_START_X(smb2_request_to_snum(req),
@@ -3699,6 +4287,311 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+enum smbd_smb2_crypto_op {
+	SMBD_SMB2_CRYPTO_SIGN,
+	SMBD_SMB2_CRYPTO_ENCRYPT,
+	SMBD_SMB2_CRYPTO_DECRYPT,
+};
+
+struct smbd_smb2_crypto_state {
+	enum smbd_smb2_crypto_op op;
+	struct smb2_signing_key *key;
+	struct iovec *vector;
+	int count;
+	NTSTATUS status;
+};
+
+static void smbd_smb2_crypto_do(void *private_data);
+static void smbd_smb2_crypto_done(struct tevent_req *subreq);
+
+/*
+ * Signs, encrypts or decrypts vector on the pthreadpool.
+ *
+ * The caller needs to make sure the buffers vector points
+ * to are not touched (or freed) until the request is done.
+ * The key is copied, so the job has its own cipher handle.
+ */
+static struct tevent_req *smbd_smb2_crypto_send(TALLOC_CTX *mem_ctx,
+						struct tevent_context *ev,
+						struct pthreadpool_tevent *pool,
+						enum smbd_smb2_crypto_op op,
+						const struct smb2_signing_key *key,
+						const struct iovec *vector,
+						int count)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smbd_smb2_crypto_state *state = NULL;
+	NTSTATUS status;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_crypto_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->op = op;
+	state->count = count;
+
+	status = smb2_signing_key_copy(state, key, &state->key);
+	if (tevent_req_nterror(req, status)) {
+		return tevent_req_post(req, ev);
+	}
+
+	state->vector = talloc_memdup(state, vector,
+				      sizeof(struct iovec) * count);
+	if (tevent_req_nomem(state->vector, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	subreq = pthreadpool_tevent_job_send(state, ev, pool,
+					     smbd_smb2_crypto_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_crypto_done, req);
+
+	return req;
+}
+
+static void smbd_smb2_crypto_do(void *private_data)
+{
+	struct smbd_smb2_crypto_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypto_state);
+
+	switch (state->op) {
+	case SMBD_SMB2_CRYPTO_SIGN:
+		state->status = smb2_signing_sign_pdu(state->key,
+						      state->vector,
+						      state->count);
+		break;
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		state->status = smb2_signing_encrypt_pdu(state->key,
+							 state->vector,
+							 state->count);
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		state->status = smb2_signing_decrypt_pdu(state->key,
+							 state->vector,
+							 state->count);
+		break;
+	}
+}
+
+static void smbd_smb2_crypto_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smbd_smb2_crypto_state *state = tevent_req_data(
+		req, struct smbd_smb2_crypto_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			tevent_req_nterror(req, map_nt_error_from_unix(ret));
+			return;
+		}
+		/*
+		 * The pthreadpool failed to create a new
+		 * thread, do it ourselves.
+		 */
+		smbd_smb2_crypto_do(state);
+	}
+
+	if (tevent_req_nterror(req, state->status)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static NTSTATUS smbd_smb2_crypto_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
+/*
+ * Is the message large enough to be worth a trip
+ * to the pthreadpool?
+ */
+static bool smbd_smb2_crypto_offload(size_t len)
+{
+	int threshold = lp_smb3_crypto_offload_threshold();
+
+	if (threshold <= 0 || len < (size_t)threshold) {
+		return false;
+	}
+
+	/*
+	 * The signing and encryption functions log
+	 * at this level and debug.c is not thread safe.
+	 */
+	if (CHECK_DEBUGLVLC(DBGC_ALL, DBGLVL_INFO)) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * With "smb2 channel io threads" every channel does its
+ * crypto on its own threads, otherwise they share the
+ * pool of the process.
+ */
+static struct pthreadpool_tevent *smbd_smb2_crypto_pool(
+	struct smbXsrv_connection *xconn)
+{
+	if (xconn->transport.io_thread != NULL) {
+		return smbd_smb2_io_thread_pool(xconn->transport.io_thread);
+	}
+	return xconn->client->sconn->pool;
+}
+
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status;
+
+	status = smbd_smb2_crypto_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	req->crypto.busy = false;
+	req->queue_entry.busy = false;
+	if (req->crypto.orphaned) {
+		/*
+		 * The connection is gone,
+		 * see smbd_smb2_request_destructor().
+		 */
+		talloc_free(req);
+		return;
+	}
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+/*
+ * Sign or encrypt the response on the pthreadpool if it's large
+ * enough. The response is queued as busy, smbd_smb2_flush_send_queue()
+ * doesn't send it or anything behind it until the job is done,
+ * so responses stay in order.
+ */
+static bool smbd_smb2_request_crypto_offload(struct smbd_smb2_request *req,
+					     enum smbd_smb2_crypto_op op,
+					     const struct smb2_signing_key *key,
+					     const struct iovec *vector,
+					     int count,
+					     NTSTATUS *_status)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct tevent_req *subreq = NULL;
+	ssize_t len;
+	int i;
+
+	*_status = NT_STATUS_OK;
+
+	if (req->preauth != NULL) {
+		return false;
+	}
+
+	len = iov_buflen(req->out.vector, req->out.vector_count);
+	if (len == -1 || !smbd_smb2_crypto_offload(len)) {
+		return false;
+	}
+
+	for (i = 0; i < req->out.vector_count; i++) {
+		if (req->out.vector[i].iov_base == NULL &&
+		    req->out.vector[i].iov_len != 0) {
+			/* sendfile */
+			return false;
+		}
+	}
+
+	subreq = smbd_smb2_crypto_send(req,
+				       xconn->client->raw_ev_ctx,
+				       smbd_smb2_crypto_pool(xconn),
+				       op,
+				       key,
+				       vector,
+				       count);
+	if (subreq == NULL) {
+		*_status = NT_STATUS_NO_MEMORY;
+		return true;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_crypto_done, req);
+
+	req->crypto.busy = true;
+	req->queue_entry.busy = true;
+	return true;
+}
+
+/*
+ * Replace the (already signed) response with an
+ * SMB2_COMPRESSION_TRANSFORM message, the SMB2 header
+ * and the fixed size body are sent uncompressed.
+ */
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct iovec *outhdr = SMBD_SMB2_OUT_HDR_IOV(req);
+	struct iovec *outbody = SMBD_SMB2_OUT_BODY_IOV(req);
+	struct iovec *outdyn = SMBD_SMB2_OUT_DYN_IOV(req);
+	DATA_BLOB blob = data_blob_null;
+	NTSTATUS status;
+
+	if (req->out.vector_count != 1 + SMBD_SMB2_NUM_IOV_PER_REQ) {
+		return NT_STATUS_OK;
+	}
+	if (!NT_STATUS_IS_OK(NT_STATUS(IVAL(outhdr->iov_base,
+					    SMB2_HDR_STATUS)))) {
+		return NT_STATUS_OK;
+	}
+	if (outdyn->iov_base == NULL) {
+		/* sendfile */
+		return NT_STATUS_OK;
+	}
+
+	if (xconn->smb2.compression_mem == NULL) {
+		xconn->smb2.compression_mem =
+			smb2_compression_mem_create(xconn);
+		if (xconn->smb2.compression_mem == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	status = smb2_compression_compress(req,
+					   xconn->smb2.compression_mem,
+					   &xconn->smb2.server.compression,
+					   outhdr,
+					   SMBD_SMB2_NUM_IOV_PER_REQ - 1,
+					   outhdr->iov_len + outbody->iov_len,
+					   &blob);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	if (blob.length == 0) {
+		/* Not worth it, send it as is */
+		return NT_STATUS_OK;
+	}
+
+	outhdr->iov_base = (void *)blob.data;
+	outhdr->iov_len = blob.length;
+	outbody->iov_len = 0;
+	outdyn->iov_len = 0;
+
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -3796,6 +4689,9 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		PULL_LE_U16(outhdr->iov_base, SMB2_HDR_OPCODE),
 		NT_STATUS(IVAL(outhdr->iov_base, SMB2_HDR_STATUS)));
 
+	smbd_smb2_request_credit_sample(
+		req, PULL_LE_U16(outhdr->iov_base, SMB2_HDR_OPCODE));
+
 	req->current_idx += SMBD_SMB2_NUM_IOV_PER_REQ;
 
 	if (req->current_idx < req->out.vector_count) {
@@ -3847,33 +4743,81 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		req->compound_related = false;
 	}
 
-	ok = smb2_setup_nbt_length(req->out.vector, req->out.vector_count);
-	if (!ok) {
-		return NT_STATUS_INVALID_PARAMETER_MIX;
-	}
-
 	/* Set credit for these operations (zero credits if this
 	   is a final reply for an async operation). */
 	smb2_calculate_credits(req, req);
 
-	/*
-	 * now check if we need to sign the current response
-	 */
-	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_enc_key,
-					firsttf,
-					req->out.vector_count - first_idx);
+	if (req->queue_entry.splice != NULL &&
+	    (firsttf->iov_len != 0 || req->do_signing || req->do_compression))
+	{
+		/*
+		 * A later response of the compound turned on
+		 * signing or encryption, we need the file data
+		 * in memory after all.
+		 */
+		status = smbd_smb2_request_unsplice(req);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
-	} else if (req->do_signing) {
+	}
+
+	/*
+	 * now check if we need to sign the current response,
+	 * this is done before the compression as the signature
+	 * covers the uncompressed message.
+	 */
+	if (firsttf->iov_len == 0 && req->do_signing) {
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *signing_key =
 			smbd_smb2_signing_key(x, xconn, NULL);
+		bool offloaded = false;
+
+		if (!req->do_compression) {
+			offloaded = smbd_smb2_request_crypto_offload(
+					req,
+					SMBD_SMB2_CRYPTO_SIGN,
+					signing_key,
+					outhdr,
+					SMBD_SMB2_NUM_IOV_PER_REQ - 1,
+					&status);
+		}
+		if (!offloaded) {
+			status = smb2_signing_sign_pdu(signing_key,
+						       outhdr,
+						       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
 
-		status = smb2_signing_sign_pdu(signing_key,
-					       outhdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+	if (req->do_compression) {
+		status = smbd_smb2_request_compress(req);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	ok = smb2_setup_nbt_length(req->out.vector, req->out.vector_count);
+	if (!ok) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+		bool offloaded;
+
+		offloaded = smbd_smb2_request_crypto_offload(
+				req,
+				SMBD_SMB2_CRYPTO_ENCRYPT,
+				req->first_enc_key,
+				firsttf,
+				req->out.vector_count - first_idx,
+				&status);
+		if (!offloaded) {
+			status = smb2_signing_encrypt_pdu(req->first_enc_key,
+						firsttf,
+						req->out.vector_count - first_idx);
+		}
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -3931,6 +4875,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 
 	/* I am a sick, sick man... :-). Sendfile hack ... JRA. */
 	if (req->out.vector_count < (2*SMBD_SMB2_NUM_IOV_PER_REQ) &&
+	    req->queue_entry.splice == NULL &&
 	    outdyn->iov_base == NULL && outdyn->iov_len != 0) {
 		/* Dynamic part is NULL. Chop it off,
 		   We're going to send it via sendfile. */
@@ -4684,6 +5629,19 @@ static bool is_smb2_recvfile_write(struct smbd_smb2_request_read_state *state)
 	return true;
 }
 
+static size_t smbd_smb2_min_recv_size(struct smbXsrv_connection *xconn)
+{
+	if (xconn->transport.uring != NULL) {
+		/*
+		 * The data is already taken off the socket by the
+		 * io_uring recv, so we can't do recvfile.
+		 */
+		return 0;
+	}
+
+	return lp_min_receive_file_size();
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn)
 {
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
@@ -4706,6 +5664,14 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.decrypt_req != NULL) {
+		/*
+		 * smbd_smb2_request_decrypt_done()
+		 * calls us again.
+		 */
+		return NT_STATUS_OK;
+	}
+
 	max_send_queue_len = MAX(1, xconn->smb2.credits.max/16);
 	cur_send_queue_len = xconn->smb2.send_queue_len;
 
@@ -4725,7 +5691,7 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 	}
 	*state = (struct smbd_smb2_request_read_state) {
 		.req = req,
-		.min_recv_size = lp_min_receive_file_size(),
+		.min_recv_size = smbd_smb2_min_recv_size(xconn),
 		._vector = {
 			[0] = (struct iovec) {
 				.iov_base = (void *)state->hdr.nbt,
@@ -4736,6 +5702,13 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		.count = 1,
 	};
 
+#ifdef WITH_SMB2_URING
+	if (xconn->transport.uring != NULL) {
+		smbd_smb2_uring_recv_resume(xconn->transport.uring);
+		return NT_STATUS_OK;
+	}
+#endif
+
 	TEVENT_FD_READABLE(xconn->transport.fde);
 
 	return NT_STATUS_OK;
@@ -4868,16 +5841,122 @@ static int socket_error_from_errno(int ret,
 	return sys_errno;
 }
 
-static NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
-					     struct smbd_smb2_send_queue **_e,
-					     size_t n)
+static bool smbd_smb2_zerocopy_completed(struct smbXsrv_connection *xconn,
+					 uint32_t id)
 {
-	struct smbd_smb2_send_queue *e = *_e;
-	bool ok;
+	return (int32_t)(id - xconn->smb2.zerocopy.completed_id) <= 0;
+}
 
-	xconn->ack.unacked_bytes += n;
+#ifdef HAVE_SMBD_MSG_ZEROCOPY
+/*
+ * Process the MSG_ZEROCOPY completions from the socket error queue
+ * and free the queue entries whose buffers are no longer used by
+ * the kernel.
+ */
+static NTSTATUS smbd_smb2_zerocopy_reap(struct smbXsrv_connection *xconn,
+					bool *_reaped)
+{
+	struct smbd_smb2_send_queue *e = NULL;
+	bool reaped = false;
 
-	ok = iov_advance(&e->vector, &e->count, n);
+	*_reaped = false;
+
+	if (!xconn->smb2.zerocopy.used) {
+		return NT_STATUS_OK;
+	}
+
+	while (true) {
+		union {
+			struct cmsghdr cm;
+			uint8_t buf[CMSG_SPACE(sizeof(struct sock_extended_err))
+				    + 64];
+		} control;
+		struct msghdr msg = {
+			.msg_control = &control,
+			.msg_controllen = sizeof(control),
+		};
+		struct cmsghdr *cm = NULL;
+		ssize_t ret;
+
+		ret = recvmsg(xconn->transport.sock,
+			      &msg,
+			      MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return map_nt_error_from_unix_common(errno);
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg);
+		     cm != NULL;
+		     cm = CMSG_NXTHDR(&msg, cm))
+		{
+			struct sock_extended_err serr;
+
+			if (!(cm->cmsg_level == SOL_IP &&
+			      cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			      cm->cmsg_type == IPV6_RECVERR))
+			{
+				continue;
+			}
+
+			memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+			if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr.ee_errno != 0)
+			{
+				continue;
+			}
+
+			if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				/*
+				 * The kernel had to copy the data anyway,
+				 * e.g. on loopback, so we only pay for
+				 * the completions.
+				 */
+				if (xconn->smb2.zerocopy.enabled) {
+					DBG_INFO("MSG_ZEROCOPY data was copied, "
+						 "disabling it\n");
+				}
+				xconn->smb2.zerocopy.enabled = false;
+			}
+
+			/*
+			 * TCP completes the ids in order, ee_data
+			 * is the last one of the range.
+			 */
+			xconn->smb2.zerocopy.completed_id = serr.ee_data;
+			reaped = true;
+		}
+	}
+
+	while ((e = xconn->smb2.zerocopy.queue) != NULL) {
+		if (!smbd_smb2_zerocopy_completed(xconn, e->zerocopy.id)) {
+			break;
+		}
+		DLIST_REMOVE(xconn->smb2.zerocopy.queue, e);
+		talloc_free(e->mem_ctx);
+	}
+
+	*_reaped = reaped;
+	return NT_STATUS_OK;
+}
+#endif /* HAVE_SMBD_MSG_ZEROCOPY */
+
+static NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
+					     struct smbd_smb2_send_queue **_e,
+					     size_t n)
+{
+	struct smbd_smb2_send_queue *e = *_e;
+	bool ok;
+
+	xconn->ack.unacked_bytes += n;
+
+	ok = iov_advance(&e->vector, &e->count, n);
 	if (!ok) {
 		return NT_STATUS_INTERNAL_ERROR;
 	}
@@ -4889,6 +5968,18 @@ static NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
 	xconn->smb2.send_queue_len--;
 	DLIST_REMOVE(xconn->smb2.send_queue, e);
 
+	if (e->zerocopy.pending &&
+	    !smbd_smb2_zerocopy_completed(xconn, e->zerocopy.id))
+	{
+		/*
+		 * The kernel still references our buffers,
+		 * smbd_smb2_zerocopy_reap() frees them.
+		 */
+		*_e = NULL;
+		DLIST_ADD_END(xconn->smb2.zerocopy.queue, e);
+		return NT_STATUS_OK;
+	}
+
 	if (e->ack.req == NULL) {
 		*_e = NULL;
 		talloc_free(e->mem_ctx);
@@ -4901,6 +5992,250 @@ static NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Splicing wants the socket non-blocking, while sendfile and
+ * recvfile do blocking I/O on it. Only switch when the mode
+ * has to change, not twice for every spliced response.
+ */
+static int smbd_smb2_set_sock_blocking(struct smbXsrv_connection *xconn,
+				       bool blocking)
+{
+	int ret;
+
+	if (xconn->smb2.sock_nonblocking != blocking) {
+		return 0;
+	}
+
+	ret = set_blocking(xconn->transport.sock, blocking);
+	if (ret == -1) {
+		return -1;
+	}
+	xconn->smb2.sock_nonblocking = !blocking;
+	return 0;
+}
+
+static NTSTATUS smbd_smb2_flush_sendfile(struct smbXsrv_connection *xconn,
+					 struct smbd_smb2_send_queue *e)
+{
+	size_t size = 0;
+	size_t i = 0;
+	uint8_t *buf;
+	NTSTATUS status = NT_STATUS_INTERNAL_ERROR;
+	int ret;
+
+	ret = smbd_smb2_set_sock_blocking(xconn, true);
+	if (ret == -1) {
+		status = map_nt_error_from_unix_common(errno);
+		smbXsrv_connection_disconnect_transport(xconn, status);
+		return status;
+	}
+
+	for (i=0; i < e->count; i++) {
+		size += e->vector[i].iov_len;
+	}
+
+	if (size <= e->sendfile_header->length) {
+		buf = e->sendfile_header->data;
+	} else {
+		buf = talloc_array(e->mem_ctx, uint8_t, size);
+		if (buf == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	size = 0;
+	for (i=0; i < e->count; i++) {
+		memcpy(buf+size,
+		       e->vector[i].iov_base,
+		       e->vector[i].iov_len);
+		size += e->vector[i].iov_len;
+	}
+
+	e->sendfile_header->data = buf;
+	e->sendfile_header->length = size;
+	e->sendfile_status = &status;
+	e->count = 0;
+
+	xconn->smb2.send_queue_len--;
+	DLIST_REMOVE(xconn->smb2.send_queue, e);
+
+	size += e->sendfile_body_size;
+
+	/*
+	 * This triggers the sendfile path via
+	 * the destructor.
+	 */
+	talloc_free(e->mem_ctx);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+	xconn->ack.unacked_bytes += size;
+	return NT_STATUS_OK;
+}
+
+#ifdef HAVE_LINUX_SPLICE
+struct smbd_smb2_splice_pipe {
+	int fds[2];
+	size_t size;
+};
+
+static int smbd_smb2_splice_pipe_destructor(struct smbd_smb2_splice_pipe *p)
+{
+	close(p->fds[0]);
+	close(p->fds[1]);
+	return 0;
+}
+
+static struct smbd_smb2_splice_pipe *smbd_smb2_splice_pipe(
+	struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_splice_pipe *p = xconn->smb2.splice_pipe;
+	int ret;
+
+	if (p != NULL) {
+		return p;
+	}
+
+	p = talloc_zero(xconn, struct smbd_smb2_splice_pipe);
+	if (p == NULL) {
+		return NULL;
+	}
+	ret = pipe2(p->fds, O_CLOEXEC | O_NONBLOCK);
+	if (ret == -1) {
+		TALLOC_FREE(p);
+		return NULL;
+	}
+	talloc_set_destructor(p, smbd_smb2_splice_pipe_destructor);
+
+	/*
+	 * A large pipe means fewer syscalls per READ,
+	 * fall back to the default if we're not allowed.
+	 */
+	ret = -1;
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+	ret = fcntl(p->fds[1], F_SETPIPE_SZ, 1024 * 1024);
+	if (ret == -1) {
+		ret = fcntl(p->fds[1], F_GETPIPE_SZ);
+	}
+#endif
+	p->size = (ret > 0) ? ret : 65536;
+
+	xconn->smb2.splice_pipe = p;
+	return p;
+}
+
+/*
+ * Move the file data of a spliced response from the
+ * page cache to the socket without copying it through
+ * user space. Returns NT_STATUS_RETRY if the socket
+ * is full.
+ */
+static NTSTATUS smbd_smb2_flush_splice_loop(struct smbXsrv_connection *xconn,
+					    struct smbd_smb2_send_queue *e,
+					    struct smbd_smb2_splice_pipe *p)
+{
+	struct smbd_smb2_splice *s = e->splice;
+	int err;
+	bool retry;
+
+	while (s->sent < s->length) {
+		ssize_t ret;
+
+		if (s->in_pipe == 0) {
+			size_t want = MIN(s->length - s->sent, p->size);
+			loff_t ofs = s->offset + s->sent;
+
+			if (s->short_file) {
+				ret = 0;
+			} else {
+				ret = splice(s->fd, &ofs, p->fds[1], NULL,
+					     want, SPLICE_F_MOVE);
+			}
+			if (ret == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return map_nt_error_from_unix_common(errno);
+			}
+			if (ret == 0) {
+				/*
+				 * The file was truncated after we
+				 * checked its size, pad with zeros
+				 * like sendfile_short_send().
+				 */
+				static const uint8_t zeros[1024];
+
+				s->short_file = true;
+				ret = send(xconn->transport.sock,
+					   zeros,
+					   MIN(want, sizeof(zeros)),
+					   MSG_DONTWAIT | MSG_NOSIGNAL);
+				err = socket_error_from_errno(ret, errno, &retry);
+				if (retry) {
+					return NT_STATUS_RETRY;
+				}
+				if (err != 0) {
+					return map_nt_error_from_unix_common(err);
+				}
+				s->sent += ret;
+				continue;
+			}
+			s->in_pipe = ret;
+		}
+
+		ret = splice(p->fds[0], NULL, xconn->transport.sock, NULL,
+			     s->in_pipe,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		if (ret == 0) {
+			return NT_STATUS_CONNECTION_DISCONNECTED;
+		}
+		err = socket_error_from_errno(ret, errno, &retry);
+		if (retry) {
+			return NT_STATUS_RETRY;
+		}
+		if (err != 0) {
+			return map_nt_error_from_unix_common(err);
+		}
+		s->in_pipe -= ret;
+		s->sent += ret;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_flush_splice(struct smbXsrv_connection *xconn,
+				       struct smbd_smb2_send_queue *e)
+{
+	struct smbd_smb2_splice_pipe *p = NULL;
+	NTSTATUS status;
+	int ret;
+
+	p = smbd_smb2_splice_pipe(xconn);
+	if (p == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/*
+	 * Older kernels ignore SPLICE_F_NONBLOCK for the socket
+	 * side, we must not block with data in the pipe. The
+	 * socket stays non-blocking until sendfile or recvfile
+	 * need it blocking again, everything else uses
+	 * MSG_DONTWAIT anyway.
+	 */
+	ret = smbd_smb2_set_sock_blocking(xconn, false);
+	if (ret == -1) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	status = smbd_smb2_flush_splice_loop(xconn, e, p);
+
+	return status;
+}
+#endif /* HAVE_LINUX_SPLICE */
+
 static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 {
 	int ret;
@@ -4916,6 +6251,16 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 	while (xconn->smb2.send_queue != NULL) {
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
 		unsigned sendmsg_flags = 0;
+		ssize_t want;
+
+		if (e->busy && NT_STATUS_IS_OK(xconn->transport.status)) {
+			/*
+			 * smbd_smb2_request_crypto_done()
+			 * calls us again.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			break;
+		}
 
 		if (!NT_STATUS_IS_OK(xconn->transport.status)) {
 			/*
@@ -4930,69 +6275,91 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 		}
 
 		if (e->sendfile_header != NULL) {
-			size_t size = 0;
-			size_t i = 0;
-			uint8_t *buf;
-
-			status = NT_STATUS_INTERNAL_ERROR;
-
-			for (i=0; i < e->count; i++) {
-				size += e->vector[i].iov_len;
-			}
-
-			if (size <= e->sendfile_header->length) {
-				buf = e->sendfile_header->data;
-			} else {
-				buf = talloc_array(e->mem_ctx, uint8_t, size);
-				if (buf == NULL) {
-					return NT_STATUS_NO_MEMORY;
-				}
-			}
-
-			size = 0;
-			for (i=0; i < e->count; i++) {
-				memcpy(buf+size,
-				       e->vector[i].iov_base,
-				       e->vector[i].iov_len);
-				size += e->vector[i].iov_len;
+			status = smbd_smb2_flush_sendfile(xconn, e);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
 			}
+			continue;
+		}
 
-			e->sendfile_header->data = buf;
-			e->sendfile_header->length = size;
-			e->sendfile_status = &status;
-			e->count = 0;
-
-			xconn->smb2.send_queue_len--;
-			DLIST_REMOVE(xconn->smb2.send_queue, e);
-
-			size += e->sendfile_body_size;
-
+#ifdef HAVE_LINUX_SPLICE
+		if (e->splice != NULL &&
+		    e->count > 0 &&
+		    e->vector[0].iov_base == NULL &&
+		    e->vector[0].iov_len != 0)
+		{
 			/*
-			 * This triggers the sendfile path via
-			 * the destructor.
+			 * The file data of a READ response,
+			 * all vectors before it are sent.
 			 */
-			talloc_free(e->mem_ctx);
-
+			status = smbd_smb2_flush_splice(xconn, e);
+			if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+				TEVENT_FD_WRITEABLE(xconn->transport.fde);
+				return NT_STATUS_OK;
+			}
+			if (!NT_STATUS_IS_OK(status)) {
+				smbXsrv_connection_disconnect_transport(xconn,
+									status);
+				return status;
+			}
+			status = smbd_smb2_advance_send_queue(
+				xconn, &e, e->splice->length);
+			if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+				continue;
+			}
 			if (!NT_STATUS_IS_OK(status)) {
 				smbXsrv_connection_disconnect_transport(xconn,
 									status);
 				return status;
 			}
-			xconn->ack.unacked_bytes += size;
 			continue;
 		}
+#endif
 
 		e->msg = (struct msghdr) {
 			.msg_iov = e->vector,
 			.msg_iovlen = e->count,
 		};
 
+		if (e->splice != NULL) {
+			int i;
+
+			/*
+			 * Stop at the file data,
+			 * smbd_smb2_flush_splice() sends it.
+			 */
+			for (i = 0; i < e->count; i++) {
+				if (e->vector[i].iov_base == NULL &&
+				    e->vector[i].iov_len != 0)
+				{
+					break;
+				}
+			}
+			e->msg.msg_iovlen = i;
+		}
+		want = iov_buflen(e->msg.msg_iov, e->msg.msg_iovlen);
+
 #ifdef MSG_NOSIGNAL
 		sendmsg_flags |= MSG_NOSIGNAL;
 #endif
 #ifdef MSG_DONTWAIT
 		sendmsg_flags |= MSG_DONTWAIT;
 #endif
+#ifdef HAVE_SMBD_MSG_ZEROCOPY
+		if (xconn->smb2.zerocopy.enabled &&
+		    e->ack.req == NULL &&
+		    e->splice == NULL &&
+		    (size_t)want >= xconn->smb2.zerocopy.threshold)
+		{
+			/*
+			 * The kernel pins our pages instead of
+			 * copying them, the entry stays alive until
+			 * smbd_smb2_zerocopy_reap() sees the
+			 * completion.
+			 */
+			sendmsg_flags |= MSG_ZEROCOPY;
+		}
+#endif
 
 		ret = sendmsg(xconn->transport.sock, &e->msg, sendmsg_flags);
 		if (ret == 0) {
@@ -5012,46 +6379,532 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 			return status;
 		}
 
-		status = smbd_smb2_advance_send_queue(xconn, &e, ret);
-		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
-			/* retry later */
-			TEVENT_FD_WRITEABLE(xconn->transport.fde);
-			return NT_STATUS_OK;
-		}
-		if (!NT_STATUS_IS_OK(status)) {
-			smbXsrv_connection_disconnect_transport(xconn,
-								status);
-			return status;
-		}
+#ifdef HAVE_SMBD_MSG_ZEROCOPY
+		if (sendmsg_flags & MSG_ZEROCOPY) {
+			/*
+			 * Every successful MSG_ZEROCOPY sendmsg()
+			 * consumes one completion id.
+			 */
+			e->zerocopy.pending = true;
+			e->zerocopy.id = xconn->smb2.zerocopy.next_id++;
+			xconn->smb2.zerocopy.used = true;
+		}
+#endif
+
+		status = smbd_smb2_advance_send_queue(xconn, &e, ret);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY) &&
+		    e->splice != NULL &&
+		    ret == want)
+		{
+			/* Everything up to the file data was sent */
+			continue;
+		}
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			/* retry later */
+			TEVENT_FD_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+			return status;
+		}
+	}
+
+	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+/*
+ * nwritten bytes from the start of the send queue were sent
+ * by someone else than smbd_smb2_flush_with_sendmsg(),
+ * advance the queue entries and try to send more.
+ */
+static NTSTATUS smbd_smb2_send_queue_sent(struct smbXsrv_connection *xconn,
+					  size_t nwritten)
+{
+	NTSTATUS status;
+
+	while (nwritten > 0) {
+		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
+		ssize_t len;
+		size_t n;
+
+		if (e == NULL) {
+			/* This is not expected! */
+			status = NT_STATUS_INTERNAL_ERROR;
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+			return status;
+		}
+
+		len = iov_buflen(e->vector, e->count);
+		if (len == -1) {
+			status = NT_STATUS_INVALID_BUFFER_SIZE;
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+			return status;
+		}
+		n = MIN(nwritten, (size_t)len);
+		nwritten -= n;
+
+		status = smbd_smb2_advance_send_queue(xconn, &e, n);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			/*
+			 * short write, the rest of this entry
+			 * goes into the next sendmsg.
+			 */
+			break;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+			return status;
+		}
+	}
+
+	return smbd_smb2_flush_send_queue(xconn);
+}
+
+static void smbd_smb2_io_thread_sent(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_flush_with_io_thread(struct smbXsrv_connection *xconn)
+{
+	struct iovec iov[SMBD_SMB2_IO_THREAD_MAX_IOV];
+	size_t iovcnt = 0;
+	size_t len = 0;
+	struct smbd_smb2_send_queue *e = NULL;
+	struct tevent_req *subreq = NULL;
+	NTSTATUS status;
+
+	if (xconn->smb2.io_thread.send_req != NULL) {
+		/*
+		 * smbd_smb2_io_thread_sent() calls us again
+		 * once the pending job completed.
+		 */
+		TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+		return NT_STATUS_OK;
+	}
+
+	while ((e = xconn->smb2.send_queue) != NULL &&
+	       e->sendfile_header != NULL &&
+	       !e->busy)
+	{
+		status = smbd_smb2_flush_sendfile(xconn, e);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	/*
+	 * Gather the queue like smbd_smb2_flush_with_uring(),
+	 * smbd_smb2_io_thread_sent() advances the queue entries.
+	 */
+	for (e = xconn->smb2.send_queue; e != NULL; e = e->next) {
+		int i;
+
+		if (e->sendfile_header != NULL || e->busy) {
+			break;
+		}
+
+		for (i = 0; i < e->count; i++) {
+			if (iovcnt == ARRAY_SIZE(iov)) {
+				break;
+			}
+			iov[iovcnt++] = e->vector[i];
+			len += e->vector[i].iov_len;
+		}
+		if (iovcnt == ARRAY_SIZE(iov)) {
+			break;
+		}
+	}
+
+	if (len < SMBD_SMB2_IO_THREAD_MIN_SIZE) {
+		/*
+		 * Small responses are cheaper to send inline,
+		 * this also handles an empty queue and a queue
+		 * head that is still being signed or encrypted.
+		 */
+		return smbd_smb2_flush_with_sendmsg(xconn);
+	}
+
+	subreq = smbd_smb2_io_thread_sendv_send(xconn,
+						xconn->client->raw_ev_ctx,
+						xconn->transport.io_thread,
+						iov,
+						iovcnt);
+	if (subreq == NULL) {
+		status = NT_STATUS_NO_MEMORY;
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_io_thread_sent, xconn);
+	xconn->smb2.io_thread.send_req = subreq;
+
+	TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static void smbd_smb2_io_thread_sent(struct tevent_req *subreq)
+{
+	struct smbXsrv_connection *xconn =
+		tevent_req_callback_data(subreq,
+		struct smbXsrv_connection);
+	size_t nwritten = 0;
+	NTSTATUS status;
+
+	status = smbd_smb2_io_thread_sendv_recv(subreq, &nwritten);
+	TALLOC_FREE(subreq);
+	xconn->smb2.io_thread.send_req = NULL;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return;
+	}
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbXsrv_connection_disconnect_transport(xconn, status);
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_send_queue_sent(xconn, nwritten);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+#ifdef WITH_SMB2_URING
+static NTSTATUS smbd_smb2_flush_with_uring(struct smbXsrv_connection *xconn)
+{
+	struct iovec iov[SMBD_SMB2_URING_MAX_IOV];
+	size_t iovcnt = 0;
+	struct smbd_smb2_send_queue *e = NULL;
+	NTSTATUS status;
+
+	if (smbd_smb2_uring_send_busy(xconn->transport.uring)) {
+		/*
+		 * smbd_smb2_uring_sent() calls us again
+		 * once the pending sendmsg completed.
+		 */
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The sendfile path writes to the socket directly,
+	 * which is fine as there's no sendmsg pending.
+	 */
+	while ((e = xconn->smb2.send_queue) != NULL &&
+	       e->sendfile_header != NULL &&
+	       !e->busy)
+	{
+		status = smbd_smb2_flush_sendfile(xconn, e);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	if (xconn->smb2.send_queue == NULL) {
+		return NT_STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	/*
+	 * Gather as much of the queue as possible into
+	 * one sendmsg, smbd_smb2_uring_sent() advances
+	 * the queue entries by the number of bytes
+	 * actually sent.
+	 */
+	for (e = xconn->smb2.send_queue; e != NULL; e = e->next) {
+		int i;
+
+		if (e->sendfile_header != NULL || e->busy) {
+			break;
+		}
+
+		for (i = 0; i < e->count; i++) {
+			if (iovcnt == ARRAY_SIZE(iov)) {
+				break;
+			}
+			iov[iovcnt++] = e->vector[i];
+		}
+		if (iovcnt == ARRAY_SIZE(iov)) {
+			break;
+		}
+	}
+
+	if (iovcnt == 0) {
+		/*
+		 * The head of the queue is still being
+		 * signed or encrypted.
+		 */
+		return NT_STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	status = smbd_smb2_uring_sendv(xconn->transport.uring, iov, iovcnt);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+
+	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+}
+#endif /* WITH_SMB2_URING */
+
+static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
+{
+	NTSTATUS status;
+
+#ifdef WITH_SMB2_URING
+	if (xconn->transport.uring != NULL &&
+	    NT_STATUS_IS_OK(xconn->transport.status))
+	{
+		status = smbd_smb2_flush_with_uring(xconn);
+	} else
+#endif
+	if (xconn->transport.io_thread != NULL &&
+	    NT_STATUS_IS_OK(xconn->transport.status))
+	{
+		status = smbd_smb2_flush_with_io_thread(xconn);
+	} else {
+		status = smbd_smb2_flush_with_sendmsg(xconn);
+	}
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+		return status;
+	}
+
+	/*
+	 * Restart reads if we were blocked on
+	 * draining the send queue.
+	 */
+
+	status = smbd_smb2_request_next_incoming(xconn);
+	return status;
+}
+
+static NTSTATUS smbd_smb2_request_process_incoming(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	NTTIME now,
+	uint8_t *pktbuf,
+	size_t pktlen,
+	size_t unread_bytes)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	NTSTATUS status;
+
+	status = smbd_smb2_inbuf_parse_compound(xconn,
+						now,
+						pktbuf,
+						pktlen,
+						req,
+						&req->in.vector,
+						&req->in.vector_count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (unread_bytes != 0) {
+		req->smb1req = talloc_zero(req, struct smb_request);
+		if (req->smb1req == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		req->smb1req->unread_bytes = unread_bytes;
+	}
+
+	req->current_idx = 1;
+
+
+	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
+		 req->current_idx, req->in.vector_count));
+
+	status = smbd_smb2_request_validate(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_setup_out(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_dispatch(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	sconn->num_requests++;
+
+	/* The timeout_processing function isn't run nearly
+	   often enough to implement 'max log size' without
+	   overrunning the size of the file by many megabytes.
+	   This is especially true if we are running at debug
+	   level 10.  Checking every 50 SMB2s is a nice
+	   tradeoff of performance vs log file size overrun. */
+
+	if ((sconn->num_requests % 50) == 0 &&
+	    need_to_check_log_size()) {
+		change_to_root_user();
+		check_log_size();
+	}
+
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_decrypt_done(struct tevent_req *subreq);
+
+/*
+ * Decrypt a large SMB2_TRANSFORM message on the pthreadpool,
+ * we don't read the next request until it's done, see
+ * smbd_smb2_request_next_incoming().
+ *
+ * Everything unexpected is left to smbd_smb2_inbuf_parse_compound().
+ */
+static bool smbd_smb2_request_decrypt_offload(struct smbXsrv_connection *xconn,
+					      struct smbd_smb2_request *req,
+					      NTTIME now,
+					      uint8_t *buf,
+					      size_t buflen,
+					      NTSTATUS *_status)
+{
+	struct smbXsrv_session *s = NULL;
+	struct tevent_req *subreq = NULL;
+	struct iovec tf_iov[2];
+	uint64_t uid;
+	size_t enc_len;
+	NTSTATUS status;
+
+	*_status = NT_STATUS_OK;
+
+	if (!smbd_smb2_crypto_offload(buflen)) {
+		return false;
+	}
+	if (buflen < SMB2_TF_HDR_SIZE || IVAL(buf, 0) != SMB2_TF_MAGIC) {
+		return false;
+	}
+	if (xconn->protocol < PROTOCOL_SMB3_00 ||
+	    xconn->smb2.server.cipher == 0 ||
+	    !xconn->smb2.got_authenticated_session)
+	{
+		return false;
+	}
+
+	enc_len = IVAL(buf, SMB2_TF_MSG_SIZE);
+	if (enc_len > buflen - SMB2_TF_HDR_SIZE) {
+		return false;
+	}
+
+	uid = BVAL(buf, SMB2_TF_SESSION_ID);
+	status = smb2srv_session_lookup_conn(xconn, uid, now, &s);
+	if (!NT_STATUS_IS_OK(status)) {
+		status = smb2srv_session_lookup_global(xconn->client,
+						       uid, req, &s);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+	if (!smb2_signing_key_valid(s->global->decryption_key)) {
+		return false;
+	}
+
+	tf_iov[0] = (struct iovec) {
+		.iov_base = (void *)buf,
+		.iov_len = SMB2_TF_HDR_SIZE,
+	};
+	tf_iov[1] = (struct iovec) {
+		.iov_base = (void *)(buf + SMB2_TF_HDR_SIZE),
+		.iov_len = enc_len,
+	};
+
+	subreq = smbd_smb2_crypto_send(req,
+				       xconn->client->raw_ev_ctx,
+				       smbd_smb2_crypto_pool(xconn),
+				       SMBD_SMB2_CRYPTO_DECRYPT,
+				       s->global->decryption_key,
+				       tf_iov,
+				       ARRAY_SIZE(tf_iov));
+	if (subreq == NULL) {
+		*_status = NT_STATUS_NO_MEMORY;
+		return true;
 	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_decrypt_done, req);
 
-	return NT_STATUS_MORE_PROCESSING_REQUIRED;
+	req->crypto.busy = true;
+	req->crypto.inbuf = buf;
+	req->crypto.inbuf_len = buflen;
+	xconn->smb2.decrypt_req = req;
+
+	return true;
 }
 
-static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
+static void smbd_smb2_request_decrypt_done(struct tevent_req *subreq)
 {
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTTIME now;
 	NTSTATUS status;
 
-	status = smbd_smb2_flush_with_sendmsg(xconn);
-	if (!NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
-		return status;
+	status = smbd_smb2_crypto_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	req->crypto.busy = false;
+	if (req->crypto.orphaned) {
+		/*
+		 * The connection is gone,
+		 * see smbd_smb2_request_destructor().
+		 */
+		talloc_free(req);
+		return;
 	}
+	xconn->smb2.decrypt_req = NULL;
 
-	/*
-	 * Restart reads if we were blocked on
-	 * draining the send queue.
-	 */
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		talloc_free(req);
+		return;
+	}
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	req->crypto.decrypted = true;
+	now = timeval_to_nttime(&req->request_time);
+
+	status = smbd_smb2_request_process_incoming(xconn,
+						    req,
+						    now,
+						    req->crypto.inbuf,
+						    req->crypto.inbuf_len,
+						    0);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
 
 	status = smbd_smb2_request_next_incoming(xconn);
-	return status;
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
 }
 
 static NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n)
 {
-	struct smbd_server_connection *sconn = xconn->client->sconn;
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
 	struct smbd_smb2_request *req = NULL;
 	size_t min_recvfile_size = UINT32_MAX;
+	uint8_t *pktbuf = NULL;
+	size_t pktlen;
+	size_t unread_bytes = 0;
 	NTSTATUS status;
 	NTTIME now;
 	bool ok;
@@ -5162,7 +7015,7 @@ got_full:
 		req = state->req;
 		*state = (struct smbd_smb2_request_read_state) {
 			.req = req,
-			.min_recv_size = lp_min_receive_file_size(),
+			.min_recv_size = smbd_smb2_min_recv_size(xconn),
 			._vector = {
 				[0] = (struct iovec) {
 					.iov_base = (void *)state->hdr.nbt,
@@ -5176,70 +7029,148 @@ got_full:
 	}
 
 	req = state->req;
+	pktbuf = state->pktbuf;
+	pktlen = state->pktlen;
+	if (state->doing_receivefile) {
+		unread_bytes = state->pktfull - state->pktlen;
+	}
+
+	*state = (struct smbd_smb2_request_read_state) {
+		.req = NULL,
+	};
 
 	req->request_time = timeval_current();
 	now = timeval_to_nttime(&req->request_time);
 
-	status = smbd_smb2_inbuf_parse_compound(xconn,
-						now,
-						state->pktbuf,
-						state->pktlen,
-						req,
-						&req->in.vector,
-						&req->in.vector_count);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
+	if (unread_bytes == 0) {
+		bool offloaded;
 
-	if (state->doing_receivefile) {
-		req->smb1req = talloc_zero(req, struct smb_request);
-		if (req->smb1req == NULL) {
-			return NT_STATUS_NO_MEMORY;
+		offloaded = smbd_smb2_request_decrypt_offload(xconn,
+							      req,
+							      now,
+							      pktbuf,
+							      pktlen,
+							      &status);
+		if (offloaded) {
+			/*
+			 * smbd_smb2_request_decrypt_done()
+			 * continues.
+			 */
+			return status;
 		}
-		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
 	}
 
-	*state = (struct smbd_smb2_request_read_state) {
-		.req = NULL,
-	};
-
-	req->current_idx = 1;
+	if (unread_bytes != 0) {
+		int ret;
 
-	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
-		 req->current_idx, req->in.vector_count));
+		/*
+		 * The rest of the WRITE is received with
+		 * blocking reads from the socket.
+		 */
+		ret = smbd_smb2_set_sock_blocking(xconn, true);
+		if (ret == -1) {
+			return map_nt_error_from_unix_common(errno);
+		}
+	}
 
-	status = smbd_smb2_request_validate(req);
+	status = smbd_smb2_request_process_incoming(xconn,
+						    req,
+						    now,
+						    pktbuf,
+						    pktlen,
+						    unread_bytes);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
 
-	status = smbd_smb2_request_setup_out(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
+	status = smbd_smb2_request_next_incoming(xconn);
+	return status;
+}
+
+static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
+				     uint16_t fde_flags);
+static void smbd_smb2_io_thread_received(struct tevent_req *subreq);
+
+/*
+ * Large reads, typically the data of a WRITE request,
+ * are done by the io thread of the channel.
+ */
+static bool smbd_smb2_recv_with_io_thread(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	ssize_t len;
+
+	if (xconn->transport.io_thread == NULL) {
+		return false;
 	}
 
-	status = smbd_smb2_request_dispatch(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
+	len = iov_buflen(state->vector, state->count);
+	if (len < SMBD_SMB2_IO_THREAD_MIN_SIZE) {
+		return false;
 	}
 
-	sconn->num_requests++;
+	return true;
+}
 
-	/* The timeout_processing function isn't run nearly
-	   often enough to implement 'max log size' without
-	   overrunning the size of the file by many megabytes.
-	   This is especially true if we are running at debug
-	   level 10.  Checking every 50 SMB2s is a nice
-	   tradeoff of performance vs log file size overrun. */
+static NTSTATUS smbd_smb2_io_thread_recv(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	struct tevent_req *subreq = NULL;
 
-	if ((sconn->num_requests % 50) == 0 &&
-	    need_to_check_log_size()) {
-		change_to_root_user();
-		check_log_size();
+	subreq = smbd_smb2_io_thread_recvv_send(xconn,
+						xconn->client->raw_ev_ctx,
+						xconn->transport.io_thread,
+						state->vector,
+						state->count);
+	if (subreq == NULL) {
+		return NT_STATUS_NO_MEMORY;
 	}
+	tevent_req_set_callback(subreq, smbd_smb2_io_thread_received, xconn);
+	xconn->smb2.io_thread.recv_req = subreq;
 
-	status = smbd_smb2_request_next_incoming(xconn);
-	return status;
+	TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_io_thread_received(struct tevent_req *subreq)
+{
+	struct smbXsrv_connection *xconn =
+		tevent_req_callback_data(subreq,
+		struct smbXsrv_connection);
+	size_t nread = 0;
+	NTSTATUS status;
+
+	status = smbd_smb2_io_thread_recvv_recv(subreq, &nread);
+	TALLOC_FREE(subreq);
+	xconn->smb2.io_thread.recv_req = NULL;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return;
+	}
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbXsrv_connection_disconnect_transport(xconn, status);
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_advance_incoming(xconn, nread);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_PENDING) ||
+	    NT_STATUS_EQUAL(status, NT_STATUS_RETRY))
+	{
+		/*
+		 * Continue with the next vector,
+		 * just as if the socket was readable.
+		 */
+		status = smbd_smb2_io_handler(xconn, TEVENT_FD_READ);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
 }
 
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
@@ -5262,6 +7193,26 @@ static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 		return NT_STATUS_OK;
 	}
 
+#ifdef HAVE_SMBD_MSG_ZEROCOPY
+	if (fde_flags & TEVENT_FD_ERROR) {
+		bool reaped = false;
+
+		/*
+		 * MSG_ZEROCOPY completions arrive on the
+		 * socket error queue and raise POLLERR.
+		 */
+		status = smbd_smb2_zerocopy_reap(xconn, &reaped);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+			return status;
+		}
+		if (reaped) {
+			fde_flags &= ~TEVENT_FD_ERROR;
+		}
+	}
+#endif
+
 	if (fde_flags & TEVENT_FD_ERROR) {
 		ret = samba_socket_poll_or_sock_error(xconn->transport.sock);
 		if (ret == -1) {
@@ -5294,8 +7245,26 @@ static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.io_thread.recv_req != NULL) {
+		/*
+		 * smbd_smb2_io_thread_received()
+		 * calls us again.
+		 */
+		TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+		return NT_STATUS_OK;
+	}
+
 again:
 
+	if (smbd_smb2_recv_with_io_thread(xconn)) {
+		status = smbd_smb2_io_thread_recv(xconn);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbXsrv_connection_disconnect_transport(xconn,
+								status);
+		}
+		return status;
+	}
+
 	state->msg = (struct msghdr) {
 		.msg_iov = state->vector,
 		.msg_iovlen = state->count,
@@ -5362,3 +7331,114 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 		return;
 	}
 }
+
+#ifdef WITH_SMB2_URING
+static NTSTATUS smbd_smb2_uring_recv_data(const uint8_t *buf,
+					  size_t len,
+					  size_t *_consumed,
+					  void *private_data)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	size_t consumed = 0;
+	NTSTATUS status;
+
+	while (consumed < len) {
+		size_t n = 0;
+		int i;
+
+		if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+			/*
+			 * we're not supposed to do any io
+			 */
+			break;
+		}
+
+		if (state->req == NULL) {
+			/*
+			 * We wait until the send queue is drained,
+			 * smbd_smb2_request_next_incoming() will
+			 * resume the delivery.
+			 */
+			break;
+		}
+
+		for (i = 0; i < state->count && consumed + n < len; i++) {
+			size_t thislen = MIN(state->vector[i].iov_len,
+					     len - consumed - n);
+
+			memcpy(state->vector[i].iov_base,
+			       buf + consumed + n,
+			       thislen);
+			n += thislen;
+		}
+		consumed += n;
+
+		status = smbd_smb2_advance_incoming(xconn, n);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_PENDING)) {
+			/* we have more to read */
+			continue;
+		}
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			/*
+			 * smbd_smb2_advance_incoming setup a new vector
+			 * that we should fill immediately.
+			 */
+			continue;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			*_consumed = consumed;
+			return status;
+		}
+	}
+
+	*_consumed = consumed;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_uring_sent(size_t nwritten, void *private_data)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+
+	return smbd_smb2_send_queue_sent(xconn, nwritten);
+}
+
+static void smbd_smb2_uring_error(NTSTATUS status, void *private_data)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+
+	smbXsrv_connection_disconnect_transport(xconn, status);
+	smbd_server_connection_terminate(xconn, nt_errstr(status));
+}
+
+static NTSTATUS smbd_smb2_uring_setup(struct smbXsrv_connection *xconn)
+{
+	NTSTATUS status;
+
+	status = smbd_smb2_uring_create(xconn,
+					xconn->client->raw_ev_ctx,
+					xconn->transport.sock,
+					smbd_smb2_uring_recv_data,
+					smbd_smb2_uring_sent,
+					smbd_smb2_uring_error,
+					xconn,
+					&xconn->transport.uring);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	/*
+	 * From now on all socket io goes via the ring,
+	 * transport.fde only owns the socket.
+	 */
+	tevent_fd_set_flags(xconn->transport.fde, 0);
+
+	return NT_STATUS_OK;
+}
+#endif /* WITH_SMB2_URING */
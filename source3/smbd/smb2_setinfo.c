@@ -473,6 +473,113 @@ static void smbd_smb2_setinfo_rename_dst_parent_check(struct tevent_req *req);
 static void smbd_smb2_setinfo_rename_dst_parent_delay_done(
 	struct tevent_req *subreq);
 
+static void smbd_smb2_setinfo_rename_done(struct tevent_req *subreq);
+
+/*
+ * Do a plain SMB2 rename of a file (not a stream or a directory) with
+ * SMB_VFS_RENAMEAT_SEND().
+ *
+ * The share mode lock can't be held across the async rename, so as
+ * for SMB1 renames it's dropped before the rename and
+ * rename_internals_fsp_send() takes it again to update the other
+ * opens. A new open of the source racing with the rename will see the
+ * old name, exactly as if it had come in just before the rename.
+ *
+ * Returns false if the caller has to do the rename synchronously.
+ */
+static bool smbd_smb2_setinfo_rename_async(struct tevent_req *req)
+{
+	struct smbd_smb2_setinfo_state *state = tevent_req_data(
+		req, struct smbd_smb2_setinfo_state);
+	struct files_struct *fsp = state->fsp;
+	connection_struct *conn = fsp->conn;
+	struct tevent_req *subreq = NULL;
+	char *newname = NULL;
+	bool overwrite = false;
+	NTSTATUS status;
+
+	if (state->file_info_level != SMB2_FILE_RENAME_INFORMATION_INTERNAL) {
+		return false;
+	}
+	if (fsp_is_alternate_stream(fsp)) {
+		return false;
+	}
+	if (fsp->fsp_flags.is_directory) {
+		return false;
+	}
+	if (!vfswrap_check_async_with_thread_creds(conn->sconn->pool)) {
+		return false;
+	}
+
+	status = smb2_parse_file_rename_information(
+		state,
+		conn,
+		state->smb2req->smb1req,
+		(char *)state->data.data,
+		state->data.length,
+		fsp->fsp_name->flags & SMB_FILENAME_POSIX_PATH,
+		&newname,
+		&overwrite);
+	if (tevent_req_nterror(req, status)) {
+		return true;
+	}
+
+	if (newname[0] == ':') {
+		TALLOC_FREE(newname);
+		return false;
+	}
+
+	DBG_DEBUG("SMB_FILE_RENAME_INFORMATION (%s) %s -> %s\n",
+		  fsp_fnum_dbg(fsp),
+		  fsp_str_dbg(fsp),
+		  newname);
+
+	TALLOC_FREE(state->lck);
+
+	subreq = rename_internals_fsp_send(state,
+					   state->ev,
+					   conn,
+					   fsp,
+					   (FILE_ATTRIBUTE_HIDDEN |
+					    FILE_ATTRIBUTE_SYSTEM),
+					   newname,
+					   overwrite);
+	if (tevent_req_nomem(subreq, req)) {
+		return true;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_setinfo_rename_done, req);
+
+	if (smbd_smb2_is_compound(state->smb2req) &&
+	    !smbd_smb2_is_last_in_compound(state->smb2req)) {
+		/*
+		 * Can't go async if we're not the
+		 * last request in a compound request.
+		 */
+		smb2_request_set_async_internal(state->smb2req, true);
+	}
+
+	/* Ensure any close request knows about this outstanding rename. */
+	if (!aio_add_req_to_fsp(fsp, req)) {
+		tevent_req_nterror(req, NT_STATUS_NO_MEMORY);
+		return true;
+	}
+	return true;
+}
+
+static void smbd_smb2_setinfo_rename_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	NTSTATUS status;
+
+	status = rename_internals_fsp_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
 static void smbd_smb2_setinfo_lease_break_check(struct tevent_req *req)
 {
 	struct smbd_smb2_setinfo_state *state = tevent_req_data(
@@ -512,6 +619,11 @@ static void smbd_smb2_setinfo_lease_break_check(struct tevent_req *req)
 		return;
 	}
 
+	if (smbd_smb2_setinfo_rename_async(req)) {
+		state->delay = true;
+		return;
+	}
+
 	status = smbd_do_setfilepathinfo(state->fsp->conn,
 					 state->smb2req->smb1req,
 					 state,
@@ -625,6 +737,10 @@ static void smbd_smb2_setinfo_lease_break_fsp_done(struct tevent_req *subreq)
 		return;
 	}
 
+	if (smbd_smb2_setinfo_rename_async(req)) {
+		return;
+	}
+
 	/* Do the setinfo again under the lock. */
 	status = smbd_do_setfilepathinfo(state->fsp->conn,
 				state->smb2req->smb1req,
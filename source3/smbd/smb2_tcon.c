@@ -431,6 +431,12 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 		tcon->share_flags |= SMB2_SHAREFLAG_ENCRYPT_DATA;
 	}
 
+	if (conn->smb2.server.compression.num_algos != 0 &&
+	    lp_smb3_compress_data(SNUM(tcon->compat)) == SMB3_COMPRESS_DATA_YES)
+	{
+		tcon->share_flags |= SMB2_SHAREFLAG_COMPRESS_DATA;
+	}
+
 	/*
 	 * For disk shares we can change the client
 	 * behavior on a cluster...
@@ -0,0 +1,784 @@
+/*
+   Unix SMB/CIFS implementation.
+   io_uring based socket transport for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+
+/*
+ * See the comment in source3/modules/vfs_io_uring.c
+ */
+struct open_how;
+#ifdef HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H
+#define open_how __ignore_liburing_compat_h_open_how
+#include <liburing/compat.h>
+#undef open_how
+#endif /* HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H */
+
+#include "includes.h"
+#include "system/network.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "smbd/smb2_uring.h"
+#include <liburing.h>
+
+/*
+ * The ring transports two kinds of operations:
+ *
+ * - a single multishot recv, which fills buffers from
+ *   a provided buffer ring. The received chunks are queued
+ *   in a fifo and handed to the recv_fn in order.
+ *
+ * - at most one sendmsg at a time. The caller gathers
+ *   as much of its send queue as possible into that sendmsg,
+ *   so a burst of responses ends up in one SQE.
+ *
+ * Both are submitted together with one io_uring_submit()
+ * at the end of each completion run.
+ */
+
+#define SMBD_SMB2_URING_OP_RECV 1
+#define SMBD_SMB2_URING_OP_SEND 2
+
+#define SMBD_SMB2_URING_BGID 0
+
+#define SMBD_SMB2_URING_CQE_BATCH 32
+
+struct smbd_smb2_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct smbd_smb2_uring_chunk {
+	uint32_t ofs;
+	uint32_t len;
+};
+
+struct smbd_smb2_uring {
+	struct tevent_context *ev;
+	int sock;
+
+	struct io_uring uring;
+	bool ring_initialized;
+	struct tevent_fd *fde;
+	struct tevent_immediate *im;
+
+	/* we're inside smbd_smb2_uring_run() */
+	bool busy;
+	/* smbd_smb2_uring_shutdown() was called */
+	bool stopped;
+	/*
+	 * io_uring_submit() failed outside of smbd_smb2_uring_run(),
+	 * reported to error_fn from the next run.
+	 */
+	NTSTATUS failed;
+
+	smbd_smb2_uring_recv_fn recv_fn;
+	smbd_smb2_uring_sent_fn sent_fn;
+	smbd_smb2_uring_error_fn error_fn;
+	void *private_data;
+
+	struct {
+		struct io_uring_buf_ring *br;
+		uint8_t *buffers;
+		unsigned num_bufs;
+		size_t buf_size;
+		bool armed;
+
+		/*
+		 * Buffers the kernel filled, but recv_fn didn't
+		 * consume completely yet. fifo[] holds the buffer ids
+		 * in the order they were received, chunks[] is
+		 * indexed by buffer id.
+		 */
+		struct smbd_smb2_uring_chunk *chunks;
+		uint16_t *fifo;
+		unsigned fifo_head;
+		unsigned fifo_count;
+	} recv;
+
+	struct {
+		bool busy;
+		struct msghdr msg;
+		struct iovec iov[SMBD_SMB2_URING_MAX_IOV];
+	} send;
+};
+
+static void smbd_smb2_uring_run(struct smbd_smb2_uring *ur);
+
+static void smbd_smb2_uring_fd_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data)
+{
+	struct smbd_smb2_uring *ur =
+		talloc_get_type_abort(private_data,
+		struct smbd_smb2_uring);
+
+	smbd_smb2_uring_run(ur);
+}
+
+static void smbd_smb2_uring_immediate_handler(struct tevent_context *ev,
+					      struct tevent_immediate *im,
+					      void *private_data)
+{
+	struct smbd_smb2_uring *ur =
+		talloc_get_type_abort(private_data,
+		struct smbd_smb2_uring);
+
+	smbd_smb2_uring_run(ur);
+}
+
+static void smbd_smb2_uring_exit(struct smbd_smb2_uring *ur)
+{
+	TALLOC_FREE(ur->fde);
+	TALLOC_FREE(ur->im);
+
+	if (!ur->ring_initialized) {
+		return;
+	}
+
+	if (ur->recv.br != NULL) {
+		io_uring_free_buf_ring(&ur->uring,
+				       ur->recv.br,
+				       ur->recv.num_bufs,
+				       SMBD_SMB2_URING_BGID);
+		ur->recv.br = NULL;
+	}
+
+	io_uring_queue_exit(&ur->uring);
+	ur->ring_initialized = false;
+}
+
+static int smbd_smb2_uring_destructor(struct smbd_smb2_uring *ur)
+{
+	smbd_smb2_uring_shutdown(ur);
+	return 0;
+}
+
+NTSTATUS smbd_smb2_uring_create(TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				int sock,
+				smbd_smb2_uring_recv_fn recv_fn,
+				smbd_smb2_uring_sent_fn sent_fn,
+				smbd_smb2_uring_error_fn error_fn,
+				void *private_data,
+				struct smbd_smb2_uring **_ur)
+{
+	struct smbd_smb2_uring *ur = NULL;
+	unsigned num_entries;
+	unsigned num_bufs;
+	size_t buf_size;
+	unsigned mask;
+	unsigned i;
+	int ret;
+
+	num_entries = lp_parm_ulong(-1, "smbd", "io uring entries", 64);
+	num_entries = MAX(num_entries, 4);
+
+	/*
+	 * The buffer ring needs a power of 2
+	 * and buffer ids are 16 bit.
+	 */
+	num_bufs = lp_parm_ulong(-1, "smbd", "io uring recv buffers", 64);
+	num_bufs = MIN(num_bufs, 32768);
+	num_bufs = MAX(num_bufs, 2);
+	while ((num_bufs & (num_bufs - 1)) != 0) {
+		num_bufs &= num_bufs - 1;
+	}
+
+	buf_size = lp_parm_ulong(-1, "smbd", "io uring recv buffer size",
+				 16384);
+	buf_size = MIN(buf_size, UINT32_MAX);
+	buf_size = MAX(buf_size, 512);
+
+	ur = talloc_zero(mem_ctx, struct smbd_smb2_uring);
+	if (ur == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	ur->ev = ev;
+	ur->sock = sock;
+	ur->recv_fn = recv_fn;
+	ur->sent_fn = sent_fn;
+	ur->error_fn = error_fn;
+	ur->private_data = private_data;
+	ur->failed = NT_STATUS_OK;
+	ur->recv.num_bufs = num_bufs;
+	ur->recv.buf_size = buf_size;
+
+	ur->recv.buffers = talloc_array(ur, uint8_t, num_bufs * buf_size);
+	if (ur->recv.buffers == NULL) {
+		TALLOC_FREE(ur);
+		return NT_STATUS_NO_MEMORY;
+	}
+	ur->recv.chunks = talloc_zero_array(ur,
+					    struct smbd_smb2_uring_chunk,
+					    num_bufs);
+	if (ur->recv.chunks == NULL) {
+		TALLOC_FREE(ur);
+		return NT_STATUS_NO_MEMORY;
+	}
+	ur->recv.fifo = talloc_zero_array(ur, uint16_t, num_bufs);
+	if (ur->recv.fifo == NULL) {
+		TALLOC_FREE(ur);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	ur->im = tevent_create_immediate(ur);
+	if (ur->im == NULL) {
+		TALLOC_FREE(ur);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	ret = io_uring_queue_init(num_entries, &ur->uring, 0);
+	if (ret < 0) {
+		TALLOC_FREE(ur);
+		return map_nt_error_from_unix_common(-ret);
+	}
+	ur->ring_initialized = true;
+	talloc_set_destructor(ur, smbd_smb2_uring_destructor);
+
+#ifdef HAVE_IO_URING_RING_DONTFORK
+	ret = io_uring_ring_dontfork(&ur->uring);
+	if (ret < 0) {
+		TALLOC_FREE(ur);
+		return map_nt_error_from_unix_common(-ret);
+	}
+#endif /* HAVE_IO_URING_RING_DONTFORK */
+
+	ur->recv.br = io_uring_setup_buf_ring(&ur->uring,
+					      num_bufs,
+					      SMBD_SMB2_URING_BGID,
+					      0,
+					      &ret);
+	if (ur->recv.br == NULL) {
+		TALLOC_FREE(ur);
+		return map_nt_error_from_unix_common(-ret);
+	}
+
+	mask = io_uring_buf_ring_mask(num_bufs);
+	for (i = 0; i < num_bufs; i++) {
+		io_uring_buf_ring_add(ur->recv.br,
+				      ur->recv.buffers + (i * buf_size),
+				      buf_size,
+				      i,
+				      mask,
+				      i);
+	}
+	io_uring_buf_ring_advance(ur->recv.br, num_bufs);
+
+	ur->fde = tevent_add_fd(ev,
+				ur,
+				ur->uring.ring_fd,
+				TEVENT_FD_READ,
+				smbd_smb2_uring_fd_handler,
+				ur);
+	if (ur->fde == NULL) {
+		TALLOC_FREE(ur);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	DBG_DEBUG("sock[%d] entries[%u] buffers[%u] buf_size[%zu]\n",
+		  sock, num_entries, num_bufs, buf_size);
+
+	*_ur = ur;
+	return NT_STATUS_OK;
+}
+
+void smbd_smb2_uring_shutdown(struct smbd_smb2_uring *ur)
+{
+	if (ur->stopped) {
+		return;
+	}
+	ur->stopped = true;
+
+	/*
+	 * The ring holds its own reference on the socket.
+	 * Make sure pending operations terminate now,
+	 * before the caller frees the memory a pending
+	 * sendmsg may still refer to.
+	 */
+	shutdown(ur->sock, SHUT_RDWR);
+
+	/*
+	 * smbd_smb2_uring_run() only works on a private
+	 * copy of the completions and checks ur->stopped
+	 * after each callback, so we can tear down the ring
+	 * even if we're called from within a callback.
+	 */
+	smbd_smb2_uring_exit(ur);
+}
+
+bool smbd_smb2_uring_send_busy(const struct smbd_smb2_uring *ur)
+{
+	return ur->send.busy;
+}
+
+static NTSTATUS smbd_smb2_uring_submit(struct smbd_smb2_uring *ur)
+{
+	int ret;
+
+	if (ur->stopped) {
+		return NT_STATUS_OK;
+	}
+
+	ret = io_uring_submit(&ur->uring);
+	if (ret == -EAGAIN || ret == -EBUSY) {
+		/*
+		 * The kernel is short of resources or the
+		 * completion queue is full, retry once we
+		 * reaped completions.
+		 */
+		tevent_schedule_immediate(ur->im, ur->ev,
+					  smbd_smb2_uring_immediate_handler,
+					  ur);
+		return NT_STATUS_OK;
+	}
+	if (ret < 0) {
+		/*
+		 * Nothing we queued will ever complete,
+		 * the connection is dead.
+		 */
+		DBG_ERR("io_uring_submit() failed: %s\n", strerror(-ret));
+		return map_nt_error_from_unix_common(-ret);
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * Report a failure from outside of smbd_smb2_uring_run(),
+ * we may be deep inside the upper layer, so error_fn is
+ * called from a clean stack.
+ */
+static void smbd_smb2_uring_defer_error(struct smbd_smb2_uring *ur,
+					NTSTATUS status)
+{
+	if (!NT_STATUS_IS_OK(ur->failed)) {
+		return;
+	}
+	ur->failed = status;
+	tevent_schedule_immediate(ur->im, ur->ev,
+				  smbd_smb2_uring_immediate_handler,
+				  ur);
+}
+
+static NTSTATUS smbd_smb2_uring_get_sqe(struct smbd_smb2_uring *ur,
+					struct io_uring_sqe **_sqe)
+{
+	struct io_uring_sqe *sqe = NULL;
+	NTSTATUS status;
+
+	sqe = io_uring_get_sqe(&ur->uring);
+	if (sqe != NULL) {
+		*_sqe = sqe;
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The submission queue is full,
+	 * flush it and try again.
+	 */
+	status = smbd_smb2_uring_submit(ur);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	sqe = io_uring_get_sqe(&ur->uring);
+	if (sqe == NULL) {
+		return NT_STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	*_sqe = sqe;
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_uring_prep_send(struct smbd_smb2_uring *ur,
+				      struct io_uring_sqe *sqe)
+{
+	unsigned flags = 0;
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+
+	io_uring_prep_sendmsg(sqe, ur->sock, &ur->send.msg, flags);
+	io_uring_sqe_set_data64(sqe, SMBD_SMB2_URING_OP_SEND);
+}
+
+NTSTATUS smbd_smb2_uring_sendv(struct smbd_smb2_uring *ur,
+			       const struct iovec *iov,
+			       int iovcnt)
+{
+	struct io_uring_sqe *sqe = NULL;
+	NTSTATUS status;
+
+	if (ur->stopped) {
+		return NT_STATUS_CONNECTION_DISCONNECTED;
+	}
+
+	SMB_ASSERT(!ur->send.busy);
+	SMB_ASSERT(iovcnt > 0);
+
+	iovcnt = MIN(iovcnt, SMBD_SMB2_URING_MAX_IOV);
+
+	/*
+	 * We keep our own copy of the iovec array and the
+	 * msghdr, so they stay stable until the completion
+	 * arrived, regardless of what the caller does with
+	 * its send queue in the meantime.
+	 */
+	memcpy(ur->send.iov, iov, sizeof(struct iovec) * iovcnt);
+	ur->send.msg = (struct msghdr) {
+		.msg_iov = ur->send.iov,
+		.msg_iovlen = iovcnt,
+	};
+
+	status = smbd_smb2_uring_get_sqe(ur, &sqe);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	smbd_smb2_uring_prep_send(ur, sqe);
+	ur->send.busy = true;
+
+	if (!ur->busy) {
+		/*
+		 * Otherwise smbd_smb2_uring_run() submits
+		 * it together with everything else.
+		 */
+		status = smbd_smb2_uring_submit(ur);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_uring_recv_arm(struct smbd_smb2_uring *ur)
+{
+	struct io_uring_sqe *sqe = NULL;
+	NTSTATUS status;
+
+	if (ur->stopped) {
+		return NT_STATUS_OK;
+	}
+	if (ur->recv.armed) {
+		return NT_STATUS_OK;
+	}
+	if (ur->recv.fifo_count == ur->recv.num_bufs) {
+		/*
+		 * All buffers are waiting to be consumed,
+		 * the recv would only fail with ENOBUFS.
+		 */
+		return NT_STATUS_OK;
+	}
+
+	status = smbd_smb2_uring_get_sqe(ur, &sqe);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	io_uring_prep_recv_multishot(sqe, ur->sock, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SMBD_SMB2_URING_BGID;
+	io_uring_sqe_set_data64(sqe, SMBD_SMB2_URING_OP_RECV);
+	ur->recv.armed = true;
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_uring_recv_recycle(struct smbd_smb2_uring *ur,
+					 uint16_t bid)
+{
+	io_uring_buf_ring_add(ur->recv.br,
+			      ur->recv.buffers + (bid * ur->recv.buf_size),
+			      ur->recv.buf_size,
+			      bid,
+			      io_uring_buf_ring_mask(ur->recv.num_bufs),
+			      0);
+	io_uring_buf_ring_advance(ur->recv.br, 1);
+}
+
+static NTSTATUS smbd_smb2_uring_recv_deliver(struct smbd_smb2_uring *ur)
+{
+	while (ur->recv.fifo_count > 0) {
+		uint16_t bid = ur->recv.fifo[ur->recv.fifo_head];
+		struct smbd_smb2_uring_chunk *c = &ur->recv.chunks[bid];
+		const uint8_t *buf = ur->recv.buffers +
+				     (bid * ur->recv.buf_size);
+		size_t consumed = 0;
+		NTSTATUS status;
+
+		status = ur->recv_fn(buf + c->ofs,
+				     c->len - c->ofs,
+				     &consumed,
+				     ur->private_data);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		if (ur->stopped) {
+			return NT_STATUS_OK;
+		}
+
+		c->ofs += consumed;
+		if (c->ofs < c->len) {
+			/*
+			 * The upper layer doesn't want more data
+			 * for now, it will call
+			 * smbd_smb2_uring_recv_resume() later.
+			 */
+			break;
+		}
+
+		*c = (struct smbd_smb2_uring_chunk) { .ofs = 0, };
+		ur->recv.fifo_head = (ur->recv.fifo_head + 1) %
+				     ur->recv.num_bufs;
+		ur->recv.fifo_count -= 1;
+		smbd_smb2_uring_recv_recycle(ur, bid);
+	}
+
+	return NT_STATUS_OK;
+}
+
+void smbd_smb2_uring_recv_resume(struct smbd_smb2_uring *ur)
+{
+	NTSTATUS status;
+
+	if (ur->stopped) {
+		return;
+	}
+
+	if (ur->busy) {
+		/*
+		 * smbd_smb2_uring_run() delivers pending data
+		 * and rearms the recv before it returns.
+		 */
+		return;
+	}
+
+	if (ur->recv.fifo_count > 0) {
+		/*
+		 * We're most likely called from within the
+		 * upper layer's processing, deliver the pending
+		 * data from a clean stack.
+		 */
+		tevent_schedule_immediate(ur->im, ur->ev,
+					  smbd_smb2_uring_immediate_handler,
+					  ur);
+		return;
+	}
+
+	if (ur->recv.armed) {
+		return;
+	}
+
+	status = smbd_smb2_uring_recv_arm(ur);
+	if (NT_STATUS_IS_OK(status)) {
+		status = smbd_smb2_uring_submit(ur);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_smb2_uring_defer_error(ur, status);
+	}
+}
+
+static NTSTATUS smbd_smb2_uring_complete_recv(
+	struct smbd_smb2_uring *ur,
+	const struct smbd_smb2_uring_cqe *cqe)
+{
+	unsigned tail;
+	uint16_t bid;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/*
+		 * The multishot recv terminated,
+		 * it needs to be rearmed.
+		 */
+		ur->recv.armed = false;
+	}
+
+	if (cqe->res == -ENOBUFS) {
+		/*
+		 * All buffers are in use, we rearm
+		 * once the upper layer consumed some.
+		 */
+		return NT_STATUS_OK;
+	}
+	if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+		return NT_STATUS_OK;
+	}
+	if (cqe->res < 0) {
+		return map_nt_error_from_unix_common(-cqe->res);
+	}
+	if (cqe->res == 0) {
+		/* propagate end of file */
+		return NT_STATUS_END_OF_FILE;
+	}
+	if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+		/* This is not expected! */
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	if (bid >= ur->recv.num_bufs ||
+	    ur->recv.fifo_count == ur->recv.num_bufs ||
+	    (size_t)cqe->res > ur->recv.buf_size)
+	{
+		/* This is not expected! */
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	ur->recv.chunks[bid] = (struct smbd_smb2_uring_chunk) {
+		.ofs = 0,
+		.len = cqe->res,
+	};
+	tail = (ur->recv.fifo_head + ur->recv.fifo_count) % ur->recv.num_bufs;
+	ur->recv.fifo[tail] = bid;
+	ur->recv.fifo_count += 1;
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_uring_complete_send(
+	struct smbd_smb2_uring *ur,
+	const struct smbd_smb2_uring_cqe *cqe)
+{
+	struct io_uring_sqe *sqe = NULL;
+	NTSTATUS status;
+
+	if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+		/*
+		 * Retry with the unchanged
+		 * iovec array.
+		 */
+		status = smbd_smb2_uring_get_sqe(ur, &sqe);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		smbd_smb2_uring_prep_send(ur, sqe);
+		return NT_STATUS_OK;
+	}
+	if (cqe->res < 0) {
+		return map_nt_error_from_unix_common(-cqe->res);
+	}
+	if (cqe->res == 0) {
+		/* propagate end of file */
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	ur->send.busy = false;
+	return ur->sent_fn(cqe->res, ur->private_data);
+}
+
+static void smbd_smb2_uring_run(struct smbd_smb2_uring *ur)
+{
+	NTSTATUS status = NT_STATUS_OK;
+
+	if (ur->stopped || ur->busy) {
+		return;
+	}
+
+	ur->busy = true;
+
+	if (!NT_STATUS_IS_OK(ur->failed)) {
+		status = ur->failed;
+		goto fail;
+	}
+
+	while (!ur->stopped) {
+		struct smbd_smb2_uring_cqe batch[SMBD_SMB2_URING_CQE_BATCH];
+		struct io_uring_cqe *cqe = NULL;
+		unsigned head;
+		unsigned nr = 0;
+		unsigned i;
+
+		/*
+		 * Copy the completions out of the ring before
+		 * calling any callback, a callback may end up in
+		 * smbd_smb2_uring_shutdown(), which unmaps the ring.
+		 */
+		io_uring_for_each_cqe(&ur->uring, head, cqe) {
+			batch[nr] = (struct smbd_smb2_uring_cqe) {
+				.user_data = io_uring_cqe_get_data64(cqe),
+				.res = cqe->res,
+				.flags = cqe->flags,
+			};
+			nr++;
+			if (nr == ARRAY_SIZE(batch)) {
+				break;
+			}
+		}
+		if (nr == 0) {
+			break;
+		}
+		io_uring_cq_advance(&ur->uring, nr);
+
+		for (i = 0; i < nr; i++) {
+			switch (batch[i].user_data) {
+			case SMBD_SMB2_URING_OP_RECV:
+				status = smbd_smb2_uring_complete_recv(
+					ur, &batch[i]);
+				break;
+			case SMBD_SMB2_URING_OP_SEND:
+				status = smbd_smb2_uring_complete_send(
+					ur, &batch[i]);
+				break;
+			default:
+				status = NT_STATUS_INTERNAL_ERROR;
+				break;
+			}
+			if (!NT_STATUS_IS_OK(status)) {
+				goto fail;
+			}
+			if (ur->stopped) {
+				goto done;
+			}
+		}
+	}
+
+	if (ur->stopped) {
+		goto done;
+	}
+
+	status = smbd_smb2_uring_recv_deliver(ur);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
+	if (ur->stopped) {
+		goto done;
+	}
+
+	status = smbd_smb2_uring_recv_arm(ur);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
+
+	ur->busy = false;
+	status = smbd_smb2_uring_submit(ur);
+	if (!NT_STATUS_IS_OK(status)) {
+		ur->error_fn(status, ur->private_data);
+	}
+	return;
+
+done:
+	ur->busy = false;
+	return;
+
+fail:
+	ur->busy = false;
+	ur->error_fn(status, ur->private_data);
+}
@@ -0,0 +1,69 @@
+/*
+   Unix SMB/CIFS implementation.
+   io_uring based socket transport for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SMBD_SMB2_URING_H_
+#define _SMBD_SMB2_URING_H_
+
+/*
+ * Maximum number of iovecs handed to a single sendmsg SQE.
+ * Entries of the send queue are gathered into one sendmsg
+ * until this limit is reached.
+ */
+#define SMBD_SMB2_URING_MAX_IOV 128
+
+struct smbd_smb2_uring;
+
+/*
+ * Called with data received from the socket. The callee
+ * consumes as much as it wants and reports that in
+ * *consumed. Unconsumed data is kept and handed over again
+ * after smbd_smb2_uring_recv_resume() was called.
+ */
+typedef NTSTATUS (*smbd_smb2_uring_recv_fn)(const uint8_t *buf,
+					     size_t len,
+					     size_t *consumed,
+					     void *private_data);
+/*
+ * Called when a sendmsg SQE submitted via smbd_smb2_uring_sendv()
+ * completed, nwritten is always > 0.
+ */
+typedef NTSTATUS (*smbd_smb2_uring_sent_fn)(size_t nwritten,
+					     void *private_data);
+/*
+ * Called as the very last action of the completion handler
+ * if the transport or one of the callbacks failed.
+ */
+typedef void (*smbd_smb2_uring_error_fn)(NTSTATUS status,
+					 void *private_data);
+
+NTSTATUS smbd_smb2_uring_create(TALLOC_CTX *mem_ctx,
+				struct tevent_context *ev,
+				int sock,
+				smbd_smb2_uring_recv_fn recv_fn,
+				smbd_smb2_uring_sent_fn sent_fn,
+				smbd_smb2_uring_error_fn error_fn,
+				void *private_data,
+				struct smbd_smb2_uring **_ur);
+bool smbd_smb2_uring_send_busy(const struct smbd_smb2_uring *ur);
+NTSTATUS smbd_smb2_uring_sendv(struct smbd_smb2_uring *ur,
+			       const struct iovec *iov,
+			       int iovcnt);
+void smbd_smb2_uring_recv_resume(struct smbd_smb2_uring *ur);
+void smbd_smb2_uring_shutdown(struct smbd_smb2_uring *ur);
+
+#endif /* _SMBD_SMB2_URING_H_ */
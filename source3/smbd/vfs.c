@@ -1220,6 +1220,23 @@ void _smb_vfs_deny_pop(struct smb_vfs_deny_state *state, const char *location)
 	} \
 } while(0)
 
+/*
+ * Like VFS_FIND, but stop at the first module implementing either the
+ * async or the sync flavour of an operation. Modules that only
+ * override the sync call must not be bypassed by async callers.
+ */
+#define VFS_FIND_ASYNC(__fn__) do { \
+	if (unlikely(smb_vfs_deny_global != NULL)) { \
+		DBG_ERR("Called with VFS denied by %s\n", \
+			smb_vfs_deny_global->location); \
+		smb_panic("Called with VFS denied!"); \
+	} \
+	while ((handle->fns->__fn__##_send_fn == NULL) && \
+	       (handle->fns->__fn__##_fn == NULL)) { \
+		handle = handle->next; \
+	} \
+} while(0)
+
 int smb_vfs_call_connect(struct vfs_handle_struct *handle,
 			 const char *service, const char *user)
 {
@@ -1379,6 +1396,108 @@ void smb_vfs_call_rewind_dir(struct vfs_handle_struct *handle,
 	handle->fns->rewind_dir_fn(handle, dirp);
 }
 
+/*
+ * Common state for the async namespace operations (mkdirat, renameat,
+ * unlinkat, linkat) and close. They all return an int and a
+ * vfs_aio_state.
+ *
+ * The directory fsps passed in are usually pathref fsps without a
+ * vuid, so unlike getxattrat we can't change back to the user here.
+ * Callers have to restore their user context in their callback.
+ */
+struct smb_vfs_call_nsop_state {
+	int (*recv_fn)(struct tevent_req *req,
+		       struct vfs_aio_state *aio_state);
+	int retval;
+	struct vfs_aio_state aio_state;
+};
+
+static void smb_vfs_call_nsop_done(struct tevent_req *subreq);
+
+static struct tevent_req *smb_vfs_call_nsop_create(
+	TALLOC_CTX *mem_ctx,
+	struct smb_vfs_call_nsop_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smb_vfs_call_nsop_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*pstate = state;
+	return req;
+}
+
+/*
+ * The module found only implements the sync call: report its result
+ * through the request.
+ */
+static struct tevent_req *smb_vfs_call_nsop_sync_done(
+	struct tevent_req *req,
+	struct tevent_context *ev,
+	int ret)
+{
+	struct smb_vfs_call_nsop_state *state = tevent_req_data(
+		req, struct smb_vfs_call_nsop_state);
+
+	state->retval = ret;
+	if (ret == -1) {
+		state->aio_state.error = errno;
+		tevent_req_error(req, errno);
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_done(req);
+	return tevent_req_post(req, ev);
+}
+
+static struct tevent_req *smb_vfs_call_nsop_wait(
+	struct tevent_req *req,
+	struct tevent_context *ev,
+	struct tevent_req *subreq)
+{
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_defer_callback(req, ev);
+	tevent_req_set_callback(subreq, smb_vfs_call_nsop_done, req);
+	return req;
+}
+
+static void smb_vfs_call_nsop_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smb_vfs_call_nsop_state *state = tevent_req_data(
+		req, struct smb_vfs_call_nsop_state);
+
+	state->retval = state->recv_fn(subreq, &state->aio_state);
+	TALLOC_FREE(subreq);
+	if (state->retval == -1) {
+		tevent_req_error(req, state->aio_state.error);
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static int smb_vfs_call_nsop_recv(struct tevent_req *req,
+				  struct vfs_aio_state *aio_state)
+{
+	struct smb_vfs_call_nsop_state *state = tevent_req_data(
+		req, struct smb_vfs_call_nsop_state);
+	int retval;
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+	*aio_state = state->aio_state;
+	retval = state->retval;
+	tevent_req_received(req);
+	return retval;
+}
+
 int smb_vfs_call_mkdirat(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
@@ -1391,6 +1510,47 @@ int smb_vfs_call_mkdirat(struct vfs_handle_struct *handle,
 			mode);
 }
 
+struct tevent_req *smb_vfs_call_mkdirat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			mode_t mode)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	req = smb_vfs_call_nsop_create(mem_ctx, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	VFS_FIND_ASYNC(mkdirat);
+
+	if (handle->fns->mkdirat_send_fn == NULL) {
+		ret = handle->fns->mkdirat_fn(handle, dirfsp, smb_fname, mode);
+		return smb_vfs_call_nsop_sync_done(req, ev, ret);
+	}
+
+	state->recv_fn = handle->fns->mkdirat_recv_fn;
+	subreq = handle->fns->mkdirat_send_fn(state,
+					      ev,
+					      handle,
+					      dirfsp,
+					      smb_fname,
+					      mode);
+	return smb_vfs_call_nsop_wait(req, ev, subreq);
+}
+
+int smb_vfs_call_mkdirat_recv(struct tevent_req *req,
+			      struct vfs_aio_state *aio_state)
+{
+	return smb_vfs_call_nsop_recv(req, aio_state);
+}
+
 int smb_vfs_call_closedir(struct vfs_handle_struct *handle,
 			  DIR *dir)
 {
@@ -1448,6 +1608,39 @@ int smb_vfs_call_close(struct vfs_handle_struct *handle,
 	return handle->fns->close_fn(handle, fsp);
 }
 
+struct tevent_req *smb_vfs_call_close_send(struct vfs_handle_struct *handle,
+					   TALLOC_CTX *mem_ctx,
+					   struct tevent_context *ev,
+					   struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	req = smb_vfs_call_nsop_create(mem_ctx, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	VFS_FIND_ASYNC(close);
+
+	if (handle->fns->close_send_fn == NULL) {
+		ret = handle->fns->close_fn(handle, fsp);
+		return smb_vfs_call_nsop_sync_done(req, ev, ret);
+	}
+
+	state->recv_fn = handle->fns->close_recv_fn;
+	subreq = handle->fns->close_send_fn(handle, state, ev, fsp);
+	return smb_vfs_call_nsop_wait(req, ev, subreq);
+}
+
+int smb_vfs_call_close_recv(struct tevent_req *req,
+			    struct vfs_aio_state *aio_state)
+{
+	return smb_vfs_call_nsop_recv(req, aio_state);
+}
+
 ssize_t smb_vfs_call_pread(struct vfs_handle_struct *handle,
 			   struct files_struct *fsp, void *data, size_t n,
 			   off_t offset)
@@ -1617,6 +1810,15 @@ ssize_t smb_vfs_call_sendfile(struct vfs_handle_struct *handle, int tofd,
 					count);
 }
 
+int smb_vfs_call_splice_read_fd(struct vfs_handle_struct *handle,
+				struct files_struct *fsp,
+				off_t offset,
+				size_t count)
+{
+	VFS_FIND(splice_read_fd);
+	return handle->fns->splice_read_fd_fn(handle, fsp, offset, count);
+}
+
 ssize_t smb_vfs_call_recvfile(struct vfs_handle_struct *handle, int fromfd,
 			      files_struct *tofsp, off_t offset,
 			      size_t count)
@@ -1641,6 +1843,56 @@ int smb_vfs_call_renameat(struct vfs_handle_struct *handle,
 				how);
 }
 
+struct tevent_req *smb_vfs_call_renameat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *srcfsp,
+			const struct smb_filename *smb_fname_src,
+			files_struct *dstfsp,
+			const struct smb_filename *smb_fname_dst,
+			const struct vfs_rename_how *how)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	req = smb_vfs_call_nsop_create(mem_ctx, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	VFS_FIND_ASYNC(renameat);
+
+	if (handle->fns->renameat_send_fn == NULL) {
+		ret = handle->fns->renameat_fn(handle,
+					       srcfsp,
+					       smb_fname_src,
+					       dstfsp,
+					       smb_fname_dst,
+					       how);
+		return smb_vfs_call_nsop_sync_done(req, ev, ret);
+	}
+
+	state->recv_fn = handle->fns->renameat_recv_fn;
+	subreq = handle->fns->renameat_send_fn(state,
+					       ev,
+					       handle,
+					       srcfsp,
+					       smb_fname_src,
+					       dstfsp,
+					       smb_fname_dst,
+					       how);
+	return smb_vfs_call_nsop_wait(req, ev, subreq);
+}
+
+int smb_vfs_call_renameat_recv(struct tevent_req *req,
+			       struct vfs_aio_state *aio_state)
+{
+	return smb_vfs_call_nsop_recv(req, aio_state);
+}
+
 int smb_vfs_call_rename_stream(struct vfs_handle_struct *handle,
 			       struct files_struct *src_fsp,
 			       const char *dst_name,
@@ -1758,6 +2010,13 @@ int smb_vfs_fsync_sync(files_struct *fsp)
 	return ret;
 }
 
+NTSTATUS smb_vfs_call_flush_cached_writes(struct vfs_handle_struct *handle,
+					  struct files_struct *fsp)
+{
+	VFS_FIND(flush_cached_writes);
+	return handle->fns->flush_cached_writes_fn(handle, fsp);
+}
+
 int smb_vfs_call_stat(struct vfs_handle_struct *handle,
 		      struct smb_filename *smb_fname)
 {
@@ -1810,6 +2069,47 @@ int smb_vfs_call_unlinkat(struct vfs_handle_struct *handle,
 			flags);
 }
 
+struct tevent_req *smb_vfs_call_unlinkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *dirfsp,
+			const struct smb_filename *smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	req = smb_vfs_call_nsop_create(mem_ctx, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	VFS_FIND_ASYNC(unlinkat);
+
+	if (handle->fns->unlinkat_send_fn == NULL) {
+		ret = handle->fns->unlinkat_fn(handle, dirfsp, smb_fname, flags);
+		return smb_vfs_call_nsop_sync_done(req, ev, ret);
+	}
+
+	state->recv_fn = handle->fns->unlinkat_recv_fn;
+	subreq = handle->fns->unlinkat_send_fn(state,
+					       ev,
+					       handle,
+					       dirfsp,
+					       smb_fname,
+					       flags);
+	return smb_vfs_call_nsop_wait(req, ev, subreq);
+}
+
+int smb_vfs_call_unlinkat_recv(struct tevent_req *req,
+			       struct vfs_aio_state *aio_state)
+{
+	return smb_vfs_call_nsop_recv(req, aio_state);
+}
+
 int smb_vfs_call_fchmod(struct vfs_handle_struct *handle,
 			struct files_struct *fsp, mode_t mode)
 {
@@ -1941,6 +2241,56 @@ int smb_vfs_call_linkat(struct vfs_handle_struct *handle,
 				flags);
 }
 
+struct tevent_req *smb_vfs_call_linkat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			struct files_struct *srcfsp,
+			const struct smb_filename *old_smb_fname,
+			struct files_struct *dstfsp,
+			const struct smb_filename *new_smb_fname,
+			int flags)
+{
+	struct tevent_req *req = NULL;
+	struct smb_vfs_call_nsop_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	req = smb_vfs_call_nsop_create(mem_ctx, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	VFS_FIND_ASYNC(linkat);
+
+	if (handle->fns->linkat_send_fn == NULL) {
+		ret = handle->fns->linkat_fn(handle,
+					     srcfsp,
+					     old_smb_fname,
+					     dstfsp,
+					     new_smb_fname,
+					     flags);
+		return smb_vfs_call_nsop_sync_done(req, ev, ret);
+	}
+
+	state->recv_fn = handle->fns->linkat_recv_fn;
+	subreq = handle->fns->linkat_send_fn(state,
+					     ev,
+					     handle,
+					     srcfsp,
+					     old_smb_fname,
+					     dstfsp,
+					     new_smb_fname,
+					     flags);
+	return smb_vfs_call_nsop_wait(req, ev, subreq);
+}
+
+int smb_vfs_call_linkat_recv(struct tevent_req *req,
+			     struct vfs_aio_state *aio_state)
+{
+	return smb_vfs_call_nsop_recv(req, aio_state);
+}
+
 int smb_vfs_call_mknodat(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
 			const struct smb_filename *smb_fname,
@@ -0,0 +1,593 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Tests for vfs_write_behind in relaxed durability mode
+
+   Copyright (C) Samba Team 2026
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "libcli/smb2/smb2.h"
+#include "libcli/smb2/smb2_calls.h"
+#include "torture/torture.h"
+#include "torture/util.h"
+#include "torture/smb2/proto.h"
+#include "torture/smb2/lease_break_handler.h"
+#include "torture/vfs/proto.h"
+#include "librpc/gen_ndr/ndr_ioctl.h"
+
+/*
+ * The share is expected to run write_behind with
+ * "write_behind:durability = relaxed" and a "write_behind:delay" long
+ * enough that nothing is written out behind the tests' back: every
+ * write done under an RWH lease below stays buffered in smbd until
+ * something forces it out.
+ */
+
+#define BASEDIR "write_behind"
+
+static const uint64_t WB_LEASE1 = 0x5752495445424548ull;
+static const uint64_t WB_LEASE2 = 0x424548494e443232ull;
+
+static void wb_fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = (uint8_t)(seed + i * 7);
+	}
+}
+
+static bool wb_open_lease(struct torture_context *tctx,
+			  struct smb2_tree *tree,
+			  const char *fname,
+			  uint64_t lease_key,
+			  struct smb2_handle *h)
+{
+	struct smb2_create io;
+	struct smb2_lease ls;
+	NTSTATUS status;
+
+	smb2_lease_create(&io, &ls, false, fname, lease_key,
+			  smb2_util_lease_state("RHW"));
+	status = smb2_create(tree, tctx, &io);
+	torture_assert_ntstatus_ok(tctx, status, "smb2_create");
+	torture_assert_int_equal(tctx, io.out.oplock_level,
+				 SMB2_OPLOCK_LEVEL_LEASE, "oplock level");
+	torture_assert_int_equal(tctx, io.out.lease_response.lease_state,
+				 smb2_util_lease_state("RHW"),
+				 "lease state");
+
+	*h = io.out.file.handle;
+	return true;
+}
+
+static bool wb_check_read(struct torture_context *tctx,
+			  struct smb2_tree *tree,
+			  struct smb2_handle h,
+			  uint64_t offset,
+			  const uint8_t *expected,
+			  size_t len)
+{
+	struct smb2_read r = {
+		.in.file.handle = h,
+		.in.offset = offset,
+		.in.length = len,
+	};
+	NTSTATUS status;
+
+	status = smb2_read(tree, tctx, &r);
+	torture_assert_ntstatus_ok(tctx, status, "smb2_read");
+	torture_assert_int_equal(tctx, r.out.data.length, len,
+				 "short read");
+	torture_assert_mem_equal(tctx, r.out.data.data, expected, len,
+				 "read data mismatch");
+
+	TALLOC_FREE(r.out.data.data);
+	return true;
+}
+
+static bool wb_check_size(struct torture_context *tctx,
+			  struct smb2_tree *tree,
+			  struct smb2_handle h,
+			  uint64_t size)
+{
+	union smb_fileinfo finfo = {
+		.generic.level = RAW_FILEINFO_STANDARD_INFORMATION,
+		.generic.in.file.handle = h,
+	};
+	NTSTATUS status;
+
+	status = smb2_getinfo_file(tree, tctx, &finfo);
+	torture_assert_ntstatus_ok(tctx, status, "smb2_getinfo_file");
+	torture_assert_u64_equal(tctx, finfo.standard_info.out.size, size,
+				 "file size");
+	return true;
+}
+
+static bool wb_set_eof(struct torture_context *tctx,
+		       struct smb2_tree *tree,
+		       struct smb2_handle h,
+		       uint64_t size)
+{
+	union smb_setfileinfo sinfo = {
+		.end_of_file_info.level =
+			RAW_SFILEINFO_END_OF_FILE_INFORMATION,
+		.end_of_file_info.in.file.handle = h,
+		.end_of_file_info.in.size = size,
+	};
+	NTSTATUS status;
+
+	status = smb2_setinfo_file(tree, &sinfo);
+	torture_assert_ntstatus_ok(tctx, status, "smb2_setinfo_file");
+	return true;
+}
+
+/*
+ * Reads have to see buffered data, both on the writing handle and on
+ * another handle sharing the lease, including the zeros between the
+ * old EOF and a buffer beyond it.
+ */
+static bool test_write_behind_read_after_write(struct torture_context *tctx,
+					       struct smb2_tree *tree)
+{
+	const char *fname = BASEDIR "\\read_after_write.dat";
+	struct smb2_handle h1 = {{0}};
+	struct smb2_handle h2 = {{0}};
+	struct smb2_handle h3 = {{0}};
+	uint8_t data[8192];
+	uint8_t tail[100];
+	uint8_t more[512];
+	uint8_t zeros[8192] = {0};
+	NTSTATUS status;
+	bool ret = true;
+	bool ok;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h3);
+	torture_assert_ntstatus_ok(tctx, status, "torture_smb2_testdir");
+	smb2_util_close(tree, h3);
+	ZERO_STRUCT(h3);
+
+	wb_fill(data, sizeof(data), 1);
+	wb_fill(tail, sizeof(tail), 2);
+	wb_fill(more, sizeof(more), 3);
+
+	ok = wb_open_lease(tctx, tree, fname, WB_LEASE1, &h1);
+	torture_assert_goto(tctx, ok, ret, done, "open h1");
+
+	status = smb2_util_write(tree, h1, data, 0, 4096);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 1");
+	status = smb2_util_write(tree, h1, data + 4096, 4096, 4096);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 2");
+
+	ok = wb_check_read(tctx, tree, h1, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read back on h1");
+
+	/* Not adjacent: issues the first buffer and starts another one */
+	status = smb2_util_write(tree, h1, tail, 16384, sizeof(tail));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 3");
+
+	ok = wb_check_size(tctx, tree, h1, 16384 + sizeof(tail));
+	torture_assert_goto(tctx, ok, ret, done, "size on h1");
+	ok = wb_check_read(tctx, tree, h1, 8192, zeros, sizeof(zeros));
+	torture_assert_goto(tctx, ok, ret, done, "hole on h1");
+	ok = wb_check_read(tctx, tree, h1, 16384, tail, sizeof(tail));
+	torture_assert_goto(tctx, ok, ret, done, "tail on h1");
+
+	ok = wb_open_lease(tctx, tree, fname, WB_LEASE1, &h2);
+	torture_assert_goto(tctx, ok, ret, done, "open h2");
+
+	ok = wb_check_read(tctx, tree, h2, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read back on h2");
+	ok = wb_check_read(tctx, tree, h2, 16384, tail, sizeof(tail));
+	torture_assert_goto(tctx, ok, ret, done, "tail on h2");
+
+	/* And the other way round */
+	status = smb2_util_write(tree, h2, more, 1024, sizeof(more));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 4");
+	memcpy(data + 1024, more, sizeof(more));
+
+	ok = wb_check_read(tctx, tree, h1, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "h2 write on h1");
+
+	status = smb2_util_close(tree, h1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "close h1");
+	ZERO_STRUCT(h1);
+	status = smb2_util_close(tree, h2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "close h2");
+	ZERO_STRUCT(h2);
+
+	status = torture_smb2_open(tree, fname, SEC_FILE_READ_DATA |
+				   SEC_FILE_READ_ATTRIBUTE, &h3);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "reopen");
+	ok = wb_check_read(tctx, tree, h3, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read after close");
+	ok = wb_check_read(tctx, tree, h3, 16384, tail, sizeof(tail));
+	torture_assert_goto(tctx, ok, ret, done, "tail after close");
+
+done:
+	if (!smb2_util_handle_empty(h1)) {
+		smb2_util_close(tree, h1);
+	}
+	if (!smb2_util_handle_empty(h2)) {
+		smb2_util_close(tree, h2);
+	}
+	if (!smb2_util_handle_empty(h3)) {
+		smb2_util_close(tree, h3);
+	}
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
+/*
+ * A second client breaking the write lease has to see what the lease
+ * holder wrote.
+ */
+static bool test_write_behind_break(struct torture_context *tctx,
+				    struct smb2_tree *tree)
+{
+	const char *fname = BASEDIR "\\break.dat";
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_create io;
+	struct smb2_lease ls;
+	struct smb2_handle h1 = {{0}};
+	struct smb2_handle h2 = {{0}};
+	uint8_t data[65536];
+	NTSTATUS status;
+	bool ret = true;
+	bool ok;
+
+	tree->session->transport->lease.handler = torture_lease_handler;
+	tree->session->transport->lease.private_data = tree;
+	torture_reset_lease_break_info(tctx, &lease_break_info);
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h2);
+	torture_assert_ntstatus_ok(tctx, status, "torture_smb2_testdir");
+	smb2_util_close(tree, h2);
+	ZERO_STRUCT(h2);
+
+	ok = torture_smb2_connection(tctx, &tree2);
+	torture_assert(tctx, ok, "second connection");
+
+	wb_fill(data, sizeof(data), 4);
+
+	ok = wb_open_lease(tctx, tree, fname, WB_LEASE1, &h1);
+	torture_assert_goto(tctx, ok, ret, done, "open h1");
+
+	status = smb2_util_write(tree, h1, data, 0, 32768);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 1");
+	status = smb2_util_write(tree, h1, data + 32768, 32768, 32768);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 2");
+
+	smb2_lease_create(&io, &ls, false, fname, WB_LEASE2,
+			  smb2_util_lease_state("RH"));
+	status = smb2_create(tree2, tctx, &io);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"open on second client");
+	h2 = io.out.file.handle;
+
+	torture_wait_for_lease_break(tctx);
+	torture_assert_int_equal_goto(tctx, lease_break_info.count, 1,
+				      ret, done, "lease break count");
+	torture_assert_int_equal_goto(tctx, lease_break_info.failures, 0,
+				      ret, done, "lease break failures");
+
+	ok = wb_check_size(tctx, tree2, h2, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "size on second client");
+	ok = wb_check_read(tctx, tree2, h2, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read on second client");
+
+done:
+	if (!smb2_util_handle_empty(h1)) {
+		smb2_util_close(tree, h1);
+	}
+	if (tree2 != NULL) {
+		if (!smb2_util_handle_empty(h2)) {
+			smb2_util_close(tree2, h2);
+		}
+		TALLOC_FREE(tree2);
+	}
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
+/*
+ * A failed write-out is reported by the next FLUSH, and by CLOSE when
+ * nothing flushed the handle before. Needs the share from
+ * torture:error_inject_share to stack error_inject below write_behind,
+ * configured through the file in torture:error_inject_conf.
+ */
+static bool test_write_behind_flush_close_error(struct torture_context *tctx,
+						struct smb2_tree *tree)
+{
+	const char *share = torture_setting_string(
+		tctx, "error_inject_share", NULL);
+	const char *conf = torture_setting_string(
+		tctx, "error_inject_conf", NULL);
+	const char *fname = "write_behind_error.dat";
+	const char *inject = "error_inject:pwrite = EROFS\n";
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_handle h = {{0}};
+	struct smb2_flush f = {};
+	struct smb2_close cl = {};
+	uint8_t data[4096];
+	NTSTATUS status;
+	bool ret = true;
+	bool ok;
+
+	if ((share == NULL) || (conf == NULL)) {
+		torture_skip(tctx, "Need torture:error_inject_share and "
+			     "torture:error_inject_conf\n");
+	}
+
+	wb_fill(data, sizeof(data), 5);
+
+	/* A new connection reloads the configuration */
+	ok = file_save(conf, inject, strlen(inject));
+	torture_assert(tctx, ok, "file_save");
+
+	ok = torture_smb2_con_share(tctx, share, &tree2);
+	torture_assert_goto(tctx, ok, ret, done, "torture_smb2_con_share");
+
+	smb2_util_unlink(tree2, fname);
+
+	ok = wb_open_lease(tctx, tree2, fname, WB_LEASE1, &h);
+	torture_assert_goto(tctx, ok, ret, done, "open");
+
+	/* Buffered, the error only shows up when it's written out */
+	status = smb2_util_write(tree2, h, data, 0, sizeof(data));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 1");
+
+	f.in.file.handle = h;
+	status = smb2_flush(tree2, &f);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_MEDIA_WRITE_PROTECTED,
+					   ret, done, "flush");
+
+	status = smb2_util_write(tree2, h, data, 0, sizeof(data));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write 2");
+
+	cl.in.file.handle = h;
+	status = smb2_close(tree2, &cl);
+	ZERO_STRUCT(h);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_MEDIA_WRITE_PROTECTED,
+					   ret, done, "close");
+
+done:
+	file_save(conf, "", 0);
+	if (tree2 != NULL) {
+		if (!smb2_util_handle_empty(h)) {
+			smb2_util_close(tree2, h);
+		}
+		smb2_util_unlink(tree2, fname);
+		TALLOC_FREE(tree2);
+	}
+	return ret;
+}
+
+/*
+ * Truncating has to cut buffered data, and extending again has to
+ * leave zeros behind, not the data that was cut.
+ */
+static bool test_write_behind_truncate(struct torture_context *tctx,
+				       struct smb2_tree *tree)
+{
+	const char *fname = BASEDIR "\\truncate.dat";
+	struct smb2_handle h = {{0}};
+	struct smb2_read r = {};
+	uint8_t data[8192];
+	uint8_t zeros[4096] = {0};
+	NTSTATUS status;
+	bool ret = true;
+	bool ok;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	torture_assert_ntstatus_ok(tctx, status, "torture_smb2_testdir");
+	smb2_util_close(tree, h);
+	ZERO_STRUCT(h);
+
+	wb_fill(data, sizeof(data), 6);
+
+	ok = wb_open_lease(tctx, tree, fname, WB_LEASE1, &h);
+	torture_assert_goto(tctx, ok, ret, done, "open");
+
+	status = smb2_util_write(tree, h, data, 0, sizeof(data));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write");
+
+	ok = wb_set_eof(tctx, tree, h, 4096);
+	torture_assert_goto(tctx, ok, ret, done, "truncate");
+	ok = wb_check_size(tctx, tree, h, 4096);
+	torture_assert_goto(tctx, ok, ret, done, "size after truncate");
+	ok = wb_check_read(tctx, tree, h, 0, data, 4096);
+	torture_assert_goto(tctx, ok, ret, done, "read after truncate");
+
+	r.in.file.handle = h;
+	r.in.offset = 4096;
+	r.in.length = 4096;
+	status = smb2_read(tree, tctx, &r);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_END_OF_FILE,
+					   ret, done, "read beyond EOF");
+
+	ok = wb_set_eof(tctx, tree, h, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "extend");
+	ok = wb_check_read(tctx, tree, h, 4096, zeros, sizeof(zeros));
+	torture_assert_goto(tctx, ok, ret, done, "read after extend");
+
+	status = smb2_util_close(tree, h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "close");
+	ZERO_STRUCT(h);
+
+	status = torture_smb2_open(tree, fname, SEC_FILE_READ_DATA |
+				   SEC_FILE_READ_ATTRIBUTE, &h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "reopen");
+	ok = wb_check_size(tctx, tree, h, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "size after close");
+	ok = wb_check_read(tctx, tree, h, 0, data, 4096);
+	torture_assert_goto(tctx, ok, ret, done, "head after close");
+	ok = wb_check_read(tctx, tree, h, 4096, zeros, sizeof(zeros));
+	torture_assert_goto(tctx, ok, ret, done, "zeros after close");
+
+done:
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
+/*
+ * A server-side copy has to read the buffered source data, and its
+ * result must not be overwritten by data buffered on the destination
+ * before the copy.
+ */
+static bool test_write_behind_copychunk(struct torture_context *tctx,
+					struct smb2_tree *tree)
+{
+	const char *src_name = BASEDIR "\\copy_src.dat";
+	const char *dst_name = BASEDIR "\\copy_dst.dat";
+	struct smb2_handle src_h = {{0}};
+	struct smb2_handle dst_h = {{0}};
+	union smb_ioctl io;
+	struct req_resume_key_rsp res_key;
+	struct srv_copychunk_copy cc_copy;
+	struct srv_copychunk_rsp cc_rsp;
+	enum ndr_err_code ndr_ret;
+	uint8_t data[8192];
+	uint8_t junk[4096];
+	NTSTATUS status;
+	bool ret = true;
+	bool ok;
+
+	smb2_deltree(tree, BASEDIR);
+	status = torture_smb2_testdir(tree, BASEDIR, &src_h);
+	torture_assert_ntstatus_ok(tctx, status, "torture_smb2_testdir");
+	smb2_util_close(tree, src_h);
+	ZERO_STRUCT(src_h);
+
+	wb_fill(data, sizeof(data), 7);
+	memset(junk, 'x', sizeof(junk));
+
+	ok = wb_open_lease(tctx, tree, src_name, WB_LEASE1, &src_h);
+	torture_assert_goto(tctx, ok, ret, done, "open src");
+	ok = wb_open_lease(tctx, tree, dst_name, WB_LEASE2, &dst_h);
+	torture_assert_goto(tctx, ok, ret, done, "open dst");
+
+	status = smb2_util_write(tree, src_h, data, 0, sizeof(data));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write src");
+	status = smb2_util_write(tree, dst_h, junk, 0, sizeof(junk));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write dst");
+
+	ZERO_STRUCT(io);
+	io.smb2.level = RAW_IOCTL_SMB2;
+	io.smb2.in.file.handle = src_h;
+	io.smb2.in.function = FSCTL_SRV_REQUEST_RESUME_KEY;
+	/* Allow for Key + ContextLength + Context */
+	io.smb2.in.max_output_response = 32;
+	io.smb2.in.flags = SMB2_IOCTL_FLAG_IS_FSCTL;
+
+	status = smb2_ioctl(tree, tctx, &io.smb2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"FSCTL_SRV_REQUEST_RESUME_KEY");
+
+	ndr_ret = ndr_pull_struct_blob(&io.smb2.out.out, tctx, &res_key,
+			(ndr_pull_flags_fn_t)ndr_pull_req_resume_key_rsp);
+	torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+					"ndr_pull_req_resume_key_rsp");
+
+	ZERO_STRUCT(cc_copy);
+	memcpy(cc_copy.source_key, res_key.resume_key,
+	       ARRAY_SIZE(cc_copy.source_key));
+	cc_copy.chunk_count = 1;
+	cc_copy.chunks = talloc_zero_array(tctx, struct srv_copychunk, 1);
+	torture_assert_goto(tctx, cc_copy.chunks != NULL, ret, done,
+			    "talloc_zero_array");
+	cc_copy.chunks[0].source_off = 0;
+	cc_copy.chunks[0].target_off = 0;
+	cc_copy.chunks[0].length = sizeof(data);
+
+	ZERO_STRUCT(io);
+	io.smb2.level = RAW_IOCTL_SMB2;
+	io.smb2.in.file.handle = dst_h;
+	io.smb2.in.function = FSCTL_SRV_COPYCHUNK;
+	io.smb2.in.max_output_response = sizeof(struct srv_copychunk_rsp);
+	io.smb2.in.flags = SMB2_IOCTL_FLAG_IS_FSCTL;
+
+	ndr_ret = ndr_push_struct_blob(&io.smb2.in.out, tctx, &cc_copy,
+			(ndr_push_flags_fn_t)ndr_push_srv_copychunk_copy);
+	torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+					"ndr_push_srv_copychunk_copy");
+
+	status = smb2_ioctl(tree, tctx, &io.smb2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"FSCTL_SRV_COPYCHUNK");
+
+	ndr_ret = ndr_pull_struct_blob(&io.smb2.out.out, tctx, &cc_rsp,
+			(ndr_pull_flags_fn_t)ndr_pull_srv_copychunk_rsp);
+	torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+					"ndr_pull_srv_copychunk_rsp");
+	torture_assert_int_equal_goto(tctx, cc_rsp.total_bytes_written,
+				      sizeof(data), ret, done,
+				      "copied bytes");
+
+	ok = wb_check_read(tctx, tree, dst_h, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read dst");
+
+	status = smb2_util_close(tree, dst_h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "close dst");
+	ZERO_STRUCT(dst_h);
+
+	status = torture_smb2_open(tree, dst_name, SEC_FILE_READ_DATA |
+				   SEC_FILE_READ_ATTRIBUTE, &dst_h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "reopen");
+	ok = wb_check_read(tctx, tree, dst_h, 0, data, sizeof(data));
+	torture_assert_goto(tctx, ok, ret, done, "read dst after close");
+
+done:
+	if (!smb2_util_handle_empty(src_h)) {
+		smb2_util_close(tree, src_h);
+	}
+	if (!smb2_util_handle_empty(dst_h)) {
+		smb2_util_close(tree, dst_h);
+	}
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
+struct torture_suite *torture_vfs_write_behind(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(
+		ctx, "write_behind");
+
+	torture_suite_add_1smb2_test(suite, "read_after_write",
+				     test_write_behind_read_after_write);
+	torture_suite_add_1smb2_test(suite, "break",
+				     test_write_behind_break);
+	torture_suite_add_1smb2_test(suite, "flush_close_error",
+				     test_write_behind_flush_close_error);
+	torture_suite_add_1smb2_test(suite, "truncate",
+				     test_write_behind_truncate);
+	torture_suite_add_1smb2_test(suite, "copychunk",
+				     test_write_behind_copychunk);
+
+	suite->description = talloc_strdup(suite, "vfs_write_behind tests");
+
+	return suite;
+}